@@ -15,8 +15,10 @@
 # =============================================================================
 
 import ctypes
+import json
 import os
 import sysconfig
+import tempfile
 import atexit
 
 
@@ -152,3 +154,71 @@ class HorovodBasics(object):
             raise ValueError(
                 'Horovod has not been initialized; use hvd.init().')
         return bool(mpi_threads_supported)
+
+    def metrics(self):
+        """A function that returns the runtime metrics of this process.
+
+        The metrics contain histograms of the negotiation time per cycle, the
+        time tensors wait in the queue, the size of fused allreduces, the
+        number of responses per cycle and the time spent waiting for ready
+        events, as well as the operations, bytes and bus bandwidth of every
+        backend. They are counted since `hvd.init()`.
+
+        Returns:
+          A dictionary with the metrics.
+        """
+        buffer_size = 0
+        buffer = None
+        while True:
+            length = self.MPI_LIB_CTYPES.horovod_get_metrics(buffer, buffer_size)
+            if length == -1:
+                raise ValueError(
+                    'Horovod has not been initialized; use hvd.init().')
+            if length < buffer_size:
+                return json.loads(buffer.value.decode('utf-8'))
+            # The metrics may grow between the calls.
+            buffer_size = length + 1024
+            buffer = ctypes.create_string_buffer(buffer_size)
+
+    def replay(self, recording, report=None):
+        """A function that replays the operations recorded by a job.
+
+        Every process replays the calls to allreduce, allgather, broadcast and
+        the other operations which the process of its rank made while
+        `HOROVOD_ENQUEUE_RECORDING` was set to `recording`, on zero filled
+        tensors in host memory and with the same time between them. This
+        measures the communication of a training job without its model, e.g.
+        to compare Horovod versions or settings. It has to be called by all
+        processes of a job with the same number of processes as the recorded
+        one.
+
+        Arguments:
+            recording: The value of `HOROVOD_ENQUEUE_RECORDING` while the job
+                       was recorded.
+            report: Optional name of a file to write the steps to as JSON.
+
+        Returns:
+          A list with a dictionary for every replayed step, holding the number
+          of tensors and bytes as well as the time of the step and the time its
+          communication took after its last operation was enqueued, in
+          microseconds.
+        """
+        fd, report_file = tempfile.mkstemp(suffix='.json')
+        os.close(fd)
+        try:
+            result = self.MPI_LIB_CTYPES.horovod_replay(
+                recording.encode('utf-8'), report_file.encode('utf-8'))
+            if result == -1:
+                raise ValueError(
+                    'Horovod has not been initialized; use hvd.init().')
+            if result < 0:
+                raise ValueError('Recording %s could not be replayed, see the '
+                                 'warning of Horovod.' % recording)
+            with open(report_file) as f:
+                steps = json.load(f)['steps']
+        finally:
+            os.remove(report_file)
+        if report is not None:
+            with open(report, 'w') as f:
+                json.dump({'steps': steps}, f)
+        return steps
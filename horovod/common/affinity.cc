@@ -0,0 +1,220 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+
+#if __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "affinity.h"
+
+namespace horovod {
+namespace common {
+
+namespace {
+
+// Memory policy which prefers a node, see set_mempolicy(2). Defined here so
+// that the headers of libnuma aren't needed.
+#define HOROVOD_MPOL_PREFERRED 1
+
+// Returns the first line of a sysfs file, or an empty string if it can't be
+// read.
+std::string ReadFirstLine(const std::string& path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+// Returns the NUMA node of a core, or -1 if it is unknown.
+int NumaNodeOfCore(int core) {
+  auto path = "/sys/devices/system/cpu/cpu" + std::to_string(core);
+  auto dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return -1;
+  }
+  int numa_node = -1;
+  while (auto entry = readdir(dir)) {
+    if (std::strncmp(entry->d_name, "node", 4) == 0 &&
+        std::isdigit((unsigned char)entry->d_name[4])) {
+      numa_node = (int)std::strtol(entry->d_name + 4, nullptr, 10);
+      break;
+    }
+  }
+  closedir(dir);
+  return numa_node;
+}
+
+// Returns the cores close to the PCI device with the given bus ID.
+std::vector<int> LocalCoresOfPciDevice(std::string pci_bus_id) {
+  // CUDA reports bus IDs in upper case, sysfs names them in lower case.
+  std::transform(pci_bus_id.begin(), pci_bus_id.end(), pci_bus_id.begin(),
+                 [](unsigned char c) { return (char)std::tolower(c); });
+  return ParseCpuList(
+      ReadFirstLine("/sys/bus/pci/devices/" + pci_bus_id + "/local_cpulist"));
+}
+
+// Returns the cores close to the first InfiniBand adapter by name.
+std::vector<int> LocalCoresOfInfiniband() {
+  auto dir = opendir("/sys/class/infiniband");
+  if (dir == nullptr) {
+    return {};
+  }
+  std::vector<std::string> adapters;
+  while (auto entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') {
+      adapters.emplace_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(adapters.begin(), adapters.end());
+  for (auto& adapter : adapters) {
+    auto cores = ParseCpuList(ReadFirstLine("/sys/class/infiniband/" +
+                                            adapter + "/device/local_cpulist"));
+    if (!cores.empty()) {
+      return cores;
+    }
+  }
+  return {};
+}
+
+} // namespace
+
+std::vector<int> ParseCpuList(const std::string& cpu_list) {
+  std::vector<int> cores;
+  size_t pos = 0;
+  while (pos < cpu_list.size()) {
+    auto end = cpu_list.find(',', pos);
+    if (end == std::string::npos) {
+      end = cpu_list.size();
+    }
+    auto range = cpu_list.substr(pos, end - pos);
+    pos = end + 1;
+
+    char* range_end;
+    long first = std::strtol(range.c_str(), &range_end, 10);
+    long last = first;
+    if (*range_end == '-') {
+      last = std::strtol(range_end + 1, &range_end, 10);
+    }
+    while (std::isspace((unsigned char)*range_end)) {
+      ++range_end;
+    }
+    if (range.empty() || *range_end != '\0' || first < 0 || last < first) {
+      return {};
+    }
+    for (long core = first; core <= last; ++core) {
+      cores.push_back((int)core);
+    }
+  }
+  return cores;
+}
+
+Status GetThreadPlacement(const std::string& affinity, int local_rank,
+                          const std::string& gpu_pci_bus_id,
+                          ThreadPlacement& placement) {
+  if (affinity == "auto") {
+    std::vector<int> local_cores;
+    if (!gpu_pci_bus_id.empty()) {
+      local_cores = LocalCoresOfPciDevice(gpu_pci_bus_id);
+    }
+    if (local_cores.empty()) {
+      local_cores = LocalCoresOfInfiniband();
+    }
+    if (local_cores.empty()) {
+      return Status::PreconditionError(
+          "Found no GPU or InfiniBand adapter with known local cores.");
+    }
+    // Threads of the framework usually start out on the first cores, so the
+    // background threads of the ranks close to the same device take the
+    // last ones.
+    placement.core = local_cores[local_cores.size() - 1 -
+                                 (size_t)local_rank % local_cores.size()];
+  } else {
+    auto cores = ParseCpuList(affinity);
+    if ((int)cores.size() <= local_rank) {
+      return Status::InvalidArgument("No core is given for local rank " +
+                                     std::to_string(local_rank) + " in \"" +
+                                     affinity + "\".");
+    }
+    placement.core = cores[local_rank];
+  }
+
+  placement.numa_node = NumaNodeOfCore(placement.core);
+  placement.node_cores.clear();
+  if (placement.numa_node >= 0) {
+    placement.node_cores = ParseCpuList(
+        ReadFirstLine("/sys/devices/system/node/node" +
+                      std::to_string(placement.numa_node) + "/cpulist"));
+  }
+  if (placement.node_cores.empty()) {
+    placement.numa_node = -1;
+  }
+  return Status::OK();
+}
+
+Status SetThreadAffinity(const std::vector<int>& cores) {
+#if __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (auto core : cores) {
+    if (core < 0 || core >= CPU_SETSIZE) {
+      return Status::InvalidArgument("Core " + std::to_string(core) +
+                                     " is out of range.");
+    }
+    CPU_SET(core, &cpu_set);
+  }
+  int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (result != 0) {
+    return Status::UnknownError(std::string("pthread_setaffinity_np failed: ") +
+                                std::strerror(result));
+  }
+  return Status::OK();
+#else
+  return Status::PreconditionError(
+      "Thread affinity is only supported on Linux.");
+#endif
+}
+
+Status SetPreferredNumaNode(int numa_node) {
+#if __linux__ && defined(SYS_set_mempolicy)
+  const size_t bits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> node_mask((size_t)numa_node / bits + 1);
+  node_mask[(size_t)numa_node / bits] |= 1UL << ((size_t)numa_node % bits);
+  // The kernel only looks at the first maxnode - 1 bits of the mask.
+  if (syscall(SYS_set_mempolicy, HOROVOD_MPOL_PREFERRED, node_mask.data(),
+              (unsigned long)(node_mask.size() * bits + 1)) != 0) {
+    return Status::UnknownError(std::string("set_mempolicy failed: ") +
+                                std::strerror(errno));
+  }
+  return Status::OK();
+#else
+  return Status::PreconditionError(
+      "NUMA memory policies are only supported on Linux.");
+#endif
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,65 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_AFFINITY_H
+#define HOROVOD_AFFINITY_H
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+namespace horovod {
+namespace common {
+
+// Cores and NUMA node that the threads of a rank are placed on.
+struct ThreadPlacement {
+  // Core of the background thread.
+  int core = -1;
+
+  // NUMA node of the core, and its cores, which the threads helping the
+  // background thread run on. The node is -1 and node_cores is empty if the
+  // NUMA topology is unknown.
+  int numa_node = -1;
+  std::vector<int> node_cores;
+};
+
+// Parses a list of cores such as "0-3,8,10-11" as used by sysfs.
+std::vector<int> ParseCpuList(const std::string& cpu_list);
+
+// Chooses the placement of the threads of a rank.
+//
+// Args:
+//  affinity: "auto" to choose a core close to the GPU with the given PCI bus
+//            ID, or to the first InfiniBand adapter if there is no GPU, or a
+//            comma separated list of cores indexed by local rank.
+//  local_rank: Rank of the process on its node.
+//  gpu_pci_bus_id: PCI bus ID of the GPU of the rank, or empty.
+Status GetThreadPlacement(const std::string& affinity, int local_rank,
+                          const std::string& gpu_pci_bus_id,
+                          ThreadPlacement& placement);
+
+// Restricts the calling thread to the given cores. Threads started by it
+// afterwards inherit them.
+Status SetThreadAffinity(const std::vector<int>& cores);
+
+// Makes the kernel prefer the NUMA node for memory first touched by the
+// calling thread and the threads it starts afterwards.
+Status SetPreferredNumaNode(int numa_node);
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_AFFINITY_H
@@ -101,5 +101,14 @@ int64_t TensorShape::num_elements() const {
   return result;
 }
 
+Status OpContext::AllocateOutput(int output_index, TensorShape shape,
+                                 std::shared_ptr<Tensor>* tensor) {
+  if (output_index != 0) {
+    return Status::PreconditionError(
+        "This operation context does not support multiple outputs.");
+  }
+  return AllocateOutput(shape, tensor);
+}
+
 } // namespace common
 } // namespace horovod
@@ -19,6 +19,10 @@
 #include <memory>
 #include <string>
 
+#if HAVE_CUDA
+#include <cuda_runtime.h>
+#endif
+
 #include "mpi_message.h"
 
 namespace horovod {
@@ -77,6 +81,11 @@ private:
 class ReadyEvent {
 public:
   virtual bool Ready() const = 0;
+#if HAVE_CUDA
+  // CUDA event which completes when the data is ready, or nullptr. If set,
+  // Horovod streams wait for the event on the GPU instead of polling Ready().
+  virtual cudaEvent_t CudaEvent() const { return nullptr; }
+#endif
   virtual ~ReadyEvent() = default;
 };
 
@@ -105,6 +114,10 @@ public:
                      std::shared_ptr<PersistentBuffer>* tensor) = 0;
   virtual Status AllocateOutput(TensorShape shape,
                                 std::shared_ptr<Tensor>* tensor) = 0;
+  // Allocates one of several outputs of the op. Contexts of ops with a single
+  // output only support output_index 0.
+  virtual Status AllocateOutput(int output_index, TensorShape shape,
+                                std::shared_ptr<Tensor>* tensor);
   virtual Framework framework() const = 0;
   virtual ~OpContext() = default;
 };
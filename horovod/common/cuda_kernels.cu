@@ -0,0 +1,239 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+
+#include <cuda_fp16.h>
+
+#include "cuda_kernels.h"
+
+namespace horovod {
+namespace common {
+
+namespace {
+
+#define BATCHED_KERNEL_THREADS_PER_BLOCK 256
+#define BATCHED_KERNEL_MAX_BLOCKS_PER_TENSOR 1024
+
+// Tensors of one launch of a batched kernel. Parameters are passed by value,
+// so that no memory has to be allocated or copied for them.
+struct BatchedCastParams {
+  const void* inputs[BATCHED_KERNEL_MAX_TENSORS];
+  void* outputs[BATCHED_KERNEL_MAX_TENSORS];
+  int64_t counts[BATCHED_KERNEL_MAX_TENSORS];
+  double factors[BATCHED_KERNEL_MAX_TENSORS];
+};
+
+// Every row of blocks (blockIdx.y) does one copy of the batch, in chunks of 16
+// bytes if both buffers are aligned to them.
+__global__ void BatchedMemcpyKernel(const BatchedMemcpyDesc* descs) {
+  auto desc = descs[blockIdx.y];
+  auto src = (const uint8_t*)desc.src;
+  auto dst = (uint8_t*)desc.dst;
+  int64_t start = (int64_t)blockIdx.x * blockDim.x + threadIdx.x;
+  int64_t stride = (int64_t)blockDim.x * gridDim.x;
+  int64_t num_vectors = 0;
+  if ((((uintptr_t)src | (uintptr_t)dst) % sizeof(uint4)) == 0) {
+    num_vectors = desc.size / (int64_t)sizeof(uint4);
+    for (int64_t i = start; i < num_vectors; i += stride) {
+      ((uint4*)dst)[i] = ((const uint4*)src)[i];
+    }
+  }
+  for (int64_t i = num_vectors * (int64_t)sizeof(uint4) + start; i < desc.size;
+       i += stride) {
+    dst[i] = src[i];
+  }
+}
+
+template <typename From, typename To> __device__ To Cast(From value) {
+  return (To)value;
+}
+
+template <> __device__ __half Cast<float, __half>(float value) {
+  return __float2half(value);
+}
+
+template <> __device__ float Cast<__half, float>(__half value) {
+  return __half2float(value);
+}
+
+// Every row of blocks (blockIdx.y) casts one tensor of the batch. Values are
+// scaled in Compute precision, which is float for float16 data.
+template <typename From, typename To, typename Compute>
+__global__ void BatchedCastKernel(BatchedCastParams params) {
+  auto input = (const From*)params.inputs[blockIdx.y];
+  auto output = (To*)params.outputs[blockIdx.y];
+  int64_t count = params.counts[blockIdx.y];
+  auto factor = (Compute)params.factors[blockIdx.y];
+  for (int64_t i = (int64_t)blockIdx.x * blockDim.x + threadIdx.x; i < count;
+       i += (int64_t)blockDim.x * gridDim.x) {
+    output[i] = Cast<Compute, To>(Cast<From, Compute>(input[i]) * factor);
+  }
+}
+
+// Adds input to accumulator element by element in Compute precision.
+template <typename T, typename Compute>
+__global__ void AccumulateKernel(const T* input, T* accumulator,
+                                 int64_t count) {
+  for (int64_t i = (int64_t)blockIdx.x * blockDim.x + threadIdx.x; i < count;
+       i += (int64_t)blockDim.x * gridDim.x) {
+    accumulator[i] = Cast<Compute, T>(Cast<T, Compute>(accumulator[i]) +
+                                      Cast<T, Compute>(input[i]));
+  }
+}
+
+template <typename T, typename Compute = float>
+cudaError_t AccumulateAs(const void* input, void* accumulator, int64_t count,
+                         cudaStream_t stream) {
+  if (count == 0) {
+    return cudaSuccess;
+  }
+  int64_t blocks = (count + BATCHED_KERNEL_THREADS_PER_BLOCK - 1) /
+                   BATCHED_KERNEL_THREADS_PER_BLOCK;
+  AccumulateKernel<T, Compute><<<
+      (unsigned int)std::min(blocks,
+                             (int64_t)BATCHED_KERNEL_MAX_BLOCKS_PER_TENSOR),
+      BATCHED_KERNEL_THREADS_PER_BLOCK, 0, stream>>>(
+      (const T*)input, (T*)accumulator, count);
+  return cudaGetLastError();
+}
+
+template <typename From, typename To, typename Compute = float>
+cudaError_t BatchedCast(const std::vector<const void*>& inputs,
+                        const std::vector<void*>& outputs,
+                        const std::vector<int64_t>& counts,
+                        const std::vector<double>& factors,
+                        cudaStream_t stream) {
+  for (size_t start = 0; start < counts.size();
+       start += BATCHED_KERNEL_MAX_TENSORS) {
+    size_t num_tensors =
+        std::min(counts.size() - start, (size_t)BATCHED_KERNEL_MAX_TENSORS);
+    BatchedCastParams params;
+    int64_t max_count = 0;
+    for (size_t i = 0; i < num_tensors; ++i) {
+      params.inputs[i] = inputs[start + i];
+      params.outputs[i] = outputs[start + i];
+      params.counts[i] = counts[start + i];
+      params.factors[i] = factors[start + i];
+      max_count = std::max(max_count, counts[start + i]);
+    }
+    if (max_count == 0) {
+      continue;
+    }
+
+    int64_t blocks = (max_count + BATCHED_KERNEL_THREADS_PER_BLOCK - 1) /
+                     BATCHED_KERNEL_THREADS_PER_BLOCK;
+    dim3 grid((unsigned int)std::min(
+                  blocks, (int64_t)BATCHED_KERNEL_MAX_BLOCKS_PER_TENSOR),
+              (unsigned int)num_tensors);
+    BatchedCastKernel<From, To, Compute>
+        <<<grid, BATCHED_KERNEL_THREADS_PER_BLOCK, 0, stream>>>(params);
+    auto status = cudaGetLastError();
+    if (status != cudaSuccess) {
+      return status;
+    }
+  }
+  return cudaSuccess;
+}
+
+} // namespace
+
+cudaError_t BatchedMemcpy(const BatchedMemcpyDesc* descs, int64_t count,
+                          int64_t max_size, cudaStream_t stream) {
+  if (count == 0 || max_size == 0) {
+    return cudaSuccess;
+  }
+  int64_t blocks = (max_size + BATCHED_KERNEL_THREADS_PER_BLOCK *
+                                   (int64_t)sizeof(uint4) - 1) /
+                   (BATCHED_KERNEL_THREADS_PER_BLOCK * (int64_t)sizeof(uint4));
+  for (int64_t start = 0; start < count; start += BATCHED_MEMCPY_MAX_COPIES) {
+    dim3 grid((unsigned int)std::min(
+                  blocks, (int64_t)BATCHED_KERNEL_MAX_BLOCKS_PER_TENSOR),
+              (unsigned int)std::min(count - start,
+                                     (int64_t)BATCHED_MEMCPY_MAX_COPIES));
+    BatchedMemcpyKernel<<<grid, BATCHED_KERNEL_THREADS_PER_BLOCK, 0, stream>>>(
+        descs + start);
+    auto status = cudaGetLastError();
+    if (status != cudaSuccess) {
+      return status;
+    }
+  }
+  return cudaSuccess;
+}
+
+cudaError_t BatchedPackFloat2Half(const std::vector<const void*>& inputs,
+                                  const std::vector<int64_t>& counts,
+                                  const std::vector<double>& factors,
+                                  void* buffer, cudaStream_t stream) {
+  std::vector<void*> outputs;
+  outputs.reserve(counts.size());
+  int64_t offset = 0;
+  for (auto count : counts) {
+    outputs.push_back((__half*)buffer + offset);
+    offset += count;
+  }
+  return BatchedCast<float, __half>(inputs, outputs, counts, factors, stream);
+}
+
+cudaError_t BatchedUnpackHalf2Float(const void* buffer,
+                                    const std::vector<void*>& outputs,
+                                    const std::vector<int64_t>& counts,
+                                    const std::vector<double>& factors,
+                                    cudaStream_t stream) {
+  std::vector<const void*> inputs;
+  inputs.reserve(counts.size());
+  int64_t offset = 0;
+  for (auto count : counts) {
+    inputs.push_back((const __half*)buffer + offset);
+    offset += count;
+  }
+  return BatchedCast<__half, float>(inputs, outputs, counts, factors, stream);
+}
+
+cudaError_t BatchedScale(const std::vector<const void*>& inputs,
+                         const std::vector<void*>& outputs,
+                         const std::vector<int64_t>& counts,
+                         const std::vector<double>& factors,
+                         MPIDataType dtype, cudaStream_t stream) {
+  switch (dtype) {
+  case HOROVOD_FLOAT16:
+    return BatchedCast<__half, __half>(inputs, outputs, counts, factors,
+                                       stream);
+  case HOROVOD_FLOAT32:
+    return BatchedCast<float, float>(inputs, outputs, counts, factors, stream);
+  case HOROVOD_FLOAT64:
+    return BatchedCast<double, double, double>(inputs, outputs, counts,
+                                               factors, stream);
+  default:
+    return cudaErrorInvalidValue;
+  }
+}
+
+cudaError_t Accumulate(const void* input, void* accumulator, int64_t count,
+                       MPIDataType dtype, cudaStream_t stream) {
+  switch (dtype) {
+  case HOROVOD_FLOAT16:
+    return AccumulateAs<__half>(input, accumulator, count, stream);
+  case HOROVOD_FLOAT32:
+    return AccumulateAs<float>(input, accumulator, count, stream);
+  case HOROVOD_FLOAT64:
+    return AccumulateAs<double, double>(input, accumulator, count, stream);
+  default:
+    return cudaErrorInvalidValue;
+  }
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,78 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_CUDA_KERNELS_H
+#define HOROVOD_CUDA_KERNELS_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "mpi_message.h"
+
+namespace horovod {
+namespace common {
+
+// Number of tensors handled by a single launch of a batched kernel, chosen so
+// that the kernel parameters fit into the parameter space of a launch.
+#define BATCHED_KERNEL_MAX_TENSORS 64
+
+// Copy of size bytes from src to dst done by BatchedMemcpy.
+struct BatchedMemcpyDesc {
+  const void* src;
+  void* dst;
+  int64_t size;
+};
+
+// Does count copies between device buffers with a single kernel launch per
+// BATCHED_MEMCPY_MAX_COPIES copies. descs is an array of descriptors in device
+// memory, and max_size the size of the largest copy.
+#define BATCHED_MEMCPY_MAX_COPIES 65535
+cudaError_t BatchedMemcpy(const BatchedMemcpyDesc* descs, int64_t count,
+                          int64_t max_size, cudaStream_t stream);
+
+// Casts float32 tensors to float16 and packs them back to back into buffer.
+// counts holds the number of elements of every tensor, and factors the factor
+// its elements are multiplied by.
+cudaError_t BatchedPackFloat2Half(const std::vector<const void*>& inputs,
+                                  const std::vector<int64_t>& counts,
+                                  const std::vector<double>& factors,
+                                  void* buffer, cudaStream_t stream);
+
+// Unpacks float16 data written by BatchedPackFloat2Half into float32 tensors.
+cudaError_t BatchedUnpackHalf2Float(const void* buffer,
+                                    const std::vector<void*>& outputs,
+                                    const std::vector<int64_t>& counts,
+                                    const std::vector<double>& factors,
+                                    cudaStream_t stream);
+
+// Copies float16, float32 or float64 tensors from inputs to outputs,
+// multiplying the elements of every tensor by its factor. An input may be its
+// own output.
+cudaError_t BatchedScale(const std::vector<const void*>& inputs,
+                         const std::vector<void*>& outputs,
+                         const std::vector<int64_t>& counts,
+                         const std::vector<double>& factors,
+                         MPIDataType dtype, cudaStream_t stream);
+
+// Adds count float16, float32 or float64 elements of input to accumulator.
+cudaError_t Accumulate(const void* input, void* accumulator, int64_t count,
+                       MPIDataType dtype, cudaStream_t stream);
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_CUDA_KERNELS_H
@@ -13,29 +13,121 @@
 // limitations under the License.
 // =============================================================================
 
+#include <algorithm>
+#include <cstring>
+
+#if HAVE_CUDA
+#include <cuda_runtime.h>
+#endif
+
 #include "fusion_buffer_manager.h"
+#include "logging.h"
 
 namespace horovod {
 namespace common {
 
-Status FusionBufferManager::InitializeBuffer(int64_t threshold, int device, std::shared_ptr<OpContext> context,
+int64_t BufferCapacity(int64_t size, int64_t limit) {
+  int64_t capacity = FUSION_BUFFER_MIN_SIZE;
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  return std::max(size, std::min(capacity, limit));
+}
+
+void FusionBufferManager::SetNumBuffers(int num_buffers) {
+  num_buffers_ = num_buffers > 0 ? num_buffers : 1;
+}
+
+int FusionBufferManager::NumBuffers() const {
+  return num_buffers_;
+}
+
+void FusionBufferManager::SetBudget(int64_t budget) {
+  budget_ = budget > 0 ? budget : 0;
+}
+
+int64_t FusionBufferManager::Budget() const {
+  return budget_;
+}
+
+void FusionBufferManager::SetExternalBytes(int64_t bytes) {
+  external_bytes_ = bytes;
+}
+
+void FusionBufferManager::ReleaseBuffer(
+    int device, std::pair<std::shared_ptr<PersistentBuffer>, int64_t>& elem) {
+  if (elem.first == nullptr) {
+    return;
+  }
+#if HAVE_CUDA
+  if (device != CPU_DEVICE_ID) {
+    // Operations on the Horovod streams may still read or write the buffer.
+    int restore_device;
+    cudaGetDevice(&restore_device);
+    cudaSetDevice(device);
+    cudaDeviceSynchronize();
+    cudaSetDevice(restore_device);
+  }
+#endif
+  elem.first.reset();
+  allocated_bytes_ -= elem.second;
+  elem.second = 0;
+}
+
+Status FusionBufferManager::InitializeBuffer(int64_t size, int64_t threshold, int device,
+                                             std::shared_ptr<OpContext> context,
                                              std::function<void()> on_start_init,
                                              std::function<void()> on_end_init) {
-  auto& elem = tensor_fusion_buffers_[std::make_tuple(device, context->framework())];
-  auto& buffer = elem.first;
-  int64_t& size = elem.second;
-  if (size != threshold) {
-    buffer.reset();
-    size = 0;
+  auto& ring = tensor_fusion_buffers_[std::make_tuple(device, context->framework())];
+  ring.last_use = std::chrono::steady_clock::now();
+  size_t num_buffers = device == CPU_DEVICE_ID ? 1 : (size_t)num_buffers_;
+  if (ring.buffers.size() != num_buffers) {
+    for (auto& elem : ring.buffers) {
+      ReleaseBuffer(device, elem);
+    }
+    ring.buffers.resize(num_buffers);
+    ring.current = 0;
+  } else {
+    ring.current = (ring.current + 1) % num_buffers;
+  }
+
+  // Buffers are grown when they're too small, and allocated again when the
+  // threshold dropped below their size.
+  auto& elem = ring.buffers[ring.current];
+  if (elem.second < size || elem.second > std::max(threshold, size)) {
+    ReleaseBuffer(device, elem);
   }
 
-  if (buffer == nullptr) {
+  if (elem.first == nullptr) {
     on_start_init();
-    size = threshold;
+    int64_t limit = threshold;
+    if (budget_ > 0) {
+      limit = std::min(limit, budget_ - allocated_bytes_ - external_bytes_);
+    }
+    int64_t capacity = BufferCapacity(size, limit);
+    if (budget_ > 0 && !warned_budget_ &&
+        allocated_bytes_ + external_bytes_ + capacity > budget_) {
+      LOG(WARNING) << "Fusion buffers need " << capacity << " more bytes, "
+                   << "which exceeds the budget of " << budget_ << " bytes set by "
+                   << HOROVOD_FUSION_MEMORY_BUDGET << ".";
+      warned_budget_ = true;
+    }
 
     // Lazily allocate persistent buffer for Tensor Fusion and keep it
-    // forever per device.
-    Status status = context->AllocatePersistent(threshold, &buffer);
+    // per device until it is too small or idle.
+    Status status = context->AllocatePersistent(capacity, &elem.first);
+    if (status.ok()) {
+      elem.second = capacity;
+      allocated_bytes_ += capacity;
+      if (device == CPU_DEVICE_ID) {
+        // Touch every page on the background thread, so that the buffer is
+        // placed on its NUMA node instead of the node of whichever memcpy
+        // thread happens to write to a page first.
+        std::memset((void*)elem.first->AccessData(context), 0, (size_t)capacity);
+      }
+    } else {
+      elem.first.reset();
+    }
     on_end_init();
 
     return status;
@@ -45,7 +137,31 @@ Status FusionBufferManager::InitializeBuffer(int64_t threshold, int device, std:
 }
 
 std::shared_ptr<PersistentBuffer>& FusionBufferManager::GetBuffer(int device, Framework framework) {
-  return tensor_fusion_buffers_[std::make_tuple(device, framework)].first;
+  auto& ring = tensor_fusion_buffers_[std::make_tuple(device, framework)];
+  if (ring.buffers.empty()) {
+    ring.buffers.resize(1);
+  }
+  return ring.buffers[ring.current].first;
+}
+
+int64_t FusionBufferManager::ReleaseIdleBuffers(std::chrono::steady_clock::duration idle_time) {
+  auto now = std::chrono::steady_clock::now();
+  int64_t released = 0;
+  for (auto& it : tensor_fusion_buffers_) {
+    auto& ring = it.second;
+    if (now - ring.last_use < idle_time) {
+      continue;
+    }
+    for (auto& elem : ring.buffers) {
+      released += elem.second;
+      ReleaseBuffer(std::get<0>(it.first), elem);
+    }
+  }
+  return released;
+}
+
+int64_t FusionBufferManager::AllocatedBytes() const {
+  return allocated_bytes_;
 }
 
 } // namespace common
@@ -16,8 +16,10 @@
 #ifndef HOROVOD_FUSION_BUFFER_MANAGER_H
 #define HOROVOD_FUSION_BUFFER_MANAGER_H
 
+#include <chrono>
 #include <iostream>
 #include <unordered_map>
+#include <vector>
 
 #include "common.h"
 #include "hashes.h"
@@ -26,33 +28,86 @@
 namespace horovod {
 namespace common {
 
+// Returns the number of bytes to allocate for a buffer which has to hold size
+// bytes: size rounded up to a power of two, at least FUSION_BUFFER_MIN_SIZE,
+// but no more than limit, unless size is larger.
+int64_t BufferCapacity(int64_t size, int64_t limit);
+
 // Encapsulates the process of creating and destroying fusion buffers as the requested
 // threshold is changed.
+//
+// Buffers are allocated for the data of the responses fused into them and grown
+// geometrically up to the threshold, so that small jobs don't hold on to a buffer of the
+// size of the threshold on every device and framework. All buffers together are kept within
+// the budget if one is set, and buffers which haven't been used for a while can be released.
+//
+// GPU devices can have several fusion buffers which are used in turn, so that packing
+// the next fused response does not have to wait until the previous one has been unpacked.
 class FusionBufferManager {
 public:
-  // Initializes a buffer of the given threshold size if not already cached.
+  // Sets the number of fusion buffers used in rotation on every GPU device.  CPU
+  // operations complete before the next one starts, so they always use one buffer.
+  void SetNumBuffers(int num_buffers);
+  int NumBuffers() const;
+
+  // Sets the number of bytes all fusion buffers and the other buffers passed to
+  // SetExternalBytes() may take up together, or zero for no budget.  A buffer which
+  // doesn't fit into the budget is only allocated as large as needed.
+  void SetBudget(int64_t budget);
+  int64_t Budget() const;
+
+  // Sets the number of bytes taken up by other buffers of Horovod, which count against
+  // the budget.
+  void SetExternalBytes(int64_t bytes);
+
+  // Switches to the next buffer of the given device and framework, and initializes it
+  // so that it holds at least size bytes if not already cached.
   //
   // Args:
-  //  threshold: Size of the buffer in bytes.
+  //  size: Number of bytes the current operation needs in the buffer.
+  //  threshold: Maximum size of the buffer in bytes.
   //  device: Device ID to associate the buffer.
   //  context: Framework used to create the buffer and associate it.
   //  on_start_init: Callback on starting buffer initialization.
   //  on_end_init: Callback on completing buffer initialization.
-  Status InitializeBuffer(int64_t threshold,
+  Status InitializeBuffer(int64_t size, int64_t threshold,
                           int device, std::shared_ptr<OpContext> context,
                           std::function<void()> on_start_init,
                           std::function<void()> on_end_init);
 
-  // Returns the buffer associated with the given device and framework, or null.
+  // Returns the current buffer associated with the given device and framework, or null.
   std::shared_ptr<PersistentBuffer>& GetBuffer(int device, Framework framework);
 
+  // Releases the buffers of every device and framework which haven't been initialized
+  // for at least idle_time, and returns the number of bytes released.  GPU devices are
+  // synchronized first, so that no operation uses a released buffer anymore.
+  int64_t ReleaseIdleBuffers(std::chrono::steady_clock::duration idle_time);
+
+  // Returns the number of bytes allocated for all fusion buffers.
+  int64_t AllocatedBytes() const;
+
 private:
+  struct BufferRing {
+    // Buffers and their sizes.
+    std::vector<std::pair<std::shared_ptr<PersistentBuffer>, int64_t>> buffers;
+    // Index of the buffer returned by GetBuffer().
+    size_t current = 0;
+    // Time the ring was last initialized.
+    std::chrono::steady_clock::time_point last_use;
+  };
+
+  // Drops a buffer of the given device, after waiting for the device if it is a GPU.
+  void ReleaseBuffer(int device, std::pair<std::shared_ptr<PersistentBuffer>, int64_t>& elem);
+
+  int num_buffers_ = 1;
+  int64_t budget_ = 0;
+  int64_t external_bytes_ = 0;
+  int64_t allocated_bytes_ = 0;
+  bool warned_budget_ = false;
+
   // Memory buffers for Tensor Fusion.  They are keyed off device ID and
-  // framework, and all are allocated tensor_fusion_threshold bytes if
-  // initialized.
-  std::unordered_map<
-      std::tuple<int, Framework>,
-      std::pair<std::shared_ptr<PersistentBuffer>, int64_t>> tensor_fusion_buffers_;
+  // framework, and are allocated on demand up to tensor_fusion_threshold bytes.
+  std::unordered_map<std::tuple<int, Framework>, BufferRing> tensor_fusion_buffers_;
 };
 
 } // namespace common
@@ -0,0 +1,91 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "gradient_accumulation.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "half.h"
+
+namespace horovod {
+namespace common {
+
+namespace {
+
+template <typename T>
+void Accumulate(const T* input, T* accumulator, int64_t count) {
+  for (int64_t i = 0; i < count; ++i) {
+    accumulator[i] += input[i];
+  }
+}
+
+// Runs one of the MPI sum functions of the 16-bit types, which take an int
+// count, in chunks.
+void Accumulate16(void (*sum)(void*, void*, int*, MPI_Datatype*),
+                  const void* input, void* accumulator, int64_t count) {
+  auto in = (unsigned short*)input;
+  auto inout = (unsigned short*)accumulator;
+  for (int64_t offset = 0; offset < count; offset += INT_MAX) {
+    int len = (int)std::min(count - offset, (int64_t)INT_MAX);
+    sum(in + offset, inout + offset, &len, nullptr);
+  }
+}
+
+} // namespace
+
+AccumulatorTensor::AccumulatorTensor(const GradientAccumulator& accumulator,
+                                     std::shared_ptr<OpContext> context)
+    : buffer_(accumulator.buffer), context_(std::move(context)),
+      dtype_(accumulator.dtype), shape_(accumulator.shape),
+      size_(accumulator.size) {}
+
+const MPIDataType AccumulatorTensor::dtype() const { return dtype_; }
+
+const TensorShape AccumulatorTensor::shape() const { return shape_; }
+
+const void* AccumulatorTensor::data() const {
+  return buffer_->AccessData(context_);
+}
+
+int64_t AccumulatorTensor::size() const { return size_; }
+
+bool AccumulationSupported(MPIDataType dtype) {
+  return dtype == HOROVOD_FLOAT16 || dtype == HOROVOD_BFLOAT16 ||
+         dtype == HOROVOD_FLOAT32 || dtype == HOROVOD_FLOAT64;
+}
+
+void AccumulateOnCPU(const void* input, void* accumulator, int64_t count,
+                     MPIDataType dtype) {
+  switch (dtype) {
+  case HOROVOD_FLOAT16:
+    Accumulate16(float16_sum, input, accumulator, count);
+    break;
+  case HOROVOD_BFLOAT16:
+    Accumulate16(bfloat16_sum, input, accumulator, count);
+    break;
+  case HOROVOD_FLOAT32:
+    Accumulate((const float*)input, (float*)accumulator, count);
+    break;
+  case HOROVOD_FLOAT64:
+    Accumulate((const double*)input, (double*)accumulator, count);
+    break;
+  default:
+    break;
+  }
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,74 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_GRADIENT_ACCUMULATION_H
+#define HOROVOD_GRADIENT_ACCUMULATION_H
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include "common.h"
+
+namespace horovod {
+namespace common {
+
+// Sum of the tensors passed to the allreduce calls of a tensor since its last
+// allreduce. Only accessed by the background thread, except for reducing,
+// which is cleared by the callback of the allreduce of the sum.
+struct GradientAccumulator {
+  std::shared_ptr<PersistentBuffer> buffer;
+  MPIDataType dtype = HOROVOD_FLOAT32;
+  TensorShape shape;
+  int64_t size = 0;
+  int device = CPU_DEVICE_ID;
+  // Number of tensors summed up in the buffer.
+  int32_t steps = 0;
+  // Whether the buffer is being allreduced, so that the next tensor can't be
+  // added to it yet.
+  std::shared_ptr<std::atomic_bool> reducing =
+      std::make_shared<std::atomic_bool>(false);
+};
+
+// The buffer of an accumulator, seen as a tensor of the shape of the tensors
+// summed up in it. The tensor keeps the buffer alive.
+class AccumulatorTensor : public Tensor {
+public:
+  AccumulatorTensor(const GradientAccumulator& accumulator,
+                    std::shared_ptr<OpContext> context);
+  const MPIDataType dtype() const override;
+  const TensorShape shape() const override;
+  const void* data() const override;
+  int64_t size() const override;
+
+private:
+  std::shared_ptr<PersistentBuffer> buffer_;
+  std::shared_ptr<OpContext> context_;
+  MPIDataType dtype_;
+  TensorShape shape_;
+  int64_t size_;
+};
+
+// Whether tensors of the data type can be summed up in an accumulator.
+bool AccumulationSupported(MPIDataType dtype);
+
+// Adds count elements of input to the accumulator in host memory.
+void AccumulateOnCPU(const void* input, void* accumulator, int64_t count,
+                     MPIDataType dtype);
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_GRADIENT_ACCUMULATION_H
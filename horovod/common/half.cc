@@ -18,6 +18,13 @@
 #include <immintrin.h>
 #endif
 
+// AVX2 and AVX-512 kernels are compiled for their instruction sets with
+// function attributes and only called if the CPU supports them.
+#if __x86_64__ && (__GNUC__ >= 5 || __clang__)
+#define HOROVOD_TARGET_AVX2_AVX512 1
+#include <immintrin.h>
+#endif
+
 #include "half.h"
 
 namespace horovod {
@@ -39,6 +46,107 @@ bool is_avx_and_f16c() {
 }
 #endif
 
+#if HOROVOD_TARGET_AVX2_AVX512
+bool is_avx2() {
+  static bool result = __builtin_cpu_supports("avx2");
+  return result;
+}
+
+bool is_avx512f() {
+  static bool result = __builtin_cpu_supports("avx512f");
+  return result;
+}
+
+// Sums up 16 float16 values at a time and returns the number of values summed.
+// The zero-masking forms of the intrinsics are used with all lanes set, since
+// the plain forms pass an undefined source to the masked builtins, for which
+// GCC 12 warns about an uninitialized value.
+__attribute__((target("avx512f"))) int
+float16_sum_avx512(const unsigned short* in, unsigned short* inout, int len) {
+  const __mmask16 all = 0xffff;
+  int i = 0;
+  for (; i < (len / 16) * 16; i += 16) {
+    __m512 in_m512 = _mm512_maskz_cvtph_ps(
+        all, _mm256_loadu_si256((__m256i*)(in + i)));
+    __m512 inout_m512 = _mm512_maskz_cvtph_ps(
+        all, _mm256_loadu_si256((__m256i*)(inout + i)));
+    __m256i new_inout_m256i = _mm512_maskz_cvtps_ph(
+        all, _mm512_maskz_add_ps(all, in_m512, inout_m512), 0);
+    _mm256_storeu_si256((__m256i*)(inout + i), new_inout_m256i);
+  }
+  return i;
+}
+
+// Sums up 16 bfloat16 values at a time and returns the number of values
+// summed. Values are widened to float32 by shifting their bits, and the sums
+// rounded to nearest even like Float2BFloat16Bits.
+__attribute__((target("avx512f"))) int
+bfloat16_sum_avx512(const unsigned short* in, unsigned short* inout, int len) {
+  const __mmask16 all = 0xffff;
+  const __m512i rounding = _mm512_set1_epi32(0x7fff);
+  const __m512i one = _mm512_set1_epi32(1);
+  const __m512i quiet = _mm512_set1_epi32(0x40);
+  int i = 0;
+  for (; i < (len / 16) * 16; i += 16) {
+    __m512i in_m512i = _mm512_maskz_slli_epi32(
+        all,
+        _mm512_maskz_cvtepu16_epi32(all,
+                                    _mm256_loadu_si256((__m256i*)(in + i))),
+        16);
+    __m512i inout_m512i = _mm512_maskz_slli_epi32(
+        all,
+        _mm512_maskz_cvtepu16_epi32(all,
+                                    _mm256_loadu_si256((__m256i*)(inout + i))),
+        16);
+    __m512 sum = _mm512_maskz_add_ps(all, _mm512_castsi512_ps(in_m512i),
+                                     _mm512_castsi512_ps(inout_m512i));
+    __m512i bits = _mm512_castps_si512(sum);
+    __m512i high = _mm512_maskz_srli_epi32(all, bits, 16);
+    __m512i lsb = _mm512_maskz_and_epi32(all, high, one);
+    __m512i rounded = _mm512_maskz_srli_epi32(
+        all,
+        _mm512_maskz_add_epi32(all, bits,
+                               _mm512_maskz_add_epi32(all, rounding, lsb)),
+        16);
+    __mmask16 is_nan = _mm512_cmp_ps_mask(sum, sum, _CMP_UNORD_Q);
+    rounded = _mm512_mask_blend_epi32(is_nan, rounded,
+                                      _mm512_maskz_or_epi32(all, high, quiet));
+    _mm256_storeu_si256((__m256i*)(inout + i),
+                        _mm512_maskz_cvtepi32_epi16(all, rounded));
+  }
+  return i;
+}
+
+// Sums up 8 bfloat16 values at a time and returns the number of values summed.
+__attribute__((target("avx2"))) int
+bfloat16_sum_avx2(const unsigned short* in, unsigned short* inout, int len) {
+  const __m256i rounding = _mm256_set1_epi32(0x7fff);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i quiet = _mm256_set1_epi32(0x40);
+  int i = 0;
+  for (; i < (len / 8) * 8; i += 8) {
+    __m256i in_m256i = _mm256_slli_epi32(
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)(in + i))), 16);
+    __m256i inout_m256i = _mm256_slli_epi32(
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)(inout + i))), 16);
+    __m256 sum = _mm256_add_ps(_mm256_castsi256_ps(in_m256i),
+                               _mm256_castsi256_ps(inout_m256i));
+    __m256i bits = _mm256_castps_si256(sum);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+    __m256i rounded = _mm256_srli_epi32(
+        _mm256_add_epi32(bits, _mm256_add_epi32(rounding, lsb)), 16);
+    __m256i is_nan = _mm256_castps_si256(_mm256_cmp_ps(sum, sum, _CMP_UNORD_Q));
+    rounded = _mm256_blendv_epi8(
+        rounded, _mm256_or_si256(_mm256_srli_epi32(bits, 16), quiet), is_nan);
+    // Pack the 32-bit values to 16 bits, which packus does per 128-bit lane.
+    __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(rounded, rounded), 0xd8);
+    _mm_storeu_si128((__m128i*)(inout + i), _mm256_castsi256_si128(packed));
+  }
+  return i;
+}
+#endif
+
 // float16 custom data type summation operation.
 void float16_sum(void* invec, void* inoutvec, int* len,
                  MPI_Datatype* datatype) {
@@ -47,6 +155,11 @@ void float16_sum(void* invec, void* inoutvec, int* len,
   auto* inout = (unsigned short*)inoutvec;
 
   int i = 0;
+#if HOROVOD_TARGET_AVX2_AVX512
+  if (is_avx512f()) {
+    i = float16_sum_avx512(in, inout, *len);
+  }
+#endif
 #if __AVX__ && __F16C__
   if (is_avx_and_f16c()) {
     for (; i < (*len / 8) * 8; i += 8) {
@@ -74,5 +187,90 @@ void float16_sum(void* invec, void* inoutvec, int* len,
   }
 }
 
+// bfloat16 custom data type summation operation.
+void bfloat16_sum(void* invec, void* inoutvec, int* len,
+                  MPI_Datatype* datatype) {
+  auto* in = (unsigned short*)invec;
+  auto* inout = (unsigned short*)inoutvec;
+
+  int i = 0;
+#if HOROVOD_TARGET_AVX2_AVX512
+  if (is_avx512f()) {
+    i = bfloat16_sum_avx512(in, inout, *len);
+  } else if (is_avx2()) {
+    i = bfloat16_sum_avx2(in, inout, *len);
+  }
+#endif
+  for (; i < *len; ++i) {
+    float in_float;
+    float inout_float;
+    BFloat16Bits2Float(in + i, &in_float);
+    BFloat16Bits2Float(inout + i, &inout_float);
+    inout_float += in_float;
+    Float2BFloat16Bits(&inout_float, inout + i);
+  }
+}
+
+void Float2HalfBuffer(const float* src, unsigned short* dest, int64_t count,
+                      float factor) {
+  int64_t i = 0;
+#if __AVX__ && __F16C__
+  if (is_avx_and_f16c()) {
+    __m256 factor_m256 = _mm256_set1_ps(factor);
+    for (; i < (count / 8) * 8; i += 8) {
+      __m256 float_m256 = _mm256_mul_ps(_mm256_loadu_ps(src + i), factor_m256);
+      __m128i half_m128i = _mm256_cvtps_ph(float_m256, 0);
+      _mm_storeu_si128((__m128i*)(dest + i), half_m128i);
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    float value = src[i] * factor;
+    Float2HalfBits(&value, dest + i);
+  }
+}
+
+void HalfBuffer2Float(const unsigned short* src, float* dest, int64_t count,
+                      float factor) {
+  int64_t i = 0;
+#if __AVX__ && __F16C__
+  if (is_avx_and_f16c()) {
+    __m256 factor_m256 = _mm256_set1_ps(factor);
+    for (; i < (count / 8) * 8; i += 8) {
+      __m256 float_m256 = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)(src + i)));
+      _mm256_storeu_ps(dest + i, _mm256_mul_ps(float_m256, factor_m256));
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    unsigned short bits = src[i];
+    HalfBits2Float(&bits, dest + i);
+    dest[i] *= factor;
+  }
+}
+
+void ScaleHalfBuffer(const unsigned short* src, unsigned short* dest,
+                     int64_t count, float factor) {
+  int64_t i = 0;
+#if __AVX__ && __F16C__
+  if (is_avx_and_f16c()) {
+    __m256 factor_m256 = _mm256_set1_ps(factor);
+    for (; i < (count / 8) * 8; i += 8) {
+      __m256 float_m256 = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)(src + i)));
+      __m128i half_m128i =
+          _mm256_cvtps_ph(_mm256_mul_ps(float_m256, factor_m256), 0);
+      _mm_storeu_si128((__m128i*)(dest + i), half_m128i);
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    unsigned short bits = src[i];
+    float value;
+    HalfBits2Float(&bits, &value);
+    value *= factor;
+    Float2HalfBits(&value, dest + i);
+  }
+}
+
 } // namespace common
 } // namespace horovod
@@ -26,6 +26,7 @@
 #ifndef HOROVOD_HALF_H
 #define HOROVOD_HALF_H
 
+#include <cstring>
 #include <stdint.h>
 
 #define OMPI_SKIP_MPICXX
@@ -132,8 +133,41 @@ inline void Float2HalfBits(float* src, unsigned short* dest) {
   *dest = u;
 }
 
+// bfloat16 is the upper half of a float32, so conversions only shift bits.
+inline void BFloat16Bits2Float(unsigned short* src, float* res) {
+  unsigned f = (unsigned)*src << 16;
+  std::memcpy(res, &f, sizeof(f));
+}
+
+inline void Float2BFloat16Bits(float* src, unsigned short* dest) {
+  unsigned s;
+  std::memcpy(&s, src, sizeof(s));
+  if ((s & 0x7fffffff) > 0x7f800000) {
+    // not a number, which rounding could turn into infinity
+    *dest = uint16_t((s >> 16) | 0x40);
+    return;
+  }
+  // round to nearest even
+  *dest = uint16_t((s + 0x7fff + ((s >> 16) & 1)) >> 16);
+}
+
 void float16_sum(void* invec, void* inoutvec, int* len, MPI_Datatype* datatype);
 
+// bfloat16 custom data type summation operation.
+void bfloat16_sum(void* invec, void* inoutvec, int* len,
+                  MPI_Datatype* datatype);
+
+// Converts count float32 values to float16 and back, multiplying them by
+// factor.
+void Float2HalfBuffer(const float* src, unsigned short* dest, int64_t count,
+                      float factor = 1.0f);
+void HalfBuffer2Float(const unsigned short* src, float* dest, int64_t count,
+                      float factor = 1.0f);
+
+// Multiplies count float16 values by factor. src may be the same as dest.
+void ScaleHalfBuffer(const unsigned short* src, unsigned short* dest,
+                     int64_t count, float factor);
+
 } // namespace common
 } // namespace horovod
 
@@ -36,9 +36,8 @@ void LogMessage::GenerateLogMessage(bool log_time) {
 }
 
 LogMessage::~LogMessage() {
-  static LogLevel min_log_level = MinLogLevelFromEnv();
   static bool log_time = LogTimeFromEnv();
-  if (severity_ >= min_log_level) {
+  if (LogLevelEnabled(severity_)) {
     GenerateLogMessage(log_time);
   }
 }
@@ -81,6 +80,11 @@ LogLevel MinLogLevelFromEnv() {
   return ParseLogLevelStr(env_var_val);
 }
 
+bool LogLevelEnabled(LogLevel severity) {
+  static LogLevel min_log_level = MinLogLevelFromEnv();
+  return severity >= min_log_level;
+}
+
 bool LogTimeFromEnv() {
   const char* env_var_val = getenv("HOROVOD_LOG_HIDE_TIME");
   if (env_var_val != nullptr &&
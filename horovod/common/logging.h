@@ -55,5 +55,8 @@ class LogMessageFatal : public LogMessage {
 LogLevel MinLogLevelFromEnv();
 bool LogTimeFromEnv();
 
+// Whether messages of the level are logged, to skip building expensive ones.
+bool LogLevelEnabled(LogLevel severity);
+
 }
 }
@@ -0,0 +1,209 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <cstring>
+
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "memcpy_pool.h"
+
+namespace horovod {
+namespace common {
+
+void NonTemporalMemcpy(void* dst, const void* src, size_t size) {
+#if __SSE2__
+  auto out = (uint8_t*)dst;
+  auto in = (const uint8_t*)src;
+
+  // Copy up to the first 16-byte aligned address of the destination.
+  size_t head = (16 - ((uintptr_t)out & 15)) & 15;
+  if (head >= size) {
+    std::memcpy(out, in, size);
+    return;
+  }
+  std::memcpy(out, in, head);
+  out += head;
+  in += head;
+  size -= head;
+
+  size_t num_blocks = size / 64;
+  for (size_t i = 0; i < num_blocks; ++i, out += 64, in += 64) {
+    auto a = _mm_loadu_si128((const __m128i*)in);
+    auto b = _mm_loadu_si128((const __m128i*)(in + 16));
+    auto c = _mm_loadu_si128((const __m128i*)(in + 32));
+    auto d = _mm_loadu_si128((const __m128i*)(in + 48));
+    _mm_stream_si128((__m128i*)out, a);
+    _mm_stream_si128((__m128i*)(out + 16), b);
+    _mm_stream_si128((__m128i*)(out + 32), c);
+    _mm_stream_si128((__m128i*)(out + 48), d);
+  }
+  // Non-temporal stores are weakly ordered, so make them visible before
+  // anything else reads the destination.
+  _mm_sfence();
+  std::memcpy(out, in, size % 64);
+#else
+  std::memcpy(dst, src, size);
+#endif
+}
+
+MemcpyPool::~MemcpyPool() { Stop(); }
+
+void MemcpyPool::Start(int num_threads) {
+  Stop();
+  std::lock_guard<std::mutex> guard(mutex_);
+  shut_down_ = false;
+  for (int i = 1; i < num_threads; ++i) {
+    threads_.emplace_back(&MemcpyPool::WorkerLoop, this);
+  }
+}
+
+void MemcpyPool::Stop() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    shut_down_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+int MemcpyPool::num_threads() const { return (int)threads_.size() + 1; }
+
+void MemcpyPool::Copy(const std::vector<MemcpyDesc>& copies) {
+  int64_t total_size = 0;
+  for (auto& copy : copies) {
+    total_size += copy.size;
+  }
+  bool non_temporal = total_size >= MEMCPY_NON_TEMPORAL_BYTES;
+  auto copy_fn = [non_temporal](const MemcpyDesc& copy) {
+    if (non_temporal) {
+      NonTemporalMemcpy(copy.dst, copy.src, (size_t)copy.size);
+    } else {
+      std::memcpy(copy.dst, copy.src, (size_t)copy.size);
+    }
+  };
+
+  if (threads_.empty() || total_size < MEMCPY_POOL_MIN_BYTES) {
+    for (auto& copy : copies) {
+      copy_fn(copy);
+    }
+    return;
+  }
+
+  // Split the copies into a few tasks per thread of about the same size, so
+  // that threads which finish early pick up the remaining work. Large copies
+  // are split up, small ones are grouped together.
+  int64_t task_size =
+      std::max(total_size / (num_threads() * 4),
+               (int64_t)MEMCPY_POOL_MIN_TASK_BYTES);
+  std::vector<MemcpyDesc> pieces;
+  std::vector<size_t> task_starts;
+  int64_t current_task_size = task_size;
+  for (auto& copy : copies) {
+    for (int64_t offset = 0; offset < copy.size;) {
+      if (current_task_size >= task_size) {
+        task_starts.push_back(pieces.size());
+        current_task_size = 0;
+      }
+      auto size = std::min(copy.size - offset, task_size - current_task_size);
+      pieces.push_back({(const uint8_t*)copy.src + offset,
+                        (uint8_t*)copy.dst + offset, size});
+      offset += size;
+      current_task_size += size;
+    }
+  }
+  task_starts.push_back(pieces.size());
+
+  std::vector<std::function<void()>> tasks;
+  for (size_t i = 0; i + 1 < task_starts.size(); ++i) {
+    auto begin = task_starts[i];
+    auto end = task_starts[i + 1];
+    tasks.push_back([&pieces, &copy_fn, begin, end]() {
+      for (auto p = begin; p < end; ++p) {
+        copy_fn(pieces[p]);
+      }
+    });
+  }
+  Run(tasks);
+}
+
+void MemcpyPool::Run(const std::vector<std::function<void()>>& tasks) {
+  if (threads_.empty() || tasks.size() <= 1) {
+    for (auto& task : tasks) {
+      task();
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    tasks_ = &tasks;
+    next_task_ = 0;
+    unfinished_tasks_ = tasks.size();
+    ++generation_;
+  }
+  work_cv_.notify_all();
+
+  RunTasks();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return unfinished_tasks_ == 0; });
+  tasks_ = nullptr;
+}
+
+void MemcpyPool::RunTasks() {
+  while (true) {
+    const std::function<void()>* task;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (tasks_ == nullptr || next_task_ >= tasks_->size()) {
+        return;
+      }
+      task = &(*tasks_)[next_task_++];
+    }
+
+    (*task)();
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (--unfinished_tasks_ == 0) {
+      done_cv_.notify_all();
+    }
+  }
+}
+
+void MemcpyPool::WorkerLoop() {
+  uint64_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this, generation]() {
+        return shut_down_ || generation_ != generation;
+      });
+      if (shut_down_) {
+        return;
+      }
+      generation = generation_;
+    }
+    RunTasks();
+  }
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,97 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_MEMCPY_POOL_H
+#define HOROVOD_MEMCPY_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace horovod {
+namespace common {
+
+// Batches of copies smaller than this are done by the calling thread alone.
+#define MEMCPY_POOL_MIN_BYTES (1 << 20)
+
+// Smallest share of a batch of copies that is given to one thread.
+#define MEMCPY_POOL_MIN_TASK_BYTES (256 << 10)
+
+// Batches of copies at least this large are written with non-temporal stores,
+// since their destination wouldn't stay in the cache anyway.
+#define MEMCPY_NON_TEMPORAL_BYTES (8 << 20)
+
+// Copy of size bytes from src to dst.
+struct MemcpyDesc {
+  const void* src;
+  void* dst;
+  int64_t size;
+};
+
+// Copies size bytes from src to dst with non-temporal stores, which bypass the
+// cache. Falls back to memcpy on CPUs without SSE2.
+void NonTemporalMemcpy(void* dst, const void* src, size_t size);
+
+// Threads which help the background thread with large memory copies into and
+// out of the fusion buffer. The thread calling Copy() or Run() always takes
+// part in the work, so a pool of one thread starts no threads at all.
+//
+// Copy() and Run() must only be called by one thread at a time.
+class MemcpyPool {
+public:
+  ~MemcpyPool();
+
+  // Starts num_threads - 1 threads to help the calling thread.
+  void Start(int num_threads);
+
+  // Stops all threads of the pool.
+  void Stop();
+
+  int num_threads() const;
+
+  // Does the copies, spread over the threads of the pool, and waits for them.
+  void Copy(const std::vector<MemcpyDesc>& copies);
+
+  // Runs the tasks, spread over the threads of the pool, and waits for them.
+  void Run(const std::vector<std::function<void()>>& tasks);
+
+private:
+  // Runs tasks of the current batch until there are none left.
+  void RunTasks();
+
+  void WorkerLoop();
+
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  bool shut_down_ = false;
+
+  // Batch of tasks being run, the next one to be started, and the number of
+  // tasks which haven't finished yet. generation_ changes with every batch.
+  const std::vector<std::function<void()>>* tasks_ = nullptr;
+  size_t next_task_ = 0;
+  size_t unfinished_tasks_ = 0;
+  uint64_t generation_ = 0;
+};
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_MEMCPY_POOL_H
@@ -0,0 +1,206 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "metrics.h"
+
+#include <algorithm>
+
+namespace horovod {
+namespace common {
+
+void Histogram::Record(int64_t value) {
+  int bucket = 0;
+  for (int64_t v = value; v > 0 && bucket < NUM_BUCKETS - 1; v >>= 1) {
+    ++bucket;
+  }
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::WriteJson(std::ostream& out) const {
+  out << "{\"count\": " << count_.load(std::memory_order_relaxed)
+      << ", \"sum\": " << sum_.load(std::memory_order_relaxed)
+      << ", \"buckets\": [";
+  bool first = true;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    auto count = buckets_[i].load(std::memory_order_relaxed);
+    if (count == 0) {
+      continue;
+    }
+    if (!first) {
+      out << ", ";
+    }
+    first = false;
+    out << "[" << (int64_t(1) << i) << ", " << count << "]";
+  }
+  out << "]}";
+}
+
+int64_t Histogram::Percentile(double fraction) const {
+  int64_t count = count_.load(std::memory_order_relaxed);
+  if (count == 0) {
+    return 0;
+  }
+  int64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= fraction * count) {
+      return int64_t(1) << i;
+    }
+  }
+  return int64_t(1) << (NUM_BUCKETS - 1);
+}
+
+void StragglerMetrics::Initialize(int size) {
+  if (size != size_) {
+    ranks_.reset(new RankLag[size]);
+    size_ = size;
+  }
+  first_name_.clear();
+}
+
+void StragglerMetrics::RecordArrival(const std::string& name, bool first,
+                                     int rank, int64_t lag_micros) {
+  if (rank < 0 || rank >= size_) {
+    return;
+  }
+  if (first) {
+    if (first_name_.empty()) {
+      first_name_ = name;
+    } else if (name == first_name_) {
+      EndStep();
+    }
+  }
+  auto& lag = ranks_[rank];
+  lag.tensor_lag_micros.Record(lag_micros);
+  lag.step_max_micros = std::max(lag.step_max_micros, lag_micros);
+}
+
+void StragglerMetrics::EndStep() {
+  for (int i = 0; i < size_; ++i) {
+    ranks_[i].step_lag_micros.Record(ranks_[i].step_max_micros);
+    ranks_[i].step_max_micros = 0;
+  }
+  steps_.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<int> StragglerMetrics::SlowestRanks(int count) const {
+  std::vector<int> ranks;
+  for (int i = 0; i < size_; ++i) {
+    if (ranks_[i].step_lag_micros.count() > 0) {
+      ranks.push_back(i);
+    }
+  }
+  std::stable_sort(ranks.begin(), ranks.end(), [this](int a, int b) {
+    return ranks_[a].step_lag_micros.Percentile(0.99) >
+           ranks_[b].step_lag_micros.Percentile(0.99);
+  });
+  ranks.resize(std::min((size_t)std::max(count, 0), ranks.size()));
+  return ranks;
+}
+
+void StragglerMetrics::WriteJson(std::ostream& out) const {
+  out << "{\"steps\": " << steps_.load(std::memory_order_relaxed)
+      << ", \"ranks\": [";
+  bool first = true;
+  for (int i = 0; i < size_; ++i) {
+    auto& lag = ranks_[i];
+    if (lag.tensor_lag_micros.count() == 0) {
+      continue;
+    }
+    if (!first) {
+      out << ", ";
+    }
+    first = false;
+    out << "{\"rank\": " << i << ", \"tensor_lag_micros\": {\"p50\": "
+        << lag.tensor_lag_micros.Percentile(0.5)
+        << ", \"p99\": " << lag.tensor_lag_micros.Percentile(0.99)
+        << "}, \"step_lag_micros\": {\"p50\": "
+        << lag.step_lag_micros.Percentile(0.5)
+        << ", \"p99\": " << lag.step_lag_micros.Percentile(0.99) << "}}";
+  }
+  out << "]}";
+}
+
+void Metrics::RecordOperation(MetricsBackend backend,
+                              MPIResponse::ResponseType response_type,
+                              int64_t bytes, int64_t microseconds, int size) {
+  double bus_factor = 1.0;
+  switch (response_type) {
+  case MPIResponse::ALLREDUCE:
+    bus_factor = 2.0 * (size - 1) / size;
+    break;
+  case MPIResponse::ALLGATHER:
+  case MPIResponse::REDUCESCATTER:
+  case MPIResponse::ALLTOALL:
+    bus_factor = (double)(size - 1) / size;
+    break;
+  default:
+    break;
+  }
+
+  auto& counters = backends_[backend];
+  counters.operations.fetch_add(1, std::memory_order_relaxed);
+  counters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  counters.bus_bytes.fetch_add((int64_t)(bytes * bus_factor),
+                               std::memory_order_relaxed);
+  counters.micros.fetch_add(microseconds, std::memory_order_relaxed);
+}
+
+std::string Metrics::ToJson() const {
+  static const char* backend_names[NUM_BACKENDS] = {"mpi", "nccl", "ddl"};
+
+  std::stringstream out;
+  out << "{\"negotiation_micros\": ";
+  negotiation_micros.WriteJson(out);
+  out << ", \"queue_micros\": ";
+  queue_micros.WriteJson(out);
+  out << ", \"fused_bytes\": ";
+  fused_bytes.WriteJson(out);
+  out << ", \"responses_per_cycle\": ";
+  responses_per_cycle.WriteJson(out);
+  out << ", \"ready_event_wait_micros\": ";
+  ready_event_wait_micros.WriteJson(out);
+  out << ", \"stragglers\": ";
+  stragglers.WriteJson(out);
+  out << ", \"buffers\": {\"fusion_bytes\": "
+      << fusion_buffer_bytes.load(std::memory_order_relaxed)
+      << ", \"shared_bytes\": "
+      << shared_buffer_bytes.load(std::memory_order_relaxed)
+      << ", \"budget_bytes\": "
+      << buffer_budget_bytes.load(std::memory_order_relaxed) << "}";
+
+  out << ", \"backends\": {";
+  for (int i = 0; i < NUM_BACKENDS; ++i) {
+    auto& counters = backends_[i];
+    auto micros = counters.micros.load(std::memory_order_relaxed);
+    auto bus_bytes = counters.bus_bytes.load(std::memory_order_relaxed);
+    if (i > 0) {
+      out << ", ";
+    }
+    out << "\"" << backend_names[i] << "\": {\"operations\": "
+        << counters.operations.load(std::memory_order_relaxed)
+        << ", \"bytes\": " << counters.bytes.load(std::memory_order_relaxed)
+        << ", \"bus_bytes\": " << bus_bytes << ", \"micros\": " << micros
+        << ", \"bus_bandwidth\": "
+        << (micros > 0 ? bus_bytes * 1e6 / micros : 0.0) << "}";
+  }
+  out << "}}";
+  return out.str();
+}
+
+} // namespace common
+} // namespace horovod
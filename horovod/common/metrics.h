@@ -0,0 +1,158 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_METRICS_H
+#define HOROVOD_METRICS_H
+
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "mpi_message.h"
+
+namespace horovod {
+namespace common {
+
+// Histogram of non-negative values with power-of-two buckets. Bucket 0 counts
+// values below 1 and bucket i values in [2^(i-1), 2^i). Values are recorded
+// with relaxed atomics, so any thread can record them while others read.
+class Histogram {
+public:
+  static const int NUM_BUCKETS = 48;
+
+  void Record(int64_t value);
+
+  // Writes the count, the sum and the buckets with their upper bounds as a
+  // JSON object. Empty buckets are left out.
+  void WriteJson(std::ostream& out) const;
+
+  // Upper bound of the bucket holding the given fraction of the values, or 0
+  // if there are none.
+  int64_t Percentile(double fraction) const;
+
+  int64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<int64_t> buckets_[NUM_BUCKETS] = {};
+  std::atomic<int64_t> count_{0};
+  std::atomic<int64_t> sum_{0};
+};
+
+// Lag of every rank behind the first rank which requested the same tensor, as
+// seen by the coordinator when it receives the requests, so the lag is
+// measured in negotiation cycles. A step ends when the first tensor ever
+// negotiated is negotiated again, and the lag of a rank in a step is its
+// largest lag in the step. Only used by the coordinator; Record* and EndStep
+// are only called by the background thread.
+class StragglerMetrics {
+public:
+  // Allocates the histograms of all ranks before metrics can be read.
+  void Initialize(int size);
+
+  // Records the arrival of the request of a rank for a tensor, which is the
+  // first request for it if lag_micros is 0 and first is true.
+  void RecordArrival(const std::string& name, bool first, int rank,
+                     int64_t lag_micros);
+
+  // Ranks with the largest 99th percentile of their lag per step, slowest
+  // first. Empty until the first step ended.
+  std::vector<int> SlowestRanks(int count) const;
+
+  int64_t step_lag_percentile(int rank, double fraction) const {
+    return ranks_[rank].step_lag_micros.Percentile(fraction);
+  }
+
+  // Writes the number of steps and the percentiles of the lag per tensor and
+  // per step of every rank as a JSON object.
+  void WriteJson(std::ostream& out) const;
+
+private:
+  void EndStep();
+
+  struct RankLag {
+    Histogram tensor_lag_micros;
+    Histogram step_lag_micros;
+    int64_t step_max_micros = 0;
+  };
+
+  std::unique_ptr<RankLag[]> ranks_;
+  int size_ = 0;
+  std::string first_name_;
+  std::atomic<int64_t> steps_{0};
+};
+
+enum MetricsBackend { MPI_BACKEND = 0, NCCL_BACKEND = 1, DDL_BACKEND = 2 };
+
+// Counters and histograms of the background thread, which are cheap enough to
+// be maintained all the time.
+class Metrics {
+public:
+  static const int NUM_BACKENDS = 3;
+
+  // Accounts a completed collective operation on the given number of ranks,
+  // which took microseconds from the start of the operation until its output
+  // was ready.
+  void RecordOperation(MetricsBackend backend,
+                       MPIResponse::ResponseType response_type, int64_t bytes,
+                       int64_t microseconds, int size);
+
+  // Returns all metrics as a JSON object.
+  std::string ToJson() const;
+
+  // Time from the start of negotiation until the responses of a cycle are
+  // known.
+  Histogram negotiation_micros;
+
+  // Time from enqueueing a tensor until its operation starts.
+  Histogram queue_micros;
+
+  // Size of the data of every allreduce, fused or not.
+  Histogram fused_bytes;
+
+  // Number of responses performed in a cycle which has any.
+  Histogram responses_per_cycle;
+
+  // Time the background thread polls ready events before an operation.
+  Histogram ready_event_wait_micros;
+
+  // Lag of every rank in negotiation, only recorded by the coordinator.
+  StragglerMetrics stragglers;
+
+  // Bytes allocated for the fusion buffers and the shared memory buffer of the
+  // node, and the budget they are kept within, or zero for none.
+  std::atomic<int64_t> fusion_buffer_bytes{0};
+  std::atomic<int64_t> shared_buffer_bytes{0};
+  std::atomic<int64_t> buffer_budget_bytes{0};
+
+private:
+  struct BackendCounters {
+    std::atomic<int64_t> operations{0};
+    std::atomic<int64_t> bytes{0};
+    // Bytes weighted by the share of the data every rank sends over the bus
+    // in the operation, as in the bus bandwidth of the NCCL tests.
+    std::atomic<int64_t> bus_bytes{0};
+    std::atomic<int64_t> micros{0};
+  };
+
+  BackendCounters backends_[NUM_BACKENDS];
+};
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_METRICS_H
@@ -16,6 +16,7 @@
 
 #include "mpi_message.h"
 #include "wire/mpi_message_generated.h"
+#include <cassert>
 #include <iostream>
 
 namespace horovod {
@@ -53,6 +54,46 @@ const std::string& MPIDataType_Name(MPIDataType value) {
   case HOROVOD_BOOL:
     static const std::string bool_("bool");
     return bool_;
+  case HOROVOD_BFLOAT16:
+    static const std::string bfloat16("bfloat16");
+    return bfloat16;
+  default:
+    static const std::string unknown("<unknown>");
+    return unknown;
+  }
+}
+
+const std::string& Compression_Name(Compression value) {
+  switch (value) {
+  case NO_COMPRESSION:
+    static const std::string none("none");
+    return none;
+  case FP16_COMPRESSION:
+    static const std::string fp16("fp16");
+    return fp16;
+  case INT8_COMPRESSION:
+    static const std::string int8("int8");
+    return int8;
+  case ONEBIT_COMPRESSION:
+    static const std::string onebit("onebit");
+    return onebit;
+  default:
+    static const std::string unknown("<unknown>");
+    return unknown;
+  }
+}
+
+const std::string& ReduceScope_Name(ReduceScope value) {
+  switch (value) {
+  case GLOBAL_SCOPE:
+    static const std::string global("global");
+    return global;
+  case LOCAL_SCOPE:
+    static const std::string local("local");
+    return local;
+  case CROSS_SCOPE:
+    static const std::string cross("cross");
+    return cross;
   default:
     static const std::string unknown("<unknown>");
     return unknown;
@@ -70,6 +111,15 @@ const std::string& MPIRequest::RequestType_Name(RequestType value) {
   case RequestType::BROADCAST:
     static const std::string broadcast("BROADCAST");
     return broadcast;
+  case RequestType::SPARSE_ALLREDUCE:
+    static const std::string sparse_allreduce("SPARSE_ALLREDUCE");
+    return sparse_allreduce;
+  case RequestType::REDUCESCATTER:
+    static const std::string reducescatter("REDUCESCATTER");
+    return reducescatter;
+  case RequestType::ALLTOALL:
+    static const std::string alltoall("ALLTOALL");
+    return alltoall;
   default:
     static const std::string unknown("<unknown>");
     return unknown;
@@ -90,10 +140,61 @@ MPIDataType MPIRequest::tensor_type() const { return tensor_type_; }
 
 void MPIRequest::set_tensor_type(MPIDataType value) { tensor_type_ = value; }
 
-const std::string& MPIRequest::tensor_name() const { return tensor_name_; }
+int32_t TensorIdTable::id(const std::string& name) const {
+  auto it = ids_.find(name);
+  return it != ids_.end() ? it->second : -1;
+}
+
+const std::string& TensorIdTable::name(int32_t id) const {
+  assert(registered(id));
+  return names_[id];
+}
+
+bool TensorIdTable::registered(int32_t id) const {
+  return id >= 0 && id < size();
+}
+
+int32_t TensorIdTable::register_name(const std::string& name) {
+  assert(ids_.find(name) == ids_.end());
+  auto id = size();
+  names_.push_back(name);
+  ids_.emplace(name, id);
+  seen_once_.erase(name);
+  return id;
+}
+
+bool TensorIdTable::should_register(const std::string& name) {
+  if (size() >= capacity_) {
+    return false;
+  }
+  if (seen_once_.erase(name) > 0) {
+    return true;
+  }
+  // Names which never come back must not accumulate either.
+  if ((int32_t)seen_once_.size() >= capacity_) {
+    seen_once_.clear();
+  }
+  seen_once_.insert(name);
+  return false;
+}
+
+int32_t TensorIdTable::size() const { return (int32_t)names_.size(); }
+
+void TensorIdTable::set_capacity(int32_t capacity) { capacity_ = capacity; }
+
+const std::string& MPIRequest::tensor_name() const {
+  return registered_tensor_name_ != nullptr ? *registered_tensor_name_
+                                            : tensor_name_;
+}
 
 void MPIRequest::set_tensor_name(const std::string& value) {
   tensor_name_ = value;
+  registered_tensor_name_ = nullptr;
+}
+
+void MPIRequest::set_registered_tensor_name(const std::string& value) {
+  tensor_name_.clear();
+  registered_tensor_name_ = &value;
 }
 
 int32_t MPIRequest::root_rank() const { return root_rank_; }
@@ -116,25 +217,56 @@ void MPIRequest::add_tensor_shape(int64_t value) {
   tensor_shape_.push_back(value);
 }
 
+Compression MPIRequest::compression() const { return compression_; }
+
+void MPIRequest::set_compression(Compression value) { compression_ = value; }
+
+int32_t MPIRequest::priority() const { return priority_; }
+
+void MPIRequest::set_priority(int32_t value) { priority_ = value; }
+
+ReduceScope MPIRequest::scope() const { return scope_; }
+
+void MPIRequest::set_scope(ReduceScope value) { scope_ = value; }
+
 namespace {
 
-void MPIRequest_ParseFromWire(MPIRequest& request,
-                              const wire::MPIRequest* obj) {
+// Returns false if the request carries an ID which isn't in tensor_ids.
+bool MPIRequest_ParseFromWire(MPIRequest& request,
+                              const wire::MPIRequest* obj,
+                              const TensorIdTable* tensor_ids) {
   request.set_request_rank(obj->request_rank());
   request.set_request_type((MPIRequest::RequestType)obj->request_type());
   request.set_tensor_type((MPIDataType)obj->tensor_type());
-  request.set_tensor_name(obj->tensor_name()->str());
+  if (obj->tensor_id() >= 0) {
+    if (tensor_ids == nullptr || !tensor_ids->registered(obj->tensor_id())) {
+      return false;
+    }
+    request.set_registered_tensor_name(tensor_ids->name(obj->tensor_id()));
+  } else {
+    request.set_tensor_name(obj->tensor_name()->str());
+  }
   request.set_root_rank(obj->root_rank());
   request.set_device(obj->device());
   request.set_tensor_shape(std::vector<int64_t>(obj->tensor_shape()->begin(),
                                                 obj->tensor_shape()->end()));
+  request.set_compression((Compression)obj->compression());
+  request.set_priority(obj->priority());
+  request.set_scope((ReduceScope)obj->scope());
+  return true;
 }
 
 void MPIRequest_SerializeToWire(const MPIRequest& request,
                                 flatbuffers::FlatBufferBuilder& builder,
-                                flatbuffers::Offset<wire::MPIRequest>& obj) {
+                                flatbuffers::Offset<wire::MPIRequest>& obj,
+                                const TensorIdTable* tensor_ids) {
   // FlatBuffers must be built bottom-up.
-  auto tensor_name_wire = builder.CreateString(request.tensor_name());
+  int32_t tensor_id =
+      tensor_ids != nullptr ? tensor_ids->id(request.tensor_name()) : -1;
+  flatbuffers::Offset<flatbuffers::String> tensor_name_wire;
+  if (tensor_id < 0) {
+    tensor_name_wire = builder.CreateString(request.tensor_name());
+  }
   auto tensor_shape_wire = builder.CreateVector(request.tensor_shape());
 
   wire::MPIRequestBuilder request_builder(builder);
@@ -142,10 +274,16 @@ void MPIRequest_SerializeToWire(const MPIRequest& request,
   request_builder.add_request_type(
       (wire::MPIRequestType)request.request_type());
   request_builder.add_tensor_type((wire::MPIDataType)request.tensor_type());
-  request_builder.add_tensor_name(tensor_name_wire);
+  if (tensor_id < 0) {
+    request_builder.add_tensor_name(tensor_name_wire);
+  }
+  request_builder.add_tensor_id(tensor_id);
   request_builder.add_root_rank(request.root_rank());
   request_builder.add_device(request.device());
   request_builder.add_tensor_shape(tensor_shape_wire);
+  request_builder.add_compression((wire::Compression)request.compression());
+  request_builder.add_priority(request.priority());
+  request_builder.add_scope((int8_t)request.scope());
   obj = request_builder.Finish();
 }
 
@@ -153,14 +291,14 @@ void MPIRequest_SerializeToWire(const MPIRequest& request,
 
 void MPIRequest::ParseFromBytes(MPIRequest& request, const uint8_t* input) {
   auto obj = flatbuffers::GetRoot<wire::MPIRequest>(input);
-  MPIRequest_ParseFromWire(request, obj);
+  MPIRequest_ParseFromWire(request, obj, nullptr);
 }
 
 void MPIRequest::SerializeToString(const MPIRequest& request,
                                    std::string& output) {
   flatbuffers::FlatBufferBuilder builder(1024);
   flatbuffers::Offset<wire::MPIRequest> obj;
-  MPIRequest_SerializeToWire(request, builder, obj);
+  MPIRequest_SerializeToWire(request, builder, obj, nullptr);
   builder.Finish(obj);
 
   uint8_t* buf = builder.GetBufferPointer();
@@ -188,26 +326,31 @@ void MPIRequestList::emplace_request(MPIRequest&& value) {
   requests_.emplace_back(value);
 }
 
-void MPIRequestList::ParseFromBytes(MPIRequestList& request_list,
-                                    const uint8_t* input) {
+bool MPIRequestList::ParseFromBytes(MPIRequestList& request_list,
+                                    const uint8_t* input,
+                                    const TensorIdTable& tensor_ids) {
   auto obj = flatbuffers::GetRoot<wire::MPIRequestList>(input);
   for (const auto& req_obj : *obj->requests()) {
     MPIRequest request;
-    MPIRequest_ParseFromWire(request, req_obj);
+    if (!MPIRequest_ParseFromWire(request, req_obj, &tensor_ids)) {
+      return false;
+    }
     request_list.emplace_request(std::move(request));
   }
   request_list.set_shutdown(obj->shutdown());
+  return true;
 }
 
 void MPIRequestList::SerializeToString(const MPIRequestList& request_list,
-                                       std::string& output) {
+                                       std::string& output,
+                                       const TensorIdTable& tensor_ids) {
   // FlatBuffers must be built bottom-up.
   flatbuffers::FlatBufferBuilder builder(1024);
   std::vector<flatbuffers::Offset<wire::MPIRequest>> requests;
   requests.reserve(request_list.requests().size());
   for (const auto& req : request_list.requests()) {
     flatbuffers::Offset<wire::MPIRequest> req_obj;
-    MPIRequest_SerializeToWire(req, builder, req_obj);
+    MPIRequest_SerializeToWire(req, builder, req_obj, &tensor_ids);
     requests.push_back(req_obj);
   }
   auto requests_wire = builder.CreateVector(requests);
@@ -237,6 +380,15 @@ const std::string& MPIResponse::ResponseType_Name(ResponseType value) {
   case ResponseType::ERROR:
     static const std::string error("ERROR");
     return error;
+  case ResponseType::SPARSE_ALLREDUCE:
+    static const std::string sparse_allreduce("SPARSE_ALLREDUCE");
+    return sparse_allreduce;
+  case ResponseType::REDUCESCATTER:
+    static const std::string reducescatter("REDUCESCATTER");
+    return reducescatter;
+  case ResponseType::ALLTOALL:
+    static const std::string alltoall("ALLTOALL");
+    return alltoall;
   default:
     static const std::string unknown("<unknown>");
     return unknown;
@@ -303,6 +455,18 @@ void MPIResponse::add_tensor_size(int64_t value) {
   tensor_sizes_.push_back(value);
 }
 
+int32_t MPIResponse::priority() const { return priority_; }
+
+void MPIResponse::set_priority(int32_t value) { priority_ = value; }
+
+ReduceScope MPIResponse::scope() const { return scope_; }
+
+void MPIResponse::set_scope(ReduceScope value) { scope_ = value; }
+
+bool MPIResponse::shape_stable() const { return shape_stable_; }
+
+void MPIResponse::set_shape_stable(bool value) { shape_stable_ = value; }
+
 void MPIResponse::add_allgather_response(const MPIResponse& response) {
   assert(response_type() == MPIResponse::ResponseType::ALLGATHER);
   assert(response.tensor_names().size() == 1);
@@ -311,32 +475,70 @@ void MPIResponse::add_allgather_response(const MPIResponse& response) {
   for (auto size : response.tensor_sizes()) {
     add_tensor_size(size);
   }
+  shape_stable_ = shape_stable_ && response.shape_stable();
 }
 
-void MPIResponse_ParseFromWire(MPIResponse& response,
-                               const wire::MPIResponse* obj) {
+// Returns false if the response carries an ID which isn't in tensor_ids.
+bool MPIResponse_ParseFromWire(MPIResponse& response,
+                               const wire::MPIResponse* obj,
+                               const TensorIdTable* tensor_ids) {
   response.set_response_type((MPIResponse::ResponseType)obj->response_type());
-  for (const auto& tensor_name_obj : *obj->tensor_names()) {
-    response.add_tensor_name(tensor_name_obj->str());
+  if (obj->tensor_ids() != nullptr) {
+    for (auto tensor_id : *obj->tensor_ids()) {
+      if (tensor_ids == nullptr || !tensor_ids->registered(tensor_id)) {
+        return false;
+      }
+      response.add_tensor_name(tensor_ids->name(tensor_id));
+    }
+  } else {
+    for (const auto& tensor_name_obj : *obj->tensor_names()) {
+      response.add_tensor_name(tensor_name_obj->str());
+    }
   }
   response.set_error_message(obj->error_message()->str());
   response.set_devices(
       std::vector<int32_t>(obj->devices()->begin(), obj->devices()->end()));
   response.set_tensor_sizes(std::vector<int64_t>(obj->tensor_sizes()->begin(),
                                                  obj->tensor_sizes()->end()));
+  response.set_priority(obj->priority());
+  response.set_scope((ReduceScope)obj->scope());
+  response.set_shape_stable(obj->shape_stable());
+  return true;
 }
 
 void MPIResponse::ParseFromBytes(MPIResponse& response, const uint8_t* input) {
   auto obj = flatbuffers::GetRoot<wire::MPIResponse>(input);
-  MPIResponse_ParseFromWire(response, obj);
+  MPIResponse_ParseFromWire(response, obj, nullptr);
 }
 
 void MPIResponse_SerializeToWire(const MPIResponse& response,
                                  flatbuffers::FlatBufferBuilder& builder,
-                                 flatbuffers::Offset<wire::MPIResponse>& obj) {
+                                 flatbuffers::Offset<wire::MPIResponse>& obj,
+                                 const TensorIdTable* tensor_ids) {
   // FlatBuffers must be built bottom-up.
-  auto tensor_names_wire =
-      builder.CreateVectorOfStrings(response.tensor_names());
+  flatbuffers::Offset<flatbuffers::Vector<int32_t>> tensor_ids_wire;
+  flatbuffers::Offset<
+      flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>>
+      tensor_names_wire;
+  // Responses carry IDs only if all of their tensors have one.
+  std::vector<int32_t> ids;
+  if (tensor_ids != nullptr) {
+    ids.reserve(response.tensor_names().size());
+    for (auto& name : response.tensor_names()) {
+      auto id = tensor_ids->id(name);
+      if (id < 0) {
+        ids.clear();
+        break;
+      }
+      ids.push_back(id);
+    }
+  }
+  bool use_ids = !ids.empty();
+  if (use_ids) {
+    tensor_ids_wire = builder.CreateVector(ids);
+  } else {
+    tensor_names_wire = builder.CreateVectorOfStrings(response.tensor_names());
+  }
   auto error_message_wire = builder.CreateString(response.error_message());
   auto devices_wire = builder.CreateVector(response.devices());
   auto tensor_sizes_wire = builder.CreateVector(response.tensor_sizes());
@@ -344,10 +546,17 @@ void MPIResponse_SerializeToWire(const MPIResponse& response,
   wire::MPIResponseBuilder response_builder(builder);
   response_builder.add_response_type(
       (wire::MPIResponseType)response.response_type());
-  response_builder.add_tensor_names(tensor_names_wire);
+  if (use_ids) {
+    response_builder.add_tensor_ids(tensor_ids_wire);
+  } else {
+    response_builder.add_tensor_names(tensor_names_wire);
+  }
   response_builder.add_error_message(error_message_wire);
   response_builder.add_devices(devices_wire);
   response_builder.add_tensor_sizes(tensor_sizes_wire);
+  response_builder.add_priority(response.priority());
+  response_builder.add_scope((int8_t)response.scope());
+  response_builder.add_shape_stable(response.shape_stable());
   obj = response_builder.Finish();
 }
 
@@ -355,7 +564,7 @@ void MPIResponse::SerializeToString(const MPIResponse& response,
                                     std::string& output) {
   flatbuffers::FlatBufferBuilder builder(1024);
   flatbuffers::Offset<wire::MPIResponse> obj;
-  MPIResponse_SerializeToWire(response, builder, obj);
+  MPIResponse_SerializeToWire(response, builder, obj, nullptr);
   builder.Finish(obj);
 
   uint8_t* buf = builder.GetBufferPointer();
@@ -383,33 +592,59 @@ void MPIResponseList::emplace_response(MPIResponse&& value) {
   responses_.emplace_back(value);
 }
 
-void MPIResponseList::ParseFromBytes(MPIResponseList& response_list,
-                                     const uint8_t* input) {
+const std::vector<std::string>& MPIResponseList::new_tensor_names() const {
+  return new_tensor_names_;
+}
+
+void MPIResponseList::add_new_tensor_name(const std::string& value) {
+  new_tensor_names_.push_back(value);
+}
+
+bool MPIResponseList::ParseFromBytes(MPIResponseList& response_list,
+                                     const uint8_t* input,
+                                     TensorIdTable& tensor_ids) {
   auto obj = flatbuffers::GetRoot<wire::MPIResponseList>(input);
+  if (obj->new_tensor_names() != nullptr) {
+    for (const auto& tensor_name_obj : *obj->new_tensor_names()) {
+      auto name = tensor_name_obj->str();
+      if (tensor_ids.id(name) >= 0) {
+        return false;
+      }
+      tensor_ids.register_name(name);
+      response_list.add_new_tensor_name(name);
+    }
+  }
   for (const auto& resp_obj : *obj->responses()) {
     MPIResponse response;
-    MPIResponse_ParseFromWire(response, resp_obj);
+    if (!MPIResponse_ParseFromWire(response, resp_obj, &tensor_ids)) {
+      return false;
+    }
     response_list.emplace_response(std::move(response));
   }
   response_list.set_shutdown(obj->shutdown());
+  return true;
 }
 
 void MPIResponseList::SerializeToString(const MPIResponseList& response_list,
-                                        std::string& output) {
+                                        std::string& output,
+                                        const TensorIdTable& tensor_ids) {
   // FlatBuffers must be built bottom-up.
   flatbuffers::FlatBufferBuilder builder(1024);
   std::vector<flatbuffers::Offset<wire::MPIResponse>> responses;
   responses.reserve(response_list.responses().size());
   for (const auto& resp : response_list.responses()) {
     flatbuffers::Offset<wire::MPIResponse> resp_obj;
-    MPIResponse_SerializeToWire(resp, builder, resp_obj);
+    MPIResponse_SerializeToWire(resp, builder, resp_obj, &tensor_ids);
     responses.push_back(resp_obj);
   }
   auto responses_wire = builder.CreateVector(responses);
+  auto new_tensor_names_wire =
+      builder.CreateVectorOfStrings(response_list.new_tensor_names());
 
   wire::MPIResponseListBuilder response_list_builder(builder);
   response_list_builder.add_responses(responses_wire);
   response_list_builder.add_shutdown(response_list.shutdown());
+  response_list_builder.add_new_tensor_names(new_tensor_names_wire);
   auto obj = response_list_builder.Finish();
   builder.Finish(obj);
 
@@ -17,7 +17,11 @@
 #ifndef HOROVOD_MPI_MESSAGE_H
 #define HOROVOD_MPI_MESSAGE_H
 
+#include <deque>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace horovod {
@@ -33,17 +37,85 @@ enum MPIDataType {
   HOROVOD_FLOAT16 = 6,
   HOROVOD_FLOAT32 = 7,
   HOROVOD_FLOAT64 = 8,
-  HOROVOD_BOOL = 9
+  HOROVOD_BOOL = 9,
+  HOROVOD_BFLOAT16 = 10
 };
 
 const std::string& MPIDataType_Name(MPIDataType value);
 
+// Compression that Horovod applies to the data of a tensor while it is
+// communicated. FP16_COMPRESSION casts float32 data to float16 when it is
+// packed into the fusion buffer and back when it is unpacked.
+// INT8_COMPRESSION and ONEBIT_COMPRESSION quantize float32 data to 8 bits or
+// to its sign with per-chunk scales and keep the quantization error of every
+// tensor to add it to the next step (see quantization.h).
+enum Compression {
+  NO_COMPRESSION = 0,
+  FP16_COMPRESSION = 1,
+  INT8_COMPRESSION = 2,
+  ONEBIT_COMPRESSION = 3
+};
+
+const std::string& Compression_Name(Compression value);
+
+// Ranks an allreduce sums up the tensor across. LOCAL_SCOPE reduces within
+// every node on the local communicator, and CROSS_SCOPE across nodes between
+// the ranks with the same local rank on the cross communicator.
+enum ReduceScope { GLOBAL_SCOPE = 0, LOCAL_SCOPE = 1, CROSS_SCOPE = 2 };
+const std::string& ReduceScope_Name(ReduceScope value);
+
+// Dense integer IDs of tensor names. The coordinator assigns an ID to a
+// tensor the second time it responds with it and sends the new names along
+// with the response list, so all ranks register the same names in the same
+// order. Afterwards, requests and responses only carry the IDs. Names which
+// are only used once, like those of unnamed operations, and names beyond the
+// capacity of the table keep being sent as strings.
+class TensorIdTable {
+public:
+  // Returns the ID of the name, or -1 if it isn't registered.
+  int32_t id(const std::string& name) const;
+
+  // Returns the name of a registered ID. References stay valid for the
+  // lifetime of the table.
+  const std::string& name(int32_t id) const;
+
+  // Whether an ID received from another rank is registered.
+  bool registered(int32_t id) const;
+
+  // Assigns the next ID to a name, which must not be registered yet.
+  int32_t register_name(const std::string& name);
+
+  // Called by the coordinator for every unregistered name it responds with.
+  // Returns true if the name has been responded with before and there is
+  // room for it in the table.
+  bool should_register(const std::string& name);
+
+  int32_t size() const;
+
+  // Maximum number of registered names. Only used by the coordinator.
+  void set_capacity(int32_t capacity);
+
+private:
+  std::unordered_map<std::string, int32_t> ids_;
+  std::deque<std::string> names_;
+  int32_t capacity_ = 0;
+  // Names the coordinator has responded with once, bounded by the capacity.
+  std::unordered_set<std::string> seen_once_;
+};
+
 // An MPIRequest is a message sent from a rank greater than zero to the
 // coordinator (rank zero), informing the coordinator of an operation that
 // the rank wants to do and the tensor that it wants to apply the operation to.
 class MPIRequest {
 public:
-  enum RequestType { ALLREDUCE = 0, ALLGATHER = 1, BROADCAST = 2 };
+  enum RequestType {
+    ALLREDUCE = 0,
+    ALLGATHER = 1,
+    BROADCAST = 2,
+    SPARSE_ALLREDUCE = 3,
+    REDUCESCATTER = 4,
+    ALLTOALL = 5
+  };
 
   static const std::string& RequestType_Name(RequestType value);
 
@@ -61,6 +133,9 @@ public:
 
   const std::string& tensor_name() const;
   void set_tensor_name(const std::string& value);
+  // Refers to a name kept by a TensorIdTable, which outlives the request,
+  // instead of copying it.
+  void set_registered_tensor_name(const std::string& value);
 
   int32_t root_rank() const;
   void set_root_rank(int32_t value);
@@ -72,6 +147,16 @@ public:
   void set_tensor_shape(const std::vector<int64_t>& value);
   void add_tensor_shape(int64_t value);
 
+  Compression compression() const;
+  void set_compression(Compression value);
+
+  // Allreduces of tensors with a higher priority are performed first.
+  int32_t priority() const;
+  void set_priority(int32_t value);
+
+  ReduceScope scope() const;
+  void set_scope(ReduceScope value);
+
   static void ParseFromBytes(MPIRequest& request, const uint8_t* input);
   static void SerializeToString(const MPIRequest& request, std::string& output);
 
@@ -82,7 +167,11 @@ private:
   int32_t root_rank_ = 0;
   int32_t device_ = 0;
   std::string tensor_name_;
+  const std::string* registered_tensor_name_ = nullptr;
   std::vector<int64_t> tensor_shape_;
+  Compression compression_ = Compression::NO_COMPRESSION;
+  int32_t priority_ = 0;
+  ReduceScope scope_ = GLOBAL_SCOPE;
 };
 
 class MPIRequestList {
@@ -94,10 +183,14 @@ public:
   bool shutdown() const;
   void set_shutdown(bool value);
 
-  static void ParseFromBytes(MPIRequestList& request_list,
-                             const uint8_t* input);
+  // Requests of tensors with an ID in tensor_ids only carry the ID. Parsing
+  // returns false if a request carries an ID which isn't registered.
+  static bool ParseFromBytes(MPIRequestList& request_list,
+                             const uint8_t* input,
+                             const TensorIdTable& tensor_ids);
   static void SerializeToString(const MPIRequestList& request_list,
-                                std::string& output);
+                                std::string& output,
+                                const TensorIdTable& tensor_ids);
 
 private:
   std::vector<MPIRequest> requests_;
@@ -111,7 +204,15 @@ private:
 // an error message instead.
 class MPIResponse {
 public:
-  enum ResponseType { ALLREDUCE = 0, ALLGATHER = 1, BROADCAST = 2, ERROR = 3 };
+  enum ResponseType {
+    ALLREDUCE = 0,
+    ALLGATHER = 1,
+    BROADCAST = 2,
+    ERROR = 3,
+    SPARSE_ALLREDUCE = 4,
+    REDUCESCATTER = 5,
+    ALLTOALL = 6
+  };
 
   static const std::string& ResponseType_Name(ResponseType value);
 
@@ -132,14 +233,29 @@ public:
   void set_devices(const std::vector<int32_t>& value);
   void add_device(int32_t value);
 
-  // Empty unless response_type is ALLGATHER.
+  // Empty unless response_type is ALLGATHER or SPARSE_ALLREDUCE.
   // These tensor sizes are the dimension zero sizes of all the input matrices,
   // indexed by the rank.
   const std::vector<int64_t>& tensor_sizes() const;
   void set_tensor_sizes(const std::vector<int64_t>& value);
   void add_tensor_size(int64_t value);
 
-  // To fuse multiple allgather responses
+  // Priority of the tensors, or of the first tensor of a fused response.
+  int32_t priority() const;
+  void set_priority(int32_t value);
+
+  // Ranks the tensors of an allreduce are summed up across.
+  ReduceScope scope() const;
+  void set_scope(ReduceScope value);
+
+  // True if the tensor sizes of an allgather haven't changed since the
+  // last response for its tensors, so that the output layout computed for
+  // that response can be reused.
+  bool shape_stable() const;
+  void set_shape_stable(bool value);
+
+  // To fuse multiple allgather responses. A fused response is only
+  // shape-stable if all of its parts are.
   void add_allgather_response(const MPIResponse& response);
 
   static void ParseFromBytes(MPIResponse& response, const uint8_t* input);
@@ -152,6 +268,9 @@ private:
   std::string error_message_;
   std::vector<int32_t> devices_;
   std::vector<int64_t> tensor_sizes_;
+  int32_t priority_ = 0;
+  ReduceScope scope_ = GLOBAL_SCOPE;
+  bool shape_stable_ = false;
 };
 
 class MPIResponseList {
@@ -163,14 +282,24 @@ public:
   bool shutdown() const;
   void set_shutdown(bool value);
 
-  static void ParseFromBytes(MPIResponseList& response_list,
-                             const uint8_t* input);
+  // Names registered by the coordinator for the responses of this list.
+  const std::vector<std::string>& new_tensor_names() const;
+  void add_new_tensor_name(const std::string& value);
+
+  // Responses only carry the IDs of their tensors, so all of them must be
+  // registered in tensor_ids or be new names of the list. Parsing registers
+  // the new names in tensor_ids first, and returns false if a new name is
+  // registered already or a response carries an ID which isn't registered.
+  static bool ParseFromBytes(MPIResponseList& response_list,
+                             const uint8_t* input, TensorIdTable& tensor_ids);
   static void SerializeToString(const MPIResponseList& response_list,
-                                std::string& output);
+                                std::string& output,
+                                const TensorIdTable& tensor_ids);
 
 private:
   std::vector<MPIResponse> responses_;
   bool shutdown_ = false;
+  std::vector<std::string> new_tensor_names_;
 };
 
 } // namespace common
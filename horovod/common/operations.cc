@@ -14,12 +14,20 @@
 // limitations under the License.
 // =============================================================================
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <climits>
+#include <condition_variable>
 #include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
 #include <queue>
+#include <set>
 #include <sstream>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -36,15 +44,47 @@
 #endif
 
 #define OMPI_SKIP_MPICXX
+#include "affinity.h"
 #include "fusion_buffer_manager.h"
+#include "gradient_accumulation.h"
 #include "half.h"
 #include "hashes.h"
+#include "metrics.h"
 #include "mpi.h"
 #include "mpi_message.h"
 #include "operations.h"
 #include "parameter_manager.h"
+#include "quantization.h"
+#include "replay.h"
+#include "response_cache.h"
+#include "tensor_partition.h"
+#include "tcp_ring.h"
+#include "tensor_queue.h"
 #include "timeline.h"
 #include "logging.h"
+#include "memcpy_pool.h"
+
+#if HAVE_CUDA
+#include "cuda_kernels.h"
+#endif
+
+// Open MPI declares MPIX_Query_cuda_support() in its extensions.
+#if HAVE_CUDA && defined(OPEN_MPI)
+#include "mpi-ext.h"
+#endif
+
+// Alltoall of GPU tensors uses the point-to-point operations of NCCL, which
+// were added in NCCL 2.7.
+#if HOROVOD_GPU_ALLREDUCE == 'N' && NCCL_VERSION_CODE >= 2700
+#define HOROVOD_NCCL_ALLTOALL 1
+#endif
+
+// NCCL operations can be captured into CUDA graphs since NCCL 2.9, which
+// needs CUDA 11.3.
+#if HOROVOD_GPU_ALLREDUCE == 'N' && NCCL_VERSION_CODE >= 2900 &&             \
+    CUDART_VERSION >= 11030
+#define HAVE_CUDA_GRAPHS 1
+#endif
 
 /*
  * Allreduce, Allgather and Broadcast Ops.
@@ -66,6 +106,13 @@
  *      - HorovodBroadcast:
  *          Perform a broadcast on a Tensor, broadcasting Tensor
  *          value from root rank to all other ranks.
+ *      - HorovodReducescatter:
+ *          Perform a reducescatter on a Tensor, returning the part of the sum
+ *          across all MPI processes that belongs to this process.
+ *      - HorovodAlltoall:
+ *          Perform an alltoall on a Tensor, sending a part of the first
+ *          dimension to every MPI process and concatenating the received
+ *          parts.
  *
  * Additionally, this library provides C APIs to initialize Horovod and query
  * rank, local rank and world size.  These are used in Python directly through
@@ -77,28 +124,6 @@ namespace common {
 
 namespace {
 
-// Table storing Tensors to be reduced, keyed by unique name.
-// This table contains everything necessary to do the reduction.
-struct TensorTableEntry {
-  // Name of the tensor.
-  std::string tensor_name;
-  // Operation context.
-  std::shared_ptr<OpContext> context;
-  // Input tensor.
-  std::shared_ptr<Tensor> tensor;
-  // Pre-allocated output tensor.
-  std::shared_ptr<Tensor> output;
-  // Root rank for broadcast operation.
-  int root_rank = 0;
-  // Event indicating that data is ready.
-  std::shared_ptr<ReadyEvent> ready_event;
-  // GPU to do reduction on, or CPU_DEVICE_ID in case of CPU.
-  int device = CPU_DEVICE_ID;
-  // A callback to call with the status.
-  StatusCallback callback;
-};
-using TensorTable = std::unordered_map<std::string, TensorTableEntry>;
-
 // Table for storing Tensor metadata on rank zero. This is used for error
 // checking, stall checking and size calculations, as well as determining
 // when a reduction is ready to be done (when all nodes are ready to do it).
@@ -106,6 +131,163 @@ using MessageTable = std::unordered_map<
     std::string,
     std::tuple<std::vector<MPIRequest>, std::chrono::steady_clock::time_point>>;
 
+#if HAVE_CUDA
+// Event recorded on the stream of a GPU operation at the end of an activity
+// in the timeline, or with an empty name at the end of the operation.
+struct ActivityEvent {
+  std::string name;
+  cudaEvent_t event;
+  // Time on the timeline when the event was recorded.
+  long record_micros;
+};
+
+// Event completed on an idle stream of a device, and the time on the
+// timeline right after it completed. Times of other events on the device are
+// measured relative to it.
+struct TimelineClock {
+  cudaStream_t stream = nullptr;
+  cudaEvent_t event = nullptr;
+  long micros = 0;
+};
+#endif
+
+// Operation being performed by the background thread, which is accounted in
+// the metrics once its entries are completed.
+struct OperationMetrics {
+  bool record = false;
+  MetricsBackend backend = MPI_BACKEND;
+  MPIResponse::ResponseType response_type = MPIResponse::ALLREDUCE;
+  int64_t bytes = 0;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Entries of an operation performed by the background thread, waiting for
+// the finalizer thread to call their callbacks.
+struct Completion {
+  std::vector<TensorTableEntry> entries;
+  Status status;
+  OperationMetrics operation;
+  // Whether the entries still have to be ended in the timeline.
+  bool end_in_timeline = false;
+#if HAVE_CUDA
+  // Device of the entries, and events which have to complete before the
+  // output of the entries can be used.
+  int device = CPU_DEVICE_ID;
+  std::queue<ActivityEvent> event_queue;
+#endif
+};
+
+// Quantization error of a tensor which is added to the tensor the next time
+// it is reduced.
+struct QuantizationResidual {
+  std::shared_ptr<PersistentBuffer> buffer;
+  int64_t num_elements = 0;
+};
+
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+// Communicators and streams of the GPUs of this process that the replicas of
+// a tensor are on, ordered by device id. The background thread sums replicas
+// up on the reduce communicators, while the finalizer thread broadcasts the
+// allreduced sum back on the broadcast communicators, so that the two threads
+// never use the same communicator.
+struct LocalDeviceGroup {
+  std::vector<int> devices;
+  std::vector<ncclComm_t> reduce_comms;
+  std::vector<cudaStream_t> reduce_streams;
+  std::vector<ncclComm_t> broadcast_comms;
+  std::vector<cudaStream_t> broadcast_streams;
+};
+#endif
+
+// Layout of the output of a (possibly fused) allgather, computed from the
+// tensor sizes of its response. Counts, displacements and offsets are in
+// elements and indexed by rank.
+struct AllgatherLayout {
+  // Response the layout was computed for.
+  std::vector<std::string> tensor_names;
+  std::vector<int64_t> tensor_sizes;
+  std::vector<int64_t> slice_elements;
+
+  std::vector<TensorShape> output_shapes;
+  std::vector<int> recvcounts;
+  std::vector<int> displcmnts;
+  // Size and offset in the gathered data of the part of every entry coming
+  // from every rank, indexed by entry and rank.
+  std::vector<std::vector<int64_t>> entry_component_sizes;
+  std::vector<std::vector<int64_t>> entry_component_offsets;
+
+  // Derived datatypes of the bytes of the inputs and of the parts of the
+  // outputs coming from every rank at their absolute addresses, for a fused
+  // allgather straight from the inputs into the outputs, and the addresses of
+  // the inputs and outputs they were created for.
+  std::vector<const void*> datatype_addresses;
+  MPI_Datatype send_type = MPI_DATATYPE_NULL;
+  std::vector<MPI_Datatype> recv_types;
+  // Arguments of MPI_Alltoallw, indexed by rank.
+  std::vector<int> send_counts;
+  std::vector<MPI_Datatype> send_types;
+  std::vector<int> recv_counts;
+  std::vector<MPI_Datatype> alltoallw_recv_types;
+  std::vector<int> zero_displs;
+};
+
+#if HAVE_CUDA
+// Descriptors of batched copies uploaded to device memory. The descriptors
+// are uploaded from pinned host memory, which may only be overwritten after
+// upload_event.
+struct BatchedMemcpyPlan {
+  std::vector<BatchedMemcpyDesc> descs;
+  int64_t max_size = 0;
+  BatchedMemcpyDesc* host_descs = nullptr;
+  BatchedMemcpyDesc* device_descs = nullptr;
+  size_t capacity = 0;
+  cudaEvent_t upload_event = nullptr;
+  uint64_t last_used = 0;
+};
+
+// Number of batched copies whose descriptors are kept in device memory per
+// stream.
+#define BATCHED_MEMCPY_PLANS_PER_STREAM 16
+#endif
+
+#if HAVE_CUDA_GRAPHS
+// Everything the device operations of an NCCL allreduce depend on. Its
+// captured graph is only replayed if all of it is the same.
+struct CudaGraphSignature {
+  std::vector<std::string> tensor_names;
+  std::vector<const void*> inputs;
+  std::vector<const void*> outputs;
+  std::vector<int64_t> sizes;
+  std::vector<double> factors;
+  const void* buffer_data = nullptr;
+  MPIDataType dtype = HOROVOD_UINT8;
+  cudaStream_t stream = nullptr;
+  ncclComm_t nccl_comm = nullptr;
+
+  bool operator==(const CudaGraphSignature& other) const {
+    return tensor_names == other.tensor_names && inputs == other.inputs &&
+           outputs == other.outputs && sizes == other.sizes &&
+           factors == other.factors && buffer_data == other.buffer_data &&
+           dtype == other.dtype && stream == other.stream &&
+           nccl_comm == other.nccl_comm;
+  }
+};
+
+// NCCL allreduce which is captured into a CUDA graph once it has run with the
+// same signature CUDA_GRAPH_MIN_REPEATS times in a row.
+struct CudaGraphAllreduce {
+  CudaGraphSignature signature;
+  int repeats = 0;
+  bool capture_failed = false;
+  cudaGraphExec_t exec = nullptr;
+};
+
+#define CUDA_GRAPH_MIN_REPEATS 2
+
+// Number of captured allreduces which are kept.
+#define CUDA_GRAPH_CAPACITY 256
+#endif
+
 // The global state required for the MPI ops.
 //
 // MPI is a library that stores a lot of global per-program state and often
@@ -117,18 +299,45 @@ struct HorovodGlobalState {
   // This ensures that only one background thread is spawned.
   std::atomic_flag initialize_flag = ATOMIC_FLAG_INIT;
 
-  // A mutex that needs to be used whenever MPI operations are done.
+  // Tensors waiting to be allreduced or allgathered. Safe to access from
+  // any thread.
+  TensorTable tensor_table;
+
+  // Queue of MPI requests waiting to be sent to the coordinator node. Any
+  // thread can push to it without taking a lock.
+  MessageQueue message_queue;
+
+  // A mutex used by the background thread to wait for wakeups.
   std::mutex mutex;
 
-  // Tensors waiting to be allreduced or allgathered.
-  TensorTable tensor_table;
+  // Signaled when enough tensors have been enqueued to start the next cycle
+  // before the cycle time has passed. Used together with the mutex above.
+  std::condition_variable wakeup_cv;
 
-  // Queue of MPI requests waiting to be sent to the coordinator node.
-  std::queue<MPIRequest> message_queue;
+  // Bytes and number of tensors enqueued since the start of the last cycle.
+  std::atomic<int64_t> enqueued_bytes{0};
+  std::atomic<int64_t> enqueued_tensors{0};
+
+  // Watermarks for enqueued bytes and tensors that wake up the background
+  // thread early. Zero disables the respective watermark.
+  std::atomic<int64_t> wakeup_threshold_bytes{0};
+  std::atomic<int64_t> wakeup_threshold_tensors{0};
 
   // Background thread running MPI communication.
   std::thread background_thread;
 
+  // Operations performed by the background thread whose callbacks have not
+  // been called yet, in the order in which they were performed.
+  std::queue<Completion> completion_queue;
+  std::mutex completion_mutex;
+  std::condition_variable completion_cv;
+
+  // Thread calling the callbacks of performed operations, so that the
+  // background thread never blocks on GPU work or framework code. It exits
+  // once the completion queue is drained after finalizer_shut_down is set.
+  std::thread finalizer_thread;
+  bool finalizer_shut_down = false;
+
   // Whether the background thread should shutdown.
   std::atomic_bool shut_down{false};
 
@@ -140,15 +349,83 @@ struct HorovodGlobalState {
   // name) and time point when tensor started allreduce op.
   std::unique_ptr<MessageTable> message_table;
 
+  // Only exists on local roots (local rank zero) with hierarchical
+  // negotiation. Holds requests of the node until all local ranks are ready.
+  std::unique_ptr<MessageTable> local_message_table;
+
+  // Whether requests are aggregated on every node before they are sent to
+  // the coordinator.
+  bool hierarchical_negotiation = false;
+
+  // Allreduces and broadcasts of tensors larger than this many bytes are split
+  // into parts of at most this size, which are negotiated and fused like
+  // separate tensors. Zero disables the partitioning.
+  int64_t partition_threshold = 0;
+
+  // Size in bytes of the chunks that the cross-node allreduce of
+  // hierarchical allreduce is split into.
+  int64_t hierarchical_chunk_size = 4 * 1024 * 1024;
+
+  // Fused CPU allgathers of at least this many bytes are gathered from the
+  // inputs into the outputs with derived datatypes instead of through the
+  // fusion buffer.
+  int64_t allgather_zero_copy_threshold = 8 * 1024 * 1024;
+
+  // Tensors broadcast with MPI which are larger than this many bytes are
+  // pipelined down a chain of ranks in chunks of broadcast_chunk_size bytes.
+  int64_t broadcast_pipeline_threshold = 64 * 1024 * 1024;
+  int64_t broadcast_chunk_size = 4 * 1024 * 1024;
+
+  // Slices of the data that hierarchical allreduce reduces across nodes.
+  // Every node divides the data evenly between its local ranks, so the
+  // slices start at the multiples of 1/local_size of the data for the
+  // local_size of every node. Starts are in units of
+  // 1/hierarchical_slice_unit of the data, the last one is the end.
+  int hierarchical_slice_unit = 1;
+  std::vector<int> hierarchical_slice_starts;
+
+  // Cross-node communicator of the ranks owning a slice on their node, or
+  // MPI_COMM_NULL if this rank doesn't own it. Equal to cross_comm for the
+  // slice of every rank of a homogeneous cluster.
+  std::vector<MPI_Comm> hierarchical_slice_comms;
+
   // Time point when coordinator last checked for stalled tensors.
   std::chrono::steady_clock::time_point last_stall_check;
 
   // Flag indicating whether to perform stall tensor check.
   bool perform_stall_check = true;
 
+  // Seconds between the logs of the slowest ranks by the coordinator, or 0.
+  std::chrono::steady_clock::duration straggler_log_interval{0};
+  std::chrono::steady_clock::time_point last_straggler_log;
+
+  // Responses agreed on in previous cycles, used to skip negotiation for
+  // tensors which are requested again with the same parameters.
+  ResponseCache response_cache;
+
+  // Time point when a cached tensor started waiting for the remaining ranks.
+  std::unordered_map<std::string, std::chrono::steady_clock::time_point>
+      cache_wait_start;
+
+  // Output layouts of shape-stable allgathers, keyed by the name of their
+  // first tensor. Only accessed by the background thread.
+  std::unordered_map<std::string, AllgatherLayout> allgather_layouts;
+
   // Timeline writer.
   Timeline timeline;
 
+  // Writer of the Enqueue* calls of this rank for replays.
+  EnqueueRecorder enqueue_recorder;
+
+  // IDs of the tensor names sent in negotiation messages. Only accessed by
+  // the background thread.
+  TensorIdTable tensor_ids;
+
+  // Metrics reported by horovod_get_metrics(), and the operation currently
+  // performed by the background thread.
+  Metrics metrics;
+  OperationMetrics current_operation;
+
   // Flag indicating whether to mark cycles in the timeline.
   bool mark_cycles_in_timeline = false;
 
@@ -158,6 +435,51 @@ struct HorovodGlobalState {
   // size.
   FusionBufferManager fusion_buffer;
 
+  // Time after which unused fusion buffers are released, or 0.
+  std::chrono::steady_clock::duration fusion_idle_release{0};
+
+  // Threads which help the background thread with copies into and out of the
+  // fusion buffer on the CPU.
+  MemcpyPool memcpy_pool;
+
+  // Ring of the TCP backend for CPU allreduces, if it is enabled.
+  TcpRing tcp_ring;
+
+  // Residuals of the tensors reduced with quantization, and the total number
+  // of bytes they take up.
+  std::unordered_map<std::string, QuantizationResidual> quantization_residuals;
+  int64_t quantization_residual_bytes = 0;
+
+  // Allreduces whose tensors are summed up locally, waiting for the
+  // background thread to add them to their accumulators, which are keyed by
+  // tensor name.
+  std::vector<TensorTableEntry> accumulation_queue;
+  std::mutex accumulation_mutex;
+  std::unordered_map<std::string, GradientAccumulator> accumulators;
+
+  // Allreduces of tensors with replicas on several GPUs of this process,
+  // waiting for the background thread to collect the replicas by tensor name.
+  // Once all replicas of a tensor are there, they are summed up into the
+  // buffer of the tensor in replica_sums, which is allreduced.
+  std::vector<TensorTableEntry> replica_queue;
+  std::mutex replica_mutex;
+  std::unordered_map<std::string, std::vector<TensorTableEntry>> replicas;
+  std::unordered_map<std::string, GradientAccumulator> replica_sums;
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+  std::map<std::vector<int>, std::unique_ptr<LocalDeviceGroup>>
+      local_device_groups;
+#endif
+
+  // Quantizer and scratch buffers of quantized allreduce operations.
+  Quantizer quantizer{1};
+  std::vector<float> quantization_values;
+  std::vector<uint8_t> quantization_send_buffer;
+  std::vector<uint8_t> quantization_recv_buffer;
+
+  // Scratch buffer that sparse allreduce operations gather the indices and
+  // rows of all ranks into.
+  std::vector<uint8_t> sparse_buffer;
+
   // Time point when last cycle started.
   std::chrono::steady_clock::time_point last_cycle_start;
 
@@ -180,13 +502,36 @@ struct HorovodGlobalState {
   // COMM_WORLD ranks of processes running on this node.
   std::vector<int> local_comm_ranks;
 
+  // COMM_WORLD ranks of the processes with the same local rank on all nodes,
+  // in the order of their cross rank.
+  std::vector<int> cross_comm_ranks;
+
   // Numbers of ranks running per node
   std::vector<int> local_sizes;
 
+  // COMM_WORLD ranks by cross rank and local rank, or empty if the nodes
+  // don't all run the same number of processes or a node doesn't have the
+  // same cross rank in the cross communicators of all its processes.
+  std::vector<int> node_ranks;
+
   // MPI custom data type for float16.
   MPI_Datatype mpi_float16_t;
   MPI_Op mpi_float16_sum;
 
+  // MPI custom data type for bfloat16.
+  MPI_Datatype mpi_bfloat16_t;
+  MPI_Op mpi_bfloat16_sum;
+
+#if HAVE_CUDA
+  // Whether the MPI library of all ranks takes device pointers, so that the
+  // cross-node allreduce of hierarchical allreduce doesn't need to stage the
+  // data in host memory.
+  bool cuda_aware_mpi = false;
+
+  // Float16 summation op which sums up device memory on the GPU.
+  MPI_Op mpi_device_float16_sum = MPI_OP_NULL;
+#endif
+
   // Private MPI communicator for Horovod to ensure no collisions with other
   // threads using MPI.
   MPI_Comm mpi_comm;
@@ -220,13 +565,74 @@ struct HorovodGlobalState {
 // other parts of the graph. Overlaying memory transfers and compute during
 // backpropagation is crucial for good performance, so we cannot use the
 // TensorFlow stream, and must use our own stream.
+//
+// Streams are keyed by device and lane. With several NCCL streams, fused
+// responses on GPU are assigned to the lanes in turn, and every lane has its
+// own stream and NCCL communicators so that independent responses can run at
+// the same time.
 #if HAVE_CUDA
-  std::unordered_map<int, cudaStream_t> streams;
+  std::unordered_map<std::tuple<int, int>, cudaStream_t> streams;
+
+  // With several fusion buffers, fused responses are packed into them on a
+  // separate stream per device, so that packing overlaps with the reduction
+  // of the previous response.
+  std::unordered_map<int, cudaStream_t> fusion_copy_streams;
+
+  // Events recorded after the last operation using a fusion buffer has
+  // unpacked it, keyed by the buffer data.
+  std::unordered_map<const void*, cudaEvent_t> fusion_buffer_free_events;
+
+#if HAVE_CUDA_GRAPHS
+  // Whether repeated NCCL allreduces are replayed from CUDA graphs, and the
+  // allreduces seen so far, keyed by the name of their first tensor. Graphs
+  // are released with the CUDA context, like streams and communicators.
+  bool cuda_graphs = false;
+  std::unordered_map<std::string, CudaGraphAllreduce> cuda_graph_allreduces;
+#endif
+
+  // Pinned host buffers which hierarchical allreduce streams the data of the
+  // cross-node allreduce through, and their size.
+  std::vector<void*> host_chunk_buffers;
+  int64_t host_chunk_buffer_size = 0;
+
+  // Event recorded after the chunk buffers have last been copied back to the
+  // device, or null.
+  cudaEvent_t host_chunk_buffers_event = nullptr;
+
+  // Descriptors of the last batched copies into and out of fusion buffers on
+  // every stream. Fused responses of a training loop usually repeat the same
+  // copies, whose descriptors then only have to be uploaded once.
+  std::unordered_map<cudaStream_t, std::vector<BatchedMemcpyPlan>>
+      batched_memcpy_plans;
+  uint64_t batched_memcpy_counter = 0;
 #endif
 #if HAVE_NCCL
-  std::unordered_map<std::vector<int32_t>, ncclComm_t> nccl_comms;
+  // NCCL communicators keyed by the participating devices, the lane and the
+  // reduce scope of the ranks they span.
+  std::unordered_map<std::tuple<std::vector<int32_t>, int, int>, ncclComm_t>
+      nccl_comms;
+
+  // Communicators which are initialized by eager_nccl_thread ahead of their
+  // first use. They are moved into nccl_comms once the thread is done.
+  struct EagerNCCLComm {
+    std::tuple<std::vector<int32_t>, int, int> key;
+    ncclUniqueId id;
+    int rank;
+    int size;
+    ncclComm_t comm = nullptr;
+  };
+  std::vector<EagerNCCLComm> eager_nccl_comms;
+  std::thread eager_nccl_thread;
+  int eager_nccl_device = 0;
+  Status eager_nccl_status;
 #endif
 
+  // Number of lanes for GPU allreduce, and the lane of the next one. All ranks
+  // perform the same operations in the same order, so they agree on the lane
+  // of every response.
+  int num_nccl_streams = 1;
+  int next_nccl_stream = 0;
+
   // Will be set to true after initialization when ddl is used
   bool ddl_initialized = false;
   int32_t ddl_local_device_id = 0;
@@ -235,6 +641,10 @@ struct HorovodGlobalState {
 #if HAVE_CUDA
   std::unordered_map<int, std::queue<cudaEvent_t>> cuda_events;
   std::mutex cuda_events_mutex;
+
+  // Clocks of the devices to convert times of CUDA events to the timeline.
+  std::unordered_map<int, TimelineClock> timeline_clocks;
+  std::mutex timeline_clocks_mutex;
 #endif
 
   ~HorovodGlobalState() {
@@ -257,6 +667,9 @@ HorovodGlobalState horovod_global;
 // Stall-check warning time
 #define STALL_WARNING_TIME std::chrono::seconds(60)
 
+// MPI tag of the chunks of a pipelined broadcast.
+#define PIPELINED_BROADCAST_TAG 0
+
 const Status NOT_INITIALIZED_ERROR = Status::PreconditionError(
     "Horovod has not been initialized; use hvd.init().");
 
@@ -272,12 +685,11 @@ const Status DUPLICATE_NAME_ERROR = Status::InvalidArgument(
     "name as another tensor that is currently being processed.  If you want "
     "to request another tensor, use a different tensor name.");
 
+// Failed operations are completed through the finalizer thread like
+// successful ones, so that all callbacks are called in order.
 #define OP_ERROR(entries, error_message)                                       \
   {                                                                            \
-    for (auto& e : (entries)) {                                                \
-      timeline.End(e.tensor_name, nullptr);                                    \
-      e.callback(Status::UnknownError(error_message));                         \
-    }                                                                          \
+    CompleteEntries((entries), Status::UnknownError(error_message));           \
     return;                                                                    \
   }
 
@@ -288,11 +700,12 @@ bool IncrementTensorCount(std::unique_ptr<MessageTable>& message_table,
                           const MPIRequest& msg, int mpi_size) {
   auto& name = msg.tensor_name();
   auto& timeline = horovod_global.timeline;
+  auto now = std::chrono::steady_clock::now();
   auto table_iter = message_table->find(name);
-  if (table_iter == message_table->end()) {
+  bool first = table_iter == message_table->end();
+  if (first) {
     std::vector<MPIRequest> messages = {msg};
     messages.reserve(static_cast<unsigned long>(mpi_size));
-    auto now = std::chrono::steady_clock::now();
     message_table->emplace(name, std::make_tuple(std::move(messages), now));
     table_iter = message_table->find(name);
     timeline.NegotiateStart(name, msg.request_type());
@@ -300,6 +713,11 @@ bool IncrementTensorCount(std::unique_ptr<MessageTable>& message_table,
     std::vector<MPIRequest>& messages = std::get<0>(table_iter->second);
     messages.push_back(msg);
   }
+  horovod_global.metrics.stragglers.RecordArrival(
+      name, first, msg.request_rank(),
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          now - std::get<1>(table_iter->second))
+          .count());
 
   timeline.NegotiateRankReady(name, msg.request_rank());
 
@@ -362,10 +780,11 @@ MPIResponse ConstructMPIResponse(std::unique_ptr<MessageTable>& message_table,
     }
   }
 
-  // If we are doing an allreduce or broadcast, check that all tensor shapes are
-  // identical.
+  // If we are doing an allreduce, broadcast or reducescatter, check that all
+  // tensor shapes are identical.
   if (message_type == MPIRequest::ALLREDUCE ||
-      message_type == MPIRequest::BROADCAST) {
+      message_type == MPIRequest::BROADCAST ||
+      message_type == MPIRequest::REDUCESCATTER) {
     TensorShape tensor_shape;
     for (auto dim : requests[0].tensor_shape()) {
       tensor_shape.AddDim(dim);
@@ -392,11 +811,77 @@ MPIResponse ConstructMPIResponse(std::unique_ptr<MessageTable>& message_table,
     }
   }
 
+  // Check that all ranks compress the data in the same way, since the reduced
+  // data would be garbage otherwise.
+  if (message_type == MPIRequest::ALLREDUCE) {
+    auto compression = requests[0].compression();
+    for (unsigned int i = 1; i < requests.size(); ++i) {
+      if (error) {
+        break;
+      }
+
+      auto request_compression = requests[i].compression();
+      if (compression != request_compression) {
+        error = true;
+        error_message_stream
+            << "Mismatched allreduce compression: One rank used "
+            << Compression_Name(compression) << ", but another rank used "
+            << Compression_Name(request_compression) << ".";
+        break;
+      }
+    }
+  }
+
+  // Check that all ranks reduce the tensor across the same ranks.
+  auto scope = requests[0].scope();
+  if (message_type == MPIRequest::ALLREDUCE) {
+    for (unsigned int i = 1; i < requests.size(); ++i) {
+      if (error) {
+        break;
+      }
+
+      auto request_scope = requests[i].scope();
+      if (scope != request_scope) {
+        error = true;
+        error_message_stream
+            << "Mismatched allreduce scopes: One rank used scope "
+            << ReduceScope_Name(scope) << ", but another rank used scope "
+            << ReduceScope_Name(request_scope) << ".";
+        break;
+      }
+    }
+  }
+
+  // Check that all ranks agree on the priority, which decides the order of
+  // the responses.
+  auto priority = requests[0].priority();
+  for (unsigned int i = 1; i < requests.size(); ++i) {
+    if (error) {
+      break;
+    }
+
+    auto request_priority = requests[i].priority();
+    if (priority != request_priority) {
+      error = true;
+      error_message_stream
+          << "Mismatched " << MPIRequest::RequestType_Name(message_type)
+          << " priorities: One rank used priority " << priority
+          << ", but another rank used priority " << request_priority << ".";
+      break;
+    }
+  }
+
   // If we are doing an allgather, make sure all but the first dimension are
   // the same. The first dimension may be different and the output tensor is
-  // the sum of the first dimension. Collect the sizes by rank.
+  // the sum of the first dimension. Collect the sizes by rank. The values of a
+  // sparse allreduce are gathered like an allgather. The first dimension of a
+  // reducescatter is split up among the ranks, and the parts of an alltoall
+  // are gathered like an allgather as well.
   std::vector<int64_t> tensor_sizes(requests.size());
-  if (message_type == MPIRequest::ALLGATHER) {
+  if (message_type == MPIRequest::ALLGATHER ||
+      message_type == MPIRequest::SPARSE_ALLREDUCE ||
+      message_type == MPIRequest::REDUCESCATTER ||
+      message_type == MPIRequest::ALLTOALL) {
     TensorShape tensor_shape;
     for (auto dim : requests[0].tensor_shape()) {
       tensor_shape.AddDim(dim);
@@ -512,8 +997,19 @@ MPIResponse ConstructMPIResponse(std::unique_ptr<MessageTable>& message_table,
     response.set_response_type(MPIResponse::ALLREDUCE);
   } else if (message_type == MPIRequest::BROADCAST) {
     response.set_response_type(MPIResponse::BROADCAST);
+  } else if (message_type == MPIRequest::SPARSE_ALLREDUCE) {
+    response.set_response_type(MPIResponse::SPARSE_ALLREDUCE);
+    for (auto dim : tensor_sizes) {
+      response.add_tensor_size(dim);
+    }
+  } else if (message_type == MPIRequest::REDUCESCATTER) {
+    response.set_response_type(MPIResponse::REDUCESCATTER);
+  } else if (message_type == MPIRequest::ALLTOALL) {
+    response.set_response_type(MPIResponse::ALLTOALL);
   }
   response.set_devices(devices);
+  response.set_priority(priority);
+  response.set_scope(scope);
 
   // Clear all queued up requests for this name. They are now taken care of
   // by the constructed MPI response.
@@ -544,12 +1040,270 @@ MPI_Datatype GetMPIDataType(const std::shared_ptr<Tensor> tensor) {
     return MPI_DOUBLE;
   case HOROVOD_BOOL:
     return MPI_C_BOOL;
+  case HOROVOD_BFLOAT16:
+    return horovod_global.mpi_bfloat16_t;
   default:
     throw std::logic_error("Type " + MPIDataType_Name(tensor->dtype()) +
                            " is not supported in MPI mode.");
   }
 }
 
+// Returns the MPI operation which sums up data of the given type.
+MPI_Op GetMPISumOp(MPIDataType dtype) {
+  switch (dtype) {
+  case HOROVOD_FLOAT16:
+    return horovod_global.mpi_float16_sum;
+  case HOROVOD_BFLOAT16:
+    return horovod_global.mpi_bfloat16_sum;
+  default:
+    return MPI_SUM;
+  }
+}
+
+#if HAVE_CUDA
+// Sums up float16 data for a CUDA-aware MPI, which may pass the device
+// pointers of an allreduce to the reduction op. Host data is summed up by
+// float16_sum.
+void device_float16_sum(void* invec, void* inoutvec, int* len,
+                        MPI_Datatype* datatype) {
+  cudaPointerAttributes attributes;
+  if (cudaPointerGetAttributes(&attributes, inoutvec) != cudaSuccess) {
+    // Older CUDA versions fail for memory unknown to CUDA.
+    cudaGetLastError();
+    float16_sum(invec, inoutvec, len, datatype);
+    return;
+  }
+#if CUDART_VERSION >= 10000
+  bool device_memory = attributes.type == cudaMemoryTypeDevice;
+#else
+  bool device_memory = attributes.memoryType == cudaMemoryTypeDevice;
+#endif
+  if (!device_memory) {
+    float16_sum(invec, inoutvec, len, datatype);
+    return;
+  }
+
+  // MPI may call the op from its own threads, so the data is summed up on
+  // the per-thread stream of the device holding it.
+  auto status = cudaSetDevice(attributes.device);
+  if (status == cudaSuccess) {
+    status = Accumulate(invec, inoutvec, *len, HOROVOD_FLOAT16,
+                        cudaStreamPerThread);
+  }
+  if (status == cudaSuccess) {
+    status = cudaStreamSynchronize(cudaStreamPerThread);
+  }
+  if (status != cudaSuccess) {
+    LOG(ERROR) << "Summing up float16 device memory failed: "
+               << cudaGetErrorString(status);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+// Returns the MPI operation which sums up data of the given type in device
+// memory with a CUDA-aware MPI, or MPI_OP_NULL if the data has to be summed
+// up in host memory.
+MPI_Op GetMPIDeviceSumOp(MPIDataType dtype) {
+  switch (dtype) {
+  case HOROVOD_FLOAT16:
+    return horovod_global.mpi_device_float16_sum;
+  case HOROVOD_BFLOAT16:
+    return MPI_OP_NULL;
+  default:
+    return MPI_SUM;
+  }
+}
+#endif
+
+// Return the number of bytes that an allreduce entry takes up in the fusion
+// buffer.
+int64_t FusedSize(const TensorTableEntry& entry) {
+  if (entry.compression == FP16_COMPRESSION) {
+    return entry.tensor->shape().num_elements() * (int64_t)sizeof(uint16_t);
+  }
+  return entry.tensor->size();
+}
+
+// Multiplies count values of type T from src by factor and stores them in
+// dest, which may be the same as src.
+template <typename T>
+void ScaleValues(const void* src, void* dest, int64_t count, double factor) {
+  auto* in = (const T*)src;
+  auto* out = (T*)dest;
+  auto scale = (T)factor;
+  for (int64_t i = 0; i < count; ++i) {
+    out[i] = in[i] * scale;
+  }
+}
+
+// Copies count values of type dtype on the CPU from src to dest, multiplied
+// by factor. src may be the same as dest.
+void ScaledCopy(MPIDataType dtype, const void* src, void* dest, int64_t count,
+                int element_size, double factor) {
+  if (factor == 1.0) {
+    if (src != dest) {
+      std::memcpy(dest, src, (size_t)(count * element_size));
+    }
+    return;
+  }
+  switch (dtype) {
+  case HOROVOD_FLOAT16:
+    ScaleHalfBuffer((const unsigned short*)src, (unsigned short*)dest, count,
+                    (float)factor);
+    break;
+  case HOROVOD_FLOAT32:
+    ScaleValues<float>(src, dest, count, factor);
+    break;
+  case HOROVOD_FLOAT64:
+    ScaleValues<double>(src, dest, count, factor);
+    break;
+  default:
+    // Rejected when the tensor is enqueued.
+    assert(false);
+  }
+}
+
+// Copies the data of an allreduce entry on the CPU from src to dest,
+// multiplied by factor. src may be the same as dest.
+void ScaledCopy(const TensorTableEntry& e, const void* src, void* dest,
+                double factor) {
+  int64_t count = e.tensor->shape().num_elements();
+  ScaledCopy(e.tensor->dtype(), src, dest, count,
+             count > 0 ? (int)(e.tensor->size() / count) : 1, factor);
+}
+
+// Copies the data of allreduce entries on the CPU like ScaledCopy, spread
+// over the threads of the memcpy pool.
+void ScaledCopies(const std::vector<TensorTableEntry>& entries,
+                  const std::vector<const void*>& inputs,
+                  const std::vector<void*>& outputs,
+                  const std::vector<double>& factors) {
+  std::vector<MemcpyDesc> copies;
+  std::vector<std::function<void()>> scaled_copies;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (factors[i] != 1.0) {
+      scaled_copies.push_back([&, i]() {
+        ScaledCopy(entries[i], inputs[i], outputs[i], factors[i]);
+      });
+    } else if (inputs[i] != outputs[i]) {
+      copies.push_back({inputs[i], outputs[i], entries[i].tensor->size()});
+    }
+  }
+  horovod_global.memcpy_pool.Copy(copies);
+  horovod_global.memcpy_pool.Run(scaled_copies);
+}
+
+// Makes the shared buffer of the node at least size bytes large. It is
+// allocated on local rank zero and mapped by the other local ranks, which all
+// have to call this with the same size.
+void EnsureSharedBuffer(int64_t size, int disp_unit) {
+  if (horovod_global.shared_buffer != nullptr &&
+      horovod_global.shared_buffer_size >= size) {
+    return;
+  }
+  // The buffer is grown geometrically within the memory budget, which is the
+  // same on all ranks, so that all local ranks agree on its size.
+  auto budget = horovod_global.fusion_buffer.Budget();
+  size = BufferCapacity(
+      size, budget > 0 ? budget : std::numeric_limits<int64_t>::max());
+  if (horovod_global.shared_buffer != nullptr) {
+    MPI_Win_fence(0, horovod_global.window);
+    MPI_Win_free(&horovod_global.window);
+    horovod_global.shared_buffer = nullptr;
+  }
+  int64_t window_size = horovod_global.local_rank == 0 ? size : 0;
+  MPI_Win_allocate_shared(window_size, disp_unit, MPI_INFO_NULL,
+                          horovod_global.local_comm,
+                          &horovod_global.shared_buffer,
+                          &horovod_global.window);
+  if (horovod_global.local_rank != 0) {
+    int query_disp_unit;
+    MPI_Aint winsize;
+    MPI_Win_shared_query(horovod_global.window, 0, &winsize, &query_disp_unit,
+                         &horovod_global.shared_buffer);
+  }
+  horovod_global.shared_buffer_size = size;
+  horovod_global.fusion_buffer.SetExternalBytes(size);
+  horovod_global.metrics.shared_buffer_bytes.store(size,
+                                                   std::memory_order_relaxed);
+}
+
+// Adds count values of type T from src to dest.
+template <typename T>
+void AccumulateRow(const void* src, void* dest, int64_t count) {
+  auto* in = (const T*)src;
+  auto* out = (T*)dest;
+  for (int64_t i = 0; i < count; ++i) {
+    out[i] += in[i];
+  }
+}
+
+// Adds count values of type dtype from src to dest, such as a row of a
+// sparse allreduce to a row of its output.
+void AccumulateValues(MPIDataType dtype, const void* src, void* dest,
+                      int64_t count) {
+  switch (dtype) {
+  case HOROVOD_UINT8:
+    AccumulateRow<uint8_t>(src, dest, count);
+    break;
+  case HOROVOD_INT8:
+    AccumulateRow<int8_t>(src, dest, count);
+    break;
+  case HOROVOD_UINT16:
+    AccumulateRow<uint16_t>(src, dest, count);
+    break;
+  case HOROVOD_INT16:
+    AccumulateRow<int16_t>(src, dest, count);
+    break;
+  case HOROVOD_INT32:
+    AccumulateRow<int32_t>(src, dest, count);
+    break;
+  case HOROVOD_INT64:
+    AccumulateRow<int64_t>(src, dest, count);
+    break;
+  case HOROVOD_FLOAT16: {
+    // Uses the vectorized summation of the MPI operation.
+    int len = (int)count;
+    float16_sum((void*)src, dest, &len, &horovod_global.mpi_float16_t);
+    break;
+  }
+  case HOROVOD_BFLOAT16: {
+    int len = (int)count;
+    bfloat16_sum((void*)src, dest, &len, &horovod_global.mpi_bfloat16_t);
+    break;
+  }
+  case HOROVOD_FLOAT32:
+    AccumulateRow<float>(src, dest, count);
+    break;
+  case HOROVOD_FLOAT64:
+    AccumulateRow<double>(src, dest, count);
+    break;
+  default:
+    // Rejected when the tensor is enqueued.
+    assert(false);
+  }
+}
+
+// Sums up count values of type dtype in data over all ranks in place through
+// the ring of the TCP backend.
+Status TcpAllreduce(MPIDataType dtype, MPI_Datatype mpi_data_type, void* data,
+                    int64_t count) {
+  int element_size;
+  MPI_Type_size(mpi_data_type, &element_size);
+  return horovod_global.tcp_ring.Allreduce(
+      data, count, element_size,
+      [dtype](const void* src, void* dest, int64_t n) {
+        AccumulateValues(dtype, src, dest, n);
+      });
+}
+
+// Returns the number of rows of a reducescatter tensor with num_rows rows that
+// a rank receives. The first ranks receive one more row if the rows can't be
+// split up evenly.
+int64_t ReducescatterRows(int64_t num_rows, int rank, int size) {
+  return num_rows / size + (rank < num_rows % size ? 1 : 0);
+}
+
 // Return the total byte size of the final allgathered output tensor
 int64_t TotalByteSizeOfAllgatherOutput(const std::vector<int64_t> &tensor_sizes,
                                        const TensorTableEntry entry) {
@@ -574,6 +1328,215 @@ int64_t TotalByteSizeOfAllgatherOutput(const std::vector<int64_t> &tensor_sizes,
   return total_byte_size_of_output;
 }
 
+// Frees the derived datatypes of an allgather layout.
+void FreeAllgatherDatatypes(AllgatherLayout& layout) {
+  if (layout.send_type != MPI_DATATYPE_NULL) {
+    MPI_Type_free(&layout.send_type);
+  }
+  for (auto& recv_type : layout.recv_types) {
+    if (recv_type != MPI_DATATYPE_NULL) {
+      MPI_Type_free(&recv_type);
+    }
+  }
+  layout.recv_types.clear();
+  layout.datatype_addresses.clear();
+}
+
+// Returns a committed datatype of blocks of bytes at absolute addresses, or
+// MPI_DATATYPE_NULL if there are no blocks.
+MPI_Datatype CreateBlocksDatatype(const std::vector<int>& lengths,
+                                  const std::vector<MPI_Aint>& addresses) {
+  if (lengths.empty()) {
+    return MPI_DATATYPE_NULL;
+  }
+  MPI_Datatype datatype;
+  MPI_Type_create_hindexed((int)lengths.size(), lengths.data(),
+                           addresses.data(), MPI_BYTE, &datatype);
+  MPI_Type_commit(&datatype);
+  return datatype;
+}
+
+// Creates the derived datatypes of a fused allgather for the current inputs
+// and outputs of its entries, unless the layout already has them.
+void PrepareAllgatherDatatypes(AllgatherLayout& layout,
+                               const std::vector<TensorTableEntry>& entries,
+                               int element_size) {
+  std::vector<const void*> addresses;
+  for (auto& e : entries) {
+    addresses.push_back(e.tensor->data());
+    addresses.push_back(e.output->data());
+  }
+  if (addresses == layout.datatype_addresses) {
+    return;
+  }
+  FreeAllgatherDatatypes(layout);
+  layout.datatype_addresses = addresses;
+
+  int size = horovod_global.size;
+  std::vector<int> lengths;
+  std::vector<MPI_Aint> block_addresses;
+  for (auto& e : entries) {
+    if (e.tensor->size() > 0) {
+      MPI_Aint address;
+      MPI_Get_address(e.tensor->data(), &address);
+      lengths.push_back((int)e.tensor->size());
+      block_addresses.push_back(address);
+    }
+  }
+  layout.send_type = CreateBlocksDatatype(lengths, block_addresses);
+
+  // The part of every entry coming from rank rc follows the parts of the
+  // ranks before it in the output.
+  std::vector<int64_t> output_offsets(entries.size(), 0);
+  layout.recv_types.resize(size);
+  for (int rc = 0; rc < size; ++rc) {
+    lengths.clear();
+    block_addresses.clear();
+    for (size_t ec = 0; ec < entries.size(); ++ec) {
+      int64_t bytes = layout.entry_component_sizes[ec][rc] * element_size;
+      if (bytes > 0) {
+        MPI_Aint address;
+        MPI_Get_address((uint8_t*)entries[ec].output->data() +
+                            output_offsets[ec],
+                        &address);
+        lengths.push_back((int)bytes);
+        block_addresses.push_back(address);
+      }
+      output_offsets[ec] += bytes;
+    }
+    layout.recv_types[rc] = CreateBlocksDatatype(lengths, block_addresses);
+  }
+
+  layout.send_counts.assign(size, layout.send_type != MPI_DATATYPE_NULL);
+  layout.send_types.assign(size, layout.send_type != MPI_DATATYPE_NULL
+                                     ? layout.send_type
+                                     : MPI_BYTE);
+  layout.recv_counts.resize(size);
+  layout.alltoallw_recv_types.resize(size);
+  for (int rc = 0; rc < size; ++rc) {
+    bool empty = layout.recv_types[rc] == MPI_DATATYPE_NULL;
+    layout.recv_counts[rc] = empty ? 0 : 1;
+    layout.alltoallw_recv_types[rc] = empty ? MPI_BYTE : layout.recv_types[rc];
+  }
+  layout.zero_displs.assign(size, 0);
+}
+
+// Computes the output layout of an allgather response.
+void ComputeAllgatherLayout(const MPIResponse& response,
+                            const std::vector<TensorTableEntry>& entries,
+                            AllgatherLayout& layout) {
+  int size = horovod_global.size;
+  FreeAllgatherDatatypes(layout);
+  layout.tensor_names = response.tensor_names();
+  layout.tensor_sizes = response.tensor_sizes();
+  layout.output_shapes.clear();
+  layout.recvcounts.assign(size, 0);
+  layout.displcmnts.assign(size, 0);
+  layout.entry_component_sizes.assign(entries.size(),
+                                      std::vector<int64_t>(size));
+  layout.entry_component_offsets.assign(entries.size(),
+                                        std::vector<int64_t>(size));
+
+  for (size_t ec = 0; ec < entries.size(); ++ec) {
+    auto& e = entries[ec];
+    // Every tensor participating in Allgather operation may have different
+    // first dimension size, but the rest of dimensions are same for all
+    // tensors.  Here we get shape of tensor sliced by first dimension.
+    TensorShape single_slice_shape;
+    for (int i = 1; i < e.tensor->shape().dims(); ++i) {
+      single_slice_shape.AddDim(e.tensor->shape().dim_size(i));
+    }
+
+    // Copy tensor sizes from the MPI response into a vector of int64_t
+    // and compute total size.  This is size of first dimension.
+    int64_t total_entry_dimension_size = 0;
+    for (int rc = 0; rc < size; ++rc) {
+      auto component_size = response.tensor_sizes()[ec * size + rc];
+      total_entry_dimension_size += component_size;
+      layout.recvcounts[rc] +=
+          component_size * single_slice_shape.num_elements();
+      layout.entry_component_sizes[ec][rc] =
+          component_size * single_slice_shape.num_elements();
+    }
+
+    // Allgather output will have shape of:
+    // (sum of first dimension of every tensor) x (tensor slice shape).
+    TensorShape output_shape;
+    output_shape.AddDim((int64_t)total_entry_dimension_size);
+    output_shape.AppendShape(single_slice_shape);
+    layout.output_shapes.push_back(output_shape);
+  }
+
+  for (int rc = 1; rc < size; ++rc) {
+    layout.displcmnts[rc] =
+        layout.displcmnts[rc - 1] + layout.recvcounts[rc - 1];
+  }
+
+  int64_t rank_displacement = 0;
+  for (int rc = 0; rc < size; ++rc) {
+    for (size_t ec = 0; ec < entries.size(); ++ec) {
+      if (ec == 0) {
+        layout.entry_component_offsets[ec][rc] = rank_displacement;
+      } else {
+        layout.entry_component_offsets[ec][rc] =
+            layout.entry_component_offsets[ec - 1][rc] +
+            layout.entry_component_sizes[ec - 1][rc];
+      }
+    }
+    rank_displacement += layout.recvcounts[rc];
+  }
+}
+
+// Returns the output layout of an allgather response. Layouts of
+// shape-stable responses are cached across steps, so that allgathers of
+// tensors with static shapes only compute them once. Other layouts are
+// computed into scratch.
+AllgatherLayout& GetAllgatherLayout(const MPIResponse& response,
+                                    const std::vector<TensorTableEntry>& entries,
+                                    AllgatherLayout& scratch) {
+  auto& layouts = horovod_global.allgather_layouts;
+  auto& first_name = response.tensor_names()[0];
+  if (!response.shape_stable()) {
+    auto it = layouts.find(first_name);
+    if (it != layouts.end()) {
+      FreeAllgatherDatatypes(it->second);
+      layouts.erase(it);
+    }
+    ComputeAllgatherLayout(response, entries, scratch);
+    return scratch;
+  }
+
+  auto it = layouts.find(first_name);
+  if (it != layouts.end()) {
+    // The same tensors may have been fused differently, or gathered with
+    // other sizes before their current response was cached.
+    auto& layout = it->second;
+    bool valid = layout.tensor_names == response.tensor_names() &&
+                 layout.tensor_sizes == response.tensor_sizes();
+    for (size_t ec = 0; valid && ec < entries.size(); ++ec) {
+      auto shape = entries[ec].tensor->shape();
+      auto& output_shape = layout.output_shapes[ec];
+      valid = shape.dims() == output_shape.dims();
+      for (int i = 1; valid && i < shape.dims(); ++i) {
+        valid = shape.dim_size(i) == output_shape.dim_size(i);
+      }
+    }
+    if (valid) {
+      return layout;
+    }
+  } else if (layouts.size() >= horovod_global.response_cache.capacity()) {
+    // Only responses replayed from the response cache are shape-stable, so
+    // there are at most as many layouts in use as cached responses.
+    for (auto& cached : layouts) {
+      FreeAllgatherDatatypes(cached.second);
+    }
+    layouts.clear();
+  }
+  auto& layout = layouts[first_name];
+  ComputeAllgatherLayout(response, entries, layout);
+  return layout;
+}
+
 #if HAVE_NCCL
 ncclDataType_t GetNCCLDataType(const std::shared_ptr<Tensor> tensor) {
   switch (tensor->dtype()) {
@@ -587,6 +1550,10 @@ ncclDataType_t GetNCCLDataType(const std::shared_ptr<Tensor> tensor) {
     return ncclFloat32;
   case HOROVOD_FLOAT64:
     return ncclFloat64;
+#if NCCL_VERSION_CODE >= 21000
+  case HOROVOD_BFLOAT16:
+    return ncclBfloat16;
+#endif
   default:
     throw std::logic_error("Type " + MPIDataType_Name(tensor->dtype()) +
                            " is not supported in NCCL mode.");
@@ -610,11 +1577,10 @@ DDL_Type GetDDLDataType(const std::shared_ptr<Tensor> tensor) {
   {                                                                            \
     auto mpi_result = (op);                                                    \
     if (mpi_result != MPI_SUCCESS) {                                           \
-      for (auto& e : (entries)) {                                              \
-        timeline.End(e.tensor_name, nullptr);                                  \
-        e.callback(Status::UnknownError(                                       \
-            std::string(op_name) + " failed, see MPI output for details."));   \
-      }                                                                        \
+      CompleteEntries((entries),                                               \
+                      Status::UnknownError(std::string(op_name) +              \
+                                           " failed, see MPI output for "      \
+                                           "details."));                       \
       return;                                                                  \
     }                                                                          \
   }
@@ -623,11 +1589,10 @@ DDL_Type GetDDLDataType(const std::shared_ptr<Tensor> tensor) {
   {                                                                            \
     auto cuda_result = (op);                                                   \
     if (cuda_result != cudaSuccess) {                                          \
-      for (auto& e : (entries)) {                                              \
-        timeline.End(e.tensor_name, nullptr);                                  \
-        e.callback(Status::UnknownError(std::string(op_name) + " failed: " +   \
-                                        cudaGetErrorString(cuda_result)));     \
-      }                                                                        \
+      CompleteEntries((entries),                                               \
+                      Status::UnknownError(std::string(op_name) +              \
+                                           " failed: " +                       \
+                                           cudaGetErrorString(cuda_result)));  \
       return;                                                                  \
     }                                                                          \
   }
@@ -636,11 +1601,10 @@ DDL_Type GetDDLDataType(const std::shared_ptr<Tensor> tensor) {
   {                                                                            \
     auto nccl_result = (op);                                                   \
     if (nccl_result != ncclSuccess) {                                          \
-      for (auto& e : (entries)) {                                              \
-        timeline.End(e.tensor_name, nullptr);                                  \
-        e.callback(Status::UnknownError(std::string(op_name) + " failed: " +   \
-                                        ncclGetErrorString(nccl_result)));     \
-      }                                                                        \
+      CompleteEntries((entries),                                               \
+                      Status::UnknownError(std::string(op_name) +              \
+                                           " failed: " +                       \
+                                           ncclGetErrorString(nccl_result)));  \
       return;                                                                  \
     }                                                                          \
   }
@@ -649,27 +1613,52 @@ DDL_Type GetDDLDataType(const std::shared_ptr<Tensor> tensor) {
   {                                                                            \
     auto ddl_result = (op);                                                    \
     if (ddl_result != DDL_SUCCESS) {                                           \
-      for (auto& e : (entries)) {                                              \
-        timeline.End(e.tensor_name, nullptr);                                  \
-        e.callback(Status::UnknownError(std::string(op_name) + " failed."));   \
-      }                                                                        \
+      CompleteEntries((entries),                                               \
+                      Status::UnknownError(std::string(op_name) +              \
+                                           " failed."));                       \
       return;                                                                  \
     }                                                                          \
   }
 
 // This event management code is only used with CUDA
 #if HAVE_CUDA
-cudaError_t GetCudaEvent(cudaEvent_t* event) {
-  int device;
-  auto status = cudaGetDevice(&device);
+// Creates a non-blocking stream with the greatest priority, so that Horovod
+// operations are not delayed by other work on the device.
+cudaError_t CreatePriorityStream(cudaStream_t* stream) {
+  int greatest_priority;
+  auto status = cudaDeviceGetStreamPriorityRange(NULL, &greatest_priority);
   if (status != cudaSuccess) {
     return status;
   }
+  return cudaStreamCreateWithPriority(stream, cudaStreamNonBlocking,
+                                      greatest_priority);
+}
 
-  auto& mutex = horovod_global.cuda_events_mutex;
-  {
-    std::lock_guard<std::mutex> guard(mutex);
-    auto& queue = horovod_global.cuda_events[device];
+// Makes the stream wait for the CUDA ready events of the entries.
+cudaError_t WaitForReadyEvents(const std::vector<TensorTableEntry>& entries,
+                               cudaStream_t stream) {
+  for (auto& e : entries) {
+    if (e.ready_event != nullptr && e.ready_event->CudaEvent() != nullptr) {
+      auto status = cudaStreamWaitEvent(stream, e.ready_event->CudaEvent(), 0);
+      if (status != cudaSuccess) {
+        return status;
+      }
+    }
+  }
+  return cudaSuccess;
+}
+
+cudaError_t GetCudaEvent(cudaEvent_t* event) {
+  int device;
+  auto status = cudaGetDevice(&device);
+  if (status != cudaSuccess) {
+    return status;
+  }
+
+  auto& mutex = horovod_global.cuda_events_mutex;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto& queue = horovod_global.cuda_events[device];
     if (!queue.empty()) {
       *event = queue.front();
       queue.pop();
@@ -677,6 +1666,10 @@ cudaError_t GetCudaEvent(cudaEvent_t* event) {
     }
   }
 
+  // Activities in the timeline are measured with the events.
+  if (horovod_global.timeline.Initialized()) {
+    return cudaEventCreateWithFlags(event, cudaEventBlockingSync);
+  }
   return cudaEventCreateWithFlags(event, cudaEventBlockingSync |
                                              cudaEventDisableTiming);
 }
@@ -698,29 +1691,464 @@ cudaError_t ReleaseCudaEvent(cudaEvent_t event) {
   return cudaSuccess;
 }
 
+// Destroys the events of fusion buffers which have completed, since their
+// buffers may have been released. They are not returned to the pool, which is
+// kept per device, as they may belong to any device.
+void ReleaseCompletedBufferEvents() {
+  auto& events = horovod_global.fusion_buffer_free_events;
+  for (auto it = events.begin(); it != events.end();) {
+    if (cudaEventQuery(it->second) == cudaSuccess) {
+      cudaEventDestroy(it->second);
+      it = events.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Converts the time of a completed event to the timeline. The clock of the
+// device is set again every second, so that the times don't drift apart.
+cudaError_t TimelineEventMicros(cudaEvent_t event, long* micros) {
+  int device;
+  auto status = cudaGetDevice(&device);
+  if (status != cudaSuccess) {
+    return status;
+  }
+
+  auto& timeline = horovod_global.timeline;
+  std::lock_guard<std::mutex> guard(horovod_global.timeline_clocks_mutex);
+  auto& clock = horovod_global.timeline_clocks[device];
+  if (clock.event == nullptr ||
+      timeline.TimeSinceStartMicros() - clock.micros > 1000000) {
+    if (clock.event == nullptr) {
+      status = cudaStreamCreateWithFlags(&clock.stream, cudaStreamNonBlocking);
+      if (status != cudaSuccess) {
+        return status;
+      }
+      status = cudaEventCreateWithFlags(&clock.event, cudaEventBlockingSync);
+      if (status != cudaSuccess) {
+        return status;
+      }
+    }
+    // Nothing else runs on the stream, so the event completes right away.
+    status = cudaEventRecord(clock.event, clock.stream);
+    if (status != cudaSuccess) {
+      return status;
+    }
+    status = cudaEventSynchronize(clock.event);
+    if (status != cudaSuccess) {
+      return status;
+    }
+    clock.micros = timeline.TimeSinceStartMicros();
+  }
+
+  // The elapsed time is negative for events completed before the clock was
+  // set.
+  float elapsed_ms;
+  status = cudaEventElapsedTime(&elapsed_ms, clock.event, event);
+  if (status != cudaSuccess) {
+    return status;
+  }
+  *micros = clock.micros + (long)(elapsed_ms * 1000);
+  return cudaSuccess;
+}
+
+// Does copies between device buffers on the stream, with a single kernel
+// launch if there's more than one. Their descriptors are uploaded to device
+// memory, unless the same copies were recently done on the stream.
+cudaError_t BatchedMemcpyAsync(const std::vector<BatchedMemcpyDesc>& descs,
+                               cudaStream_t stream) {
+  if (descs.empty()) {
+    return cudaSuccess;
+  }
+  if (descs.size() == 1) {
+    return cudaMemcpyAsync(descs[0].dst, descs[0].src, (size_t)descs[0].size,
+                           cudaMemcpyDeviceToDevice, stream);
+  }
+
+  auto& plans = horovod_global.batched_memcpy_plans[stream];
+  auto plan = std::find_if(
+      plans.begin(), plans.end(), [&descs](const BatchedMemcpyPlan& plan) {
+        return plan.descs.size() == descs.size() &&
+               std::equal(descs.begin(), descs.end(), plan.descs.begin(),
+                          [](const BatchedMemcpyDesc& a,
+                             const BatchedMemcpyDesc& b) {
+                            return a.src == b.src && a.dst == b.dst &&
+                                   a.size == b.size;
+                          });
+      });
+  if (plan == plans.end()) {
+    if (plans.size() < BATCHED_MEMCPY_PLANS_PER_STREAM) {
+      plans.emplace_back();
+      plan = plans.end() - 1;
+    } else {
+      // The descriptors of a plan are only read by kernels on this stream, so
+      // they can be replaced by an upload on the same stream.
+      plan = std::min_element(
+          plans.begin(), plans.end(),
+          [](const BatchedMemcpyPlan& a, const BatchedMemcpyPlan& b) {
+            return a.last_used < b.last_used;
+          });
+    }
+
+    cudaError_t status;
+    if (plan->upload_event != nullptr) {
+      status = cudaEventSynchronize(plan->upload_event);
+      if (status != cudaSuccess) {
+        return status;
+      }
+    } else {
+      status = GetCudaEvent(&plan->upload_event);
+      if (status != cudaSuccess) {
+        return status;
+      }
+    }
+    if (plan->capacity < descs.size()) {
+      // cudaFree waits for the kernels still reading the old descriptors.
+      if (plan->device_descs != nullptr) {
+        cudaFree(plan->device_descs);
+        cudaFreeHost(plan->host_descs);
+        plan->device_descs = nullptr;
+        plan->host_descs = nullptr;
+        plan->capacity = 0;
+      }
+      status = cudaMalloc((void**)&plan->device_descs,
+                          descs.size() * sizeof(BatchedMemcpyDesc));
+      if (status != cudaSuccess) {
+        return status;
+      }
+      status = cudaMallocHost((void**)&plan->host_descs,
+                              descs.size() * sizeof(BatchedMemcpyDesc));
+      if (status != cudaSuccess) {
+        cudaFree(plan->device_descs);
+        plan->device_descs = nullptr;
+        return status;
+      }
+      plan->capacity = descs.size();
+    }
+
+    plan->descs = descs;
+    plan->max_size = 0;
+    for (auto& desc : descs) {
+      plan->max_size = std::max(plan->max_size, desc.size);
+    }
+    std::copy(descs.begin(), descs.end(), plan->host_descs);
+    status = cudaMemcpyAsync(plan->device_descs, plan->host_descs,
+                             descs.size() * sizeof(BatchedMemcpyDesc),
+                             cudaMemcpyHostToDevice, stream);
+    if (status != cudaSuccess) {
+      return status;
+    }
+    status = cudaEventRecord(plan->upload_event, stream);
+    if (status != cudaSuccess) {
+      return status;
+    }
+  }
+
+  plan->last_used = ++horovod_global.batched_memcpy_counter;
+  return BatchedMemcpy(plan->device_descs, (int64_t)descs.size(),
+                       plan->max_size, stream);
+}
+
+// Copies the data of allreduce entries on the GPU from inputs to outputs on
+// the stream, multiplying the data of every entry by its factor. Data that
+// isn't scaled is copied with BatchedMemcpyAsync, all other data with a single
+// batched kernel.
+cudaError_t ScaledCopiesAsync(const std::vector<TensorTableEntry>& entries,
+                              const std::vector<const void*>& inputs,
+                              const std::vector<void*>& outputs,
+                              const std::vector<double>& factors,
+                              cudaStream_t stream) {
+  std::vector<const void*> scaled_inputs;
+  std::vector<void*> scaled_outputs;
+  std::vector<int64_t> counts;
+  std::vector<double> scale_factors;
+  std::vector<BatchedMemcpyDesc> copies;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (factors[i] != 1.0) {
+      scaled_inputs.push_back(inputs[i]);
+      scaled_outputs.push_back(outputs[i]);
+      counts.push_back(entries[i].tensor->shape().num_elements());
+      scale_factors.push_back(factors[i]);
+    } else if (inputs[i] != outputs[i]) {
+      copies.push_back({inputs[i], outputs[i], entries[i].tensor->size()});
+    }
+  }
+  auto status = BatchedMemcpyAsync(copies, stream);
+  if (status != cudaSuccess || counts.empty()) {
+    return status;
+  }
+  return BatchedScale(scaled_inputs, scaled_outputs, counts, scale_factors,
+                      entries[0].tensor->dtype(), stream);
+}
+
+#if HAVE_CUDA_GRAPHS
+// Copies every tensor from inputs to outputs on the stream and scales it by
+// its factor. Unscaled tensors are copied with a memcpy each rather than with
+// BatchedMemcpyAsync, since the device descriptors of batched copies may be
+// overwritten by the time a captured graph is replayed.
+cudaError_t GraphScaledCopiesAsync(const std::vector<TensorTableEntry>& entries,
+                                   const std::vector<const void*>& inputs,
+                                   const std::vector<void*>& outputs,
+                                   const std::vector<double>& factors,
+                                   cudaStream_t stream) {
+  std::vector<const void*> scaled_inputs;
+  std::vector<void*> scaled_outputs;
+  std::vector<int64_t> counts;
+  std::vector<double> scale_factors;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (factors[i] != 1.0) {
+      scaled_inputs.push_back(inputs[i]);
+      scaled_outputs.push_back(outputs[i]);
+      counts.push_back(entries[i].tensor->shape().num_elements());
+      scale_factors.push_back(factors[i]);
+    } else if (inputs[i] != outputs[i]) {
+      auto status = cudaMemcpyAsync(outputs[i], inputs[i],
+                                    (size_t)entries[i].tensor->size(),
+                                    cudaMemcpyDeviceToDevice, stream);
+      if (status != cudaSuccess) {
+        return status;
+      }
+    }
+  }
+  if (counts.empty()) {
+    return cudaSuccess;
+  }
+  return BatchedScale(scaled_inputs, scaled_outputs, counts, scale_factors,
+                      entries[0].tensor->dtype(), stream);
+}
+
+// Issues the packing, reduction and unpacking of an NCCL allreduce described
+// by its signature on its stream. signature.factors holds the prescale
+// factors of all entries, followed by their postscale factors.
+Status IssueGraphAllreduce(const std::vector<TensorTableEntry>& entries,
+                           const CudaGraphSignature& signature,
+                           bool use_fusion_buffer,
+                           ncclDataType_t nccl_data_type) {
+  auto stream = signature.stream;
+  auto buffer_data = (uint8_t*)signature.buffer_data;
+  size_t num_entries = entries.size();
+  std::vector<double> prescale_factors(signature.factors.begin(),
+                                       signature.factors.begin() + num_entries);
+  std::vector<double> postscale_factors(signature.factors.begin() + num_entries,
+                                        signature.factors.end());
+
+  // The data is reduced in the fusion buffer, or in the output of a single
+  // tensor.
+  std::vector<void*> buffer_parts;
+  std::vector<const void*> const_buffer_parts;
+  int64_t offset = 0;
+  int64_t num_elements = 0;
+  for (auto& e : entries) {
+    buffer_parts.push_back(buffer_data + offset);
+    const_buffer_parts.push_back(buffer_data + offset);
+    offset += e.tensor->size();
+    num_elements += e.tensor->shape().num_elements();
+  }
+
+  const void* fused_input_data = buffer_data;
+  cudaError_t cuda_result = cudaSuccess;
+  if (use_fusion_buffer || prescale_factors[0] != 1.0) {
+    cuda_result = GraphScaledCopiesAsync(entries, signature.inputs,
+                                         buffer_parts, prescale_factors,
+                                         stream);
+  } else {
+    fused_input_data = signature.inputs[0];
+  }
+  if (cuda_result != cudaSuccess) {
+    return Status::UnknownError(std::string("Packing failed: ") +
+                                cudaGetErrorString(cuda_result));
+  }
+
+  auto nccl_result =
+      ncclAllReduce(fused_input_data, buffer_data, (size_t)num_elements,
+                    nccl_data_type, ncclSum, signature.nccl_comm, stream);
+  if (nccl_result != ncclSuccess) {
+    return Status::UnknownError(std::string("ncclAllReduce failed: ") +
+                                ncclGetErrorString(nccl_result));
+  }
+
+  if (use_fusion_buffer) {
+    std::vector<void*> outputs;
+    for (auto output : signature.outputs) {
+      outputs.push_back(const_cast<void*>(output));
+    }
+    cuda_result = GraphScaledCopiesAsync(entries, const_buffer_parts, outputs,
+                                         postscale_factors, stream);
+  } else if (postscale_factors[0] != 1.0) {
+    cuda_result = GraphScaledCopiesAsync(entries, const_buffer_parts,
+                                         buffer_parts, postscale_factors,
+                                         stream);
+  }
+  if (cuda_result != cudaSuccess) {
+    return Status::UnknownError(std::string("Unpacking failed: ") +
+                                cudaGetErrorString(cuda_result));
+  }
+  return Status::OK();
+}
+
+// Destroys the executable graph of an allreduce after its replays are done.
+void DestroyGraphAllreduce(CudaGraphAllreduce& graph) {
+  if (graph.exec != nullptr) {
+    cudaStreamSynchronize(graph.signature.stream);
+    cudaGraphExecDestroy(graph.exec);
+    graph.exec = nullptr;
+  }
+}
+
+// Replays the device operations of an NCCL allreduce from a CUDA graph once
+// it has been seen with the same signature CUDA_GRAPH_MIN_REPEATS times,
+// capturing the graph first. Sets launched to false if the allreduce has to
+// be issued without a graph this time.
+Status LaunchGraphAllreduce(const std::vector<TensorTableEntry>& entries,
+                            CudaGraphSignature signature,
+                            bool use_fusion_buffer,
+                            ncclDataType_t nccl_data_type, bool& launched) {
+  launched = false;
+  auto& graphs = horovod_global.cuda_graph_allreduces;
+  auto& name = signature.tensor_names[0];
+  auto it = graphs.find(name);
+  if (it == graphs.end()) {
+    if (graphs.size() >= CUDA_GRAPH_CAPACITY) {
+      for (auto& graph : graphs) {
+        DestroyGraphAllreduce(graph.second);
+      }
+      graphs.clear();
+    }
+    it = graphs.emplace(name, CudaGraphAllreduce()).first;
+  }
+  auto& graph = it->second;
+  if (!(graph.signature == signature)) {
+    DestroyGraphAllreduce(graph);
+    graph.signature = std::move(signature);
+    graph.repeats = 0;
+    graph.capture_failed = false;
+  }
+  ++graph.repeats;
+
+  if (graph.exec == nullptr) {
+    if (graph.capture_failed || graph.repeats < CUDA_GRAPH_MIN_REPEATS) {
+      return Status::OK();
+    }
+
+    // Only the operations issued by this thread are captured, so framework
+    // threads can go on using the device meanwhile.
+    auto stream = graph.signature.stream;
+    auto cuda_result =
+        cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal);
+    Status capture_status =
+        cuda_result == cudaSuccess
+            ? IssueGraphAllreduce(entries, graph.signature, use_fusion_buffer,
+                                  nccl_data_type)
+            : Status::UnknownError(
+                  std::string("cudaStreamBeginCapture failed: ") +
+                  cudaGetErrorString(cuda_result));
+    if (cuda_result == cudaSuccess) {
+      // The capture has to be ended even if issuing the operations failed.
+      cudaGraph_t captured_graph = nullptr;
+      cuda_result = cudaStreamEndCapture(stream, &captured_graph);
+      if (capture_status.ok() && cuda_result != cudaSuccess) {
+        capture_status =
+            Status::UnknownError(std::string("cudaStreamEndCapture failed: ") +
+                                 cudaGetErrorString(cuda_result));
+      }
+      if (capture_status.ok()) {
+        cuda_result = cudaGraphInstantiate(&graph.exec, captured_graph,
+                                           nullptr, nullptr, 0);
+        if (cuda_result != cudaSuccess) {
+          graph.exec = nullptr;
+          capture_status = Status::UnknownError(
+              std::string("cudaGraphInstantiate failed: ") +
+              cudaGetErrorString(cuda_result));
+        }
+      }
+      if (captured_graph != nullptr) {
+        cudaGraphDestroy(captured_graph);
+      }
+    }
+    if (!capture_status.ok()) {
+      cudaGetLastError();
+      LOG(WARNING) << "Not replaying the allreduce of " << name
+                   << " from a CUDA graph: " << capture_status.reason();
+      graph.capture_failed = true;
+      return Status::OK();
+    }
+  }
+
+  auto cuda_result = cudaGraphLaunch(graph.exec, graph.signature.stream);
+  if (cuda_result != cudaSuccess) {
+    return Status::UnknownError(std::string("cudaGraphLaunch failed: ") +
+                                cudaGetErrorString(cuda_result));
+  }
+  launched = true;
+  return Status::OK();
+}
+#endif
+
 #define RECORD_EVENT(entries, event_queue, name, stream)                       \
   {                                                                            \
     cudaEvent_t event;                                                         \
     CUDA_CHECK(entries, "GetCudaEvent", GetCudaEvent(&event))                  \
     CUDA_CHECK(entries, "cudaEventRecord", cudaEventRecord(event, stream))     \
-    (event_queue).emplace(name, event);                                        \
+    (event_queue).push(ActivityEvent{                                          \
+        name, event, horovod_global.timeline.TimeSinceStartMicros()});        \
+  }
+
+// The events of a queue are recorded on the same stream, so they are all
+// complete once the last one is. Every activity lasts from the completion of
+// the previous event, or from the time its event was recorded for the first
+// event, until the completion of its event on the device.
+Status WaitForEvents(const std::vector<TensorTableEntry>& entries,
+                     Timeline& timeline,
+                     std::queue<ActivityEvent>& event_queue) {
+  auto cuda_error = [](const char* op_name, cudaError_t cuda_result) {
+    return Status::UnknownError(std::string(op_name) + " failed: " +
+                                cudaGetErrorString(cuda_result));
+  };
+  if (!event_queue.empty()) {
+    auto cuda_result = cudaEventSynchronize(event_queue.back().event);
+    if (cuda_result != cudaSuccess) {
+      return cuda_error("cudaEventSynchronize", cuda_result);
+    }
+  }
+  bool first_activity = true;
+  long activity_start = 0;
+  while (!event_queue.empty()) {
+    auto activity = event_queue.front();
+    event_queue.pop();
+    if (timeline.Initialized()) {
+      long activity_end;
+      auto cuda_result = TimelineEventMicros(activity.event, &activity_end);
+      if (cuda_result != cudaSuccess) {
+        return cuda_error("TimelineEventMicros", cuda_result);
+      }
+      if (first_activity) {
+        activity_start = activity.record_micros;
+        first_activity = false;
+      }
+      activity_end = std::max(activity_end, activity_start);
+      if (activity.name != "") {
+        for (auto& e : entries) {
+          timeline.ActivitySpan(e.tensor_name, activity.name, activity_start,
+                                activity_end);
+        }
+      }
+      activity_start = activity_end;
+    }
+    auto cuda_result = ReleaseCudaEvent(activity.event);
+    if (cuda_result != cudaSuccess) {
+      return cuda_error("ReleaseCudaEvent", cuda_result);
+    }
   }
+  return Status::OK();
+}
 
 #define WAIT_FOR_EVENTS(entries, timeline, event_queue)                        \
   {                                                                            \
-    while (!(event_queue).empty()) {                                           \
-      std::string name;                                                        \
-      cudaEvent_t event;                                                       \
-      std::tie(name, event) = (event_queue).front();                           \
-      (event_queue).pop();                                                     \
-      if (name != "") {                                                        \
-        ACTIVITY_START_ALL(entries, timeline, name)                            \
-      }                                                                        \
-      CUDA_CHECK(entries, "cudaEventSynchronize", cudaEventSynchronize(event)) \
-      if (name != "") {                                                        \
-        ACTIVITY_END_ALL(entries, timeline)                                    \
-      }                                                                        \
-      CUDA_CHECK(entries, "ReleaseCudaEvent", ReleaseCudaEvent(event))         \
+    auto wait_status = WaitForEvents((entries), (timeline), (event_queue));    \
+    if (!wait_status.ok()) {                                                   \
+      CompleteEntries((entries), wait_status);                                 \
+      return;                                                                  \
     }                                                                          \
   }
 #endif
@@ -739,1262 +2167,4959 @@ cudaError_t ReleaseCudaEvent(cudaEvent_t event) {
     }                                                                          \
   }
 
-int64_t TensorFusionThresholdBytes() {
-  int64_t proposed_fusion_threshold =
-      horovod_global.param_manager.TensorFusionThresholdBytes();
-
-  // If the cluster is homogeneous and hierarchical allreduce is enabled,
-  // adjust buffer size to make sure it is divisible by local_size to improve
-  // performance.
-  if (horovod_global.is_homogeneous &&
-      horovod_global.param_manager.HierarchicalAllreduce()) {
-    // Assume the worst-case data type float64, since if it is divisible with
-    // float64, it will be divisible for other types too.
-
-    // Ensuring that fusion buffer can hold a number of elements divisible by
-    // FUSION_BUFFER_ATOMIC_UNIT for performance
-    int mpi_double_size;
-    MPI_Type_size(MPI_DOUBLE, &mpi_double_size);
-    int64_t div =
-        horovod_global.local_size * mpi_double_size * FUSION_BUFFER_ATOMIC_UNIT;
-    return ((proposed_fusion_threshold + div - 1) / div) * div;
+#if HAVE_NCCL
+// Returns the rank and the size of this rank in the NCCL communicators of the
+// given scope, and the MPI communicator their unique id is broadcast on.
+void NCCLScopeRanks(ReduceScope scope, int* nccl_rank, int* nccl_size,
+                    MPI_Comm* nccl_id_bcast_comm) {
+  if (scope == LOCAL_SCOPE) {
+    *nccl_rank = horovod_global.local_rank;
+    *nccl_size = horovod_global.local_size;
+    *nccl_id_bcast_comm = horovod_global.local_comm;
+  } else if (scope == CROSS_SCOPE) {
+    *nccl_rank = horovod_global.cross_rank;
+    *nccl_size = horovod_global.cross_size;
+    *nccl_id_bcast_comm = horovod_global.cross_comm;
+  } else {
+    *nccl_rank = horovod_global.rank;
+    *nccl_size = horovod_global.size;
+    *nccl_id_bcast_comm = horovod_global.mpi_comm;
   }
-
-  return proposed_fusion_threshold;
 }
 
-// Process an MPIResponse by doing a reduction, a gather, a broadcast, or
-// raising an error.
-void PerformOperation(TensorTable& tensor_table, MPIResponse response) {
-  std::vector<TensorTableEntry> entries;
-  // Reserve to save re-allocation costs, as we know the size before.
-  entries.reserve(response.tensor_names().size());
-  {
-    // Lock on the tensor table.
-    std::lock_guard<std::mutex> guard(horovod_global.mutex);
-    for (auto& name : response.tensor_names()) {
-      // We should never fail at finding this key in the tensor table.
-      auto iter = tensor_table.find(name);
-      assert(iter != tensor_table.end());
-
-      assert(response.response_type() == MPIResponse::ALLREDUCE ||
-             response.response_type() == MPIResponse::ALLGATHER ||
-             response.response_type() == MPIResponse::BROADCAST ||
-             response.response_type() == MPIResponse::ERROR);
-
-      entries.push_back(iter->second);
-
-      // Clear the tensor table of this tensor and its callbacks; the rest of
-      // this function takes care of it.
-      tensor_table.erase(iter);
-    }
+// A local or cross scope which spans all ranks describes the same group as
+// the global scope, whose communicator is then shared. The ranks of a scope
+// are ordered like the global ranks in that case, and so are their devices.
+ReduceScope CanonicalNCCLScope(ReduceScope scope) {
+  if ((scope == LOCAL_SCOPE &&
+       horovod_global.local_size == horovod_global.size) ||
+      (scope == CROSS_SCOPE &&
+       horovod_global.cross_size == horovod_global.size)) {
+    return GLOBAL_SCOPE;
   }
+  return scope;
+}
 
-  auto& timeline = horovod_global.timeline;
-  for (auto& e : entries) {
-    timeline.Start(e.tensor_name, response.response_type());
+// Waits for the eager initialization of communicators and makes them
+// available to GetNCCLComm. Communicators which failed are created on their
+// first use instead.
+void FinishEagerNCCLInit() {
+  if (!horovod_global.eager_nccl_thread.joinable()) {
+    return;
   }
-
-  if (entries.size() > 1) {
-    auto first_entry = entries[0];
-    // Note: it is OK for different entries to come from different frameworks
-    // since buffer allocated here is guaranteed to survive at least till the
-    // end of this operation.
-    Status status = horovod_global.fusion_buffer.InitializeBuffer(
-        TensorFusionThresholdBytes(), first_entry.device, first_entry.context,
-        [&]() { ACTIVITY_START_ALL(entries, timeline, INIT_FUSION_BUFFER) },
-        [&]() { ACTIVITY_END_ALL(entries, timeline) });
-    if (!status.ok()) {
-      for (auto& e : entries) {
-        timeline.End(e.tensor_name, nullptr);
-        e.callback(status);
-      }
-      return;
-    }
+  horovod_global.eager_nccl_thread.join();
+  if (!horovod_global.eager_nccl_status.ok()) {
+    LOG(WARNING) << "Eager NCCL initialization failed: "
+                 << horovod_global.eager_nccl_status.reason();
   }
-
-  // On GPU data readiness is signalled by ready_event.
-  std::vector<TensorTableEntry> waiting_tensors;
-  for (auto& e : entries) {
-    if (e.ready_event != nullptr) {
-      timeline.ActivityStart(e.tensor_name, WAIT_FOR_DATA);
-      waiting_tensors.push_back(e);
+  for (auto& eager_comm : horovod_global.eager_nccl_comms) {
+    if (eager_comm.comm != nullptr) {
+      horovod_global.nccl_comms[eager_comm.key] = eager_comm.comm;
     }
   }
-  while (!waiting_tensors.empty()) {
-    for (auto it = waiting_tensors.begin(); it != waiting_tensors.end();) {
-      if (it->ready_event->Ready()) {
-        timeline.ActivityEnd(it->tensor_name);
-        timeline.ActivityStart(it->tensor_name, WAIT_FOR_OTHER_TENSOR_DATA);
-        it = waiting_tensors.erase(it);
-      } else {
-        ++it;
-      }
-    }
-    std::this_thread::sleep_for(std::chrono::nanoseconds(100));
+  horovod_global.eager_nccl_comms.clear();
+}
+
+// Devices of the ranks of a scope, in the order of the scope ranks.
+std::vector<int32_t> ScopeDevices(const std::vector<int32_t>& devices,
+                                  ReduceScope scope) {
+  if (scope == GLOBAL_SCOPE) {
+    return devices;
   }
-  for (auto& e : entries) {
-    if (e.ready_event != nullptr) {
-      timeline.ActivityEnd(e.tensor_name);
-    }
+  auto& scope_ranks = scope == LOCAL_SCOPE ? horovod_global.local_comm_ranks
+                                           : horovod_global.cross_comm_ranks;
+  std::vector<int32_t> scope_devices;
+  scope_devices.reserve(scope_ranks.size());
+  for (int rank : scope_ranks) {
+    scope_devices.push_back(devices[rank]);
   }
+  return scope_devices;
+}
 
-  Status status;
-  if (response.response_type() == MPIResponse::ALLGATHER) {
+// Returns the NCCL communicator of the given devices and lane in nccl_comm,
+// and creates it if it doesn't exist yet. The communicator spans the ranks on
+// this node for LOCAL_SCOPE, the ranks with the same local rank for
+// CROSS_SCOPE, otherwise all ranks. All ranks of the communicator have to call
+// this at the same point.
+Status GetNCCLComm(std::vector<TensorTableEntry>& entries,
+                   const std::vector<int32_t>& nccl_device_map, int lane,
+                   ReduceScope scope, ncclComm_t* nccl_comm) {
+  FinishEagerNCCLInit();
+  scope = CanonicalNCCLScope(scope);
+  ncclComm_t& comm = horovod_global.nccl_comms[std::make_tuple(
+      nccl_device_map, lane, (int)scope)];
+  if (comm != nullptr) {
+    *nccl_comm = comm;
+    return Status::OK();
+  }
 
-    // Sizes of subcomponents of each entry from all ranks
-    auto** entry_component_sizes = new int64_t*[entries.size()];
+  auto& timeline = horovod_global.timeline;
+  ACTIVITY_START_ALL(entries, timeline, INIT_NCCL)
+
+  int nccl_rank, nccl_size;
+  MPI_Comm nccl_id_bcast_comm;
+  NCCLScopeRanks(scope, &nccl_rank, &nccl_size, &nccl_id_bcast_comm);
+
+  ncclUniqueId nccl_id;
+  if (nccl_rank == 0) {
+    auto nccl_result = ncclGetUniqueId(&nccl_id);
+    if (nccl_result != ncclSuccess) {
+      return Status::UnknownError(std::string("ncclGetUniqueId failed: ") +
+                                  ncclGetErrorString(nccl_result));
+    }
+  }
 
-    // Offset of each subcomponent of every entry in the final buffer after
-    // allgatherv
-    auto** entry_component_offsets = new int64_t*[entries.size()];
+  if (MPI_Bcast((void*)&nccl_id, sizeof(nccl_id), MPI_BYTE, 0,
+                nccl_id_bcast_comm) != MPI_SUCCESS) {
+    return Status::UnknownError(
+        "MPI_Bcast failed, see MPI output for details.");
+  }
 
-    auto* recvcounts = new int[horovod_global.size]();
-    auto* displcmnts = new int[horovod_global.size]();
+  ncclComm_t new_nccl_comm;
+  auto nccl_result =
+      ncclCommInitRank(&new_nccl_comm, nccl_size, nccl_id, nccl_rank);
+  if (nccl_result != ncclSuccess) {
+    return Status::UnknownError(std::string("ncclCommInitRank failed: ") +
+                                ncclGetErrorString(nccl_result));
+  }
+  comm = new_nccl_comm;
 
-    for (size_t ec = 0; ec < entries.size(); ++ec) {
-      entry_component_sizes[ec] = new int64_t[horovod_global.size]();
-      entry_component_offsets[ec] = new int64_t[horovod_global.size]();
-    }
+  // Barrier helps NCCL to synchronize after initialization and avoid
+  // deadlock that we've been seeing without it.
+  if (MPI_Barrier(horovod_global.mpi_comm) != MPI_SUCCESS) {
+    return Status::UnknownError(
+        "MPI_Barrier failed, see MPI output for details.");
+  }
 
-    auto& first_entry = entries[0];
+  ACTIVITY_END_ALL(entries, timeline)
+  *nccl_comm = comm;
+  return Status::OK();
+}
 
-    ACTIVITY_START_ALL(entries, timeline, ALLOCATE_OUTPUT)
-    for (size_t ec = 0; ec < entries.size(); ++ec) {
-      auto& e = entries[ec];
-      // Every tensor participating in Allgather operation may have different
-      // first dimension size, but the rest of dimensions are same for all
-      // tensors.  Here we get shape of tensor sliced by first dimension.
-      TensorShape single_slice_shape;
-      for (int i = 1; i < e.tensor->shape().dims(); ++i) {
-        single_slice_shape.AddDim(e.tensor->shape().dim_size(i));
+// Starts to initialize the global, local and cross communicators of all lanes
+// on a separate thread, assuming that every rank uses the GPU of its local
+// rank. The unique ids are broadcast right away, while the expensive
+// ncclCommInitRank calls overlap with the rest of the startup and the first
+// cycles. Communicators of other device maps are still created on first use.
+void StartEagerNCCLInit(HorovodGlobalState& state) {
+  int device_count = 0;
+  if (cudaGetDeviceCount(&device_count) != cudaSuccess) {
+    device_count = 0;
+  }
+  int min_device_count = device_count;
+  MPI_Allreduce(MPI_IN_PLACE, &min_device_count, 1, MPI_INT, MPI_MIN,
+                state.mpi_comm);
+  if (min_device_count == 0) {
+    return;
+  }
+  int device = state.local_rank % device_count;
+  std::vector<int32_t> device_map((size_t)state.size);
+  device_map[state.rank] = device;
+  MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, device_map.data(), 1,
+                MPI_INT, state.mpi_comm);
+
+  // Communicators of one rank aren't needed, and the cross communicators only
+  // line up if all nodes run the same number of ranks.
+  std::vector<ReduceScope> scopes = {GLOBAL_SCOPE};
+  if (CanonicalNCCLScope(LOCAL_SCOPE) == LOCAL_SCOPE && state.local_size > 1) {
+    scopes.push_back(LOCAL_SCOPE);
+  }
+  if (CanonicalNCCLScope(CROSS_SCOPE) == CROSS_SCOPE && state.cross_size > 1 &&
+      state.is_homogeneous) {
+    scopes.push_back(CROSS_SCOPE);
+  }
+  for (int lane = 0; lane < state.num_nccl_streams; ++lane) {
+    for (auto scope : scopes) {
+      std::vector<int32_t> scope_device_map;
+      if (scope == GLOBAL_SCOPE) {
+        scope_device_map = device_map;
+      } else {
+        for (int rank : scope == LOCAL_SCOPE ? state.local_comm_ranks
+                                             : state.cross_comm_ranks) {
+          scope_device_map.push_back(device_map[rank]);
+        }
       }
-
-      // Copy tensor sizes from the MPI response into a vector of int64_t
-      // and compute total size.  This is size of first dimension.
-      int64_t total_entry_dimension_size = 0;
-      for (int rc = 0; rc < horovod_global.size; ++rc) {
-        auto component_size =
-            response.tensor_sizes()[ec * horovod_global.size + rc];
-        total_entry_dimension_size += component_size;
-        recvcounts[rc] += component_size * single_slice_shape.num_elements();
-        entry_component_sizes[ec][rc] =
-            component_size * single_slice_shape.num_elements();
+      HorovodGlobalState::EagerNCCLComm eager_comm;
+      eager_comm.key = std::make_tuple(scope_device_map, lane, (int)scope);
+      MPI_Comm nccl_id_bcast_comm;
+      NCCLScopeRanks(scope, &eager_comm.rank, &eager_comm.size,
+                     &nccl_id_bcast_comm);
+      int failed = 0;
+      if (eager_comm.rank == 0 &&
+          ncclGetUniqueId(&eager_comm.id) != ncclSuccess) {
+        failed = 1;
       }
-
-      // Allgather output will have shape of:
-      // (sum of first dimension of every tensor) x (tensor slice shape).
-      TensorShape output_shape;
-      output_shape.AddDim((int64_t)total_entry_dimension_size);
-      output_shape.AppendShape(single_slice_shape);
-
-      status = e.context->AllocateOutput(output_shape, &e.output);
-      if (!status.ok()) {
-        timeline.End(e.tensor_name, nullptr);
-        e.callback(status);
+      // All ranks give up on eager initialization together.
+      MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX,
+                    state.mpi_comm);
+      if (failed) {
+        LOG(WARNING) << "ncclGetUniqueId failed, NCCL communicators are "
+                        "created on their first use.";
+        state.eager_nccl_comms.clear();
         return;
       }
+      MPI_Bcast((void*)&eager_comm.id, sizeof(eager_comm.id), MPI_BYTE, 0,
+                nccl_id_bcast_comm);
+      state.eager_nccl_comms.push_back(eager_comm);
     }
-    ACTIVITY_END_ALL(entries, timeline)
+  }
 
-    for (int rc = 0; rc < horovod_global.size; ++rc) {
-      if (rc == 0) {
-        displcmnts[rc] = 0;
-      } else {
-        displcmnts[rc] = displcmnts[rc - 1] + recvcounts[rc - 1];
-      }
+  // All ranks initialize the communicators in the same order, so that every
+  // collective ncclCommInitRank call finds its peers.
+  state.eager_nccl_device = device;
+  state.eager_nccl_status = Status::OK();
+  state.eager_nccl_thread = std::thread([&state]() {
+    auto cuda_result = cudaSetDevice(state.eager_nccl_device);
+    if (cuda_result != cudaSuccess) {
+      state.eager_nccl_status = Status::UnknownError(
+          std::string("cudaSetDevice failed: ") +
+          cudaGetErrorString(cuda_result));
+      return;
     }
-
-    unsigned int rank_displacement = 0;
-    for (int rc = 0; rc < horovod_global.size; ++rc) {
-      for (size_t ec = 0; ec < entries.size(); ++ec) {
-        if (ec == 0) {
-          entry_component_offsets[ec][rc] = rank_displacement;
-        } else {
-          entry_component_offsets[ec][rc] =
-              entry_component_offsets[ec - 1][rc] +
-              entry_component_sizes[ec - 1][rc];
-        }
+    for (auto& eager_comm : state.eager_nccl_comms) {
+      auto nccl_result = ncclCommInitRank(&eager_comm.comm, eager_comm.size,
+                                          eager_comm.id, eager_comm.rank);
+      if (nccl_result != ncclSuccess) {
+        eager_comm.comm = nullptr;
+        state.eager_nccl_status =
+            Status::UnknownError(std::string("ncclCommInitRank failed: ") +
+                                 ncclGetErrorString(nccl_result));
+        return;
       }
-      rank_displacement += recvcounts[rc];
     }
+  });
+}
+#endif
 
-    int element_size;
-    MPI_Type_size(GetMPIDataType(first_entry.tensor), &element_size);
-    int64_t total_size = displcmnts[horovod_global.size - 1] +
-                         recvcounts[horovod_global.size - 1];
+// Ends the entries of a performed operation in the timeline and hands them
+// over to the finalizer thread, which calls their callbacks with the status.
+// The timeline is ended right away since the coordinator may already receive
+// requests for the same tensors from ranks which are done with them.
+void CompleteEntries(std::vector<TensorTableEntry>& entries,
+                     const Status& status) {
+  for (auto& e : entries) {
+    horovod_global.timeline.End(e.tensor_name,
+                                status.ok() ? e.output : nullptr);
+  }
+  Completion completion;
+  completion.entries = std::move(entries);
+  completion.operation = horovod_global.current_operation;
+  completion.status = status;
+  {
+    std::lock_guard<std::mutex> guard(horovod_global.completion_mutex);
+    horovod_global.completion_queue.push(std::move(completion));
+  }
+  horovod_global.completion_cv.notify_one();
+}
+
+#if HAVE_CUDA
+// Hands the entries of an operation still running on the GPU over to the
+// finalizer thread, which waits for all events in the queue before it ends
+// the entries in the timeline and calls their callbacks.
+void CompleteEntries(
+    std::vector<TensorTableEntry>& entries, int device,
+    std::queue<ActivityEvent>& event_queue) {
+  Completion completion;
+  completion.entries = std::move(entries);
+  completion.operation = horovod_global.current_operation;
+  completion.status = Status::OK();
+  completion.end_in_timeline = true;
+  completion.device = device;
+  std::swap(completion.event_queue, event_queue);
+  {
+    std::lock_guard<std::mutex> guard(horovod_global.completion_mutex);
+    horovod_global.completion_queue.push(std::move(completion));
+  }
+  horovod_global.completion_cv.notify_one();
+}
+#endif
+
+void FinalizeCompletion(Completion& completion) {
+  auto& entries = completion.entries;
+  auto& timeline = horovod_global.timeline;
+#if HAVE_CUDA
+  // Errors are reported right here, since this already is the finalizer
+  // thread.
+  if (!completion.event_queue.empty()) {
+    auto cuda_result = cudaSetDevice(completion.device);
+    completion.status =
+        cuda_result == cudaSuccess
+            ? WaitForEvents(entries, timeline, completion.event_queue)
+            : Status::UnknownError(std::string("cudaSetDevice failed: ") +
+                                   cudaGetErrorString(cuda_result));
+  }
+#endif
+  auto& operation = completion.operation;
+  if (operation.record && completion.status.ok()) {
+    horovod_global.metrics.RecordOperation(
+        operation.backend, operation.response_type, operation.bytes,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - operation.start)
+            .count(),
+        horovod_global.size);
+  }
+  for (auto& e : entries) {
+    if (completion.end_in_timeline) {
+      timeline.End(e.tensor_name,
+                   completion.status.ok() ? e.output : nullptr);
+    }
+    e.callback(completion.status);
+  }
+}
+
+// Calls the callbacks of performed operations one after another, so that
+// they are called in the same order in which the operations were performed.
+void FinalizerThreadLoop(HorovodGlobalState& state) {
+  while (true) {
+    Completion completion;
+    {
+      std::unique_lock<std::mutex> lock(state.completion_mutex);
+      state.completion_cv.wait(lock, [&state]() {
+        return state.finalizer_shut_down || !state.completion_queue.empty();
+      });
+      if (state.completion_queue.empty()) {
+        return;
+      }
+      completion = std::move(state.completion_queue.front());
+      state.completion_queue.pop();
+    }
+    FinalizeCompletion(completion);
+  }
+}
+
+int64_t TensorFusionThresholdBytes() {
+  int64_t proposed_fusion_threshold =
+      horovod_global.param_manager.TensorFusionThresholdBytes();
+
+  // If hierarchical allreduce is enabled, adjust buffer size to make sure it
+  // is divisible into the slices of all nodes to improve performance.
+  if (horovod_global.param_manager.HierarchicalAllreduce()) {
+    // Assume the worst-case data type float64, since if it is divisible with
+    // float64, it will be divisible for other types too.
+
+    // Ensuring that fusion buffer can hold a number of elements divisible by
+    // FUSION_BUFFER_ATOMIC_UNIT for performance
+    int mpi_double_size;
+    MPI_Type_size(MPI_DOUBLE, &mpi_double_size);
+    int64_t div = horovod_global.hierarchical_slice_unit * mpi_double_size *
+                  FUSION_BUFFER_ATOMIC_UNIT;
+    return ((proposed_fusion_threshold + div - 1) / div) * div;
+  }
+
+  return proposed_fusion_threshold;
+}
+
+// Returns the total size in bytes of the data of an allreduce or allgather
+// response, which is the same on all ranks.
+int64_t ResponseBytes(const std::vector<TensorTableEntry>& entries,
+                      const MPIResponse& response) {
+  int64_t bytes = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    auto& e = entries[i];
+    if (response.response_type() != MPIResponse::ALLGATHER) {
+      bytes += e.tensor->size();
+      continue;
+    }
+    int element_size;
+    MPI_Type_size(GetMPIDataType(e.tensor), &element_size);
+    int64_t row_bytes = element_size;
+    for (int d = 1; d < e.tensor->shape().dims(); ++d) {
+      row_bytes *= e.tensor->shape().dim_size(d);
+    }
+    for (int rc = 0; rc < horovod_global.size; ++rc) {
+      bytes += response.tensor_sizes()[i * horovod_global.size + rc] *
+               row_bytes;
+    }
+  }
+  return bytes;
+}
+
+// Returns the number of bytes a fused response needs in the fusion buffer.
+int64_t FusionBufferBytes(const std::vector<TensorTableEntry>& entries,
+                          const MPIResponse& response) {
+  if (response.response_type() == MPIResponse::ALLGATHER) {
+    return ResponseBytes(entries, response);
+  }
+  int64_t bytes = 0;
+  for (auto& e : entries) {
+    bytes += FusedSize(e);
+  }
+  if (response.response_type() == MPIResponse::ALLREDUCE &&
+      horovod_global.param_manager.HierarchicalAllreduce()) {
+    // Hierarchical allreduce pads the data with dummy elements to a multiple
+    // of the slices, which TensorFusionThresholdBytes() is rounded up to.
+    int mpi_double_size;
+    MPI_Type_size(MPI_DOUBLE, &mpi_double_size);
+    int64_t div = horovod_global.hierarchical_slice_unit * mpi_double_size *
+                  FUSION_BUFFER_ATOMIC_UNIT;
+    bytes = ((bytes + div - 1) / div) * div;
+  }
+  return bytes;
+}
+
+// Returns the library which performs an operation on data on the device.
+MetricsBackend OperationBackend(MPIResponse::ResponseType response_type,
+                                int device) {
+  if (device == CPU_DEVICE_ID) {
+    return MPI_BACKEND;
+  }
+  switch (response_type) {
+  case MPIResponse::ALLREDUCE:
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+    return NCCL_BACKEND;
+#elif HOROVOD_GPU_ALLREDUCE == 'D'
+    return DDL_BACKEND;
+#else
+    return MPI_BACKEND;
+#endif
+  case MPIResponse::REDUCESCATTER:
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+    return NCCL_BACKEND;
+#else
+    return MPI_BACKEND;
+#endif
+  case MPIResponse::ALLTOALL:
+#if HOROVOD_NCCL_ALLTOALL
+    return NCCL_BACKEND;
+#else
+    return MPI_BACKEND;
+#endif
+  case MPIResponse::ALLGATHER:
+#if HOROVOD_GPU_ALLGATHER == 'N'
+    return NCCL_BACKEND;
+#else
+    return MPI_BACKEND;
+#endif
+  case MPIResponse::BROADCAST:
+#if HOROVOD_GPU_BROADCAST == 'N'
+    return NCCL_BACKEND;
+#else
+    return MPI_BACKEND;
+#endif
+  default:
+    return MPI_BACKEND;
+  }
+}
+
+#if HOROVOD_GPU_ALLGATHER == 'N'
+// Appends the parts of slice of the data of a node in an allgather buffer to
+// pieces. The data of a node are the contributions of its ranks in the order
+// of their local ranks, which is split into local_size slices of about the
+// same number of bytes.
+void AppendNodeSlice(uint8_t* buffer, const int* recvcounts,
+                     const int* displcmnts, int element_size, int node,
+                     int slice,
+                     std::vector<std::pair<uint8_t*, int64_t>>& pieces) {
+  int local_size = horovod_global.local_size;
+  auto node_ranks = &horovod_global.node_ranks[node * local_size];
+  int64_t total = 0;
+  for (int i = 0; i < local_size; ++i) {
+    total += (int64_t)recvcounts[node_ranks[i]] * element_size;
+  }
+  int64_t begin = total * slice / local_size;
+  int64_t end = total * (slice + 1) / local_size;
+  int64_t offset = 0;
+  for (int i = 0; i < local_size && offset < end; ++i) {
+    int rank = node_ranks[i];
+    int64_t size = (int64_t)recvcounts[rank] * element_size;
+    int64_t from = std::max(begin, offset);
+    int64_t to = std::min(end, offset + size);
+    if (from < to) {
+      pieces.emplace_back(buffer + (int64_t)displcmnts[rank] * element_size +
+                              (from - offset),
+                          to - from);
+    }
+    offset += size;
+  }
+}
+
+// Gathers the contributions of all ranks into buffer in three steps: an
+// allgather within the node over NVLink, an exchange of the data of every node
+// with the other nodes, for which every local rank sends one slice of it to
+// the ranks with the same local rank, and a broadcast of the slices of the
+// other nodes within the node. Every rank sends its share of the data of its
+// node across nodes, so all network adapters are used.
+Status HierarchicalNCCLAllgather(std::vector<TensorTableEntry>& entries,
+                                 const MPIResponse& response, int lane,
+                                 const void* send_data, uint8_t* buffer,
+                                 const int* recvcounts, const int* displcmnts,
+                                 int element_size, cudaStream_t stream) {
+  ncclComm_t local_comm;
+  ncclComm_t cross_comm;
+  Status status =
+      GetNCCLComm(entries, ScopeDevices(response.devices(), LOCAL_SCOPE), lane,
+                  LOCAL_SCOPE, &local_comm);
+  if (status.ok()) {
+    status = GetNCCLComm(entries, ScopeDevices(response.devices(), CROSS_SCOPE),
+                         lane, CROSS_SCOPE, &cross_comm);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  int local_size = horovod_global.local_size;
+  int local_rank = horovod_global.local_rank;
+  int node = horovod_global.cross_rank;
+  auto node_ranks = &horovod_global.node_ranks[node * local_size];
+  auto nccl_error = [](const char* op_name, ncclResult_t nccl_result) {
+    return Status::UnknownError(std::string(op_name) + " failed: " +
+                                ncclGetErrorString(nccl_result));
+  };
+
+  // The ranks of a node usually have consecutive ranks, and their data is then
+  // gathered with ncclAllGather if they all contribute the same amount.
+  bool contiguous = true;
+  for (int i = 0; i < local_size; ++i) {
+    contiguous = contiguous && node_ranks[i] == node_ranks[0] + i &&
+                 recvcounts[node_ranks[i]] == recvcounts[node_ranks[0]];
+  }
+  if (contiguous) {
+    auto nccl_result = ncclAllGather(
+        send_data, buffer + (int64_t)displcmnts[node_ranks[0]] * element_size,
+        (size_t)recvcounts[node_ranks[0]] * element_size, ncclUint8,
+        local_comm, stream);
+    if (nccl_result != ncclSuccess) {
+      return nccl_error("ncclAllGather", nccl_result);
+    }
+  } else {
+    ncclGroupStart();
+    for (int i = 0; i < local_size; ++i) {
+      int rank = node_ranks[i];
+      if (recvcounts[rank] == 0) {
+        continue;
+      }
+      auto nccl_result = ncclBroadcast(
+          send_data, buffer + (int64_t)displcmnts[rank] * element_size,
+          (size_t)recvcounts[rank] * element_size, ncclUint8, i, local_comm,
+          stream);
+      if (nccl_result != ncclSuccess) {
+        ncclGroupEnd();
+        return nccl_error("ncclBroadcast", nccl_result);
+      }
+    }
+    auto nccl_result = ncclGroupEnd();
+    if (nccl_result != ncclSuccess) {
+      return nccl_error("ncclBroadcast", nccl_result);
+    }
+  }
+
+  // Slices owned by this local rank are exchanged with the other nodes, and
+  // then the slices of other nodes are broadcast by their owners on this
+  // node. Cross ranks are the indices of the nodes.
+  for (int step = 0; step < 2; ++step) {
+    std::vector<std::pair<uint8_t*, int64_t>> pieces;
+    std::vector<int> roots;
+    for (int n = 0; n < horovod_global.cross_size; ++n) {
+      for (int slice = 0; slice < local_size; ++slice) {
+        if ((step == 0 && slice != local_rank) || (step == 1 && n == node)) {
+          continue;
+        }
+        AppendNodeSlice(buffer, recvcounts, displcmnts, element_size, n, slice,
+                        pieces);
+        roots.resize(pieces.size(), step == 0 ? n : slice);
+      }
+    }
+    ncclGroupStart();
+    for (size_t i = 0; i < pieces.size(); ++i) {
+      auto nccl_result = ncclBroadcast(
+          pieces[i].first, pieces[i].first, (size_t)pieces[i].second,
+          ncclUint8, roots[i], step == 0 ? cross_comm : local_comm, stream);
+      if (nccl_result != ncclSuccess) {
+        ncclGroupEnd();
+        return nccl_error("ncclBroadcast", nccl_result);
+      }
+    }
+    auto nccl_result = ncclGroupEnd();
+    if (nccl_result != ncclSuccess) {
+      return nccl_error("ncclBroadcast", nccl_result);
+    }
+  }
+  return Status::OK();
+}
+#endif
+
+// Broadcasts size bytes of data from the root down a chain of all ranks of the
+// communicator, ordered by their distance from the root, in chunks of at most
+// chunk_size bytes. Every rank forwards a chunk to the next rank while it
+// receives the following chunks, so a broadcast takes about as long as sending
+// the data over a single link, whatever the number of ranks. Returns the
+// first MPI error.
+int PipelinedBroadcast(void* data, int64_t size, int root, MPI_Comm comm,
+                       int64_t chunk_size) {
+  int rank, comm_size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &comm_size);
+  int position = (rank - root + comm_size) % comm_size;
+  int prev = (rank - 1 + comm_size) % comm_size;
+  int next = (rank + 1) % comm_size;
+  chunk_size = std::min(chunk_size, (int64_t)INT_MAX);
+  int64_t num_chunks = (size + chunk_size - 1) / chunk_size;
+  auto chunk = [&](int64_t i) {
+    return std::make_pair((uint8_t*)data + i * chunk_size,
+                          (int)std::min(chunk_size, size - i * chunk_size));
+  };
+
+  // All receives are posted up front into their part of the data. Chunks are
+  // matched in order since they come from the same rank with the same tag.
+  std::vector<MPI_Request> recv_requests;
+  if (position > 0) {
+    recv_requests.resize((size_t)num_chunks);
+    for (int64_t i = 0; i < num_chunks; ++i) {
+      auto c = chunk(i);
+      int result = MPI_Irecv(c.first, c.second, MPI_BYTE, prev,
+                             PIPELINED_BROADCAST_TAG, comm, &recv_requests[i]);
+      if (result != MPI_SUCCESS) {
+        return result;
+      }
+    }
+  }
+
+  std::vector<MPI_Request> send_requests;
+  for (int64_t i = 0; i < num_chunks; ++i) {
+    if (position > 0) {
+      int result = MPI_Wait(&recv_requests[i], MPI_STATUS_IGNORE);
+      if (result != MPI_SUCCESS) {
+        return result;
+      }
+    }
+    if (position < comm_size - 1) {
+      auto c = chunk(i);
+      send_requests.emplace_back();
+      int result = MPI_Isend(c.first, c.second, MPI_BYTE, next,
+                             PIPELINED_BROADCAST_TAG, comm,
+                             &send_requests.back());
+      if (result != MPI_SUCCESS) {
+        return result;
+      }
+    }
+  }
+  return MPI_Waitall((int)send_requests.size(), send_requests.data(),
+                     MPI_STATUSES_IGNORE);
+}
+
+// Process an MPIResponse by doing a reduction, a gather, a broadcast, or
+// raising an error.
+void PerformOperation(TensorTable& tensor_table,
+                      const MPIResponse& response) {
+  std::vector<TensorTableEntry> entries;
+  // Reserve to save re-allocation costs, as we know the size before.
+  entries.reserve(response.tensor_names().size());
+  for (auto& name : response.tensor_names()) {
+    assert(response.response_type() == MPIResponse::ALLREDUCE ||
+           response.response_type() == MPIResponse::ALLGATHER ||
+           response.response_type() == MPIResponse::BROADCAST ||
+           response.response_type() == MPIResponse::SPARSE_ALLREDUCE ||
+           response.response_type() == MPIResponse::REDUCESCATTER ||
+           response.response_type() == MPIResponse::ALLTOALL ||
+           response.response_type() == MPIResponse::ERROR);
+
+    // Clear the tensor table of this tensor and its callbacks; the rest of
+    // this function takes care of it.
+    entries.push_back(tensor_table.Take(name));
+  }
+
+  auto& timeline = horovod_global.timeline;
+  for (auto& e : entries) {
+    timeline.Start(e.tensor_name, response.response_type());
+  }
+
+  auto& metrics = horovod_global.metrics;
+  auto operation_start = std::chrono::steady_clock::now();
+  for (auto& e : entries) {
+    metrics.queue_micros.Record(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            operation_start - e.enqueue_time)
+            .count());
+  }
+  auto& operation = horovod_global.current_operation;
+  operation.record = response.response_type() != MPIResponse::ERROR;
+  if (operation.record) {
+    operation.backend =
+        OperationBackend(response.response_type(), entries[0].device);
+    operation.response_type = response.response_type();
+    operation.bytes = ResponseBytes(entries, response);
+    operation.start = operation_start;
+    if (response.response_type() == MPIResponse::ALLREDUCE) {
+      metrics.fused_bytes.Record(operation.bytes);
+    }
+  }
+
+  // Compressed data is packed into the fusion buffer like fused tensors. A
+  // compressed tensor which doesn't fit into the fusion buffer is reduced
+  // without compression. Its size and the fusion threshold are the same on
+  // all ranks, so all ranks agree on that.
+  bool compressed =
+      response.response_type() == MPIResponse::ALLREDUCE &&
+      entries[0].compression == FP16_COMPRESSION &&
+      (entries.size() > 1 ||
+       FusedSize(entries[0]) <= TensorFusionThresholdBytes());
+  // Large fused CPU allgathers don't go through the fusion buffer, see
+  // PrepareAllgatherDatatypes(). The size of the response is the same on all
+  // ranks.
+  bool zero_copy_allgather =
+      response.response_type() == MPIResponse::ALLGATHER &&
+      entries.size() > 1 && entries[0].device == CPU_DEVICE_ID &&
+      ResponseBytes(entries, response) >=
+          horovod_global.allgather_zero_copy_threshold;
+  bool use_fusion_buffer =
+      (entries.size() > 1 || compressed) && !zero_copy_allgather;
+
+  if (use_fusion_buffer) {
+    auto& first_entry = entries[0];
+    // Note: it is OK for different entries to come from different frameworks
+    // since buffer allocated here is guaranteed to survive at least till the
+    // end of this operation.
+    Status status = horovod_global.fusion_buffer.InitializeBuffer(
+        FusionBufferBytes(entries, response), TensorFusionThresholdBytes(),
+        first_entry.device, first_entry.context,
+        [&]() { ACTIVITY_START_ALL(entries, timeline, INIT_FUSION_BUFFER) },
+        [&]() { ACTIVITY_END_ALL(entries, timeline) });
+    horovod_global.metrics.fusion_buffer_bytes.store(
+        horovod_global.fusion_buffer.AllocatedBytes(),
+        std::memory_order_relaxed);
+    if (!status.ok()) {
+      CompleteEntries(entries, status);
+      return;
+    }
+  }
+
+  // The output layout of an allgather only depends on its response, so its
+  // outputs are allocated while the input data may still be computed.
+  AllgatherLayout scratch_layout;
+  AllgatherLayout* allgather_layout = nullptr;
+  if (response.response_type() == MPIResponse::ALLGATHER) {
+    allgather_layout = &GetAllgatherLayout(response, entries, scratch_layout);
+    ACTIVITY_START_ALL(entries, timeline, ALLOCATE_OUTPUT)
+    for (size_t ec = 0; ec < entries.size(); ++ec) {
+      auto& e = entries[ec];
+      Status status = e.context->AllocateOutput(
+          allgather_layout->output_shapes[ec], &e.output);
+      if (!status.ok()) {
+        CompleteEntries(entries, status);
+        return;
+      }
+    }
+    ACTIVITY_END_ALL(entries, timeline)
+  }
+
+  // On GPU data readiness is signalled by ready_event. Allreduce with NCCL or
+  // DDL and allgather and broadcast with NCCL only access the data on Horovod
+  // streams, which wait for ready events that expose a CUDA event on the GPU,
+  // so those aren't polled here.
+  bool wait_on_stream = false;
+#if HOROVOD_GPU_ALLREDUCE == 'N' || HOROVOD_GPU_ALLREDUCE == 'D'
+  wait_on_stream = response.response_type() == MPIResponse::ALLREDUCE &&
+                   entries[0].device != CPU_DEVICE_ID;
+#endif
+  // GPU reducescatter and alltoall only run with NCCL.
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+  wait_on_stream = wait_on_stream ||
+                   (response.response_type() == MPIResponse::REDUCESCATTER &&
+                    entries[0].device != CPU_DEVICE_ID);
+#endif
+#if HOROVOD_NCCL_ALLTOALL
+  wait_on_stream = wait_on_stream ||
+                   (response.response_type() == MPIResponse::ALLTOALL &&
+                    entries[0].device != CPU_DEVICE_ID);
+#endif
+#if HOROVOD_GPU_ALLGATHER == 'N'
+  wait_on_stream = wait_on_stream ||
+                   (response.response_type() == MPIResponse::ALLGATHER &&
+                    entries[0].device != CPU_DEVICE_ID);
+#endif
+#if HOROVOD_GPU_BROADCAST == 'N'
+  wait_on_stream = wait_on_stream ||
+                   (response.response_type() == MPIResponse::BROADCAST &&
+                    entries[0].device != CPU_DEVICE_ID);
+#endif
+  auto needs_polling = [wait_on_stream](const TensorTableEntry& e) {
+    if (e.ready_event == nullptr) {
+      return false;
+    }
+#if HAVE_CUDA
+    if (wait_on_stream && e.ready_event->CudaEvent() != nullptr) {
+      return false;
+    }
+#endif
+    return true;
+  };
+  std::vector<TensorTableEntry> waiting_tensors;
+  for (auto& e : entries) {
+    if (needs_polling(e)) {
+      timeline.ActivityStart(e.tensor_name, WAIT_FOR_DATA);
+      waiting_tensors.push_back(e);
+    }
+  }
+  auto wait_start = std::chrono::steady_clock::now();
+  bool waited = !waiting_tensors.empty();
+  while (!waiting_tensors.empty()) {
+    for (auto it = waiting_tensors.begin(); it != waiting_tensors.end();) {
+      if (it->ready_event->Ready()) {
+        timeline.ActivityEnd(it->tensor_name);
+        timeline.ActivityStart(it->tensor_name, WAIT_FOR_OTHER_TENSOR_DATA);
+        it = waiting_tensors.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::nanoseconds(100));
+  }
+  if (waited) {
+    metrics.ready_event_wait_micros.Record(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - wait_start)
+            .count());
+  }
+  for (auto& e : entries) {
+    if (needs_polling(e)) {
+      timeline.ActivityEnd(e.tensor_name);
+    }
+  }
+
+  Status status;
+  if (response.response_type() == MPIResponse::ALLGATHER) {
+    auto& layout = *allgather_layout;
+    auto* recvcounts = layout.recvcounts.data();
+    auto* displcmnts = layout.displcmnts.data();
+
+    // Sizes of subcomponents of each entry from all ranks
+    auto& entry_component_sizes = layout.entry_component_sizes;
+
+    // Offset of each subcomponent of every entry in the final buffer after
+    // allgatherv
+    auto& entry_component_offsets = layout.entry_component_offsets;
+
+    auto& first_entry = entries[0];
+
+    int element_size;
+    MPI_Type_size(GetMPIDataType(first_entry.tensor), &element_size);
+    int64_t total_size = displcmnts[horovod_global.size - 1] +
+                         recvcounts[horovod_global.size - 1];
 
     int64_t total_size_in_bytes = total_size * element_size;
 
-#if HOROVOD_GPU_ALLGATHER != 'M' // 'M' stands for MPI
-    if (horovod_global.param_manager.HierarchicalAllgather()) {
-      // If shared buffer is not initialized or is not large enough, reallocate
-      if (horovod_global.shared_buffer == nullptr ||
-          horovod_global.shared_buffer_size < total_size_in_bytes) {
-        if (horovod_global.shared_buffer != nullptr) {
-          MPI_Win_fence(0, horovod_global.window);
-          MPI_Win_free(&horovod_global.window);
-          horovod_global.shared_buffer = nullptr;
+#if HOROVOD_GPU_ALLGATHER == 'N'
+    if (first_entry.device != CPU_DEVICE_ID) {
+      CUDA_CHECK(entries, "cudaSetDevice", cudaSetDevice(first_entry.device))
+      int lane = horovod_global.next_nccl_stream;
+      horovod_global.next_nccl_stream =
+          (lane + 1) % horovod_global.num_nccl_streams;
+      cudaStream_t& stream =
+          horovod_global.streams[std::make_tuple(first_entry.device, lane)];
+      if (stream == nullptr) {
+        CUDA_CHECK(entries, "CreatePriorityStream",
+                   CreatePriorityStream(&stream))
+      }
+      auto event_queue = std::queue<ActivityEvent>();
+
+      ncclComm_t nccl_comm;
+      status = GetNCCLComm(entries, response.devices(), lane, GLOBAL_SCOPE,
+                           &nccl_comm);
+      if (!status.ok()) {
+        OP_ERROR(entries, status.reason())
+      }
+
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, QUEUE, stream)
+      }
+      CUDA_CHECK(entries, "WaitForReadyEvents",
+                 WaitForReadyEvents(entries, stream))
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, WAIT_FOR_DATA, stream)
+      }
+
+      // Data is gathered as bytes, so that tensors of every type can be
+      // gathered. The contribution of every rank lands at its displacement in
+      // the fusion buffer, or in the output of a single tensor, which have
+      // the same layout.
+      uint8_t* gather_data;
+      uint8_t* buffer_data = nullptr;
+      if (use_fusion_buffer) {
+        auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+            first_entry.device, first_entry.context->framework());
+        buffer_data = (uint8_t*)buffer->AccessData(first_entry.context);
+        gather_data = buffer_data;
+
+        // Wait until the last operation using this buffer has unpacked it.
+        auto free_event =
+            horovod_global.fusion_buffer_free_events.find(buffer_data);
+        if (free_event != horovod_global.fusion_buffer_free_events.end()) {
+          CUDA_CHECK(entries, "cudaStreamWaitEvent",
+                     cudaStreamWaitEvent(stream, free_event->second, 0))
+          CUDA_CHECK(entries, "ReleaseCudaEvent",
+                     ReleaseCudaEvent(free_event->second))
+          horovod_global.fusion_buffer_free_events.erase(free_event);
         }
-        int64_t window_size =
-            horovod_global.local_rank == 0 ? total_size_in_bytes : 0;
 
-        // Allocate shared memory, give each rank their respective pointer
-        ACTIVITY_START_ALL(entries, timeline, ALLOCATE_SHARED_BUFFER)
-        MPI_Win_allocate_shared(
-            window_size, element_size, MPI_INFO_NULL, horovod_global.local_comm,
-            &horovod_global.shared_buffer, &horovod_global.window);
+        int64_t offset = displcmnts[horovod_global.rank] * element_size;
+        std::vector<BatchedMemcpyDesc> copies;
+        for (auto& e : entries) {
+          copies.push_back(
+              {e.tensor->data(), buffer_data + offset, e.tensor->size()});
+          offset += e.tensor->size();
+        }
+        CUDA_CHECK(entries, "BatchedMemcpyAsync",
+                   BatchedMemcpyAsync(copies, stream))
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, MEMCPY_IN_FUSION_BUFFER, stream)
+        }
+      } else {
+        gather_data = (uint8_t*)first_entry.output->data();
+      }
+      auto send_data =
+          use_fusion_buffer
+              ? (const void*)(gather_data +
+                              displcmnts[horovod_global.rank] * element_size)
+              : first_entry.tensor->data();
+
+      // ncclAllGather needs the same number of elements from every rank,
+      // otherwise every rank broadcasts its data to the others.
+      bool even_split = true;
+      for (int rc = 0; rc < horovod_global.size; ++rc) {
+        even_split = even_split && recvcounts[rc] == recvcounts[0];
+      }
+      bool hierarchical_allgather =
+          horovod_global.param_manager.HierarchicalAllgather(
+              total_size_in_bytes) &&
+          !horovod_global.node_ranks.empty() &&
+          horovod_global.local_size > 1 && horovod_global.cross_size > 1;
+      if (hierarchical_allgather) {
+        status = HierarchicalNCCLAllgather(
+            entries, response, lane, send_data, gather_data, recvcounts,
+            displcmnts, element_size, stream);
+        if (!status.ok()) {
+          OP_ERROR(entries, status.reason())
+        }
+      } else if (even_split) {
+        NCCL_CHECK(entries, "ncclAllGather",
+                   ncclAllGather(send_data, gather_data,
+                                 (size_t)recvcounts[0] * element_size,
+                                 ncclUint8, nccl_comm, stream))
+      } else {
+        NCCL_CHECK(entries, "ncclGroupStart", ncclGroupStart())
+        for (int rc = 0; rc < horovod_global.size; ++rc) {
+          if (recvcounts[rc] == 0) {
+            continue;
+          }
+          NCCL_CHECK(entries, "ncclBroadcast",
+                     ncclBroadcast(send_data,
+                                   gather_data + displcmnts[rc] * element_size,
+                                   (size_t)recvcounts[rc] * element_size,
+                                   ncclUint8, rc, nccl_comm, stream))
+        }
+        NCCL_CHECK(entries, "ncclGroupEnd", ncclGroupEnd())
+      }
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, NCCL_ALLGATHER, stream)
+      }
 
-        if (horovod_global.local_rank != 0) {
-          int disp_unit;
-          MPI_Aint winsize;
-          MPI_Win_shared_query(horovod_global.window, 0, &winsize, &disp_unit,
-                               &horovod_global.shared_buffer);
+      if (use_fusion_buffer) {
+        std::vector<BatchedMemcpyDesc> copies;
+        for (size_t ec = 0; ec < entries.size(); ++ec) {
+          auto& e = entries[ec];
+          int64_t copy_offset = 0;
+          for (int rc = 0; rc < horovod_global.size; ++rc) {
+            auto size = entry_component_sizes[ec][rc] * element_size;
+            if (size > 0) {
+              copies.push_back(
+                  {buffer_data + entry_component_offsets[ec][rc] * element_size,
+                   (uint8_t*)e.output->data() + copy_offset, size});
+            }
+            copy_offset += size;
+          }
+        }
+        CUDA_CHECK(entries, "BatchedMemcpyAsync",
+                   BatchedMemcpyAsync(copies, stream))
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, MEMCPY_OUT_FUSION_BUFFER, stream)
+        }
+
+        if (horovod_global.fusion_buffer.NumBuffers() > 1 ||
+            horovod_global.num_nccl_streams > 1) {
+          // Let the next operation using this buffer know when it's free.
+          cudaEvent_t buffer_free_event;
+          CUDA_CHECK(entries, "GetCudaEvent", GetCudaEvent(&buffer_free_event))
+          CUDA_CHECK(entries, "cudaEventRecord",
+                     cudaEventRecord(buffer_free_event, stream))
+          horovod_global.fusion_buffer_free_events[buffer_data] =
+              buffer_free_event;
+        }
+      }
+
+      RECORD_EVENT(entries, event_queue, "", stream)
+      CompleteEntries(entries, first_entry.device, event_queue);
+      return;
+    }
+#endif
+
+#if HOROVOD_GPU_ALLGATHER != 'M' // 'M' stands for MPI
+    if (horovod_global.param_manager.HierarchicalAllgather(
+            total_size_in_bytes)) {
+      // If shared buffer is not initialized or is not large enough, reallocate
+      if (horovod_global.shared_buffer == nullptr ||
+          horovod_global.shared_buffer_size < total_size_in_bytes) {
+        // Allocate shared memory, give each rank their respective pointer
+        ACTIVITY_START_ALL(entries, timeline, ALLOCATE_SHARED_BUFFER)
+        EnsureSharedBuffer(total_size_in_bytes, element_size);
+        ACTIVITY_END_ALL(entries, timeline)
+      }
+
+      // Compute cross-node allgather displacements and recvcounts for
+      // homogeneous/parallelized case
+      auto* cross_recvcounts = new int[horovod_global.cross_size]();
+      auto* cross_displcmnts = new int[horovod_global.cross_size]();
+
+      if (horovod_global.is_homogeneous) {
+        for (int i = 0; i < horovod_global.cross_size; ++i) {
+          cross_recvcounts[i] = recvcounts[horovod_global.local_size * i +
+                                           horovod_global.local_rank];
+          cross_displcmnts[i] = displcmnts[horovod_global.local_size * i +
+                                           horovod_global.local_rank];
+        }
+      } else if (horovod_global.local_rank == 0) {
+        // In this case local rank 0 will allgather with all local data
+        int offset = 0;
+        for (int i = 0; i < horovod_global.cross_size; ++i) {
+          for (int j = offset; j < offset + horovod_global.local_sizes[i];
+               ++j) {
+            cross_recvcounts[i] += recvcounts[j];
+          }
+          cross_displcmnts[i] = displcmnts[offset];
+          offset += horovod_global.local_sizes[i];
+        }
+      }
+
+      ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_SHARED_BUFFER)
+      std::vector<MemcpyDesc> copies;
+      for (size_t ec = 0; ec < entries.size(); ++ec) {
+        auto& e = entries[ec];
+        void* shared_buffer_at_offset =
+            (uint8_t*)horovod_global.shared_buffer +
+            entry_component_offsets[ec][horovod_global.rank] * element_size;
+
+        // CPU copy to shared buffer
+        copies.push_back(
+            {e.tensor->data(), shared_buffer_at_offset,
+             entry_component_sizes[ec][horovod_global.rank] * element_size});
+      }
+      horovod_global.memcpy_pool.Copy(copies);
+      MPI_CHECK(entries, "MPI_Barrier", MPI_Barrier(horovod_global.mpi_comm));
+      ACTIVITY_END_ALL(entries, timeline)
+
+      // Perform the cross-node allgather. If the cluster is homogeneous all
+      // local ranks participate, otherwise local rank 0 handles all data
+      ACTIVITY_START_ALL(entries, timeline, MPI_CROSS_ALLGATHER)
+      if (horovod_global.is_homogeneous || horovod_global.local_rank == 0) {
+        MPI_CHECK(entries, "MPI_Allgatherv",
+                  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                                 horovod_global.shared_buffer, cross_recvcounts,
+                                 cross_displcmnts,
+                                 GetMPIDataType(first_entry.tensor),
+                                 horovod_global.cross_comm))
+      }
+      MPI_CHECK(entries, "MPI_Barrier", MPI_Barrier(horovod_global.mpi_comm));
+      ACTIVITY_END_ALL(entries, timeline)
+
+      // Copy memory out of the fusion buffer.
+      ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_FUSION_BUFFER)
+      copies.clear();
+      for (size_t ec = 0; ec < entries.size(); ++ec) {
+        auto& e = entries[ec];
+        int64_t copy_offset = 0;
+        for (int rc = 0; rc < horovod_global.size; ++rc) {
+          auto entry_component_size = entry_component_sizes[ec][rc];
+          copies.push_back(
+              {(uint8_t*)horovod_global.shared_buffer +
+                   entry_component_offsets[ec][rc] * element_size,
+               (uint8_t*)e.output->data() + copy_offset,
+               entry_component_size * element_size});
+          copy_offset += entry_component_size * element_size;
+        }
+      }
+      horovod_global.memcpy_pool.Copy(copies);
+      MPI_CHECK(entries, "MPI_Barrier", MPI_Barrier(horovod_global.mpi_comm));
+      ACTIVITY_END_ALL(entries, timeline)
+
+      // Free the buffers
+      delete[] cross_displcmnts;
+      delete[] cross_recvcounts;
+
+    } else {
+#endif
+      // Data is at the CPU and hierarchical allgather is disabled, or
+      // Data is at the GPU and HOROVOD_GPU_ALLGATHER == MPI
+      if (zero_copy_allgather) {
+        // Every rank sends its inputs to all ranks, which receive them
+        // straight into the parts of their outputs for the sending rank.
+        PrepareAllgatherDatatypes(layout, entries, element_size);
+        ACTIVITY_START_ALL(entries, timeline, MPI_ALLGATHER)
+        MPI_CHECK(entries, "MPI_Alltoallw",
+                  MPI_Alltoallw(MPI_BOTTOM, layout.send_counts.data(),
+                                layout.zero_displs.data(),
+                                layout.send_types.data(), MPI_BOTTOM,
+                                layout.recv_counts.data(),
+                                layout.zero_displs.data(),
+                                layout.alltoallw_recv_types.data(),
+                                horovod_global.mpi_comm))
+        ACTIVITY_END_ALL(entries, timeline)
+        if (!response.shape_stable()) {
+          FreeAllgatherDatatypes(layout);
+        }
+
+      } else if (entries.size() > 1) {
+        auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+            first_entry.device, first_entry.context->framework());
+        auto buffer_data = buffer->AccessData(first_entry.context);
+
+        int64_t total_num_elements = 0;
+
+        // Copy memory into the fusion buffer. Then the input data of each
+        // process is assumed to be in the area where that process would
+        // receive its own contribution to the receive buffer.
+        ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_FUSION_BUFFER)
+        int64_t offset = displcmnts[horovod_global.rank] * element_size;
+        std::vector<MemcpyDesc> copies;
+        for (auto& e : entries) {
+          void* buffer_data_at_offset = (uint8_t*)buffer_data + offset;
+          copies.push_back(
+              {e.tensor->data(), buffer_data_at_offset, e.tensor->size()});
+          offset += e.tensor->size();
+          total_num_elements += e.tensor->shape().num_elements();
+        }
+        horovod_global.memcpy_pool.Copy(copies);
+        ACTIVITY_END_ALL(entries, timeline)
+
+        ACTIVITY_START_ALL(entries, timeline, MPI_ALLGATHER)
+        MPI_CHECK(entries, "MPI_Allgatherv",
+                  MPI_Allgatherv(MPI_IN_PLACE, (int)total_num_elements,
+                                 GetMPIDataType(first_entry.tensor),
+                                 (void*)buffer_data, recvcounts, displcmnts,
+                                 GetMPIDataType(first_entry.tensor),
+                                 horovod_global.mpi_comm))
+        ACTIVITY_END_ALL(entries, timeline)
+
+        ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_FUSION_BUFFER)
+        // Copy memory out of the fusion buffer.
+        copies.clear();
+        for (size_t ec = 0; ec < entries.size(); ++ec) {
+          auto& e = entries[ec];
+          int64_t copy_offset = 0;
+          for (int rc = 0; rc < horovod_global.size; ++rc) {
+            copies.push_back(
+                {(const uint8_t*)buffer_data +
+                     entry_component_offsets[ec][rc] * element_size,
+                 (uint8_t*)e.output->data() + copy_offset,
+                 entry_component_sizes[ec][rc] * element_size});
+
+            copy_offset += entry_component_sizes[ec][rc] * element_size;
+          }
+        }
+        horovod_global.memcpy_pool.Copy(copies);
+        ACTIVITY_END_ALL(entries, timeline)
+
+      } else if (entries.size() == 1) {
+        ACTIVITY_START_ALL(entries, timeline, MPI_ALLGATHER)
+        MPI_CHECK(
+            entries, "MPI_Allgatherv",
+            MPI_Allgatherv(first_entry.tensor->data(),
+                           (int)first_entry.tensor->shape().num_elements(),
+                           GetMPIDataType(first_entry.tensor),
+                           (void*)first_entry.output->data(), recvcounts,
+                           displcmnts, GetMPIDataType(first_entry.tensor),
+                           horovod_global.mpi_comm))
+        ACTIVITY_END_ALL(entries, timeline)
+      }
+
+#if HOROVOD_GPU_ALLGATHER != 'M' // 'M' stands for MPI
+    }
+#endif
+
+    CompleteEntries(entries, Status::OK());
+
+  } else if (response.response_type() == MPIResponse::ALLREDUCE) {
+    auto& first_entry = entries[0];
+    // A scoped allreduce sums up the tensor on the local or the cross
+    // communicator only.
+    auto scope = response.scope();
+    MPI_Comm reduce_comm = horovod_global.mpi_comm;
+    int reduce_rank = horovod_global.rank;
+    int reduce_size = horovod_global.size;
+    if (scope == LOCAL_SCOPE) {
+      reduce_comm = horovod_global.local_comm;
+      reduce_rank = horovod_global.local_rank;
+      reduce_size = horovod_global.local_size;
+    } else if (scope == CROSS_SCOPE) {
+      reduce_comm = horovod_global.cross_comm;
+      reduce_rank = horovod_global.cross_rank;
+      reduce_size = horovod_global.cross_size;
+    }
+    // With the TCP backend, CPU data is reduced over its ring instead of MPI.
+    bool tcp_allreduce = horovod_global.tcp_ring.initialized() &&
+                         first_entry.device == CPU_DEVICE_ID &&
+                         scope == GLOBAL_SCOPE;
+    // The choice of algorithms depends on the total size of the response,
+    // which is the same on all ranks.
+    int64_t total_bytes = 0;
+    for (auto& e : entries) {
+      total_bytes += e.tensor->size();
+    }
+#if HAVE_CUDA
+    bool on_gpu = first_entry.device != CPU_DEVICE_ID;
+    int lane = 0;
+    if (on_gpu) {
+      CUDA_CHECK(entries, "cudaSetDevice", cudaSetDevice(first_entry.device))
+
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+      lane = horovod_global.next_nccl_stream;
+      horovod_global.next_nccl_stream =
+          (lane + 1) % horovod_global.num_nccl_streams;
+#endif
+
+      // Ensure stream is in the map before executing reduction.
+      cudaStream_t& stream =
+          horovod_global.streams[std::make_tuple(first_entry.device, lane)];
+      if (stream == nullptr) {
+        CUDA_CHECK(entries, "CreatePriorityStream",
+                   CreatePriorityStream(&stream))
+      }
+    }
+#endif
+
+// 'N' stands for NCCL and 'D' for DDL
+#if HOROVOD_GPU_ALLREDUCE == 'N' || HOROVOD_GPU_ALLREDUCE == 'D'
+    if (on_gpu) {
+      auto stream =
+          horovod_global.streams[std::make_tuple(first_entry.device, lane)];
+      auto event_queue = std::queue<ActivityEvent>();
+
+      // Responses on other lanes may use the other fusion buffers at the
+      // same time, so buffers are handed over with events as well.
+      bool pipeline_fusion = horovod_global.fusion_buffer.NumBuffers() > 1 ||
+                             horovod_global.num_nccl_streams > 1;
+
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+      // Compressed data is reduced as float16.
+      ncclDataType_t nccl_data_type;
+      try {
+        nccl_data_type =
+            compressed ? ncclFloat16 : GetNCCLDataType(first_entry.tensor);
+      } catch (const std::logic_error& ex) {
+        OP_ERROR(entries, ex.what())
+      }
+#endif
+
+      // Hierarchical allreduce of GPU tensors only pays off across nodes.
+      bool hierarchical_allreduce =
+          scope == GLOBAL_SCOPE &&
+          horovod_global.param_manager.HierarchicalAllreduce(total_bytes) &&
+          horovod_global.cross_size > 1;
+
+      // Determine GPU IDs of the devices participating in this communicator.
+      ReduceScope nccl_scope = hierarchical_allreduce ? LOCAL_SCOPE : scope;
+      std::vector<int32_t> nccl_device_map =
+          ScopeDevices(response.devices(), nccl_scope);
+
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+      // Ensure NCCL communicator is in the map before executing reduction.
+      ncclComm_t nccl_comm;
+      status = GetNCCLComm(entries, nccl_device_map, lane, nccl_scope,
+                           &nccl_comm);
+      if (!status.ok()) {
+        OP_ERROR(entries, status.reason())
+      }
+#elif HOROVOD_GPU_ALLREDUCE == 'D'
+      if (scope != GLOBAL_SCOPE) {
+        OP_ERROR(entries, "DDL only reduces tensors across all ranks.")
+      }
+      if (!horovod_global.ddl_initialized) {
+        // Initialize DDL
+        auto ddl_options = std::getenv("DDL_OPTIONS");
+        if (ddl_options == nullptr) {
+          OP_ERROR(entries,
+                   "DDL_OPTIONS env variable needs to be set to use DDL.")
+        }
+        DDL_CHECK(entries, "ddl_init", ddl_init(ddl_options))
+        horovod_global.ddl_initialized = true;
+        horovod_global.ddl_local_device_id = first_entry.device;
+      } else if (horovod_global.ddl_local_device_id != first_entry.device) {
+        OP_ERROR(entries,
+                 "DDL does not support more than one GPU device per process.")
+      }
+#endif
+
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, QUEUE, stream)
+      }
+
+      CUDA_CHECK(entries, "WaitForReadyEvents",
+                 WaitForReadyEvents(entries, stream))
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, WAIT_FOR_DATA, stream)
+      }
+
+#if HAVE_CUDA_GRAPHS
+      // Allreduces which repeat with the same tensors and buffers are
+      // replayed from a CUDA graph instead of launching every copy and kernel
+      // from the host. Graphs don't record timeline activities and don't hand
+      // fusion buffers over between streams.
+      if (horovod_global.cuda_graphs && !hierarchical_allreduce &&
+          !compressed && !pipeline_fusion && !timeline.Initialized() &&
+          first_entry.compression == NO_COMPRESSION) {
+        CudaGraphSignature signature;
+        for (auto& e : entries) {
+          signature.tensor_names.push_back(e.tensor_name);
+          signature.inputs.push_back(e.tensor->data());
+          signature.outputs.push_back(e.output->data());
+          signature.sizes.push_back(e.tensor->size());
+          signature.factors.push_back(e.prescale_factor);
+        }
+        for (auto& e : entries) {
+          signature.factors.push_back(e.postscale_factor);
+        }
+        signature.buffer_data =
+            use_fusion_buffer
+                ? horovod_global.fusion_buffer
+                      .GetBuffer(first_entry.device,
+                                 first_entry.context->framework())
+                      ->AccessData(first_entry.context)
+                : first_entry.output->data();
+        signature.dtype = first_entry.tensor->dtype();
+        signature.stream = stream;
+        signature.nccl_comm = nccl_comm;
+
+        bool launched;
+        status = LaunchGraphAllreduce(entries, std::move(signature),
+                                      use_fusion_buffer, nccl_data_type,
+                                      launched);
+        if (!status.ok()) {
+          OP_ERROR(entries, status.reason())
+        }
+        if (launched) {
+          RECORD_EVENT(entries, event_queue, "", stream)
+          CompleteEntries(entries, first_entry.device, event_queue);
+          return;
+        }
+      }
+#endif
+
+      // If entries.size() > 1, we copy tensors into fusion buffer before
+      // allreduce, and distribute results of allreduce back into target
+      // tensors after allreduce.
+
+      const void* fused_input_data;
+      void* buffer_data;
+      int64_t num_elements = 0;
+      if (use_fusion_buffer) {
+        // Access the fusion buffer.
+        auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+            first_entry.device, first_entry.context->framework());
+        buffer_data =
+            const_cast<void*>(buffer->AccessData(first_entry.context));
+
+        // With several fusion buffers, the previous fused response may still
+        // be reduced on the main stream while this one is packed.
+        auto copy_stream = stream;
+        if (pipeline_fusion) {
+          cudaStream_t& fusion_copy_stream =
+              horovod_global.fusion_copy_streams[first_entry.device];
+          if (fusion_copy_stream == nullptr) {
+            CUDA_CHECK(entries, "CreatePriorityStream",
+                       CreatePriorityStream(&fusion_copy_stream))
+          }
+          copy_stream = fusion_copy_stream;
+          CUDA_CHECK(entries, "WaitForReadyEvents",
+                     WaitForReadyEvents(entries, copy_stream))
+
+          // Wait until the last operation using this buffer has unpacked it.
+          auto free_event =
+              horovod_global.fusion_buffer_free_events.find(buffer_data);
+          if (free_event != horovod_global.fusion_buffer_free_events.end()) {
+            CUDA_CHECK(entries, "cudaStreamWaitEvent",
+                       cudaStreamWaitEvent(copy_stream, free_event->second, 0))
+            CUDA_CHECK(entries, "ReleaseCudaEvent",
+                       ReleaseCudaEvent(free_event->second))
+            horovod_global.fusion_buffer_free_events.erase(free_event);
+          }
+        }
+
+        // Copy memory into the fusion buffer, applying the prescale factors.
+        std::vector<const void*> inputs;
+        std::vector<double> factors;
+        for (auto& e : entries) {
+          inputs.push_back(e.tensor->data());
+          factors.push_back(e.prescale_factor);
+        }
+        if (compressed) {
+          // Cast all tensors to float16 with a single kernel.
+          std::vector<int64_t> counts;
+          for (auto& e : entries) {
+            counts.push_back(e.tensor->shape().num_elements());
+          }
+          CUDA_CHECK(entries, "BatchedPackFloat2Half",
+                     BatchedPackFloat2Half(inputs, counts, factors,
+                                           buffer_data, copy_stream))
+        } else {
+          std::vector<void*> outputs;
+          int64_t offset = 0;
+          for (auto& e : entries) {
+            outputs.push_back((uint8_t*)buffer_data + offset);
+            offset += e.tensor->size();
+          }
+          CUDA_CHECK(entries, "ScaledCopiesAsync",
+                     ScaledCopiesAsync(entries, inputs, outputs, factors,
+                                       copy_stream))
+        }
+
+        if (timeline.Initialized() || horovod_global.ddl_initialized) {
+          RECORD_EVENT(entries, event_queue, MEMCPY_IN_FUSION_BUFFER,
+                       copy_stream)
+        }
+
+        if (pipeline_fusion) {
+          // The reduction on the main stream has to wait for the packing.
+          cudaEvent_t packed_event;
+          CUDA_CHECK(entries, "GetCudaEvent", GetCudaEvent(&packed_event))
+          CUDA_CHECK(entries, "cudaEventRecord",
+                     cudaEventRecord(packed_event, copy_stream))
+          CUDA_CHECK(entries, "cudaStreamWaitEvent",
+                     cudaStreamWaitEvent(stream, packed_event, 0))
+          CUDA_CHECK(entries, "ReleaseCudaEvent", ReleaseCudaEvent(packed_event))
+        }
+
+        // Set the input data to originate from the buffer.
+        fused_input_data = buffer_data;
+
+        // Perform the reduction on the fusion buffer.
+        for (auto& e : entries) {
+          num_elements += e.tensor->shape().num_elements();
+        }
+
+      } else {
+        fused_input_data = first_entry.tensor->data();
+        buffer_data = (void*)first_entry.output->data();
+        num_elements = first_entry.tensor->shape().num_elements();
+
+        if (horovod_global.ddl_initialized ||
+            first_entry.prescale_factor != 1.0) {
+          // Copy input buffer content to output buffer, because DDL only
+          // supports in-place allreduce, and scale it there
+          CUDA_CHECK(entries, "ScaledCopiesAsync",
+                     ScaledCopiesAsync(entries, {fused_input_data},
+                                       {buffer_data},
+                                       {first_entry.prescale_factor}, stream))
+          fused_input_data = buffer_data;
+          if (timeline.Initialized() || horovod_global.ddl_initialized) {
+            RECORD_EVENT(entries, event_queue, MEMCPY_IN_FUSION_BUFFER,
+                         stream)
+          }
+        }
+      }
+
+#if HOROVOD_GPU_ALLREDUCE == 'D'
+      // Synchronize.
+      WAIT_FOR_EVENTS(entries, timeline, event_queue)
+      DDL_Type ddl_data_type;
+      try {
+        ddl_data_type = GetDDLDataType(first_entry.tensor);
+      } catch (const std::logic_error& ex) {
+        OP_ERROR(entries, ex.what())
+      }
+      DDL_CHECK(entries, "ddl_allreduce",
+                ddl_allreduce(buffer_data, (size_t)num_elements, ddl_data_type,
+                              DDL_OP_SUM))
+#else
+      if (hierarchical_allreduce) {
+        auto mpi_data_type = compressed ? horovod_global.mpi_float16_t
+                                        : GetMPIDataType(first_entry.tensor);
+        auto mpi_op = GetMPISumOp(compressed ? HOROVOD_FLOAT16
+                                             : first_entry.tensor->dtype());
+        int element_size;
+        MPI_Type_size(mpi_data_type, &element_size);
+
+        // If we are using fusion buffer, include dummy elements from the
+        // buffer (if necessary) to make sure the data is divisible into the
+        // slices of all nodes. This is always possible since we set the
+        // fusion buffer size divisible by hierarchical_slice_unit.
+        int64_t slice_unit = horovod_global.hierarchical_slice_unit;
+        if (use_fusion_buffer) {
+          // Making sure the number of elements is divisible by
+          // FUSION_BUFFER_ATOMIC_UNIT for improved performance
+          int64_t div = slice_unit * FUSION_BUFFER_ATOMIC_UNIT;
+          num_elements = ((num_elements + div - 1) / div) * div;
+        }
+
+        // Split the elements into two groups: the part divisible into the
+        // slices of all nodes, and num_elements_remaining. Within every node
+        // the first group is split evenly between the local ranks with NCCL
+        // ReduceScatter, every slice of it is allreduced across nodes by the
+        // ranks owning it in parallel, and it is gathered again with NCCL
+        // Allgather. For the second group (if any), do NCCL Reduce (at
+        // root_rank), MPI Allreduce (across root_rank's), and NCCL Bcast.
+        int64_t num_elements_sliced = num_elements / slice_unit * slice_unit;
+        int64_t num_elements_per_rank =
+            num_elements_sliced / horovod_global.local_size;
+
+        size_t buffer_len_per_rank = element_size * num_elements_per_rank;
+
+        void* buffer_data_at_rank_offset =
+            (uint8_t*)buffer_data +
+            buffer_len_per_rank * horovod_global.local_rank;
+
+        int64_t num_elements_remaining = num_elements - num_elements_sliced;
+
+        void* buffer_data_remainder =
+            (uint8_t*)buffer_data + element_size * num_elements_sliced;
+
+        void* fused_input_data_remainder =
+            (uint8_t*)fused_input_data + element_size * num_elements_sliced;
+
+        // Local rank 0 is on every node, while the last local rank lines up
+        // across nodes only if all nodes run the same number of ranks.
+        int root_rank =
+            horovod_global.is_homogeneous ? horovod_global.local_size - 1 : 0;
+        bool is_root_rank = horovod_global.local_rank == root_rank;
+
+        // Ranges of the buffer that this rank allreduces across nodes.
+        struct CrossRange {
+          int64_t offset;
+          int64_t count;
+          MPI_Comm comm;
+        };
+        std::vector<CrossRange> cross_ranges;
+        auto& slice_starts = horovod_global.hierarchical_slice_starts;
+        for (size_t i = 0; i + 1 < slice_starts.size(); ++i) {
+          auto slice_comm = horovod_global.hierarchical_slice_comms[i];
+          int64_t offset = num_elements_sliced / slice_unit * slice_starts[i];
+          int64_t end = num_elements_sliced / slice_unit * slice_starts[i + 1];
+          if (slice_comm != MPI_COMM_NULL && end > offset) {
+            cross_ranges.push_back({offset, end - offset, slice_comm});
+          }
+        }
+        if (is_root_rank && num_elements_remaining > 0) {
+          cross_ranges.push_back({num_elements_sliced, num_elements_remaining,
+                                  horovod_global.cross_comm});
+        }
+
+        if (num_elements_per_rank > 0) {
+          NCCL_CHECK(entries, "ncclReduceScatter",
+                     ncclReduceScatter(fused_input_data,
+                                       buffer_data_at_rank_offset,
+                                       (size_t)num_elements_per_rank,
+                                       nccl_data_type, ncclSum, nccl_comm,
+                                       stream))
+
+          if (timeline.Initialized()) {
+            RECORD_EVENT(entries, event_queue, NCCL_REDUCESCATTER, stream)
+          }
+        }
+
+        if (num_elements_remaining > 0) {
+          // Reduce the remaining data at root_rank to append to existing
+          // buffer
+          NCCL_CHECK(entries, "ncclReduce",
+                     ncclReduce(fused_input_data_remainder,
+                                buffer_data_remainder,
+                                (size_t)num_elements_remaining,
+                                nccl_data_type, ncclSum, root_rank, nccl_comm,
+                                stream))
+
+          if (timeline.Initialized()) {
+            RECORD_EVENT(entries, event_queue, NCCL_REDUCE, stream)
+          }
+        }
+
+        auto device_mpi_op =
+            horovod_global.cuda_aware_mpi
+                ? GetMPIDeviceSumOp(compressed ? HOROVOD_FLOAT16
+                                               : first_entry.tensor->dtype())
+                : MPI_OP_NULL;
+        if (!cross_ranges.empty() && device_mpi_op != MPI_OP_NULL) {
+          // A CUDA-aware MPI allreduces the slices in device memory, once the
+          // stream has reduced them within the node.
+          CUDA_CHECK(entries, "cudaStreamSynchronize",
+                     cudaStreamSynchronize(stream))
+          WAIT_FOR_EVENTS(entries, timeline, event_queue)
+
+          ACTIVITY_START_ALL(entries, timeline, MPI_ALLREDUCE)
+          for (auto& range : cross_ranges) {
+            MPI_CHECK(entries, "MPI_Allreduce",
+                      MPI_Allreduce(MPI_IN_PLACE,
+                                    (uint8_t*)buffer_data +
+                                        range.offset * element_size,
+                                    (int)range.count, mpi_data_type,
+                                    device_mpi_op, range.comm))
+          }
+          ACTIVITY_END_ALL(entries, timeline)
+        } else if (!cross_ranges.empty()) {
+          // The data is copied to the host and back in chunks through a
+          // small pool of pinned buffers, which is allocated once. Copies of
+          // the next chunks on the stream overlap with the cross-node
+          // allreduce of the current chunk on the host.
+          auto& chunk_buffers = horovod_global.host_chunk_buffers;
+          int64_t chunk_size = horovod_global.hierarchical_chunk_size;
+          if (horovod_global.host_chunk_buffer_size != chunk_size) {
+            for (auto chunk_buffer : chunk_buffers) {
+              cudaFreeHost(chunk_buffer);
+            }
+            chunk_buffers.clear();
+            horovod_global.host_chunk_buffer_size = chunk_size;
+          }
+          while (chunk_buffers.size() < HIERARCHICAL_ALLREDUCE_CHUNK_BUFFERS) {
+            void* chunk_buffer;
+            CUDA_CHECK(entries, "cudaHostAlloc",
+                       cudaHostAlloc(&chunk_buffer, (size_t)chunk_size,
+                                     cudaHostAllocPortable))
+            chunk_buffers.push_back(chunk_buffer);
+          }
+
+          // The chunk buffers may still be copied back to the device for the
+          // previous response on another lane.
+          auto& chunk_buffers_event = horovod_global.host_chunk_buffers_event;
+          if (chunk_buffers_event != nullptr) {
+            CUDA_CHECK(entries, "cudaStreamWaitEvent",
+                       cudaStreamWaitEvent(stream, chunk_buffers_event, 0))
+            CUDA_CHECK(entries, "ReleaseCudaEvent",
+                       ReleaseCudaEvent(chunk_buffers_event))
+            chunk_buffers_event = nullptr;
+          }
+
+          // Synchronize.
+          WAIT_FOR_EVENTS(entries, timeline, event_queue)
+
+          int64_t chunk_num_elements = chunk_size / element_size;
+          std::vector<CrossRange> chunks;
+          for (auto& range : cross_ranges) {
+            for (int64_t offset = 0; offset < range.count;
+                 offset += chunk_num_elements) {
+              chunks.push_back(
+                  {range.offset + offset,
+                   std::min(chunk_num_elements, range.count - offset),
+                   range.comm});
+            }
+          }
+          int64_t num_chunks = (int64_t)chunks.size();
+          int64_t num_chunks_copied = 0;
+          std::queue<cudaEvent_t> copy_events;
+          ACTIVITY_START_ALL(entries, timeline, MPI_ALLREDUCE)
+          for (int64_t chunk = 0; chunk < num_chunks; ++chunk) {
+            // Copy chunks into all chunk buffers which have been copied back
+            // to the device. The copy back of the chunk previously held by a
+            // buffer is ahead of the new copy on the stream.
+            while (num_chunks_copied < num_chunks &&
+                   num_chunks_copied < chunk + (int64_t)chunk_buffers.size()) {
+              auto& next_chunk = chunks[num_chunks_copied];
+              CUDA_CHECK(
+                  entries, "cudaMemcpyAsync",
+                  cudaMemcpyAsync(
+                      chunk_buffers[num_chunks_copied % chunk_buffers.size()],
+                      (uint8_t*)buffer_data + next_chunk.offset * element_size,
+                      (size_t)(next_chunk.count * element_size),
+                      cudaMemcpyDeviceToHost, stream))
+              cudaEvent_t copy_event;
+              CUDA_CHECK(entries, "GetCudaEvent", GetCudaEvent(&copy_event))
+              CUDA_CHECK(entries, "cudaEventRecord",
+                         cudaEventRecord(copy_event, stream))
+              copy_events.push(copy_event);
+              ++num_chunks_copied;
+            }
+
+            void* chunk_buffer = chunk_buffers[chunk % chunk_buffers.size()];
+            auto& this_chunk = chunks[chunk];
+            CUDA_CHECK(entries, "cudaEventSynchronize",
+                       cudaEventSynchronize(copy_events.front()))
+            CUDA_CHECK(entries, "ReleaseCudaEvent",
+                       ReleaseCudaEvent(copy_events.front()))
+            copy_events.pop();
+
+            MPI_CHECK(entries, "MPI_Allreduce",
+                      MPI_Allreduce(MPI_IN_PLACE, chunk_buffer,
+                                    (int)this_chunk.count, mpi_data_type,
+                                    mpi_op, this_chunk.comm))
+
+            CUDA_CHECK(entries, "cudaMemcpyAsync",
+                       cudaMemcpyAsync((uint8_t*)buffer_data +
+                                           this_chunk.offset * element_size,
+                                       chunk_buffer,
+                                       (size_t)(this_chunk.count * element_size),
+                                       cudaMemcpyHostToDevice, stream))
+          }
+          CUDA_CHECK(entries, "GetCudaEvent", GetCudaEvent(&chunk_buffers_event))
+          CUDA_CHECK(entries, "cudaEventRecord",
+                     cudaEventRecord(chunk_buffers_event, stream))
+          ACTIVITY_END_ALL(entries, timeline)
+        }
+
+        if (num_elements_per_rank > 0) {
+          NCCL_CHECK(entries, "ncclAllGather",
+                     ncclAllGather(buffer_data_at_rank_offset, buffer_data,
+                                   (size_t)num_elements_per_rank,
+                                   nccl_data_type, nccl_comm, stream))
+
+          if (timeline.Initialized()) {
+            RECORD_EVENT(entries, event_queue, NCCL_ALLGATHER, stream)
+          }
+        }
+        if (num_elements_remaining > 0) {
+          NCCL_CHECK(entries, "ncclBcast",
+                     ncclBcast(buffer_data_remainder,
+                               (size_t)num_elements_remaining,
+                               nccl_data_type, root_rank, nccl_comm, stream))
+
+          if (timeline.Initialized()) {
+            RECORD_EVENT(entries, event_queue, NCCL_BCAST, stream)
+          }
+        }
+      } else {
+        NCCL_CHECK(entries, "ncclAllReduce",
+                   ncclAllReduce(fused_input_data, buffer_data,
+                                 (size_t)num_elements, nccl_data_type, ncclSum,
+                                 nccl_comm, stream))
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, NCCL_ALLREDUCE, stream)
+        }
+      }
+#endif
+
+      if (use_fusion_buffer) {
+        // Copy memory out of the fusion buffer, applying the postscale
+        // factors.
+        std::vector<void*> outputs;
+        std::vector<double> factors;
+        for (auto& e : entries) {
+          outputs.push_back((void*)e.output->data());
+          factors.push_back(e.postscale_factor);
+        }
+        if (compressed) {
+          std::vector<int64_t> counts;
+          for (auto& e : entries) {
+            counts.push_back(e.tensor->shape().num_elements());
+          }
+          CUDA_CHECK(entries, "BatchedUnpackHalf2Float",
+                     BatchedUnpackHalf2Float(buffer_data, outputs, counts,
+                                             factors, stream))
+        } else {
+          std::vector<const void*> inputs;
+          int64_t offset = 0;
+          for (auto& e : entries) {
+            inputs.push_back((uint8_t*)buffer_data + offset);
+            offset += e.tensor->size();
+          }
+          CUDA_CHECK(entries, "ScaledCopiesAsync",
+                     ScaledCopiesAsync(entries, inputs, outputs, factors,
+                                       stream))
+        }
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, MEMCPY_OUT_FUSION_BUFFER, stream)
+        }
+
+        if (pipeline_fusion) {
+          // Let the next operation using this buffer know when it's free.
+          cudaEvent_t free_event;
+          CUDA_CHECK(entries, "GetCudaEvent", GetCudaEvent(&free_event))
+          CUDA_CHECK(entries, "cudaEventRecord",
+                     cudaEventRecord(free_event, stream))
+          horovod_global.fusion_buffer_free_events[buffer_data] = free_event;
+        }
+      } else if (first_entry.postscale_factor != 1.0) {
+        CUDA_CHECK(entries, "ScaledCopiesAsync",
+                   ScaledCopiesAsync(entries, {buffer_data}, {buffer_data},
+                                     {first_entry.postscale_factor}, stream))
+      }
+
+      // Use completion marker via event because it's faster than
+      // blocking cudaStreamSynchronize() in this thread. The finalizer
+      // thread waits for it, so that the background thread can go on with
+      // the next operation right away.
+      RECORD_EVENT(entries, event_queue, "", stream)
+
+      CompleteEntries(entries, first_entry.device, event_queue);
+      return;
+    }
+#endif
+
+    // With hierarchical allreduce, CPU tensors are summed up within every
+    // node through the shared buffer instead of sending them over MPI.
+    bool shared_memory_allreduce =
+        first_entry.device == CPU_DEVICE_ID && scope == GLOBAL_SCOPE &&
+        horovod_global.param_manager.HierarchicalAllreduce(total_bytes) &&
+        horovod_global.local_size > 1;
+
+    if (first_entry.compression == INT8_COMPRESSION ||
+        first_entry.compression == ONEBIT_COMPRESSION) {
+      // Sums of quantized values can't be computed by MPI_Allreduce. Instead,
+      // every rank sums up one segment of the data: the quantized data is
+      // exchanged with MPI_Alltoallv, every rank quantizes its sums again with
+      // INT8_COMPRESSION, and the sums are gathered with MPI_Allgatherv.
+      assert(first_entry.device == CPU_DEVICE_ID);
+      auto compression = first_entry.compression;
+      auto& quantizer = horovod_global.quantizer;
+      auto& values = horovod_global.quantization_values;
+      auto& send_buffer = horovod_global.quantization_send_buffer;
+      auto& recv_buffer = horovod_global.quantization_recv_buffer;
+
+      ACTIVITY_START_ALL(entries, timeline, QUANTIZE)
+      int64_t num_elements = 0;
+      for (auto& e : entries) {
+        num_elements += e.tensor->shape().num_elements();
+      }
+      values.resize((size_t)num_elements);
+
+      // Add the quantization error of the previous step to the tensors.
+      int64_t offset = 0;
+      for (auto& e : entries) {
+        int64_t count = e.tensor->shape().num_elements();
+        auto& residual = horovod_global.quantization_residuals[e.tensor_name];
+        if (residual.num_elements != count) {
+          horovod_global.quantization_residual_bytes -=
+              residual.num_elements * (int64_t)sizeof(float);
+          residual.num_elements = 0;
+          residual.buffer.reset();
+          Status status = e.context->AllocatePersistent(
+              count * (int64_t)sizeof(float), &residual.buffer);
+          if (!status.ok()) {
+            horovod_global.quantization_residuals.erase(e.tensor_name);
+            OP_ERROR(entries, status.reason())
+          }
+          residual.num_elements = count;
+          horovod_global.quantization_residual_bytes +=
+              count * (int64_t)sizeof(float);
+          std::memset((void*)residual.buffer->AccessData(e.context), 0,
+                      (size_t)count * sizeof(float));
+        }
+        auto input = (const float*)e.tensor->data();
+        auto error = (const float*)residual.buffer->AccessData(e.context);
+        auto prescale = (float)e.prescale_factor;
+        for (int64_t i = 0; i < count; ++i) {
+          values[offset + i] = input[i] * prescale + error[i];
+        }
+        offset += count;
+      }
+
+      // Quantize everything and keep the quantization error for the next step.
+      send_buffer.resize(
+          (size_t)Quantizer::QuantizedSize(num_elements, compression));
+      quantizer.Quantize(values.data(), num_elements, compression,
+                         send_buffer.data(), values.data());
+      offset = 0;
+      for (auto& e : entries) {
+        int64_t count = e.tensor->shape().num_elements();
+        auto& residual = horovod_global.quantization_residuals[e.tensor_name];
+        std::memcpy((void*)residual.buffer->AccessData(e.context),
+                    values.data() + offset, (size_t)count * sizeof(float));
+        offset += count;
+      }
+      if (timeline.Initialized()) {
+        std::stringstream args;
+        args << "\"compression_ratio\": "
+             << (double)num_elements * sizeof(float) / send_buffer.size()
+             << ", \"residual_bytes\": "
+             << horovod_global.quantization_residual_bytes;
+        for (auto& e : entries) {
+          timeline.ActivityEnd(e.tensor_name, args.str());
+        }
+      }
+
+      // Segments of whole chunks, segment r is reduced by rank r.
+      int size = reduce_size;
+      int rank = reduce_rank;
+      int64_t num_chunks =
+          (num_elements + QUANTIZATION_CHUNK_SIZE - 1) / QUANTIZATION_CHUNK_SIZE;
+      std::vector<int64_t> segment_starts(size + 1);
+      for (int r = 0; r <= size; ++r) {
+        segment_starts[r] = std::min(
+            num_elements, num_chunks * r / size * QUANTIZATION_CHUNK_SIZE);
+      }
+      int64_t segment_start = segment_starts[rank];
+      int64_t segment_count = segment_starts[rank + 1] - segment_start;
+
+      std::vector<int> counts(size);
+      std::vector<int> displcmnts(size);
+      std::vector<int> recvcounts(size);
+      std::vector<int> recvdisplcmnts(size);
+      int segment_bytes =
+          (int)Quantizer::QuantizedSize(segment_count, compression);
+      for (int r = 0; r < size; ++r) {
+        counts[r] = (int)Quantizer::QuantizedSize(
+            segment_starts[r + 1] - segment_starts[r], compression);
+        displcmnts[r] =
+            (int)Quantizer::QuantizedSize(segment_starts[r], compression);
+        recvcounts[r] = segment_bytes;
+        recvdisplcmnts[r] = r * segment_bytes;
+      }
+      recv_buffer.resize((size_t)segment_bytes * size);
+
+      ACTIVITY_START_ALL(entries, timeline, MPI_ALLTOALLV)
+      MPI_CHECK(entries, "MPI_Alltoallv",
+                MPI_Alltoallv(send_buffer.data(), counts.data(),
+                              displcmnts.data(), MPI_BYTE, recv_buffer.data(),
+                              recvcounts.data(), recvdisplcmnts.data(),
+                              MPI_BYTE, reduce_comm))
+      ACTIVITY_END_ALL(entries, timeline)
+
+      // Sum up the segment of this rank and quantize the sums.
+      ACTIVITY_START_ALL(entries, timeline, QUANTIZE)
+      float* segment_values = values.data() + segment_start;
+      std::fill(segment_values, segment_values + segment_count, 0.0f);
+      for (int r = 0; r < size; ++r) {
+        Quantizer::Dequantize(recv_buffer.data() + recvdisplcmnts[r],
+                              segment_count, compression, segment_values,
+                              true);
+      }
+      for (int r = 0; r < size; ++r) {
+        counts[r] = (int)Quantizer::QuantizedSize(
+            segment_starts[r + 1] - segment_starts[r], INT8_COMPRESSION);
+        displcmnts[r] =
+            (int)Quantizer::QuantizedSize(segment_starts[r], INT8_COMPRESSION);
+      }
+      send_buffer.resize(
+          (size_t)Quantizer::QuantizedSize(num_elements, INT8_COMPRESSION));
+      quantizer.Quantize(segment_values, segment_count, INT8_COMPRESSION,
+                         send_buffer.data() + displcmnts[rank], nullptr);
+      ACTIVITY_END_ALL(entries, timeline)
+
+      ACTIVITY_START_ALL(entries, timeline, MPI_ALLGATHERV)
+      MPI_CHECK(entries, "MPI_Allgatherv",
+                MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                               send_buffer.data(), counts.data(),
+                               displcmnts.data(), MPI_BYTE,
+                               reduce_comm))
+      ACTIVITY_END_ALL(entries, timeline)
+
+      ACTIVITY_START_ALL(entries, timeline, DEQUANTIZE)
+      Quantizer::Dequantize(send_buffer.data(), num_elements, INT8_COMPRESSION,
+                            values.data(), false);
+      offset = 0;
+      for (auto& e : entries) {
+        ScaledCopy(e, values.data() + offset, (void*)e.output->data(),
+                   e.postscale_factor);
+        offset += e.tensor->shape().num_elements();
+      }
+      ACTIVITY_END_ALL(entries, timeline)
+    } else if (compressed) {
+      // Only CPU tensors get here, GPU tensors are compressed with NCCL only.
+      assert(first_entry.device == CPU_DEVICE_ID);
+      auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+          first_entry.device, first_entry.context->framework());
+      auto buffer_data = (unsigned short*)buffer->AccessData(first_entry.context);
+
+      // Convert the tensors to float16 while copying them into the fusion
+      // buffer.
+      ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_FUSION_BUFFER)
+      int64_t num_elements = 0;
+      for (auto& e : entries) {
+        int64_t count = e.tensor->shape().num_elements();
+        Float2HalfBuffer((const float*)e.tensor->data(),
+                         buffer_data + num_elements, count,
+                         (float)e.prescale_factor);
+        num_elements += count;
+      }
+      ACTIVITY_END_ALL(entries, timeline)
+
+      if (tcp_allreduce) {
+        ACTIVITY_START_ALL(entries, timeline, TCP_ALLREDUCE)
+        status = TcpAllreduce(HOROVOD_FLOAT16, horovod_global.mpi_float16_t,
+                              buffer_data, num_elements);
+        if (!status.ok()) {
+          OP_ERROR(entries, status.reason())
+        }
+      } else {
+        ACTIVITY_START_ALL(entries, timeline, MPI_ALLREDUCE)
+        MPI_CHECK(entries, "MPI_Allreduce",
+                  MPI_Allreduce(MPI_IN_PLACE, (void*)buffer_data,
+                                (int)num_elements, horovod_global.mpi_float16_t,
+                                horovod_global.mpi_float16_sum, reduce_comm))
+      }
+      ACTIVITY_END_ALL(entries, timeline)
+
+      ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_FUSION_BUFFER)
+      num_elements = 0;
+      for (auto& e : entries) {
+        int64_t count = e.tensor->shape().num_elements();
+        HalfBuffer2Float(buffer_data + num_elements, (float*)e.output->data(),
+                         count, (float)e.postscale_factor);
+        num_elements += count;
+      }
+      ACTIVITY_END_ALL(entries, timeline)
+    } else if (shared_memory_allreduce) {
+      // The data is processed in chunks. Every local rank copies its part of
+      // a chunk into its own slot of the shared buffer. Every local rank then
+      // sums up its slices of the chunk over all slots into the first slot
+      // and allreduces them with the other nodes. Finally, every local rank
+      // copies the sums out of the first slot.
+      auto dtype = first_entry.tensor->dtype();
+      auto mpi_data_type = GetMPIDataType(first_entry.tensor);
+      int element_size;
+      MPI_Type_size(mpi_data_type, &element_size);
+      int local_rank = horovod_global.local_rank;
+      int local_size = horovod_global.local_size;
+      int64_t num_elements = 0;
+      for (auto& e : entries) {
+        num_elements += e.tensor->shape().num_elements();
+      }
+
+      // Slots and slices start at cache line boundaries, so that local ranks
+      // don't write to the same cache lines.
+      const int64_t cache_line = 64;
+      int64_t chunk_elements = std::max(
+          std::min(horovod_global.hierarchical_chunk_size / element_size,
+                   num_elements),
+          (int64_t)1);
+      int64_t slot_size = (chunk_elements * element_size + cache_line - 1) /
+                          cache_line * cache_line;
+      if (horovod_global.shared_buffer == nullptr ||
+          horovod_global.shared_buffer_size < slot_size * local_size) {
+        ACTIVITY_START_ALL(entries, timeline, ALLOCATE_SHARED_BUFFER)
+        EnsureSharedBuffer(slot_size * local_size, element_size);
+        ACTIVITY_END_ALL(entries, timeline)
+      }
+      auto shared_data = (uint8_t*)horovod_global.shared_buffer;
+
+      // Copies the elements [chunk_start, chunk_start + chunk_count) of the
+      // fused entries into the slot of this rank, or the sums of them out of
+      // the first slot into the outputs.
+      auto copy_chunk = [&](int64_t chunk_start, int64_t chunk_count,
+                            bool copy_in) {
+        int64_t offset = 0;
+        for (auto& e : entries) {
+          int64_t count = e.tensor->shape().num_elements();
+          int64_t start = std::max(chunk_start, offset);
+          int64_t end = std::min(chunk_start + chunk_count, offset + count);
+          if (start < end) {
+            auto entry_data =
+                (copy_in ? (uint8_t*)e.tensor->data()
+                         : (uint8_t*)e.output->data()) +
+                (start - offset) * element_size;
+            auto slot_data = shared_data +
+                             (copy_in ? local_rank * slot_size : 0) +
+                             (start - chunk_start) * element_size;
+            if (copy_in) {
+              ScaledCopy(dtype, entry_data, slot_data, end - start,
+                         element_size, e.prescale_factor);
+            } else {
+              ScaledCopy(dtype, slot_data, entry_data, end - start,
+                         element_size, e.postscale_factor);
+            }
+          }
+          offset += count;
+        }
+      };
+
+      for (int64_t chunk_start = 0; chunk_start < num_elements;
+           chunk_start += chunk_elements) {
+        int64_t chunk_count =
+            std::min(chunk_elements, num_elements - chunk_start);
+
+        ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_SHARED_BUFFER)
+        copy_chunk(chunk_start, chunk_count, true);
+        MPI_CHECK(entries, "MPI_Barrier",
+                  MPI_Barrier(horovod_global.local_comm))
+        ACTIVITY_END_ALL(entries, timeline)
+
+        // Every local rank sums up the slices of the chunk it owns and
+        // allreduces them with the owners of the slices on the other nodes.
+        auto& slice_starts = horovod_global.hierarchical_slice_starts;
+        int64_t slice_unit = horovod_global.hierarchical_slice_unit;
+        int64_t cache_line_elements = std::max(cache_line / element_size,
+                                               (int64_t)1);
+        auto slice_offset = [&](size_t slice) -> int64_t {
+          if (slice + 1 == slice_starts.size()) {
+            return chunk_count;
+          }
+          return chunk_count * slice_starts[slice] / slice_unit /
+                 cache_line_elements * cache_line_elements;
+        };
+        for (size_t i = 0; i + 1 < slice_starts.size(); ++i) {
+          auto slice_comm = horovod_global.hierarchical_slice_comms[i];
+          int64_t slice_start = slice_offset(i);
+          int64_t slice_count = slice_offset(i + 1) - slice_start;
+          if (slice_comm == MPI_COMM_NULL || slice_count == 0) {
+            continue;
+          }
+          auto slice_data = shared_data + slice_start * element_size;
+
+          ACTIVITY_START_ALL(entries, timeline, SHARED_MEMORY_REDUCE)
+          for (int r = 1; r < local_size; ++r) {
+            AccumulateValues(dtype, slice_data + r * slot_size, slice_data,
+                             slice_count);
+          }
+          ACTIVITY_END_ALL(entries, timeline)
+
+          if (horovod_global.cross_size > 1) {
+            ACTIVITY_START_ALL(entries, timeline, MPI_CROSS_ALLREDUCE)
+            MPI_CHECK(entries, "MPI_Allreduce",
+                      MPI_Allreduce(MPI_IN_PLACE, slice_data, (int)slice_count,
+                                    mpi_data_type, GetMPISumOp(dtype),
+                                    slice_comm))
+            ACTIVITY_END_ALL(entries, timeline)
+          }
+        }
+
+        // The slots are only reused for the next chunk once every local rank
+        // copied the sums out.
+        ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_SHARED_BUFFER)
+        MPI_CHECK(entries, "MPI_Barrier",
+                  MPI_Barrier(horovod_global.local_comm))
+        copy_chunk(chunk_start, chunk_count, false);
+        MPI_CHECK(entries, "MPI_Barrier",
+                  MPI_Barrier(horovod_global.local_comm))
+        ACTIVITY_END_ALL(entries, timeline)
+      }
+    } else if (entries.size() > 1) {
+      // Access the fusion buffer.
+      auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+          first_entry.device, first_entry.context->framework());
+      auto buffer_data = buffer->AccessData(first_entry.context);
+
+      // Copy memory into the fusion buffer, applying the prescale factors.
+      ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_FUSION_BUFFER)
+      std::vector<const void*> inputs;
+      std::vector<void*> outputs;
+      std::vector<double> factors;
+      int64_t offset = 0;
+      for (auto& e : entries) {
+        inputs.push_back(e.tensor->data());
+        outputs.push_back((uint8_t*)buffer_data + offset);
+        factors.push_back(e.prescale_factor);
+        offset += e.tensor->size();
+      }
+#if HAVE_CUDA
+      if (on_gpu) {
+        auto stream =
+            horovod_global.streams[std::make_tuple(first_entry.device, lane)];
+        CUDA_CHECK(entries, "ScaledCopiesAsync",
+                   ScaledCopiesAsync(entries, inputs, outputs, factors,
+                                     stream))
+        CUDA_CHECK(entries, "cudaStreamSynchronize",
+                   cudaStreamSynchronize(stream))
+      } else {
+#endif
+        ScaledCopies(entries, inputs, outputs, factors);
+#if HAVE_CUDA
+      }
+#endif
+      ACTIVITY_END_ALL(entries, timeline)
+
+      int64_t num_elements = 0;
+      for (auto& e : entries) {
+        num_elements += e.tensor->shape().num_elements();
+      }
+      if (tcp_allreduce) {
+        ACTIVITY_START_ALL(entries, timeline, TCP_ALLREDUCE)
+        status = TcpAllreduce(first_entry.tensor->dtype(),
+                              GetMPIDataType(first_entry.tensor),
+                              (void*)buffer_data, num_elements);
+        if (!status.ok()) {
+          OP_ERROR(entries, status.reason())
+        }
+      } else {
+        ACTIVITY_START_ALL(entries, timeline, MPI_ALLREDUCE)
+        MPI_CHECK(entries, "MPI_Allreduce",
+                  MPI_Allreduce(MPI_IN_PLACE, (void*)buffer_data,
+                                (int)num_elements,
+                                GetMPIDataType(first_entry.tensor),
+                                GetMPISumOp(first_entry.tensor->dtype()),
+                                reduce_comm))
+      }
+      ACTIVITY_END_ALL(entries, timeline)
+
+      // Copy memory out of the fusion buffer, applying the postscale
+      // factors.
+      ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_FUSION_BUFFER)
+      std::vector<const void*> fused_outputs(outputs.begin(), outputs.end());
+      for (size_t ec = 0; ec < entries.size(); ++ec) {
+        outputs[ec] = (void*)entries[ec].output->data();
+        factors[ec] = entries[ec].postscale_factor;
+      }
+#if HAVE_CUDA
+      if (on_gpu) {
+        auto stream =
+            horovod_global.streams[std::make_tuple(first_entry.device, lane)];
+        CUDA_CHECK(entries, "ScaledCopiesAsync",
+                   ScaledCopiesAsync(entries, fused_outputs, outputs, factors,
+                                     stream))
+        CUDA_CHECK(entries, "cudaStreamSynchronize",
+                   cudaStreamSynchronize(stream))
+      } else {
+#endif
+        ScaledCopies(entries, fused_outputs, outputs, factors);
+#if HAVE_CUDA
+      }
+#endif
+      ACTIVITY_END_ALL(entries, timeline)
+    } else {
+      auto& e = first_entry;
+      // Scaled data is allreduced in place in the output.
+      auto scale = [&](const void* src, double factor) -> Status {
+#if HAVE_CUDA
+        if (on_gpu) {
+          auto stream =
+              horovod_global.streams[std::make_tuple(e.device, lane)];
+          auto cuda_result = ScaledCopiesAsync(
+              entries, {src}, {(void*)e.output->data()}, {factor}, stream);
+          if (cuda_result == cudaSuccess) {
+            cuda_result = cudaStreamSynchronize(stream);
+          }
+          if (cuda_result != cudaSuccess) {
+            return Status::UnknownError(
+                std::string("ScaledCopiesAsync failed: ") +
+                cudaGetErrorString(cuda_result));
+          }
+          return Status::OK();
+        }
+#endif
+        ScaledCopy(e, src, (void*)e.output->data(), factor);
+        return Status::OK();
+      };
+      if (e.prescale_factor != 1.0) {
+        status = scale(e.tensor->data(), e.prescale_factor);
+        if (!status.ok()) {
+          OP_ERROR(entries, status.reason())
+        }
+      }
+
+      const void* sendbuf = e.tensor->data() == e.output->data() ||
+                                    e.prescale_factor != 1.0
+                                ? MPI_IN_PLACE
+                                : e.tensor->data();
+      int64_t num_elements = e.tensor->shape().num_elements();
+      if (tcp_allreduce) {
+        // The ring only reduces in place.
+        if (sendbuf != MPI_IN_PLACE) {
+          std::memcpy((void*)e.output->data(), sendbuf,
+                      (size_t)e.tensor->size());
+        }
+        ACTIVITY_START_ALL(entries, timeline, TCP_ALLREDUCE)
+        status = TcpAllreduce(e.tensor->dtype(), GetMPIDataType(e.tensor),
+                              (void*)e.output->data(), num_elements);
+        if (!status.ok()) {
+          OP_ERROR(entries, status.reason())
+        }
+      } else {
+        ACTIVITY_START_ALL(entries, timeline, MPI_ALLREDUCE)
+        MPI_CHECK(entries, "MPI_Allreduce",
+                  MPI_Allreduce(sendbuf, (void*)e.output->data(),
+                                (int)num_elements, GetMPIDataType(e.tensor),
+                                GetMPISumOp(e.tensor->dtype()), reduce_comm))
+      }
+      ACTIVITY_END_ALL(entries, timeline)
+
+      if (e.postscale_factor != 1.0) {
+        status = scale(e.output->data(), e.postscale_factor);
+        if (!status.ok()) {
+          OP_ERROR(entries, status.reason())
+        }
+      }
+    }
+
+    CompleteEntries(entries, Status::OK());
+  } else if (response.response_type() == MPIResponse::BROADCAST) {
+    auto& first_entry = entries[0];
+    bool is_root = horovod_global.rank == first_entry.root_rank;
+
+    // The root rank sends the data of its input tensors, which isn't copied
+    // to its outputs, and the other ranks receive it into their outputs.
+    // Fused tensors are packed into the fusion buffer on the root rank and
+    // unpacked from it on the other ranks.
+    auto data_ptr = [is_root](const TensorTableEntry& e) {
+      return is_root ? (void*)e.tensor->data() : (void*)e.output->data();
+    };
+    int64_t total_size = 0;
+    for (auto& e : entries) {
+      total_size += e.tensor->size();
+    }
+
+#if HOROVOD_GPU_BROADCAST == 'N'
+    if (first_entry.device != CPU_DEVICE_ID) {
+      CUDA_CHECK(entries, "cudaSetDevice", cudaSetDevice(first_entry.device))
+      int lane = horovod_global.next_nccl_stream;
+      horovod_global.next_nccl_stream =
+          (lane + 1) % horovod_global.num_nccl_streams;
+      cudaStream_t& stream =
+          horovod_global.streams[std::make_tuple(first_entry.device, lane)];
+      if (stream == nullptr) {
+        CUDA_CHECK(entries, "CreatePriorityStream",
+                   CreatePriorityStream(&stream))
+      }
+      auto event_queue = std::queue<ActivityEvent>();
+
+      ncclComm_t nccl_comm;
+      status = GetNCCLComm(entries, response.devices(), lane, GLOBAL_SCOPE,
+                           &nccl_comm);
+      if (!status.ok()) {
+        OP_ERROR(entries, status.reason())
+      }
+
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, QUEUE, stream)
+      }
+      CUDA_CHECK(entries, "WaitForReadyEvents",
+                 WaitForReadyEvents(entries, stream))
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, WAIT_FOR_DATA, stream)
+      }
+
+      // Data is broadcast as bytes, so that tensors of every type can be
+      // broadcast.
+      if (use_fusion_buffer) {
+        auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+            first_entry.device, first_entry.context->framework());
+        auto buffer_data = (uint8_t*)buffer->AccessData(first_entry.context);
+
+        // Wait until the last operation using this buffer has unpacked it.
+        auto free_event =
+            horovod_global.fusion_buffer_free_events.find(buffer_data);
+        if (free_event != horovod_global.fusion_buffer_free_events.end()) {
+          CUDA_CHECK(entries, "cudaStreamWaitEvent",
+                     cudaStreamWaitEvent(stream, free_event->second, 0))
+          CUDA_CHECK(entries, "ReleaseCudaEvent",
+                     ReleaseCudaEvent(free_event->second))
+          horovod_global.fusion_buffer_free_events.erase(free_event);
+        }
+
+        if (is_root) {
+          int64_t offset = 0;
+          std::vector<BatchedMemcpyDesc> copies;
+          for (auto& e : entries) {
+            copies.push_back(
+                {e.tensor->data(), buffer_data + offset, e.tensor->size()});
+            offset += e.tensor->size();
+          }
+          CUDA_CHECK(entries, "BatchedMemcpyAsync",
+                     BatchedMemcpyAsync(copies, stream))
+          if (timeline.Initialized()) {
+            RECORD_EVENT(entries, event_queue, MEMCPY_IN_FUSION_BUFFER,
+                         stream)
+          }
+        }
+
+        NCCL_CHECK(entries, "ncclBroadcast",
+                   ncclBroadcast(buffer_data, buffer_data, (size_t)total_size,
+                                 ncclUint8, first_entry.root_rank, nccl_comm,
+                                 stream))
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, NCCL_BCAST, stream)
+        }
+
+        if (!is_root) {
+          int64_t offset = 0;
+          std::vector<BatchedMemcpyDesc> copies;
+          for (auto& e : entries) {
+            copies.push_back({buffer_data + offset, (void*)e.output->data(),
+                              e.tensor->size()});
+            offset += e.tensor->size();
+          }
+          CUDA_CHECK(entries, "BatchedMemcpyAsync",
+                     BatchedMemcpyAsync(copies, stream))
+          if (timeline.Initialized()) {
+            RECORD_EVENT(entries, event_queue, MEMCPY_OUT_FUSION_BUFFER,
+                         stream)
+          }
+        }
+
+        if (horovod_global.fusion_buffer.NumBuffers() > 1 ||
+            horovod_global.num_nccl_streams > 1) {
+          // Let the next operation using this buffer know when it's free.
+          cudaEvent_t buffer_free_event;
+          CUDA_CHECK(entries, "GetCudaEvent", GetCudaEvent(&buffer_free_event))
+          CUDA_CHECK(entries, "cudaEventRecord",
+                     cudaEventRecord(buffer_free_event, stream))
+          horovod_global.fusion_buffer_free_events[buffer_data] =
+              buffer_free_event;
+        }
+      } else {
+        auto data = data_ptr(first_entry);
+        NCCL_CHECK(entries, "ncclBroadcast",
+                   ncclBroadcast(data, data, (size_t)total_size, ncclUint8,
+                                 first_entry.root_rank, nccl_comm, stream))
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, NCCL_BCAST, stream)
+        }
+      }
+
+      RECORD_EVENT(entries, event_queue, "", stream)
+      CompleteEntries(entries, first_entry.device, event_queue);
+      return;
+    }
+#endif
+
+    if (use_fusion_buffer) {
+      auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+          first_entry.device, first_entry.context->framework());
+      auto buffer_data = (uint8_t*)buffer->AccessData(first_entry.context);
+
+      if (is_root) {
+        ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_FUSION_BUFFER)
+        int64_t offset = 0;
+        for (auto& e : entries) {
+          std::memcpy(buffer_data + offset, e.tensor->data(),
+                      (size_t)e.tensor->size());
+          offset += e.tensor->size();
+        }
+        ACTIVITY_END_ALL(entries, timeline)
+      }
+
+      ACTIVITY_START_ALL(entries, timeline, MPI_BCAST)
+      MPI_CHECK(entries, "MPI_Bcast",
+                MPI_Bcast((void*)buffer_data, (int)total_size, MPI_BYTE,
+                          first_entry.root_rank, horovod_global.mpi_comm))
+      ACTIVITY_END_ALL(entries, timeline)
+
+      if (!is_root) {
+        ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_FUSION_BUFFER)
+        int64_t offset = 0;
+        for (auto& e : entries) {
+          std::memcpy((void*)e.output->data(), buffer_data + offset,
+                      (size_t)e.tensor->size());
+          offset += e.tensor->size();
+        }
+        ACTIVITY_END_ALL(entries, timeline)
+      }
+    } else if (first_entry.tensor->size() >
+                   horovod_global.broadcast_pipeline_threshold ||
+               first_entry.tensor->shape().num_elements() > INT_MAX) {
+      // Large tensors are pipelined down a chain of ranks, which also
+      // handles more elements than an MPI count can hold.
+      auto& e = first_entry;
+      ACTIVITY_START_ALL(entries, timeline, MPI_BCAST)
+      MPI_CHECK(entries, "PipelinedBroadcast",
+                PipelinedBroadcast(data_ptr(e), e.tensor->size(), e.root_rank,
+                                   horovod_global.mpi_comm,
+                                   horovod_global.broadcast_chunk_size))
+      ACTIVITY_END_ALL(entries, timeline)
+    } else {
+      auto& e = first_entry;
+      ACTIVITY_START_ALL(entries, timeline, MPI_BCAST)
+      MPI_CHECK(entries, "MPI_Bcast",
+                MPI_Bcast(data_ptr(e), (int)e.tensor->shape().num_elements(),
+                          GetMPIDataType(e.tensor), e.root_rank,
+                          horovod_global.mpi_comm))
+      ACTIVITY_END_ALL(entries, timeline)
+    }
+
+    CompleteEntries(entries, Status::OK());
+  } else if (response.response_type() == MPIResponse::SPARSE_ALLREDUCE) {
+    // The indices and rows of every rank are gathered in a single allgather,
+    // the block of every rank holding its indices followed by its rows.
+    assert(entries.size() == 1);
+    auto& e = entries[0];
+    assert(e.device == CPU_DEVICE_ID);
+
+    TensorShape row_shape;
+    for (int i = 1; i < e.tensor->shape().dims(); ++i) {
+      row_shape.AddDim(e.tensor->shape().dim_size(i));
+    }
+    int element_size;
+    MPI_Type_size(GetMPIDataType(e.tensor), &element_size);
+    int64_t row_size = row_shape.num_elements() * element_size;
+    int64_t block_row_size = (int64_t)sizeof(int64_t) + row_size;
+
+    std::vector<int> recvcounts(horovod_global.size);
+    std::vector<int> displcmnts(horovod_global.size);
+    int64_t total_rows = 0;
+    for (int rc = 0; rc < horovod_global.size; ++rc) {
+      auto num_rows = response.tensor_sizes()[rc];
+      recvcounts[rc] = (int)(num_rows * block_row_size);
+      displcmnts[rc] = (int)(total_rows * block_row_size);
+      total_rows += num_rows;
+    }
+
+    auto& buffer = horovod_global.sparse_buffer;
+    buffer.resize((size_t)(total_rows * block_row_size));
+
+    ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_SPARSE_BUFFER)
+    int64_t num_rows = e.tensor->shape().dim_size(0);
+    uint8_t* block = buffer.data() + displcmnts[horovod_global.rank];
+    std::memcpy(block, e.indices->data(),
+                (size_t)(num_rows * sizeof(int64_t)));
+    std::memcpy(block + num_rows * sizeof(int64_t), e.tensor->data(),
+                (size_t)(num_rows * row_size));
+    ACTIVITY_END_ALL(entries, timeline)
+
+    ACTIVITY_START_ALL(entries, timeline, MPI_ALLGATHER)
+    MPI_CHECK(entries, "MPI_Allgatherv",
+              MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                             (void*)buffer.data(), recvcounts.data(),
+                             displcmnts.data(), MPI_BYTE,
+                             horovod_global.mpi_comm))
+    ACTIVITY_END_ALL(entries, timeline)
+
+    // Find the output row of every gathered row. Rows with the same index
+    // share an output row if they are deduplicated, in the order in which
+    // their indices first occur.
+    std::vector<int64_t> output_rows((size_t)total_rows);
+    std::vector<int64_t> output_indices;
+    std::unordered_map<int64_t, int64_t> index_rows;
+    int64_t row = 0;
+    for (int rc = 0; rc < horovod_global.size; ++rc) {
+      auto* indices = (const int64_t*)(buffer.data() + displcmnts[rc]);
+      for (int64_t i = 0; i < response.tensor_sizes()[rc]; ++i, ++row) {
+        if (e.deduplicate) {
+          auto result = index_rows.emplace(indices[i], output_indices.size());
+          if (result.second) {
+            output_indices.push_back(indices[i]);
+          }
+          output_rows[row] = result.first->second;
+        } else {
+          output_rows[row] = row;
+          output_indices.push_back(indices[i]);
+        }
+      }
+    }
+
+    ACTIVITY_START_ALL(entries, timeline, ALLOCATE_OUTPUT)
+    TensorShape output_shape;
+    output_shape.AddDim((int64_t)output_indices.size());
+    output_shape.AppendShape(row_shape);
+    status = e.context->AllocateOutput(0, output_shape, &e.output);
+    if (status.ok()) {
+      TensorShape indices_shape;
+      indices_shape.AddDim((int64_t)output_indices.size());
+      status = e.context->AllocateOutput(1, indices_shape, &e.output_indices);
+    }
+    ACTIVITY_END_ALL(entries, timeline)
+    if (!status.ok()) {
+      CompleteEntries(entries, status);
+      return;
+    }
+
+    ACTIVITY_START_ALL(entries, timeline, MERGE_SPARSE_ROWS)
+    std::memcpy((void*)e.output_indices->data(), output_indices.data(),
+                output_indices.size() * sizeof(int64_t));
+    auto* output = (uint8_t*)e.output->data();
+    if (e.deduplicate) {
+      std::memset(output, 0, (size_t)(output_indices.size() * row_size));
+    }
+    row = 0;
+    for (int rc = 0; rc < horovod_global.size; ++rc) {
+      auto num_rank_rows = response.tensor_sizes()[rc];
+      const uint8_t* rows =
+          buffer.data() + displcmnts[rc] + num_rank_rows * sizeof(int64_t);
+      if (!e.deduplicate) {
+        std::memcpy(output + row * row_size, rows,
+                    (size_t)(num_rank_rows * row_size));
+        row += num_rank_rows;
+        continue;
+      }
+      for (int64_t i = 0; i < num_rank_rows; ++i, ++row) {
+        AccumulateValues(e.tensor->dtype(), rows + i * row_size,
+                         output + output_rows[row] * row_size,
+                         row_shape.num_elements());
+      }
+    }
+    ACTIVITY_END_ALL(entries, timeline)
+
+    CompleteEntries(entries, Status::OK());
+  } else if (response.response_type() == MPIResponse::REDUCESCATTER) {
+    auto& first_entry = entries[0];
+    int element_size;
+    MPI_Type_size(GetMPIDataType(first_entry.tensor), &element_size);
+
+    // Number of elements of every entry that every rank receives, and their
+    // sums over all entries. Fused tensors are packed into the fusion buffer
+    // by rank, so that the data of every rank is contiguous.
+    std::vector<std::vector<int64_t>> entry_counts(entries.size());
+    std::vector<int> recvcounts(horovod_global.size);
+    ACTIVITY_START_ALL(entries, timeline, ALLOCATE_OUTPUT)
+    for (size_t ec = 0; ec < entries.size(); ++ec) {
+      auto& e = entries[ec];
+      TensorShape row_shape;
+      for (int i = 1; i < e.tensor->shape().dims(); ++i) {
+        row_shape.AddDim(e.tensor->shape().dim_size(i));
+      }
+      int64_t num_rows = e.tensor->shape().dim_size(0);
+      entry_counts[ec].resize(horovod_global.size);
+      for (int rc = 0; rc < horovod_global.size; ++rc) {
+        entry_counts[ec][rc] =
+            ReducescatterRows(num_rows, rc, horovod_global.size) *
+            row_shape.num_elements();
+        recvcounts[rc] += (int)entry_counts[ec][rc];
+      }
+
+      TensorShape output_shape;
+      output_shape.AddDim(
+          ReducescatterRows(num_rows, horovod_global.rank, horovod_global.size));
+      output_shape.AppendShape(row_shape);
+      status = e.context->AllocateOutput(output_shape, &e.output);
+      if (!status.ok()) {
+        break;
+      }
+    }
+    ACTIVITY_END_ALL(entries, timeline)
+    if (!status.ok()) {
+      CompleteEntries(entries, status);
+      return;
+    }
+
+    std::vector<int> displcmnts(horovod_global.size);
+    for (int rc = 1; rc < horovod_global.size; ++rc) {
+      displcmnts[rc] = displcmnts[rc - 1] + recvcounts[rc - 1];
+    }
+    // Returns the offset of the data of a rank in the input of an entry.
+    auto input_offset = [&entry_counts](size_t ec, int rank) {
+      int64_t offset = 0;
+      for (int rc = 0; rc < rank; ++rc) {
+        offset += entry_counts[ec][rc];
+      }
+      return offset;
+    };
+
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+    if (first_entry.device != CPU_DEVICE_ID) {
+      CUDA_CHECK(entries, "cudaSetDevice", cudaSetDevice(first_entry.device))
+      int lane = horovod_global.next_nccl_stream;
+      horovod_global.next_nccl_stream =
+          (lane + 1) % horovod_global.num_nccl_streams;
+      cudaStream_t& stream =
+          horovod_global.streams[std::make_tuple(first_entry.device, lane)];
+      if (stream == nullptr) {
+        CUDA_CHECK(entries, "CreatePriorityStream",
+                   CreatePriorityStream(&stream))
+      }
+      auto event_queue = std::queue<ActivityEvent>();
+
+      ncclDataType_t nccl_data_type;
+      try {
+        nccl_data_type = GetNCCLDataType(first_entry.tensor);
+      } catch (const std::logic_error& ex) {
+        OP_ERROR(entries, ex.what())
+      }
+      ncclComm_t nccl_comm;
+      status = GetNCCLComm(entries, response.devices(), lane, GLOBAL_SCOPE,
+                           &nccl_comm);
+      if (!status.ok()) {
+        OP_ERROR(entries, status.reason())
+      }
+
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, QUEUE, stream)
+      }
+      CUDA_CHECK(entries, "WaitForReadyEvents",
+                 WaitForReadyEvents(entries, stream))
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, WAIT_FOR_DATA, stream)
+      }
+
+      // ncclReduceScatter needs the same number of elements for every rank,
+      // otherwise the data of every rank is reduced to it separately.
+      bool even_split = true;
+      for (auto count : recvcounts) {
+        even_split = even_split && count == recvcounts[0];
+      }
+      if (use_fusion_buffer) {
+        auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+            first_entry.device, first_entry.context->framework());
+        auto buffer_data = (uint8_t*)buffer->AccessData(first_entry.context);
+
+        // Wait until the last operation using this buffer has unpacked it.
+        auto free_event =
+            horovod_global.fusion_buffer_free_events.find(buffer_data);
+        if (free_event != horovod_global.fusion_buffer_free_events.end()) {
+          CUDA_CHECK(entries, "cudaStreamWaitEvent",
+                     cudaStreamWaitEvent(stream, free_event->second, 0))
+          CUDA_CHECK(entries, "ReleaseCudaEvent",
+                     ReleaseCudaEvent(free_event->second))
+          horovod_global.fusion_buffer_free_events.erase(free_event);
+        }
+
+        int64_t offset = 0;
+        std::vector<BatchedMemcpyDesc> copies;
+        for (int rc = 0; rc < horovod_global.size; ++rc) {
+          for (size_t ec = 0; ec < entries.size(); ++ec) {
+            if (entry_counts[ec][rc] > 0) {
+              copies.push_back({(uint8_t*)entries[ec].tensor->data() +
+                                    input_offset(ec, rc) * element_size,
+                                buffer_data + offset * element_size,
+                                entry_counts[ec][rc] * element_size});
+            }
+            offset += entry_counts[ec][rc];
+          }
+        }
+        CUDA_CHECK(entries, "BatchedMemcpyAsync",
+                   BatchedMemcpyAsync(copies, stream))
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, MEMCPY_IN_FUSION_BUFFER, stream)
+        }
+
+        // The data of this rank is reduced in place.
+        auto rank_data =
+            buffer_data + displcmnts[horovod_global.rank] * element_size;
+        if (even_split) {
+          NCCL_CHECK(entries, "ncclReduceScatter",
+                     ncclReduceScatter(buffer_data, rank_data,
+                                       (size_t)recvcounts[0], nccl_data_type,
+                                       ncclSum, nccl_comm, stream))
+        } else {
+          NCCL_CHECK(entries, "ncclGroupStart", ncclGroupStart())
+          for (int rc = 0; rc < horovod_global.size; ++rc) {
+            auto data = buffer_data + displcmnts[rc] * element_size;
+            NCCL_CHECK(entries, "ncclReduce",
+                       ncclReduce(data, data, (size_t)recvcounts[rc],
+                                  nccl_data_type, ncclSum, rc, nccl_comm,
+                                  stream))
+          }
+          NCCL_CHECK(entries, "ncclGroupEnd", ncclGroupEnd())
+        }
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, NCCL_REDUCESCATTER, stream)
+        }
+
+        offset = 0;
+        copies.clear();
+        for (size_t ec = 0; ec < entries.size(); ++ec) {
+          auto count = entry_counts[ec][horovod_global.rank];
+          copies.push_back({rank_data + offset * element_size,
+                            (void*)entries[ec].output->data(),
+                            count * element_size});
+          offset += count;
+        }
+        CUDA_CHECK(entries, "BatchedMemcpyAsync",
+                   BatchedMemcpyAsync(copies, stream))
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, MEMCPY_OUT_FUSION_BUFFER, stream)
         }
-        horovod_global.shared_buffer_size = total_size_in_bytes;
-        ACTIVITY_END_ALL(entries, timeline)
-      }
-
-      // Compute cross-node allgather displacements and recvcounts for
-      // homogeneous/parallelized case
-      auto* cross_recvcounts = new int[horovod_global.cross_size]();
-      auto* cross_displcmnts = new int[horovod_global.cross_size]();
 
-      if (horovod_global.is_homogeneous) {
-        for (int i = 0; i < horovod_global.cross_size; ++i) {
-          cross_recvcounts[i] = recvcounts[horovod_global.local_size * i +
-                                           horovod_global.local_rank];
-          cross_displcmnts[i] = displcmnts[horovod_global.local_size * i +
-                                           horovod_global.local_rank];
+        if (horovod_global.fusion_buffer.NumBuffers() > 1 ||
+            horovod_global.num_nccl_streams > 1) {
+          // Let the next operation using this buffer know when it's free.
+          cudaEvent_t buffer_free_event;
+          CUDA_CHECK(entries, "GetCudaEvent", GetCudaEvent(&buffer_free_event))
+          CUDA_CHECK(entries, "cudaEventRecord",
+                     cudaEventRecord(buffer_free_event, stream))
+          horovod_global.fusion_buffer_free_events[buffer_data] =
+              buffer_free_event;
         }
-      } else if (horovod_global.local_rank == 0) {
-        // In this case local rank 0 will allgather with all local data
-        int offset = 0;
-        for (int i = 0; i < horovod_global.cross_size; ++i) {
-          for (int j = offset; j < offset + horovod_global.local_sizes[i];
-               ++j) {
-            cross_recvcounts[i] += recvcounts[j];
+      } else {
+        auto& e = first_entry;
+        if (even_split) {
+          NCCL_CHECK(entries, "ncclReduceScatter",
+                     ncclReduceScatter(e.tensor->data(), (void*)e.output->data(),
+                                       (size_t)recvcounts[0], nccl_data_type,
+                                       ncclSum, nccl_comm, stream))
+        } else {
+          NCCL_CHECK(entries, "ncclGroupStart", ncclGroupStart())
+          for (int rc = 0; rc < horovod_global.size; ++rc) {
+            NCCL_CHECK(entries, "ncclReduce",
+                       ncclReduce((uint8_t*)e.tensor->data() +
+                                      displcmnts[rc] * element_size,
+                                  (void*)e.output->data(),
+                                  (size_t)recvcounts[rc], nccl_data_type,
+                                  ncclSum, rc, nccl_comm, stream))
           }
-          cross_displcmnts[i] = displcmnts[offset];
-          offset += horovod_global.local_sizes[i];
+          NCCL_CHECK(entries, "ncclGroupEnd", ncclGroupEnd())
+        }
+        if (timeline.Initialized()) {
+          RECORD_EVENT(entries, event_queue, NCCL_REDUCESCATTER, stream)
         }
       }
 
-      ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_SHARED_BUFFER)
-      for (size_t ec = 0; ec < entries.size(); ++ec) {
-        auto& e = entries[ec];
-        void* shared_buffer_at_offset =
-            (uint8_t*)horovod_global.shared_buffer +
-            entry_component_offsets[ec][horovod_global.rank] * element_size;
+      RECORD_EVENT(entries, event_queue, "", stream)
+      CompleteEntries(entries, first_entry.device, event_queue);
+      return;
+    }
+#endif
 
-        // CPU copy to shared buffer
-        memcpy(shared_buffer_at_offset, e.tensor->data(),
-               (size_t)(entry_component_sizes[ec][horovod_global.rank] *
-                        element_size));
+    auto mpi_op = GetMPISumOp(first_entry.tensor->dtype());
+    if (use_fusion_buffer) {
+      auto& buffer = horovod_global.fusion_buffer.GetBuffer(
+          first_entry.device, first_entry.context->framework());
+      auto buffer_data = (uint8_t*)buffer->AccessData(first_entry.context);
+
+      ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_FUSION_BUFFER)
+      int64_t offset = 0;
+      for (int rc = 0; rc < horovod_global.size; ++rc) {
+        for (size_t ec = 0; ec < entries.size(); ++ec) {
+          std::memcpy(buffer_data + offset * element_size,
+                      (uint8_t*)entries[ec].tensor->data() +
+                          input_offset(ec, rc) * element_size,
+                      (size_t)(entry_counts[ec][rc] * element_size));
+          offset += entry_counts[ec][rc];
+        }
       }
-      MPI_CHECK(entries, "MPI_Barrier", MPI_Barrier(horovod_global.mpi_comm));
       ACTIVITY_END_ALL(entries, timeline)
 
-      // Perform the cross-node allgather. If the cluster is homogeneous all
-      // local ranks participate, otherwise local rank 0 handles all data
-      ACTIVITY_START_ALL(entries, timeline, MPI_CROSS_ALLGATHER)
-      if (horovod_global.is_homogeneous || horovod_global.local_rank == 0) {
-        MPI_CHECK(entries, "MPI_Allgatherv",
-                  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
-                                 horovod_global.shared_buffer, cross_recvcounts,
-                                 cross_displcmnts,
-                                 GetMPIDataType(first_entry.tensor),
-                                 horovod_global.cross_comm))
-      }
-      MPI_CHECK(entries, "MPI_Barrier", MPI_Barrier(horovod_global.mpi_comm));
+      // In place, the data of this rank is reduced to the start of the
+      // buffer.
+      ACTIVITY_START_ALL(entries, timeline, MPI_REDUCESCATTER)
+      MPI_CHECK(entries, "MPI_Reduce_scatter",
+                MPI_Reduce_scatter(MPI_IN_PLACE, (void*)buffer_data,
+                                   recvcounts.data(),
+                                   GetMPIDataType(first_entry.tensor), mpi_op,
+                                   horovod_global.mpi_comm))
       ACTIVITY_END_ALL(entries, timeline)
 
-      // Copy memory out of the fusion buffer.
       ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_FUSION_BUFFER)
+      offset = 0;
       for (size_t ec = 0; ec < entries.size(); ++ec) {
-        auto& e = entries[ec];
-        int64_t copy_offset = 0;
-        for (int rc = 0; rc < horovod_global.size; ++rc) {
-          auto entry_component_size = entry_component_sizes[ec][rc];
-          std::memcpy((void*)((uint8_t*)e.output->data() + copy_offset),
-                      (void*)((uint8_t*)horovod_global.shared_buffer +
-                              entry_component_size * element_size),
-                      (size_t)entry_component_size * element_size);
-          copy_offset += entry_component_size * element_size;
-        }
+        auto count = entry_counts[ec][horovod_global.rank];
+        std::memcpy((void*)entries[ec].output->data(),
+                    buffer_data + offset * element_size,
+                    (size_t)(count * element_size));
+        offset += count;
       }
-      MPI_CHECK(entries, "MPI_Barrier", MPI_Barrier(horovod_global.mpi_comm));
       ACTIVITY_END_ALL(entries, timeline)
+    } else {
+      auto& e = first_entry;
+      ACTIVITY_START_ALL(entries, timeline, MPI_REDUCESCATTER)
+      MPI_CHECK(entries, "MPI_Reduce_scatter",
+                MPI_Reduce_scatter(e.tensor->data(), (void*)e.output->data(),
+                                   recvcounts.data(), GetMPIDataType(e.tensor),
+                                   mpi_op, horovod_global.mpi_comm))
+      ACTIVITY_END_ALL(entries, timeline)
+    }
 
-      // Free the buffers
-      delete[] cross_displcmnts;
-      delete[] cross_recvcounts;
+    CompleteEntries(entries, Status::OK());
+  } else if (response.response_type() == MPIResponse::ALLTOALL) {
+    assert(entries.size() == 1);
+    auto& e = entries[0];
+
+    // Every rank learns how many rows it receives from every other rank.
+    std::vector<int32_t> recv_splits(horovod_global.size);
+    ACTIVITY_START_ALL(entries, timeline, MPI_ALLTOALL)
+    MPI_CHECK(entries, "MPI_Alltoall",
+              MPI_Alltoall(e.splits.data(), 1, MPI_INT32_T, recv_splits.data(),
+                           1, MPI_INT32_T, horovod_global.mpi_comm))
+    ACTIVITY_END_ALL(entries, timeline)
 
-    } else {
-#endif
-      // Data is at the CPU and hierarchical allgather is disabled, or
-      // Data is at the GPU and HOROVOD_GPU_ALLGATHER == MPI
-      if (entries.size() > 1) {
-        auto& buffer = horovod_global.fusion_buffer.GetBuffer(
-            first_entry.device, first_entry.context->framework());
-        auto buffer_data = buffer->AccessData(first_entry.context);
+    TensorShape row_shape;
+    for (int i = 1; i < e.tensor->shape().dims(); ++i) {
+      row_shape.AddDim(e.tensor->shape().dim_size(i));
+    }
+    int64_t row_elements = row_shape.num_elements();
+    std::vector<int> sendcounts(horovod_global.size);
+    std::vector<int> sdispls(horovod_global.size);
+    std::vector<int> recvcounts(horovod_global.size);
+    std::vector<int> rdispls(horovod_global.size);
+    int64_t total_rows = 0;
+    for (int rc = 0; rc < horovod_global.size; ++rc) {
+      sendcounts[rc] = (int)(e.splits[rc] * row_elements);
+      recvcounts[rc] = (int)(recv_splits[rc] * row_elements);
+      if (rc > 0) {
+        sdispls[rc] = sdispls[rc - 1] + sendcounts[rc - 1];
+        rdispls[rc] = rdispls[rc - 1] + recvcounts[rc - 1];
+      }
+      total_rows += recv_splits[rc];
+    }
 
-        int64_t total_num_elements = 0;
+    ACTIVITY_START_ALL(entries, timeline, ALLOCATE_OUTPUT)
+    TensorShape output_shape;
+    output_shape.AddDim(total_rows);
+    output_shape.AppendShape(row_shape);
+    status = e.context->AllocateOutput(output_shape, &e.output);
+    ACTIVITY_END_ALL(entries, timeline)
+    if (!status.ok()) {
+      CompleteEntries(entries, status);
+      return;
+    }
 
-        // Copy memory into the fusion buffer. Then the input data of each
-        // process is assumed to be in the area where that process would
-        // receive its own contribution to the receive buffer.
-        ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_FUSION_BUFFER)
-        int64_t offset = displcmnts[horovod_global.rank] * element_size;
-        for (auto& e : entries) {
-          void* buffer_data_at_offset = (uint8_t*)buffer_data + offset;
-          std::memcpy(buffer_data_at_offset, e.tensor->data(),
-                      (size_t)e.tensor->size());
-          offset += e.tensor->size();
-          total_num_elements += e.tensor->shape().num_elements();
+#if HOROVOD_NCCL_ALLTOALL
+    if (e.device != CPU_DEVICE_ID) {
+      CUDA_CHECK(entries, "cudaSetDevice", cudaSetDevice(e.device))
+      int lane = horovod_global.next_nccl_stream;
+      horovod_global.next_nccl_stream =
+          (lane + 1) % horovod_global.num_nccl_streams;
+      cudaStream_t& stream =
+          horovod_global.streams[std::make_tuple(e.device, lane)];
+      if (stream == nullptr) {
+        CUDA_CHECK(entries, "CreatePriorityStream",
+                   CreatePriorityStream(&stream))
+      }
+      auto event_queue = std::queue<ActivityEvent>();
+
+      ncclComm_t nccl_comm;
+      status = GetNCCLComm(entries, response.devices(), lane, GLOBAL_SCOPE,
+                           &nccl_comm);
+      if (!status.ok()) {
+        OP_ERROR(entries, status.reason())
+      }
+
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, QUEUE, stream)
+      }
+      CUDA_CHECK(entries, "WaitForReadyEvents",
+                 WaitForReadyEvents(entries, stream))
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, WAIT_FOR_DATA, stream)
+      }
+
+      // The data is sent as bytes, so that all data types are supported.
+      int element_size;
+      MPI_Type_size(GetMPIDataType(e.tensor), &element_size);
+      NCCL_CHECK(entries, "ncclGroupStart", ncclGroupStart())
+      for (int rc = 0; rc < horovod_global.size; ++rc) {
+        if (sendcounts[rc] > 0) {
+          NCCL_CHECK(entries, "ncclSend",
+                     ncclSend((uint8_t*)e.tensor->data() +
+                                  (int64_t)sdispls[rc] * element_size,
+                              (size_t)sendcounts[rc] * element_size, ncclUint8,
+                              rc, nccl_comm, stream))
         }
-        ACTIVITY_END_ALL(entries, timeline)
+        if (recvcounts[rc] > 0) {
+          NCCL_CHECK(entries, "ncclRecv",
+                     ncclRecv((uint8_t*)e.output->data() +
+                                  (int64_t)rdispls[rc] * element_size,
+                              (size_t)recvcounts[rc] * element_size, ncclUint8,
+                              rc, nccl_comm, stream))
+        }
+      }
+      NCCL_CHECK(entries, "ncclGroupEnd", ncclGroupEnd())
+      if (timeline.Initialized()) {
+        RECORD_EVENT(entries, event_queue, NCCL_ALLTOALL, stream)
+      }
 
-        ACTIVITY_START_ALL(entries, timeline, MPI_ALLGATHER)
-        MPI_CHECK(entries, "MPI_Allgatherv",
-                  MPI_Allgatherv(MPI_IN_PLACE, (int)total_num_elements,
-                                 GetMPIDataType(first_entry.tensor),
-                                 (void*)buffer_data, recvcounts, displcmnts,
-                                 GetMPIDataType(first_entry.tensor),
-                                 horovod_global.mpi_comm))
-        ACTIVITY_END_ALL(entries, timeline)
+      RECORD_EVENT(entries, event_queue, "", stream)
+      CompleteEntries(entries, e.device, event_queue);
+      return;
+    }
+#endif
 
-        ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_FUSION_BUFFER)
-        // Copy memory out of the fusion buffer.
-        for (size_t ec = 0; ec < entries.size(); ++ec) {
-          auto& e = entries[ec];
-          int64_t copy_offset = 0;
-          for (int rc = 0; rc < horovod_global.size; ++rc) {
-            std::memcpy((void*)((uint8_t*)e.output->data() + copy_offset),
-                        (void*)((uint8_t*)buffer_data +
-                                entry_component_offsets[ec][rc] * element_size),
-                        (size_t)entry_component_sizes[ec][rc] * element_size);
+    ACTIVITY_START_ALL(entries, timeline, MPI_ALLTOALLV)
+    MPI_CHECK(entries, "MPI_Alltoallv",
+              MPI_Alltoallv(e.tensor->data(), sendcounts.data(), sdispls.data(),
+                            GetMPIDataType(e.tensor), (void*)e.output->data(),
+                            recvcounts.data(), rdispls.data(),
+                            GetMPIDataType(e.tensor), horovod_global.mpi_comm))
+    ACTIVITY_END_ALL(entries, timeline)
+
+    CompleteEntries(entries, Status::OK());
+  } else if (response.response_type() == MPIResponse::ERROR) {
+    assert(entries.size() == 1);
+
+    status = Status::PreconditionError(response.error_message());
+    CompleteEntries(entries, status);
+  }
+}
+
+// Report Tensors that were submitted to be reduced, gathered or broadcasted by
+// some ranks but not others and are waiting for long time to get processed.
+// Only requests from the given ranks are expected in the message table.
+// Logs the ranks which were the furthest behind the first rank to request the
+// same tensors.
+void LogStragglers(const StragglerMetrics& stragglers) {
+  std::stringstream message;
+  for (int rank : stragglers.SlowestRanks(STRAGGLER_LOG_RANKS)) {
+    message << (message.tellp() > 0 ? ", " : "") << "rank " << rank << " ("
+            << stragglers.step_lag_percentile(rank, 0.5) << " us median, "
+            << stragglers.step_lag_percentile(rank, 0.99) << " us p99)";
+  }
+  if (message.tellp() > 0) {
+    LOG(INFO) << "Slowest ranks by lag per step: " << message.str();
+  }
+}
+
+void CheckForStalledTensors(const MessageTable& message_table,
+                            const std::vector<int>& ranks) {
+  bool preamble = false;
+  auto now = std::chrono::steady_clock::now();
+  for (auto& m : message_table) {
+    auto tensor_name = m.first;
+    const std::vector<MPIRequest>& messages = std::get<0>(m.second);
+    std::chrono::steady_clock::time_point start_at = std::get<1>(m.second);
+
+    if (now - start_at > STALL_WARNING_TIME) {
+      std::stringstream message;
+      if (!preamble) {
+       message << "One or more tensors were submitted to be "
+                  "reduced, gathered or broadcasted by subset of ranks and "
+                  "are waiting for remainder of ranks for more than "
+               << std::chrono::duration_cast<std::chrono::seconds>(
+                   STALL_WARNING_TIME)
+                   .count()
+               << " seconds. "
+               << "This may indicate that different ranks are trying to "
+                  "submit different tensors or that only subset of ranks is "
+                  "submitting tensors, which will cause deadlock. "
+               << std::endl << "Stalled ops:" ;
+        preamble = true;
+      }
+      message << tensor_name;
+      message << " [missing ranks:";
+      std::unordered_set<int32_t> ready_ranks;
+      bool missing_preamble = false;
+      for (auto msg_iter = messages.begin(); msg_iter != messages.end();
+           ++msg_iter) {
+        ready_ranks.insert(msg_iter->request_rank());
+      }
+      for (int32_t rank : ranks) {
+        if (ready_ranks.find(rank) == ready_ranks.end()) {
+          if (!missing_preamble) {
+            message << " ";
+            missing_preamble = true;
+          } else {
+            message << ", ";
+          }
+          message << rank;
+        }
+      }
+      message << "]";
+      LOG(WARNING) << message.str();
+    }
+  }
+}
+
+// The MPI background thread loop coordinates all the MPI processes and the
+// tensor reductions. The design of the communicator mechanism is limited by a
+// few considerations:
+//
+//      1. Some MPI implementations require all MPI calls to happen from a
+//      single thread. Since TensorFlow may use several threads for graph
+//      processing, this means we must have our own dedicated thread for dealing
+//      with MPI.
+//      2. We want to gracefully handle errors, when MPI processes do not
+//      properly agree upon what should happen (such as mismatched types or
+//      shapes). To do so requires the MPI processes to know about the shapes
+//      and types of the relevant tensors on the other processes.
+//      3. The MPI reductions and gathers should be able to happen in parallel
+//      with other ongoing operations. This means that they cannot be blocking
+//      ops, but rather must be async ops, the execution of which happens on a
+//      separate thread.
+//      4. We cannot guarantee that all the MPI processes reduce their tensors
+//      in the same order, so we cannot dispatch one thread per tensor,
+//      otherwise we may end up dispatching many blocked threads and never make
+//      progress if we have a thread pool limit.
+bool RunLoopOnce(HorovodGlobalState& state, bool is_coordinator);
+void BackgroundThreadLoop(HorovodGlobalState& state) {
+  // Initialize MPI if it was not initialized. This must happen on the
+  // background thread, since not all MPI implementations support being called
+  // from multiple threads.
+  //
+  // In some cases MPI library has multi-threading support, but it slows down
+  // certain components, e.g. OpenIB BTL in OpenMPI gets disabled if
+  // MPI_THREAD_MULTIPLE is requested.
+  //
+  // By default, we will ask for multiple threads, so other libraries like
+  // mpi4py can be used together with Horovod if multi-threaded MPI is
+  // installed.
+  auto mpi_threads_disable = std::getenv(HOROVOD_MPI_THREADS_DISABLE);
+  int required = MPI_THREAD_MULTIPLE;
+  if (mpi_threads_disable != nullptr &&
+      std::strtol(mpi_threads_disable, nullptr, 10) > 0) {
+    required = MPI_THREAD_SINGLE;
+  }
+  int provided;
+  int is_mpi_initialized = 0;
+  MPI_Initialized(&is_mpi_initialized);
+  if (is_mpi_initialized) {
+    MPI_Query_thread(&provided);
+    if (provided < MPI_THREAD_MULTIPLE) {
+      LOG(WARNING) << "MPI has already been initialized without "
+                      "multi-threading support (MPI_THREAD_MULTIPLE). This will "
+                      "likely cause a segmentation fault.";
+    }
+  } else {
+    MPI_Init_thread(NULL, NULL, required, &provided);
+    state.should_finalize = true;
+  }
 
-            copy_offset += entry_component_sizes[ec][rc] * element_size;
-          }
-        }
-        ACTIVITY_END_ALL(entries, timeline)
+  if (state.ranks.size() > 0) {
+    MPI_Group world_group;
+    MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+    MPI_Group work_group;
+    MPI_Group_incl(world_group, state.ranks.size(), &(state.ranks[0]),
+                   &work_group);
+    MPI_Comm_create_group(MPI_COMM_WORLD, work_group, 0, &(state.mpi_comm));
+    if (state.mpi_comm == MPI_COMM_NULL) {
+      LOG(WARNING) << "Unable to create Horovod communicator, using "
+                      "MPI_COMM_WORLD instead.";
+      state.mpi_comm = MPI_COMM_WORLD;
+    }
+    MPI_Group_free(&world_group);
+    MPI_Group_free(&work_group);
+  } else if (!state.mpi_comm) {
+    // No ranks were given and no communicator provided to horovod_init() so use
+    // MPI_COMM_WORLD
+    MPI_Comm_dup(MPI_COMM_WORLD, &(horovod_global.mpi_comm));
+  }
 
-      } else if (entries.size() == 1) {
-        ACTIVITY_START_ALL(entries, timeline, MPI_ALLGATHER)
-        MPI_CHECK(
-            entries, "MPI_Allgatherv",
-            MPI_Allgatherv(first_entry.tensor->data(),
-                           (int)first_entry.tensor->shape().num_elements(),
-                           GetMPIDataType(first_entry.tensor),
-                           (void*)first_entry.output->data(), recvcounts,
-                           displcmnts, GetMPIDataType(first_entry.tensor),
-                           horovod_global.mpi_comm))
-        ACTIVITY_END_ALL(entries, timeline)
-      }
+  // Get MPI rank to determine if we are rank zero.
+  int rank;
+  MPI_Comm_rank(state.mpi_comm, &rank);
+  bool is_coordinator = rank == 0;
 
-      delete[] recvcounts;
-      delete[] displcmnts;
+  // Get MPI size to determine how many tensors to wait for before reducing.
+  int size;
+  MPI_Comm_size(state.mpi_comm, &size);
+  if (is_coordinator) {
+    LOG(INFO) << "Started Horovod with " << size << " processes";
+  }
 
-      for (size_t ec = 0; ec < entries.size(); ++ec) {
-        delete[] entry_component_sizes[ec];
-        delete[] entry_component_offsets[ec];
-      }
-      delete[] entry_component_sizes;
-      delete[] entry_component_offsets;
+  // Determine local rank by querying the local communicator.
+  MPI_Comm local_comm;
+  MPI_Comm_split_type(state.mpi_comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
+                      &local_comm);
+  int local_rank, local_size;
+  MPI_Comm_rank(local_comm, &local_rank);
+  MPI_Comm_size(local_comm, &local_size);
+  std::vector<int> local_comm_ranks((size_t)local_size);
+  local_comm_ranks[local_rank] = rank;
+  MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, local_comm_ranks.data(), 1,
+                MPI_INT, local_comm);
 
-#if HOROVOD_GPU_ALLGATHER != 'M' // 'M' stands for MPI
-    }
-#endif
+  // Determine if cluster is homogeneous, i.e., if every node has the same
+  // local_size
+  auto local_sizes = new int[size];
+  MPI_Allgather(&local_size, 1, MPI_INT, local_sizes, 1, MPI_INT,
+                state.mpi_comm);
 
-    for (auto& e : entries) {
-      timeline.End(e.tensor_name, e.output);
-      e.callback(Status::OK());
+  bool is_homogeneous = true;
+  for (int i = 0; i < size; ++i) {
+    if (local_sizes[i] != local_size) {
+      is_homogeneous = false;
+      break;
     }
+  }
+  for (int i = 0; i < size; i += local_sizes[i]) {
+    state.local_sizes.push_back(local_sizes[i]);
+  }
 
-  } else if (response.response_type() == MPIResponse::ALLREDUCE) {
-    auto& first_entry = entries[0];
-#if HAVE_CUDA
-    bool on_gpu = first_entry.device != CPU_DEVICE_ID;
-    if (on_gpu) {
-      CUDA_CHECK(entries, "cudaSetDevice", cudaSetDevice(first_entry.device))
+  delete[] local_sizes;
+  state.is_homogeneous = is_homogeneous;
 
-      // Ensure stream is in the map before executing reduction.
-      cudaStream_t& stream = horovod_global.streams[first_entry.device];
-      if (stream == nullptr) {
-        int greatest_priority;
-        CUDA_CHECK(entries, "cudaDeviceGetStreamPriorityRange",
-                   cudaDeviceGetStreamPriorityRange(NULL, &greatest_priority))
-        CUDA_CHECK(entries, "cudaStreamCreateWithPriority",
-                   cudaStreamCreateWithPriority(&stream, cudaStreamNonBlocking,
-                                                greatest_priority))
+  // Set up cross-communicator in case of hierarchical allreduce.
+  MPI_Comm cross_comm;
+  MPI_Comm_split(state.mpi_comm, local_rank, rank, &cross_comm);
+  int cross_rank, cross_size;
+  MPI_Comm_rank(cross_comm, &cross_rank);
+  MPI_Comm_size(cross_comm, &cross_size);
+  std::vector<int> cross_comm_ranks((size_t)cross_size);
+  cross_comm_ranks[cross_rank] = rank;
+  MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, cross_comm_ranks.data(), 1,
+                MPI_INT, cross_comm);
+
+  // Cross ranks identify the nodes if all processes of a node agree on it.
+  state.node_ranks.clear();
+  if (is_homogeneous) {
+    int node_bounds[2] = {-cross_rank, cross_rank};
+    MPI_Allreduce(MPI_IN_PLACE, node_bounds, 2, MPI_INT, MPI_MIN, local_comm);
+    int consistent = -node_bounds[0] == node_bounds[1] ? 1 : 0;
+    MPI_Allreduce(MPI_IN_PLACE, &consistent, 1, MPI_INT, MPI_MIN,
+                  state.mpi_comm);
+    if (consistent) {
+      std::vector<int> positions((size_t)size);
+      positions[rank] = cross_rank * local_size + local_rank;
+      MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, positions.data(), 1,
+                    MPI_INT, state.mpi_comm);
+      state.node_ranks.resize((size_t)size);
+      for (int i = 0; i < size; ++i) {
+        state.node_ranks[positions[i]] = i;
       }
     }
-#endif
-
-// 'N' stands for NCCL and 'D' for DDL
-#if HOROVOD_GPU_ALLREDUCE == 'N' || HOROVOD_GPU_ALLREDUCE == 'D'
-    if (on_gpu) {
-      auto stream = horovod_global.streams[first_entry.device];
-      auto event_queue = std::queue<std::pair<std::string, cudaEvent_t>>();
+  }
 
-      // Determine GPU IDs of the devices participating in this communicator.
-      std::vector<int32_t> nccl_device_map;
-      if (horovod_global.param_manager.HierarchicalAllreduce()) {
-        // Reserve before for-loop, to save on reallocation cost.
-        nccl_device_map.reserve(horovod_global.local_comm_ranks.size());
-        for (int rank : horovod_global.local_comm_ranks) {
-          nccl_device_map.push_back(response.devices()[rank]);
-        }
-      } else {
-        nccl_device_map = response.devices();
-      }
+  // Split the data of hierarchical allreduce into the slices of all nodes.
+  // Every slice is owned by one local rank on each node.
+  int slice_unit = 1;
+  for (int node_size : state.local_sizes) {
+    int a = slice_unit, b = node_size;
+    while (b != 0) {
+      int t = a % b;
+      a = b;
+      b = t;
+    }
+    slice_unit = slice_unit / a * node_size;
+  }
+  std::set<int> slice_starts;
+  for (int node_size : state.local_sizes) {
+    for (int i = 0; i <= node_size; ++i) {
+      slice_starts.insert(i * (slice_unit / node_size));
+    }
+  }
+  state.hierarchical_slice_unit = slice_unit;
+  state.hierarchical_slice_starts.assign(slice_starts.begin(),
+                                         slice_starts.end());
+  state.hierarchical_slice_comms.clear();
+  for (size_t i = 0; i + 1 < state.hierarchical_slice_starts.size(); ++i) {
+    bool owned = state.hierarchical_slice_starts[i] /
+                     (slice_unit / local_size) ==
+                 local_rank;
+    MPI_Comm slice_comm = MPI_COMM_NULL;
+    if (is_homogeneous) {
+      slice_comm = owned ? cross_comm : MPI_COMM_NULL;
+    } else {
+      MPI_Comm_split(state.mpi_comm, owned ? 0 : MPI_UNDEFINED, rank,
+                     &slice_comm);
+    }
+    state.hierarchical_slice_comms.push_back(slice_comm);
+  }
 
-#if HOROVOD_GPU_ALLREDUCE == 'N'
-      // Ensure NCCL communicator is in the map before executing reduction.
-      ncclComm_t& nccl_comm = horovod_global.nccl_comms[nccl_device_map];
-      if (nccl_comm == nullptr) {
-        ACTIVITY_START_ALL(entries, timeline, INIT_NCCL)
-
-        int nccl_rank, nccl_size;
-        MPI_Comm nccl_id_bcast_comm;
-        if (horovod_global.param_manager.HierarchicalAllreduce()) {
-          nccl_rank = horovod_global.local_rank;
-          nccl_size = horovod_global.local_size;
-          nccl_id_bcast_comm = horovod_global.local_comm;
-        } else {
-          nccl_rank = horovod_global.rank;
-          nccl_size = horovod_global.size;
-          nccl_id_bcast_comm = horovod_global.mpi_comm;
-        }
+  // Create custom MPI float16 data type.
+  MPI_Datatype mpi_float16_t;
+  MPI_Type_contiguous(2, MPI_BYTE, &mpi_float16_t);
+  MPI_Type_commit(&mpi_float16_t);
 
-        ncclUniqueId nccl_id;
-        if (nccl_rank == 0) {
-          NCCL_CHECK(entries, "ncclGetUniqueId", ncclGetUniqueId(&nccl_id))
-        }
+  // Create custom MPI float16 summation op.
+  MPI_Op mpi_float16_sum;
+  MPI_Op_create(&float16_sum, 1, &mpi_float16_sum);
 
-        MPI_CHECK(entries, "MPI_Bcast",
-                  MPI_Bcast((void*)&nccl_id, sizeof(nccl_id), MPI_BYTE, 0,
-                            nccl_id_bcast_comm));
+  // Create custom MPI bfloat16 data type and summation op.
+  MPI_Datatype mpi_bfloat16_t;
+  MPI_Type_contiguous(2, MPI_BYTE, &mpi_bfloat16_t);
+  MPI_Type_commit(&mpi_bfloat16_t);
+  MPI_Op mpi_bfloat16_sum;
+  MPI_Op_create(&bfloat16_sum, 1, &mpi_bfloat16_sum);
 
-        ncclComm_t new_nccl_comm;
-        NCCL_CHECK(
-            entries, "ncclCommInitRank",
-            ncclCommInitRank(&new_nccl_comm, nccl_size, nccl_id, nccl_rank))
-        nccl_comm = new_nccl_comm;
+#if HAVE_CUDA
+  // Let the cross-node allreduce of hierarchical allreduce use device
+  // pointers if the MPI library supports them. This is queried from Open MPI
+  // and can be overridden with HOROVOD_CUDA_AWARE_MPI, and all ranks have to
+  // agree on it.
+  int cuda_aware_mpi = 0;
+#if defined(MPIX_CUDA_AWARE_SUPPORT) && MPIX_CUDA_AWARE_SUPPORT
+  cuda_aware_mpi = MPIX_Query_cuda_support();
+#endif
+  auto horovod_cuda_aware_mpi = std::getenv(HOROVOD_CUDA_AWARE_MPI);
+  if (horovod_cuda_aware_mpi != nullptr) {
+    cuda_aware_mpi =
+        std::strtol(horovod_cuda_aware_mpi, nullptr, 10) > 0 ? 1 : 0;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &cuda_aware_mpi, 1, MPI_INT, MPI_MIN,
+                state.mpi_comm);
+  state.cuda_aware_mpi = cuda_aware_mpi > 0;
+  if (state.cuda_aware_mpi) {
+    MPI_Op_create(&device_float16_sum, 1, &state.mpi_device_float16_sum);
+  }
+#endif
 
-        // Barrier helps NCCL to synchronize after initialization and avoid
-        // deadlock that we've been seeing without it.
-        MPI_CHECK(entries, "MPI_Barrier", MPI_Barrier(horovod_global.mpi_comm));
+  // Create custom datatypes for the parameter manager.
+  state.param_manager.CreateMpiTypes();
 
-        ACTIVITY_END_ALL(entries, timeline)
-      }
-#elif HOROVOD_GPU_ALLREDUCE == 'D'
-      if (!horovod_global.ddl_initialized) {
-        // Initialize DDL
-        auto ddl_options = std::getenv("DDL_OPTIONS");
-        if (ddl_options == nullptr) {
-          OP_ERROR(entries,
-                   "DDL_OPTIONS env variable needs to be set to use DDL.")
-        }
-        DDL_CHECK(entries, "ddl_init", ddl_init(ddl_options))
-        horovod_global.ddl_initialized = true;
-        horovod_global.ddl_local_device_id = first_entry.device;
-      } else if (horovod_global.ddl_local_device_id != first_entry.device) {
-        OP_ERROR(entries,
-                 "DDL does not support more than one GPU device per process.")
-      }
+  state.rank = rank;
+  state.quantizer = Quantizer((uint64_t)rank + 1);
+  state.local_rank = local_rank;
+  state.cross_rank = cross_rank;
+  state.size = size;
+  state.local_size = local_size;
+  state.cross_size = cross_size;
+  state.local_comm = local_comm;
+  state.cross_comm = cross_comm;
+  state.mpi_float16_t = mpi_float16_t;
+  state.mpi_float16_sum = mpi_float16_sum;
+  state.mpi_bfloat16_t = mpi_bfloat16_t;
+  state.mpi_bfloat16_sum = mpi_bfloat16_sum;
+  state.mpi_threads_supported = (provided == MPI_THREAD_MULTIPLE);
+  state.local_comm_ranks = local_comm_ranks;
+  state.cross_comm_ranks = cross_comm_ranks;
+
+  // Keep the background thread off the cores of the framework, and close to
+  // the GPU or InfiniBand adapter it feeds. The threads it starts inherit the
+  // cores of its NUMA node until it is pinned to its own core once they have
+  // been started, and memory first touched by any of them is taken from that
+  // node.
+  ThreadPlacement placement;
+  auto horovod_thread_affinity = std::getenv(HOROVOD_THREAD_AFFINITY);
+  if (horovod_thread_affinity != nullptr && *horovod_thread_affinity != '\0') {
+    std::string gpu_pci_bus_id;
+#if HAVE_CUDA
+    // Like eager NCCL initialization, this assumes every rank uses the GPU of
+    // its local rank.
+    int device_count = 0;
+    char pci_bus_id[32];
+    if (cudaGetDeviceCount(&device_count) == cudaSuccess && device_count > 0 &&
+        cudaDeviceGetPCIBusId(pci_bus_id, (int)sizeof(pci_bus_id),
+                              local_rank % device_count) == cudaSuccess) {
+      gpu_pci_bus_id = pci_bus_id;
+    } else {
+      cudaGetLastError();
+    }
 #endif
-
-      if (timeline.Initialized()) {
-        RECORD_EVENT(entries, event_queue, QUEUE, stream)
+    auto placement_status = GetThreadPlacement(
+        horovod_thread_affinity, local_rank, gpu_pci_bus_id, placement);
+    if (placement_status.ok() && !placement.node_cores.empty()) {
+      placement_status = SetThreadAffinity(placement.node_cores);
+    }
+    if (!placement_status.ok()) {
+      LOG(WARNING) << "Not pinning the Horovod threads: "
+                   << placement_status.reason();
+      placement = ThreadPlacement();
+    } else {
+      LOG(DEBUG, rank) << "Pinning the background thread to core "
+                       << placement.core << " of NUMA node "
+                       << placement.numa_node;
+      if (placement.numa_node >= 0) {
+        auto numa_status = SetPreferredNumaNode(placement.numa_node);
+        if (!numa_status.ok()) {
+          LOG(WARNING) << "Not preferring NUMA node " << placement.numa_node
+                       << " for host memory: " << numa_status.reason();
+        }
       }
+    }
+  }
 
-      // If entries.size() > 1, we copy tensors into fusion buffer before
-      // allreduce, and distribute results of allreduce back into target
-      // tensors after allreduce.
-
-      const void* fused_input_data;
-      void* buffer_data;
-      int64_t num_elements = 0;
-      size_t buffer_len;
-      if (entries.size() > 1) {
-        // Access the fusion buffer.
-        auto& buffer = horovod_global.fusion_buffer.GetBuffer(
-            first_entry.device, first_entry.context->framework());
-        buffer_data =
-            const_cast<void*>(buffer->AccessData(first_entry.context));
+  // Open the timeline file on coordinator.
+  auto horovod_timeline = std::getenv(HOROVOD_TIMELINE);
+  if (is_coordinator && horovod_timeline != nullptr) {
+    auto horovod_timeline_format = std::getenv(HOROVOD_TIMELINE_FORMAT);
+    auto horovod_timeline_sample_steps =
+        std::getenv(HOROVOD_TIMELINE_SAMPLE_STEPS);
+    state.timeline.Initialize(
+        std::string(horovod_timeline), static_cast<unsigned int>(size),
+        horovod_timeline_format != nullptr &&
+                std::string(horovod_timeline_format) == "binary"
+            ? BINARY_TIMELINE
+            : JSON_TIMELINE,
+        horovod_timeline_sample_steps != nullptr
+            ? (int)std::strtol(horovod_timeline_sample_steps, nullptr, 10)
+            : 1);
+  }
 
-        // Copy memory into the fusion buffer.
-        int64_t offset = 0;
-        for (auto& e : entries) {
-          void* buffer_data_at_offset = (uint8_t*)buffer_data + offset;
-          CUDA_CHECK(entries, "cudaMemcpyAsync",
-                     cudaMemcpyAsync(buffer_data_at_offset, e.tensor->data(),
-                                     (size_t)e.tensor->size(),
-                                     cudaMemcpyDeviceToDevice, stream))
-          offset += e.tensor->size();
-        }
+  auto horovod_timeline_mark_cycles = std::getenv(HOROVOD_TIMELINE_MARK_CYCLES);
+  if (horovod_timeline_mark_cycles != nullptr &&
+      std::strtol(horovod_timeline_mark_cycles, nullptr, 10) > 0) {
+    state.mark_cycles_in_timeline = true;
+  }
 
-        buffer_len = (size_t)offset;
+  // Every rank records its own calls, since they are replayed by every rank.
+  auto horovod_enqueue_recording = std::getenv(HOROVOD_ENQUEUE_RECORDING);
+  if (horovod_enqueue_recording != nullptr) {
+    auto recording_status = state.enqueue_recorder.Initialize(
+        std::string(horovod_enqueue_recording) + "." + std::to_string(rank),
+        rank, size);
+    if (!recording_status.ok()) {
+      LOG(WARNING) << recording_status.reason();
+    }
+  }
 
-        if (timeline.Initialized() || horovod_global.ddl_initialized) {
-          RECORD_EVENT(entries, event_queue, MEMCPY_IN_FUSION_BUFFER, stream)
-        }
+  // Override Tensor Fusion threshold, if it's set.
+  state.param_manager.SetTensorFusionThresholdBytes(64 * 1024 * 1024);
+  auto horovod_fusion_threshold = std::getenv(HOROVOD_FUSION_THRESHOLD);
+  if (horovod_fusion_threshold != nullptr) {
+    int64_t threshold = std::strtol(horovod_fusion_threshold, nullptr, 10);
+    state.param_manager.SetTensorFusionThresholdBytes(threshold, true);
+  }
 
-        // Set the input data to originate from the buffer.
-        fused_input_data = buffer_data;
+  // Set the chunk size of the cross-node allreduce in hierarchical allreduce.
+  // Chunks hold at least one element of any data type.
+  state.hierarchical_chunk_size = 4 * 1024 * 1024;
+  auto horovod_hierarchical_chunk_size =
+      std::getenv(HOROVOD_HIERARCHICAL_ALLREDUCE_CHUNK_SIZE);
+  if (horovod_hierarchical_chunk_size != nullptr) {
+    state.hierarchical_chunk_size =
+        std::max(std::strtol(horovod_hierarchical_chunk_size, nullptr, 10),
+                 (long)sizeof(double));
+  }
 
-        // Perform the reduction on the fusion buffer.
-        for (auto& e : entries) {
-          num_elements += e.tensor->shape().num_elements();
-        }
+  // Set the number of lanes for GPU allreduce.
+  auto horovod_num_nccl_streams = std::getenv(HOROVOD_NUM_NCCL_STREAMS);
+  state.num_nccl_streams =
+      horovod_num_nccl_streams != nullptr
+          ? std::max((int)std::strtol(horovod_num_nccl_streams, nullptr, 10), 1)
+          : 1;
+  state.next_nccl_stream = 0;
+
+  // Replay repeated NCCL allreduces from CUDA graphs.
+  auto horovod_cuda_graphs = std::getenv(HOROVOD_CUDA_GRAPHS);
+  if (horovod_cuda_graphs != nullptr &&
+      std::strtol(horovod_cuda_graphs, nullptr, 10) > 0) {
+#if HAVE_CUDA_GRAPHS
+    state.cuda_graphs = true;
+#else
+    LOG(WARNING) << "CUDA graphs need Horovod to be built with NCCL 2.9 "
+                    "and CUDA 11.3 or newer for GPU allreduce.";
+#endif
+  }
 
-      } else {
-        fused_input_data = first_entry.tensor->data();
-        buffer_data = (void*)first_entry.output->data();
-        num_elements = first_entry.tensor->shape().num_elements();
-        buffer_len = (size_t)first_entry.output->size();
-
-        if (horovod_global.ddl_initialized) {
-          // Copy input buffer content to output buffer
-          // because DDL only supports in-place allreduce
-          CUDA_CHECK(entries, "cudaMemcpyAsync",
-                     cudaMemcpyAsync(buffer_data, fused_input_data, buffer_len,
-                                     cudaMemcpyDeviceToDevice, stream))
-          RECORD_EVENT(entries, event_queue, MEMCPY_IN_FUSION_BUFFER, stream)
-        }
-      }
+#if HAVE_NCCL
+  // Create the NCCL communicators ahead of the first GPU operation.
+  auto horovod_nccl_eager_init = std::getenv(HOROVOD_NCCL_EAGER_INIT);
+  if (horovod_nccl_eager_init != nullptr &&
+      std::strtol(horovod_nccl_eager_init, nullptr, 10) > 0) {
+    StartEagerNCCLInit(state);
+  }
+#endif
 
-      void* host_buffer = nullptr;
+  // Set the number of fusion buffers used in rotation on every GPU.
+  auto horovod_fusion_buffers = std::getenv(HOROVOD_FUSION_BUFFERS);
+  state.fusion_buffer.SetNumBuffers(
+      horovod_fusion_buffers != nullptr
+          ? (int)std::strtol(horovod_fusion_buffers, nullptr, 10)
+          : 1);
+
+  // Set the memory budget of the fusion buffers and the shared buffer. The
+  // local ranks have to agree on the size of the shared buffer, so all ranks
+  // use the smallest budget that was set.
+  int64_t fusion_memory_budget = std::numeric_limits<int64_t>::max();
+  auto horovod_fusion_memory_budget =
+      std::getenv(HOROVOD_FUSION_MEMORY_BUDGET);
+  if (horovod_fusion_memory_budget != nullptr &&
+      std::strtoll(horovod_fusion_memory_budget, nullptr, 10) > 0) {
+    fusion_memory_budget =
+        (int64_t)std::strtoll(horovod_fusion_memory_budget, nullptr, 10);
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &fusion_memory_budget, 1, MPI_INT64_T, MPI_MIN,
+                state.mpi_comm);
+  state.fusion_buffer.SetBudget(
+      fusion_memory_budget < std::numeric_limits<int64_t>::max()
+          ? fusion_memory_budget
+          : 0);
+  state.metrics.buffer_budget_bytes.store(state.fusion_buffer.Budget(),
+                                          std::memory_order_relaxed);
+
+  // Release fusion buffers which haven't been used for this many seconds.
+  auto horovod_fusion_idle_release = std::getenv(HOROVOD_FUSION_IDLE_RELEASE);
+  if (horovod_fusion_idle_release != nullptr) {
+    state.fusion_idle_release = std::chrono::seconds(
+        std::max(0L, std::strtol(horovod_fusion_idle_release, nullptr, 10)));
+  }
 
-#if HOROVOD_GPU_ALLREDUCE == 'D'
-      // Synchronize.
-      WAIT_FOR_EVENTS(entries, timeline, event_queue)
-      DDL_Type ddl_data_type;
-      try {
-        ddl_data_type = GetDDLDataType(first_entry.tensor);
-      } catch (const std::logic_error& ex) {
-        OP_ERROR(entries, ex.what())
-      }
-      DDL_CHECK(entries, "ddl_allreduce",
-                ddl_allreduce(buffer_data, (size_t)num_elements, ddl_data_type,
-                              DDL_OP_SUM))
-#else
-      if (horovod_global.param_manager.HierarchicalAllreduce()) {
-        int element_size;
-        MPI_Type_size(GetMPIDataType(first_entry.tensor), &element_size);
+  // Start the memcpy threads. By default, the cores of the node are shared by
+  // its ranks, with at most four threads per rank.
+  auto horovod_memcpy_threads = std::getenv(HOROVOD_MEMCPY_THREADS);
+  int num_memcpy_threads =
+      horovod_memcpy_threads != nullptr
+          ? (int)std::strtol(horovod_memcpy_threads, nullptr, 10)
+          : std::min((int)std::thread::hardware_concurrency() / local_size, 4);
+  state.memcpy_pool.Start(std::max(num_memcpy_threads, 1));
+
+  // Connect the ring of the TCP backend if all ranks ask for it, so that CPU
+  // allreduces don't go through MPI.
+  auto horovod_cpu_operations = std::getenv(HOROVOD_CPU_OPERATIONS);
+  int use_tcp_ring = horovod_cpu_operations != nullptr &&
+                     std::strcmp(horovod_cpu_operations, "tcp") == 0;
+  MPI_Allreduce(MPI_IN_PLACE, &use_tcp_ring, 1, MPI_INT, MPI_MIN,
+                state.mpi_comm);
+  if (use_tcp_ring && size > 1) {
+    auto horovod_tcp_ring_connections =
+        std::getenv(HOROVOD_TCP_RING_CONNECTIONS);
+    int num_connections =
+        horovod_tcp_ring_connections != nullptr
+            ? (int)std::strtol(horovod_tcp_ring_connections, nullptr, 10)
+            : TCP_RING_DEFAULT_CONNECTIONS;
+    auto tcp_ring_status =
+        state.tcp_ring.Initialize(state.mpi_comm, num_connections,
+                                  std::getenv(HOROVOD_TCP_RING_INTERFACE));
+    if (!tcp_ring_status.ok()) {
+      LOG(WARNING) << "Falling back to MPI for CPU allreduces: "
+                   << tcp_ring_status.reason();
+    }
+  }
 
-        // If cluster is homogeneous and we are using fusion buffer, include
-        // dummy elements from the buffer (if necessary) to make sure the data
-        // is divisible by local_size. This is always possible since we
-        // set the fusion buffer size divisible by local_size.
-        if (horovod_global.is_homogeneous && entries.size() > 1) {
-          // Making sure the number of elements is divisible by
-          // FUSION_BUFFER_ATOMIC_UNIT for improved performance
-          int div = horovod_global.local_size * FUSION_BUFFER_ATOMIC_UNIT;
-          num_elements = ((num_elements + div - 1) / div) * div;
-          buffer_len = num_elements * element_size;
-        }
+  // Override the cycle time.
+  state.param_manager.SetCycleTimeMs(5);
+  auto horovod_cycle_time = std::getenv(HOROVOD_CYCLE_TIME);
+  if (horovod_cycle_time != nullptr) {
+    state.param_manager.SetCycleTimeMs(std::strtof(horovod_cycle_time, nullptr),
+                                       true);
+  }
 
-        // Split the elements into two groups: num_elements_per_rank*local_size,
-        // and num_elements_remaining. Cross-node reduction for the first group
-        // is done by all local_rank's in parallel, while for the second group
-        // it it is only done by the root_rank. If the cluster is not
-        // homogeneous first group is zero, and root_rank is 0.
+  // Set the watermarks for waking up the background thread before the end of
+  // the cycle. The byte watermark is auto-tuned unless it's set.
+  state.param_manager.SetCycleWakeupThresholdBytes(0);
+  auto horovod_cycle_wakeup_bytes = std::getenv(HOROVOD_CYCLE_WAKEUP_BYTES);
+  if (horovod_cycle_wakeup_bytes != nullptr) {
+    int64_t threshold = std::strtol(horovod_cycle_wakeup_bytes, nullptr, 10);
+    state.param_manager.SetCycleWakeupThresholdBytes(threshold, true);
+  }
+  auto horovod_cycle_wakeup_tensors = std::getenv(HOROVOD_CYCLE_WAKEUP_TENSORS);
+  state.wakeup_threshold_tensors =
+      horovod_cycle_wakeup_tensors != nullptr
+          ? std::strtol(horovod_cycle_wakeup_tensors, nullptr, 10)
+          : 0;
 
-        // Homogeneous case:
-        // For the part of data divisible by local_size, perform NCCL
-        // ReduceScatter - Parallelized MPI Allreduce - NCCL Allgather. For the
-        // non-divisible part (if any), do NCCL Reduce (at rank local_size-1),
-        // MPI Allreduce (across rank (local_size-1)'s), and NCCL Bcast
+  // Disable stall check.
+  auto horovod_stall_check_disable = std::getenv(HOROVOD_STALL_CHECK_DISABLE);
+  if (horovod_stall_check_disable != nullptr &&
+      std::strtol(horovod_stall_check_disable, nullptr, 10) > 0) {
+    state.perform_stall_check = false;
+  }
 
-        int64_t num_elements_per_rank =
-            horovod_global.is_homogeneous
-                ? num_elements / horovod_global.local_size
-                : 0;
+  auto horovod_straggler_log_interval =
+      std::getenv(HOROVOD_STRAGGLER_LOG_INTERVAL);
+  if (horovod_straggler_log_interval != nullptr) {
+    state.straggler_log_interval = std::chrono::seconds(
+        std::max(0L, std::strtol(horovod_straggler_log_interval, nullptr, 10)));
+  }
+  if (is_coordinator) {
+    state.metrics.stragglers.Initialize(size);
+  }
+  state.last_straggler_log = std::chrono::steady_clock::now();
+
+  // Set flag for hierarchical negotiation. All ranks have to agree on it
+  // since it changes which communicators are used for negotiation.
+  int hierarchical_negotiation = 0;
+  auto horovod_hierarchical_negotiation =
+      std::getenv(HOROVOD_HIERARCHICAL_NEGOTIATION);
+  if (horovod_hierarchical_negotiation != nullptr &&
+      std::strtol(horovod_hierarchical_negotiation, nullptr, 10) > 0) {
+    hierarchical_negotiation = 1;
+  }
+  MPI_Bcast(&hierarchical_negotiation, 1, MPI_INT, RANK_ZERO, state.mpi_comm);
+  state.hierarchical_negotiation = hierarchical_negotiation > 0;
+
+  // Set the size of the parts that large tensors are split into. All ranks
+  // have to split tensors the same way, so they use the smallest size.
+  int64_t partition_threshold = 0;
+  auto horovod_partition_threshold = std::getenv(HOROVOD_PARTITION_THRESHOLD);
+  if (horovod_partition_threshold != nullptr) {
+    partition_threshold = std::max(
+        (int64_t)0, (int64_t)std::strtoll(horovod_partition_threshold,
+                                          nullptr, 10));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &partition_threshold, 1, MPI_INT64_T, MPI_MIN,
+                state.mpi_comm);
+  state.partition_threshold = partition_threshold;
+
+  // Set the size from which fused CPU allgathers skip the fusion buffer. All
+  // ranks have to make the same MPI call, so they use the smallest size.
+  int64_t allgather_zero_copy_threshold = state.allgather_zero_copy_threshold;
+  auto horovod_allgather_zero_copy_threshold =
+      std::getenv(HOROVOD_ALLGATHER_ZERO_COPY_THRESHOLD);
+  if (horovod_allgather_zero_copy_threshold != nullptr) {
+    allgather_zero_copy_threshold = std::max(
+        (int64_t)0, (int64_t)std::strtoll(horovod_allgather_zero_copy_threshold,
+                                          nullptr, 10));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &allgather_zero_copy_threshold, 1, MPI_INT64_T,
+                MPI_MIN, state.mpi_comm);
+  state.allgather_zero_copy_threshold = allgather_zero_copy_threshold;
+
+  // Set the size above which MPI broadcasts are pipelined, and the size of
+  // their chunks. All ranks have to pipeline the same tensors in the same
+  // chunks, so they use the smallest values that were set.
+  int64_t broadcast_pipeline[2] = {64 * 1024 * 1024, 4 * 1024 * 1024};
+  auto horovod_broadcast_pipeline_threshold =
+      std::getenv(HOROVOD_BROADCAST_PIPELINE_THRESHOLD);
+  if (horovod_broadcast_pipeline_threshold != nullptr) {
+    broadcast_pipeline[0] = std::max(
+        (int64_t)0, (int64_t)std::strtoll(horovod_broadcast_pipeline_threshold,
+                                          nullptr, 10));
+  }
+  auto horovod_broadcast_chunk_size = std::getenv(HOROVOD_BROADCAST_CHUNK_SIZE);
+  if (horovod_broadcast_chunk_size != nullptr) {
+    broadcast_pipeline[1] = std::max(
+        (int64_t)1,
+        (int64_t)std::strtoll(horovod_broadcast_chunk_size, nullptr, 10));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, broadcast_pipeline, 2, MPI_INT64_T, MPI_MIN,
+                state.mpi_comm);
+  state.broadcast_pipeline_threshold = broadcast_pipeline[0];
+  state.broadcast_chunk_size = broadcast_pipeline[1];
+
+  // Set the response cache capacity. All ranks use the smallest capacity so
+  // that the caches stay consistent.
+  int cache_capacity = 1024;
+  auto horovod_cache_capacity = std::getenv(HOROVOD_CACHE_CAPACITY);
+  if (horovod_cache_capacity != nullptr) {
+    cache_capacity =
+        std::max(0, (int)std::strtol(horovod_cache_capacity, nullptr, 10));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &cache_capacity, 1, MPI_INT, MPI_MIN,
+                state.mpi_comm);
+  state.response_cache.set_capacity((uint32_t)cache_capacity);
+  // Tensor IDs are kept for as many tensors as responses are cached.
+  state.tensor_ids.set_capacity(cache_capacity);
+  state.cache_wait_start.clear();
 
-        size_t buffer_len_per_rank = element_size * num_elements_per_rank;
+  // Set flag for hierarchical allgather. Ignore if Horovod is running on a
+  // single node.
+  auto horovod_hierarchical_allgather =
+      std::getenv(HOROVOD_HIERARCHICAL_ALLGATHER);
+  state.param_manager.SetHierarchicalAllgather(false);
+  if (horovod_hierarchical_allgather != nullptr) {
+    bool value = std::strtol(horovod_hierarchical_allgather, nullptr, 10) > 0 &&
+                 (size != local_size);
+    state.param_manager.SetHierarchicalAllgather(value, true);
+  }
+  // Set flag for hierarchical allreduce. Ignore if Horovod is running one
+  // rank per node.
+  auto horovod_hierarchical_allreduce =
+      std::getenv(HOROVOD_HIERARCHICAL_ALLREDUCE);
+  state.param_manager.SetHierarchicalAllreduce(false);
+  if (horovod_hierarchical_allreduce != nullptr) {
+    bool value = std::strtol(horovod_hierarchical_allreduce, nullptr, 10) > 0 &&
+                 (local_size > 1);
+    state.param_manager.SetHierarchicalAllreduce(value, true);
+  }
 
-        void* buffer_data_at_rank_offset =
-            (uint8_t*)buffer_data +
-            buffer_len_per_rank * horovod_global.local_rank;
+  // Issue warning if hierarchical allgather is enabled in heterogeneous cluster
+  if (is_coordinator && state.param_manager.HierarchicalAllgather() &&
+      !state.is_homogeneous) {
+    std::cerr
+        << "WARNING: Using different number of ranks per node might cause "
+           "performance loss in hierarchical allgather. Consider assigning "
+           "the same number of ranks to each node, or disabling "
+           "hierarchical allgather.";
+  }
 
-        int64_t num_elements_remaining =
-            horovod_global.is_homogeneous
-                ? num_elements % horovod_global.local_size
-                : num_elements;
+  // Enable auto-tuning.
+  auto horovod_autotune = std::getenv(HOROVOD_AUTOTUNE);
+  if (horovod_autotune != nullptr &&
+      std::strtol(horovod_autotune, nullptr, 10) > 0) {
+    auto horovod_autotune_log = std::getenv(HOROVOD_AUTOTUNE_LOG);
+    // Results of earlier runs are only reused for the same job layout and
+    // allreduce backend.
+    auto horovod_autotune_cache = std::getenv(HOROVOD_AUTOTUNE_CACHE);
+    std::string job_key = "size=" + std::to_string(size) +
+                          ",local_size=" + std::to_string(local_size);
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+    job_key += ",backend=nccl";
+#elif HOROVOD_GPU_ALLREDUCE == 'D'
+    job_key += ",backend=ddl";
+#else
+    job_key += ",backend=mpi";
+#endif
+    state.param_manager.Initialize(
+        rank, RANK_ZERO, state.mpi_comm,
+        horovod_autotune_log != nullptr ? std::string(horovod_autotune_log)
+                                        : "",
+        horovod_autotune_cache != nullptr ? std::string(horovod_autotune_cache)
+                                          : "",
+        job_key);
+    state.param_manager.SetAutoTuning(true);
 
-        size_t buffer_len_remaining = element_size * num_elements_remaining;
+    // Tune again when the throughput drops after tuning has finished.
+    auto horovod_autotune_retune_margin =
+        std::getenv(HOROVOD_AUTOTUNE_RETUNE_MARGIN);
+    if (horovod_autotune_retune_margin != nullptr) {
+      state.param_manager.SetRetuneMargin(
+          std::strtod(horovod_autotune_retune_margin, nullptr));
+    }
+  }
 
-        void* buffer_data_remainder =
-            (uint8_t*)buffer_data +
-            buffer_len_per_rank * horovod_global.local_size;
+  // Initialize the tensor count table. No tensors are available yet.
+  if (is_coordinator) {
+    state.message_table = std::unique_ptr<MessageTable>(new MessageTable());
+  }
+  state.local_message_table.reset();
+  if (state.hierarchical_negotiation && local_rank == 0) {
+    state.local_message_table =
+        std::unique_ptr<MessageTable>(new MessageTable());
+  }
 
-        void* fused_input_data_remainder =
-            (uint8_t*)fused_input_data +
-            buffer_len_per_rank * horovod_global.local_size;
+  // Start the thread which calls the callbacks of performed operations.
+  state.finalizer_shut_down = false;
+  state.finalizer_thread = std::thread(FinalizerThreadLoop, std::ref(state));
 
-        int root_rank =
-            horovod_global.is_homogeneous ? horovod_global.local_size - 1 : 0;
-        bool is_root_rank = horovod_global.local_rank == root_rank;
+  // All helper threads have been started on the cores of the NUMA node.
+  if (placement.core >= 0) {
+    auto affinity_status = SetThreadAffinity({placement.core});
+    if (!affinity_status.ok()) {
+      LOG(WARNING) << "Not pinning the background thread: "
+                   << affinity_status.reason();
+    }
+  }
 
-        int64_t total_num_elements =
-            is_root_rank ? num_elements_per_rank + num_elements_remaining
-                         : num_elements_per_rank;
-        int64_t total_buffer_len =
-            is_root_rank ? buffer_len_per_rank + buffer_len_remaining
-                         : buffer_len_per_rank;
+  // Signal that initialization is completed.
+  state.initialization_done = true;
 
-        if (num_elements_per_rank > 0) {
-          NCCL_CHECK(entries, "ncclReduceScatter",
-                     ncclReduceScatter(fused_input_data,
-                                       buffer_data_at_rank_offset,
-                                       (size_t)num_elements_per_rank,
-                                       GetNCCLDataType(first_entry.tensor),
-                                       ncclSum, nccl_comm, stream))
+  LOG(INFO, rank) << "Horovod Initialized";
 
-          if (timeline.Initialized()) {
-            RECORD_EVENT(entries, event_queue, NCCL_REDUCESCATTER, stream)
-          }
-        }
+  // Iterate until shutdown.
+  while (RunLoopOnce(state, is_coordinator))
+    ;
 
-        if (num_elements_remaining > 0) {
-          // Reduce the remaining data at local_size-1 to append to
-          // existing buffer
-          NCCL_CHECK(entries, "ncclReduce",
-                     ncclReduce(fused_input_data_remainder,
-                                buffer_data_remainder,
-                                (size_t)num_elements_remaining,
-                                GetNCCLDataType(first_entry.tensor), ncclSum,
-                                root_rank, nccl_comm, stream))
+  LOG(DEBUG, rank) << "Shutting down background thread";
 
-          if (timeline.Initialized()) {
-            RECORD_EVENT(entries, event_queue, NCCL_REDUCE, stream)
-          }
-        }
+  // Signal that shutdown has been requested.
+  state.shut_down = true;
 
-        if (horovod_global.is_homogeneous || is_root_rank) {
-          // cudaHostAlloc is significantly slower than malloc.  Pre-allocating
-          // a buffer is not safe since the tensor can be arbitrarily large.
-          host_buffer = malloc(total_buffer_len);
+#if HAVE_NCCL
+  if (state.eager_nccl_thread.joinable()) {
+    state.eager_nccl_thread.join();
+  }
+#endif
 
-          // Synchronize.
-          WAIT_FOR_EVENTS(entries, timeline, event_queue)
+  // TODO: init.cu:645 WARN Cuda failure 'driver shutting down'
+  //#if HAVE_NCCL
+  //  for (auto it = horovod_global.streams.begin();
+  //       it != horovod_global.streams.end(); ++it) {
+  //    cudaStreamSynchronize(it->second);
+  //  }
+  //  for (auto it = horovod_global.nccl_comms.begin();
+  //       it != horovod_global.nccl_comms.end(); ++it) {
+  //    ncclCommDestroy(it->second);
+  //  }
+  //#endif
 
-          // According to https://docs.nvidia.com/cuda/cuda-runtime-api/
-          // api-sync-behavior.html#api-sync-behavior__memcpy-async,
-          // cudaMemcpyAsync is synchronous with respect to the host, so we
-          // memcpy (effectively) synchronously to generate an accurate timeline
-          ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_HOST_BUFFER)
-          CUDA_CHECK(entries, "cudaMemcpyAsync",
-                     cudaMemcpyAsync(host_buffer, buffer_data_at_rank_offset,
-                                     total_buffer_len, cudaMemcpyDeviceToHost,
-                                     stream))
-          ACTIVITY_END_ALL(entries, timeline)
+  // Let the finalizer thread call the callbacks of all performed operations
+  // before the outstanding ones are failed below.
+  {
+    std::lock_guard<std::mutex> guard(state.completion_mutex);
+    state.finalizer_shut_down = true;
+  }
+  state.completion_cv.notify_all();
+  state.finalizer_thread.join();
+  state.memcpy_pool.Stop();
+  state.timeline.Shutdown();
+  state.enqueue_recorder.Shutdown();
 
-          ACTIVITY_START_ALL(entries, timeline, MPI_ALLREDUCE)
-          MPI_CHECK(entries, "MPI_Allreduce",
-                    MPI_Allreduce(MPI_IN_PLACE, host_buffer,
-                                  (int)total_num_elements,
-                                  GetMPIDataType(first_entry.tensor),
-                                  first_entry.tensor->dtype() == HOROVOD_FLOAT16
-                                      ? horovod_global.mpi_float16_sum
-                                      : MPI_SUM,
-                                  horovod_global.cross_comm))
-          ACTIVITY_END_ALL(entries, timeline)
+  // Notify all outstanding operations that Horovod has been shut down
+  // and clear up the tensor table and message queue.
+  auto entries = state.tensor_table.TakeAll();
+  state.message_queue.Clear();
+  {
+    std::lock_guard<std::mutex> guard(state.accumulation_mutex);
+    for (auto& e : state.accumulation_queue) {
+      entries.push_back(std::move(e));
+    }
+    state.accumulation_queue.clear();
+  }
+  state.accumulators.clear();
+  {
+    std::lock_guard<std::mutex> guard(state.replica_mutex);
+    for (auto& e : state.replica_queue) {
+      entries.push_back(std::move(e));
+    }
+    state.replica_queue.clear();
+  }
+  for (auto& replicas : state.replicas) {
+    for (auto& e : replicas.second) {
+      entries.push_back(std::move(e));
+    }
+  }
+  state.replicas.clear();
+  state.replica_sums.clear();
+  for (auto& e : entries) {
+    e.callback(SHUT_DOWN_ERROR);
+  }
 
-          ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_HOST_BUFFER)
-          CUDA_CHECK(entries, "cudaMemcpyAsync",
-                     cudaMemcpyAsync(buffer_data_at_rank_offset, host_buffer,
-                                     total_buffer_len, cudaMemcpyHostToDevice,
-                                     stream))
-          ACTIVITY_END_ALL(entries, timeline)
-        }
+  horovod_global.tcp_ring.Finalize();
 
-        if (num_elements_per_rank > 0) {
-          NCCL_CHECK(entries, "ncclAllGather",
-                     ncclAllGather(buffer_data_at_rank_offset, buffer_data,
-                                   (size_t)num_elements_per_rank,
-                                   GetNCCLDataType(first_entry.tensor),
-                                   nccl_comm, stream))
+  for (auto& layout : horovod_global.allgather_layouts) {
+    FreeAllgatherDatatypes(layout.second);
+  }
+  horovod_global.allgather_layouts.clear();
 
-          if (timeline.Initialized()) {
-            RECORD_EVENT(entries, event_queue, NCCL_ALLGATHER, stream)
-          }
-        }
-        if (num_elements_remaining > 0) {
-          NCCL_CHECK(entries, "ncclBcast",
-                     ncclBcast(buffer_data_remainder,
-                               (size_t)num_elements_remaining,
-                               GetNCCLDataType(first_entry.tensor), root_rank,
-                               nccl_comm, stream))
+  if (horovod_global.shared_buffer != nullptr) {
+    MPI_Win_free(&horovod_global.window);
+    horovod_global.shared_buffer = nullptr;
+  }
 
-          if (timeline.Initialized()) {
-            RECORD_EVENT(entries, event_queue, NCCL_BCAST, stream)
-          }
-        }
-      } else {
-        NCCL_CHECK(entries, "ncclAllReduce",
-                   ncclAllReduce(fused_input_data, buffer_data,
-                                 (size_t)num_elements,
-                                 GetNCCLDataType(first_entry.tensor), ncclSum,
-                                 nccl_comm, stream))
-        if (timeline.Initialized()) {
-          RECORD_EVENT(entries, event_queue, NCCL_ALLREDUCE, stream)
-        }
-      }
-#endif
+  if (horovod_global.mpi_comm != MPI_COMM_NULL &&
+      horovod_global.mpi_comm != MPI_COMM_WORLD) {
+    MPI_Comm_free(&horovod_global.mpi_comm);
+  }
+  // Forget the communicator so that restarting with horovod_init() duplicates
+  // MPI_COMM_WORLD again instead of using the freed one.
+  horovod_global.mpi_comm = MPI_Comm();
 
-      if (entries.size() > 1) {
-        // Copy memory out of the fusion buffer.
-        int64_t offset = 0;
-        for (auto& e : entries) {
-          void* buffer_data_at_offset = (uint8_t*)buffer_data + offset;
-          CUDA_CHECK(entries, "cudaMemcpyAsync",
-                     cudaMemcpyAsync((void*)e.output->data(),
-                                     buffer_data_at_offset,
-                                     (size_t)e.tensor->size(),
-                                     cudaMemcpyDeviceToDevice, stream))
-          offset += e.tensor->size();
-        }
-        if (timeline.Initialized()) {
-          RECORD_EVENT(entries, event_queue, MEMCPY_OUT_FUSION_BUFFER, stream)
-        }
-      }
+  if (horovod_global.local_comm != MPI_COMM_NULL) {
+    MPI_Comm_free(&horovod_global.local_comm);
+  }
 
-      // Use completion marker via event because it's faster than
-      // blocking cudaStreamSynchronize() in this thread.
-      RECORD_EVENT(entries, event_queue, "", stream)
+  for (auto& slice_comm : horovod_global.hierarchical_slice_comms) {
+    if (slice_comm != MPI_COMM_NULL &&
+        slice_comm != horovod_global.cross_comm) {
+      MPI_Comm_free(&slice_comm);
+    }
+  }
+  horovod_global.hierarchical_slice_comms.clear();
 
-      // TODO: use thread pool or single thread for callbacks
-      std::thread finalizer_thread([entries, first_entry, host_buffer, response,
-                                    event_queue, &timeline]() mutable {
-        CUDA_CHECK(entries, "cudaSetDevice", cudaSetDevice(first_entry.device))
+  if (horovod_global.cross_comm != MPI_COMM_NULL) {
+    MPI_Comm_free(&horovod_global.cross_comm);
+  }
 
-        WAIT_FOR_EVENTS(entries, timeline, event_queue)
+  if (horovod_global.mpi_float16_t != MPI_DATATYPE_NULL) {
+    MPI_Type_free(&horovod_global.mpi_float16_t);
+  }
 
-        if (host_buffer != nullptr) {
-          free(host_buffer);
-        }
+  if (horovod_global.mpi_float16_sum != MPI_OP_NULL) {
+    MPI_Op_free(&horovod_global.mpi_float16_sum);
+  }
 
-        for (auto& e : entries) {
-          timeline.End(e.tensor_name, e.output);
-          e.callback(Status::OK());
-        }
-      });
-      finalizer_thread.detach();
-      return;
-    }
+#if HAVE_CUDA
+  if (horovod_global.mpi_device_float16_sum != MPI_OP_NULL) {
+    MPI_Op_free(&horovod_global.mpi_device_float16_sum);
+  }
 #endif
 
-    if (entries.size() > 1) {
-      // Access the fusion buffer.
-      auto& buffer = horovod_global.fusion_buffer.GetBuffer(
-          first_entry.device, first_entry.context->framework());
-      auto buffer_data = buffer->AccessData(first_entry.context);
+  if (horovod_global.mpi_bfloat16_t != MPI_DATATYPE_NULL) {
+    MPI_Type_free(&horovod_global.mpi_bfloat16_t);
+  }
 
-      // Copy memory into the fusion buffer.
-      ACTIVITY_START_ALL(entries, timeline, MEMCPY_IN_FUSION_BUFFER)
-      int64_t offset = 0;
-      for (auto& e : entries) {
-        void* buffer_data_at_offset = (uint8_t*)buffer_data + offset;
-#if HAVE_CUDA
-        if (on_gpu) {
-          CUDA_CHECK(entries, "cudaMemcpyAsync",
-                     cudaMemcpyAsync(
-                         buffer_data_at_offset, e.tensor->data(),
-                         (size_t)e.tensor->size(), cudaMemcpyDeviceToDevice,
-                         horovod_global.streams[first_entry.device]))
-        } else {
-#endif
-          std::memcpy(buffer_data_at_offset, e.tensor->data(),
-                      (size_t)e.tensor->size());
-#if HAVE_CUDA
-        }
-#endif
-        offset += e.tensor->size();
-      }
-#if HAVE_CUDA
-      if (on_gpu) {
-        CUDA_CHECK(
-            entries, "cudaStreamSynchronize",
-            cudaStreamSynchronize(horovod_global.streams[first_entry.device]))
-      }
-#endif
-      ACTIVITY_END_ALL(entries, timeline)
+  if (horovod_global.mpi_bfloat16_sum != MPI_OP_NULL) {
+    MPI_Op_free(&horovod_global.mpi_bfloat16_sum);
+  }
 
-      ACTIVITY_START_ALL(entries, timeline, MPI_ALLREDUCE)
-      int64_t num_elements = 0;
-      for (auto& e : entries) {
-        num_elements += e.tensor->shape().num_elements();
-      }
-      MPI_CHECK(entries, "MPI_Allreduce",
-                MPI_Allreduce(MPI_IN_PLACE, (void*)buffer_data,
-                              (int)num_elements,
-                              GetMPIDataType(first_entry.tensor),
-                              first_entry.tensor->dtype() == HOROVOD_FLOAT16
-                                  ? horovod_global.mpi_float16_sum
-                                  : MPI_SUM,
-                              horovod_global.mpi_comm))
-      ACTIVITY_END_ALL(entries, timeline)
+  horovod_global.param_manager.FreeMpiTypes();
 
-      // Copy memory out of the fusion buffer.
-      ACTIVITY_START_ALL(entries, timeline, MEMCPY_OUT_FUSION_BUFFER)
-      offset = 0;
-      for (auto& e : entries) {
-        void* buffer_data_at_offset = (uint8_t*)buffer_data + offset;
-#if HAVE_CUDA
-        if (on_gpu) {
-          CUDA_CHECK(entries, "cudaMemcpyAsync",
-                     cudaMemcpyAsync(
-                         (void*)e.output->data(), buffer_data_at_offset,
-                         (size_t)e.tensor->size(), cudaMemcpyDeviceToDevice,
-                         horovod_global.streams[first_entry.device]))
-        } else {
-#endif
-          std::memcpy((void*)e.output->data(), buffer_data_at_offset,
-                      (size_t)e.tensor->size());
-#if HAVE_CUDA
-        }
+  if (horovod_global.should_finalize) {
+#if HAVE_DDL
+    // ddl_finalize calls MPI_Finalize
+    ddl_finalize();
+#else
+    int is_mpi_finalized = 0;
+    MPI_Finalized(&is_mpi_finalized);
+    if (!is_mpi_finalized) {
+      MPI_Finalize();
+    }
 #endif
-        offset += e.tensor->size();
+  }
+}
+
+// Fuse responses that are ready in the same cycle so that they can be
+// processed together through the fusion buffer. The result only depends on
+// the responses and on the tensor table, so all ranks calling this with the
+// same responses produce the same fused responses.
+//
+// Only tensors with the same response type, data type, compression, reduce
+// scope, devices and broadcast root rank can share the fusion buffer, so
+// responses are sorted into one bin per such group.
+// Mixed-precision training interleaves requests of different data types,
+// which would otherwise break up the fusion. A bin that would grow beyond
+// the fusion threshold is closed and a new one is opened for its group.
+// Fused responses are emitted in the order in which their bins were opened.
+//
+// Responses are binned in the order of their priority, so the tensors with
+// the highest priority are fused and performed first. A fused response has
+// the priority of its first tensor.
+MPIResponseList FuseResponses(std::deque<MPIResponse>& responses,
+                              HorovodGlobalState& state) {
+  std::stable_sort(responses.begin(), responses.end(),
+                   [](const MPIResponse& a, const MPIResponse& b) {
+                     return a.priority() > b.priority();
+                   });
+
+  struct FusionBin {
+    MPIResponse response;
+    int64_t size;
+  };
+  // Tensors of a group are only fused with each other.
+  using FusionKey =
+      std::tuple<MPIResponse::ResponseType, MPIDataType, Compression,
+                 ReduceScope, std::vector<int32_t>, std::string, int>;
+
+  std::vector<FusionBin> bins;
+  std::map<FusionKey, size_t> open_bins;
+  int64_t fusion_threshold = TensorFusionThresholdBytes();
+  while (!responses.empty()) {
+    auto response = std::move(responses.front());
+    assert(response.tensor_names().size() == 1);
+    responses.pop_front();
+
+    if (response.response_type() != MPIResponse::ResponseType::ALLREDUCE &&
+        response.response_type() != MPIResponse::ResponseType::ALLGATHER &&
+        response.response_type() !=
+            MPIResponse::ResponseType::REDUCESCATTER &&
+        response.response_type() != MPIResponse::ResponseType::BROADCAST) {
+      bins.push_back(FusionBin{std::move(response), 0});
+      continue;
+    }
+
+    auto& entry = state.tensor_table.Get(response.tensor_names()[0]);
+#if HOROVOD_GPU_BROADCAST != 'N'
+    // Without NCCL, GPU tensors are broadcast by a CUDA-aware MPI directly
+    // from device memory, which can't be packed with host copies.
+    if (response.response_type() == MPIResponse::ResponseType::BROADCAST &&
+        entry.device != CPU_DEVICE_ID) {
+      bins.push_back(FusionBin{std::move(response), 0});
+      continue;
+    }
+#endif
+    int64_t tensor_size;
+    if (response.response_type() == MPIResponse::ResponseType::ALLREDUCE) {
+      tensor_size = FusedSize(entry);
+    } else if (response.response_type() ==
+                   MPIResponse::ResponseType::REDUCESCATTER ||
+               response.response_type() ==
+                   MPIResponse::ResponseType::BROADCAST) {
+      // The whole input of a reducescatter or broadcast is packed into the
+      // fusion buffer.
+      tensor_size = entry.tensor->size();
+    } else {
+      tensor_size =
+          TotalByteSizeOfAllgatherOutput(response.tensor_sizes(), entry);
+    }
+    // Every rank knows the root rank of a broadcast, which is zero for the
+    // other operations.
+    FusionKey key(response.response_type(), entry.tensor->dtype(),
+                  entry.compression, response.scope(), response.devices(),
+                  entry.group, entry.root_rank);
+
+    auto open_bin = open_bins.find(key);
+    if (open_bin != open_bins.end() &&
+        bins[open_bin->second].size + tensor_size <= fusion_threshold) {
+      // These tensors will fuse together well.
+      auto& bin = bins[open_bin->second];
+      if (response.response_type() != MPIResponse::ResponseType::ALLGATHER) {
+        bin.response.add_tensor_name(response.tensor_names()[0]);
+      } else {
+        bin.response.add_allgather_response(response);
       }
-#if HAVE_CUDA
-      if (on_gpu) {
-        CUDA_CHECK(
-            entries, "cudaStreamSynchronize",
-            cudaStreamSynchronize(horovod_global.streams[first_entry.device]))
+      bin.size += tensor_size;
+    } else {
+      open_bins[key] = bins.size();
+      bins.push_back(FusionBin{std::move(response), tensor_size});
+    }
+  }
+
+  MPIResponseList response_list;
+  for (auto& bin : bins) {
+    response_list.emplace_response(std::move(bin.response));
+    LOG(DEBUG) << "Created response of size " << bin.size;
+  }
+  return response_list;
+}
+
+// Parameters of a local tensor that are checked before its cached response
+// is reused.
+TensorParams GetTensorParams(const TensorTableEntry& entry,
+                             MPIResponse::ResponseType response_type) {
+  TensorParams params;
+  switch (response_type) {
+  case MPIResponse::ALLGATHER:
+    params.request_type = MPIRequest::ALLGATHER;
+    break;
+  case MPIResponse::BROADCAST:
+    params.request_type = MPIRequest::BROADCAST;
+    break;
+  case MPIResponse::SPARSE_ALLREDUCE:
+    params.request_type = MPIRequest::SPARSE_ALLREDUCE;
+    break;
+  case MPIResponse::REDUCESCATTER:
+    params.request_type = MPIRequest::REDUCESCATTER;
+    break;
+  case MPIResponse::ALLTOALL:
+    params.request_type = MPIRequest::ALLTOALL;
+    break;
+  default:
+    params.request_type = MPIRequest::ALLREDUCE;
+  }
+  params.dtype = entry.tensor->dtype();
+  auto shape = entry.tensor->shape();
+  for (int i = 0; i < shape.dims(); ++i) {
+    params.shape.push_back(shape.dim_size(i));
+  }
+  params.device = entry.device;
+  params.root_rank = entry.root_rank;
+  params.compression = entry.compression;
+  params.priority = entry.priority;
+  params.scope = entry.scope;
+  return params;
+}
+
+// Exchange cache hits with the other ranks. Requests whose responses are
+// cached and requested by all ranks are returned as cached_responses, cached
+// requests that are still missing on some ranks are put back on the message
+// queue, and only the remaining requests are left in message_queue for full
+// negotiation. Returns whether any rank needs full negotiation this cycle.
+bool CoordinateCache(HorovodGlobalState& state,
+                     std::deque<MPIRequest>& message_queue,
+                     std::deque<MPIResponse>& cached_responses,
+                     bool& should_shut_down) {
+  auto& cache = state.response_cache;
+  auto now = std::chrono::steady_clock::now();
+  CacheCoordinator cache_coordinator(cache.num_active_bits());
+  cache_coordinator.set_should_shut_down(should_shut_down);
+  for (auto& message : message_queue) {
+    auto cache_state = cache.cached(message);
+    if (cache_state == ResponseCache::HIT) {
+      uint32_t cache_bit = cache.peek_cache_bit(message.tensor_name());
+      auto wait_start = state.cache_wait_start.find(message.tensor_name());
+      if (state.perform_stall_check &&
+          wait_start != state.cache_wait_start.end() &&
+          now - wait_start->second > STALL_WARNING_TIME) {
+        // Tensor has been waiting for other ranks for too long. Drop it from
+        // the cache so that it is negotiated and reported by the stall check.
+        cache_coordinator.record_invalid_bit(cache_bit);
+        cache_coordinator.set_uncached_in_queue(true);
+      } else {
+        cache_coordinator.record_hit(cache_bit);
       }
-#endif
-      ACTIVITY_END_ALL(entries, timeline)
     } else {
-      auto& e = first_entry;
-      ACTIVITY_START_ALL(entries, timeline, MPI_ALLREDUCE)
-      const void* sendbuf = e.tensor->data() == e.output->data()
-                                ? MPI_IN_PLACE
-                                : e.tensor->data();
-      MPI_CHECK(entries, "MPI_Allreduce",
-                MPI_Allreduce(sendbuf, (void*)e.output->data(),
-                              (int)e.tensor->shape().num_elements(),
-                              GetMPIDataType(e.tensor),
-                              first_entry.tensor->dtype() == HOROVOD_FLOAT16
-                                  ? horovod_global.mpi_float16_sum
-                                  : MPI_SUM,
-                              horovod_global.mpi_comm))
-      ACTIVITY_END_ALL(entries, timeline)
+      if (cache_state == ResponseCache::INVALID) {
+        cache_coordinator.record_invalid_bit(
+            cache.peek_cache_bit(message.tensor_name()));
+      }
+      cache_coordinator.set_uncached_in_queue(true);
     }
+  }
 
-    for (auto& e : entries) {
-      timeline.End(e.tensor_name, e.output);
-      e.callback(Status::OK());
+  cache_coordinator.sync(state.mpi_comm);
+  for (auto bit : cache_coordinator.invalid_bits()) {
+    cache.erase_response(bit);
+  }
+  should_shut_down = cache_coordinator.should_shut_down();
+
+  std::deque<MPIRequest> uncached_queue;
+  std::deque<MPIRequest> pending_queue;
+  for (auto& message : message_queue) {
+    auto& name = message.tensor_name();
+    if (cache.cached(message) == ResponseCache::HIT) {
+      uint32_t cache_bit = cache.peek_cache_bit(name);
+      if (cache_coordinator.cache_hits().find(cache_bit) ==
+          cache_coordinator.cache_hits().end()) {
+        // Not requested by all ranks yet, try again in the next cycle.
+        state.cache_wait_start.emplace(name, now);
+        pending_queue.push_back(std::move(message));
+        continue;
+      }
+    } else {
+      uncached_queue.push_back(std::move(message));
     }
-  } else if (response.response_type() == MPIResponse::BROADCAST) {
-    assert(entries.size() == 1);
-    auto e = entries[0];
+    state.cache_wait_start.erase(name);
+  }
+  message_queue = std::move(uncached_queue);
+
+  // Keep the pending requests ahead of the ones enqueued since.
+  state.message_queue.Requeue(pending_queue);
+
+  // Cache bits are ordered from least to most recently used, so the
+  // responses which were waiting longest get processed first.
+  for (auto bit : cache_coordinator.cache_hits()) {
+    cached_responses.push_back(cache.peek_response(bit));
+  }
 
-    // On root rank, MPI_Bcast sends data, on other ranks it receives data.
-    void* data_ptr;
-    if (horovod_global.rank == e.root_rank) {
-      data_ptr = (void*)e.tensor->data();
+  return cache_coordinator.uncached_in_queue();
+}
+
+// Gathers the request lists of all ranks in the communicator on its rank
+// zero. On rank zero, returns the lists received from the other ranks in
+// rank order. Other ranks get an empty vector.
+std::vector<MPIRequestList> GatherRequestLists(const MPIRequestList& message_list,
+                                               MPI_Comm comm,
+                                               const TensorIdTable& tensor_ids) {
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  std::vector<MPIRequestList> received_lists;
+  if (rank != RANK_ZERO) {
+    std::string encoded_message;
+    MPIRequestList::SerializeToString(message_list, encoded_message,
+                                      tensor_ids);
+    int encoded_message_length = (int)encoded_message.length() + 1;
+    MPI_Gather(&encoded_message_length, 1, MPI_INT, nullptr, 1, MPI_INT,
+               RANK_ZERO, comm);
+    MPI_Gatherv((void*)encoded_message.c_str(), encoded_message_length,
+                MPI_BYTE, nullptr, nullptr, nullptr, MPI_BYTE, RANK_ZERO,
+                comm);
+    return received_lists;
+  }
+
+  // 1. Get message lengths from every rank.
+  auto recvcounts = new int[size];
+  recvcounts[0] = 0;
+  MPI_Gather(MPI_IN_PLACE, 1, MPI_INT, recvcounts, 1, MPI_INT, RANK_ZERO,
+             comm);
+
+  // 2. Compute displacements.
+  auto displcmnts = new int[size];
+  size_t total_size = 0;
+  for (int i = 0; i < size; ++i) {
+    if (i == 0) {
+      displcmnts[i] = 0;
     } else {
-      data_ptr = (void*)e.output->data();
+      displcmnts[i] = recvcounts[i - 1] + displcmnts[i - 1];
     }
+    total_size += recvcounts[i];
+  }
 
-    ACTIVITY_START_ALL(entries, timeline, MPI_BCAST)
-    MPI_CHECK(entries, "MPI_Bcast",
-              MPI_Bcast(data_ptr, (int)e.tensor->shape().num_elements(),
-                        GetMPIDataType(e.tensor), e.root_rank,
-                        horovod_global.mpi_comm))
-    ACTIVITY_END_ALL(entries, timeline)
+  // 3. Collect messages from every rank.
+  auto buffer = new uint8_t[total_size];
+  MPI_Gatherv(nullptr, 0, MPI_BYTE, buffer, recvcounts, displcmnts, MPI_BYTE,
+              RANK_ZERO, comm);
+
+  // 4. Parse messages. A list with an unknown tensor ID can't be negotiated,
+  // so it is turned into a shutdown request, which fails all operations.
+  received_lists.resize(size - 1);
+  for (int i = 1; i < size; ++i) {
+    auto rank_buffer_ptr = buffer + displcmnts[i];
+    if (!MPIRequestList::ParseFromBytes(received_lists[i - 1], rank_buffer_ptr,
+                                        tensor_ids)) {
+      LOG(ERROR) << "Requests from rank " << i << " of a communicator carry "
+                 << "an unknown tensor ID. Shutting Horovod down.";
+      received_lists[i - 1] = MPIRequestList();
+      received_lists[i - 1].set_shutdown(true);
+    }
+  }
 
-    timeline.End(e.tensor_name, e.output);
-    e.callback(Status::OK());
-  } else if (response.response_type() == MPIResponse::ERROR) {
-    assert(entries.size() == 1);
-    auto e = entries[0];
+  // 5. Free buffers.
+  delete[] recvcounts;
+  delete[] displcmnts;
+  delete[] buffer;
 
-    status = Status::PreconditionError(response.error_message());
-    timeline.End(e.tensor_name, nullptr);
-    e.callback(status);
+  return received_lists;
+}
+
+// Sends the response list from rank zero of the communicator to all the
+// other ranks in it, which register the new tensor names of the list.
+void BroadcastResponseList(MPIResponseList& response_list, MPI_Comm comm,
+                           TensorIdTable& tensor_ids) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  if (rank == RANK_ZERO) {
+    std::string encoded_response;
+    MPIResponseList::SerializeToString(response_list, encoded_response,
+                                       tensor_ids);
+    int encoded_response_length = (int)encoded_response.length() + 1;
+    MPI_Bcast(&encoded_response_length, 1, MPI_INT, RANK_ZERO, comm);
+    MPI_Bcast((void*)encoded_response.c_str(), encoded_response_length,
+              MPI_BYTE, RANK_ZERO, comm);
+  } else {
+    int msg_length;
+    MPI_Bcast(&msg_length, 1, MPI_INT, RANK_ZERO, comm);
+    auto buffer = new uint8_t[msg_length];
+    MPI_Bcast(buffer, msg_length, MPI_BYTE, RANK_ZERO, comm);
+    if (!MPIResponseList::ParseFromBytes(response_list, buffer, tensor_ids)) {
+      // This rank can't take part in operations it can't identify, while the
+      // other ranks already perform them.
+      LOG(ERROR) << "Responses of the coordinator carry tensor IDs which "
+                    "don't match the IDs of this rank.";
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    delete[] buffer;
   }
 }
 
-// Report Tensors that were submitted to be reduced, gathered or broadcasted by
-// some ranks but not others and are waiting for long time to get processed.
-void CheckForStalledTensors(HorovodGlobalState& state) {
-  bool preamble = false;
+// On a local root, records the requests of all ranks on the node and returns
+// the requests of tensors which are now ready on every local rank, to be
+// forwarded to the coordinator. Requests for other tensors are held back
+// until the remaining local ranks request them too.
+MPIRequestList AggregateLocalRequests(HorovodGlobalState& state,
+                                      std::vector<MPIRequestList>& local_lists) {
+  auto& local_table = *state.local_message_table;
   auto now = std::chrono::steady_clock::now();
-  for (auto& m : *state.message_table) {
-    auto tensor_name = m.first;
-    std::vector<MPIRequest>& messages = std::get<0>(m.second);
-    std::chrono::steady_clock::time_point start_at = std::get<1>(m.second);
 
-    if (now - start_at > STALL_WARNING_TIME) {
-      std::stringstream message;
-      if (!preamble) {
-       message << "One or more tensors were submitted to be "
-                  "reduced, gathered or broadcasted by subset of ranks and "
-                  "are waiting for remainder of ranks for more than "
-               << std::chrono::duration_cast<std::chrono::seconds>(
-                   STALL_WARNING_TIME)
-                   .count()
-               << " seconds. "
-               << "This may indicate that different ranks are trying to "
-                  "submit different tensors or that only subset of ranks is "
-                  "submitting tensors, which will cause deadlock. "
-               << std::endl << "Stalled ops:" ;
-        preamble = true;
-      }
-      message << tensor_name;
-      message << " [missing ranks:";
-      std::unordered_set<int32_t> ready_ranks;
-      bool missing_preamble = false;
-      for (auto msg_iter = messages.begin(); msg_iter != messages.end();
-           ++msg_iter) {
-        ready_ranks.insert(msg_iter->request_rank());
+  MPIRequestList node_list;
+  for (auto& local_list : local_lists) {
+    for (auto& request : local_list.requests()) {
+      auto& name = request.tensor_name();
+      auto table_iter = local_table.find(name);
+      if (table_iter == local_table.end()) {
+        std::vector<MPIRequest> requests;
+        requests.reserve(static_cast<unsigned long>(state.local_size));
+        table_iter =
+            local_table.emplace(name, std::make_tuple(std::move(requests), now))
+                .first;
       }
-      for (int32_t rank = 0; rank < state.size; ++rank) {
-        if (ready_ranks.find(rank) == ready_ranks.end()) {
-          if (!missing_preamble) {
-            message << " ";
-            missing_preamble = true;
-          } else {
-            message << ", ";
-          }
-          message << rank;
+
+      std::vector<MPIRequest>& requests = std::get<0>(table_iter->second);
+      requests.push_back(request);
+      if ((int)requests.size() == state.local_size) {
+        for (auto& ready_request : requests) {
+          node_list.emplace_request(std::move(ready_request));
         }
+        local_table.erase(table_iter);
       }
-      message << "]";
-      LOG(WARNING) << message.str();
+    }
+    if (local_list.shutdown()) {
+      node_list.set_shutdown(true);
     }
   }
+  return node_list;
 }
 
-// The MPI background thread loop coordinates all the MPI processes and the
-// tensor reductions. The design of the communicator mechanism is limited by a
-// few considerations:
-//
-//      1. Some MPI implementations require all MPI calls to happen from a
-//      single thread. Since TensorFlow may use several threads for graph
-//      processing, this means we must have our own dedicated thread for dealing
-//      with MPI.
-//      2. We want to gracefully handle errors, when MPI processes do not
-//      properly agree upon what should happen (such as mismatched types or
-//      shapes). To do so requires the MPI processes to know about the shapes
-//      and types of the relevant tensors on the other processes.
-//      3. The MPI reductions and gathers should be able to happen in parallel
-//      with other ongoing operations. This means that they cannot be blocking
-//      ops, but rather must be async ops, the execution of which happens on a
-//      separate thread.
-//      4. We cannot guarantee that all the MPI processes reduce their tensors
-//      in the same order, so we cannot dispatch one thread per tensor,
-//      otherwise we may end up dispatching many blocked threads and never make
-//      progress if we have a thread pool limit.
-bool RunLoopOnce(HorovodGlobalState& state, bool is_coordinator);
-void BackgroundThreadLoop(HorovodGlobalState& state) {
-  // Initialize MPI if it was not initialized. This must happen on the
-  // background thread, since not all MPI implementations support being called
-  // from multiple threads.
-  //
-  // In some cases MPI library has multi-threading support, but it slows down
-  // certain components, e.g. OpenIB BTL in OpenMPI gets disabled if
-  // MPI_THREAD_MULTIPLE is requested.
-  //
-  // By default, we will ask for multiple threads, so other libraries like
-  // mpi4py can be used together with Horovod if multi-threaded MPI is
-  // installed.
-  auto mpi_threads_disable = std::getenv(HOROVOD_MPI_THREADS_DISABLE);
-  int required = MPI_THREAD_MULTIPLE;
-  if (mpi_threads_disable != nullptr &&
-      std::strtol(mpi_threads_disable, nullptr, 10) > 0) {
-    required = MPI_THREAD_SINGLE;
+// On the coordinator, counts the requests of all ranks and constructs the
+// responses for tensors that are ready on every rank. The coordinator's own
+// requests come first in request_lists. Responses served from the response
+// cache are placed ahead of the newly negotiated ones.
+MPIResponseList ConstructResponseList(HorovodGlobalState& state,
+                                      std::vector<MPIRequestList>& request_lists,
+                                      std::deque<MPIResponse>& cached_responses,
+                                      bool should_shut_down) {
+  std::vector<std::string> ready_to_reduce;
+  for (auto& request_list : request_lists) {
+    for (auto& message : request_list.requests()) {
+      bool reduce =
+          IncrementTensorCount(state.message_table, message, state.size);
+      if (reduce) {
+        ready_to_reduce.push_back(message.tensor_name());
+      }
+    }
+    if (request_list.shutdown()) {
+      // Received SHUTDOWN request from one of the workers.
+      should_shut_down = true;
+    }
   }
-  int provided;
-  int is_mpi_initialized = 0;
-  MPI_Initialized(&is_mpi_initialized);
-  if (is_mpi_initialized) {
-    MPI_Query_thread(&provided);
-    if (provided < MPI_THREAD_MULTIPLE) {
-      LOG(WARNING) << "MPI has already been initialized without "
-                      "multi-threading support (MPI_THREAD_MULTIPLE). This will "
-                      "likely cause a segmentation fault.";
+
+  // At this point, rank zero should have a fully updated tensor count
+  // table and should know all the tensors that need to be reduced or
+  // gathered, and everyone else should have sent all their information
+  // to rank zero. We can now do reductions and gathers; rank zero will
+  // choose which ones and in what order, and will notify the other ranks
+  // before doing each reduction.
+  std::deque<MPIResponse> responses = std::move(cached_responses);
+  for (auto& tensor_name : ready_to_reduce) {
+    MPIResponse response =
+        ConstructMPIResponse(state.message_table, tensor_name);
+    responses.push_back(std::move(response));
+  }
+
+  MPIResponseList response_list = FuseResponses(responses, state);
+  response_list.set_shutdown(should_shut_down);
+
+  // Tensors get their IDs the second time they are in a response, which all
+  // ranks receive.
+  for (auto& response : response_list.responses()) {
+    for (auto& tensor_name : response.tensor_names()) {
+      if (state.tensor_ids.id(tensor_name) < 0 &&
+          state.tensor_ids.should_register(tensor_name)) {
+        state.tensor_ids.register_name(tensor_name);
+        response_list.add_new_tensor_name(tensor_name);
+      }
     }
-  } else {
-    MPI_Init_thread(NULL, NULL, required, &provided);
-    state.should_finalize = true;
   }
 
-  if (state.ranks.size() > 0) {
-    MPI_Group world_group;
-    MPI_Comm_group(MPI_COMM_WORLD, &world_group);
-    MPI_Group work_group;
-    MPI_Group_incl(world_group, state.ranks.size(), &(state.ranks[0]),
-                   &work_group);
-    MPI_Comm_create_group(MPI_COMM_WORLD, work_group, 0, &(state.mpi_comm));
-    if (state.mpi_comm == MPI_COMM_NULL) {
-      LOG(WARNING) << "Unable to create Horovod communicator, using "
-                      "MPI_COMM_WORLD instead.";
-      state.mpi_comm = MPI_COMM_WORLD;
+  if (!response_list.responses().empty() && LogLevelEnabled(LogLevel::TRACE)) {
+    std::string tensors_ready;
+    for (auto& r : response_list.responses()) {
+      tensors_ready += r.tensor_names_string() + "; " ;
     }
-    MPI_Group_free(&world_group);
-    MPI_Group_free(&work_group);
-  } else if (!state.mpi_comm) {
-    // No ranks were given and no communicator provided to horovod_init() so use
-    // MPI_COMM_WORLD
-    MPI_Comm_dup(MPI_COMM_WORLD, &(horovod_global.mpi_comm));
+    LOG(TRACE) << "Sending ready responses as " << tensors_ready;
   }
+  return response_list;
+}
 
-  // Get MPI rank to determine if we are rank zero.
-  int rank;
-  MPI_Comm_rank(state.mpi_comm, &rank);
-  bool is_coordinator = rank == 0;
+// Checks whether the given number of bytes and tensors enqueued since the
+// start of the last cycle are enough to start the next one early.
+bool CycleWakeupThresholdReached(const HorovodGlobalState& state,
+                                 int64_t enqueued_bytes,
+                                 int64_t enqueued_tensors) {
+  int64_t threshold_bytes = state.wakeup_threshold_bytes;
+  int64_t threshold_tensors = state.wakeup_threshold_tensors;
+  return (threshold_bytes > 0 && enqueued_bytes >= threshold_bytes) ||
+         (threshold_tensors > 0 && enqueued_tensors >= threshold_tensors);
+}
 
-  // Get MPI size to determine how many tensors to wait for before reducing.
-  int size;
-  MPI_Comm_size(state.mpi_comm, &size);
-  if (is_coordinator) {
-    LOG(INFO) << "Started Horovod with " << size << " processes";
-  }
+bool CycleWakeupThresholdReached(const HorovodGlobalState& state) {
+  return CycleWakeupThresholdReached(state, state.enqueued_bytes,
+                                     state.enqueued_tensors);
+}
 
-  // Determine local rank by querying the local communicator.
-  MPI_Comm local_comm;
-  MPI_Comm_split_type(state.mpi_comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
-                      &local_comm);
-  int local_rank, local_size;
-  MPI_Comm_rank(local_comm, &local_rank);
-  MPI_Comm_size(local_comm, &local_size);
-  std::vector<int> local_comm_ranks((size_t)local_size);
-  local_comm_ranks[local_rank] = rank;
-  MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, local_comm_ranks.data(), 1,
-                MPI_INT, local_comm);
+// Accounts for newly enqueued tensors and wakes up the background thread if
+// these tensors made one of the watermarks be reached.
+void NotifyTensorsEnqueued(HorovodGlobalState& state, int64_t size,
+                           int64_t count) {
+  int64_t bytes = state.enqueued_bytes.fetch_add(size) + size;
+  int64_t tensors = state.enqueued_tensors.fetch_add(count) + count;
+  if (CycleWakeupThresholdReached(state, bytes, tensors) &&
+      !CycleWakeupThresholdReached(state, bytes - size, tensors - count)) {
+    // Take the mutex so that the wakeup can't be missed by a background
+    // thread which is just about to wait.
+    std::lock_guard<std::mutex> guard(state.mutex);
+    state.wakeup_cv.notify_one();
+  }
+}
 
-  // Determine if cluster is homogeneous, i.e., if every node has the same
-  // local_size
-  auto local_sizes = new int[size];
-  MPI_Allgather(&local_size, 1, MPI_INT, local_sizes, 1, MPI_INT,
-                state.mpi_comm);
+// Adds a tensor to the tensor table and its request to the message queue
+// without blocking on the background thread.
+Status EnqueueEntry(HorovodGlobalState& state, TensorTableEntry e,
+                    MPIRequest message) {
+  if (state.shut_down) {
+    return SHUT_DOWN_ERROR;
+  }
+  int64_t size = e.tensor->size();
+  e.enqueue_time = std::chrono::steady_clock::now();
+  if (!state.tensor_table.Insert(std::move(e))) {
+    return DUPLICATE_NAME_ERROR;
+  }
+  if (state.shut_down && state.tensor_table.Remove(message.tensor_name())) {
+    // The background thread shut down after the check above and won't
+    // process this request. If the entry is already gone, its callback has
+    // been called with the shutdown error.
+    return SHUT_DOWN_ERROR;
+  }
+  LOG(TRACE, state.rank) << "Enqueued " << message.tensor_name();
+  state.message_queue.Push(std::move(message));
+  NotifyTensorsEnqueued(state, size, 1);
+  return Status::OK();
+}
 
-  bool is_homogeneous = true;
-  for (int i = 0; i < size; ++i) {
-    if (local_sizes[i] != local_size) {
-      is_homogeneous = false;
-      break;
+// Adds a group of tensors to the tensor table and their requests to the
+// message queue at once, so that the background thread always takes them in
+// the same cycle. Either all or none of the tensors are enqueued.
+Status EnqueueEntries(HorovodGlobalState& state,
+                      std::vector<TensorTableEntry>& entries,
+                      std::vector<MPIRequest>& messages) {
+  if (state.shut_down) {
+    return SHUT_DOWN_ERROR;
+  }
+  int64_t size = 0;
+  auto enqueue_time = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < entries.size(); ++i) {
+    size += entries[i].tensor->size();
+    entries[i].enqueue_time = enqueue_time;
+    if (!state.tensor_table.Insert(std::move(entries[i]))) {
+      for (size_t j = 0; j < i; ++j) {
+        state.tensor_table.Remove(messages[j].tensor_name());
+      }
+      return DUPLICATE_NAME_ERROR;
+    }
+  }
+  if (state.shut_down) {
+    // See EnqueueEntry.
+    for (auto& message : messages) {
+      state.tensor_table.Remove(message.tensor_name());
     }
+    return SHUT_DOWN_ERROR;
+  }
+  int64_t count = (int64_t)messages.size();
+  LOG(TRACE, state.rank) << "Enqueued group of " << count << " tensors "
+                         << "starting with " << messages[0].tensor_name();
+  state.message_queue.Push(std::move(messages));
+  NotifyTensorsEnqueued(state, size, count);
+  return Status::OK();
+}
+
+// Only floating point data can be scaled by the prescale and postscale
+// factors of an allreduce.
+Status CheckScaleFactors(const TensorTableEntry& e) {
+  if (e.prescale_factor == 1.0 && e.postscale_factor == 1.0) {
+    return Status::OK();
+  }
+  auto dtype = e.tensor->dtype();
+  if (dtype != HOROVOD_FLOAT16 && dtype != HOROVOD_FLOAT32 &&
+      dtype != HOROVOD_FLOAT64) {
+    return Status::InvalidArgument(
+        "Allreduce of tensor " + e.tensor_name +
+        " can only be scaled for float16, float32 and float64 tensors.");
+  }
+  return Status::OK();
+}
+
+// Picks the compression of an allreduce entry and returns its request.
+MPIRequest PrepareAllreduce(HorovodGlobalState& state, TensorTableEntry& e) {
+  // Only float32 data is compressed. On GPU, compression is only done with
+  // NCCL, since MPI can't apply the float16 sum to device memory. Quantized
+  // data is only reduced on CPU.
+  if (e.tensor->dtype() != HOROVOD_FLOAT32) {
+    e.compression = NO_COMPRESSION;
   }
-  for (int i = 0; i < size; i += local_sizes[i]) {
-    state.local_sizes.push_back(local_sizes[i]);
+#if HOROVOD_GPU_ALLREDUCE != 'N'
+  if (e.device != CPU_DEVICE_ID) {
+    e.compression = NO_COMPRESSION;
+  }
+#endif
+  if (e.device != CPU_DEVICE_ID && e.compression != FP16_COMPRESSION) {
+    e.compression = NO_COMPRESSION;
   }
 
-  delete[] local_sizes;
-  state.is_homogeneous = is_homogeneous;
+  MPIRequest message;
+  message.set_request_rank(state.rank);
+  message.set_tensor_name(e.tensor_name);
+  message.set_tensor_type(e.tensor->dtype());
+  message.set_device(e.device);
+  message.set_request_type(MPIRequest::ALLREDUCE);
+  for (int i = 0; i < e.tensor->shape().dims(); ++i) {
+    message.add_tensor_shape((int64_t)e.tensor->shape().dim_size(i));
+  }
+  message.set_compression(e.compression);
+  message.set_priority(e.priority);
+  message.set_scope(e.scope);
+  return message;
+}
 
-  // Set up cross-communicator in case of hierarchical allreduce.
-  MPI_Comm cross_comm;
-  MPI_Comm_split(state.mpi_comm, local_rank, rank, &cross_comm);
-  int cross_rank, cross_size;
-  MPI_Comm_rank(cross_comm, &cross_rank);
-  MPI_Comm_size(cross_comm, &cross_size);
+// Returns the request of a broadcast entry.
+MPIRequest PrepareBroadcast(HorovodGlobalState& state, TensorTableEntry& e) {
+  MPIRequest message;
+  message.set_request_rank(state.rank);
+  message.set_tensor_name(e.tensor_name);
+  message.set_tensor_type(e.tensor->dtype());
+  message.set_root_rank(e.root_rank);
+  message.set_device(e.device);
+  message.set_request_type(MPIRequest::BROADCAST);
+  for (int i = 0; i < e.tensor->shape().dims(); ++i) {
+    message.add_tensor_shape((int64_t)e.tensor->shape().dim_size(i));
+  }
+  return message;
+}
 
-  // Create custom MPI float16 data type.
-  MPI_Datatype mpi_float16_t;
-  MPI_Type_contiguous(2, MPI_BYTE, &mpi_float16_t);
-  MPI_Type_commit(&mpi_float16_t);
+// Enqueues an entry, which is split into parts that are enqueued together if
+// its tensor is larger than the partition threshold.
+Status EnqueuePartitionedEntry(
+    HorovodGlobalState& state, TensorTableEntry e,
+    MPIRequest (*prepare)(HorovodGlobalState&, TensorTableEntry&)) {
+  auto parts = PartitionEntry(std::move(e), state.partition_threshold);
+  if (parts.size() == 1) {
+    MPIRequest message = prepare(state, parts[0]);
+    return EnqueueEntry(state, std::move(parts[0]), std::move(message));
+  }
+  std::vector<MPIRequest> messages;
+  messages.reserve(parts.size());
+  for (auto& part : parts) {
+    messages.push_back(prepare(state, part));
+  }
+  return EnqueueEntries(state, parts, messages);
+}
 
-  // Create custom MPI float16 summation op.
-  MPI_Op mpi_float16_sum;
-  MPI_Op_create(&float16_sum, 1, &mpi_float16_sum);
+// Queues an allreduce whose tensor is added to its accumulator by the
+// background thread.
+Status EnqueueAccumulation(HorovodGlobalState& state, TensorTableEntry e) {
+  auto dtype = e.tensor->dtype();
+  if (!AccumulationSupported(dtype) ||
+      (e.device != CPU_DEVICE_ID && dtype == HOROVOD_BFLOAT16)) {
+    return Status::InvalidArgument(
+        "Allreduce of tensor " + e.tensor_name + " can't accumulate " +
+        MPIDataType_Name(dtype) + " tensors.");
+  }
+  int64_t size = e.tensor->size();
+  {
+    // The queue is drained under the lock after shut_down is set.
+    std::lock_guard<std::mutex> guard(state.accumulation_mutex);
+    if (state.shut_down) {
+      return SHUT_DOWN_ERROR;
+    }
+    state.accumulation_queue.push_back(std::move(e));
+  }
+  NotifyTensorsEnqueued(state, size, 1);
+  return Status::OK();
+}
 
-  // Create custom datatypes for the parameter manager.
-  state.param_manager.CreateMpiTypes();
+#if HAVE_CUDA
+// Ready event of an accumulator, which completes once the last tensor has been
+// added to it.
+class AccumulatorReadyEvent : public ReadyEvent {
+public:
+  AccumulatorReadyEvent(cudaEvent_t event) : event_(event) {}
+  ~AccumulatorReadyEvent() { cudaEventDestroy(event_); }
+  bool Ready() const override {
+    return cudaEventQuery(event_) != cudaErrorNotReady;
+  }
+  cudaEvent_t CudaEvent() const override { return event_; }
 
-  state.rank = rank;
-  state.local_rank = local_rank;
-  state.cross_rank = cross_rank;
-  state.size = size;
-  state.local_size = local_size;
-  state.cross_size = cross_size;
-  state.local_comm = local_comm;
-  state.cross_comm = cross_comm;
-  state.mpi_float16_t = mpi_float16_t;
-  state.mpi_float16_sum = mpi_float16_sum;
-  state.mpi_threads_supported = (provided == MPI_THREAD_MULTIPLE);
-  state.local_comm_ranks = local_comm_ranks;
+private:
+  cudaEvent_t event_;
+};
 
-  // Open the timeline file on coordinator.
-  auto horovod_timeline = std::getenv(HOROVOD_TIMELINE);
-  if (is_coordinator && horovod_timeline != nullptr) {
-    state.timeline.Initialize(std::string(horovod_timeline),
-                              static_cast<unsigned int>(size));
+// Copies or adds the tensor of an entry to the buffer of its accumulator on
+// the first stream of its device.
+cudaError_t AccumulateOnGPU(HorovodGlobalState& state, TensorTableEntry& e,
+                            void* buffer, bool first, cudaStream_t* stream) {
+  auto status = cudaSetDevice(e.device);
+  if (status != cudaSuccess) {
+    return status;
   }
-
-  auto horovod_timeline_mark_cycles = std::getenv(HOROVOD_TIMELINE_MARK_CYCLES);
-  if (horovod_timeline_mark_cycles != nullptr &&
-      std::strtol(horovod_timeline_mark_cycles, nullptr, 10) > 0) {
-    state.mark_cycles_in_timeline = true;
+  *stream = state.streams[std::make_tuple(e.device, 0)];
+  if (*stream == nullptr) {
+    status = CreatePriorityStream(stream);
+    if (status != cudaSuccess) {
+      return status;
+    }
+    state.streams[std::make_tuple(e.device, 0)] = *stream;
   }
-
-  // Override Tensor Fusion threshold, if it's set.
-  state.param_manager.SetTensorFusionThresholdBytes(64 * 1024 * 1024);
-  auto horovod_fusion_threshold = std::getenv(HOROVOD_FUSION_THRESHOLD);
-  if (horovod_fusion_threshold != nullptr) {
-    int64_t threshold = std::strtol(horovod_fusion_threshold, nullptr, 10);
-    state.param_manager.SetTensorFusionThresholdBytes(threshold, true);
+  if (e.ready_event != nullptr) {
+    if (e.ready_event->CudaEvent() != nullptr) {
+      status = cudaStreamWaitEvent(*stream, e.ready_event->CudaEvent(), 0);
+      if (status != cudaSuccess) {
+        return status;
+      }
+    } else {
+      while (!e.ready_event->Ready()) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(100));
+      }
+    }
   }
-
-  // Override the cycle time.
-  state.param_manager.SetCycleTimeMs(5);
-  auto horovod_cycle_time = std::getenv(HOROVOD_CYCLE_TIME);
-  if (horovod_cycle_time != nullptr) {
-    state.param_manager.SetCycleTimeMs(std::strtof(horovod_cycle_time, nullptr),
-                                       true);
+  if (first) {
+    return cudaMemcpyAsync(buffer, e.tensor->data(), (size_t)e.tensor->size(),
+                           cudaMemcpyDeviceToDevice, *stream);
   }
+  return Accumulate(e.tensor->data(), buffer,
+                    e.tensor->shape().num_elements(), e.tensor->dtype(),
+                    *stream);
+}
+#endif
 
-  // Disable stall check.
-  auto horovod_stall_check_disable = std::getenv(HOROVOD_STALL_CHECK_DISABLE);
-  if (horovod_stall_check_disable != nullptr &&
-      std::strtol(horovod_stall_check_disable, nullptr, 10) > 0) {
-    state.perform_stall_check = false;
+// Hands an accumulating entry over to the finalizer thread, which calls its
+// callback with the status once the events of the completion are done. The
+// entry was never negotiated, so it is not ended in the timeline.
+void CompleteAccumulation(HorovodGlobalState& state, TensorTableEntry& e,
+                          Completion& completion) {
+  completion.entries.push_back(std::move(e));
+  {
+    std::lock_guard<std::mutex> guard(state.completion_mutex);
+    state.completion_queue.push(std::move(completion));
   }
+  state.completion_cv.notify_one();
+}
 
-  // Set flag for hierarchical allgather. Ignore if Horovod is running on a
-  // single node.
-  auto horovod_hierarchical_allgather =
-      std::getenv(HOROVOD_HIERARCHICAL_ALLGATHER);
-  state.param_manager.SetHierarchicalAllgather(false);
-  if (horovod_hierarchical_allgather != nullptr) {
-    bool value = std::strtol(horovod_hierarchical_allgather, nullptr, 10) > 0 &&
-                 (size != local_size);
-    state.param_manager.SetHierarchicalAllgather(value, true);
+void CompleteAccumulation(HorovodGlobalState& state, TensorTableEntry& e,
+                          const Status& status) {
+  Completion completion;
+  completion.status = status;
+  CompleteAccumulation(state, e, completion);
+}
+
+// Adds the tensor of an accumulating allreduce to its accumulator. Every
+// accumulation_steps-th entry of a tensor becomes an allreduce of the sum,
+// which is enqueued like any other allreduce, while the callbacks of the
+// other entries are called by the finalizer thread once their tensor has been
+// added, or has failed to. Returns false if the entry has to wait since the
+// previous sum is still being allreduced.
+bool PerformAccumulation(HorovodGlobalState& state, TensorTableEntry& e) {
+  auto& accumulator = state.accumulators[e.tensor_name];
+  if (*accumulator.reducing) {
+    return false;
   }
-  // Set flag for hierarchical allreduce. Ignore if Horovod is running on a
-  // single node.
-  auto horovod_hierarchical_allreduce =
-      std::getenv(HOROVOD_HIERARCHICAL_ALLREDUCE);
-  state.param_manager.SetHierarchicalAllreduce(false);
-  if (horovod_hierarchical_allreduce != nullptr) {
-    bool value = std::strtol(horovod_hierarchical_allreduce, nullptr, 10) > 0 &&
-                 (size != local_size);
-    state.param_manager.SetHierarchicalAllreduce(value, true);
+
+  auto dtype = e.tensor->dtype();
+  auto shape = e.tensor->shape();
+  if (accumulator.buffer == nullptr || accumulator.dtype != dtype ||
+      accumulator.shape != shape || accumulator.device != e.device) {
+    if (accumulator.steps > 0) {
+      CompleteAccumulation(
+          state, e,
+          Status::InvalidArgument(
+              "Tensor " + e.tensor_name + " was accumulated with a different "
+              "type, shape or device in previous steps."));
+      return true;
+    }
+    accumulator.buffer.reset();
+    Status status =
+        e.context->AllocatePersistent(e.tensor->size(), &accumulator.buffer);
+    if (!status.ok()) {
+      state.accumulators.erase(e.tensor_name);
+      CompleteAccumulation(state, e, status);
+      return true;
+    }
+    accumulator.dtype = dtype;
+    accumulator.shape = shape;
+    accumulator.size = e.tensor->size();
+    accumulator.device = e.device;
   }
 
-#if HOROVOD_GPU_ALLREDUCE != 'N' && HOROVOD_GPU_ALLREDUCE != 'D'
-  // Hierarchical allreduce is not supported without NCCL or DDL
-  state.param_manager.SetHierarchicalAllreduce(false, true);
+  auto buffer = (void*)accumulator.buffer->AccessData(e.context);
+  bool first = accumulator.steps == 0;
+  bool last = ++accumulator.steps >= e.accumulation_steps;
+  Completion completion;
+#if HAVE_CUDA
+  cudaEvent_t event = nullptr;
+  if (e.device != CPU_DEVICE_ID) {
+    cudaStream_t stream;
+    auto cuda_result = AccumulateOnGPU(state, e, buffer, first, &stream);
+    if (cuda_result == cudaSuccess) {
+      cuda_result = last ? cudaEventCreateWithFlags(&event,
+                                                    cudaEventDisableTiming)
+                         : GetCudaEvent(&event);
+    }
+    if (cuda_result == cudaSuccess) {
+      cuda_result = cudaEventRecord(event, stream);
+    }
+    if (cuda_result != cudaSuccess) {
+      accumulator.steps = 0;
+      CompleteAccumulation(state, e,
+                           Status::UnknownError(
+                               std::string("Accumulation failed: ") +
+                               cudaGetErrorString(cuda_result)));
+      return true;
+    }
+    if (!last) {
+      completion.device = e.device;
+      completion.event_queue.push(ActivityEvent{
+          "", event, state.timeline.TimeSinceStartMicros()});
+    }
+  } else {
 #endif
-
-  // Issue warning if hierarchical allreduce is enabled in heterogeneous cluster
-  if (is_coordinator &&
-      (state.param_manager.HierarchicalAllreduce() ||
-       state.param_manager.HierarchicalAllgather()) &&
-      !state.is_homogeneous) {
-    std::cerr
-        << "WARNING: Using different number of ranks per node might cause "
-           "performance loss in hierarchical allgather and "
-           "hierarchical allreduce. Consider assigning the same "
-           "number of ranks to each node, or disabling hierarchical "
-           "allgather and hierarchical allreduce.";
+    if (e.ready_event != nullptr) {
+      while (!e.ready_event->Ready()) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(100));
+      }
+    }
+    if (first) {
+      std::memcpy(buffer, e.tensor->data(), (size_t)e.tensor->size());
+    } else {
+      AccumulateOnCPU(e.tensor->data(), buffer, shape.num_elements(), dtype);
+    }
+#if HAVE_CUDA
   }
+#endif
 
-  // Enable auto-tuning.
-  auto horovod_autotune = std::getenv(HOROVOD_AUTOTUNE);
-  if (horovod_autotune != nullptr &&
-      std::strtol(horovod_autotune, nullptr, 10) > 0) {
-    auto horovod_autotune_log = std::getenv(HOROVOD_AUTOTUNE_LOG);
-    state.param_manager.Initialize(rank, RANK_ZERO, state.mpi_comm,
-                                   horovod_autotune_log != nullptr
-                                       ? std::string(horovod_autotune_log)
-                                       : "");
-    state.param_manager.SetAutoTuning(true);
+  if (!last) {
+    CompleteAccumulation(state, e, completion);
+    return true;
   }
 
-  // Initialize the tensor count table. No tensors are available yet.
-  if (is_coordinator) {
-    state.message_table = std::unique_ptr<MessageTable>(new MessageTable());
+  // Allreduce the sum. The next entry of the tensor waits until it is done.
+  accumulator.steps = 0;
+  auto reducing = accumulator.reducing;
+  *reducing = true;
+  auto callback = e.callback;
+  e.callback = [reducing, callback](const Status& status) {
+    *reducing = false;
+    callback(status);
+  };
+  e.tensor = std::make_shared<AccumulatorTensor>(accumulator, e.context);
+  e.ready_event = nullptr;
+#if HAVE_CUDA
+  if (event != nullptr) {
+    e.ready_event = std::make_shared<AccumulatorReadyEvent>(event);
+  }
+#endif
+  e.accumulation_steps = 1;
+  // Keeps the callback in case the sum can't be enqueued.
+  TensorTableEntry failed;
+  failed.tensor_name = e.tensor_name;
+  failed.callback = e.callback;
+  Status status =
+      EnqueuePartitionedEntry(state, std::move(e), PrepareAllreduce);
+  if (!status.ok()) {
+    CompleteAccumulation(state, failed, status);
   }
+  return true;
+}
 
-  // Signal that initialization is completed.
-  state.initialization_done = true;
+// Adds the tensors of all queued accumulating allreduces to their
+// accumulators. Entries of a tensor whose sum is still being allreduced stay
+// in the queue, in order, until the next cycle.
+void PerformAccumulations(HorovodGlobalState& state) {
+  std::vector<TensorTableEntry> entries;
+  {
+    std::lock_guard<std::mutex> guard(state.accumulation_mutex);
+    entries.swap(state.accumulation_queue);
+  }
+  if (entries.empty()) {
+    return;
+  }
+  std::vector<TensorTableEntry> waiting;
+  std::unordered_set<std::string> waiting_names;
+  for (auto& e : entries) {
+    if (waiting_names.find(e.tensor_name) != waiting_names.end() ||
+        !PerformAccumulation(state, e)) {
+      waiting_names.insert(e.tensor_name);
+      waiting.push_back(std::move(e));
+    }
+  }
+  if (!waiting.empty()) {
+    std::lock_guard<std::mutex> guard(state.accumulation_mutex);
+    for (auto& e : state.accumulation_queue) {
+      waiting.push_back(std::move(e));
+    }
+    state.accumulation_queue.swap(waiting);
+  }
+}
 
-  LOG(INFO, rank) << "Horovod Initialized";
+// Queues an allreduce of a tensor with replicas on several GPUs, which the
+// background thread collects until all replicas are there.
+Status EnqueueReplica(HorovodGlobalState& state, TensorTableEntry e) {
+  int64_t size = e.tensor->size();
+  {
+    // The queue is drained under the lock after shut_down is set.
+    std::lock_guard<std::mutex> guard(state.replica_mutex);
+    if (state.shut_down) {
+      return SHUT_DOWN_ERROR;
+    }
+    state.replica_queue.push_back(std::move(e));
+  }
+  NotifyTensorsEnqueued(state, size, 1);
+  return Status::OK();
+}
 
-  // Iterate until shutdown.
-  while (RunLoopOnce(state, is_coordinator))
-    ;
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+// Returns the communicators and streams of a set of local GPUs, creating them
+// on first use.
+Status GetLocalDeviceGroup(HorovodGlobalState& state,
+                           const std::vector<int>& devices,
+                           LocalDeviceGroup*& group) {
+  auto& slot = state.local_device_groups[devices];
+  if (slot != nullptr) {
+    group = slot.get();
+    return Status::OK();
+  }
+  std::unique_ptr<LocalDeviceGroup> new_group(new LocalDeviceGroup());
+  new_group->devices = devices;
+  auto count = devices.size();
+  new_group->reduce_comms.resize(count);
+  new_group->broadcast_comms.resize(count);
+  for (auto comms : {&new_group->reduce_comms, &new_group->broadcast_comms}) {
+    auto nccl_result =
+        ncclCommInitAll(comms->data(), (int)count, devices.data());
+    if (nccl_result != ncclSuccess) {
+      state.local_device_groups.erase(devices);
+      return Status::UnknownError(std::string("ncclCommInitAll failed: ") +
+                                  ncclGetErrorString(nccl_result));
+    }
+  }
+  for (auto device : devices) {
+    cudaStream_t reduce_stream, broadcast_stream;
+    auto cuda_result = cudaSetDevice(device);
+    if (cuda_result == cudaSuccess) {
+      cuda_result = CreatePriorityStream(&reduce_stream);
+    }
+    if (cuda_result == cudaSuccess) {
+      cuda_result = CreatePriorityStream(&broadcast_stream);
+    }
+    if (cuda_result != cudaSuccess) {
+      state.local_device_groups.erase(devices);
+      return Status::UnknownError(
+          std::string("Creating the streams of local replicas failed: ") +
+          cudaGetErrorString(cuda_result));
+    }
+    new_group->reduce_streams.push_back(reduce_stream);
+    new_group->broadcast_streams.push_back(broadcast_stream);
+  }
+  group = new_group.get();
+  slot = std::move(new_group);
+  return Status::OK();
+}
 
-  LOG(DEBUG, rank) << "Shutting down background thread";
+// Sums up the replicas of a tensor, ordered by device, into the buffer of the
+// sum on the first device. Records the completion of the sum in event.
+Status ReduceReplicas(LocalDeviceGroup& group,
+                      std::vector<TensorTableEntry>& replicas, void* buffer,
+                      cudaEvent_t* event) {
+  auto& first = replicas[0];
+  auto count = (size_t)first.tensor->shape().num_elements();
+  ncclDataType_t dtype;
+  try {
+    dtype = GetNCCLDataType(first.tensor);
+  } catch (const std::logic_error& ex) {
+    return Status::InvalidArgument(ex.what());
+  }
+  for (size_t i = 0; i < replicas.size(); ++i) {
+    auto& e = replicas[i];
+    auto cuda_result = cudaSetDevice(e.device);
+    if (cuda_result == cudaSuccess && e.ready_event != nullptr) {
+      if (e.ready_event->CudaEvent() != nullptr) {
+        cuda_result = cudaStreamWaitEvent(group.reduce_streams[i],
+                                          e.ready_event->CudaEvent(), 0);
+      } else {
+        while (!e.ready_event->Ready()) {
+          std::this_thread::sleep_for(std::chrono::nanoseconds(100));
+        }
+      }
+    }
+    if (cuda_result != cudaSuccess) {
+      return Status::UnknownError(std::string("cudaStreamWaitEvent failed: ") +
+                                  cudaGetErrorString(cuda_result));
+    }
+  }
 
-  // Signal that shutdown has been requested.
-  state.shut_down = true;
+  ncclGroupStart();
+  for (size_t i = 0; i < replicas.size(); ++i) {
+    auto nccl_result =
+        ncclReduce(replicas[i].tensor->data(), i == 0 ? buffer : nullptr,
+                   count, dtype, ncclSum, 0, group.reduce_comms[i],
+                   group.reduce_streams[i]);
+    if (nccl_result != ncclSuccess) {
+      ncclGroupEnd();
+      return Status::UnknownError(std::string("ncclReduce failed: ") +
+                                  ncclGetErrorString(nccl_result));
+    }
+  }
+  auto nccl_result = ncclGroupEnd();
+  if (nccl_result != ncclSuccess) {
+    return Status::UnknownError(std::string("ncclReduce failed: ") +
+                                ncclGetErrorString(nccl_result));
+  }
 
-  // TODO: init.cu:645 WARN Cuda failure 'driver shutting down'
-  //#if HAVE_NCCL
-  //  for (auto it = horovod_global.streams.begin();
-  //       it != horovod_global.streams.end(); ++it) {
-  //    cudaStreamSynchronize(it->second);
-  //  }
-  //  for (auto it = horovod_global.nccl_comms.begin();
-  //       it != horovod_global.nccl_comms.end(); ++it) {
-  //    ncclCommDestroy(it->second);
-  //  }
-  //#endif
+  auto cuda_result = cudaSetDevice(first.device);
+  if (cuda_result == cudaSuccess) {
+    cuda_result = cudaEventCreateWithFlags(event, cudaEventDisableTiming);
+  }
+  if (cuda_result == cudaSuccess) {
+    cuda_result = cudaEventRecord(*event, group.reduce_streams[0]);
+  }
+  if (cuda_result != cudaSuccess) {
+    return Status::UnknownError(std::string("Recording the local sum failed: ") +
+                                cudaGetErrorString(cuda_result));
+  }
+  return Status::OK();
+}
 
-  // Notify all outstanding operations that Horovod has been shut down
-  // and clear up the tensor table and message queue.
-  std::vector<StatusCallback> callbacks;
-  {
-    std::lock_guard<std::mutex> guard(state.mutex);
-    for (auto& e : state.tensor_table) {
-      callbacks.emplace_back(e.second.callback);
+// Broadcasts the allreduced output of the first replica of a tensor into the
+// outputs of the other replicas, and waits until it is done. Called by the
+// finalizer thread.
+Status BroadcastReplicas(LocalDeviceGroup& group,
+                         const std::shared_ptr<Tensor>& output,
+                         std::vector<TensorTableEntry>& others) {
+  auto count = (size_t)output->shape().num_elements();
+  ncclDataType_t dtype;
+  try {
+    dtype = GetNCCLDataType(output);
+  } catch (const std::logic_error& ex) {
+    return Status::InvalidArgument(ex.what());
+  }
+  ncclGroupStart();
+  for (size_t i = 0; i < group.devices.size(); ++i) {
+    auto recvbuff =
+        i == 0 ? (void*)output->data() : (void*)others[i - 1].output->data();
+    auto nccl_result =
+        ncclBroadcast(output->data(), recvbuff, count, dtype, 0,
+                      group.broadcast_comms[i], group.broadcast_streams[i]);
+    if (nccl_result != ncclSuccess) {
+      ncclGroupEnd();
+      return Status::UnknownError(std::string("ncclBroadcast failed: ") +
+                                  ncclGetErrorString(nccl_result));
+    }
+  }
+  auto nccl_result = ncclGroupEnd();
+  if (nccl_result != ncclSuccess) {
+    return Status::UnknownError(std::string("ncclBroadcast failed: ") +
+                                ncclGetErrorString(nccl_result));
+  }
+  for (size_t i = 0; i < group.devices.size(); ++i) {
+    auto cuda_result = cudaSetDevice(group.devices[i]);
+    if (cuda_result == cudaSuccess) {
+      cuda_result = cudaStreamSynchronize(group.broadcast_streams[i]);
     }
-    state.tensor_table.clear();
-    while (!state.message_queue.empty()) {
-      state.message_queue.pop();
+    if (cuda_result != cudaSuccess) {
+      return Status::UnknownError(std::string("ncclBroadcast failed: ") +
+                                  cudaGetErrorString(cuda_result));
     }
   }
-  for (auto& cb : callbacks) {
-    cb(SHUT_DOWN_ERROR);
+  return Status::OK();
+}
+#endif
+
+// Hands replicas over to the finalizer thread, which calls their callbacks
+// with the status. The replicas were never negotiated, so they are not ended
+// in the timeline.
+void CompleteReplicas(HorovodGlobalState& state,
+                      std::vector<TensorTableEntry>& replicas,
+                      const Status& status) {
+  Completion completion;
+  completion.entries = std::move(replicas);
+  completion.status = status;
+  {
+    std::lock_guard<std::mutex> guard(state.completion_mutex);
+    state.completion_queue.push(std::move(completion));
   }
+  state.completion_cv.notify_one();
+}
 
-  if (horovod_global.shared_buffer != nullptr) {
-    MPI_Win_free(&horovod_global.window);
-    horovod_global.shared_buffer = nullptr;
+// Sums up the complete set of replicas of a tensor on the GPUs of this
+// process and enqueues the allreduce of the sum in place of the first replica.
+// Once the sum has been allreduced, it is broadcast into the outputs of all
+// replicas before their callbacks are called. Returns false if the previous
+// sum of the tensor is still being allreduced.
+bool PerformLocalReduction(HorovodGlobalState& state,
+                           std::vector<TensorTableEntry>& replicas) {
+  auto& accumulator = state.replica_sums[replicas[0].tensor_name];
+  if (*accumulator.reducing) {
+    return false;
   }
+  std::sort(replicas.begin(), replicas.end(),
+            [](const TensorTableEntry& a, const TensorTableEntry& b) {
+              return a.device < b.device;
+            });
+  auto fail = [&state, &replicas](const Status& status) {
+    CompleteReplicas(state, replicas, status);
+    return true;
+  };
 
-  if (horovod_global.mpi_comm != MPI_COMM_NULL &&
-      horovod_global.mpi_comm != MPI_COMM_WORLD) {
-    MPI_Comm_free(&horovod_global.mpi_comm);
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+  auto& first = replicas[0];
+  auto dtype = first.tensor->dtype();
+  auto shape = first.tensor->shape();
+  if (accumulator.buffer == nullptr || accumulator.dtype != dtype ||
+      accumulator.shape != shape || accumulator.device != first.device) {
+    accumulator.buffer.reset();
+    Status status = first.context->AllocatePersistent(first.tensor->size(),
+                                                      &accumulator.buffer);
+    if (!status.ok()) {
+      state.replica_sums.erase(first.tensor_name);
+      return fail(status);
+    }
+    accumulator.dtype = dtype;
+    accumulator.shape = shape;
+    accumulator.size = first.tensor->size();
+    accumulator.device = first.device;
   }
 
-  if (horovod_global.local_comm != MPI_COMM_NULL) {
-    MPI_Comm_free(&horovod_global.local_comm);
+  std::vector<int> devices;
+  for (auto& e : replicas) {
+    devices.push_back(e.device);
+  }
+  LocalDeviceGroup* group;
+  Status status = GetLocalDeviceGroup(state, devices, group);
+  cudaEvent_t event = nullptr;
+  if (status.ok()) {
+    status = ReduceReplicas(
+        *group, replicas, (void*)accumulator.buffer->AccessData(first.context),
+        &event);
+  }
+  if (!status.ok()) {
+    if (event != nullptr) {
+      cudaEventDestroy(event);
+    }
+    return fail(status);
   }
 
-  if (horovod_global.cross_comm != MPI_COMM_NULL) {
-    MPI_Comm_free(&horovod_global.cross_comm);
+  // Allreduce the sum. The next replicas of the tensor wait until it is done.
+  auto reducing = accumulator.reducing;
+  *reducing = true;
+  auto output = first.output;
+  auto callback = first.callback;
+  auto others = std::make_shared<std::vector<TensorTableEntry>>();
+  for (size_t i = 1; i < replicas.size(); ++i) {
+    others->push_back(std::move(replicas[i]));
   }
+  TensorTableEntry e = std::move(first);
+  e.callback = [reducing, group, output, callback,
+                others](const Status& status) {
+    *reducing = false;
+    Status result = status;
+    if (result.ok()) {
+      result = BroadcastReplicas(*group, output, *others);
+    }
+    callback(result);
+    for (auto& other : *others) {
+      other.callback(result);
+    }
+  };
+  e.tensor = std::make_shared<AccumulatorTensor>(accumulator, e.context);
+  e.ready_event = std::make_shared<AccumulatorReadyEvent>(event);
+  e.local_replicas = 1;
+  // Keeps the callback in case the sum can't be enqueued.
+  std::vector<TensorTableEntry> failed(1);
+  failed[0].tensor_name = e.tensor_name;
+  failed[0].callback = e.callback;
+  status = EnqueuePartitionedEntry(state, std::move(e), PrepareAllreduce);
+  if (!status.ok()) {
+    CompleteReplicas(state, failed, status);
+  }
+  return true;
+#else
+  return fail(
+      Status::PreconditionError("Allreduce of local replicas needs NCCL."));
+#endif
+}
 
-  if (horovod_global.mpi_float16_t != MPI_DATATYPE_NULL) {
-    MPI_Type_free(&horovod_global.mpi_float16_t);
+// Collects the queued replicas of all tensors and enqueues the allreduces of
+// the tensors whose replicas are complete. Replicas of a tensor whose
+// previous replicas are still waiting stay in the queue until the next cycle.
+void PerformLocalReductions(HorovodGlobalState& state) {
+  std::vector<TensorTableEntry> entries;
+  {
+    std::lock_guard<std::mutex> guard(state.replica_mutex);
+    entries.swap(state.replica_queue);
+  }
+  if (entries.empty() && state.replicas.empty()) {
+    return;
+  }
+  std::vector<TensorTableEntry> waiting;
+  for (auto& e : entries) {
+    auto& replicas = state.replicas[e.tensor_name];
+    if ((int32_t)replicas.size() == e.local_replicas) {
+      waiting.push_back(std::move(e));
+      continue;
+    }
+    if (!replicas.empty()) {
+      auto& first = replicas[0];
+      bool same_device = false;
+      for (auto& replica : replicas) {
+        same_device = same_device || replica.device == e.device;
+      }
+      if (same_device || first.local_replicas != e.local_replicas ||
+          first.tensor->dtype() != e.tensor->dtype() ||
+          first.tensor->shape() != e.tensor->shape()) {
+        auto status = Status::InvalidArgument(
+            "Replicas of tensor " + e.tensor_name + " need the same type, "
+            "shape and number of replicas, and must be on different GPUs.");
+        std::vector<TensorTableEntry> invalid;
+        invalid.push_back(std::move(e));
+        CompleteReplicas(state, invalid, status);
+        continue;
+      }
+    }
+    replicas.push_back(std::move(e));
   }
 
-  if (horovod_global.mpi_float16_sum != MPI_OP_NULL) {
-    MPI_Op_free(&horovod_global.mpi_float16_sum);
+  for (auto iter = state.replicas.begin(); iter != state.replicas.end();) {
+    auto& replicas = iter->second;
+    if (!replicas.empty() &&
+        ((int32_t)replicas.size() < replicas[0].local_replicas ||
+         !PerformLocalReduction(state, replicas))) {
+      ++iter;
+    } else {
+      iter = state.replicas.erase(iter);
+    }
   }
 
-  horovod_global.param_manager.FreeMpiTypes();
-
-  if (horovod_global.should_finalize) {
-#if HAVE_DDL
-    // ddl_finalize calls MPI_Finalize
-    ddl_finalize();
-#else
-    int is_mpi_finalized = 0;
-    MPI_Finalized(&is_mpi_finalized);
-    if (!is_mpi_finalized) {
-      MPI_Finalize();
+  if (!waiting.empty()) {
+    std::lock_guard<std::mutex> guard(state.replica_mutex);
+    for (auto& e : state.replica_queue) {
+      waiting.push_back(std::move(e));
     }
-#endif
+    state.replica_queue.swap(waiting);
   }
 }
 
@@ -2027,15 +7152,28 @@ void BackgroundThreadLoop(HorovodGlobalState& state) {
 //      response from the coordinator. At that point, the tick ends.
 //      If instead of "DONE" they receive "SHUTDOWN", they exit their background
 //      loop.
+//
+// Ticks start every cycle time. If a byte or tensor count watermark is set,
+// the background thread is woken up as soon as that much data has been
+// enqueued, so that small latency-sensitive operations do not have to wait
+// for the end of the cycle.
+//
+// If the response cache is enabled, all ranks first exchange a bit vector of
+// the cached responses they have requests for. Tensors requested by all ranks
+// are processed straight from the cache, and steps a) to e) are only done
+// when some rank has a request that is not cached.
 bool RunLoopOnce(HorovodGlobalState& state, bool is_coordinator) {
   // This delay determines thread frequency and MPI message latency
-  auto start_time = std::chrono::steady_clock::now();
-  auto sleep_duration = state.last_cycle_start +
-                        std::chrono::microseconds(
-                            long(state.param_manager.CycleTimeMs() * 1000.)) -
-                        start_time;
-  if (sleep_duration > std::chrono::steady_clock::duration::zero()) {
-    std::this_thread::sleep_for(sleep_duration);
+  auto cycle_end = state.last_cycle_start +
+                   std::chrono::microseconds(
+                       long(state.param_manager.CycleTimeMs() * 1000.));
+  {
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.wakeup_threshold_bytes =
+        state.param_manager.CycleWakeupThresholdBytes();
+    state.wakeup_cv.wait_until(lock, cycle_end, [&state]() {
+      return state.shut_down || CycleWakeupThresholdReached(state);
+    });
   }
   state.last_cycle_start = std::chrono::steady_clock::now();
 
@@ -2044,336 +7182,202 @@ bool RunLoopOnce(HorovodGlobalState& state, bool is_coordinator) {
     state.timeline.MarkCycleStart();
   }
 
-  // Copy the data structures from global state under this lock.
-  // However, don't keep the lock for the rest of the loop, so that
-  // enqueued stream callbacks can continue.
-  std::queue<MPIRequest> message_queue;
-  {
-    std::lock_guard<std::mutex> guard(state.mutex);
-    while (!state.message_queue.empty()) {
-      MPIRequest message = state.message_queue.front();
-      state.message_queue.pop();
-      message_queue.push(message);
-    }
-  }
-
-  if (!message_queue.empty()) {
-    LOG(DEBUG, state.rank) << "Sent " << message_queue.size() << " messages";
-  }
+  // Take all the requests enqueued so far. Framework threads can keep
+  // enqueueing while the rest of the loop runs. Accumulated allreduces whose
+  // last step has come are enqueued first.
+  state.enqueued_bytes = 0;
+  state.enqueued_tensors = 0;
+  PerformAccumulations(state);
+  PerformLocalReductions(state);
+  std::deque<MPIRequest> message_queue;
+  state.message_queue.PopAll(message_queue);
+  auto negotiation_start = std::chrono::steady_clock::now();
 
   // Flag indicating that the background thread should shut down.
   bool should_shut_down = state.shut_down;
 
-  // Collect all tensors that are ready to be reduced. Record them in the
-  // tensor count table (rank zero) or send them to rank zero to be
-  // recorded (everyone else).
-  std::vector<std::string> ready_to_reduce;
-  if (is_coordinator) {
-    while (!message_queue.empty()) {
-      // Pop the first available message message
-      MPIRequest message = message_queue.front();
-      message_queue.pop();
-
-      bool reduce =
-          IncrementTensorCount(state.message_table, message, state.size);
-      if (reduce) {
-        ready_to_reduce.push_back(message.tensor_name());
-      }
-    }
-
-    // Rank zero has put all its own tensors in the tensor count table.
-    // Now, it should count all the tensors that are coming from other
-    // ranks at this tick.
+  std::deque<MPIResponse> cached_responses;
+  bool need_communication = true;
+  if (state.response_cache.capacity() > 0) {
+    need_communication = CoordinateCache(state, message_queue,
+                                         cached_responses, should_shut_down);
+  }
 
-    // 1. Get message lengths from every rank.
-    auto recvcounts = new int[state.size];
-    recvcounts[0] = 0;
-    MPI_Gather(MPI_IN_PLACE, 1, MPI_INT, recvcounts, 1, MPI_INT, RANK_ZERO,
-               state.mpi_comm);
+  if (!message_queue.empty()) {
+    LOG(DEBUG, state.rank) << "Sent " << message_queue.size() << " messages";
+  }
 
-    // 2. Compute displacements.
-    auto displcmnts = new int[state.size];
-    size_t total_size = 0;
-    for (int i = 0; i < state.size; ++i) {
-      if (i == 0) {
-        displcmnts[i] = 0;
-      } else {
-        displcmnts[i] = recvcounts[i - 1] + displcmnts[i - 1];
-      }
-      total_size += recvcounts[i];
+  MPIResponseList response_list;
+  if (!need_communication) {
+    // Every rank has only cached requests, so all ranks can build the same
+    // responses without talking to the coordinator.
+    response_list = FuseResponses(cached_responses, state);
+    response_list.set_shutdown(should_shut_down);
+  } else {
+    MPIRequestList message_list;
+    message_list.set_shutdown(should_shut_down);
+    for (auto& message : message_queue) {
+      message_list.emplace_request(std::move(message));
     }
 
-    // 3. Collect messages from every rank.
-    auto buffer = new uint8_t[total_size];
-    MPI_Gatherv(nullptr, 0, MPI_BYTE, buffer, recvcounts, displcmnts, MPI_BYTE,
-                RANK_ZERO, state.mpi_comm);
-
-    // 4. Process messages.
-    for (int i = 1; i < state.size; ++i) {
-      auto rank_buffer_ptr = buffer + displcmnts[i];
-      MPIRequestList received_message_list;
-      MPIRequestList::ParseFromBytes(received_message_list, rank_buffer_ptr);
-      for (auto& received_message : received_message_list.requests()) {
-        auto& received_name = received_message.tensor_name();
-
-        bool reduce = IncrementTensorCount(state.message_table,
-                                           received_message, state.size);
-        if (reduce) {
-          ready_to_reduce.push_back(received_name);
+    if (state.hierarchical_negotiation) {
+      // Requests are first collected by the local root of every node, and
+      // only local roots talk to the coordinator. Responses fan out the same
+      // way.
+      auto request_lists =
+          GatherRequestLists(message_list, state.local_comm, state.tensor_ids);
+      if (state.local_rank == 0) {
+        request_lists.insert(request_lists.begin(), std::move(message_list));
+        MPIRequestList node_list = AggregateLocalRequests(state, request_lists);
+        auto node_lists =
+            GatherRequestLists(node_list, state.cross_comm, state.tensor_ids);
+        if (is_coordinator) {
+          node_lists.insert(node_lists.begin(), std::move(node_list));
+          response_list = ConstructResponseList(state, node_lists,
+                                                cached_responses,
+                                                should_shut_down);
         }
+        BroadcastResponseList(response_list, state.cross_comm,
+                              state.tensor_ids);
       }
-      if (received_message_list.shutdown()) {
-        // Received SHUTDOWN request from one of the workers.
-        should_shut_down = true;
+      BroadcastResponseList(response_list, state.local_comm, state.tensor_ids);
+    } else {
+      auto request_lists =
+          GatherRequestLists(message_list, state.mpi_comm, state.tensor_ids);
+      if (is_coordinator) {
+        request_lists.insert(request_lists.begin(), std::move(message_list));
+        response_list = ConstructResponseList(state, request_lists,
+                                              cached_responses,
+                                              should_shut_down);
       }
-    }
 
-    // 5. Free buffers.
-    delete[] recvcounts;
-    delete[] displcmnts;
-    delete[] buffer;
-
-    // At this point, rank zero should have a fully updated tensor count
-    // table and should know all the tensors that need to be reduced or
-    // gathered, and everyone else should have sent all their information
-    // to rank zero. We can now do reductions and gathers; rank zero will
-    // choose which ones and in what order, and will notify the other ranks
-    // before doing each reduction.
-    std::deque<MPIResponse> responses;
-    for (auto& tensor_name : ready_to_reduce) {
-      MPIResponse response =
-          ConstructMPIResponse(state.message_table, tensor_name);
-      responses.push_back(std::move(response));
+      // Notify all nodes which tensors we'd like to reduce at this step.
+      BroadcastResponseList(response_list, state.mpi_comm, state.tensor_ids);
     }
+  }
 
-    MPIResponseList response_list;
-    response_list.set_shutdown(should_shut_down);
-    {
-      // Protect access to tensor table.
-      std::lock_guard<std::mutex> guard(horovod_global.mutex);
-      while (!responses.empty()) {
-
-        auto response = responses.front();
-        assert(response.tensor_names().size() == 1);
-        responses.pop_front();
-        int64_t tensor_size = 0;
-        if (response.response_type() == MPIResponse::ResponseType::ALLREDUCE) {
-          // Attempt to add more responses to this fused response.
-          auto& entry = state.tensor_table[response.tensor_names()[0]];
-          tensor_size = entry.tensor->size();
-
-          std::deque<MPIResponse> skipped_responses;
-          int64_t skipped_size = 0;
-          while (!responses.empty()) {
-            auto new_response = responses.front();
-            assert(new_response.tensor_names().size() == 1);
-            auto& new_entry =
-                state.tensor_table[new_response.tensor_names()[0]];
-            int64_t new_tensor_size = new_entry.tensor->size();
-
-            if (response.response_type() == new_response.response_type() &&
-                response.devices() == new_response.devices() &&
-                entry.tensor->dtype() == new_entry.tensor->dtype() &&
-                tensor_size + new_tensor_size <= TensorFusionThresholdBytes()) {
-              // These tensors will fuse together well.
-              tensor_size += new_tensor_size;
-              response.add_tensor_name(new_response.tensor_names()[0]);
-              responses.pop_front();
-            } else {
-              // In general, don't try to fuse additional tensors since they are usually
-              // computed in order of requests and skipping tensors may mean
-              // that the batch will have to wait longer while skipped tensors
-              // could be reduced at that time. However, mixed-precision training may yield
-              // requests of various dtype in a mixed-up sequence causing breakups
-              // in fusion. To counter this some look ahead is allowed.
-
-              skipped_size += new_tensor_size;
-              if (tensor_size + skipped_size <= TensorFusionThresholdBytes()) {
-                // Skip response and look ahead for more to fuse.
-                skipped_responses.push_back(std::move(responses.front()));
-                responses.pop_front();
-              } else {
-                break;
-              }
-            }
-          }
-
-          // Replace any skipped responses.
-          while (!skipped_responses.empty()) {
-            responses.push_front(std::move(skipped_responses.back()));
-            skipped_responses.pop_back();
-          }
-
-        } else if (response.response_type() ==
-                   MPIResponse::ResponseType::ALLGATHER) {
-          // Attempt to add more responses to this fused response.
-          auto& entry = state.tensor_table[response.tensor_names()[0]];
-
-          // This is size of first dimension.
-          int64_t total_byte_size_of_output =
-              TotalByteSizeOfAllgatherOutput(response.tensor_sizes(), entry);
-
-          std::deque<MPIResponse> skipped_responses;
-          int64_t skipped_size = 0;
-          while (!responses.empty()) {
-
-            auto new_response = responses.front();
-            assert(new_response.tensor_names().size() == 1);
-            auto& new_entry =
-                state.tensor_table[new_response.tensor_names()[0]];
-
-            int64_t new_total_byte_size_of_output =
-                TotalByteSizeOfAllgatherOutput(new_response.tensor_sizes(),
-                                               new_entry);
-
-            if (response.response_type() == new_response.response_type() &&
-                response.devices() == new_response.devices() &&
-                entry.tensor->dtype() == new_entry.tensor->dtype() &&
-                total_byte_size_of_output + new_total_byte_size_of_output <=
-                    TensorFusionThresholdBytes()) {
-
-              // These tensors will fuse together well.
-              total_byte_size_of_output += new_total_byte_size_of_output;
-              response.add_allgather_response(new_response);
-              responses.pop_front();
-
-            } else {
-              // In general, don't try to fuse additional tensors since they are usually
-              // computed in order of requests and skipping tensors may mean
-              // that the batch will have to wait longer while skipped tensors
-              // could be reduced at that time. However, mixed-precision training may yield
-              // requests of various dtype in a mixed-up sequence causing breakups
-              // in fusion. To counter this some look ahead is allowed.
-
-              skipped_size += new_total_byte_size_of_output;
-              if (total_byte_size_of_output + skipped_size <=
-                      TensorFusionThresholdBytes()) {
-                // Skip response and look ahead for more to fuse.
-                skipped_responses.push_back(std::move(responses.front()));
-                responses.pop_front();
-              } else {
-                break;
-              }
-            }
-          }
-
-          // Replace any skipped responses.
-          while (!skipped_responses.empty()) {
-            responses.push_front(std::move(skipped_responses.back()));
-            skipped_responses.pop_back();
-          }
-
-        }
+  if (response_list.shutdown()) {
+    should_shut_down = true;
+  }
 
-        response_list.add_response(response);
-        LOG(DEBUG) << "Created response of size " << tensor_size;
+  if (state.response_cache.capacity() > 0) {
+    // All ranks add the responses to the cache in the same order, which keeps
+    // the caches and cache bits identical across ranks. This has to happen
+    // before the entries are removed from the tensor table below.
+    // Sparse allreduces aren't cached since their number of rows usually
+    // changes every step.
+    for (auto& response : response_list.responses()) {
+      if (response.response_type() == MPIResponse::ERROR ||
+          response.response_type() == MPIResponse::SPARSE_ALLREDUCE ||
+          (int)response.devices().size() != state.size) {
+        continue;
       }
-    }
-
-    if (!response_list.responses().empty()) {
-      std::string tensors_ready;
-      for (auto r : response_list.responses()) {
-        tensors_ready += r.tensor_names_string() + "; " ;
+      std::vector<TensorParams> params;
+      for (auto& tensor_name : response.tensor_names()) {
+        params.push_back(GetTensorParams(state.tensor_table.Get(tensor_name),
+                                         response.response_type()));
       }
-      LOG(TRACE) << "Sending ready responses as " << tensors_ready;
+      state.response_cache.put(response, params);
     }
+    state.response_cache.update_cache_bits();
+  }
 
-    // Notify all nodes which tensors we'd like to reduce at this step.
-    std::string encoded_response;
-    MPIResponseList::SerializeToString(response_list, encoded_response);
-    int encoded_response_length = (int)encoded_response.length() + 1;
-    MPI_Bcast(&encoded_response_length, 1, MPI_INT, RANK_ZERO, state.mpi_comm);
-    MPI_Bcast((void*)encoded_response.c_str(), encoded_response_length,
-              MPI_BYTE, RANK_ZERO, state.mpi_comm);
-
-    std::vector<std::string> tensor_names;
-    int64_t total_tensor_size = 0;
-    if (state.param_manager.IsAutoTuning()) {
-      for (auto& response : response_list.responses()) {
-        if (response.response_type() == MPIResponse::ResponseType::ALLREDUCE) {
-          for (auto& tensor_name : response.tensor_names()) {
-            tensor_names.push_back(tensor_name);
-            auto& entry = state.tensor_table[tensor_name];
-            total_tensor_size += entry.tensor->size();
-          }
-        }
-      }
-    }
+  state.metrics.negotiation_micros.Record(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - negotiation_start)
+          .count());
+  if (!response_list.responses().empty()) {
+    state.metrics.responses_per_cycle.Record(
+        (int64_t)response_list.responses().size());
+  }
 
-    // Perform the collective operation. All nodes should end up performing
-    // the same operation.
+  std::vector<std::string> tensor_names;
+  int64_t total_tensor_size = 0;
+  if (state.param_manager.IsObserving()) {
     for (auto& response : response_list.responses()) {
-      LOG(TRACE, state.rank) << "Performing " << response.tensor_names_string();
-      LOG(DEBUG, state.rank) << "Processing " << response.tensor_names().size() << " tensors";
-      PerformOperation(state.tensor_table, response);
-      LOG(TRACE, state.rank) << "Finished performing " << response.tensor_names_string();
+      if (response.response_type() == MPIResponse::ResponseType::ALLREDUCE) {
+        for (auto& tensor_name : response.tensor_names()) {
+          tensor_names.push_back(tensor_name);
+          auto& entry = state.tensor_table.Get(tensor_name);
+          total_tensor_size += entry.tensor->size();
+        }
+      }
     }
+  }
 
-    // Check for stalled tensors.
-    if (state.perform_stall_check &&
-        std::chrono::steady_clock::now() - state.last_stall_check >
-            STALL_WARNING_TIME) {
-      CheckForStalledTensors(state);
-      state.last_stall_check = std::chrono::steady_clock::now();
+  // Perform the collective operation. All nodes should end up performing
+  // the same operation.
+  for (auto& response : response_list.responses()) {
+    if (LogLevelEnabled(LogLevel::TRACE)) {
+      LOG(TRACE, state.rank)
+          << "Performing " << response.tensor_names_string();
     }
-
-    if (state.param_manager.IsAutoTuning()) {
-      state.param_manager.Update(tensor_names, total_tensor_size);
+    LOG(DEBUG, state.rank) << "Processing " << response.tensor_names().size()
+                           << " tensors";
+    // The auto-tuner times allreduces and allgathers by size to choose their
+    // algorithms.
+    bool record_operation =
+        state.param_manager.IsAutoTuning() &&
+        (response.response_type() == MPIResponse::ALLREDUCE ||
+         response.response_type() == MPIResponse::ALLGATHER);
+    auto operation_start = std::chrono::steady_clock::now();
+    PerformOperation(state.tensor_table, response);
+    if (record_operation) {
+      state.param_manager.RecordOperation(
+          response.response_type() == MPIResponse::ALLREDUCE
+              ? ParameterManager::ALLREDUCE_OP
+              : ParameterManager::ALLGATHER_OP,
+          state.current_operation.bytes,
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - operation_start)
+              .count());
     }
-  } else {
-    std::string encoded_message;
-    MPIRequestList message_list;
-    message_list.set_shutdown(should_shut_down);
-    while (!message_queue.empty()) {
-      message_list.add_request(message_queue.front());
-      message_queue.pop();
+    if (LogLevelEnabled(LogLevel::TRACE)) {
+      LOG(TRACE, state.rank)
+          << "Finished performing " << response.tensor_names_string();
     }
-    MPIRequestList::SerializeToString(message_list, encoded_message);
-    int encoded_message_length = (int)encoded_message.length() + 1;
-    MPI_Gather(&encoded_message_length, 1, MPI_INT, nullptr, 1, MPI_INT,
-               RANK_ZERO, state.mpi_comm);
-    MPI_Gatherv((void*)encoded_message.c_str(), encoded_message_length,
-                MPI_BYTE, nullptr, nullptr, nullptr, MPI_BYTE, RANK_ZERO,
-                state.mpi_comm);
-
-    int msg_length;
-    MPI_Bcast(&msg_length, 1, MPI_INT, RANK_ZERO, state.mpi_comm);
-    auto buffer = new uint8_t[msg_length];
-    MPI_Bcast(buffer, msg_length, MPI_BYTE, RANK_ZERO, state.mpi_comm);
-    MPIResponseList response_list;
-    MPIResponseList::ParseFromBytes(response_list, buffer);
-    delete[] buffer;
+  }
 
-    std::vector<std::string> tensor_names;
-    int64_t total_tensor_size = 0;
-    if (state.param_manager.IsAutoTuning()) {
-      for (auto& response : response_list.responses()) {
-        if (response.response_type() == MPIResponse::ResponseType::ALLREDUCE) {
-          for (auto& tensor_name : response.tensor_names()) {
-            tensor_names.push_back(tensor_name);
-            auto& entry = state.tensor_table[tensor_name];
-            total_tensor_size += entry.tensor->size();
-          }
-        }
+  // Check for stalled tensors.
+  if (state.perform_stall_check &&
+      std::chrono::steady_clock::now() - state.last_stall_check >
+          STALL_WARNING_TIME) {
+    if (is_coordinator) {
+      std::vector<int> ranks;
+      for (int rank = 0; rank < state.size; ++rank) {
+        ranks.push_back(rank);
       }
+      CheckForStalledTensors(*state.message_table, ranks);
     }
-
-    // Perform the collective operation. All nodes should end up performing
-    // the same operation.
-    for (auto& response : response_list.responses()) {
-      LOG(TRACE, state.rank) << "Performing " << response.tensor_names_string();
-      LOG(DEBUG, state.rank) << "Processing " << response.tensor_names().size() << " tensors";
-      PerformOperation(state.tensor_table, response);
-      LOG(TRACE, state.rank) << "Finished performing " << response.tensor_names_string();
+    if (state.local_message_table != nullptr) {
+      // Tensors held back on this node are not known to the coordinator
+      // yet, so report the local ranks that are missing.
+      CheckForStalledTensors(*state.local_message_table,
+                             state.local_comm_ranks);
     }
+    state.last_stall_check = std::chrono::steady_clock::now();
+  }
 
-    if (state.param_manager.IsAutoTuning()) {
-      state.param_manager.Update(tensor_names, total_tensor_size);
-    }
+  if (is_coordinator &&
+      state.straggler_log_interval > std::chrono::steady_clock::duration(0) &&
+      std::chrono::steady_clock::now() - state.last_straggler_log >
+          state.straggler_log_interval) {
+    LogStragglers(state.metrics.stragglers);
+    state.last_straggler_log = std::chrono::steady_clock::now();
+  }
 
-    if (response_list.shutdown()) {
-      should_shut_down = true;
-    }
+  if (state.fusion_idle_release > std::chrono::steady_clock::duration(0) &&
+      state.fusion_buffer.ReleaseIdleBuffers(state.fusion_idle_release) > 0) {
+    state.metrics.fusion_buffer_bytes.store(
+        state.fusion_buffer.AllocatedBytes(), std::memory_order_relaxed);
+#if HAVE_CUDA
+    // The events of released GPU buffers have completed.
+    ReleaseCompletedBufferEvents();
+#endif
+  }
+
+  if (state.param_manager.IsObserving()) {
+    state.param_manager.Update(tensor_names, total_tensor_size);
   }
 
   return !should_shut_down;
@@ -2401,6 +7405,23 @@ void InitializeHorovodOnce(const int* ranks, int nranks) {
   }
 }
 
+ReplayRecord MakeReplayRecord(ReplayOp op, const std::string& name,
+                              const Tensor& tensor, int device) {
+  ReplayRecord record;
+  record.op = op;
+  record.name = name;
+  record.dtype = tensor.dtype();
+  record.shape = tensor.shape();
+  record.device = device;
+  return record;
+}
+
+void RecordEnqueue(ReplayRecord record) {
+  std::vector<ReplayRecord> records;
+  records.push_back(std::move(record));
+  horovod_global.enqueue_recorder.Record(records);
+}
+
 } // namespace
 
 Status CheckInitialized() {
@@ -2424,6 +7445,7 @@ void horovod_init_comm(MPI_Comm comm) {
 void horovod_shutdown() {
   if (horovod_global.background_thread.joinable()) {
     horovod_global.shut_down = true;
+    horovod_global.wakeup_cv.notify_all();
     horovod_global.background_thread.join();
     // Reset the initialization flag to allow restarting with horovod_init(...)
     horovod_global.initialize_flag.clear();
@@ -2465,6 +7487,49 @@ int horovod_mpi_threads_supported() {
   }
   return horovod_global.mpi_threads_supported ? 1 : 0;
 }
+
+int horovod_get_metrics(char* buffer, int buffer_size) {
+  if (!horovod_global.initialization_done) {
+    return -1;
+  }
+  auto json = horovod_global.metrics.ToJson();
+  if (buffer != nullptr && buffer_size > 0) {
+    auto length = std::min((size_t)buffer_size - 1, json.size());
+    memcpy(buffer, json.data(), length);
+    buffer[length] = '\0';
+  }
+  return (int)json.size();
+}
+
+int horovod_replay(const char* recording, const char* report) {
+  if (!horovod_global.initialization_done) {
+    return -1;
+  }
+  auto file_name =
+      std::string(recording) + "." + std::to_string(horovod_global.rank);
+  std::vector<ReplayRecord> records;
+  int size;
+  auto status = ReadRecording(file_name, records, size);
+  if (status.ok() && size != horovod_global.size) {
+    status = Status::PreconditionError(
+        file_name + " was recorded with " + std::to_string(size) +
+        " processes, but Horovod runs with " +
+        std::to_string(horovod_global.size) + ".");
+  }
+  std::vector<ReplayStep> steps;
+  if (status.ok()) {
+    status = Replay(records, steps);
+  }
+  if (!status.ok()) {
+    LOG(WARNING) << "Replay failed: " << status.reason();
+    return -2;
+  }
+  if (report != nullptr) {
+    std::ofstream file(report, std::ios::out | std::ios::trunc);
+    WriteReplayJson(steps, file);
+  }
+  return (int)steps.size();
+}
 }
 
 // MPI must be initialized and the background thread must be running before
@@ -2474,17 +7539,47 @@ Status EnqueueTensorAllreduce(std::shared_ptr<OpContext> context,
                               std::shared_ptr<Tensor> output,
                               std::shared_ptr<ReadyEvent> ready_event,
                               const std::string name, const int device,
-                              StatusCallback callback) {
-  MPIRequest message;
-  message.set_request_rank(horovod_global.rank);
-  message.set_tensor_name(name);
-  message.set_tensor_type(tensor->dtype());
-  message.set_device(device);
-  message.set_request_type(MPIRequest::ALLREDUCE);
-  for (int i = 0; i < tensor->shape().dims(); ++i) {
-    message.add_tensor_shape((int64_t)tensor->shape().dim_size(i));
+                              StatusCallback callback,
+                              Compression compression, double prescale_factor,
+                              double postscale_factor, int32_t priority,
+                              int32_t accumulation_steps, ReduceScope scope,
+                              int32_t local_replicas) {
+  if (accumulation_steps < 1) {
+    return Status::InvalidArgument(
+        "Allreduce of tensor " + name +
+        " needs at least one accumulation step.");
+  }
+  if (local_replicas < 1) {
+    return Status::InvalidArgument("Allreduce of tensor " + name +
+                                   " needs at least one replica.");
+  }
+  if (local_replicas > 1) {
+#if HOROVOD_GPU_ALLREDUCE != 'N'
+    return Status::PreconditionError(
+        "Allreduce of tensor " + name +
+        " with local replicas needs Horovod to be built with NCCL.");
+#endif
+    if (device == CPU_DEVICE_ID || accumulation_steps > 1) {
+      return Status::InvalidArgument(
+          "Allreduce of tensor " + name +
+          " with local replicas needs GPU tensors and can't accumulate.");
+    }
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+    // The replicas are summed up and broadcast with NCCL on the background
+    // and finalizer threads, which must not throw.
+    try {
+      GetNCCLDataType(tensor);
+    } catch (const std::logic_error& ex) {
+      return Status::InvalidArgument("Allreduce of tensor " + name +
+                                     " with local replicas: " + ex.what());
+    }
+#endif
+  }
+  if (scope == CROSS_SCOPE && !horovod_global.is_homogeneous) {
+    return Status::InvalidArgument(
+        "Allreduce of tensor " + name +
+        " across nodes needs the same number of ranks on every node.");
   }
-
   TensorTableEntry e;
   e.tensor_name = name;
   e.context = context;
@@ -2493,19 +7588,99 @@ Status EnqueueTensorAllreduce(std::shared_ptr<OpContext> context,
   e.ready_event = ready_event;
   e.device = device;
   e.callback = callback;
+  e.compression = compression;
+  e.prescale_factor = prescale_factor;
+  e.postscale_factor = postscale_factor;
+  e.priority = priority;
+  e.accumulation_steps = accumulation_steps;
+  e.scope = scope;
+  e.local_replicas = local_replicas;
+  Status status = CheckScaleFactors(e);
+  if (!status.ok()) {
+    return status;
+  }
+  if (horovod_global.enqueue_recorder.Initialized()) {
+    auto record = MakeReplayRecord(REPLAY_ALLREDUCE, name, *tensor, device);
+    record.compression = compression;
+    record.prescale_factor = prescale_factor;
+    record.postscale_factor = postscale_factor;
+    record.priority = priority;
+    record.accumulation_steps = accumulation_steps;
+    record.scope = scope;
+    record.local_replicas = local_replicas;
+    RecordEnqueue(std::move(record));
+  }
 
-  std::lock_guard<std::mutex> guard(horovod_global.mutex);
-  if (horovod_global.shut_down) {
-    return SHUT_DOWN_ERROR;
+  if (local_replicas > 1) {
+    return EnqueueReplica(horovod_global, std::move(e));
   }
-  if (horovod_global.tensor_table.find(name) !=
-      horovod_global.tensor_table.end()) {
-    return DUPLICATE_NAME_ERROR;
+  if (accumulation_steps > 1) {
+    return EnqueueAccumulation(horovod_global, std::move(e));
   }
-  horovod_global.tensor_table.emplace(name, std::move(e));
-  horovod_global.message_queue.push(message);
-  LOG(TRACE, horovod_global.rank) << "Enqueued " << name;
-  return Status::OK();
+  return EnqueuePartitionedEntry(horovod_global, std::move(e),
+                                 PrepareAllreduce);
+}
+
+// MPI must be initialized and the background thread must be running before
+// this function is called.
+Status EnqueueTensorAllreduces(
+    std::vector<std::shared_ptr<OpContext>>& contexts,
+    std::vector<std::shared_ptr<Tensor>>& tensors,
+    std::vector<std::shared_ptr<Tensor>>& outputs,
+    std::vector<std::shared_ptr<ReadyEvent>>& ready_events,
+    const std::vector<std::string>& names, const int device,
+    std::vector<StatusCallback>& callbacks, Compression compression,
+    double prescale_factor, double postscale_factor, int32_t priority) {
+  if (tensors.empty()) {
+    return Status::OK();
+  }
+  if (contexts.size() != tensors.size() || outputs.size() != tensors.size() ||
+      ready_events.size() != tensors.size() ||
+      names.size() != tensors.size() || callbacks.size() != tensors.size()) {
+    return Status::InvalidArgument(
+        "Grouped allreduce requires the same number of contexts, tensors, "
+        "outputs, ready events, names and callbacks.");
+  }
+
+  std::vector<TensorTableEntry> entries(tensors.size());
+  std::vector<MPIRequest> messages;
+  messages.reserve(tensors.size());
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    auto& e = entries[i];
+    e.tensor_name = names[i];
+    e.context = contexts[i];
+    e.tensor = tensors[i];
+    e.output = outputs[i];
+    e.ready_event = ready_events[i];
+    e.device = device;
+    e.callback = callbacks[i];
+    e.compression = compression;
+    e.prescale_factor = prescale_factor;
+    e.postscale_factor = postscale_factor;
+    e.priority = priority;
+    e.group = names[0];
+    Status status = CheckScaleFactors(e);
+    if (!status.ok()) {
+      return status;
+    }
+    messages.push_back(PrepareAllreduce(horovod_global, e));
+  }
+  if (horovod_global.enqueue_recorder.Initialized()) {
+    std::vector<ReplayRecord> records;
+    for (size_t i = 0; i < tensors.size(); ++i) {
+      auto record =
+          MakeReplayRecord(REPLAY_ALLREDUCE, names[i], *tensors[i], device);
+      record.compression = compression;
+      record.prescale_factor = prescale_factor;
+      record.postscale_factor = postscale_factor;
+      record.priority = priority;
+      record.group_size = (int32_t)tensors.size();
+      records.push_back(std::move(record));
+    }
+    horovod_global.enqueue_recorder.Record(records);
+  }
+
+  return EnqueueEntries(horovod_global, entries, messages);
 }
 
 // MPI must be initialized and the background thread must be running before
@@ -2532,19 +7707,11 @@ Status EnqueueTensorAllgather(std::shared_ptr<OpContext> context,
   e.ready_event = ready_event;
   e.device = device;
   e.callback = callback;
-
-  std::lock_guard<std::mutex> guard(horovod_global.mutex);
-  if (horovod_global.shut_down) {
-    return SHUT_DOWN_ERROR;
-  }
-  if (horovod_global.tensor_table.find(name) !=
-      horovod_global.tensor_table.end()) {
-    return DUPLICATE_NAME_ERROR;
+  if (horovod_global.enqueue_recorder.Initialized()) {
+    RecordEnqueue(MakeReplayRecord(REPLAY_ALLGATHER, name, *tensor, device));
   }
-  horovod_global.tensor_table.emplace(name, std::move(e));
-  horovod_global.message_queue.push(message);
-  LOG(TRACE, horovod_global.rank) << "Enqueued " << name;
-  return Status::OK();
+
+  return EnqueueEntry(horovod_global, std::move(e), std::move(message));
 }
 
 // MPI must be initialized and the background thread must be running before
@@ -2555,13 +7722,48 @@ Status EnqueueTensorBroadcast(std::shared_ptr<OpContext> context,
                               std::shared_ptr<ReadyEvent> ready_event,
                               const std::string name, const int device,
                               StatusCallback callback) {
+  TensorTableEntry e;
+  e.tensor_name = name;
+  e.context = context;
+  e.tensor = tensor;
+  e.output = output;
+  e.root_rank = root_rank;
+  e.ready_event = ready_event;
+  e.device = device;
+  e.callback = callback;
+  if (horovod_global.enqueue_recorder.Initialized()) {
+    auto record = MakeReplayRecord(REPLAY_BROADCAST, name, *tensor, device);
+    record.root_rank = root_rank;
+    RecordEnqueue(std::move(record));
+  }
+
+  return EnqueuePartitionedEntry(horovod_global, std::move(e),
+                                 PrepareBroadcast);
+}
+
+Status EnqueueTensorReducescatter(std::shared_ptr<OpContext> context,
+                                  std::shared_ptr<Tensor> tensor,
+                                  std::shared_ptr<ReadyEvent> ready_event,
+                                  const std::string name, const int device,
+                                  StatusCallback callback) {
+#if HOROVOD_GPU_ALLREDUCE != 'N'
+  if (device != CPU_DEVICE_ID) {
+    return Status::InvalidArgument(
+        "Reducescatter of GPU tensors requires Horovod to be built with "
+        "HOROVOD_GPU_ALLREDUCE=NCCL.");
+  }
+#endif
+  if (tensor->shape().dims() == 0) {
+    return Status::InvalidArgument(
+        "Reducescatter requires a tensor with at least one dimension.");
+  }
+
   MPIRequest message;
   message.set_request_rank(horovod_global.rank);
   message.set_tensor_name(name);
   message.set_tensor_type(tensor->dtype());
-  message.set_root_rank(root_rank);
   message.set_device(device);
-  message.set_request_type(MPIRequest::BROADCAST);
+  message.set_request_type(MPIRequest::REDUCESCATTER);
   for (int i = 0; i < tensor->shape().dims(); ++i) {
     message.add_tensor_shape((int64_t)tensor->shape().dim_size(i));
   }
@@ -2570,24 +7772,140 @@ Status EnqueueTensorBroadcast(std::shared_ptr<OpContext> context,
   e.tensor_name = name;
   e.context = context;
   e.tensor = tensor;
-  e.output = output;
-  e.root_rank = root_rank;
   e.ready_event = ready_event;
   e.device = device;
   e.callback = callback;
+  if (horovod_global.enqueue_recorder.Initialized()) {
+    RecordEnqueue(
+        MakeReplayRecord(REPLAY_REDUCESCATTER, name, *tensor, device));
+  }
 
-  std::lock_guard<std::mutex> guard(horovod_global.mutex);
-  if (horovod_global.shut_down) {
-    return SHUT_DOWN_ERROR;
+  return EnqueueEntry(horovod_global, std::move(e), std::move(message));
+}
+
+Status EnqueueTensorAlltoall(std::shared_ptr<OpContext> context,
+                             std::shared_ptr<Tensor> tensor,
+                             std::vector<int32_t> splits,
+                             std::shared_ptr<ReadyEvent> ready_event,
+                             const std::string name, const int device,
+                             StatusCallback callback) {
+#if !HOROVOD_NCCL_ALLTOALL
+  if (device != CPU_DEVICE_ID) {
+    return Status::InvalidArgument(
+        "Alltoall of GPU tensors requires Horovod to be built with "
+        "HOROVOD_GPU_ALLREDUCE=NCCL and NCCL 2.7 or newer.");
   }
-  if (horovod_global.tensor_table.find(name) !=
-      horovod_global.tensor_table.end()) {
-    return DUPLICATE_NAME_ERROR;
+#endif
+  if (tensor->shape().dims() == 0) {
+    return Status::InvalidArgument(
+        "Alltoall requires a tensor with at least one dimension.");
   }
-  horovod_global.tensor_table.emplace(name, std::move(e));
-  horovod_global.message_queue.push(message);
-  LOG(TRACE, horovod_global.rank) << "Enqueued " << name;
-  return Status::OK();
+  int64_t num_rows = tensor->shape().dim_size(0);
+  if (splits.empty()) {
+    if (num_rows % horovod_global.size != 0) {
+      return Status::InvalidArgument(
+          "Alltoall without splits requires the first dimension of the "
+          "tensor to be divisible by the number of processes.");
+    }
+    splits.assign(horovod_global.size, (int32_t)(num_rows / horovod_global.size));
+  } else {
+    if ((int)splits.size() != horovod_global.size) {
+      return Status::InvalidArgument(
+          "Alltoall requires one split for every process.");
+    }
+    int64_t total_rows = 0;
+    for (auto split : splits) {
+      if (split < 0) {
+        return Status::InvalidArgument("Alltoall splits must not be negative.");
+      }
+      total_rows += split;
+    }
+    if (total_rows != num_rows) {
+      return Status::InvalidArgument(
+          "Alltoall splits must add up to the first dimension of the tensor.");
+    }
+  }
+
+  if (horovod_global.enqueue_recorder.Initialized()) {
+    auto record = MakeReplayRecord(REPLAY_ALLTOALL, name, *tensor, device);
+    record.splits = splits;
+    RecordEnqueue(std::move(record));
+  }
+
+  MPIRequest message;
+  message.set_request_rank(horovod_global.rank);
+  message.set_tensor_name(name);
+  message.set_tensor_type(tensor->dtype());
+  message.set_device(device);
+  message.set_request_type(MPIRequest::ALLTOALL);
+  for (int i = 0; i < tensor->shape().dims(); ++i) {
+    message.add_tensor_shape((int64_t)tensor->shape().dim_size(i));
+  }
+
+  TensorTableEntry e;
+  e.tensor_name = name;
+  e.context = context;
+  e.tensor = tensor;
+  e.splits = std::move(splits);
+  e.ready_event = ready_event;
+  e.device = device;
+  e.callback = callback;
+
+  return EnqueueEntry(horovod_global, std::move(e), std::move(message));
+}
+
+Status EnqueueTensorSparseAllreduce(std::shared_ptr<OpContext> context,
+                                    std::shared_ptr<Tensor> values,
+                                    std::shared_ptr<Tensor> indices,
+                                    std::shared_ptr<ReadyEvent> ready_event,
+                                    const std::string name, const int device,
+                                    bool deduplicate, StatusCallback callback) {
+  if (device != CPU_DEVICE_ID) {
+    return Status::InvalidArgument(
+        "Sparse allreduce is only supported for CPU tensors.");
+  }
+  if (values->shape().dims() == 0) {
+    return Status::InvalidArgument(
+        "Sparse allreduce values must have at least one dimension.");
+  }
+  if (indices->dtype() != HOROVOD_INT64 || indices->shape().dims() != 1 ||
+      indices->shape().dim_size(0) != values->shape().dim_size(0)) {
+    return Status::InvalidArgument(
+        "Sparse allreduce indices must be a vector of int64 with one index "
+        "for every row of the values.");
+  }
+  if (deduplicate && values->dtype() == HOROVOD_BOOL) {
+    return Status::InvalidArgument(
+        "Sparse allreduce cannot deduplicate rows of bool tensors.");
+  }
+
+  MPIRequest message;
+  message.set_request_rank(horovod_global.rank);
+  message.set_tensor_name(name);
+  message.set_tensor_type(values->dtype());
+  message.set_device(device);
+  message.set_request_type(MPIRequest::SPARSE_ALLREDUCE);
+  for (int i = 0; i < values->shape().dims(); ++i) {
+    message.add_tensor_shape((int64_t)values->shape().dim_size(i));
+  }
+
+  TensorTableEntry e;
+  e.tensor_name = name;
+  e.context = context;
+  e.tensor = values;
+  e.indices = indices;
+  e.deduplicate = deduplicate;
+  e.ready_event = ready_event;
+  e.device = device;
+  e.callback = callback;
+  if (horovod_global.enqueue_recorder.Initialized()) {
+    auto record =
+        MakeReplayRecord(REPLAY_SPARSE_ALLREDUCE, name, *values, device);
+    record.deduplicate = deduplicate;
+    RecordEnqueue(std::move(record));
+  }
+
+  return EnqueueEntry(horovod_global, std::move(e), std::move(message));
 }
 
 } // namespace common
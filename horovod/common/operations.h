@@ -38,6 +38,10 @@ namespace common {
 #define MEMCPY_IN_HOST_BUFFER "MEMCPY_IN_HOST_BUFFER"
 #define MEMCPY_IN_SHARED_BUFFER "MEMCPY_IN_SHARED_BUFFER"
 #define MPI_ALLREDUCE "MPI_ALLREDUCE"
+#define TCP_ALLREDUCE "TCP_ALLREDUCE"
+#define SHARED_MEMORY_REDUCE "SHARED_MEMORY_REDUCE"
+#define MPI_CROSS_ALLREDUCE "MPI_CROSS_ALLREDUCE"
+#define MEMCPY_OUT_SHARED_BUFFER "MEMCPY_OUT_SHARED_BUFFER"
 #define MEMCPY_OUT_HOST_BUFFER "MEMCPY_OUT_HOST_BUFFER"
 #define NCCL_ALLREDUCE "NCCL_ALLREDUCE"
 #define MEMCPY_OUT_FUSION_BUFFER "MEMCPY_OUT_FUSION_BUFFER"
@@ -48,22 +52,68 @@ namespace common {
 #define NCCL_BCAST "NCCL_BCAST"
 #define COPY_ALLGATHER_OUTPUT "COPY_ALLGATHER_OUTPUT"
 #define ALLOCATE_SHARED_BUFFER "ALLOCATE_SHARED_BUFFER"
+#define QUANTIZE "QUANTIZE"
+#define MPI_ALLTOALLV "MPI_ALLTOALLV"
+#define MPI_ALLGATHERV "MPI_ALLGATHERV"
+#define DEQUANTIZE "DEQUANTIZE"
+#define MEMCPY_IN_SPARSE_BUFFER "MEMCPY_IN_SPARSE_BUFFER"
+#define MERGE_SPARSE_ROWS "MERGE_SPARSE_ROWS"
+#define MPI_REDUCESCATTER "MPI_REDUCESCATTER"
+#define MPI_ALLTOALL "MPI_ALLTOALL"
+#define NCCL_ALLTOALL "NCCL_ALLTOALL"
 
 // The number of elements held by fusion buffer and hierarchical
 // allreduce size is always a multiple of FUSION_BUFFER_ATOMIC_UNIT
 #define FUSION_BUFFER_ATOMIC_UNIT 64
 
+// Smallest size in bytes fusion and shared memory buffers are allocated with.
+#define FUSION_BUFFER_MIN_SIZE (1 << 20)
+
+// Number of pinned host buffers that hierarchical allreduce streams the data
+// of the cross-node allreduce through.
+#define HIERARCHICAL_ALLREDUCE_CHUNK_BUFFERS 4
+
+// Number of the slowest ranks logged with HOROVOD_STRAGGLER_LOG_INTERVAL.
+#define STRAGGLER_LOG_RANKS 3
+
 // Horovod knobs.
 #define HOROVOD_MPI_THREADS_DISABLE "HOROVOD_MPI_THREADS_DISABLE"
 #define HOROVOD_TIMELINE "HOROVOD_TIMELINE"
 #define HOROVOD_TIMELINE_MARK_CYCLES "HOROVOD_TIMELINE_MARK_CYCLES"
+#define HOROVOD_TIMELINE_FORMAT "HOROVOD_TIMELINE_FORMAT"
+#define HOROVOD_TIMELINE_SAMPLE_STEPS "HOROVOD_TIMELINE_SAMPLE_STEPS"
+#define HOROVOD_ENQUEUE_RECORDING "HOROVOD_ENQUEUE_RECORDING"
 #define HOROVOD_AUTOTUNE "HOROVOD_AUTOTUNE"
 #define HOROVOD_AUTOTUNE_LOG "HOROVOD_AUTOTUNE_LOG"
+#define HOROVOD_AUTOTUNE_CACHE "HOROVOD_AUTOTUNE_CACHE"
+#define HOROVOD_AUTOTUNE_RETUNE_MARGIN "HOROVOD_AUTOTUNE_RETUNE_MARGIN"
 #define HOROVOD_FUSION_THRESHOLD "HOROVOD_FUSION_THRESHOLD"
+#define HOROVOD_FUSION_BUFFERS "HOROVOD_FUSION_BUFFERS"
+#define HOROVOD_FUSION_MEMORY_BUDGET "HOROVOD_FUSION_MEMORY_BUDGET"
+#define HOROVOD_FUSION_IDLE_RELEASE "HOROVOD_FUSION_IDLE_RELEASE"
+#define HOROVOD_MEMCPY_THREADS "HOROVOD_MEMCPY_THREADS"
+#define HOROVOD_THREAD_AFFINITY "HOROVOD_THREAD_AFFINITY"
+#define HOROVOD_NUM_NCCL_STREAMS "HOROVOD_NUM_NCCL_STREAMS"
+#define HOROVOD_NCCL_EAGER_INIT "HOROVOD_NCCL_EAGER_INIT"
+#define HOROVOD_CUDA_GRAPHS "HOROVOD_CUDA_GRAPHS"
 #define HOROVOD_CYCLE_TIME "HOROVOD_CYCLE_TIME"
+#define HOROVOD_CYCLE_WAKEUP_BYTES "HOROVOD_CYCLE_WAKEUP_BYTES"
+#define HOROVOD_CYCLE_WAKEUP_TENSORS "HOROVOD_CYCLE_WAKEUP_TENSORS"
 #define HOROVOD_STALL_CHECK_DISABLE "HOROVOD_STALL_CHECK_DISABLE"
+#define HOROVOD_STRAGGLER_LOG_INTERVAL "HOROVOD_STRAGGLER_LOG_INTERVAL"
 #define HOROVOD_HIERARCHICAL_ALLREDUCE "HOROVOD_HIERARCHICAL_ALLREDUCE"
+#define HOROVOD_HIERARCHICAL_ALLREDUCE_CHUNK_SIZE "HOROVOD_HIERARCHICAL_ALLREDUCE_CHUNK_SIZE"
+#define HOROVOD_CUDA_AWARE_MPI "HOROVOD_CUDA_AWARE_MPI"
+#define HOROVOD_BROADCAST_PIPELINE_THRESHOLD "HOROVOD_BROADCAST_PIPELINE_THRESHOLD"
+#define HOROVOD_BROADCAST_CHUNK_SIZE "HOROVOD_BROADCAST_CHUNK_SIZE"
 #define HOROVOD_HIERARCHICAL_ALLGATHER "HOROVOD_HIERARCHICAL_ALLGATHER"
+#define HOROVOD_ALLGATHER_ZERO_COPY_THRESHOLD "HOROVOD_ALLGATHER_ZERO_COPY_THRESHOLD"
+#define HOROVOD_CACHE_CAPACITY "HOROVOD_CACHE_CAPACITY"
+#define HOROVOD_HIERARCHICAL_NEGOTIATION "HOROVOD_HIERARCHICAL_NEGOTIATION"
+#define HOROVOD_PARTITION_THRESHOLD "HOROVOD_PARTITION_THRESHOLD"
+#define HOROVOD_CPU_OPERATIONS "HOROVOD_CPU_OPERATIONS"
+#define HOROVOD_TCP_RING_CONNECTIONS "HOROVOD_TCP_RING_CONNECTIONS"
+#define HOROVOD_TCP_RING_INTERFACE "HOROVOD_TCP_RING_INTERFACE"
 
 // A callback to call after the MPI communication completes. Since the
 // allreduce and allgather ops are asynchronous, this callback is what resumes
@@ -103,14 +153,74 @@ int horovod_local_size();
 // C interface to return flag indicating whether MPI multi-threading is
 // supported. Returns -1 if Horovod is not initialized.
 int horovod_mpi_threads_supported();
+
+// C interface to get the runtime metrics of this process as a JSON object.
+// Writes at most buffer_size bytes including the terminating NUL into buffer
+// and returns the length of the whole JSON text, so that a caller can retry
+// with a larger buffer. Returns -1 if Horovod is not initialized.
+int horovod_get_metrics(char* buffer, int buffer_size);
+
+// C interface to replay the Enqueue* calls recorded with
+// HOROVOD_ENQUEUE_RECORDING set to recording. Every rank replays its own
+// file recording.<rank>, so all ranks of a job of the recorded size have to
+// call it. Writes the communication time of every step as a JSON object to
+// report unless it is NULL. Returns the number of replayed steps, -1 if
+// Horovod is not initialized, or -2 if the recording can't be replayed.
+int horovod_replay(const char* recording, const char* report);
 }
 
+// Sums up the tensor over all ranks. Every rank multiplies its data by
+// prescale_factor before the sum and the sum by postscale_factor, e.g. 1/size
+// to average it. Scaling is done while the data is copied into and out of the
+// fusion buffer and is only supported for floating point tensors. Allreduces
+// with a higher priority are performed first when several are ready, and all
+// ranks must use the same priority for a tensor.
+//
+// With accumulation_steps N > 1, the tensors of N calls with the same name are
+// summed up locally in a persistent buffer, and only their sum is allreduced
+// into the output of the Nth call. The callbacks of the other calls are called
+// once their tensor has been added, and their output is left untouched. Only
+// floating point tensors can be accumulated.
+//
+// With scope LOCAL_SCOPE, the tensor is only summed up across the ranks on
+// the same node, and with CROSS_SCOPE across the ranks with the same local
+// rank on all nodes, which needs the same number of ranks on every node. All
+// ranks still have to enqueue the tensor. A two-tier schedule can reduce
+// within nodes every step and across nodes only every few steps.
+//
+// With local_replicas N > 1, a process driving several GPUs enqueues the
+// tensor under the same name once from each of N GPUs. The N tensors are
+// summed up with NCCL on the GPU with the lowest id, their sum is negotiated
+// and allreduced once for the process, and the result is broadcast into the
+// outputs on all N GPUs. Every rank has to use the same N for a tensor, and
+// the postscale factor of an average has to divide by N times the number of
+// ranks. Needs NCCL.
 Status EnqueueTensorAllreduce(std::shared_ptr<OpContext> context,
                               std::shared_ptr<Tensor> tensor,
                               std::shared_ptr<Tensor> output,
                               std::shared_ptr<ReadyEvent> ready_event,
                               const std::string name, const int device,
-                              StatusCallback callback);
+                              StatusCallback callback,
+                              Compression compression = NO_COMPRESSION,
+                              double prescale_factor = 1.0,
+                              double postscale_factor = 1.0,
+                              int32_t priority = 0,
+                              int32_t accumulation_steps = 1,
+                              ReduceScope scope = GLOBAL_SCOPE,
+                              int32_t local_replicas = 1);
+
+// Enqueues the allreduces of a group of tensors on the same device at once.
+// The tensors of a group are negotiated in the same cycle and only fused with
+// each other. The callback of every tensor is called when it is done.
+Status EnqueueTensorAllreduces(
+    std::vector<std::shared_ptr<OpContext>>& contexts,
+    std::vector<std::shared_ptr<Tensor>>& tensors,
+    std::vector<std::shared_ptr<Tensor>>& outputs,
+    std::vector<std::shared_ptr<ReadyEvent>>& ready_events,
+    const std::vector<std::string>& names, const int device,
+    std::vector<StatusCallback>& callbacks,
+    Compression compression = NO_COMPRESSION, double prescale_factor = 1.0,
+    double postscale_factor = 1.0, int32_t priority = 0);
 
 Status EnqueueTensorAllgather(std::shared_ptr<OpContext> context,
                               std::shared_ptr<Tensor> tensor,
@@ -125,6 +235,36 @@ Status EnqueueTensorBroadcast(std::shared_ptr<OpContext> context,
                               const std::string name, const int device,
                               StatusCallback callback);
 
+// Sums up the tensor over all ranks and returns the part of the sum that
+// belongs to this rank: the first dimension is split up among the ranks in
+// order, the first ranks getting one more row if it can't be split up evenly.
+Status EnqueueTensorReducescatter(std::shared_ptr<OpContext> context,
+                                  std::shared_ptr<Tensor> tensor,
+                                  std::shared_ptr<ReadyEvent> ready_event,
+                                  const std::string name, const int device,
+                                  StatusCallback callback);
+
+// Sends splits[r] rows of the tensor along the first dimension to every rank r
+// in order, and returns the rows received from all ranks concatenated in rank
+// order. If splits is empty, the rows are split up evenly.
+Status EnqueueTensorAlltoall(std::shared_ptr<OpContext> context,
+                             std::shared_ptr<Tensor> tensor,
+                             std::vector<int32_t> splits,
+                             std::shared_ptr<ReadyEvent> ready_event,
+                             const std::string name, const int device,
+                             StatusCallback callback);
+
+// Sums the rows of values of all ranks, given by their indices along the first
+// dimension, without densifying them. The output holds the rows of all ranks
+// in rank order and their indices, with rows of the same index summed up if
+// deduplicate is true. Only supported for CPU tensors.
+Status EnqueueTensorSparseAllreduce(std::shared_ptr<OpContext> context,
+                                    std::shared_ptr<Tensor> values,
+                                    std::shared_ptr<Tensor> indices,
+                                    std::shared_ptr<ReadyEvent> ready_event,
+                                    const std::string name, const int device,
+                                    bool deduplicate, StatusCallback callback);
+
 } // namespace common
 } // namespace horovod
 
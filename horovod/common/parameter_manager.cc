@@ -18,7 +18,9 @@
 
 #include <algorithm>
 #include <cmath>
+#include <iomanip>
 #include <limits>
+#include <sstream>
 
 #include "mpi.h"
 
@@ -29,14 +31,38 @@ namespace common {
 #define CYCLES_PER_SAMPLE 10
 #define BAYES_OPT_MAX_SAMPLES 20
 #define GAUSSIAN_PROCESS_NOISE 0.8
-
-Eigen::VectorXd CreateVector(double x1, double x2) {
-  Eigen::VectorXd v(2);
+#define ALGORITHM_BUCKETS 4
+#define ALGORITHM_TABLE_SAMPLES 6
+#define RETUNE_LOW_SCORES 5
+#define RETUNE_RADIUS 0.25
+#define RETUNE_MAX_SAMPLES 8
+
+Eigen::VectorXd CreateVector(double x1, double x2, double x3) {
+  Eigen::VectorXd v(3);
   v(0) = x1;
   v(1) = x2;
+  v(2) = x3;
   return v;
 }
 
+// Returns a 64-bit FNV-1a hash of the sorted tensor names, which is the same across runs.
+std::string TensorSignature(const std::set<std::string>& tensor_names) {
+  uint64_t hash = 14695981039346656037ull;
+  for (auto& name : tensor_names) {
+    for (char c : name + "\n") {
+      hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+    }
+  }
+  std::ostringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return ss.str();
+}
+
+// Cached values of fixed parameters are only used if they were fixed to the same value.
+bool SameValue(double a, double b) {
+  return std::fabs(a - b) <= 1e-9 * std::max(1.0, std::fabs(b));
+}
+
 // ParameterManager
 ParameterManager::ParameterManager() :
     hierarchical_allreduce_(CategoricalParameter<bool>(std::vector<bool>{false, true})),
@@ -44,16 +70,23 @@ ParameterManager::ParameterManager() :
     joint_params_(BayesianParameter(
       std::vector<BayesianVariableConfig>{
         { BayesianVariable::fusion_buffer_threshold_mb, std::pair<double, double>(0, 64) },
-        { BayesianVariable::cycle_time_ms, std::pair<double, double>(1, 100) }
+        { BayesianVariable::cycle_time_ms, std::pair<double, double>(1, 100) },
+        { BayesianVariable::cycle_wakeup_threshold_mb, std::pair<double, double>(0, 64) }
       }, std::vector<Eigen::VectorXd>{
-        CreateVector(4, 5),
-        CreateVector(32, 50),
-        CreateVector(16, 25),
-        CreateVector(8, 10)
+        CreateVector(4, 5, 0),
+        CreateVector(32, 50, 16),
+        CreateVector(16, 25, 4),
+        CreateVector(8, 10, 1)
       })),
+    algorithm_table_(-1),
+    algorithm_table_sample_(-1),
     parameter_chain_(std::vector<ITunableParameter*>{&joint_params_, &hierarchical_allreduce_, &hierarchical_allgather_}),
     active_(false),
     warmup_remaining_(WARMUPS),
+    retune_margin_(0),
+    retuning_(false),
+    usual_score_(0),
+    low_scores_(0),
     sample_(0),
     rank_(-1),
     root_rank_(0),
@@ -62,16 +95,19 @@ ParameterManager::ParameterManager() :
 }
 
 void ParameterManager::CreateMpiTypes() {
-  const int nitems = 5;
-  int blocklengths[5] = {1, 1, 1, 1, 1};
-  MPI_Datatype types[5] = {MPI_CXX_BOOL, MPI_CXX_BOOL, MPI_DOUBLE, MPI_DOUBLE, MPI_CXX_BOOL};
+  const int nitems = 7;
+  int blocklengths[7] = {1, 1, 1, 1, 1, 1, 1};
+  MPI_Datatype types[7] = {MPI_CXX_BOOL, MPI_CXX_BOOL, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_INT32_T,
+                           MPI_CXX_BOOL};
 
-  MPI_Aint offsets[5];
+  MPI_Aint offsets[7];
   offsets[0] = offsetof(Params, hierarchical_allreduce);
   offsets[1] = offsetof(Params, hierarchical_allgather);
   offsets[2] = offsetof(Params, tensor_fusion_threshold);
   offsets[3] = offsetof(Params, cycle_time);
-  offsets[4] = offsetof(Params, active);
+  offsets[4] = offsetof(Params, cycle_wakeup_threshold);
+  offsets[5] = offsetof(Params, algorithm_table);
+  offsets[6] = offsetof(Params, active);
 
   MPI_Type_create_struct(nitems, blocklengths, offsets, types, &mpi_params_type_);
   MPI_Type_commit(&mpi_params_type_);
@@ -83,17 +119,21 @@ void ParameterManager::FreeMpiTypes() {
   }
 }
 
-void ParameterManager::Initialize(int32_t rank, int32_t root_rank, MPI_Comm mpi_comm, std::string file_name) {
+void ParameterManager::Initialize(int32_t rank, int32_t root_rank, MPI_Comm mpi_comm, std::string file_name,
+                                  std::string cache_file_name, std::string job_key) {
   rank_ = rank;
   root_rank_ = root_rank;
   mpi_comm_ = mpi_comm;
+  cache_file_name_ = cache_file_name;
+  job_key_ = job_key;
+  warmup_tensor_names_.clear();
   if (rank_ == root_rank) {
-    LOG(INFO) << "Autotuner: Tunable params [hierarchical_allreduce,hierarchical_allgather,cycle_time_ms,tensor_fusion_threshold] score";
+    LOG(INFO) << "Autotuner: Tunable params [hierarchical_allreduce,hierarchical_allgather,cycle_time_ms,tensor_fusion_threshold,cycle_wakeup_threshold] score";
   }
   if (rank_ == root_rank && !file_name.empty()) {
     file_.open(file_name, std::ios::out | std::ios::trunc);
     if (file_.good()) {
-      file_ << "hierarchical_allreduce,hierarchical_allgather,cycle_time_ms,tensor_fusion_threshold,score" << std::endl;
+      file_ << "hierarchical_allreduce,hierarchical_allgather,cycle_time_ms,tensor_fusion_threshold,cycle_wakeup_threshold,score" << std::endl;
       writing_ = true;
     }
   }
@@ -106,8 +146,20 @@ void ParameterManager::SetAutoTuning(bool active) {
   active_ = active;
 };
 
+void ParameterManager::SetRetuneMargin(double margin) {
+  retune_margin_ = margin;
+}
+
 bool ParameterManager::HierarchicalAllreduce() const {
-  return active_ ? hierarchical_allreduce_.Value() : hierarchical_allreduce_.BestValue();
+  if (algorithm_table_ >= 0) {
+    return (algorithm_table_ & AlgorithmMask(ALLREDUCE_OP)) != 0;
+  }
+  return TuningParams() ? hierarchical_allreduce_.Value() : hierarchical_allreduce_.BestValue();
+}
+
+bool ParameterManager::HierarchicalAllreduce(int64_t bytes) const {
+  return UseHierarchical(ALLREDUCE_OP, bytes,
+                         TuningParams() ? hierarchical_allreduce_.Value() : hierarchical_allreduce_.BestValue());
 }
 
 void ParameterManager::SetHierarchicalAllreduce(bool value, bool fixed) {
@@ -115,7 +167,15 @@ void ParameterManager::SetHierarchicalAllreduce(bool value, bool fixed) {
 }
 
 bool ParameterManager::HierarchicalAllgather() const {
-  return active_ ? hierarchical_allgather_.Value() : hierarchical_allgather_.BestValue();
+  if (algorithm_table_ >= 0) {
+    return (algorithm_table_ & AlgorithmMask(ALLGATHER_OP)) != 0;
+  }
+  return TuningParams() ? hierarchical_allgather_.Value() : hierarchical_allgather_.BestValue();
+}
+
+bool ParameterManager::HierarchicalAllgather(int64_t bytes) const {
+  return UseHierarchical(ALLGATHER_OP, bytes,
+                         TuningParams() ? hierarchical_allgather_.Value() : hierarchical_allgather_.BestValue());
 }
 
 void ParameterManager::SetHierarchicalAllgather(bool value, bool fixed) {
@@ -124,7 +184,7 @@ void ParameterManager::SetHierarchicalAllgather(bool value, bool fixed) {
 
 
 int64_t ParameterManager::TensorFusionThresholdBytes() const {
-  double b = active_ ?
+  double b = TuningParams() ?
       joint_params_.Value(fusion_buffer_threshold_mb) :
       joint_params_.BestValue(fusion_buffer_threshold_mb);
   return int64_t(b * 1024 * 1024);
@@ -135,18 +195,33 @@ void ParameterManager::SetTensorFusionThresholdBytes(int64_t threshold, bool fix
 }
 
 double ParameterManager::CycleTimeMs() const {
-  return active_ ? joint_params_.Value(cycle_time_ms) : joint_params_.BestValue(cycle_time_ms);
+  return TuningParams() ? joint_params_.Value(cycle_time_ms) : joint_params_.BestValue(cycle_time_ms);
 };
 
 void ParameterManager::SetCycleTimeMs(double value, bool fixed) {
   joint_params_.SetValue(cycle_time_ms, value, fixed);
 }
 
+int64_t ParameterManager::CycleWakeupThresholdBytes() const {
+  double b = TuningParams() ?
+      joint_params_.Value(cycle_wakeup_threshold_mb) :
+      joint_params_.BestValue(cycle_wakeup_threshold_mb);
+  return int64_t(b * 1024 * 1024);
+};
+
+void ParameterManager::SetCycleWakeupThresholdBytes(int64_t threshold, bool fixed) {
+  joint_params_.SetValue(cycle_wakeup_threshold_mb, double(threshold) / (1024 * 1024), fixed);
+}
+
 void ParameterManager::Update(const std::vector<std::string>& tensor_names, int64_t bytes) {
-  if (!active_) {
+  if (!IsObserving()) {
     return;
   }
 
+  if (warmup_remaining_ > 0 && !cache_file_name_.empty()) {
+    warmup_tensor_names_.insert(tensor_names.begin(), tensor_names.end());
+  }
+
   for (const std::string& tensor_name : tensor_names) {
     int32_t cycle = tensor_counts_[tensor_name]++;
     if (cycle >= (sample_ + 1) * CYCLES_PER_SAMPLE) {
@@ -166,10 +241,24 @@ void ParameterManager::Update(const std::vector<std::string>& tensor_names, int6
   if (sample_ >= SAMPLES) {
     std::sort(scores_, scores_ + SAMPLES);
     double med_score = scores_[SAMPLES / 2];
-    Tune(med_score);
+    if (active_) {
+      Tune(med_score);
+    } else {
+      Monitor(med_score);
+    }
   }
 }
 
+void ParameterManager::RecordOperation(AlgorithmOp op, int64_t bytes, double microseconds) {
+  if (algorithm_table_sample_ < 0 || rank_ != root_rank_) {
+    return;
+  }
+  auto& stats = algorithm_stats_[UseHierarchical(op, bytes, false) ? 1 : 0]
+                                [op * ALGORITHM_BUCKETS + AlgorithmBucket(bytes)];
+  stats.first += bytes;
+  stats.second += microseconds;
+}
+
 void ParameterManager::Tune(double score) {
   if (warmup_remaining_ > 0) {
     // Ignore this score as we're still warming up.
@@ -177,28 +266,65 @@ void ParameterManager::Tune(double score) {
     if (rank_ == root_rank_) {
       LOG(INFO) << "Autotuner: Warming up (" << warmup_remaining_ << " remaining)";
     }
+
+    if (warmup_remaining_ == 0 && !cache_file_name_.empty()) {
+      // All tensors of the model have been seen during the warmup, so the
+      // results of earlier runs can be looked up now.
+      if (rank_ == root_rank_) {
+        LoadCache();
+      }
+      SyncParams();
+    }
   } else {
     // Log the last parameter values before updating.
     LogParameters(score);
 
     // Only do the tuning on the coordinator to ensure consistency.
     if (rank_ == root_rank_) {
-      bool finished_tuning = true;
-      double best_score = score;
-      for (auto* param : parameter_chain_) {
-        double new_best_score;
-        bool finished = param->Tune(best_score, &new_best_score);
-        best_score = new_best_score;
-
-        if (!finished) {
-          finished_tuning = false;
-          break;
+      if (retuning_) {
+        // Only the numerical parameters are tuned again.
+        double best_score;
+        if (joint_params_.Tune(score, &best_score)) {
+          retuning_ = false;
+          SetAutoTuning(false);
+          LogBestParameters();
+        }
+      } else {
+        bool finished_tuning = true;
+        if (algorithm_table_sample_ >= 0) {
+          finished_tuning = TuneAlgorithmTable();
+        } else {
+          WriteCache("sample", hierarchical_allreduce_.Value(), hierarchical_allgather_.Value(),
+                     joint_params_.Value(cycle_time_ms), joint_params_.Value(fusion_buffer_threshold_mb),
+                     joint_params_.Value(cycle_wakeup_threshold_mb), score, algorithm_table_);
+
+          double best_score = score;
+          for (auto* param : parameter_chain_) {
+            double new_best_score;
+            bool finished = param->Tune(best_score, &new_best_score);
+            best_score = new_best_score;
+
+            if (!finished) {
+              finished_tuning = false;
+              break;
+            }
+          }
+
+          // The algorithms are chosen per message size with the best values of
+          // the other parameters.
+          if (finished_tuning && StartAlgorithmTable()) {
+            finished_tuning = false;
+          }
         }
-      }
 
-      if (finished_tuning) {
-        SetAutoTuning(false);
-        LogBestParameters();
+        if (finished_tuning) {
+          SetAutoTuning(false);
+          LogBestParameters();
+          WriteCache("best", hierarchical_allreduce_.BestValue(), hierarchical_allgather_.BestValue(),
+                     joint_params_.BestValue(cycle_time_ms), joint_params_.BestValue(fusion_buffer_threshold_mb),
+                     joint_params_.BestValue(cycle_wakeup_threshold_mb), hierarchical_allreduce_.BestScore(),
+                     algorithm_table_);
+        }
       }
     }
 
@@ -210,25 +336,62 @@ void ParameterManager::Tune(double score) {
   Reset();
 }
 
+void ParameterManager::Monitor(double score) {
+  if (rank_ == root_rank_) {
+    if (usual_score_ <= 0) {
+      // The first score with the tuned parameters.
+      usual_score_ = score;
+    } else if (score < usual_score_ * (1 - retune_margin_)) {
+      ++low_scores_;
+    } else {
+      low_scores_ = 0;
+      usual_score_ = 0.9 * usual_score_ + 0.1 * score;
+    }
+
+    if (low_scores_ >= RETUNE_LOW_SCORES && joint_params_.HasTunableVariables()) {
+      LOG(INFO) << "Autotuner: Score dropped from " << usual_score_ << " to " << score
+                << ", tuning again around the best params";
+      // The algorithms keep their best values while the numerical parameters
+      // are tuned again.
+      hierarchical_allreduce_.SetValue(hierarchical_allreduce_.BestValue(), true);
+      hierarchical_allgather_.SetValue(hierarchical_allgather_.BestValue(), true);
+      joint_params_.StartLocalSearch(RETUNE_RADIUS, RETUNE_MAX_SAMPLES);
+      retuning_ = true;
+      usual_score_ = 0;
+      low_scores_ = 0;
+      // The warmup is over on all workers.
+      active_ = true;
+      warmup_remaining_ = 0;
+    }
+  }
+
+  // Send the parameters, which start tuning again if the score dropped.
+  SyncParams();
+  Reset();
+}
+
 void ParameterManager::SyncParams() {
   Params params;
 
   // Coordinator send the updated parameters.
   if (rank_ == root_rank_) {
-    if (active_) {
+    if (TuningParams()) {
       // We're actively tuning, so send the current value.
       params.hierarchical_allreduce = hierarchical_allreduce_.Value();
       params.hierarchical_allgather = hierarchical_allgather_.Value();
       params.tensor_fusion_threshold = joint_params_.Value(fusion_buffer_threshold_mb);
       params.cycle_time = joint_params_.Value(cycle_time_ms);
+      params.cycle_wakeup_threshold = joint_params_.Value(cycle_wakeup_threshold_mb);
     } else {
       // Tuning has completed, so send the best value.
       params.hierarchical_allreduce = hierarchical_allreduce_.BestValue();
       params.hierarchical_allgather = hierarchical_allgather_.BestValue();
       params.tensor_fusion_threshold = joint_params_.BestValue(fusion_buffer_threshold_mb);
       params.cycle_time = joint_params_.BestValue(cycle_time_ms);
+      params.cycle_wakeup_threshold = joint_params_.BestValue(cycle_wakeup_threshold_mb);
     }
 
+    params.algorithm_table = algorithm_table_;
     params.active = active_;
   }
 
@@ -241,6 +404,8 @@ void ParameterManager::SyncParams() {
     hierarchical_allgather_.SetValue(params.hierarchical_allgather, true);
     joint_params_.SetValue(fusion_buffer_threshold_mb, params.tensor_fusion_threshold, true);
     joint_params_.SetValue(cycle_time_ms, params.cycle_time, true);
+    joint_params_.SetValue(cycle_wakeup_threshold_mb, params.cycle_wakeup_threshold, true);
+    algorithm_table_ = params.algorithm_table;
     active_ = params.active;
   }
 }
@@ -253,18 +418,23 @@ void ParameterManager::Reset() {
 }
 
 void ParameterManager::LogParameters(double score) {
-  if (rank_ == root_rank_) {
+  if (rank_ == root_rank_ && algorithm_table_sample_ >= 0) {
+    LOG(INFO) << "Autotuner: Algorithm table sample " << algorithm_table_sample_ << " ["
+              << HierarchicalAllreduce() << ", " << HierarchicalAllgather() << "] " << score;
+  } else if (rank_ == root_rank_) {
     LOG(INFO) << "Autotuner: ["
               << hierarchical_allreduce_.Value() << ", "
               << hierarchical_allgather_.Value() << ", "
               << joint_params_.Value(cycle_time_ms) << " ms, "
-              << joint_params_.Value(fusion_buffer_threshold_mb) << " mb] "
+              << joint_params_.Value(fusion_buffer_threshold_mb) << " mb, "
+              << joint_params_.Value(cycle_wakeup_threshold_mb) << " mb] "
               << score;
     if (writing_ && file_.good()) {
       file_ << hierarchical_allreduce_.Value() << ","
             << hierarchical_allgather_.Value() << ","
             << joint_params_.Value(cycle_time_ms) << ","
             << joint_params_.Value(fusion_buffer_threshold_mb) << ","
+            << joint_params_.Value(cycle_wakeup_threshold_mb) << ","
             << score
             << std::endl;
     }
@@ -277,19 +447,211 @@ void ParameterManager::LogBestParameters() {
               << hierarchical_allreduce_.BestValue() << ", "
               << hierarchical_allgather_.BestValue() << ", "
               << joint_params_.BestValue(cycle_time_ms) << " ms, "
-              << joint_params_.BestValue(fusion_buffer_threshold_mb) << " mb] "
+              << joint_params_.BestValue(fusion_buffer_threshold_mb) << " mb, "
+              << joint_params_.BestValue(cycle_wakeup_threshold_mb) << " mb] "
               << hierarchical_allreduce_.BestScore();
+    if (algorithm_table_ >= 0) {
+      LOG(INFO) << "Autotuner: Hierarchical allreduce for buckets ["
+                << AlgorithmBucketList(algorithm_table_, ALLREDUCE_OP) << "], allgather for buckets ["
+                << AlgorithmBucketList(algorithm_table_, ALLGATHER_OP) << "]";
+    }
     if (writing_ && file_.good()) {
       file_ << hierarchical_allreduce_.BestValue() << ","
             << hierarchical_allgather_.BestValue() << ","
             << joint_params_.BestValue(cycle_time_ms) << ","
             << joint_params_.BestValue(fusion_buffer_threshold_mb) << ","
+            << joint_params_.BestValue(cycle_wakeup_threshold_mb) << ","
             << hierarchical_allreduce_.BestScore()
             << std::endl;
     }
   }
 }
 
+int ParameterManager::AlgorithmBucket(int64_t bytes) {
+  // Upper bounds of the message sizes of the buckets, the last bucket holds
+  // all larger messages.
+  static const int64_t bounds[ALGORITHM_BUCKETS - 1] = {256 * 1024, 4 * 1024 * 1024, 32 * 1024 * 1024};
+  int bucket = 0;
+  while (bucket < ALGORITHM_BUCKETS - 1 && bytes >= bounds[bucket]) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+int32_t ParameterManager::AlgorithmMask(AlgorithmOp op) {
+  return ((1 << ALGORITHM_BUCKETS) - 1) << (op * ALGORITHM_BUCKETS);
+}
+
+bool ParameterManager::UseHierarchical(AlgorithmOp op, int64_t bytes, bool default_value) const {
+  if (algorithm_table_ < 0) {
+    return default_value;
+  }
+  return ((algorithm_table_ >> (op * ALGORITHM_BUCKETS + AlgorithmBucket(bytes))) & 1) != 0;
+}
+
+bool ParameterManager::StartAlgorithmTable() {
+  if (!hierarchical_allreduce_.IsTunable() && !hierarchical_allgather_.IsTunable()) {
+    return false;
+  }
+  for (auto& stats : algorithm_stats_) {
+    stats.assign(2 * ALGORITHM_BUCKETS, std::make_pair((int64_t)0, 0.0));
+  }
+  algorithm_table_sample_ = 0;
+  algorithm_table_ = AlgorithmTable(false);
+  return true;
+}
+
+bool ParameterManager::TuneAlgorithmTable() {
+  ++algorithm_table_sample_;
+  if (algorithm_table_sample_ < ALGORITHM_TABLE_SAMPLES) {
+    algorithm_table_ = AlgorithmTable(algorithm_table_sample_ % 2 == 1);
+    return false;
+  }
+
+  // Buckets without operations keep the algorithm chosen for the whole job.
+  int32_t table = AlgorithmTable(false);
+  const AlgorithmOp ops[] = {ALLREDUCE_OP, ALLGATHER_OP};
+  for (auto op : ops) {
+    auto& param = op == ALLREDUCE_OP ? hierarchical_allreduce_ : hierarchical_allgather_;
+    if (!param.IsTunable()) {
+      continue;
+    }
+    for (int bucket = 0; bucket < ALGORITHM_BUCKETS; ++bucket) {
+      int cell = op * ALGORITHM_BUCKETS + bucket;
+      auto& flat = algorithm_stats_[0][cell];
+      auto& hierarchical = algorithm_stats_[1][cell];
+      bool use_hierarchical = param.BestValue();
+      if (flat.first > 0 && hierarchical.first > 0) {
+        // Compare bytes per microsecond.
+        use_hierarchical = hierarchical.first * flat.second > flat.first * hierarchical.second;
+      }
+      if (use_hierarchical) {
+        table |= 1 << cell;
+      }
+    }
+  }
+  algorithm_table_ = table;
+  algorithm_table_sample_ = -1;
+  return true;
+}
+
+int32_t ParameterManager::AlgorithmTable(bool hierarchical) const {
+  int32_t table = 0;
+  if (hierarchical_allreduce_.IsTunable() ? hierarchical : hierarchical_allreduce_.BestValue()) {
+    table |= AlgorithmMask(ALLREDUCE_OP);
+  }
+  if (hierarchical_allgather_.IsTunable() ? hierarchical : hierarchical_allgather_.BestValue()) {
+    table |= AlgorithmMask(ALLGATHER_OP);
+  }
+  return table;
+}
+
+std::string ParameterManager::AlgorithmBucketList(int32_t table, AlgorithmOp op) {
+  std::ostringstream ss;
+  for (int bucket = 0; bucket < ALGORITHM_BUCKETS; ++bucket) {
+    ss << (bucket > 0 ? ", " : "") << ((table >> (op * ALGORITHM_BUCKETS + bucket)) & 1);
+  }
+  return ss.str();
+}
+
+void ParameterManager::LoadCache() {
+  cache_key_ = job_key_ + ",model=" + TensorSignature(warmup_tensor_names_);
+  std::ifstream file(cache_file_name_);
+  if (!file.good()) {
+    return;
+  }
+
+  // Only samples of the Bayesian optimization, which are taken with the initial
+  // values of the categorical parameters, can be reused.
+  bool found_best = false;
+  bool best_hierarchical_allreduce = false;
+  bool best_hierarchical_allgather = false;
+  int32_t best_algorithm_table = -1;
+  Eigen::VectorXd best_point;
+  std::vector<std::pair<Eigen::VectorXd, double>> samples;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream ss(line);
+    std::string key, kind;
+    bool hierarchical_allreduce, hierarchical_allgather;
+    double cycle_time, fusion_mb, wakeup_mb, score;
+    int32_t algorithm_table = -1;
+    if (!(ss >> key >> kind >> hierarchical_allreduce >> hierarchical_allgather >> cycle_time >> fusion_mb >>
+          wakeup_mb >> score) || key != cache_key_) {
+      continue;
+    }
+    ss >> algorithm_table;
+    if ((!hierarchical_allreduce_.IsTunable() && hierarchical_allreduce != hierarchical_allreduce_.Value()) ||
+        (!hierarchical_allgather_.IsTunable() && hierarchical_allgather != hierarchical_allgather_.Value()) ||
+        (joint_params_.IsFixed(cycle_time_ms) && !SameValue(cycle_time, joint_params_.Value(cycle_time_ms))) ||
+        (joint_params_.IsFixed(fusion_buffer_threshold_mb) &&
+         !SameValue(fusion_mb, joint_params_.Value(fusion_buffer_threshold_mb))) ||
+        (joint_params_.IsFixed(cycle_wakeup_threshold_mb) &&
+         !SameValue(wakeup_mb, joint_params_.Value(cycle_wakeup_threshold_mb)))) {
+      continue;
+    }
+
+    Eigen::VectorXd point = CreateVector(fusion_mb, cycle_time, wakeup_mb);
+    if (kind == "best") {
+      found_best = true;
+      best_hierarchical_allreduce = hierarchical_allreduce;
+      best_hierarchical_allgather = hierarchical_allgather;
+      best_algorithm_table = algorithm_table;
+      best_point = point;
+    } else if (kind == "sample" && hierarchical_allreduce == hierarchical_allreduce_.Value() &&
+               hierarchical_allgather == hierarchical_allgather_.Value() &&
+               samples.size() < (size_t)BAYES_OPT_MAX_SAMPLES) {
+      samples.emplace_back(point, score);
+    }
+  }
+
+  if (found_best) {
+    if (hierarchical_allreduce_.IsTunable()) {
+      hierarchical_allreduce_.SetValue(best_hierarchical_allreduce, false);
+    }
+    if (hierarchical_allgather_.IsTunable()) {
+      hierarchical_allgather_.SetValue(best_hierarchical_allgather, false);
+    }
+    BayesianVariable variables[] = {fusion_buffer_threshold_mb, cycle_time_ms, cycle_wakeup_threshold_mb};
+    for (int i = 0; i < 3; ++i) {
+      if (!joint_params_.IsFixed(variables[i])) {
+        joint_params_.SetValue(variables[i], best_point(i), false);
+      }
+    }
+    if (best_algorithm_table >= 0) {
+      // Keep the algorithms of operations fixed by the user.
+      int32_t fixed_mask = (hierarchical_allreduce_.IsTunable() ? 0 : AlgorithmMask(ALLREDUCE_OP)) |
+                           (hierarchical_allgather_.IsTunable() ? 0 : AlgorithmMask(ALLGATHER_OP));
+      algorithm_table_ = (best_algorithm_table & ~fixed_mask) | (AlgorithmTable(false) & fixed_mask);
+    }
+    SetAutoTuning(false);
+    LOG(INFO) << "Autotuner: Using cached best params ["
+              << HierarchicalAllreduce() << ", "
+              << HierarchicalAllgather() << ", "
+              << CycleTimeMs() << " ms, "
+              << joint_params_.BestValue(fusion_buffer_threshold_mb) << " mb, "
+              << joint_params_.BestValue(cycle_wakeup_threshold_mb) << " mb]";
+  } else if (!samples.empty()) {
+    joint_params_.AddPriorSamples(samples);
+    LOG(INFO) << "Autotuner: Continuing from " << samples.size() << " cached samples";
+  }
+}
+
+void ParameterManager::WriteCache(const std::string& kind, bool hierarchical_allreduce,
+                                  bool hierarchical_allgather, double cycle_time_ms, double fusion_mb,
+                                  double wakeup_mb, double score, int32_t algorithm_table) {
+  if (cache_file_name_.empty() || cache_key_.empty()) {
+    return;
+  }
+  std::ofstream file(cache_file_name_, std::ios::out | std::ios::app);
+  if (file.good()) {
+    file << std::setprecision(17) << cache_key_ << " " << kind << " "
+         << hierarchical_allreduce << " " << hierarchical_allgather << " "
+         << cycle_time_ms << " " << fusion_mb << " " << wakeup_mb << " "
+         << score << " " << algorithm_table << std::endl;
+  }
+}
+
 // TunableParameter
 template <class T>
 ParameterManager::TunableParameter<T>::TunableParameter(T initial_value) :
@@ -347,6 +709,14 @@ void ParameterManager::TunableParameter<T>::Reinitialize(T value) {
   best_score_ = 0;
 }
 
+template <class T>
+void ParameterManager::TunableParameter<T>::ObserveValue(T value, double score) {
+  if (score > best_score_) {
+    best_score_ = score;
+    best_value_ = value;
+  }
+}
+
 template <class T>
 void ParameterManager::TunableParameter<T>::CompleteTuning() {
   value_ = initial_value_;
@@ -386,7 +756,9 @@ ParameterManager::BayesianParameter::BayesianParameter(
     TunableParameter<Eigen::VectorXd>(test_points[0]),
     variables_(variables),
     test_points_(test_points),
-    iteration_(0) {
+    iteration_(0),
+    max_samples_(BAYES_OPT_MAX_SAMPLES),
+    local_search_(false) {
   ResetBayes();
   ResetState();
 }
@@ -418,11 +790,48 @@ double ParameterManager::BayesianParameter::BestValue(BayesianVariable variable)
   return TunableParameter::BestValue()(index_.at(variable));
 }
 
+bool ParameterManager::BayesianParameter::IsFixed(BayesianVariable variable) const {
+  return fixed_values_.find(variable) != fixed_values_.end();
+}
+
+void ParameterManager::BayesianParameter::AddPriorSamples(
+    const std::vector<std::pair<Eigen::VectorXd, double>>& samples) {
+  for (auto& sample : samples) {
+    Eigen::VectorXd value = FilterPoint(sample.first);
+    bayes_->AddSample(value, sample.second);
+    ObserveValue(value, sample.second);
+    ++iteration_;
+  }
+  SetCurrentValue(iteration_ < test_points_.size() ? FilterTestPoint(iteration_) : bayes_->NextSample());
+}
+
+void ParameterManager::BayesianParameter::StartLocalSearch(double radius, uint32_t max_samples) {
+  Eigen::VectorXd best_value = TunableParameter::BestValue();
+  std::vector<std::pair<double, double>> bounds;
+  for (auto var : variables_) {
+    if (fixed_values_.find(var.variable) == fixed_values_.end()) {
+      double best = best_value(index_[var.variable]);
+      double width = (var.bounds.second - var.bounds.first) * radius;
+      bounds.emplace_back(std::max(var.bounds.first, best - width), std::min(var.bounds.second, best + width));
+    }
+  }
+
+  bayes_.reset(new BayesianOptimization(bounds, GAUSSIAN_PROCESS_NOISE));
+  Reinitialize(best_value);
+  iteration_ = 0;
+  max_samples_ = max_samples;
+  local_search_ = true;
+}
+
+bool ParameterManager::BayesianParameter::HasTunableVariables() const {
+  return fixed_values_.size() < variables_.size();
+}
+
 void ParameterManager::BayesianParameter::OnTune(double score, Eigen::VectorXd& value) {
   bayes_->AddSample(value, score);
 
   ++iteration_;
-  if (iteration_ < test_points_.size()) {
+  if (!local_search_ && iteration_ < test_points_.size()) {
     value = FilterTestPoint(iteration_);
   } else {
     value = bayes_->NextSample();
@@ -430,7 +839,7 @@ void ParameterManager::BayesianParameter::OnTune(double score, Eigen::VectorXd&
 }
 
 bool ParameterManager::BayesianParameter::IsDoneTuning() const {
-  return iteration_ > BAYES_OPT_MAX_SAMPLES;
+  return iteration_ > max_samples_;
 }
 
 void ParameterManager::BayesianParameter::ResetState() {
@@ -456,14 +865,17 @@ void ParameterManager::BayesianParameter::ResetBayes() {
 }
 
 Eigen::VectorXd ParameterManager::BayesianParameter::FilterTestPoint(int i) {
-  Eigen::VectorXd& test_point = test_points_[i];
-  Eigen::VectorXd filtered_point(test_point.size() - fixed_values_.size());
+  return FilterPoint(test_points_[i]);
+}
+
+Eigen::VectorXd ParameterManager::BayesianParameter::FilterPoint(const Eigen::VectorXd& point) {
+  Eigen::VectorXd filtered_point(point.size() - fixed_values_.size());
 
   int k = 0;
-  for (int j = 0; j < test_point.size(); ++j) {
+  for (int j = 0; j < point.size(); ++j) {
     BayesianVariable variable = variables_[j].variable;
     if (fixed_values_.find(variable) == fixed_values_.end()) {
-      filtered_point(k) = test_point(j);
+      filtered_point(k) = point(j);
       ++k;
     }
   }
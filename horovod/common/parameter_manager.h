@@ -22,6 +22,8 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <set>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -52,7 +54,13 @@ public:
   void FreeMpiTypes();
 
   // Initializes this manager if auto tuning was requested.
-  void Initialize(int32_t rank, int32_t root_rank, MPI_Comm mpi_comm, std::string file_name);
+  //
+  // Args:
+  //  file_name: Log file of the tried parameters, or empty.
+  //  cache_file_name: File the results of tuning are kept in across runs, or empty.
+  //  job_key: Describes the job (world size, local size, backend) in the cache keys.
+  void Initialize(int32_t rank, int32_t root_rank, MPI_Comm mpi_comm, std::string file_name,
+                  std::string cache_file_name = "", std::string job_key = "");
 
   // Starts or stop the auto tuning procedure.
   void SetAutoTuning(bool active);
@@ -62,12 +70,29 @@ public:
     return active_;
   }
 
-  // Do hierarchical allreduce with MPI + NCCL.
+  // Keeps scoring the throughput after tuning has finished, and tunes the
+  // numerical parameters again around their best values if the score stays
+  // below its usual value by more than the given fraction. Zero disables it.
+  void SetRetuneMargin(double margin);
+
+  // Returns true if Update() needs to be called with the processed tensors.
+  inline bool IsObserving() const {
+    return active_ || retune_margin_ > 0;
+  }
+
+  // Collective operations with a choice of algorithms per message size.
+  enum AlgorithmOp { ALLREDUCE_OP = 0, ALLGATHER_OP = 1 };
+
+  // Do hierarchical allreduce with MPI + NCCL. Without a size, returns true if
+  // any allreduce may be hierarchical.
   bool HierarchicalAllreduce() const;
+  bool HierarchicalAllreduce(int64_t bytes) const;
   void SetHierarchicalAllreduce(bool value, bool fixed=false);
 
-  // Do hierarchical allgather.
+  // Do hierarchical allgather. Without a size, returns true if any allgather
+  // may be hierarchical.
   bool HierarchicalAllgather() const;
+  bool HierarchicalAllgather(int64_t bytes) const;
   void SetHierarchicalAllgather(bool value, bool fixed=false);
 
   // Threshold for Tensor Fusion.  All tensors that occupy memory beyond this
@@ -80,6 +105,12 @@ public:
   double CycleTimeMs() const;
   void SetCycleTimeMs(double cycle_time_ms, bool fixed=false);
 
+  // Number of bytes enqueued since the start of the last cycle after which the
+  // background thread starts the next cycle without waiting for the cycle time
+  // to pass.  Zero disables the early wakeup.
+  int64_t CycleWakeupThresholdBytes() const;
+  void SetCycleWakeupThresholdBytes(int64_t threshold, bool fixed=false);
+
   // Observes that the given tensors have been processed (e.g., allreduced) over the given number of microseconds.
   //
   // Args:
@@ -88,10 +119,19 @@ public:
   //  microseconds: The number of microseconds taken to process the bytes on this worker.
   void Update(const std::vector<std::string>& tensor_names, int64_t bytes);
 
+  // Observes that a response of an operation with the given total size has
+  // been performed in the given number of microseconds, which is attributed to
+  // the algorithm used for its size bucket.
+  void RecordOperation(AlgorithmOp op, int64_t bytes, double microseconds);
+
 private:
   // Adjusts the parameter values based on the last observed score.
   void Tune(double score);
 
+  // Compares the score after tuning has finished with the usual score, and
+  // starts tuning again if it dropped for several samples in a row.
+  void Monitor(double score);
+
   // Broadcasts updated parameter values from the coordinator to the other workers.
   void SyncParams();
 
@@ -102,6 +142,48 @@ private:
   void LogParameters(double score);
   void LogBestParameters();
 
+  // Returns the bucket of the algorithm table for messages of the given size.
+  static int AlgorithmBucket(int64_t bytes);
+
+  // Returns the algorithm table bits of every bucket of an operation.
+  static int32_t AlgorithmMask(AlgorithmOp op);
+
+  // Returns whether operations of the given size use the hierarchical
+  // algorithm, which defaults to the job-wide choice before the table is
+  // tuned.
+  bool UseHierarchical(AlgorithmOp op, int64_t bytes, bool default_value) const;
+
+  // Starts measuring the algorithms of every bucket once the other
+  // parameters are tuned. Returns false if no algorithm is tunable.
+  bool StartAlgorithmTable();
+
+  // Switches between the algorithms after every sample and picks the faster
+  // one for every bucket in the end. Returns true once done.
+  bool TuneAlgorithmTable();
+
+  // Returns the table using the hierarchical or flat algorithm for all
+  // buckets of the tunable operations.
+  int32_t AlgorithmTable(bool hierarchical) const;
+
+  // Lists the algorithm of every bucket of an operation for logging.
+  static std::string AlgorithmBucketList(int32_t table, AlgorithmOp op);
+
+  // Returns true while the parameters other than the algorithm table are tuned.
+  inline bool TuningParams() const {
+    return active_ && algorithm_table_sample_ < 0;
+  }
+
+  // Looks up the results of earlier runs of the same model in the cache file. Either
+  // finishes tuning with the cached best parameters, or adds the cached samples to
+  // the Bayesian optimization. Only called on the coordinator.
+  void LoadCache();
+
+  // Appends the current (kind "sample") or best (kind "best") parameters and their
+  // score to the cache file.
+  void WriteCache(const std::string& kind, bool hierarchical_allreduce, bool hierarchical_allgather,
+                  double cycle_time_ms, double fusion_mb, double wakeup_mb, double score,
+                  int32_t algorithm_table);
+
 
   // Interface used to represent a parameter (or group of parameters) being tuned.
   class ITunableParameter {
@@ -130,6 +212,7 @@ private:
   protected:
     void SetCurrentValue(T value);
     void Reinitialize(T value);
+    void ObserveValue(T value, double score);
 
   private:
     void CompleteTuning();
@@ -161,7 +244,7 @@ private:
     uint32_t index_;
   };
 
-  enum BayesianVariable { fusion_buffer_threshold_mb, cycle_time_ms };
+  enum BayesianVariable { fusion_buffer_threshold_mb, cycle_time_ms, cycle_wakeup_threshold_mb };
 
   struct BayesianVariableConfig {
     BayesianVariable variable;
@@ -176,6 +259,19 @@ private:
     void SetValue(BayesianVariable variable, double value, bool fixed);
     double Value(BayesianVariable variable) const;
     double BestValue(BayesianVariable variable) const;
+    bool IsFixed(BayesianVariable variable) const;
+
+    // Adds samples of earlier runs, with values of all variables in the order of the
+    // test points, and continues with the next point to try.
+    void AddPriorSamples(const std::vector<std::pair<Eigen::VectorXd, double>>& samples);
+
+    // Starts tuning again within the given fraction of the range of every variable
+    // around the best values, beginning with the best values, for at most the given
+    // number of samples.
+    void StartLocalSearch(double radius, uint32_t max_samples);
+
+    // Returns true if any variable isn't fixed.
+    bool HasTunableVariables() const;
 
   private:
     void OnTune(double score, Eigen::VectorXd& value);
@@ -183,10 +279,13 @@ private:
     void ResetState();
     void ResetBayes();
     Eigen::VectorXd FilterTestPoint(int i);
+    Eigen::VectorXd FilterPoint(const Eigen::VectorXd& point);
 
     std::vector<BayesianVariableConfig> variables_;
     std::vector<Eigen::VectorXd> test_points_;
     uint32_t iteration_;
+    uint32_t max_samples_;
+    bool local_search_;
 
     struct EnumClassHash {
       template <typename T>
@@ -204,10 +303,27 @@ private:
   CategoricalParameter<bool> hierarchical_allgather_;
   BayesianParameter joint_params_;
 
+  // Bit (op * ALGORITHM_BUCKETS + bucket) is set if operations in the bucket
+  // use the hierarchical algorithm. Negative until the table is tuned.
+  int32_t algorithm_table_;
+
+  // Number of samples taken while tuning the algorithm table, or negative.
+  int32_t algorithm_table_sample_;
+
+  // Bytes and microseconds of the operations of every bucket with the flat
+  // (0) and hierarchical (1) algorithm while tuning the table.
+  std::vector<std::pair<int64_t, double>> algorithm_stats_[2];
+
   std::vector<ITunableParameter*> parameter_chain_;
   bool active_;
   int32_t warmup_remaining_;
 
+  // Retuning after drops of the throughput, see SetRetuneMargin().
+  double retune_margin_;
+  bool retuning_;
+  double usual_score_;
+  int32_t low_scores_;
+
   static constexpr int SAMPLES = 5;
   double scores_[SAMPLES];
   int32_t sample_;
@@ -221,11 +337,19 @@ private:
   std::ofstream file_;
   bool writing_;
 
+  std::string cache_file_name_;
+  std::string job_key_;
+  std::string cache_key_;
+  // Names of the tensors processed during the warmup, which identify the model.
+  std::set<std::string> warmup_tensor_names_;
+
   struct Params {
     bool hierarchical_allreduce;
     bool hierarchical_allgather;
     double tensor_fusion_threshold;
     double cycle_time;
+    double cycle_wakeup_threshold;
+    int32_t algorithm_table;
     bool active;
   };
 
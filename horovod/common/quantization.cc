@@ -0,0 +1,139 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include "quantization.h"
+
+namespace horovod {
+namespace common {
+
+namespace {
+
+// Number of bytes of the quantized values of a chunk, without its scale.
+int64_t ChunkPayloadSize(int64_t count, Compression compression) {
+  if (compression == ONEBIT_COMPRESSION) {
+    return (count + 7) / 8;
+  }
+  assert(compression == INT8_COMPRESSION);
+  return count;
+}
+
+} // namespace
+
+Quantizer::Quantizer(uint64_t seed) : state_(seed != 0 ? seed : 1) {}
+
+int64_t Quantizer::QuantizedSize(int64_t count, Compression compression) {
+  int64_t full_chunks = count / QUANTIZATION_CHUNK_SIZE;
+  int64_t remainder = count % QUANTIZATION_CHUNK_SIZE;
+  int64_t size =
+      full_chunks * ((int64_t)sizeof(float) +
+                     ChunkPayloadSize(QUANTIZATION_CHUNK_SIZE, compression));
+  if (remainder > 0) {
+    size += (int64_t)sizeof(float) + ChunkPayloadSize(remainder, compression);
+  }
+  return size;
+}
+
+float Quantizer::NextUniform() {
+  state_ ^= state_ >> 12;
+  state_ ^= state_ << 25;
+  state_ ^= state_ >> 27;
+  uint64_t r = state_ * 2685821657736338717ULL;
+  // The upper 24 bits fit exactly into the mantissa of a float.
+  return (float)(r >> 40) * (1.0f / 16777216.0f);
+}
+
+void Quantizer::Quantize(const float* src, int64_t count,
+                         Compression compression, uint8_t* dest,
+                         float* error) {
+  for (int64_t start = 0; start < count; start += QUANTIZATION_CHUNK_SIZE) {
+    int64_t n = std::min((int64_t)QUANTIZATION_CHUNK_SIZE, count - start);
+    const float* in = src + start;
+    float* err = error != nullptr ? error + start : nullptr;
+
+    float scale = 0;
+    uint8_t* payload = dest + sizeof(float);
+    if (compression == ONEBIT_COMPRESSION) {
+      for (int64_t i = 0; i < n; ++i) {
+        scale += std::fabs(in[i]);
+      }
+      scale /= n;
+      std::memset(payload, 0, (size_t)ChunkPayloadSize(n, compression));
+      for (int64_t i = 0; i < n; ++i) {
+        float x = in[i];
+        bool positive = x >= 0;
+        if (positive) {
+          payload[i / 8] |= (uint8_t)(1 << (i % 8));
+        }
+        if (err != nullptr) {
+          err[i] = x - (positive ? scale : -scale);
+        }
+      }
+    } else {
+      assert(compression == INT8_COMPRESSION);
+      for (int64_t i = 0; i < n; ++i) {
+        scale = std::max(scale, std::fabs(in[i]));
+      }
+      scale /= 127;
+      float inverse_scale = scale > 0 ? 1 / scale : 0;
+      auto* q = (int8_t*)payload;
+      for (int64_t i = 0; i < n; ++i) {
+        float x = in[i];
+        float level = std::floor(x * inverse_scale + NextUniform());
+        level = std::max(-127.0f, std::min(127.0f, level));
+        q[i] = (int8_t)level;
+        if (err != nullptr) {
+          err[i] = x - level * scale;
+        }
+      }
+    }
+    std::memcpy(dest, &scale, sizeof(float));
+    dest = payload + ChunkPayloadSize(n, compression);
+  }
+}
+
+void Quantizer::Dequantize(const uint8_t* src, int64_t count,
+                           Compression compression, float* dest,
+                           bool accumulate) {
+  for (int64_t start = 0; start < count; start += QUANTIZATION_CHUNK_SIZE) {
+    int64_t n = std::min((int64_t)QUANTIZATION_CHUNK_SIZE, count - start);
+    float* out = dest + start;
+
+    float scale;
+    std::memcpy(&scale, src, sizeof(float));
+    const uint8_t* payload = src + sizeof(float);
+    if (compression == ONEBIT_COMPRESSION) {
+      for (int64_t i = 0; i < n; ++i) {
+        float value = (payload[i / 8] >> (i % 8)) & 1 ? scale : -scale;
+        out[i] = accumulate ? out[i] + value : value;
+      }
+    } else {
+      assert(compression == INT8_COMPRESSION);
+      auto* q = (const int8_t*)payload;
+      for (int64_t i = 0; i < n; ++i) {
+        float value = q[i] * scale;
+        out[i] = accumulate ? out[i] + value : value;
+      }
+    }
+    src = payload + ChunkPayloadSize(n, compression);
+  }
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,70 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_QUANTIZATION_H
+#define HOROVOD_QUANTIZATION_H
+
+#include <stdint.h>
+
+#include "mpi_message.h"
+
+namespace horovod {
+namespace common {
+
+// Number of values that share a scale in quantized data.
+#define QUANTIZATION_CHUNK_SIZE 512
+
+// Quantizes float32 data for INT8_COMPRESSION and ONEBIT_COMPRESSION.
+//
+// Quantized data is a sequence of chunks of QUANTIZATION_CHUNK_SIZE values
+// (the last chunk may be shorter), each of them stored as a float scale
+// followed by the quantized values:
+//  - INT8_COMPRESSION stores one signed byte per value, stochastically rounded
+//    to a multiple of scale = max(|x|) / 127, so it is unbiased.
+//  - ONEBIT_COMPRESSION stores one bit per value for its sign, which stands
+//    for +scale or -scale with scale = mean(|x|).
+// Since chunks start at multiples of QUANTIZATION_CHUNK_SIZE values, any range
+// of whole chunks can be quantized and dequantized on its own.
+class Quantizer {
+public:
+  explicit Quantizer(uint64_t seed);
+
+  // Returns the number of bytes that count quantized values take up.
+  static int64_t QuantizedSize(int64_t count, Compression compression);
+
+  // Quantizes count values of src into dest. If error is not null, the
+  // difference between every value and its quantized value is written to it.
+  // error may point to src.
+  void Quantize(const float* src, int64_t count, Compression compression,
+                uint8_t* dest, float* error);
+
+  // Dequantizes count values of src into dest, or adds them to dest if
+  // accumulate is true.
+  static void Dequantize(const uint8_t* src, int64_t count,
+                         Compression compression, float* dest,
+                         bool accumulate);
+
+private:
+  // Returns a uniformly distributed random number in [0, 1).
+  float NextUniform();
+
+  // State of the xorshift64* generator used for stochastic rounding.
+  uint64_t state_;
+};
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_QUANTIZATION_H
@@ -0,0 +1,553 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "replay.h"
+
+#include <condition_variable>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "operations.h"
+
+namespace horovod {
+namespace common {
+
+namespace {
+
+const char* const RECORDING_HEADER = "HVDREPLAY";
+
+int64_t ElementSize(MPIDataType dtype) {
+  switch (dtype) {
+  case HOROVOD_UINT8:
+  case HOROVOD_INT8:
+  case HOROVOD_BOOL:
+    return 1;
+  case HOROVOD_UINT16:
+  case HOROVOD_INT16:
+  case HOROVOD_FLOAT16:
+  case HOROVOD_BFLOAT16:
+    return 2;
+  case HOROVOD_INT32:
+  case HOROVOD_FLOAT32:
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+std::vector<std::string> Split(const std::string& line, char separator) {
+  std::vector<std::string> fields;
+  std::stringstream stream(line);
+  std::string field;
+  while (std::getline(stream, field, separator)) {
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+bool ParseOp(const std::string& name, ReplayOp& op) {
+  for (int i = REPLAY_ALLREDUCE; i <= REPLAY_SPARSE_ALLREDUCE; ++i) {
+    if (ReplayOp_Name((ReplayOp)i) == name) {
+      op = (ReplayOp)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ParseDataType(const std::string& name, MPIDataType& dtype) {
+  for (int i = HOROVOD_UINT8; i <= HOROVOD_BFLOAT16; ++i) {
+    if (MPIDataType_Name((MPIDataType)i) == name) {
+      dtype = (MPIDataType)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Parses the optional key=value fields which follow the device of a record.
+bool ParseOption(const std::string& field, ReplayRecord& record) {
+  auto separator = field.find('=');
+  if (separator == std::string::npos) {
+    return false;
+  }
+  auto key = field.substr(0, separator);
+  auto value = field.substr(separator + 1);
+  if (key == "root") {
+    record.root_rank = std::stoi(value);
+  } else if (key == "compression") {
+    record.compression = (Compression)std::stoi(value);
+  } else if (key == "prescale") {
+    record.prescale_factor = std::stod(value);
+  } else if (key == "postscale") {
+    record.postscale_factor = std::stod(value);
+  } else if (key == "priority") {
+    record.priority = std::stoi(value);
+  } else if (key == "accumulation") {
+    record.accumulation_steps = std::stoi(value);
+  } else if (key == "scope") {
+    record.scope = (ReduceScope)std::stoi(value);
+  } else if (key == "replicas") {
+    record.local_replicas = std::stoi(value);
+  } else if (key == "group") {
+    record.group_size = std::stoi(value);
+  } else if (key == "splits") {
+    for (auto& split : Split(value, ',')) {
+      record.splits.push_back(std::stoi(split));
+    }
+  } else if (key == "deduplicate") {
+    record.deduplicate = value == "1";
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseRecord(const std::string& line, ReplayRecord& record) {
+  auto fields = Split(line, '\t');
+  if (fields.size() < 6 || !ParseOp(fields[1], record.op) ||
+      !ParseDataType(fields[3], record.dtype)) {
+    return false;
+  }
+  try {
+    record.micros = std::stoll(fields[0]);
+    record.name = fields[2];
+    for (auto& dim : Split(fields[4], ',')) {
+      record.shape.AddDim(std::stoll(dim));
+    }
+    record.device = std::stoi(fields[5]);
+    for (size_t i = 6; i < fields.size(); ++i) {
+      if (!ParseOption(fields[i], record)) {
+        return false;
+      }
+    }
+  } catch (const std::exception&) {
+    return false;
+  }
+  return true;
+}
+
+class ReplayBuffer : public PersistentBuffer {
+public:
+  explicit ReplayBuffer(int64_t size) : data_(size) {}
+  const void* AccessData(std::shared_ptr<OpContext> context) const override {
+    return data_.data();
+  }
+
+private:
+  std::vector<uint8_t> data_;
+};
+
+// Zero filled host tensor.
+class ReplayTensor : public Tensor {
+public:
+  ReplayTensor(MPIDataType dtype, TensorShape shape)
+      : dtype_(dtype), shape_(std::move(shape)),
+        data_(shape_.num_elements() * ElementSize(dtype)) {}
+  const MPIDataType dtype() const override { return dtype_; }
+  const TensorShape shape() const override { return shape_; }
+  const void* data() const override { return data_.data(); }
+  int64_t size() const override { return (int64_t)data_.size(); }
+
+private:
+  MPIDataType dtype_;
+  TensorShape shape_;
+  std::vector<uint8_t> data_;
+};
+
+// Allocates outputs of the data type of the replayed tensor, or int64 indices
+// as the second output of a sparse allreduce.
+class ReplayOpContext : public OpContext {
+public:
+  explicit ReplayOpContext(MPIDataType dtype) : dtype_(dtype) {}
+  Status AllocatePersistent(int64_t size,
+                            std::shared_ptr<PersistentBuffer>* tensor) override {
+    *tensor = std::make_shared<ReplayBuffer>(size);
+    return Status::OK();
+  }
+  Status AllocateOutput(TensorShape shape,
+                        std::shared_ptr<Tensor>* tensor) override {
+    *tensor = std::make_shared<ReplayTensor>(dtype_, std::move(shape));
+    return Status::OK();
+  }
+  Status AllocateOutput(int output_index, TensorShape shape,
+                        std::shared_ptr<Tensor>* tensor) override {
+    if (output_index < 0 || output_index > 1) {
+      return Status::PreconditionError("Invalid output index " +
+                                       std::to_string(output_index) + ".");
+    }
+    *tensor = std::make_shared<ReplayTensor>(
+        output_index == 0 ? dtype_ : HOROVOD_INT64, std::move(shape));
+    return Status::OK();
+  }
+  Framework framework() const override { return Framework::PYTORCH; }
+
+private:
+  MPIDataType dtype_;
+};
+
+// Operations of the current step which are not done yet.
+class ReplayProgress {
+public:
+  void Start(int64_t tensors) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    outstanding_ += tensors;
+  }
+  void Done(const Status& status) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!status.ok()) {
+      errors_++;
+    }
+    last_done_ = std::chrono::steady_clock::now();
+    if (--outstanding_ == 0) {
+      cv_.notify_all();
+    }
+  }
+  // Waits until all operations are done and returns the time the last of
+  // them was done and the number of failed operations.
+  std::chrono::steady_clock::time_point Wait(int64_t& errors) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return outstanding_ == 0; });
+    errors = errors_;
+    errors_ = 0;
+    return last_done_;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int64_t outstanding_ = 0;
+  int64_t errors_ = 0;
+  std::chrono::steady_clock::time_point last_done_;
+};
+
+int64_t MicrosBetween(std::chrono::steady_clock::time_point from,
+                      std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+      .count();
+}
+
+} // namespace
+
+const std::string& ReplayOp_Name(ReplayOp value) {
+  switch (value) {
+  case REPLAY_ALLREDUCE:
+    static const std::string allreduce("allreduce");
+    return allreduce;
+  case REPLAY_ALLGATHER:
+    static const std::string allgather("allgather");
+    return allgather;
+  case REPLAY_BROADCAST:
+    static const std::string broadcast("broadcast");
+    return broadcast;
+  case REPLAY_REDUCESCATTER:
+    static const std::string reducescatter("reducescatter");
+    return reducescatter;
+  case REPLAY_ALLTOALL:
+    static const std::string alltoall("alltoall");
+    return alltoall;
+  case REPLAY_SPARSE_ALLREDUCE:
+    static const std::string sparse_allreduce("sparse_allreduce");
+    return sparse_allreduce;
+  default:
+    static const std::string unknown("<unknown>");
+    return unknown;
+  }
+}
+
+Status EnqueueRecorder::Initialize(const std::string& file_name, int rank,
+                                   int size) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  file_.open(file_name, std::ios::out | std::ios::trunc);
+  if (!file_.good()) {
+    return Status::PreconditionError("Error opening the enqueue recording " +
+                                     file_name + ".");
+  }
+  file_ << RECORDING_HEADER << '\t' << REPLAY_RECORDING_VERSION << '\t'
+        << rank << '\t' << size << std::endl;
+  start_time_ = std::chrono::steady_clock::now();
+  initialized_ = true;
+  return Status::OK();
+}
+
+void EnqueueRecorder::Record(std::vector<ReplayRecord>& records) {
+  if (!initialized_) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!file_.good()) {
+    return;
+  }
+  auto micros = MicrosBetween(start_time_, std::chrono::steady_clock::now());
+  for (auto& record : records) {
+    record.micros = micros;
+    file_ << micros << '\t' << ReplayOp_Name(record.op) << '\t'
+          << record.name << '\t' << MPIDataType_Name(record.dtype) << '\t';
+    for (int i = 0; i < record.shape.dims(); ++i) {
+      file_ << (i > 0 ? "," : "") << record.shape.dim_size(i);
+    }
+    file_ << '\t' << record.device;
+    if (record.root_rank != 0) {
+      file_ << "\troot=" << record.root_rank;
+    }
+    if (record.compression != NO_COMPRESSION) {
+      file_ << "\tcompression=" << (int)record.compression;
+    }
+    if (record.prescale_factor != 1.0) {
+      file_ << "\tprescale=" << std::setprecision(17)
+            << record.prescale_factor;
+    }
+    if (record.postscale_factor != 1.0) {
+      file_ << "\tpostscale=" << std::setprecision(17)
+            << record.postscale_factor;
+    }
+    if (record.priority != 0) {
+      file_ << "\tpriority=" << record.priority;
+    }
+    if (record.accumulation_steps != 1) {
+      file_ << "\taccumulation=" << record.accumulation_steps;
+    }
+    if (record.scope != GLOBAL_SCOPE) {
+      file_ << "\tscope=" << (int)record.scope;
+    }
+    if (record.local_replicas != 1) {
+      file_ << "\treplicas=" << record.local_replicas;
+    }
+    if (record.group_size != 0) {
+      file_ << "\tgroup=" << record.group_size;
+    }
+    if (!record.splits.empty()) {
+      file_ << "\tsplits=";
+      for (size_t i = 0; i < record.splits.size(); ++i) {
+        file_ << (i > 0 ? "," : "") << record.splits[i];
+      }
+    }
+    if (record.deduplicate) {
+      file_ << "\tdeduplicate=1";
+    }
+    file_ << '\n';
+  }
+  // Flush every call, so that the recording of a job which is killed is
+  // still complete.
+  file_.flush();
+}
+
+void EnqueueRecorder::Shutdown() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (initialized_) {
+    initialized_ = false;
+    file_.close();
+  }
+}
+
+Status ReadRecording(const std::string& file_name,
+                     std::vector<ReplayRecord>& records, int& size) {
+  std::ifstream file(file_name);
+  if (!file.good()) {
+    return Status::PreconditionError("Error opening the enqueue recording " +
+                                     file_name + ".");
+  }
+  std::string line;
+  std::getline(file, line);
+  auto header = Split(line, '\t');
+  if (header.size() != 4 || header[0] != RECORDING_HEADER ||
+      header[1] != std::to_string(REPLAY_RECORDING_VERSION)) {
+    return Status::InvalidArgument(file_name +
+                                   " is not an enqueue recording of version " +
+                                   std::to_string(REPLAY_RECORDING_VERSION) +
+                                   ".");
+  }
+  size = std::atoi(header[3].c_str());
+  int line_number = 1;
+  while (std::getline(file, line)) {
+    line_number++;
+    if (line.empty()) {
+      continue;
+    }
+    ReplayRecord record;
+    if (!ParseRecord(line, record)) {
+      return Status::InvalidArgument("Invalid record on line " +
+                                     std::to_string(line_number) + " of " +
+                                     file_name + ".");
+    }
+    records.push_back(std::move(record));
+  }
+  return Status::OK();
+}
+
+Status Replay(const std::vector<ReplayRecord>& records,
+              std::vector<ReplayStep>& steps) {
+  if (records.empty()) {
+    return Status::OK();
+  }
+
+  // Inputs are reused by every step, like the parameters of a model.
+  std::unordered_map<std::string, std::shared_ptr<Tensor>> inputs;
+  auto input = [&inputs](const ReplayRecord& record) {
+    auto& tensor = inputs[record.name];
+    if (tensor == nullptr) {
+      tensor = std::make_shared<ReplayTensor>(record.dtype, record.shape);
+    }
+    return tensor;
+  };
+
+  ReplayProgress progress;
+  auto callback = [&progress](const Status& status) { progress.Done(status); };
+  auto& first_name = records[0].name;
+  // Number of calls of every tensor in the current step.
+  std::unordered_map<std::string, int32_t> seen;
+  ReplayStep step;
+  auto step_start = std::chrono::steady_clock::now();
+  auto last_enqueue = step_start;
+  int64_t recorded_step_start = records[0].micros;
+
+  auto finish_step = [&]() {
+    auto done = progress.Wait(step.errors);
+    if (step.tensors > 0) {
+      step.micros = std::max(MicrosBetween(step_start, done), (int64_t)0);
+      step.communication_micros =
+          std::max(MicrosBetween(last_enqueue, done), (int64_t)0);
+      steps.push_back(step);
+    }
+    step = ReplayStep();
+    seen.clear();
+  };
+
+  for (size_t i = 0; i < records.size();) {
+    auto& record = records[i];
+    int32_t replicas = std::max(record.local_replicas, 1);
+    if (i > 0 && record.name == first_name && seen[first_name] >= replicas) {
+      finish_step();
+      recorded_step_start = record.micros;
+      step_start = std::chrono::steady_clock::now();
+    }
+    // All replicas of a tensor are replayed by the first of them.
+    if (seen[record.name]++ % replicas != 0) {
+      i++;
+      continue;
+    }
+    std::this_thread::sleep_until(
+        step_start +
+        std::chrono::microseconds(record.micros - recorded_step_start));
+
+    size_t count = 1;
+    Status status;
+    if (record.op == REPLAY_ALLREDUCE && record.group_size > 1 &&
+        i + record.group_size <= records.size()) {
+      count = record.group_size;
+      std::vector<std::shared_ptr<OpContext>> contexts;
+      std::vector<std::shared_ptr<Tensor>> tensors;
+      std::vector<std::shared_ptr<Tensor>> outputs;
+      std::vector<std::shared_ptr<ReadyEvent>> ready_events(count);
+      std::vector<std::string> names;
+      std::vector<StatusCallback> callbacks(count, callback);
+      for (size_t j = i; j < i + count; ++j) {
+        contexts.push_back(std::make_shared<ReplayOpContext>(records[j].dtype));
+        tensors.push_back(input(records[j]));
+        outputs.push_back(
+            std::make_shared<ReplayTensor>(records[j].dtype, records[j].shape));
+        names.push_back(records[j].name);
+      }
+      progress.Start(count);
+      status = EnqueueTensorAllreduces(
+          contexts, tensors, outputs, ready_events, names, CPU_DEVICE_ID,
+          callbacks, record.compression, record.prescale_factor,
+          record.postscale_factor, record.priority);
+    } else {
+      auto context = std::make_shared<ReplayOpContext>(record.dtype);
+      auto tensor = input(record);
+      progress.Start(1);
+      switch (record.op) {
+      case REPLAY_ALLREDUCE:
+        status = EnqueueTensorAllreduce(
+            context, tensor,
+            std::make_shared<ReplayTensor>(record.dtype, record.shape),
+            nullptr, record.name, CPU_DEVICE_ID, callback, record.compression,
+            record.prescale_factor, record.postscale_factor, record.priority,
+            record.accumulation_steps, record.scope);
+        break;
+      case REPLAY_ALLGATHER:
+        status = EnqueueTensorAllgather(context, tensor, nullptr, record.name,
+                                        CPU_DEVICE_ID, callback);
+        break;
+      case REPLAY_BROADCAST:
+        status = EnqueueTensorBroadcast(
+            context, tensor,
+            std::make_shared<ReplayTensor>(record.dtype, record.shape),
+            record.root_rank, nullptr, record.name, CPU_DEVICE_ID, callback);
+        break;
+      case REPLAY_REDUCESCATTER:
+        status = EnqueueTensorReducescatter(context, tensor, nullptr,
+                                            record.name, CPU_DEVICE_ID,
+                                            callback);
+        break;
+      case REPLAY_ALLTOALL:
+        status = EnqueueTensorAlltoall(context, tensor, record.splits, nullptr,
+                                       record.name, CPU_DEVICE_ID, callback);
+        break;
+      case REPLAY_SPARSE_ALLREDUCE: {
+        TensorShape indices_shape;
+        indices_shape.AddDim(record.shape.dims() > 0 ? record.shape.dim_size(0)
+                                                     : 0);
+        auto& indices = inputs[record.name + ".indices"];
+        if (indices == nullptr) {
+          indices = std::make_shared<ReplayTensor>(HOROVOD_INT64, indices_shape);
+          auto data = (int64_t*)indices->data();
+          for (int64_t j = 0; j < indices_shape.dim_size(0); ++j) {
+            data[j] = j;
+          }
+        }
+        status = EnqueueTensorSparseAllreduce(
+            context, tensor, indices, nullptr, record.name, CPU_DEVICE_ID,
+            record.deduplicate, callback);
+        break;
+      }
+      }
+    }
+    last_enqueue = std::chrono::steady_clock::now();
+    if (!status.ok()) {
+      // Operations which could not be enqueued don't call back.
+      for (size_t j = 0; j < count; ++j) {
+        callback(status);
+      }
+    }
+    for (size_t j = i; j < i + count; ++j) {
+      step.tensors++;
+      step.bytes += records[j].shape.num_elements() *
+                    ElementSize(records[j].dtype) *
+                    std::max(records[j].local_replicas, 1);
+    }
+    i += count;
+  }
+  finish_step();
+  return Status::OK();
+}
+
+void WriteReplayJson(const std::vector<ReplayStep>& steps, std::ostream& out) {
+  out << "{\"steps\": [";
+  for (size_t i = 0; i < steps.size(); ++i) {
+    auto& step = steps[i];
+    out << (i > 0 ? ", " : "") << "{\"tensors\": " << step.tensors
+        << ", \"bytes\": " << step.bytes << ", \"micros\": " << step.micros
+        << ", \"communication_micros\": " << step.communication_micros
+        << ", \"errors\": " << step.errors << "}";
+  }
+  out << "]}" << std::endl;
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,127 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_REPLAY_H
+#define HOROVOD_REPLAY_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "mpi_message.h"
+
+namespace horovod {
+namespace common {
+
+// Operations whose enqueueing can be recorded and replayed.
+enum ReplayOp {
+  REPLAY_ALLREDUCE = 0,
+  REPLAY_ALLGATHER = 1,
+  REPLAY_BROADCAST = 2,
+  REPLAY_REDUCESCATTER = 3,
+  REPLAY_ALLTOALL = 4,
+  REPLAY_SPARSE_ALLREDUCE = 5
+};
+
+const std::string& ReplayOp_Name(ReplayOp value);
+
+// A call to one of the Enqueue* functions, with everything needed to make the
+// same call again on tensors of the same type and shape.
+struct ReplayRecord {
+  // Time of the call in microseconds since the recording started.
+  int64_t micros = 0;
+  ReplayOp op = REPLAY_ALLREDUCE;
+  std::string name;
+  MPIDataType dtype = HOROVOD_FLOAT32;
+  // Shape of the tensor, or of the values of a sparse allreduce.
+  TensorShape shape;
+  int device = CPU_DEVICE_ID;
+  int root_rank = 0;
+  Compression compression = NO_COMPRESSION;
+  double prescale_factor = 1.0;
+  double postscale_factor = 1.0;
+  int32_t priority = 0;
+  int32_t accumulation_steps = 1;
+  ReduceScope scope = GLOBAL_SCOPE;
+  int32_t local_replicas = 1;
+  // Number of tensors of a grouped allreduce, recorded with each of them.
+  int32_t group_size = 0;
+  std::vector<int32_t> splits;
+  bool deduplicate = false;
+};
+
+// Records the Enqueue* calls of a rank into a text file, one tab separated
+// line per call, so that their timing can be replayed without the model and
+// the framework which made them. The file starts with a line holding
+// "HVDREPLAY", the version, the rank and the number of ranks.
+class EnqueueRecorder {
+public:
+  ~EnqueueRecorder() { Shutdown(); }
+  Status Initialize(const std::string& file_name, int rank, int size);
+  inline bool Initialized() const { return initialized_; }
+  // Records calls which were made together, such as the allreduces of a
+  // group, with the current time. Safe to call from any thread.
+  void Record(std::vector<ReplayRecord>& records);
+  void Shutdown();
+
+private:
+  std::atomic_bool initialized_{false};
+  std::mutex mutex_;
+  std::ofstream file_;
+  std::chrono::steady_clock::time_point start_time_;
+};
+
+#define REPLAY_RECORDING_VERSION 1
+
+// Reads the records of a recording and the number of ranks of the job which
+// made it.
+Status ReadRecording(const std::string& file_name,
+                     std::vector<ReplayRecord>& records, int& size);
+
+// Communication of one training step of a replay. A step begins whenever the
+// first tensor of the recording is enqueued again.
+struct ReplayStep {
+  int64_t tensors = 0;
+  int64_t bytes = 0;
+  // Time from the first call of the step until all its operations were done.
+  int64_t micros = 0;
+  // Time from the last call of the step until all its operations were done,
+  // which is the communication not hidden behind the computation between the
+  // calls.
+  int64_t communication_micros = 0;
+  // Operations which failed.
+  int64_t errors = 0;
+};
+
+// Makes the calls of a recording again on host tensors, with the same time
+// between the calls of a step as in the recording. A step waits until the
+// operations of the previous step are done, like a training loop which uses
+// their results. GPU tensors are replayed on the CPU, and the replicas of a
+// tensor on several GPUs as a single tensor. Horovod has to be initialized.
+Status Replay(const std::vector<ReplayRecord>& records,
+              std::vector<ReplayStep>& steps);
+
+// Writes the steps of a replay as a JSON object.
+void WriteReplayJson(const std::vector<ReplayStep>& steps, std::ostream& out);
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_REPLAY_H
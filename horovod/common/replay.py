@@ -0,0 +1,59 @@
+# Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+"""Replays the operations of a job recorded with HOROVOD_ENQUEUE_RECORDING.
+
+Usage: mpirun -np <size> python -m horovod.common.replay \
+           [--framework torch|tensorflow|mxnet] recording [report.json]
+"""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import argparse
+import importlib
+import os
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Replays the operations of a recorded Horovod job.')
+    parser.add_argument('--framework', default='torch',
+                        choices=['torch', 'tensorflow', 'mxnet'],
+                        help='Framework whose Horovod library replays.')
+    parser.add_argument('recording',
+                        help='Value of HOROVOD_ENQUEUE_RECORDING of the job.')
+    parser.add_argument('report', nargs='?',
+                        help='File to write the replayed steps to as JSON.')
+    args = parser.parse_args()
+
+    # Don't overwrite the recording with the replay.
+    os.environ.pop('HOROVOD_ENQUEUE_RECORDING', None)
+    hvd = importlib.import_module('horovod.' + args.framework)
+    hvd.init()
+    steps = hvd.replay(args.recording,
+                       args.report if hvd.rank() == 0 else None)
+    if hvd.rank() == 0:
+        for i, step in enumerate(steps):
+            print('step %d: %d tensors, %d bytes, %.3f ms, %.3f ms '
+                  'communication%s' %
+                  (i, step['tensors'], step['bytes'], step['micros'] / 1000.0,
+                   step['communication_micros'] / 1000.0,
+                   ', %d errors' % step['errors'] if step['errors'] else ''))
+    hvd.shutdown()
+
+
+if __name__ == '__main__':
+    main()
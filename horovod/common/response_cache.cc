@@ -0,0 +1,274 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <cassert>
+#include <iterator>
+
+#include "response_cache.h"
+
+namespace horovod {
+namespace common {
+
+namespace {
+
+MPIRequest::RequestType RequestTypeOf(const MPIResponse& response) {
+  switch (response.response_type()) {
+  case MPIResponse::ALLGATHER:
+    return MPIRequest::ALLGATHER;
+  case MPIResponse::BROADCAST:
+    return MPIRequest::BROADCAST;
+  case MPIResponse::SPARSE_ALLREDUCE:
+    return MPIRequest::SPARSE_ALLREDUCE;
+  case MPIResponse::REDUCESCATTER:
+    return MPIRequest::REDUCESCATTER;
+  case MPIResponse::ALLTOALL:
+    return MPIRequest::ALLTOALL;
+  default:
+    return MPIRequest::ALLREDUCE;
+  }
+}
+
+// Packs a set of bits into 64-bit words, starting at the given offset.
+void SetBits(std::vector<uint64_t>& words, const std::set<uint32_t>& bits,
+             uint32_t offset) {
+  for (auto bit : bits) {
+    uint32_t pos = bit + offset;
+    words[pos / 64] |= (uint64_t)1 << (pos % 64);
+  }
+}
+
+// Unpacks set bits from words into a set, skipping the first offset bits.
+void GetBits(const std::vector<uint64_t>& words, std::set<uint32_t>& bits,
+             uint32_t offset) {
+  bits.clear();
+  for (size_t i = 0; i < words.size(); ++i) {
+    uint64_t word = words[i];
+    while (word != 0) {
+      uint32_t pos = (uint32_t)(i * 64) + __builtin_ctzll(word);
+      if (pos >= offset) {
+        bits.insert(pos - offset);
+      }
+      word &= word - 1;
+    }
+  }
+}
+
+} // namespace
+
+void ResponseCache::set_capacity(uint32_t capacity) {
+  capacity_ = capacity;
+  cache_.clear();
+  cache_iters_.clear();
+  tensor_name_to_bit_.clear();
+  bits_outdated_ = false;
+}
+
+uint32_t ResponseCache::capacity() const { return capacity_; }
+
+uint32_t ResponseCache::num_active_bits() const {
+  return (uint32_t)cache_iters_.size();
+}
+
+ResponseCache::CacheState
+ResponseCache::cached(const MPIRequest& message) const {
+  auto it = tensor_name_to_bit_.find(message.tensor_name());
+  if (it == tensor_name_to_bit_.end()) {
+    return CacheState::MISS;
+  }
+
+  auto& params = cache_iters_[it->second]->second;
+  if (params.request_type == message.request_type() &&
+      params.dtype == message.tensor_type() &&
+      params.shape == message.tensor_shape() &&
+      params.device == message.device() &&
+      params.root_rank == message.root_rank() &&
+      params.compression == message.compression() &&
+      params.priority == message.priority() &&
+      params.scope == message.scope()) {
+    return CacheState::HIT;
+  }
+  return CacheState::INVALID;
+}
+
+void ResponseCache::put_(const MPIResponse& response,
+                         const TensorParams& params) {
+  auto& name = response.tensor_names()[0];
+  auto it = tensor_name_to_bit_.find(name);
+  if (it != tensor_name_to_bit_.end()) {
+    // Replace the existing entry and move it to the front.
+    uint32_t cache_bit = it->second;
+    auto cache_it = cache_iters_[cache_bit];
+    cache_it->first = response;
+    cache_it->second = params;
+    cache_.splice(cache_.begin(), cache_, cache_it);
+  } else if (cache_.size() >= capacity_) {
+    // Evict the least recently used entry and reuse its bit.
+    auto& evicted_name = cache_.back().first.tensor_names()[0];
+    uint32_t cache_bit = tensor_name_to_bit_[evicted_name];
+    tensor_name_to_bit_.erase(evicted_name);
+    cache_.pop_back();
+    cache_.emplace_front(response, params);
+    cache_iters_[cache_bit] = cache_.begin();
+    tensor_name_to_bit_[name] = cache_bit;
+  } else {
+    cache_.emplace_front(response, params);
+    cache_iters_.push_back(cache_.begin());
+    tensor_name_to_bit_[name] = (uint32_t)cache_iters_.size() - 1;
+  }
+  bits_outdated_ = true;
+}
+
+void ResponseCache::put(const MPIResponse& response,
+                        const std::vector<TensorParams>& params) {
+  if (capacity_ == 0) {
+    return;
+  }
+  assert(response.tensor_names().size() == params.size());
+
+  // Fused responses are split up so that every tensor gets its own entry.
+  auto& names = response.tensor_names();
+  size_t num_ranks = response.devices().size();
+  for (size_t i = 0; i < names.size(); ++i) {
+    MPIResponse single;
+    single.set_response_type(response.response_type());
+    single.add_tensor_name(names[i]);
+    single.set_devices(response.devices());
+    single.set_priority(params[i].priority);
+    single.set_scope(params[i].scope);
+    // A response replayed from the cache has the same tensor sizes as the
+    // last response for its tensor.
+    single.set_shape_stable(true);
+    if (response.response_type() == MPIResponse::ALLGATHER) {
+      for (size_t rank = 0; rank < num_ranks; ++rank) {
+        single.add_tensor_size(response.tensor_sizes()[i * num_ranks + rank]);
+      }
+    }
+    assert(params[i].request_type == RequestTypeOf(single));
+    put_(single, params[i]);
+  }
+}
+
+const MPIResponse& ResponseCache::peek_response(uint32_t cache_bit) const {
+  assert(cache_bit < cache_iters_.size());
+  return cache_iters_[cache_bit]->first;
+}
+
+uint32_t ResponseCache::peek_cache_bit(const std::string& tensor_name) const {
+  auto it = tensor_name_to_bit_.find(tensor_name);
+  assert(it != tensor_name_to_bit_.end());
+  return it->second;
+}
+
+void ResponseCache::erase_response(uint32_t cache_bit) {
+  assert(cache_bit < cache_iters_.size());
+  auto cache_it = cache_iters_[cache_bit];
+  if (cache_it == cache_.end()) {
+    return;
+  }
+  tensor_name_to_bit_.erase(cache_it->first.tensor_names()[0]);
+  cache_.erase(cache_it);
+  cache_iters_[cache_bit] = cache_.end();
+  bits_outdated_ = true;
+}
+
+void ResponseCache::update_cache_bits() {
+  if (!bits_outdated_) {
+    return;
+  }
+
+  // Walk the cache from the least recently used entry.
+  cache_iters_.resize(cache_.size());
+  uint32_t cache_bit = 0;
+  for (auto it = cache_.rbegin(); it != cache_.rend(); ++it) {
+    cache_iters_[cache_bit] = std::prev(it.base());
+    tensor_name_to_bit_[it->first.tensor_names()[0]] = cache_bit;
+    ++cache_bit;
+  }
+  bits_outdated_ = false;
+}
+
+CacheCoordinator::CacheCoordinator(uint32_t num_active_bits)
+    : num_active_bits_(num_active_bits) {}
+
+void CacheCoordinator::record_hit(uint32_t bit) { cache_hits_.insert(bit); }
+
+void CacheCoordinator::record_invalid_bit(uint32_t bit) {
+  invalid_bits_.insert(bit);
+  invalid_in_queue_ = true;
+}
+
+void CacheCoordinator::set_should_shut_down(bool should_shut_down) {
+  should_shut_down_ = should_shut_down;
+}
+
+void CacheCoordinator::set_uncached_in_queue(bool uncached_in_queue) {
+  uncached_in_queue_ = uncached_in_queue;
+}
+
+const std::set<uint32_t>& CacheCoordinator::cache_hits() const {
+  return cache_hits_;
+}
+
+const std::set<uint32_t>& CacheCoordinator::invalid_bits() const {
+  return invalid_bits_;
+}
+
+bool CacheCoordinator::should_shut_down() const { return should_shut_down_; }
+
+bool CacheCoordinator::uncached_in_queue() const { return uncached_in_queue_; }
+
+void CacheCoordinator::sync(MPI_Comm comm) {
+  std::vector<uint64_t> bitvector(
+      (num_active_bits_ + NUM_STATUS_BITS + 63) / 64, 0);
+
+  // Status bits are inverted so that bitwise AND across ranks yields an OR.
+  if (!should_shut_down_) {
+    bitvector[0] |= (uint64_t)1 << SHOULD_SHUT_DOWN;
+  }
+  if (!uncached_in_queue_) {
+    bitvector[0] |= (uint64_t)1 << UNCACHED_IN_QUEUE;
+  }
+  if (!invalid_in_queue_) {
+    bitvector[0] |= (uint64_t)1 << INVALID_IN_QUEUE;
+  }
+  SetBits(bitvector, cache_hits_, NUM_STATUS_BITS);
+
+  MPI_Allreduce(MPI_IN_PLACE, bitvector.data(), (int)bitvector.size(),
+                MPI_UINT64_T, MPI_BAND, comm);
+
+  should_shut_down_ = (bitvector[0] & ((uint64_t)1 << SHOULD_SHUT_DOWN)) == 0;
+  uncached_in_queue_ =
+      (bitvector[0] & ((uint64_t)1 << UNCACHED_IN_QUEUE)) == 0;
+  invalid_in_queue_ = (bitvector[0] & ((uint64_t)1 << INVALID_IN_QUEUE)) == 0;
+  GetBits(bitvector, cache_hits_, NUM_STATUS_BITS);
+
+  // Invalid entries are rare (shape or type changes), so only exchange them
+  // when at least one rank has any.
+  if (invalid_in_queue_) {
+    std::vector<uint64_t> invalid_bitvector((num_active_bits_ + 63) / 64, 0);
+    SetBits(invalid_bitvector, invalid_bits_, 0);
+    MPI_Allreduce(MPI_IN_PLACE, invalid_bitvector.data(),
+                  (int)invalid_bitvector.size(), MPI_UINT64_T, MPI_BOR, comm);
+    GetBits(invalid_bitvector, invalid_bits_, 0);
+
+    // A tensor invalidated on any rank cannot be served from the cache.
+    for (auto bit : invalid_bits_) {
+      cache_hits_.erase(bit);
+    }
+  }
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,147 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_RESPONSE_CACHE_H
+#define HOROVOD_RESPONSE_CACHE_H
+
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#define OMPI_SKIP_MPICXX
+#include "mpi.h"
+#include "mpi_message.h"
+
+namespace horovod {
+namespace common {
+
+// Parameters of a tensor on this rank which must not change for a cached
+// response to remain valid.
+struct TensorParams {
+  MPIRequest::RequestType request_type = MPIRequest::ALLREDUCE;
+  MPIDataType dtype = HOROVOD_UINT8;
+  std::vector<int64_t> shape;
+  int32_t device = CPU_DEVICE_ID;
+  int32_t root_rank = 0;
+  Compression compression = NO_COMPRESSION;
+  int32_t priority = 0;
+  ReduceScope scope = GLOBAL_SCOPE;
+};
+
+// LRU cache of MPIResponses that all ranks have already agreed on.
+//
+// Every rank inserts responses into the cache in the same order, so the
+// position of a response in the cache (its "cache bit") refers to the same
+// tensor on every rank. Ranks can then exchange a bit vector of cache hits
+// instead of serialized MPIRequests to find tensors that are ready everywhere.
+class ResponseCache {
+public:
+  enum CacheState { MISS = 0, HIT = 1, INVALID = 2 };
+
+  void set_capacity(uint32_t capacity);
+  uint32_t capacity() const;
+
+  // Number of bits currently in use, identical on all ranks.
+  uint32_t num_active_bits() const;
+
+  // Checks whether the response for this request is cached. A cached response
+  // for a tensor with different parameters is reported as INVALID.
+  CacheState cached(const MPIRequest& message) const;
+
+  // Adds a (possibly fused) response to the cache, replacing any existing
+  // entries for its tensors and marking them as most recently used.
+  //
+  // Args:
+  //  response: ALLREDUCE, ALLGATHER, BROADCAST, REDUCESCATTER or ALLTOALL
+  //            response.
+  //  params: Parameters of every tensor in the response, in order.
+  void put(const MPIResponse& response, const std::vector<TensorParams>& params);
+
+  // Returns the cached response for a bit without changing the cache order.
+  const MPIResponse& peek_response(uint32_t cache_bit) const;
+
+  // Returns the cache bit of a cached tensor.
+  uint32_t peek_cache_bit(const std::string& tensor_name) const;
+
+  void erase_response(uint32_t cache_bit);
+
+  // Reassigns cache bits based on the current cache order so that the least
+  // recently used responses get the lowest bits. Must be called by all ranks
+  // at the same point in the cycle.
+  void update_cache_bits();
+
+private:
+  void put_(const MPIResponse& response, const TensorParams& params);
+
+  uint32_t capacity_ = 0;
+
+  // Most recently used responses are at the front.
+  std::list<std::pair<MPIResponse, TensorParams>> cache_;
+  std::vector<std::list<std::pair<MPIResponse, TensorParams>>::iterator>
+      cache_iters_;
+  std::unordered_map<std::string, uint32_t> tensor_name_to_bit_;
+  bool bits_outdated_ = false;
+};
+
+// Collects the cache hits and status flags of one cycle on this rank and
+// synchronizes them with all the other ranks.
+class CacheCoordinator {
+public:
+  explicit CacheCoordinator(uint32_t num_active_bits);
+
+  void record_hit(uint32_t bit);
+  void record_invalid_bit(uint32_t bit);
+  void set_should_shut_down(bool should_shut_down);
+  void set_uncached_in_queue(bool uncached_in_queue);
+
+  // After sync(), cache hits common to all ranks.
+  const std::set<uint32_t>& cache_hits() const;
+
+  // After sync(), cache bits invalidated on any rank.
+  const std::set<uint32_t>& invalid_bits() const;
+
+  // After sync(), true if any rank requested shutdown.
+  bool should_shut_down() const;
+
+  // After sync(), true if any rank has requests that need full negotiation.
+  bool uncached_in_queue() const;
+
+  // Combines the cache hits of all ranks with a bitwise AND. Status flags are
+  // stored inverted in the same bit vector so that the AND computes a logical
+  // OR for them. Invalid bits are only exchanged if some rank has any.
+  void sync(MPI_Comm comm);
+
+private:
+  enum StatusBit {
+    SHOULD_SHUT_DOWN = 0,
+    UNCACHED_IN_QUEUE = 1,
+    INVALID_IN_QUEUE = 2
+  };
+  static const uint32_t NUM_STATUS_BITS = 3;
+
+  uint32_t num_active_bits_;
+  std::set<uint32_t> cache_hits_;
+  std::set<uint32_t> invalid_bits_;
+  bool should_shut_down_ = false;
+  bool uncached_in_queue_ = false;
+  bool invalid_in_queue_ = false;
+};
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_RESPONSE_CACHE_H
@@ -0,0 +1,465 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "tcp_ring.h"
+
+// Broken connections are reported by send() instead of a SIGPIPE.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace horovod {
+namespace common {
+
+namespace {
+
+// Address of the listening sockets of a rank, which is exchanged over MPI.
+struct RingAddress {
+  char host[64];
+  uint32_t ip;
+  uint16_t port;
+  int32_t pid;
+};
+
+// First message on every connection, which tells the accepting rank which
+// connection it is.
+struct RingHello {
+  int32_t rank;
+  int32_t connection;
+};
+
+Status SocketError(const std::string& call) {
+  return Status::UnknownError(call + " failed: " + std::strerror(errno));
+}
+
+// Path of the Unix domain socket a process listens on for peers on its host.
+void UnixAddress(int32_t pid, sockaddr_un* address) {
+  std::memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  auto tmpdir = std::getenv("TMPDIR");
+  std::snprintf(address->sun_path, sizeof(address->sun_path),
+                "%s/horovod-ring.%d", tmpdir != nullptr ? tmpdir : "/tmp",
+                (int)pid);
+}
+
+// Returns the IPv4 address of the given interface, or of the first interface
+// which is up and isn't a loopback, in network byte order.
+Status InterfaceAddress(const char* interface, uint32_t* ip) {
+  ifaddrs* addresses;
+  if (getifaddrs(&addresses) != 0) {
+    return SocketError("getifaddrs");
+  }
+  bool found = false;
+  for (auto a = addresses; a != nullptr && !found; a = a->ifa_next) {
+    if (a->ifa_addr == nullptr || a->ifa_addr->sa_family != AF_INET ||
+        !(a->ifa_flags & IFF_UP)) {
+      continue;
+    }
+    if (interface != nullptr ? std::strcmp(a->ifa_name, interface) == 0
+                             : !(a->ifa_flags & IFF_LOOPBACK)) {
+      *ip = ((sockaddr_in*)a->ifa_addr)->sin_addr.s_addr;
+      found = true;
+    }
+  }
+  freeifaddrs(addresses);
+  if (!found) {
+    if (interface != nullptr) {
+      return Status::InvalidArgument(std::string("Network interface ") +
+                                     interface + " has no IPv4 address.");
+    }
+    *ip = htonl(INADDR_LOOPBACK);
+  }
+  return Status::OK();
+}
+
+Status WriteAll(int fd, const void* data, size_t size) {
+  auto bytes = (const uint8_t*)data;
+  while (size > 0) {
+    auto n = write(fd, bytes, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return SocketError("write");
+    }
+    bytes += n;
+    size -= (size_t)n;
+  }
+  return Status::OK();
+}
+
+Status ReadAll(int fd, void* data, size_t size) {
+  auto bytes = (uint8_t*)data;
+  while (size > 0) {
+    auto n = read(fd, bytes, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n == 0) {
+      return Status::UnknownError("Connection of the ring was closed.");
+    }
+    if (n < 0) {
+      return SocketError("read");
+    }
+    bytes += n;
+    size -= (size_t)n;
+  }
+  return Status::OK();
+}
+
+} // namespace
+
+TcpRing::~TcpRing() { Finalize(); }
+
+Status TcpRing::Initialize(MPI_Comm comm, int num_connections,
+                           const char* interface) {
+  Finalize();
+  MPI_Comm_rank(comm, &rank_);
+  MPI_Comm_size(comm, &size_);
+  num_connections = std::max(num_connections, 1);
+
+  RingAddress address;
+  std::memset(&address, 0, sizeof(address));
+  gethostname(address.host, sizeof(address.host) - 1);
+  address.pid = (int32_t)getpid();
+  auto status = InterfaceAddress(interface, &address.ip);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Listen on an ephemeral TCP port and on a Unix domain socket.
+  int tcp_listener = socket(AF_INET, SOCK_STREAM, 0);
+  int unix_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_in tcp_address;
+  std::memset(&tcp_address, 0, sizeof(tcp_address));
+  tcp_address.sin_family = AF_INET;
+  tcp_address.sin_addr.s_addr = address.ip;
+  tcp_address.sin_port = 0;
+  socklen_t tcp_address_size = sizeof(tcp_address);
+  sockaddr_un unix_address;
+  UnixAddress(address.pid, &unix_address);
+  unlink(unix_address.sun_path);
+  if (tcp_listener < 0 || unix_listener < 0 ||
+      bind(tcp_listener, (sockaddr*)&tcp_address, sizeof(tcp_address)) != 0 ||
+      listen(tcp_listener, num_connections) != 0 ||
+      getsockname(tcp_listener, (sockaddr*)&tcp_address, &tcp_address_size) !=
+          0 ||
+      bind(unix_listener, (sockaddr*)&unix_address, sizeof(unix_address)) !=
+          0 ||
+      listen(unix_listener, num_connections) != 0) {
+    status = SocketError("Listening socket of the ring");
+  }
+  address.port = tcp_address.sin_port;
+
+  // All ranks have to take part in the exchange even if they failed, and
+  // the status is reduced afterwards.
+  std::vector<RingAddress> addresses((size_t)size_);
+  MPI_Allgather(&address, sizeof(address), MPI_BYTE, addresses.data(),
+                sizeof(address), MPI_BYTE, comm);
+  int failed = status.ok() ? 0 : 1;
+  MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, comm);
+  if (status.ok() && failed) {
+    status = Status::UnknownError("Another rank couldn't set up its ring.");
+  }
+
+  // Connect to the next rank. Connections complete in the backlog of the
+  // listening socket, so all ranks can connect before they accept. Peers on
+  // the same host are tried through their Unix domain socket first, which
+  // may not be reachable if they run in another container.
+  auto& next = addresses[(rank_ + 1) % size_];
+  bool next_local = std::strcmp(next.host, address.host) == 0;
+  for (int i = 0; i < num_connections && status.ok(); ++i) {
+    int fd = -1;
+    int result = -1;
+    if (next_local) {
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      sockaddr_un next_address;
+      UnixAddress(next.pid, &next_address);
+      result = connect(fd, (sockaddr*)&next_address, sizeof(next_address));
+      if (result != 0 && fd >= 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    if (result != 0) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in next_address;
+      std::memset(&next_address, 0, sizeof(next_address));
+      next_address.sin_family = AF_INET;
+      next_address.sin_addr.s_addr = next.ip;
+      next_address.sin_port = next.port;
+      result = connect(fd, (sockaddr*)&next_address, sizeof(next_address));
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (fd >= 0) {
+      send_fds_.push_back(fd);
+    }
+    RingHello hello{rank_, i};
+    if (fd < 0 || result != 0) {
+      status = SocketError("connect");
+    } else {
+      status = WriteAll(fd, &hello, sizeof(hello));
+    }
+  }
+
+  // Accept the connections of the previous rank on either socket, and sort
+  // them by their connection index.
+  recv_fds_.assign((size_t)num_connections, -1);
+  for (int i = 0; i < num_connections && status.ok(); ++i) {
+    pollfd listeners[2] = {{tcp_listener, POLLIN, 0},
+                           {unix_listener, POLLIN, 0}};
+    if (poll(listeners, 2, -1) < 0) {
+      if (errno == EINTR) {
+        --i;
+        continue;
+      }
+      status = SocketError("poll");
+      break;
+    }
+    bool over_tcp = listeners[0].revents != 0;
+    int fd = accept(over_tcp ? tcp_listener : unix_listener, nullptr, nullptr);
+    if (fd < 0) {
+      status = SocketError("accept");
+      break;
+    }
+    RingHello hello;
+    status = ReadAll(fd, &hello, sizeof(hello));
+    if (status.ok() && (hello.rank != (rank_ + size_ - 1) % size_ ||
+                        hello.connection < 0 ||
+                        hello.connection >= num_connections ||
+                        recv_fds_[hello.connection] >= 0)) {
+      status = Status::UnknownError(
+          "Unexpected connection to the ring from rank " +
+          std::to_string(hello.rank) + ".");
+    }
+    if (!status.ok()) {
+      close(fd);
+      break;
+    }
+    if (over_tcp) {
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    recv_fds_[hello.connection] = fd;
+  }
+
+  if (tcp_listener >= 0) {
+    close(tcp_listener);
+  }
+  if (unix_listener >= 0) {
+    close(unix_listener);
+  }
+  unlink(unix_address.sun_path);
+
+  failed = status.ok() ? 0 : 1;
+  MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, comm);
+  if (status.ok() && failed) {
+    status = Status::UnknownError("Another rank couldn't connect its ring.");
+  }
+  if (!status.ok()) {
+    Finalize();
+    return status;
+  }
+
+  // The transfers poll the sockets, so that sending and receiving interleave.
+  for (auto fd : send_fds_) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+  for (auto fd : recv_fds_) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+  recv_buffers_.assign((size_t)num_connections,
+                       std::vector<uint8_t>(TCP_RING_CHUNK_BYTES));
+  threads_.Start(num_connections);
+  initialized_ = true;
+  return Status::OK();
+}
+
+void TcpRing::Finalize() {
+  threads_.Stop();
+  for (auto fd : send_fds_) {
+    close(fd);
+  }
+  for (auto fd : recv_fds_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  send_fds_.clear();
+  recv_fds_.clear();
+  recv_buffers_.clear();
+  initialized_ = false;
+}
+
+bool TcpRing::initialized() const { return initialized_; }
+
+Status TcpRing::Allreduce(void* data, int64_t count, int element_size,
+                          const ReduceFunction& reduce) {
+  if (size_ == 1 || count == 0) {
+    return Status::OK();
+  }
+
+  // Every connection reduces its own part of the data in a separate ring.
+  int num_streams = (int)std::min(
+      (int64_t)send_fds_.size(),
+      std::max(count * element_size / TCP_RING_MIN_STREAM_BYTES, (int64_t)1));
+  std::vector<Status> statuses((size_t)num_streams, Status::OK());
+  std::vector<std::function<void()>> tasks;
+  for (int i = 0; i < num_streams; ++i) {
+    int64_t start = count * i / num_streams;
+    int64_t end = count * (i + 1) / num_streams;
+    tasks.push_back([this, i, start, end, data, element_size, &reduce,
+                     &statuses]() {
+      statuses[i] = StreamAllreduce(i, (uint8_t*)data + start * element_size,
+                                    end - start, element_size, reduce);
+    });
+  }
+  threads_.Run(tasks);
+  for (auto& status : statuses) {
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+Status TcpRing::StreamAllreduce(int connection, uint8_t* data, int64_t count,
+                                int element_size,
+                                const ReduceFunction& reduce) {
+  // The data is split into one segment per rank. In the reduce-scatter phase,
+  // every rank sends a segment to the next rank, which adds it to its own
+  // copy and passes the sum on, until every rank holds the total of one
+  // segment. The totals are then passed around the ring in the allgather
+  // phase.
+  auto segment_start = [&](int segment) -> int64_t {
+    return count * segment / size_;
+  };
+  auto segment_count = [&](int segment) -> int64_t {
+    return segment_start(segment + 1) - segment_start(segment);
+  };
+  int64_t chunk_elements =
+      std::max((int64_t)(TCP_RING_CHUNK_BYTES / element_size), (int64_t)1);
+  auto recv_buffer = recv_buffers_[connection].data();
+
+  for (int step = 0; step < size_ - 1; ++step) {
+    int send_segment = (rank_ - step + size_) % size_;
+    int recv_segment = (rank_ - step - 1 + 2 * size_) % size_;
+    int64_t send_count = segment_count(send_segment);
+    int64_t recv_count = segment_count(recv_segment);
+    auto send_data = data + segment_start(send_segment) * element_size;
+    auto recv_data = data + segment_start(recv_segment) * element_size;
+    for (int64_t done = 0; done < std::max(send_count, recv_count);
+         done += chunk_elements) {
+      int64_t send_chunk =
+          std::max(std::min(chunk_elements, send_count - done), (int64_t)0);
+      int64_t recv_chunk =
+          std::max(std::min(chunk_elements, recv_count - done), (int64_t)0);
+      auto status = Exchange(connection, send_data + done * element_size,
+                             send_chunk * element_size, recv_buffer,
+                             recv_chunk * element_size);
+      if (!status.ok()) {
+        return status;
+      }
+      if (recv_chunk > 0) {
+        reduce(recv_buffer, recv_data + done * element_size, recv_chunk);
+      }
+    }
+  }
+
+  for (int step = 0; step < size_ - 1; ++step) {
+    int send_segment = (rank_ - step + 1 + size_) % size_;
+    int recv_segment = (rank_ - step + size_) % size_;
+    auto status = Exchange(
+        connection, data + segment_start(send_segment) * element_size,
+        segment_count(send_segment) * element_size,
+        data + segment_start(recv_segment) * element_size,
+        segment_count(recv_segment) * element_size);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+Status TcpRing::Exchange(int connection, const uint8_t* send_data,
+                         int64_t send_size, uint8_t* recv_data,
+                         int64_t recv_size) {
+  int send_fd = send_fds_[connection];
+  int recv_fd = recv_fds_[connection];
+  while (send_size > 0 || recv_size > 0) {
+    pollfd fds[2];
+    int num_fds = 0;
+    if (send_size > 0) {
+      fds[num_fds++] = {send_fd, POLLOUT, 0};
+    }
+    if (recv_size > 0) {
+      fds[num_fds++] = {recv_fd, POLLIN, 0};
+    }
+    if (poll(fds, (nfds_t)num_fds, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return SocketError("poll");
+    }
+    for (int i = 0; i < num_fds; ++i) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      if (fds[i].fd == send_fd && send_size > 0) {
+        auto n = send(send_fd, send_data, (size_t)send_size, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+            errno != EINTR) {
+          return SocketError("send");
+        }
+        if (n > 0) {
+          send_data += n;
+          send_size -= n;
+        }
+      } else if (fds[i].fd == recv_fd && recv_size > 0) {
+        auto n = recv(recv_fd, recv_data, (size_t)recv_size, 0);
+        if (n == 0) {
+          return Status::UnknownError("Connection of the ring was closed.");
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+            errno != EINTR) {
+          return SocketError("recv");
+        }
+        if (n > 0) {
+          recv_data += n;
+          recv_size -= n;
+        }
+      }
+    }
+  }
+  return Status::OK();
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,103 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_TCP_RING_H
+#define HOROVOD_TCP_RING_H
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+#include "common.h"
+#include "memcpy_pool.h"
+#define OMPI_SKIP_MPICXX
+#include "mpi.h"
+
+namespace horovod {
+namespace common {
+
+// Number of connections between neighbors of the ring unless it is set.
+#define TCP_RING_DEFAULT_CONNECTIONS 4
+
+// Data of an allreduce smaller than this per connection is sent over fewer
+// connections, so that small tensors aren't split into tiny messages.
+#define TCP_RING_MIN_STREAM_BYTES (256 << 10)
+
+// Segments of the ring are exchanged and reduced in chunks of at most this
+// size, so that the reduction of a chunk overlaps with the transfer of the
+// chunks on the other connections.
+#define TCP_RING_CHUNK_BYTES (1 << 20)
+
+// Adds count elements from src to dest.
+using ReduceFunction =
+    std::function<void(const void* src, void* dest, int64_t count)>;
+
+// Ring allreduce of CPU data over sockets, which doesn't go through MPI once
+// the ring is connected. Every rank is connected to the next and the previous
+// rank of the ring through a number of connections, each of which is served by
+// its own thread and carries an equal part of the data. Peers on the same host
+// are connected through Unix domain sockets, other peers through TCP.
+//
+// Allreduce() must only be called by one thread at a time, and all ranks have
+// to call it with the same element counts in the same order.
+class TcpRing {
+public:
+  ~TcpRing();
+
+  // Connects the ranks of comm into a ring, using the MPI ranks to exchange
+  // the addresses of the listening sockets. The TCP sockets are bound to the
+  // IPv4 address of the given network interface, or to the first interface
+  // which isn't a loopback if it is null. Must be called by all ranks of comm.
+  Status Initialize(MPI_Comm comm, int num_connections, const char* interface);
+
+  // Closes all connections and stops the threads.
+  void Finalize();
+
+  bool initialized() const;
+
+  // Sums up count elements of element_size bytes in data over all ranks in
+  // place.
+  Status Allreduce(void* data, int64_t count, int element_size,
+                   const ReduceFunction& reduce);
+
+private:
+  // Ring allreduce of count elements in data over the given connection.
+  Status StreamAllreduce(int connection, uint8_t* data, int64_t count,
+                         int element_size, const ReduceFunction& reduce);
+
+  // Sends send_size bytes to the next rank while receiving recv_size bytes
+  // from the previous rank on the given connection, so that the ring can't
+  // deadlock with every rank blocked in sending.
+  Status Exchange(int connection, const uint8_t* send_data, int64_t send_size,
+                  uint8_t* recv_data, int64_t recv_size);
+
+  int rank_ = 0;
+  int size_ = 1;
+  bool initialized_ = false;
+
+  // Sockets to the next and from the previous rank, one per connection.
+  std::vector<int> send_fds_;
+  std::vector<int> recv_fds_;
+
+  // Chunks received from the previous rank, which are reduced into the data.
+  std::vector<std::vector<uint8_t>> recv_buffers_;
+
+  MemcpyPool threads_;
+};
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_TCP_RING_H
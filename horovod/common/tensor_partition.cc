@@ -0,0 +1,108 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "tensor_partition.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace horovod {
+namespace common {
+
+TensorSlice::TensorSlice(std::shared_ptr<Tensor> tensor, int64_t offset,
+                         int64_t num_elements)
+    : tensor_(tensor), offset_(offset), num_elements_(num_elements) {
+  auto total_elements = tensor_->shape().num_elements();
+  element_size_ = total_elements > 0 ? tensor_->size() / total_elements : 0;
+}
+
+const MPIDataType TensorSlice::dtype() const { return tensor_->dtype(); }
+
+const TensorShape TensorSlice::shape() const {
+  TensorShape shape;
+  shape.AddDim(num_elements_);
+  return shape;
+}
+
+const void* TensorSlice::data() const {
+  return (const uint8_t*)tensor_->data() + offset_ * element_size_;
+}
+
+int64_t TensorSlice::size() const { return num_elements_ * element_size_; }
+
+namespace {
+
+// Completion shared by the parts of a partitioned entry.
+struct PartitionCompletion {
+  explicit PartitionCompletion(int parts, StatusCallback callback)
+      : remaining(parts), callback(callback) {}
+
+  void Done(const Status& part_status) {
+    if (!part_status.ok()) {
+      std::lock_guard<std::mutex> guard(mutex);
+      if (status.ok()) {
+        status = part_status;
+      }
+    }
+    if (remaining.fetch_sub(1) == 1) {
+      callback(status);
+    }
+  }
+
+  std::atomic_int remaining;
+  StatusCallback callback;
+  std::mutex mutex;
+  Status status;
+};
+
+} // namespace
+
+std::vector<TensorTableEntry> PartitionEntry(TensorTableEntry e,
+                                             int64_t part_size) {
+  std::vector<TensorTableEntry> parts;
+  auto num_elements = e.tensor->shape().num_elements();
+  if (part_size <= 0 || e.tensor->size() <= part_size || num_elements == 0) {
+    parts.push_back(std::move(e));
+    return parts;
+  }
+
+  auto element_size = e.tensor->size() / num_elements;
+  auto part_elements = std::max(part_size / element_size, (int64_t)1);
+  auto num_parts = (int)((num_elements + part_elements - 1) / part_elements);
+  auto completion = std::make_shared<PartitionCompletion>(num_parts, e.callback);
+  parts.reserve(num_parts);
+  for (int i = 0; i < num_parts; ++i) {
+    auto offset = i * part_elements;
+    auto count = std::min(part_elements, num_elements - offset);
+    TensorTableEntry part = e;
+    part.tensor_name = e.tensor_name + "/part_" + std::to_string(i);
+    part.tensor = std::make_shared<TensorSlice>(e.tensor, offset, count);
+    if (e.output == e.tensor) {
+      part.output = part.tensor;
+    } else if (e.output != nullptr) {
+      part.output = std::make_shared<TensorSlice>(e.output, offset, count);
+    }
+    part.callback = [completion](const Status& status) {
+      completion->Done(status);
+    };
+    parts.push_back(std::move(part));
+  }
+  return parts;
+}
+
+} // namespace common
+} // namespace horovod
@@ -0,0 +1,60 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_TENSOR_PARTITION_H
+#define HOROVOD_TENSOR_PARTITION_H
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "common.h"
+#include "tensor_queue.h"
+
+namespace horovod {
+namespace common {
+
+// A contiguous range of the elements of a tensor, seen as a one-dimensional
+// tensor. The slice keeps the tensor alive.
+class TensorSlice : public Tensor {
+public:
+  TensorSlice(std::shared_ptr<Tensor> tensor, int64_t offset,
+              int64_t num_elements);
+  const MPIDataType dtype() const override;
+  const TensorShape shape() const override;
+  const void* data() const override;
+  int64_t size() const override;
+
+private:
+  std::shared_ptr<Tensor> tensor_;
+  int64_t offset_;
+  int64_t num_elements_;
+  int64_t element_size_;
+};
+
+// Splits an entry whose tensor is larger than part_size bytes into entries of
+// at most part_size bytes each, which refer to consecutive slices of its tensor
+// and output. The parts are named <name>/part_<i>, so every rank splitting the
+// same tensor gets the same parts. The callback of the entry is called once
+// all parts are done, with the first error of any part.
+//
+// Entries which are not larger than part_size are returned unchanged.
+std::vector<TensorTableEntry> PartitionEntry(TensorTableEntry e,
+                                             int64_t part_size);
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_TENSOR_PARTITION_H
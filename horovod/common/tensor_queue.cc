@@ -0,0 +1,191 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <cassert>
+#include <functional>
+#include <iterator>
+
+#include "tensor_queue.h"
+
+namespace horovod {
+namespace common {
+
+// Number of queue and free list nodes allocated up front. They grow beyond
+// this when more requests are outstanding.
+#define MESSAGE_QUEUE_INITIAL_CAPACITY 1024
+
+// Number of empty slots a tensor table shard keeps for names that may be
+// enqueued again, in addition to two for every entry in it.
+#define TENSOR_TABLE_VACANT_SLOTS 256
+
+bool TensorTable::Insert(TensorTableEntry entry) {
+  auto& shard = ShardFor(entry.tensor_name);
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  auto iter = shard.slots.find(entry.tensor_name);
+  if (iter == shard.slots.end()) {
+    auto name = entry.tensor_name;
+    iter = shard.slots.emplace(std::move(name), Slot()).first;
+  } else if (iter->second.occupied) {
+    return false;
+  } else {
+    shard.vacant--;
+  }
+  iter->second.entry = std::move(entry);
+  iter->second.occupied = true;
+  return true;
+}
+
+const TensorTableEntry& TensorTable::Get(const std::string& tensor_name) {
+  auto& shard = ShardFor(tensor_name);
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  auto iter = shard.slots.find(tensor_name);
+  // We should never fail at finding this key in the tensor table.
+  assert(iter != shard.slots.end() && iter->second.occupied);
+  return iter->second.entry;
+}
+
+TensorTableEntry TensorTable::Take(const std::string& tensor_name) {
+  auto& shard = ShardFor(tensor_name);
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  auto iter = shard.slots.find(tensor_name);
+  assert(iter != shard.slots.end() && iter->second.occupied);
+  TensorTableEntry entry = std::move(iter->second.entry);
+  Vacate(shard, iter->second);
+  TrimVacant(shard);
+  return entry;
+}
+
+bool TensorTable::Remove(const std::string& tensor_name) {
+  auto& shard = ShardFor(tensor_name);
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  auto iter = shard.slots.find(tensor_name);
+  if (iter == shard.slots.end() || !iter->second.occupied) {
+    return false;
+  }
+  Vacate(shard, iter->second);
+  return true;
+}
+
+std::vector<TensorTableEntry> TensorTable::TakeAll() {
+  std::vector<TensorTableEntry> entries;
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    for (auto& slot : shard.slots) {
+      if (slot.second.occupied) {
+        entries.push_back(std::move(slot.second.entry));
+      }
+    }
+    shard.slots.clear();
+    shard.vacant = 0;
+  }
+  return entries;
+}
+
+void TensorTable::Vacate(Shard& shard, Slot& slot) {
+  // Release whatever the moved-from entry may still hold, such as the
+  // captures of its callback.
+  slot.entry = TensorTableEntry();
+  slot.occupied = false;
+  shard.vacant++;
+}
+
+void TensorTable::TrimVacant(Shard& shard) {
+  size_t occupied = shard.slots.size() - shard.vacant;
+  if (shard.vacant <= TENSOR_TABLE_VACANT_SLOTS + 2 * occupied) {
+    return;
+  }
+  for (auto iter = shard.slots.begin(); iter != shard.slots.end();) {
+    if (iter->second.occupied) {
+      ++iter;
+    } else {
+      iter = shard.slots.erase(iter);
+    }
+  }
+  shard.vacant = 0;
+}
+
+TensorTable::Shard& TensorTable::ShardFor(const std::string& tensor_name) {
+  return shards_[std::hash<std::string>()(tensor_name) % NUM_SHARDS];
+}
+
+MessageQueue::MessageQueue()
+    : queue_(MESSAGE_QUEUE_INITIAL_CAPACITY),
+      free_groups_(MESSAGE_QUEUE_INITIAL_CAPACITY) {}
+
+MessageQueue::~MessageQueue() {
+  Clear();
+  std::vector<MPIRequest>* group;
+  while (free_groups_.pop(group)) {
+    delete group;
+  }
+}
+
+void MessageQueue::Push(MPIRequest message) {
+  auto group = TakeGroup();
+  group->push_back(std::move(message));
+  queue_.push(group);
+}
+
+void MessageQueue::Push(std::vector<MPIRequest> messages) {
+  auto group = TakeGroup();
+  group->insert(group->end(), std::make_move_iterator(messages.begin()),
+                std::make_move_iterator(messages.end()));
+  queue_.push(group);
+}
+
+void MessageQueue::PopAll(std::deque<MPIRequest>& messages) {
+  while (!requeued_.empty()) {
+    messages.push_back(std::move(requeued_.front()));
+    requeued_.pop_front();
+  }
+  std::vector<MPIRequest>* group;
+  while (queue_.pop(group)) {
+    for (auto& message : *group) {
+      messages.push_back(std::move(message));
+    }
+    ReturnGroup(group);
+  }
+}
+
+void MessageQueue::Requeue(std::deque<MPIRequest>& messages) {
+  while (!messages.empty()) {
+    requeued_.push_front(std::move(messages.back()));
+    messages.pop_back();
+  }
+}
+
+void MessageQueue::Clear() {
+  requeued_.clear();
+  std::vector<MPIRequest>* group;
+  while (queue_.pop(group)) {
+    ReturnGroup(group);
+  }
+}
+
+std::vector<MPIRequest>* MessageQueue::TakeGroup() {
+  std::vector<MPIRequest>* group;
+  if (free_groups_.pop(group)) {
+    return group;
+  }
+  return new std::vector<MPIRequest>();
+}
+
+void MessageQueue::ReturnGroup(std::vector<MPIRequest>* group) {
+  group->clear();
+  free_groups_.push(group);
+}
+
+} // namespace common
+} // namespace horovod
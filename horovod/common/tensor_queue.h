@@ -0,0 +1,192 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_TENSOR_QUEUE_H
+#define HOROVOD_TENSOR_QUEUE_H
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/stack.hpp>
+
+#include "common.h"
+#include "mpi_message.h"
+#include "operations.h"
+
+namespace horovod {
+namespace common {
+
+// Table storing Tensors to be reduced, keyed by unique name.
+// This table contains everything necessary to do the reduction.
+struct TensorTableEntry {
+  // Name of the tensor.
+  std::string tensor_name;
+  // Operation context.
+  std::shared_ptr<OpContext> context;
+  // Input tensor.
+  std::shared_ptr<Tensor> tensor;
+  // Pre-allocated output tensor.
+  std::shared_ptr<Tensor> output;
+  // Row indices of the values in tensor for a sparse allreduce.
+  std::shared_ptr<Tensor> indices;
+  // Output row indices of a sparse allreduce, allocated with the output.
+  std::shared_ptr<Tensor> output_indices;
+  // Whether a sparse allreduce sums up rows with the same index.
+  bool deduplicate = false;
+  // Number of rows of an alltoall tensor sent to every rank.
+  std::vector<int32_t> splits;
+  // Root rank for broadcast operation.
+  int root_rank = 0;
+  // Event indicating that data is ready.
+  std::shared_ptr<ReadyEvent> ready_event;
+  // GPU to do reduction on, or CPU_DEVICE_ID in case of CPU.
+  int device = CPU_DEVICE_ID;
+  // A callback to call with the status.
+  StatusCallback callback;
+  // Compression of the data while it is allreduced.
+  Compression compression = NO_COMPRESSION;
+  // Factors the data of an allreduce is multiplied by before and after it is
+  // summed up.
+  double prescale_factor = 1.0;
+  double postscale_factor = 1.0;
+  // Allreduces with a higher priority are performed first.
+  int32_t priority = 0;
+  // Number of allreduce calls whose tensors are summed up locally before the
+  // sum is allreduced.
+  int32_t accumulation_steps = 1;
+  // Ranks an allreduce sums up the tensor across.
+  ReduceScope scope = GLOBAL_SCOPE;
+  // Number of GPUs of this process which enqueue an allreduce of the tensor,
+  // whose sum is allreduced once for the process.
+  int32_t local_replicas = 1;
+  // Name of the first tensor of a grouped allreduce, empty for other tensors.
+  std::string group;
+  // Time the tensor was enqueued.
+  std::chrono::steady_clock::time_point enqueue_time;
+};
+
+// Tensor table split into shards with their own locks, so that framework
+// threads enqueueing different tensors rarely contend with each other or with
+// the background thread.
+//
+// Entries are only taken out by the background thread. References returned by
+// Get() therefore stay valid on the background thread until the entry is
+// taken out of the table, even while other threads insert new entries.
+//
+// Most tensors are enqueued again under the same name every step, so a slot
+// stays in the table when its entry is taken out and is filled again by the
+// next entry of that name, without allocating a new one.
+class TensorTable {
+public:
+  // Inserts a new entry. Returns false if an entry with the same name exists.
+  bool Insert(TensorTableEntry entry);
+
+  // Returns the entry for a tensor which must be in the table.
+  const TensorTableEntry& Get(const std::string& tensor_name);
+
+  // Removes the entry for a tensor which must be in the table and returns it.
+  TensorTableEntry Take(const std::string& tensor_name);
+
+  // Removes the entry for a tensor. Returns false if it's not in the table.
+  bool Remove(const std::string& tensor_name);
+
+  // Removes all entries and returns them.
+  std::vector<TensorTableEntry> TakeAll();
+
+private:
+  static const size_t NUM_SHARDS = 16;
+
+  struct Slot {
+    TensorTableEntry entry;
+    // Whether the slot holds an entry or waits for the next one of its name.
+    bool occupied = false;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, Slot> slots;
+    // Number of slots without an entry.
+    size_t vacant = 0;
+  };
+
+  Shard& ShardFor(const std::string& tensor_name);
+
+  // Empties a slot whose entry has been moved out of it.
+  void Vacate(Shard& shard, Slot& slot);
+
+  // Drops the empty slots of a shard once they far outnumber its entries,
+  // which happens when tensor names change from step to step.
+  void TrimVacant(Shard& shard);
+
+  Shard shards_[NUM_SHARDS];
+};
+
+// Queue of MPI requests waiting to be sent to the coordinator node. Any
+// number of framework threads can push requests without taking a lock,
+// while only the background thread pops them.
+//
+// Requests are queued in groups. The background thread returns the groups it
+// has drained to a free list, from which the next pushes take them, so that
+// pushing a request does not allocate a new group.
+class MessageQueue {
+public:
+  MessageQueue();
+  ~MessageQueue();
+
+  // Adds a request to the back of the queue. Safe to call from any thread.
+  void Push(MPIRequest message);
+
+  // Adds a group of requests to the back of the queue, which PopAll() always
+  // takes together. Safe to call from any thread.
+  void Push(std::vector<MPIRequest> messages);
+
+  // Moves all queued requests to the back of messages, starting with the
+  // requests passed to Requeue(). Only called by the background thread.
+  void PopAll(std::deque<MPIRequest>& messages);
+
+  // Puts requests back into the queue ahead of all other requests. Only
+  // called by the background thread.
+  void Requeue(std::deque<MPIRequest>& messages);
+
+  // Drops all queued requests. Only called by the background thread.
+  void Clear();
+
+private:
+  // Returns an empty group from the free list, or a new one if it's empty.
+  std::vector<MPIRequest>* TakeGroup();
+
+  // Empties a drained group and returns it to the free list.
+  void ReturnGroup(std::vector<MPIRequest>* group);
+
+  boost::lockfree::queue<std::vector<MPIRequest>*> queue_;
+
+  // Empty groups which keep their capacity for the next pushes.
+  boost::lockfree::stack<std::vector<MPIRequest>*> free_groups_;
+
+  // Requests put back by the background thread, which are not visible to
+  // other threads.
+  std::deque<MPIRequest> requeued_;
+};
+
+} // namespace common
+} // namespace horovod
+
+#endif // HOROVOD_TENSOR_QUEUE_H
@@ -13,6 +13,7 @@
 // limitations under the License.
 // =============================================================================
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <sstream>
@@ -24,16 +25,33 @@
 namespace horovod {
 namespace common {
 
-void TimelineWriter::Initialize(std::string file_name) {
-  file_.open(file_name, std::ios::out | std::ios::trunc);
+// Number of tensors whose operations are counted for sampling. Names which
+// are only used once, like those of unnamed operations, would otherwise grow
+// the counts forever.
+#define TIMELINE_MAX_SAMPLED_TENSORS 16384
+
+void TimelineWriter::Initialize(std::string file_name, TimelineFormat format) {
+  format_ = format;
+  if (format_ == BINARY_TIMELINE) {
+    file_.open(file_name, std::ios::out | std::ios::trunc | std::ios::binary);
+  } else {
+    file_.open(file_name, std::ios::out | std::ios::trunc);
+  }
   if (file_.good()) {
-    // Initialize the timeline with '[' character.
-    file_ << "[\n";
+    if (format_ == BINARY_TIMELINE) {
+      int32_t header[2] = {TIMELINE_BINARY_VERSION,
+                           (int32_t)sizeof(TimelineBinaryRecord)};
+      file_.write("HVDTLBIN", 8);
+      file_.write((const char*)header, sizeof(header));
+      strings_.push_back("");
+    } else {
+      // Initialize the timeline with '[' character.
+      file_ << "[\n";
+    }
     healthy_ = true;
 
     // Spawn writer thread.
-    std::thread writer_thread(&TimelineWriter::WriterLoop, this);
-    writer_thread.detach();
+    writer_thread_ = std::thread(&TimelineWriter::WriterLoop, this);
   } else {
     LOG(ERROR) << "Error opening the Horovod Timeline file " << file_name
                << ", will not write a timeline.";
@@ -44,6 +62,18 @@ void TimelineWriter::EnqueueWriteEvent(const std::string& tensor_name,
                                        char phase, const std::string& op_name,
                                        const std::string& args,
                                        long ts_micros) {
+  if (format_ == BINARY_TIMELINE) {
+    TimelineBinaryRecord r{};
+    r.type = 'E';
+    r.phase = phase;
+    r.tensor_id = InternString(tensor_name);
+    r.name_id = InternString(op_name);
+    r.args_id = InternString(args);
+    r.ts_micros = ts_micros;
+    EnqueueBinary(r);
+    return;
+  }
+
   TimelineRecord r{};
   r.type = TimelineRecordType::EVENT;
   r.tensor_name = tensor_name;
@@ -58,6 +88,15 @@ void TimelineWriter::EnqueueWriteEvent(const std::string& tensor_name,
 
 void TimelineWriter::EnqueueWriteMarker(const std::string& name,
                                         long ts_micros) {
+  if (format_ == BINARY_TIMELINE) {
+    TimelineBinaryRecord r{};
+    r.type = 'M';
+    r.name_id = InternString(name);
+    r.ts_micros = ts_micros;
+    EnqueueBinary(r);
+    return;
+  }
+
   TimelineRecord r{};
   r.type = TimelineRecordType::MARKER;
   r.marker_name = name;
@@ -67,6 +106,51 @@ void TimelineWriter::EnqueueWriteMarker(const std::string& name,
     ;
 }
 
+void TimelineWriter::EnqueueBinary(const TimelineBinaryRecord& r) {
+  while (healthy_ && !binary_queue_.push(r))
+    ;
+}
+
+int32_t TimelineWriter::InternString(const std::string& s) {
+  if (s.empty()) {
+    return 0;
+  }
+  auto it = string_ids_.find(s);
+  if (it != string_ids_.end()) {
+    return it->second;
+  }
+
+  std::lock_guard<std::mutex> guard(strings_mutex_);
+  auto id = (int32_t)strings_.size();
+  strings_.push_back(s);
+  string_ids_.emplace(s, id);
+  return id;
+}
+
+void TimelineWriter::DoWriteString(int32_t id) {
+  std::string s;
+  {
+    std::lock_guard<std::mutex> guard(strings_mutex_);
+    s = strings_[id];
+  }
+
+  TimelineBinaryRecord r{};
+  r.type = 'S';
+  r.name_id = id;
+  r.args_id = (int32_t)s.size();
+  file_.write((const char*)&r, sizeof(r));
+  file_.write(s.data(), s.size());
+}
+
+void TimelineWriter::DoWriteBinary(const TimelineBinaryRecord& r) {
+  // Write out the strings used for the first time.
+  auto max_id = std::max(r.tensor_id, std::max(r.name_id, r.args_id));
+  while (strings_written_ <= max_id) {
+    DoWriteString(strings_written_++);
+  }
+  file_.write((const char*)&r, sizeof(r));
+}
+
 void TimelineWriter::DoWriteEvent(const TimelineRecord& r) {
   assert(r.type == TimelineRecordType::EVENT);
 
@@ -117,41 +201,78 @@ void TimelineWriter::DoWriteMarker(const TimelineRecord& r) {
   file_ << "}," << std::endl;
 }
 
-void TimelineWriter::WriterLoop() {
-  while (healthy_) {
-    while (healthy_ && !record_queue_.empty()) {
-      auto& r = record_queue_.front();
-      switch (r.type) {
-      case TimelineRecordType::EVENT:
-        DoWriteEvent(r);
-        break;
-      case TimelineRecordType::MARKER:
-        DoWriteMarker(r);
-        break;
-      default:
-        throw std::logic_error("Unknown event type provided.");
-      }
-      record_queue_.pop();
-
-      if (!file_.good()) {
-        LOG(ERROR) << "Error writing to the Horovod Timeline after it was "
-                      "successfully opened, will stop writing the timeline.";
-        healthy_ = false;
-      }
+void TimelineWriter::Shutdown() {
+  if (!writer_thread_.joinable()) {
+    return;
+  }
+  shut_down_ = true;
+  writer_thread_.join();
+  if (healthy_) {
+    // Records enqueued while the writer thread stopped.
+    WriteQueuedRecords();
+  }
+  healthy_ = false;
+  file_.close();
+}
+
+void TimelineWriter::WriteQueuedRecords() {
+  bool wrote_binary = false;
+  while (healthy_ && !binary_queue_.empty()) {
+    DoWriteBinary(binary_queue_.front());
+    binary_queue_.pop();
+    wrote_binary = true;
+
+    if (!file_.good()) {
+      LOG(ERROR) << "Error writing to the Horovod Timeline after it was "
+                    "successfully opened, will stop writing the timeline.";
+      healthy_ = false;
     }
+  }
+  if (wrote_binary) {
+    // Records are flushed once the queue is drained rather than one by one.
+    file_.flush();
+  }
+
+  while (healthy_ && !record_queue_.empty()) {
+    auto& r = record_queue_.front();
+    switch (r.type) {
+    case TimelineRecordType::EVENT:
+      DoWriteEvent(r);
+      break;
+    case TimelineRecordType::MARKER:
+      DoWriteMarker(r);
+      break;
+    default:
+      throw std::logic_error("Unknown event type provided.");
+    }
+    record_queue_.pop();
+
+    if (!file_.good()) {
+      LOG(ERROR) << "Error writing to the Horovod Timeline after it was "
+                    "successfully opened, will stop writing the timeline.";
+      healthy_ = false;
+    }
+  }
+}
+
+void TimelineWriter::WriterLoop() {
+  while (healthy_ && !shut_down_) {
+    WriteQueuedRecords();
 
     // Allow scheduler to schedule other work for this core.
     std::this_thread::yield();
   }
 }
 
-void Timeline::Initialize(std::string file_name, unsigned int horovod_size) {
+void Timeline::Initialize(std::string file_name, unsigned int horovod_size,
+                          TimelineFormat format, int sample_steps) {
   if (initialized_) {
     return;
   }
 
   // Start the writer.
-  writer_.Initialize(std::move(file_name));
+  writer_.Initialize(std::move(file_name), format);
+  sample_steps_ = std::max(sample_steps, 1);
 
   // Initialize if we were able to open the file successfully.
   initialized_ = writer_.IsHealthy();
@@ -163,16 +284,41 @@ void Timeline::Initialize(std::string file_name, unsigned int horovod_size) {
   }
 }
 
+void Timeline::Shutdown() {
+  if (!initialized_) {
+    return;
+  }
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  writer_.Shutdown();
+}
+
 long Timeline::TimeSinceStartMicros() const {
   auto now = std::chrono::steady_clock::now();
   auto ts = now - start_time_;
   return std::chrono::duration_cast<std::chrono::microseconds>(ts).count();
 }
 
+bool Timeline::Sampled(const std::string& tensor_name) {
+  if (sample_steps_ == 1) {
+    return true;
+  }
+  auto iter = tensor_steps_.find(tensor_name);
+  return iter == tensor_steps_.end() || iter->second % sample_steps_ == 0;
+}
+
 // Write event to the Horovod Timeline file.
 void Timeline::WriteEvent(const std::string& tensor_name, const char phase,
                           const std::string& op_name, const std::string& args) {
-  auto ts_micros = TimeSinceStartMicros();
+  WriteEvent(tensor_name, phase, op_name, args, TimeSinceStartMicros());
+}
+
+void Timeline::WriteEvent(const std::string& tensor_name, const char phase,
+                          const std::string& op_name, const std::string& args,
+                          long ts_micros) {
+  if (!Sampled(tensor_name)) {
+    return;
+  }
+
   writer_.EnqueueWriteEvent(tensor_name, phase, op_name, args, ts_micros);
 }
 
@@ -242,17 +388,31 @@ void Timeline::ActivityStart(const std::string& tensor_name,
   tensor_states_[tensor_name] = TimelineState::ACTIVITY;
 }
 
-void Timeline::ActivityEnd(const std::string& tensor_name) {
+void Timeline::ActivityEnd(const std::string& tensor_name,
+                           const std::string& args) {
   if (!initialized_) {
     return;
   }
 
   std::lock_guard<std::recursive_mutex> guard(mutex_);
   assert(tensor_states_[tensor_name] == TimelineState::ACTIVITY);
-  WriteEvent(tensor_name, 'E');
+  WriteEvent(tensor_name, 'E', "", args);
   tensor_states_[tensor_name] = TimelineState::TOP_LEVEL;
 }
 
+void Timeline::ActivitySpan(const std::string& tensor_name,
+                            const std::string& activity, long start_micros,
+                            long end_micros) {
+  if (!initialized_) {
+    return;
+  }
+
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  assert(tensor_states_[tensor_name] == TimelineState::TOP_LEVEL);
+  WriteEvent(tensor_name, 'B', activity, "", start_micros);
+  WriteEvent(tensor_name, 'E', "", "", end_micros);
+}
+
 void Timeline::End(const std::string& tensor_name,
                    const std::shared_ptr<Tensor> tensor) {
   if (!initialized_) {
@@ -266,12 +426,24 @@ void Timeline::End(const std::string& tensor_name,
     ActivityEnd(tensor_name);
   }
 
-  std::stringstream args;
-  if (tensor != nullptr) {
-    args << "\"dtype\": \"" << MPIDataType_Name(tensor->dtype()) << "\"";
-    args << ", \"shape\": \"" << tensor->shape().DebugString() << "\"";
+  if (Sampled(tensor_name)) {
+    std::stringstream args;
+    if (tensor != nullptr) {
+      args << "\"dtype\": \"" << MPIDataType_Name(tensor->dtype()) << "\"";
+      args << ", \"shape\": \"" << tensor->shape().DebugString() << "\"";
+    }
+    WriteEvent(tensor_name, 'E', "", args.str());
+  }
+  tensor_states_.erase(tensor_name);
+
+  if (sample_steps_ > 1) {
+    if (tensor_steps_.size() >= TIMELINE_MAX_SAMPLED_TENSORS &&
+        tensor_steps_.find(tensor_name) == tensor_steps_.end()) {
+      // Starts the sampling of all tensors over.
+      tensor_steps_.clear();
+    }
+    ++tensor_steps_[tensor_name];
   }
-  WriteEvent(tensor_name, 'E', "", args.str());
 }
 
 void Timeline::MarkCycleStart() {
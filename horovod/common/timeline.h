@@ -21,6 +21,7 @@
 #include <fstream>
 #include <iostream>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -32,6 +33,8 @@ namespace common {
 
 enum TimelineRecordType { EVENT, MARKER };
 
+enum TimelineFormat { JSON_TIMELINE, BINARY_TIMELINE };
+
 struct TimelineRecord {
   TimelineRecordType type;
   std::string tensor_name;
@@ -42,23 +45,55 @@ struct TimelineRecord {
   long ts_micros;
 };
 
+// Record of a binary timeline file, which starts with the 8 bytes "HVDTLBIN"
+// followed by the version and the record size as 32-bit integers.
+//
+// Tensor names, operation names and arguments are replaced by IDs. Before the
+// first record using an ID, a record of type 'S' with the ID in name_id and
+// the length in args_id is followed by the characters of the string. ID 0 is
+// the empty string.
+struct TimelineBinaryRecord {
+  int64_t ts_micros;
+  int32_t tensor_id;
+  int32_t name_id;
+  int32_t args_id;
+  // 'E' for an event, 'M' for a marker, 'S' for a string.
+  char type;
+  char phase;
+  char padding[2];
+};
+
+#define TIMELINE_BINARY_VERSION 1
+
 class TimelineWriter {
 public:
-  void Initialize(std::string file_name);
+  ~TimelineWriter() { Shutdown(); }
+  void Initialize(std::string file_name, TimelineFormat format);
   inline bool IsHealthy() const { return healthy_; }
   void EnqueueWriteEvent(const std::string& tensor_name, char phase,
                          const std::string& op_name, const std::string& args,
                          long ts_micros);
   void EnqueueWriteMarker(const std::string& name, long ts_micros);
+  // Writes out the queued records and closes the file.
+  void Shutdown();
 
 private:
   void DoWriteEvent(const TimelineRecord& r);
   void DoWriteMarker(const TimelineRecord& r);
+  void DoWriteBinary(const TimelineBinaryRecord& r);
+  void DoWriteString(int32_t id);
+  int32_t InternString(const std::string& s);
+  void EnqueueBinary(const TimelineBinaryRecord& r);
+  void WriteQueuedRecords();
   void WriterLoop();
 
   // Are we healthy?
   std::atomic_bool healthy_{false};
 
+  // Writer thread, which runs until shut_down_ is set.
+  std::thread writer_thread_;
+  std::atomic_bool shut_down_{false};
+
   // Timeline file.
   std::ofstream file_;
 
@@ -70,6 +105,21 @@ private:
   // Mapping of tensor names to indexes. It is used to reduce size of the
   // timeline file.
   std::unordered_map<std::string, int> tensor_table_;
+
+  TimelineFormat format_ = JSON_TIMELINE;
+
+  // Records of the binary timeline, which only hold IDs of strings.
+  boost::lockfree::spsc_queue<TimelineBinaryRecord,
+                              boost::lockfree::capacity<1048576>>
+      binary_queue_;
+
+  // IDs of the strings of the binary timeline. The IDs are assigned by the
+  // enqueueing thread, and the strings are written out by the writer thread
+  // before the first record using them.
+  std::unordered_map<std::string, int32_t> string_ids_;
+  std::vector<std::string> strings_;
+  std::mutex strings_mutex_;
+  int32_t strings_written_ = 1;
 };
 
 enum TimelineState { UNKNOWN, NEGOTIATING, TOP_LEVEL, ACTIVITY };
@@ -78,7 +128,10 @@ enum TimelineState { UNKNOWN, NEGOTIATING, TOP_LEVEL, ACTIVITY };
 // https://github.com/catapult-project/catapult/tree/master/tracing
 class Timeline {
 public:
-  void Initialize(std::string file_name, unsigned int horovod_size);
+  // Only every sample_steps-th operation on each tensor is recorded.
+  void Initialize(std::string file_name, unsigned int horovod_size,
+                  TimelineFormat format = JSON_TIMELINE,
+                  int sample_steps = 1);
   inline bool Initialized() const { return initialized_; }
   void NegotiateStart(const std::string& tensor_name,
                       MPIRequest::RequestType request_type);
@@ -88,15 +141,26 @@ public:
              MPIResponse::ResponseType response_type);
   void ActivityStart(const std::string& tensor_name,
                      const std::string& activity);
-  void ActivityEnd(const std::string& tensor_name);
+  void ActivityEnd(const std::string& tensor_name,
+                   const std::string& args = "");
+  // Records an activity which started and ended at the given times, such as
+  // work on a GPU measured with CUDA events.
+  void ActivitySpan(const std::string& tensor_name, const std::string& activity,
+                    long start_micros, long end_micros);
   void End(const std::string& tensor_name, std::shared_ptr<Tensor> tensor);
   void MarkCycleStart();
+  long TimeSinceStartMicros() const;
+  // Writes out all recorded events. Nothing is recorded afterwards.
+  void Shutdown();
 
 private:
-  long TimeSinceStartMicros() const;
+  bool Sampled(const std::string& tensor_name);
   void WriteEvent(const std::string& tensor_name, char phase,
                   const std::string& op_name = "",
                   const std::string& args = "");
+  void WriteEvent(const std::string& tensor_name, char phase,
+                  const std::string& op_name, const std::string& args,
+                  long ts_micros);
   void WriteMarker(const std::string& name);
 
   // Boolean flag indicating whether Timeline was initialized (and thus should
@@ -118,6 +182,10 @@ private:
   // Map of ranks to their string representations.
   // std::to_string() is very slow.
   std::vector<std::string> rank_strings_;
+
+  // Number of operations done on each tensor when sampling.
+  int sample_steps_ = 1;
+  std::unordered_map<std::string, int64_t> tensor_steps_;
 };
 
 } // namespace common
@@ -0,0 +1,93 @@
+# Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+"""Converts a binary Horovod Timeline to the Chrome Tracing format.
+
+Usage: python -m horovod.common.timeline_converter timeline.bin timeline.json
+"""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import struct
+import sys
+
+MAGIC = b'HVDTLBIN'
+VERSION = 1
+
+# ts_micros, tensor_id, name_id, args_id, type, phase, padding
+RECORD = struct.Struct('<qiiicc2x')
+
+
+def _read_records(f):
+    if f.read(len(MAGIC)) != MAGIC:
+        raise ValueError('Not a binary Horovod Timeline file.')
+    version, record_size = struct.unpack('<ii', f.read(8))
+    if version != VERSION or record_size != RECORD.size:
+        raise ValueError('Unsupported binary Horovod Timeline version %d.' % version)
+
+    strings = {0: ''}
+    while True:
+        data = f.read(RECORD.size)
+        if len(data) < RECORD.size:
+            # The last record may be incomplete if the job was killed.
+            return
+        ts_micros, tensor_id, name_id, args_id, type, phase = RECORD.unpack(data)
+        if type == b'S':
+            strings[name_id] = f.read(args_id).decode('utf-8')
+        elif type == b'M':
+            yield 'M', strings[name_id], None, None, None, ts_micros
+        else:
+            yield ('E', strings[tensor_id], phase.decode('utf-8'),
+                   strings[name_id], strings[args_id], ts_micros)
+
+
+def convert(binary_file, json_file):
+    """Writes the events of a binary timeline file to a JSON timeline file."""
+    tensor_table = {}
+    with open(binary_file, 'rb') as f, open(json_file, 'w') as out:
+        out.write('[\n')
+        for type, name, phase, op_name, args, ts_micros in _read_records(f):
+            if type == 'M':
+                out.write('{"ph": "i", "name": "%s", "ts": %d, "s": "g"},\n' %
+                          (name, ts_micros))
+                continue
+
+            tensor_idx = tensor_table.get(name)
+            if tensor_idx is None:
+                # Tensors are modeled as processes.
+                tensor_idx = len(tensor_table) + 1
+                tensor_table[name] = tensor_idx
+                out.write('{"name": "process_name", "ph": "M", "pid": %d, '
+                          '"args": {"name": "%s"}},\n' % (tensor_idx, name))
+                out.write('{"name": "process_sort_index", "ph": "M", "pid": %d, '
+                          '"args": {"sort_index": %d}},\n' % (tensor_idx, tensor_idx))
+
+            event = '{"ph": "%s"' % phase
+            if phase != 'E':
+                event += ', "name": "%s"' % op_name
+            event += ', "ts": %d, "pid": %d' % (ts_micros, tensor_idx)
+            if phase == 'X':
+                event += ', "dur": 0'
+            if args:
+                event += ', "args": {%s}' % args
+            out.write(event + '},\n')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        sys.exit(1)
+    convert(sys.argv[1], sys.argv[2])
@@ -44,8 +44,9 @@ enum MPIDataType {
   MPIDataType_HOROVOD_FLOAT32 = 7,
   MPIDataType_HOROVOD_FLOAT64 = 8,
   MPIDataType_HOROVOD_BOOL = 9,
+  MPIDataType_HOROVOD_BFLOAT16 = 10,
   MPIDataType_MIN = MPIDataType_HOROVOD_UINT8,
-  MPIDataType_MAX = MPIDataType_HOROVOD_BOOL
+  MPIDataType_MAX = MPIDataType_HOROVOD_BFLOAT16
 };
 
 inline const char **EnumNamesMPIDataType() {
@@ -60,6 +61,7 @@ inline const char **EnumNamesMPIDataType() {
     "HOROVOD_FLOAT32",
     "HOROVOD_FLOAT64",
     "HOROVOD_BOOL",
+    "HOROVOD_BFLOAT16",
     nullptr
   };
   return names;
@@ -70,12 +72,40 @@ inline const char *EnumNameMPIDataType(MPIDataType e) {
   return EnumNamesMPIDataType()[index];
 }
 
+enum Compression {
+  Compression_NO_COMPRESSION = 0,
+  Compression_FP16_COMPRESSION = 1,
+  Compression_INT8_COMPRESSION = 2,
+  Compression_ONEBIT_COMPRESSION = 3,
+  Compression_MIN = Compression_NO_COMPRESSION,
+  Compression_MAX = Compression_ONEBIT_COMPRESSION
+};
+
+inline const char **EnumNamesCompression() {
+  static const char *names[] = {
+    "NO_COMPRESSION",
+    "FP16_COMPRESSION",
+    "INT8_COMPRESSION",
+    "ONEBIT_COMPRESSION",
+    nullptr
+  };
+  return names;
+}
+
+inline const char *EnumNameCompression(Compression e) {
+  const size_t index = static_cast<int>(e);
+  return EnumNamesCompression()[index];
+}
+
 enum MPIRequestType {
   MPIRequestType_ALLREDUCE = 0,
   MPIRequestType_ALLGATHER = 1,
   MPIRequestType_BROADCAST = 2,
+  MPIRequestType_SPARSE_ALLREDUCE = 3,
+  MPIRequestType_REDUCESCATTER = 4,
+  MPIRequestType_ALLTOALL = 5,
   MPIRequestType_MIN = MPIRequestType_ALLREDUCE,
-  MPIRequestType_MAX = MPIRequestType_BROADCAST
+  MPIRequestType_MAX = MPIRequestType_ALLTOALL
 };
 
 inline const char **EnumNamesMPIRequestType() {
@@ -83,6 +113,9 @@ inline const char **EnumNamesMPIRequestType() {
     "ALLREDUCE",
     "ALLGATHER",
     "BROADCAST",
+    "SPARSE_ALLREDUCE",
+    "REDUCESCATTER",
+    "ALLTOALL",
     nullptr
   };
   return names;
@@ -98,8 +131,11 @@ enum MPIResponseType {
   MPIResponseType_ALLGATHER = 1,
   MPIResponseType_BROADCAST = 2,
   MPIResponseType_ERROR = 3,
+  MPIResponseType_SPARSE_ALLREDUCE = 4,
+  MPIResponseType_REDUCESCATTER = 5,
+  MPIResponseType_ALLTOALL = 6,
   MPIResponseType_MIN = MPIResponseType_ALLREDUCE,
-  MPIResponseType_MAX = MPIResponseType_ERROR
+  MPIResponseType_MAX = MPIResponseType_ALLTOALL
 };
 
 inline const char **EnumNamesMPIResponseType() {
@@ -108,6 +144,9 @@ inline const char **EnumNamesMPIResponseType() {
     "ALLGATHER",
     "BROADCAST",
     "ERROR",
+    "SPARSE_ALLREDUCE",
+    "REDUCESCATTER",
+    "ALLTOALL",
     nullptr
   };
   return names;
@@ -126,7 +165,11 @@ struct MPIRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_TENSOR_NAME = 10,
     VT_ROOT_RANK = 12,
     VT_DEVICE = 14,
-    VT_TENSOR_SHAPE = 16
+    VT_TENSOR_SHAPE = 16,
+    VT_COMPRESSION = 18,
+    VT_TENSOR_ID = 20,
+    VT_PRIORITY = 22,
+    VT_SCOPE = 24
   };
   int32_t request_rank() const {
     return GetField<int32_t>(VT_REQUEST_RANK, 0);
@@ -149,6 +192,18 @@ struct MPIRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::Vector<int64_t> *tensor_shape() const {
     return GetPointer<const flatbuffers::Vector<int64_t> *>(VT_TENSOR_SHAPE);
   }
+  Compression compression() const {
+    return static_cast<Compression>(GetField<int8_t>(VT_COMPRESSION, 0));
+  }
+  int32_t tensor_id() const {
+    return GetField<int32_t>(VT_TENSOR_ID, -1);
+  }
+  int32_t priority() const {
+    return GetField<int32_t>(VT_PRIORITY, 0);
+  }
+  int8_t scope() const {
+    return GetField<int8_t>(VT_SCOPE, 0);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<int32_t>(verifier, VT_REQUEST_RANK) &&
@@ -160,6 +215,10 @@ struct MPIRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            VerifyField<int32_t>(verifier, VT_DEVICE) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_TENSOR_SHAPE) &&
            verifier.Verify(tensor_shape()) &&
+           VerifyField<int8_t>(verifier, VT_COMPRESSION) &&
+           VerifyField<int32_t>(verifier, VT_TENSOR_ID) &&
+           VerifyField<int32_t>(verifier, VT_PRIORITY) &&
+           VerifyField<int8_t>(verifier, VT_SCOPE) &&
            verifier.EndTable();
   }
 };
@@ -188,13 +247,25 @@ struct MPIRequestBuilder {
   void add_tensor_shape(flatbuffers::Offset<flatbuffers::Vector<int64_t>> tensor_shape) {
     fbb_.AddOffset(MPIRequest::VT_TENSOR_SHAPE, tensor_shape);
   }
+  void add_compression(Compression compression) {
+    fbb_.AddElement<int8_t>(MPIRequest::VT_COMPRESSION, static_cast<int8_t>(compression), 0);
+  }
+  void add_tensor_id(int32_t tensor_id) {
+    fbb_.AddElement<int32_t>(MPIRequest::VT_TENSOR_ID, tensor_id, -1);
+  }
+  void add_priority(int32_t priority) {
+    fbb_.AddElement<int32_t>(MPIRequest::VT_PRIORITY, priority, 0);
+  }
+  void add_scope(int8_t scope) {
+    fbb_.AddElement<int8_t>(MPIRequest::VT_SCOPE, scope, 0);
+  }
   MPIRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   MPIRequestBuilder &operator=(const MPIRequestBuilder &);
   flatbuffers::Offset<MPIRequest> Finish() {
-    const auto end = fbb_.EndTable(start_, 7);
+    const auto end = fbb_.EndTable(start_, 11);
     auto o = flatbuffers::Offset<MPIRequest>(end);
     return o;
   }
@@ -208,13 +279,21 @@ inline flatbuffers::Offset<MPIRequest> CreateMPIRequest(
     flatbuffers::Offset<flatbuffers::String> tensor_name = 0,
     int32_t root_rank = 0,
     int32_t device = 0,
-    flatbuffers::Offset<flatbuffers::Vector<int64_t>> tensor_shape = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<int64_t>> tensor_shape = 0,
+    Compression compression = Compression_NO_COMPRESSION,
+    int32_t tensor_id = -1,
+    int32_t priority = 0,
+    int8_t scope = 0) {
   MPIRequestBuilder builder_(_fbb);
+  builder_.add_priority(priority);
+  builder_.add_tensor_id(tensor_id);
   builder_.add_tensor_shape(tensor_shape);
   builder_.add_device(device);
   builder_.add_root_rank(root_rank);
   builder_.add_tensor_name(tensor_name);
   builder_.add_request_rank(request_rank);
+  builder_.add_scope(scope);
+  builder_.add_compression(compression);
   builder_.add_tensor_type(tensor_type);
   builder_.add_request_type(request_type);
   return builder_.Finish();
@@ -228,7 +307,11 @@ inline flatbuffers::Offset<MPIRequest> CreateMPIRequestDirect(
     const char *tensor_name = nullptr,
     int32_t root_rank = 0,
     int32_t device = 0,
-    const std::vector<int64_t> *tensor_shape = nullptr) {
+    const std::vector<int64_t> *tensor_shape = nullptr,
+    Compression compression = Compression_NO_COMPRESSION,
+    int32_t tensor_id = -1,
+    int32_t priority = 0,
+    int8_t scope = 0) {
   return horovod::common::wire::CreateMPIRequest(
       _fbb,
       request_rank,
@@ -237,7 +320,11 @@ inline flatbuffers::Offset<MPIRequest> CreateMPIRequestDirect(
       tensor_name ? _fbb.CreateString(tensor_name) : 0,
       root_rank,
       device,
-      tensor_shape ? _fbb.CreateVector<int64_t>(*tensor_shape) : 0);
+      tensor_shape ? _fbb.CreateVector<int64_t>(*tensor_shape) : 0,
+      compression,
+      tensor_id,
+      priority,
+      scope);
 }
 
 struct MPIRequestList FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
@@ -308,7 +395,11 @@ struct MPIResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_TENSOR_NAMES = 6,
     VT_ERROR_MESSAGE = 8,
     VT_DEVICES = 10,
-    VT_TENSOR_SIZES = 12
+    VT_TENSOR_SIZES = 12,
+    VT_TENSOR_IDS = 14,
+    VT_PRIORITY = 16,
+    VT_SCOPE = 18,
+    VT_SHAPE_STABLE = 20
   };
   MPIResponseType response_type() const {
     return static_cast<MPIResponseType>(GetField<int8_t>(VT_RESPONSE_TYPE, 0));
@@ -325,6 +416,18 @@ struct MPIResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::Vector<int64_t> *tensor_sizes() const {
     return GetPointer<const flatbuffers::Vector<int64_t> *>(VT_TENSOR_SIZES);
   }
+  const flatbuffers::Vector<int32_t> *tensor_ids() const {
+    return GetPointer<const flatbuffers::Vector<int32_t> *>(VT_TENSOR_IDS);
+  }
+  int32_t priority() const {
+    return GetField<int32_t>(VT_PRIORITY, 0);
+  }
+  int8_t scope() const {
+    return GetField<int8_t>(VT_SCOPE, 0);
+  }
+  bool shape_stable() const {
+    return GetField<uint8_t>(VT_SHAPE_STABLE, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<int8_t>(verifier, VT_RESPONSE_TYPE) &&
@@ -337,6 +440,11 @@ struct MPIResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            verifier.Verify(devices()) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_TENSOR_SIZES) &&
            verifier.Verify(tensor_sizes()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TENSOR_IDS) &&
+           verifier.Verify(tensor_ids()) &&
+           VerifyField<int32_t>(verifier, VT_PRIORITY) &&
+           VerifyField<int8_t>(verifier, VT_SCOPE) &&
+           VerifyField<uint8_t>(verifier, VT_SHAPE_STABLE) &&
            verifier.EndTable();
   }
 };
@@ -359,13 +467,25 @@ struct MPIResponseBuilder {
   void add_tensor_sizes(flatbuffers::Offset<flatbuffers::Vector<int64_t>> tensor_sizes) {
     fbb_.AddOffset(MPIResponse::VT_TENSOR_SIZES, tensor_sizes);
   }
+  void add_tensor_ids(flatbuffers::Offset<flatbuffers::Vector<int32_t>> tensor_ids) {
+    fbb_.AddOffset(MPIResponse::VT_TENSOR_IDS, tensor_ids);
+  }
+  void add_priority(int32_t priority) {
+    fbb_.AddElement<int32_t>(MPIResponse::VT_PRIORITY, priority, 0);
+  }
+  void add_scope(int8_t scope) {
+    fbb_.AddElement<int8_t>(MPIResponse::VT_SCOPE, scope, 0);
+  }
+  void add_shape_stable(bool shape_stable) {
+    fbb_.AddElement<uint8_t>(MPIResponse::VT_SHAPE_STABLE, static_cast<uint8_t>(shape_stable), 0);
+  }
   MPIResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   MPIResponseBuilder &operator=(const MPIResponseBuilder &);
   flatbuffers::Offset<MPIResponse> Finish() {
-    const auto end = fbb_.EndTable(start_, 5);
+    const auto end = fbb_.EndTable(start_, 9);
     auto o = flatbuffers::Offset<MPIResponse>(end);
     return o;
   }
@@ -377,12 +497,20 @@ inline flatbuffers::Offset<MPIResponse> CreateMPIResponse(
     flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> tensor_names = 0,
     flatbuffers::Offset<flatbuffers::String> error_message = 0,
     flatbuffers::Offset<flatbuffers::Vector<int32_t>> devices = 0,
-    flatbuffers::Offset<flatbuffers::Vector<int64_t>> tensor_sizes = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<int64_t>> tensor_sizes = 0,
+    flatbuffers::Offset<flatbuffers::Vector<int32_t>> tensor_ids = 0,
+    int32_t priority = 0,
+    int8_t scope = 0,
+    bool shape_stable = false) {
   MPIResponseBuilder builder_(_fbb);
+  builder_.add_priority(priority);
+  builder_.add_tensor_ids(tensor_ids);
   builder_.add_tensor_sizes(tensor_sizes);
   builder_.add_devices(devices);
   builder_.add_error_message(error_message);
   builder_.add_tensor_names(tensor_names);
+  builder_.add_shape_stable(shape_stable);
+  builder_.add_scope(scope);
   builder_.add_response_type(response_type);
   return builder_.Finish();
 }
@@ -393,20 +521,29 @@ inline flatbuffers::Offset<MPIResponse> CreateMPIResponseDirect(
     const std::vector<flatbuffers::Offset<flatbuffers::String>> *tensor_names = nullptr,
     const char *error_message = nullptr,
     const std::vector<int32_t> *devices = nullptr,
-    const std::vector<int64_t> *tensor_sizes = nullptr) {
+    const std::vector<int64_t> *tensor_sizes = nullptr,
+    const std::vector<int32_t> *tensor_ids = nullptr,
+    int32_t priority = 0,
+    int8_t scope = 0,
+    bool shape_stable = false) {
   return horovod::common::wire::CreateMPIResponse(
       _fbb,
       response_type,
       tensor_names ? _fbb.CreateVector<flatbuffers::Offset<flatbuffers::String>>(*tensor_names) : 0,
       error_message ? _fbb.CreateString(error_message) : 0,
       devices ? _fbb.CreateVector<int32_t>(*devices) : 0,
-      tensor_sizes ? _fbb.CreateVector<int64_t>(*tensor_sizes) : 0);
+      tensor_sizes ? _fbb.CreateVector<int64_t>(*tensor_sizes) : 0,
+      tensor_ids ? _fbb.CreateVector<int32_t>(*tensor_ids) : 0,
+      priority,
+      scope,
+      shape_stable);
 }
 
 struct MPIResponseList FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_RESPONSES = 4,
-    VT_SHUTDOWN = 6
+    VT_SHUTDOWN = 6,
+    VT_NEW_TENSOR_NAMES = 8
   };
   const flatbuffers::Vector<flatbuffers::Offset<MPIResponse>> *responses() const {
     return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<MPIResponse>> *>(VT_RESPONSES);
@@ -414,12 +551,18 @@ struct MPIResponseList FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   bool shutdown() const {
     return GetField<uint8_t>(VT_SHUTDOWN, 0) != 0;
   }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *new_tensor_names() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_NEW_TENSOR_NAMES);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_RESPONSES) &&
            verifier.Verify(responses()) &&
            verifier.VerifyVectorOfTables(responses()) &&
            VerifyField<uint8_t>(verifier, VT_SHUTDOWN) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_NEW_TENSOR_NAMES) &&
+           verifier.Verify(new_tensor_names()) &&
+           verifier.VerifyVectorOfStrings(new_tensor_names()) &&
            verifier.EndTable();
   }
 };
@@ -433,13 +576,16 @@ struct MPIResponseListBuilder {
   void add_shutdown(bool shutdown) {
     fbb_.AddElement<uint8_t>(MPIResponseList::VT_SHUTDOWN, static_cast<uint8_t>(shutdown), 0);
   }
+  void add_new_tensor_names(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> new_tensor_names) {
+    fbb_.AddOffset(MPIResponseList::VT_NEW_TENSOR_NAMES, new_tensor_names);
+  }
   MPIResponseListBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   MPIResponseListBuilder &operator=(const MPIResponseListBuilder &);
   flatbuffers::Offset<MPIResponseList> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 3);
     auto o = flatbuffers::Offset<MPIResponseList>(end);
     return o;
   }
@@ -448,8 +594,10 @@ struct MPIResponseListBuilder {
 inline flatbuffers::Offset<MPIResponseList> CreateMPIResponseList(
     flatbuffers::FlatBufferBuilder &_fbb,
     flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<MPIResponse>>> responses = 0,
-    bool shutdown = false) {
+    bool shutdown = false,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> new_tensor_names = 0) {
   MPIResponseListBuilder builder_(_fbb);
+  builder_.add_new_tensor_names(new_tensor_names);
   builder_.add_responses(responses);
   builder_.add_shutdown(shutdown);
   return builder_.Finish();
@@ -458,11 +606,13 @@ inline flatbuffers::Offset<MPIResponseList> CreateMPIResponseList(
 inline flatbuffers::Offset<MPIResponseList> CreateMPIResponseListDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     const std::vector<flatbuffers::Offset<MPIResponse>> *responses = nullptr,
-    bool shutdown = false) {
+    bool shutdown = false,
+    const std::vector<flatbuffers::Offset<flatbuffers::String>> *new_tensor_names = nullptr) {
   return horovod::common::wire::CreateMPIResponseList(
       _fbb,
       responses ? _fbb.CreateVector<flatbuffers::Offset<MPIResponse>>(*responses) : 0,
-      shutdown);
+      shutdown,
+      new_tensor_names ? _fbb.CreateVector<flatbuffers::Offset<flatbuffers::String>>(*new_tensor_names) : 0);
 }
 
 }  // namespace wire
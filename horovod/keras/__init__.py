@@ -23,6 +23,8 @@ from horovod.tensorflow import local_size
 from horovod.tensorflow import rank
 from horovod.tensorflow import local_rank
 from horovod.tensorflow import mpi_threads_supported
+from horovod.tensorflow import metrics
+from horovod.tensorflow import replay
 from horovod.tensorflow import Compression
 
 from horovod.keras import callbacks
@@ -22,20 +22,26 @@ from horovod.common import check_extension
 check_extension('horovod.mxnet', 'HOROVOD_WITH_MXNET',
                 __file__, 'mpi_lib')
 
+from horovod.mxnet.compression import Compression
 from horovod.mxnet.mpi_ops import allgather
+from horovod.mxnet.mpi_ops import sparse_allreduce
+from horovod.mxnet.mpi_ops import reducescatter, alltoall
 from horovod.mxnet.mpi_ops import allreduce, allreduce_
 from horovod.mxnet.mpi_ops import broadcast, broadcast_
 from horovod.mxnet.mpi_ops import init, shutdown
 from horovod.mxnet.mpi_ops import size, local_size, rank, local_rank
 from horovod.mxnet.mpi_ops import mpi_threads_supported
+from horovod.mxnet.mpi_ops import metrics
+from horovod.mxnet.mpi_ops import replay
 
 import mxnet as mx
 
 
 # This is where Horovod's DistributedOptimizer wrapper for MXNet goes
 class DistributedOptimizer(mx.optimizer.Optimizer):
-    def __init__(self, optimizer):
+    def __init__(self, optimizer, compression=Compression.none):
         self._optimizer = optimizer
+        self._compression = compression
 
     def __getattr__(self, item):
         return getattr(self._optimizer, item)
@@ -46,9 +52,11 @@ class DistributedOptimizer(mx.optimizer.Optimizer):
     def _do_allreduce(self, index, grad):
         if isinstance(index, (tuple, list)):
             for i in range(len(index)):
-                allreduce_(grad[i], average=True, name=str(index[i]))
+                allreduce_(grad[i], average=True, name=str(index[i]),
+                           compression=self._compression)
         else:
-            allreduce_(grad, average=True, name=str(index))
+            allreduce_(grad, average=True, name=str(index),
+                       compression=self._compression)
 
     def update(self, index, weight, grad, state):
         self._do_allreduce(index, grad)
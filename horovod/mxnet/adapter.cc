@@ -94,7 +94,11 @@ template <class T> T* MXTemporaryBuffer<T>::tensor() const {
 
 template <class T>
 MXOpContext<T>::MXOpContext(int device, T* output)
-    : device_(device), output_(output) {}
+    : device_(device), outputs_({output}) {}
+
+template <class T>
+MXOpContext<T>::MXOpContext(int device, std::vector<T*> outputs)
+    : device_(device), outputs_(std::move(outputs)) {}
 
 template <class T>
 Status
@@ -108,13 +112,24 @@ MXOpContext<T>::AllocatePersistent(int64_t size,
 template <class T>
 Status MXOpContext<T>::AllocateOutput(TensorShape shape,
                                       std::shared_ptr<Tensor>* tensor) {
+  return AllocateOutput(0, shape, tensor);
+}
+
+template <class T>
+Status MXOpContext<T>::AllocateOutput(int output_index, TensorShape shape,
+                                      std::shared_ptr<Tensor>* tensor) {
+  if (output_index < 0 || output_index >= (int)outputs_.size()) {
+    return Status::PreconditionError("Invalid output index " +
+                                     std::to_string(output_index) + ".");
+  }
+  T* output = outputs_[output_index];
   int64_t* shape_array = new int64_t[shape.dims()];
   for (int idx = 0; idx < shape.dims(); idx++) {
     shape_array[idx] = shape.dim_size(idx);
   }
-  TensorUtil::ResizeNd(output_, shape.dims(), shape_array);
+  TensorUtil::ResizeNd(output, shape.dims(), shape_array);
   delete[] shape_array;
-  *tensor = std::make_shared<MXTensor<T>>(output_);
+  *tensor = std::make_shared<MXTensor<T>>(output);
   return Status::OK();
 }
 
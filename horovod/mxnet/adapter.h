@@ -58,16 +58,19 @@ public:
 template <class T> class MXOpContext : public OpContext {
 public:
   MXOpContext(int device, T* output);
+  MXOpContext(int device, std::vector<T*> outputs);
   virtual Status
   AllocatePersistent(int64_t size,
                      std::shared_ptr<PersistentBuffer>* tensor) override;
   virtual Status AllocateOutput(TensorShape shape,
                                 std::shared_ptr<Tensor>* tensor) override;
+  virtual Status AllocateOutput(int output_index, TensorShape shape,
+                                std::shared_ptr<Tensor>* tensor) override;
   virtual Framework framework() const override;
 
 private:
   int device_;
-  T* output_;
+  std::vector<T*> outputs_;
 };
 
 inline void ThrowIfError(const Status& status) {
@@ -0,0 +1,72 @@
+# Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+"""Gradient compression algorithms."""
+
+
+class Compressor(object):
+    """Interface for compression applied by the Horovod core during allreduce."""
+
+    """Compression applied by the Horovod core to the data of the tensor."""
+    core_compression = 0
+
+
+class NoneCompressor(Compressor):
+    """Default no-op compression."""
+    core_compression = 0
+
+
+class FP16FusedCompressor(Compressor):
+    """Compress float32 gradients to 16-bit inside the Horovod fusion buffer.
+
+    Tensors larger than the fusion buffer, and GPU tensors reduced without NCCL,
+    are reduced without compression.
+    """
+    core_compression = 1
+
+
+class Int8Compressor(FP16FusedCompressor):
+    """Quantize float32 gradients of CPU tensors to 8 bits.
+
+    Every chunk of 512 values is scaled by its largest absolute value and
+    rounded stochastically. The quantization error of every tensor is kept by
+    Horovod and added to the tensor the next time it is reduced.
+    """
+    core_compression = 2
+
+
+class OneBitCompressor(FP16FusedCompressor):
+    """Quantize float32 gradients of CPU tensors to their signs.
+
+    Every chunk of 512 values is sent as its signs and the mean of its absolute
+    values. The quantization error of every tensor is kept by Horovod and added
+    to the tensor the next time it is reduced.
+    """
+    core_compression = 3
+
+
+class Compression(object):
+    """Optional gradient compression algorithm used during allreduce."""
+
+    """Do not compress the gradients. This is the default."""
+    none = NoneCompressor
+
+    """Compress float32 gradients to 16-bit inside the Horovod fusion buffer."""
+    fp16_fused = FP16FusedCompressor
+
+    """Quantize float32 gradients to 8 bits with error feedback."""
+    int8 = Int8Compressor
+
+    """Quantize float32 gradients to 1 bit with error feedback."""
+    onebit = OneBitCompressor
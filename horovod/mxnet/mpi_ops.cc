@@ -19,7 +19,7 @@
 #include "adapter.h"
 #include "cuda_util.h"
 #include "mpi_ops.h"
-#include "ready_event.h"
+#include "staging_pool.h"
 #include "tensor_util.h"
 
 namespace horovod {
@@ -29,6 +29,10 @@ namespace {
 
 std::atomic_int op_count;
 
+#if HAVE_CUDA
+StagingBufferPool staging_pool;
+#endif
+
 std::string GetOpName(std::string prefix, char* name) {
   if (name != nullptr) {
     return prefix + "." + std::string(name);
@@ -49,7 +53,7 @@ inline void InvokeCompleteCallback(Callback on_complete, const Status& status) {
 }
 
 void DoAllreduce(NDArray* tensor, NDArray* output, const std::string& name,
-                 Callback on_complete) {
+                 Compression compression, Callback on_complete) {
   ThrowIfError(common::CheckInitialized());
 
   auto device = TensorUtil::GetDevice(tensor);
@@ -62,30 +66,31 @@ void DoAllreduce(NDArray* tensor, NDArray* output, const std::string& name,
                              name, device,
                              [on_complete](const Status& status) {
                                InvokeCompleteCallback(on_complete, status);
-                             });
+                             },
+                             compression);
   ThrowIfError(enqueue_result);
 }
 
 #if HAVE_CUDA
-void DoAllreduceCudaOnCPU(NDArray* tensor, NDArray* output, std::string& name,
+// Reduces a GPU tensor staged in a pinned host buffer in place. The copies to
+// and from the buffer are engine operations, which its variable orders around
+// this one, so no ready event is needed.
+void DoAllreduceCudaOnCPU(std::shared_ptr<StagingBuffer> staging,
+                          std::string& name, Compression compression,
                           Callback on_complete) {
   ThrowIfError(common::CheckInitialized());
 
-  // Make async copy of input tensor to CPU tensor and record completion event.
-  auto hvd_cpu_buffer = std::make_shared<MXTemporaryBuffer<NDArray>>(
-      CPU_DEVICE_ID, tensor->dtype());
-  TensorUtil::AsyncCopyCudaToCPU(tensor, hvd_cpu_buffer->tensor());
-  auto hvd_context = std::make_shared<MXOpContext<NDArray>>(
-      CPU_DEVICE_ID, hvd_cpu_buffer->tensor());
-  auto ready_event = std::make_shared<MXReadyEvent<NDArray>>(tensor);
+  auto hvd_cpu_buffer = std::make_shared<MXTensor<NDArray>>(&staging->view);
+  auto hvd_context =
+      std::make_shared<MXOpContext<NDArray>>(CPU_DEVICE_ID, &staging->view);
 
   auto enqueue_result = EnqueueTensorAllreduce(
-      hvd_context, hvd_cpu_buffer, hvd_cpu_buffer, ready_event,
+      hvd_context, hvd_cpu_buffer, hvd_cpu_buffer, nullptr,
       name, CPU_DEVICE_ID,
-      [hvd_cpu_buffer, output, on_complete](const Status& status) {
-        TensorUtil::CopyCPUToCuda(hvd_cpu_buffer->tensor(), output);
+      [staging, on_complete](const Status& status) {
         InvokeCompleteCallback(on_complete, status);
-      });
+      },
+      compression);
   ThrowIfError(enqueue_result);
 }
 #endif
@@ -108,25 +113,25 @@ void DoAllgather(NDArray* tensor, NDArray* output, std::string& name,
 }
 
 #if HAVE_CUDA
-void DoAllgatherCudaOnCPU(NDArray* tensor, NDArray* output, std::string& name,
+// Gathers a GPU tensor staged in a pinned host buffer. The size of the output
+// is only known once all ranks have sent theirs, so it is gathered into a
+// temporary buffer, and the copy back to the GPU is pushed to the engine from
+// the callback.
+void DoAllgatherCudaOnCPU(std::shared_ptr<StagingBuffer> staging,
+                          NDArray* output, std::string& name,
                           Callback on_complete) {
   ThrowIfError(common::CheckInitialized());
 
-  // Make async copy of input tensor to CPU tensor and record completion event.
-  auto hvd_cpu_tensor = std::make_shared<MXTemporaryBuffer<NDArray>>(
-      CPU_DEVICE_ID, tensor->dtype());
-  TensorUtil::AsyncCopyCudaToCPU(tensor, hvd_cpu_tensor->tensor());
-  auto ready_event = std::make_shared<MXReadyEvent<NDArray>>(tensor);
-
+  auto hvd_cpu_tensor = std::make_shared<MXTensor<NDArray>>(&staging->view);
   auto hvd_cpu_output = std::make_shared<MXTemporaryBuffer<NDArray>>(
       CPU_DEVICE_ID, output->dtype());
   auto hvd_context = std::make_shared<MXOpContext<NDArray>>(
       CPU_DEVICE_ID, hvd_cpu_output->tensor());
 
   auto enqueue_result = EnqueueTensorAllgather(
-      hvd_context, hvd_cpu_tensor, ready_event,
+      hvd_context, hvd_cpu_tensor, nullptr,
       name, CPU_DEVICE_ID,
-      [hvd_cpu_output, output, on_complete](const Status& status) {
+      [staging, hvd_cpu_output, output, on_complete](const Status& status) {
         TensorUtil::CopyCPUToCuda(hvd_cpu_output->tensor(), output);
         InvokeCompleteCallback(on_complete, status);
       });
@@ -160,56 +165,108 @@ void DoBroadcast(NDArray* tensor, NDArray* output, int root_rank,
 }
 
 #if HAVE_CUDA
-void DoBroadcastCudaOnCPU(
-    std::shared_ptr<MXTemporaryBuffer<NDArray>>& hvd_cpu_buffer, int root_rank,
-    std::string& name, Callback on_complete) {
-  // Make async copy of input tensor to CPU tensor and record completion event.
-  auto hvd_context = std::make_shared<MXOpContext<NDArray>>(
-      CPU_DEVICE_ID, hvd_cpu_buffer->tensor());
-  auto ready_event =
-      std::make_shared<MXReadyEvent<NDArray>>(hvd_cpu_buffer->tensor());
+// Broadcasts a GPU tensor staged in a pinned host buffer in place, ordered
+// like the allreduce above.
+void DoBroadcastCudaOnCPU(std::shared_ptr<StagingBuffer> staging,
+                          int root_rank, std::string& name,
+                          Callback on_complete) {
+  ThrowIfError(common::CheckInitialized());
+
+  auto hvd_cpu_buffer = std::make_shared<MXTensor<NDArray>>(&staging->view);
+  auto hvd_context =
+      std::make_shared<MXOpContext<NDArray>>(CPU_DEVICE_ID, &staging->view);
 
   auto enqueue_result = EnqueueTensorBroadcast(
-      hvd_context, hvd_cpu_buffer, hvd_cpu_buffer, root_rank, ready_event,
+      hvd_context, hvd_cpu_buffer, hvd_cpu_buffer, root_rank, nullptr,
       name, CPU_DEVICE_ID,
-      [on_complete](const Status& status) {
+      [staging, on_complete](const Status& status) {
         InvokeCompleteCallback(on_complete, status);
       });
   ThrowIfError(enqueue_result);
 }
 #endif
 
+void DoSparseAllreduce(NDArray* values, NDArray* indices, NDArray* output,
+                       NDArray* output_indices, std::string& name,
+                       bool deduplicate, Callback on_complete) {
+  ThrowIfError(common::CheckInitialized());
+
+  auto device = TensorUtil::GetDevice(values);
+  auto hvd_values = std::make_shared<MXTensor<NDArray>>(values);
+  auto hvd_indices = std::make_shared<MXTensor<NDArray>>(indices);
+  auto hvd_context = std::make_shared<MXOpContext<NDArray>>(
+      device, std::vector<NDArray*>{output, output_indices});
+
+  auto enqueue_result = EnqueueTensorSparseAllreduce(
+      hvd_context, hvd_values, hvd_indices, nullptr, name, device,
+      deduplicate, [on_complete](const Status& status) {
+        InvokeCompleteCallback(on_complete, status);
+      });
+  ThrowIfError(enqueue_result);
+}
+
+void DoReducescatter(NDArray* tensor, NDArray* output, std::string& name,
+                     Callback on_complete) {
+  ThrowIfError(common::CheckInitialized());
+
+  auto device = TensorUtil::GetDevice(tensor);
+  auto hvd_tensor = std::make_shared<MXTensor<NDArray>>(tensor);
+  auto hvd_context = std::make_shared<MXOpContext<NDArray>>(device, output);
+
+  auto enqueue_result = EnqueueTensorReducescatter(
+      hvd_context, hvd_tensor, nullptr, name, device,
+      [on_complete](const Status& status) {
+        InvokeCompleteCallback(on_complete, status);
+      });
+  ThrowIfError(enqueue_result);
+}
+
+void DoAlltoall(NDArray* tensor, std::vector<int32_t>& splits, NDArray* output,
+                std::string& name, Callback on_complete) {
+  ThrowIfError(common::CheckInitialized());
+
+  auto device = TensorUtil::GetDevice(tensor);
+  auto hvd_tensor = std::make_shared<MXTensor<NDArray>>(tensor);
+  auto hvd_context = std::make_shared<MXOpContext<NDArray>>(device, output);
+
+  auto enqueue_result = EnqueueTensorAlltoall(
+      hvd_context, hvd_tensor, splits, nullptr, name, device,
+      [on_complete](const Status& status) {
+        InvokeCompleteCallback(on_complete, status);
+      });
+  ThrowIfError(enqueue_result);
+}
+
 extern "C" int horovod_mxnet_allreduce_async(NDArray* input, NDArray* output,
-                                             char* name, bool average) {
+                                             char* name, bool average,
+                                             int compression) {
   MX_API_BEGIN();
 
   std::string op_name = GetOpName("allreduce", name);
-  auto allreduce_async_fn = [input, output,
-                             op_name](RunContext rctx,
-                                      Callback on_complete) mutable {
-    DoAllreduce(input, output, op_name, on_complete);
+  auto allreduce_async_fn = [input, output, op_name,
+                             compression](RunContext rctx,
+                                          Callback on_complete) mutable {
+    DoAllreduce(input, output, op_name, (Compression)compression,
+                on_complete);
   };
 
-#if HAVE_CUDA
+#if HAVE_CUDA && !HOROVOD_GPU_ALLREDUCE
+  // The tensor is reduced in a pinned host buffer from the pool. The engine
+  // copies it there and back asynchronously, ordered by the variables of the
+  // tensors and the buffer, so the operation itself only writes the buffer.
+  auto staging = staging_pool.Acquire(*input);
+  TensorUtil::AsyncCopyCudaToCPU(input, &staging->view);
   auto allreduce_async_cpu_fn =
-      [input, output, op_name](RunContext rctx,
-                               Callback on_complete) mutable {
-        DoAllreduceCudaOnCPU(input, output, op_name, on_complete);
+      [staging, op_name, compression](RunContext rctx,
+                                      Callback on_complete) mutable {
+        DoAllreduceCudaOnCPU(staging, op_name, (Compression)compression,
+                             on_complete);
       };
-#endif
-
-#if HAVE_CUDA && !HOROVOD_GPU_ALLREDUCE
-  // Not in-place
-  if (input->var() != output->var()) {
-    Engine::Get()->PushAsync(allreduce_async_cpu_fn, input->ctx(),
-                             {input->var()}, {output->var()},
-                             FnProperty::kNormal, 0, "HorovodAllreduce");
-  // In-place
-  } else {
-    Engine::Get()->PushAsync(allreduce_async_cpu_fn, input->ctx(), {},
-                             {output->var()}, FnProperty::kNormal, 0,
-                             "HorovodAllreduce");
-  }
+  Engine::Get()->PushAsync(allreduce_async_cpu_fn, input->ctx(), {},
+                           {staging->view.var()}, FnProperty::kNormal, 0,
+                           "HorovodAllreduce");
+  TensorUtil::CopyCPUToCuda(&staging->view, output);
+  staging_pool.Release(staging);
 #else
   // Not in-place
   if (input->var() != output->var()) {
@@ -242,26 +299,20 @@ extern "C" int horovod_mxnet_allgather_async(NDArray* input, NDArray* output,
     DoAllgather(input, output, op_name, on_complete);
   };
 
-#if HAVE_CUDA
+#if HAVE_CUDA && !HOROVOD_GPU_ALLGATHER
+  // The input is staged in a pinned host buffer from the pool, which the
+  // engine copies it to before the operation runs.
+  auto staging = staging_pool.Acquire(*input);
+  TensorUtil::AsyncCopyCudaToCPU(input, &staging->view);
   auto allgather_async_cpu_fn =
-      [input, output, op_name](RunContext rctx,
-                               Callback on_complete) mutable {
-        DoAllgatherCudaOnCPU(input, output, op_name, on_complete);
+      [staging, output, op_name](RunContext rctx,
+                                 Callback on_complete) mutable {
+        DoAllgatherCudaOnCPU(staging, output, op_name, on_complete);
       };
-#endif
-
-#if HAVE_CUDA && HOROVOD_GPU_ALLGATHER != 'M'
-  // Not in-place
-  if (input->var() != output->var()) {
-    Engine::Get()->PushAsync(allgather_async_cpu_fn, input->ctx(),
-                             {input->var()}, {output->var()},
-                             FnProperty::kNormal, 0, "HorovodAllgather");
-  // In-place
-  } else {
-    Engine::Get()->PushAsync(allgather_async_cpu_fn, input->ctx(), {},
-                             {output->var()}, FnProperty::kNormal, 0,
-                             "HorovodAllgather");
-  }
+  Engine::Get()->PushAsync(allgather_async_cpu_fn, input->ctx(),
+                           {staging->view.var()}, {output->var()},
+                           FnProperty::kNormal, 0, "HorovodAllgather");
+  staging_pool.Release(staging);
 #else
   // Not in-place
   if (input->var() != output->var()) {
@@ -290,31 +341,24 @@ extern "C" int horovod_mxnet_broadcast_async(NDArray* input, NDArray* output,
     DoBroadcast(input, output, root_rank, op_name, on_complete);
   };
 
-#if HAVE_CUDA && HOROVOD_GPU_BROADCAST != 'M'
+#if HAVE_CUDA && !HOROVOD_GPU_BROADCAST
   ThrowIfError(common::CheckInitialized());
-  // Make async copy of input tensor to CPU tensor and record completion event.
-  auto hvd_cpu_buffer = std::make_shared<MXTemporaryBuffer<NDArray>>(
-      CPU_DEVICE_ID, input->dtype());
-  TensorUtil::AsyncCopyCudaToCPU(input, hvd_cpu_buffer->tensor());
-  auto broadcast_async_cpu_fn =
-        [hvd_cpu_buffer, op_name, root_rank]
-        (RunContext rctx, Callback on_complete) mutable {
-          DoBroadcastCudaOnCPU(hvd_cpu_buffer, root_rank, op_name, on_complete);
-        };
-
-  // Not in-place
-  if (input->var() != output->var()) {
-    Engine::Get()->PushAsync(broadcast_async_cpu_fn, input->ctx(),
-                             {input->var()}, {output->var()},
-                             FnProperty::kNormal, 0, "HorovodBroadcast");
-  // In-place
-  } else {
-    Engine::Get()->PushAsync(broadcast_async_cpu_fn, input->ctx(), {},
-                             {output->var()}, FnProperty::kNormal, 0,
-                             "HorovodBroadcast");
+  // Staged like the allreduce. Only the root rank needs to copy its data to
+  // the buffer, since the others receive theirs.
+  auto staging = staging_pool.Acquire(*input);
+  if (horovod_rank() == root_rank) {
+    TensorUtil::AsyncCopyCudaToCPU(input, &staging->view);
   }
-
-  TensorUtil::CopyCPUToCuda(hvd_cpu_buffer->tensor(), output);
+  auto broadcast_async_cpu_fn =
+      [staging, op_name, root_rank](RunContext rctx,
+                                    Callback on_complete) mutable {
+        DoBroadcastCudaOnCPU(staging, root_rank, op_name, on_complete);
+      };
+  Engine::Get()->PushAsync(broadcast_async_cpu_fn, input->ctx(), {},
+                           {staging->view.var()}, FnProperty::kNormal, 0,
+                           "HorovodBroadcast");
+  TensorUtil::CopyCPUToCuda(&staging->view, output);
+  staging_pool.Release(staging);
 #else
   // Not in-place
   if (input->var() != output->var()) {
@@ -332,5 +376,69 @@ extern "C" int horovod_mxnet_broadcast_async(NDArray* input, NDArray* output,
   MX_API_END();
 }
 
+extern "C" int horovod_mxnet_sparse_allreduce_async(NDArray* values,
+                                                    NDArray* indices,
+                                                    NDArray* output,
+                                                    NDArray* output_indices,
+                                                    char* name,
+                                                    bool deduplicate) {
+  MX_API_BEGIN();
+
+  // Sparse allreduce only runs on the CPU, so the Python wrapper passes CPU
+  // arrays.
+  std::string op_name = GetOpName("sparse_allreduce", name);
+  auto sparse_allreduce_async_fn =
+      [values, indices, output, output_indices, op_name,
+       deduplicate](RunContext rctx, Callback on_complete) mutable {
+        DoSparseAllreduce(values, indices, output, output_indices, op_name,
+                          deduplicate, on_complete);
+      };
+
+  Engine::Get()->PushAsync(sparse_allreduce_async_fn, values->ctx(),
+                           {values->var(), indices->var()},
+                           {output->var(), output_indices->var()},
+                           FnProperty::kNormal, 0, "HorovodSparseAllreduce");
+
+  MX_API_END();
+}
+
+extern "C" int horovod_mxnet_reducescatter_async(NDArray* input,
+                                                 NDArray* output, char* name) {
+  MX_API_BEGIN();
+
+  // GPU arrays are reduced with NCCL, so they are passed on as they are.
+  std::string op_name = GetOpName("reducescatter", name);
+  auto reducescatter_async_fn = [input, output, op_name](
+      RunContext rctx, Callback on_complete) mutable {
+    DoReducescatter(input, output, op_name, on_complete);
+  };
+
+  Engine::Get()->PushAsync(reducescatter_async_fn, input->ctx(),
+                           {input->var()}, {output->var()},
+                           FnProperty::kNormal, 0, "HorovodReducescatter");
+
+  MX_API_END();
+}
+
+extern "C" int horovod_mxnet_alltoall_async(NDArray* input, int* splits,
+                                            int num_splits, NDArray* output,
+                                            char* name) {
+  MX_API_BEGIN();
+
+  // The splits are copied, since the operation runs after this call returns.
+  std::vector<int32_t> splits_vector(splits, splits + num_splits);
+  std::string op_name = GetOpName("alltoall", name);
+  auto alltoall_async_fn = [input, splits_vector, output, op_name](
+      RunContext rctx, Callback on_complete) mutable {
+    DoAlltoall(input, splits_vector, output, op_name, on_complete);
+  };
+
+  Engine::Get()->PushAsync(alltoall_async_fn, input->ctx(), {input->var()},
+                           {output->var()}, FnProperty::kNormal, 0,
+                           "HorovodAlltoall");
+
+  MX_API_END();
+}
+
 } // namespace mxnet
 } // namespace horovod
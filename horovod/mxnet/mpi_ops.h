@@ -32,11 +32,23 @@ typedef ::mxnet::NDArray NDArray;
 typedef ::mxnet::Engine::CallbackOnComplete Callback;
 
 extern "C" int horovod_mxnet_allreduce_async(NDArray* tensor, NDArray* output,
-                                             char* name, bool average);
+                                             char* name, bool average,
+                                             int compression);
 extern "C" int horovod_mxnet_allgather_async(NDArray* tensor, NDArray* output,
                                              char* name);
 extern "C" int horovod_mxnet_broadcast_async(NDArray* tensor, NDArray* output,
                                              int root_rank, char* name);
+extern "C" int horovod_mxnet_sparse_allreduce_async(NDArray* values,
+                                                    NDArray* indices,
+                                                    NDArray* output,
+                                                    NDArray* output_indices,
+                                                    char* name,
+                                                    bool deduplicate);
+extern "C" int horovod_mxnet_reducescatter_async(NDArray* tensor,
+                                                 NDArray* output, char* name);
+extern "C" int horovod_mxnet_alltoall_async(NDArray* tensor, int* splits,
+                                            int num_splits, NDArray* output,
+                                            char* name);
 
 } // namespace mxnet
 } // namespace horovod
@@ -25,6 +25,7 @@ import mxnet as mx
 from mxnet.base import c_str, check_call, string_types
 
 from horovod.common import get_ext_suffix
+from horovod.mxnet.compression import Compression
 from horovod.common import HorovodBasics as _HorovodBasics
 _basics = _HorovodBasics(__file__, 'mpi_lib')
 
@@ -36,13 +37,15 @@ local_size = _basics.local_size
 rank = _basics.rank
 local_rank = _basics.local_rank
 mpi_threads_supported = _basics.mpi_threads_supported
+metrics = _basics.metrics
+replay = _basics.replay
 
 dll_path = os.path.join(os.path.dirname(__file__),
                         'mpi_lib' + get_ext_suffix())
 MPI_MXNET_LIB_CTYPES = ctypes.CDLL(dll_path, ctypes.RTLD_GLOBAL)
 
 
-def allreduce(tensor, average=True, name=None):
+def allreduce(tensor, average=True, name=None, compression=Compression.none):
     """
     A function that performs averaging or summation of the input tensor over
     all the Horovod processes. The input tensor is not modified.
@@ -61,6 +64,8 @@ def allreduce(tensor, average=True, name=None):
         average: A flag indicating whether to compute average or summation,
                  defaults to average.
         name: A name of the reduction operation.
+        compression: Compression applied by Horovod to float32 data while it
+                     is reduced. Defaults to not using compression.
 
     Returns:
         A tensor of the same shape and type as `tensor`, averaged or summed
@@ -72,15 +77,17 @@ def allreduce(tensor, average=True, name=None):
     c_out = output.handle
     if isinstance(name, string_types):
         check_call(MPI_MXNET_LIB_CTYPES.horovod_mxnet_allreduce_async(c_in,
-                   c_out, c_str(name), ctypes.c_bool(average)))
+                   c_out, c_str(name), ctypes.c_bool(average),
+                   ctypes.c_int(compression.core_compression)))
     else:
         check_call(MPI_MXNET_LIB_CTYPES.horovod_mxnet_allreduce_async(c_in,
-                   c_out, name, ctypes.c_bool(average)))
+                   c_out, name, ctypes.c_bool(average),
+                   ctypes.c_int(compression.core_compression)))
 
     return output
 
 
-def allreduce_(tensor, average=True, name=None):
+def allreduce_(tensor, average=True, name=None, compression=Compression.none):
     """
     A function that performs in-place averaging or summation of the input
     tensor over all the Horovod processes.
@@ -95,6 +102,8 @@ def allreduce_(tensor, average=True, name=None):
         average: A flag indicating whether to compute average or summation,
                  defaults to average.
         name: A name of the reduction operation.
+        compression: Compression applied by Horovod to float32 data while it
+                     is reduced. Defaults to not using compression.
 
     Returns:
         A tensor of the same shape and type as `tensor`, averaged or summed
@@ -104,10 +113,12 @@ def allreduce_(tensor, average=True, name=None):
     c_out = tensor.handle
     if isinstance(name, string_types):
         check_call(MPI_MXNET_LIB_CTYPES.horovod_mxnet_allreduce_async(c_in,
-                   c_out, c_str(name), ctypes.c_bool(average)))
+                   c_out, c_str(name), ctypes.c_bool(average),
+                   ctypes.c_int(compression.core_compression)))
     else:
         check_call(MPI_MXNET_LIB_CTYPES.horovod_mxnet_allreduce_async(c_in,
-                   c_out, name, ctypes.c_bool(average)))
+                   c_out, name, ctypes.c_bool(average),
+                   ctypes.c_int(compression.core_compression)))
     return tensor
 
 
@@ -148,6 +159,114 @@ def allgather(tensor, name=None):
     return output
 
 
+def sparse_allreduce(values, indices, average=True, deduplicate=False,
+                     name=None):
+    """
+    A function that averages or sums the rows of a sparse tensor, given as the
+    rows `values` and their `indices` along the first dimension, over all the
+    Horovod processes. The input tensors are not modified.
+
+    The rows and indices of all processes are gathered in a single operation
+    instead of densifying the tensor, so the input values on the different
+    processes must have the same rank and shape, except for the first
+    dimension. The operation runs on the CPU, GPU tensors are copied to the CPU
+    first.
+
+    Arguments:
+        values: A tensor with the rows of the sparse tensor.
+        indices: A vector with the index of every row of `values`.
+        average: A flag indicating whether to compute average or summation,
+                 defaults to average.
+        deduplicate: If True, rows with the same index are summed up into a
+                     single row. Otherwise the rows of all processes are kept.
+        name: A name of the sparse allreduce operation.
+
+    Returns:
+        A tuple of the averaged or summed rows and their int64 indices, in the
+        context of `values`. Without deduplication these are the rows and
+        indices of all processes in rank order, otherwise every index occurs
+        once in the order in which it first occurs.
+    """
+    assert(isinstance(values, mx.nd.NDArray))
+    assert(isinstance(indices, mx.nd.NDArray))
+    cpu_values = values.as_in_context(mx.cpu())
+    cpu_indices = indices.as_in_context(mx.cpu()).astype('int64')
+    output = mx.nd.zeros(shape=values.shape, ctx=mx.cpu(), dtype=values.dtype)
+    output_indices = mx.nd.zeros(shape=indices.shape, ctx=mx.cpu(),
+                                 dtype='int64')
+    c_name = c_str(name) if isinstance(name, string_types) else name
+    check_call(MPI_MXNET_LIB_CTYPES.horovod_mxnet_sparse_allreduce_async(
+        cpu_values.handle, cpu_indices.handle, output.handle,
+        output_indices.handle, c_name, ctypes.c_bool(deduplicate)))
+    if average:
+        output /= size()
+    return (output.as_in_context(values.context),
+            output_indices.as_in_context(values.context))
+
+
+def reducescatter(tensor, name=None):
+    """
+    A function that sums the input tensor over all the Horovod processes and
+    scatters the sum along the first dimension. The input tensor is not
+    modified.
+
+    The tensor type and shape must be the same on all Horovod processes for a
+    given name. The rows of the sum are split up among the processes in rank
+    order, the first processes getting one more row if the first dimension
+    can't be split up evenly. GPU tensors require Horovod to be built with
+    NCCL.
+
+    Arguments:
+        tensor: A tensor to reduce and scatter.
+        name: A name of the reducescatter operation.
+
+    Returns:
+        A tensor of the same type as `tensor` with the rows of the sum that
+        belong to this process.
+    """
+    assert(isinstance(tensor, mx.nd.NDArray))
+    output = mx.nd.zeros(shape=tensor.shape, ctx=tensor.context,
+                         dtype=tensor.dtype)
+    c_name = c_str(name) if isinstance(name, string_types) else name
+    check_call(MPI_MXNET_LIB_CTYPES.horovod_mxnet_reducescatter_async(
+        tensor.handle, output.handle, c_name))
+    return output
+
+
+def alltoall(tensor, splits=None, name=None):
+    """
+    A function that sends the rows of the input tensor to all the Horovod
+    processes and concatenates the rows received from them. The input tensor
+    is not modified.
+
+    `splits[r]` rows of `tensor` are sent to process `r` in rank order. If
+    `splits` is None, the first dimension must be divisible by the number of
+    processes and the rows are split up evenly. The input tensors on the
+    different processes must have the same rank and shape, except for the
+    first dimension. GPU tensors require Horovod to be built with NCCL 2.7 or
+    newer.
+
+    Arguments:
+        tensor: A tensor to distribute.
+        splits: A list with the number of rows sent to every process.
+        name: A name of the alltoall operation.
+
+    Returns:
+        A tensor of the same type as `tensor` with the rows received from all
+        processes, concatenated on dimension zero in rank order.
+    """
+    assert(isinstance(tensor, mx.nd.NDArray))
+    splits = [] if splits is None else [int(split) for split in splits]
+    c_splits = (ctypes.c_int * len(splits))(*splits)
+    output = mx.nd.zeros(shape=tensor.shape, ctx=tensor.context,
+                         dtype=tensor.dtype)
+    c_name = c_str(name) if isinstance(name, string_types) else name
+    check_call(MPI_MXNET_LIB_CTYPES.horovod_mxnet_alltoall_async(
+        tensor.handle, c_splits, ctypes.c_int(len(splits)), output.handle,
+        c_name))
+    return output
+
+
 def broadcast(tensor, root_rank, name=None):
     """
     A function that broadcasts the input tensor on root rank to the same input
@@ -0,0 +1,67 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "staging_pool.h"
+
+namespace horovod {
+namespace mxnet {
+
+using namespace ::mxnet;
+
+std::shared_ptr<StagingBuffer>
+StagingBufferPool::Acquire(const NDArray& tensor) {
+  int64_t capacity = 1;
+  while (capacity < (int64_t)tensor.shape().Size()) {
+    capacity <<= 1;
+  }
+  int device = tensor.ctx().real_dev_id();
+  Key key(device, tensor.dtype(), capacity);
+
+  auto staging = std::make_shared<StagingBuffer>();
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto& buffers = free_buffers_[key];
+    if (!buffers.empty()) {
+      staging->buffer = buffers.back();
+      buffers.pop_back();
+    }
+  }
+  if (staging->buffer.is_none()) {
+    TShape shape(1);
+    shape[0] = capacity;
+    staging->buffer =
+        NDArray(shape, Context::CPUPinned(device), false, tensor.dtype());
+  }
+  staging->view = staging->buffer.Reshape(tensor.shape());
+  return staging;
+}
+
+void StagingBufferPool::Release(std::shared_ptr<StagingBuffer> staging) {
+  // A write dependency waits for the readers of the buffer as well.
+  auto buffer = staging->buffer;
+  Engine::Get()->PushSync(
+      [this, buffer](RunContext rctx) { Put(buffer); }, Context::CPU(), {},
+      {buffer.var()}, FnProperty::kNormal, 0, "HorovodReleaseStagingBuffer");
+}
+
+void StagingBufferPool::Put(const NDArray& buffer) {
+  Key key(buffer.ctx().real_dev_id(), buffer.dtype(),
+          (int64_t)buffer.shape().Size());
+  std::lock_guard<std::mutex> guard(mutex_);
+  free_buffers_[key].push_back(buffer);
+}
+
+} // namespace mxnet
+} // namespace horovod
@@ -0,0 +1,70 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef HOROVOD_MXNET_STAGING_POOL_H
+#define HOROVOD_MXNET_STAGING_POOL_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include <mxnet/engine.h>
+#include <mxnet/ndarray.h>
+
+namespace horovod {
+namespace mxnet {
+
+typedef ::mxnet::NDArray NDArray;
+
+// Pool of pinned host buffers that GPU tensors are staged in when the
+// operation on them runs on the CPU. Buffers are kept per GPU and data type,
+// and their number of elements is rounded up to a power of two, so that
+// tensors of similar sizes share them.
+//
+// All accesses to a staged buffer are pushed to the MXNet engine under the
+// variable of the buffer, so a buffer is only handed out again once an
+// engine operation pushed by Release has seen its last user finish.
+struct StagingBuffer {
+  // Pooled buffer with room for a power of two of elements.
+  NDArray buffer;
+  // The buffer reshaped like the staged tensor, sharing its variable.
+  NDArray view;
+};
+
+class StagingBufferPool {
+public:
+  // Returns a buffer for the tensor, on pinned memory of its GPU.
+  std::shared_ptr<StagingBuffer> Acquire(const NDArray& tensor);
+
+  // Pushes an engine operation that returns the buffer to the pool after all
+  // operations pushed on it so far.
+  void Release(std::shared_ptr<StagingBuffer> staging);
+
+private:
+  // GPU, data type and number of elements of a buffer.
+  typedef std::tuple<int, int, int64_t> Key;
+
+  void Put(const NDArray& buffer);
+
+  std::mutex mutex_;
+  std::map<Key, std::vector<NDArray>> free_buffers_;
+};
+
+} // namespace mxnet
+} // namespace horovod
+
+#endif // HOROVOD_MXNET_STAGING_POOL_H
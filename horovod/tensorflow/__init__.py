@@ -36,21 +36,32 @@ check_extension('horovod.tensorflow', 'HOROVOD_WITH_TENSORFLOW', __file__, 'mpi_
 
 from horovod.tensorflow.compression import Compression
 from horovod.tensorflow.mpi_ops import allgather, broadcast, _allreduce
+from horovod.tensorflow.mpi_ops import _grouped_allreduce
+from horovod.tensorflow.mpi_ops import sparse_allreduce
+from horovod.tensorflow.mpi_ops import reducescatter, alltoall
 from horovod.tensorflow.mpi_ops import init, shutdown
 from horovod.tensorflow.mpi_ops import size, local_size, rank, local_rank
 from horovod.tensorflow.mpi_ops import mpi_threads_supported
+from horovod.tensorflow.mpi_ops import metrics
+from horovod.tensorflow.mpi_ops import replay
 from horovod.tensorflow.util import _executing_eagerly
 
+import collections
+
 import tensorflow as tf
 
+# Types which Horovod can scale while they are allreduced.
+_SCALED_DTYPES = (tf.float16, tf.float32, tf.float64)
+
+
 def allreduce(tensor, average=True, device_dense='', device_sparse='',
               compression=Compression.none):
     """Perform an allreduce on a tf.Tensor or tf.IndexedSlices.
 
     This function performs a bandwidth-optimal ring allreduce on the input
-    tensor. If the input is an tf.IndexedSlices, the function instead does an
-    allgather on the values and the indices, effectively doing an allreduce on
-    the represented tensor.
+    tensor. If the input is an tf.IndexedSlices, the function instead gathers
+    the values and the indices in a single sparse allreduce on the CPU,
+    effectively doing an allreduce on the represented tensor.
 
     Arguments:
         tensor: tf.Tensor, tf.Variable, or tf.IndexedSlices to reduce.
@@ -59,8 +70,8 @@ def allreduce(tensor, average=True, device_dense='', device_sparse='',
                  Otherwise, computes the sum over all ranks.
         device_dense: Device to be used for dense tensors. Uses GPU by default
                       if Horovod was built with HOROVOD_GPU_ALLREDUCE.
-        device_sparse: Device to be used for sparse tensors. Uses GPU by default
-                       if Horovod was built with HOROVOD_GPU_ALLGATHER.
+        device_sparse: Device to be used for averaging sparse tensors. The
+                       sparse allreduce itself always runs on the CPU.
         compression: Compression algorithm used to reduce the amount of data
                      sent and received by each worker node.  Defaults to not
                      using compression.
@@ -70,11 +81,12 @@ def allreduce(tensor, average=True, device_dense='', device_sparse='',
         processes.
     """
     if isinstance(tensor, tf.IndexedSlices):
+        with tf.device('/cpu:0'):
+            # For IndexedSlices, gather the values and indices in a single
+            # sparse allreduce instead of an allreduce.
+            values, indices = sparse_allreduce(tensor.values, tensor.indices)
         with tf.device(device_sparse):
-            # For IndexedSlices, do two allgathers instead of an allreduce.
             horovod_size = tf.cast(size(), tensor.values.dtype)
-            values = allgather(tensor.values)
-            indices = allgather(tensor.indices)
 
             # To make this operation into an average, divide allgathered values by
             # the Horovod size.
@@ -83,13 +95,66 @@ def allreduce(tensor, average=True, device_dense='', device_sparse='',
                                 dense_shape=tensor.dense_shape)
     else:
         with tf.device(device_dense):
-            horovod_size = tf.cast(size(), dtype=tensor.dtype)
             tensor_compressed, ctx = compression.compress(tensor)
-            summed_tensor_compressed = _allreduce(tensor_compressed)
+            # Horovod averages float16, float32 and float64 data while it is
+            # copied out of the fusion buffer.
+            scale = average and tensor_compressed.dtype in _SCALED_DTYPES
+            summed_tensor_compressed = _allreduce(
+                tensor_compressed, compression=compression.core_compression,
+                postscale_factor=1.0 / size() if scale else 1.0)
             summed_tensor = compression.decompress(summed_tensor_compressed, ctx)
-            new_tensor = (tf.div(summed_tensor, horovod_size)
-                          if average else summed_tensor)
-        return new_tensor
+            if average and not scale:
+                horovod_size = tf.cast(size(), dtype=summed_tensor.dtype)
+                summed_tensor = tf.div(summed_tensor, horovod_size)
+        return summed_tensor
+
+
+def grouped_allreduce(tensors, average=True, device_dense='',
+                      compression=Compression.none):
+    """Perform an allreduce on a list of tf.Tensors in a single call.
+
+    The tensors of every type are enqueued at once by a single op and fused
+    with each other, which saves the per-tensor overhead of many separate
+    allreduces.
+
+    Arguments:
+        tensors: List of tf.Tensors or tf.Variables to reduce. The number of
+                 tensors and their shapes must be identical across all ranks.
+        average: If True, computes the average over all ranks.
+                 Otherwise, computes the sum over all ranks.
+        device_dense: Device to be used for the tensors. Uses GPU by default
+                      if Horovod was built with HOROVOD_GPU_ALLREDUCE.
+        compression: Compression algorithm used to reduce the amount of data
+                     sent and received by each worker node.  Defaults to not
+                     using compression.
+
+    Returns:
+        A list of tensors of the same shapes and types as `tensors`, summed
+        or averaged across all processes.
+    """
+    results = [None] * len(tensors)
+    with tf.device(device_dense):
+        compressed = [compression.compress(tensor) for tensor in tensors]
+        # All tensors of an op have the same type, so there is a group for
+        # every type.
+        groups = collections.OrderedDict()
+        for i, (tensor_compressed, _) in enumerate(compressed):
+            groups.setdefault(tensor_compressed.dtype, []).append(i)
+        for dtype, indices in groups.items():
+            scale = average and dtype in _SCALED_DTYPES
+            summed_tensors_compressed = _grouped_allreduce(
+                [compressed[i][0] for i in indices],
+                compression=compression.core_compression,
+                postscale_factor=1.0 / size() if scale else 1.0)
+            for i, summed_tensor_compressed in zip(indices,
+                                                   summed_tensors_compressed):
+                summed_tensor = compression.decompress(
+                    summed_tensor_compressed, compressed[i][1])
+                if average and not scale:
+                    horovod_size = tf.cast(size(), dtype=summed_tensor.dtype)
+                    summed_tensor = tf.div(summed_tensor, horovod_size)
+                results[i] = summed_tensor
+    return results
 
 
 def broadcast_global_variables(root_rank):
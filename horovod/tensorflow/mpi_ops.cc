@@ -14,7 +14,9 @@
 // limitations under the License.
 // =============================================================================
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <thread>
 #include <unordered_map>
@@ -26,7 +28,11 @@
 #define EIGEN_USE_THREADS
 
 #if HAVE_CUDA
+#include <cuda_runtime.h>
+
+#include "tensorflow/core/public/version.h"
 #include "tensorflow/stream_executor/stream.h"
+#include "tensorflow/stream_executor/stream_executor_internal.h"
 #endif
 
 #define OMPI_SKIP_MPICXX
@@ -77,12 +83,27 @@ common::Status ConvertStatus(const Status& status) {
 #if HAVE_CUDA
 class TFReadyEvent : public common::ReadyEvent {
 public:
-  TFReadyEvent(DeviceContext* device_context);
+  TFReadyEvent(DeviceContext* device_context, int device);
+  ~TFReadyEvent();
   bool Ready() const override;
+  cudaEvent_t CudaEvent() const override;
 
 private:
+  int device_;
+  // CUDA event recorded on the stream of the op, or nullptr if it could not
+  // be recorded, in which case the StreamExecutor event is used instead.
+  cudaEvent_t cuda_event_ = nullptr;
   std::shared_ptr<perftools::gputools::Event> event_;
 };
+
+// CUDA events of destroyed ready events by device, which are recorded again
+// by later ops instead of creating a new event for every op.
+struct ReadyEventRegistry {
+  std::unordered_map<int, std::queue<cudaEvent_t>> cuda_events;
+  std::mutex mutex;
+};
+
+static ReadyEventRegistry ready_event_registry;
 #endif
 
 class TFPersistentBuffer : public common::PersistentBuffer {
@@ -115,6 +136,9 @@ public:
   virtual common::Status
   AllocateOutput(common::TensorShape shape,
                  std::shared_ptr<common::Tensor>* tensor) override;
+  virtual common::Status
+  AllocateOutput(int output_index, common::TensorShape shape,
+                 std::shared_ptr<common::Tensor>* tensor) override;
   virtual common::Framework framework() const override;
   OpKernelContext* GetKernelContext() const;
 
@@ -123,18 +147,66 @@ private:
 };
 
 #if HAVE_CUDA
-TFReadyEvent::TFReadyEvent(DeviceContext* device_context) {
-  auto executor = device_context->stream()->parent();
+TFReadyEvent::TFReadyEvent(DeviceContext* device_context, int device)
+    : device_(device) {
+  auto stream = device_context->stream();
+#if TF_MAJOR_VERSION > 1 || (TF_MAJOR_VERSION == 1 && TF_MINOR_VERSION >= 13)
+  auto cuda_stream = (cudaStream_t)stream->implementation()->GpuStreamHack();
+#else
+  auto cuda_stream = (cudaStream_t)stream->implementation()->CudaStreamHack();
+#endif
+
+  // The event must be created on the device of the stream.
+  int restore_device;
+  if (cudaGetDevice(&restore_device) == cudaSuccess &&
+      cudaSetDevice(device) == cudaSuccess) {
+    {
+      std::lock_guard<std::mutex> guard(ready_event_registry.mutex);
+      auto& queue = ready_event_registry.cuda_events[device_];
+      if (!queue.empty()) {
+        cuda_event_ = queue.front();
+        queue.pop();
+      }
+    }
+    if (cuda_event_ == nullptr &&
+        cudaEventCreateWithFlags(&cuda_event_, cudaEventDisableTiming) !=
+            cudaSuccess) {
+      cuda_event_ = nullptr;
+    }
+    if (cuda_event_ != nullptr &&
+        cudaEventRecord(cuda_event_, cuda_stream) != cudaSuccess) {
+      cudaEventDestroy(cuda_event_);
+      cuda_event_ = nullptr;
+    }
+    cudaSetDevice(restore_device);
+  }
+  if (cuda_event_ != nullptr) {
+    return;
+  }
+
+  auto executor = stream->parent();
   auto ready_event = new perftools::gputools::Event(executor);
   ready_event->Init();
-  device_context->stream()->ThenRecordEvent(ready_event);
+  stream->ThenRecordEvent(ready_event);
   event_ = std::shared_ptr<perftools::gputools::Event>(ready_event);
 }
 
+TFReadyEvent::~TFReadyEvent() {
+  if (cuda_event_ != nullptr) {
+    std::lock_guard<std::mutex> guard(ready_event_registry.mutex);
+    ready_event_registry.cuda_events[device_].push(cuda_event_);
+  }
+}
+
 bool TFReadyEvent::Ready() const {
+  if (cuda_event_ != nullptr) {
+    return cudaEventQuery(cuda_event_) != cudaErrorNotReady;
+  }
   return event_->PollForStatus() !=
          perftools::gputools::Event::Status::kPending;
 }
+
+cudaEvent_t TFReadyEvent::CudaEvent() const { return cuda_event_; }
 #endif
 
 TFPersistentBuffer::TFPersistentBuffer(OpKernelContext* context, int64_t size) {
@@ -192,6 +264,8 @@ const common::MPIDataType TFTensor::dtype() const {
     return common::HOROVOD_FLOAT64;
   case DT_BOOL:
     return common::HOROVOD_BOOL;
+  case DT_BFLOAT16:
+    return common::HOROVOD_BFLOAT16;
   default:
     throw std::logic_error("Invalid tensor type.");
   }
@@ -224,12 +298,18 @@ common::Status TFOpContext::AllocatePersistent(
 common::Status
 TFOpContext::AllocateOutput(common::TensorShape shape,
                             std::shared_ptr<common::Tensor>* tensor) {
+  return AllocateOutput(0, shape, tensor);
+}
+
+common::Status
+TFOpContext::AllocateOutput(int output_index, common::TensorShape shape,
+                            std::shared_ptr<common::Tensor>* tensor) {
   TensorShape tf_shape;
   for (int idx = 0; idx < shape.dims(); ++idx) {
     tf_shape.AddDim(shape.dim_size(idx));
   }
   Tensor* tf_tensor;
-  Status status = context_->allocate_output(0, tf_shape, &tf_tensor);
+  Status status = context_->allocate_output(output_index, tf_shape, &tf_tensor);
   if (status.ok()) {
     *tensor = std::make_shared<TFTensor>(*tf_tensor);
   }
@@ -265,7 +345,7 @@ common::ReadyEvent* RecordReadyEvent(OpKernelContext* context) {
 #if HAVE_CUDA
   auto device_context = context->op_device_context();
   if (device_context != nullptr) {
-    return new TFReadyEvent(device_context);
+    return new TFReadyEvent(device_context, GetDeviceID(context));
   }
 #endif
   return nullptr;
@@ -276,7 +356,13 @@ common::ReadyEvent* RecordReadyEvent(OpKernelContext* context) {
 class HorovodAllreduceOp : public AsyncOpKernel {
 public:
   explicit HorovodAllreduceOp(OpKernelConstruction* context)
-      : AsyncOpKernel(context) {}
+      : AsyncOpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("compression", &compression_));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("prescale_factor", &prescale_factor_));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("postscale_factor", &postscale_factor_));
+  }
 
   void ComputeAsync(OpKernelContext* context, DoneCallback done) override {
     OP_REQUIRES_OK_ASYNC(context, ConvertStatus(common::CheckInitialized()),
@@ -284,10 +370,15 @@ public:
 
     auto node_name = name();
     auto device = GetDeviceID(context);
-    auto tensor = context->input(0);
+    // The sum is written over the input if no other op uses its buffer, which
+    // saves allocating and copying a second tensor of the same size. The input
+    // is only copied afterwards, since the copy would share the buffer.
     Tensor* output;
-    OP_REQUIRES_OK_ASYNC(
-        context, context->allocate_output(0, tensor.shape(), &output), done);
+    OP_REQUIRES_OK_ASYNC(context,
+                         context->forward_input_or_allocate_output(
+                             {0}, 0, context->input(0).shape(), &output),
+                         done);
+    auto tensor = context->input(0);
     // ReadyEvent makes sure input tensor is ready, and output is allocated.
     auto ready_event = std::shared_ptr<common::ReadyEvent>(RecordReadyEvent(context));
     auto hvd_context = std::make_shared<TFOpContext>(context);
@@ -298,9 +389,16 @@ public:
         [context, done](const common::Status& status) {
           context->SetStatus(ConvertStatus(status));
           done();
-        });
+        },
+        (common::Compression)compression_, prescale_factor_,
+        postscale_factor_);
     OP_REQUIRES_OK_ASYNC(context, ConvertStatus(enqueue_result), done);
   }
+
+private:
+  int compression_;
+  float prescale_factor_;
+  float postscale_factor_;
 };
 
 REGISTER_KERNEL_BUILDER(Name("HorovodAllreduce").Device(DEVICE_CPU),
@@ -311,7 +409,10 @@ REGISTER_KERNEL_BUILDER(Name("HorovodAllreduce").Device(DEVICE_GPU),
 #endif
 
 REGISTER_OP("HorovodAllreduce")
-    .Attr("T: {int32, int64, float16, float32, float64}")
+    .Attr("T: {int32, int64, float16, float32, float64, bfloat16}")
+    .Attr("compression: int = 0")
+    .Attr("prescale_factor: float = 1.0")
+    .Attr("postscale_factor: float = 1.0")
     .Input("tensor: T")
     .Output("sum: T")
     .SetShapeFn([](shape_inference::InferenceContext* c) {
@@ -326,11 +427,120 @@ allreduce.
 
 Arguments
     tensor:     A tensor to reduce.
+    compression: Compression applied by Horovod to float32 data while it is
+                 reduced, 0 for none and 1 for float16.
+    prescale_factor: Factor the tensor is multiplied by before the reduction.
+    postscale_factor: Factor the sum is multiplied by after the reduction.
 
 Output
     sum:    A tensor with the same shape as `tensor`, summed across all MPI processes.
 )doc");
 
+class HorovodGroupedAllreduceOp : public AsyncOpKernel {
+public:
+  explicit HorovodGroupedAllreduceOp(OpKernelConstruction* context)
+      : AsyncOpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("num_tensors", &num_tensors_));
+    OP_REQUIRES_OK(context, context->GetAttr("compression", &compression_));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("prescale_factor", &prescale_factor_));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("postscale_factor", &postscale_factor_));
+  }
+
+  void ComputeAsync(OpKernelContext* context, DoneCallback done) override {
+    OP_REQUIRES_OK_ASYNC(context, ConvertStatus(common::CheckInitialized()),
+                         done);
+
+    auto node_name = name();
+    auto device = GetDeviceID(context);
+    std::vector<std::shared_ptr<common::OpContext>> hvd_contexts;
+    std::vector<std::shared_ptr<common::Tensor>> hvd_tensors;
+    std::vector<std::shared_ptr<common::Tensor>> hvd_outputs;
+    std::vector<std::string> names;
+    for (int i = 0; i < num_tensors_; ++i) {
+      Tensor* output;
+      OP_REQUIRES_OK_ASYNC(context,
+                           context->forward_input_or_allocate_output(
+                               {i}, i, context->input(i).shape(), &output),
+                           done);
+      auto tensor = context->input(i);
+      hvd_tensors.push_back(std::make_shared<TFTensor>(tensor));
+      hvd_outputs.push_back(std::make_shared<TFTensor>(*output));
+      names.push_back(node_name + "_" + std::to_string(i));
+    }
+    // All inputs are ready and all outputs are allocated at this point, so
+    // the tensors share one context and ready event.
+    auto ready_event =
+        std::shared_ptr<common::ReadyEvent>(RecordReadyEvent(context));
+    auto hvd_context = std::make_shared<TFOpContext>(context);
+    hvd_contexts.assign(num_tensors_, hvd_context);
+    std::vector<std::shared_ptr<common::ReadyEvent>> ready_events(
+        num_tensors_, ready_event);
+
+    // The op is done once the callbacks of all tensors were called.
+    auto remaining = std::make_shared<std::atomic_int>(num_tensors_);
+    std::vector<common::StatusCallback> callbacks(
+        num_tensors_, [context, done, remaining](const common::Status& status) {
+          if (!status.ok()) {
+            context->SetStatus(ConvertStatus(status));
+          }
+          if (--*remaining == 0) {
+            done();
+          }
+        });
+    auto enqueue_result = EnqueueTensorAllreduces(
+        hvd_contexts, hvd_tensors, hvd_outputs, ready_events, names, device,
+        callbacks, (common::Compression)compression_, prescale_factor_,
+        postscale_factor_);
+    OP_REQUIRES_OK_ASYNC(context, ConvertStatus(enqueue_result), done);
+  }
+
+private:
+  int num_tensors_;
+  int compression_;
+  float prescale_factor_;
+  float postscale_factor_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("HorovodGroupedAllreduce").Device(DEVICE_CPU),
+                        HorovodGroupedAllreduceOp);
+#if HOROVOD_GPU_ALLREDUCE
+REGISTER_KERNEL_BUILDER(Name("HorovodGroupedAllreduce").Device(DEVICE_GPU),
+                        HorovodGroupedAllreduceOp);
+#endif
+
+REGISTER_OP("HorovodGroupedAllreduce")
+    .Attr("T: {int32, int64, float16, float32, float64, bfloat16}")
+    .Attr("num_tensors: int >= 1")
+    .Attr("compression: int = 0")
+    .Attr("prescale_factor: float = 1.0")
+    .Attr("postscale_factor: float = 1.0")
+    .Input("tensors: num_tensors * T")
+    .Output("sum: num_tensors * T")
+    .SetShapeFn([](shape_inference::InferenceContext* c) {
+      for (int i = 0; i < c->num_inputs(); ++i) {
+        c->set_output(i, c->input(i));
+      }
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Perform an MPI Allreduce on a group of tensors, which are enqueued at once and
+fused with each other. All other processes that do a grouped reduction with the
+same name must have the same number of tensors with the same dimensions.
+
+Arguments
+    tensors:     The tensors to reduce.
+    compression: Compression applied by Horovod to float32 data while it is
+                 reduced, 0 for none and 1 for float16.
+    prescale_factor: Factor the tensors are multiplied by before the reduction.
+    postscale_factor: Factor the sums are multiplied by after the reduction.
+
+Output
+    sum:    Tensors with the same shapes as `tensors`, summed across all MPI
+            processes.
+)doc");
+
 class HorovodAllgatherOp : public AsyncOpKernel {
 public:
   explicit HorovodAllgatherOp(OpKernelConstruction* context)
@@ -368,7 +578,8 @@ REGISTER_KERNEL_BUILDER(Name("HorovodAllgather").Device(DEVICE_GPU),
 
 REGISTER_OP("HorovodAllgather")
     .Attr(
-        "T: {uint8, int8, uint16, int16, int32, int64, float16, float32, float64, bool}")
+        "T: {uint8, int8, uint16, int16, int32, int64, float16, float32, float64, "
+        "bool, bfloat16}")
     .Input("tensor: T")
     .Output("output: T")
     .SetShapeFn([](shape_inference::InferenceContext* c) {
@@ -403,14 +614,18 @@ public:
 
     auto node_name = name();
     auto device = GetDeviceID(context);
-    auto tensor = context->input(0);
     Tensor* output = nullptr;
     if (common::horovod_rank() == root_rank_) {
-      context->set_output(0, tensor);
+      context->set_output(0, context->input(0));
     } else {
-      OP_REQUIRES_OK_ASYNC(
-          context, context->allocate_output(0, tensor.shape(), &output), done);
+      // The other ranks receive the data into the input if no other op uses
+      // its buffer.
+      OP_REQUIRES_OK_ASYNC(context,
+                           context->forward_input_or_allocate_output(
+                               {0}, 0, context->input(0).shape(), &output),
+                           done);
     }
+    auto tensor = context->input(0);
     // ReadyEvent makes sure input tensor is ready, and output is allocated.
     auto ready_event = std::shared_ptr<common::ReadyEvent>(RecordReadyEvent(context));
     auto hvd_context = std::make_shared<TFOpContext>(context);
@@ -441,7 +656,8 @@ REGISTER_KERNEL_BUILDER(Name("HorovodBroadcast").Device(DEVICE_GPU),
 
 REGISTER_OP("HorovodBroadcast")
     .Attr(
-        "T: {uint8, int8, uint16, int16, int32, int64, float16, float32, float64, bool}")
+        "T: {uint8, int8, uint16, int16, int32, int64, float16, float32, float64, "
+        "bool, bfloat16}")
     .Attr("root_rank: int")
     .Input("tensor: T")
     .Output("output: T")
@@ -462,5 +678,206 @@ Output
                `tensor` on root rank.
 )doc");
 
+class HorovodSparseAllreduceOp : public AsyncOpKernel {
+public:
+  explicit HorovodSparseAllreduceOp(OpKernelConstruction* context)
+      : AsyncOpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("deduplicate", &deduplicate_));
+  }
+
+  void ComputeAsync(OpKernelContext* context, DoneCallback done) override {
+    OP_REQUIRES_OK_ASYNC(context, ConvertStatus(common::CheckInitialized()),
+                         done);
+
+    auto node_name = name();
+    auto device = GetDeviceID(context);
+    auto values = context->input(0);
+    auto indices = context->input(1);
+    // Like allgather, the outputs can only be allocated once the number of
+    // rows of all ranks is known.
+    auto ready_event =
+        std::shared_ptr<common::ReadyEvent>(RecordReadyEvent(context));
+    auto hvd_context = std::make_shared<TFOpContext>(context);
+    auto hvd_values = std::make_shared<TFTensor>(values);
+    auto hvd_indices = std::make_shared<TFTensor>(indices);
+    auto enqueue_result = EnqueueTensorSparseAllreduce(
+        hvd_context, hvd_values, hvd_indices, ready_event, node_name, device,
+        deduplicate_, [context, done](const common::Status& status) {
+          context->SetStatus(ConvertStatus(status));
+          done();
+        });
+    OP_REQUIRES_OK_ASYNC(context, ConvertStatus(enqueue_result), done);
+  }
+
+private:
+  bool deduplicate_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("HorovodSparseAllreduce").Device(DEVICE_CPU),
+                        HorovodSparseAllreduceOp);
+
+REGISTER_OP("HorovodSparseAllreduce")
+    .Attr(
+        "T: {uint8, int8, uint16, int16, int32, int64, float16, float32, float64, "
+        "bfloat16}")
+    .Attr("deduplicate: bool = false")
+    .Input("values: T")
+    .Input("indices: int64")
+    .Output("output_values: T")
+    .Output("output_indices: int64")
+    .SetShapeFn([](shape_inference::InferenceContext* c) {
+      shape_inference::ShapeHandle values;
+      TF_RETURN_IF_ERROR(
+          c->ReplaceDim(c->input(0), 0, c->UnknownDim(), &values));
+      c->set_output(0, values);
+      c->set_output(1, c->Vector(c->UnknownDim()));
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Perform a sparse MPI Allreduce on the rows of a tensor given by their indices.
+The rows and indices of all processes are gathered in a single operation. All
+other processes that do a sparse allreduce on a tensor with the same name must
+have the same dimension on all but the first dimension.
+
+Arguments
+    values:       A tensor with the rows to reduce.
+    indices:      A vector with the index of every row of `values`.
+    deduplicate:  Whether to sum up rows with the same index.
+
+Output
+    output_values:   The rows of all processes, or their sums by index if
+                     `deduplicate` is set.
+    output_indices:  The index of every row of `output_values`.
+)doc");
+
+class HorovodReducescatterOp : public AsyncOpKernel {
+public:
+  explicit HorovodReducescatterOp(OpKernelConstruction* context)
+      : AsyncOpKernel(context) {}
+
+  void ComputeAsync(OpKernelContext* context, DoneCallback done) override {
+    OP_REQUIRES_OK_ASYNC(context, ConvertStatus(common::CheckInitialized()),
+                         done);
+
+    auto node_name = name();
+    auto device = GetDeviceID(context);
+    auto tensor = context->input(0);
+    // The output is allocated once the tensor is known to have the same shape
+    // on all ranks.
+    auto ready_event =
+        std::shared_ptr<common::ReadyEvent>(RecordReadyEvent(context));
+    auto hvd_context = std::make_shared<TFOpContext>(context);
+    auto hvd_tensor = std::make_shared<TFTensor>(tensor);
+    auto enqueue_result = EnqueueTensorReducescatter(
+        hvd_context, hvd_tensor, ready_event, node_name, device,
+        [context, done](const common::Status& status) {
+          context->SetStatus(ConvertStatus(status));
+          done();
+        });
+    OP_REQUIRES_OK_ASYNC(context, ConvertStatus(enqueue_result), done);
+  }
+};
+
+REGISTER_KERNEL_BUILDER(Name("HorovodReducescatter").Device(DEVICE_CPU),
+                        HorovodReducescatterOp);
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+REGISTER_KERNEL_BUILDER(Name("HorovodReducescatter").Device(DEVICE_GPU),
+                        HorovodReducescatterOp);
+#endif
+
+REGISTER_OP("HorovodReducescatter")
+    .Attr("T: {int32, int64, float16, float32, float64, bfloat16}")
+    .Input("tensor: T")
+    .Output("output: T")
+    .SetShapeFn([](shape_inference::InferenceContext* c) {
+      shape_inference::ShapeHandle output;
+      TF_RETURN_IF_ERROR(
+          c->ReplaceDim(c->input(0), 0, c->UnknownDim(), &output));
+      c->set_output(0, output);
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Perform an MPI Reduce-Scatter on a tensor. The tensor is summed across all
+processes and every process receives its part of the sum along the first
+dimension, the first processes getting one more row if it can't be split up
+evenly. All other processes that do a reduce-scatter on a tensor with the same
+name must have the same shape for that tensor.
+
+Arguments
+    tensor:     A tensor to reduce.
+
+Output
+    output:    The rows of the sum that belong to this process.
+)doc");
+
+class HorovodAlltoallOp : public AsyncOpKernel {
+public:
+  explicit HorovodAlltoallOp(OpKernelConstruction* context)
+      : AsyncOpKernel(context) {}
+
+  void ComputeAsync(OpKernelContext* context, DoneCallback done) override {
+    OP_REQUIRES_OK_ASYNC(context, ConvertStatus(common::CheckInitialized()),
+                         done);
+
+    auto node_name = name();
+    auto device = GetDeviceID(context);
+    auto tensor = context->input(0);
+    auto splits_tensor = context->input(1);
+    auto splits_flat = splits_tensor.flat<int32>();
+    std::vector<int32_t> splits(splits_flat.data(),
+                                splits_flat.data() + splits_flat.size());
+    // The number of rows of the output is only known once the splits of all
+    // ranks are exchanged.
+    auto ready_event =
+        std::shared_ptr<common::ReadyEvent>(RecordReadyEvent(context));
+    auto hvd_context = std::make_shared<TFOpContext>(context);
+    auto hvd_tensor = std::make_shared<TFTensor>(tensor);
+    auto enqueue_result = EnqueueTensorAlltoall(
+        hvd_context, hvd_tensor, std::move(splits), ready_event, node_name,
+        device, [context, done](const common::Status& status) {
+          context->SetStatus(ConvertStatus(status));
+          done();
+        });
+    OP_REQUIRES_OK_ASYNC(context, ConvertStatus(enqueue_result), done);
+  }
+};
+
+REGISTER_KERNEL_BUILDER(Name("HorovodAlltoall").Device(DEVICE_CPU),
+                        HorovodAlltoallOp);
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+REGISTER_KERNEL_BUILDER(
+    Name("HorovodAlltoall").Device(DEVICE_GPU).HostMemory("splits"),
+    HorovodAlltoallOp);
+#endif
+
+REGISTER_OP("HorovodAlltoall")
+    .Attr(
+        "T: {uint8, int8, uint16, int16, int32, int64, float16, float32, float64, "
+        "bool, bfloat16}")
+    .Input("tensor: T")
+    .Input("splits: int32")
+    .Output("output: T")
+    .SetShapeFn([](shape_inference::InferenceContext* c) {
+      shape_inference::ShapeHandle output;
+      TF_RETURN_IF_ERROR(
+          c->ReplaceDim(c->input(0), 0, c->UnknownDim(), &output));
+      c->set_output(0, output);
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Perform an MPI Alltoall on a tensor. The rows of the tensor are sent to all
+processes in order, and the rows received from all processes are concatenated in
+order. All other processes that do an alltoall on a tensor with the same name
+must have the same dimension on all but the first dimension.
+
+Arguments
+    tensor:     A tensor to distribute.
+    splits:     A vector with the number of rows sent to every process, or an
+                empty vector to split up the rows evenly.
+
+Output
+    output:    The rows received from all processes.
+)doc");
+
 } // namespace tensorflow
 } // namespace horovod
@@ -68,6 +68,8 @@ local_size = _basics.local_size
 rank = _basics.rank
 local_rank = _basics.local_rank
 mpi_threads_supported = _basics.mpi_threads_supported
+metrics = _basics.metrics
+replay = _basics.replay
 
 
 def _normalize_name(name):
@@ -75,20 +77,31 @@ def _normalize_name(name):
     return re.sub('[^a-zA-Z0-9_]', '_', name)
 
 
-def _allreduce(tensor, name=None):
+def _allreduce(tensor, name=None, compression=0, prescale_factor=1.0,
+               postscale_factor=1.0):
     """An op which sums an input tensor over all the Horovod processes.
 
     The reduction operation is keyed by the name of the op. The tensor type and
     shape must be the same on all Horovod processes for a given name. The reduction
     will not start until all processes are ready to send and receive the tensor.
 
+    `compression` selects the compression Horovod applies to float32 data inside
+    the fusion buffer, 0 for none and 1 for float16. It must be the same on all
+    Horovod processes for a given name.
+
+    Floating point tensors are multiplied by `prescale_factor` before and the
+    sum by `postscale_factor` after the reduction, while Horovod copies them
+    into and out of the fusion buffer.
+
     Returns:
       A tensor of the same shape and type as `tensor`, summed across all
       processes.
     """
     if name is None and not _executing_eagerly():
         name = 'HorovodAllreduce_%s' % _normalize_name(tensor.name)
-    return MPI_LIB.horovod_allreduce(tensor, name=name)
+    return MPI_LIB.horovod_allreduce(tensor, name=name, compression=compression,
+                                     prescale_factor=prescale_factor,
+                                     postscale_factor=postscale_factor)
 
 
 @ops.RegisterGradient('HorovodAllreduce')
@@ -102,7 +115,48 @@ def _allreduce_grad(op, grad):
     Returns:
       The gradient with respect to the input of the op.
     """
-    return _allreduce(grad)
+    return _allreduce(grad, compression=op.get_attr('compression'),
+                      prescale_factor=op.get_attr('prescale_factor'),
+                      postscale_factor=op.get_attr('postscale_factor'))
+
+
+def _grouped_allreduce(tensors, name=None, compression=0, prescale_factor=1.0,
+                       postscale_factor=1.0):
+    """An op which sums a group of input tensors of the same type over all the
+    Horovod processes.
+
+    The tensors are enqueued at once and only fused with each other. The
+    number of tensors, their types and shapes must be the same on all Horovod
+    processes for a given name. Floating point tensors are scaled like in
+    `_allreduce`.
+
+    Returns:
+      A list of tensors of the same shapes and type as `tensors`, summed
+      across all processes.
+    """
+    if name is None and not _executing_eagerly():
+        name = 'HorovodGroupedAllreduce_%s' % _normalize_name(tensors[0].name)
+    return MPI_LIB.horovod_grouped_allreduce(tensors, name=name,
+                                             compression=compression,
+                                             prescale_factor=prescale_factor,
+                                             postscale_factor=postscale_factor)
+
+
+@ops.RegisterGradient('HorovodGroupedAllreduce')
+def _grouped_allreduce_grad(op, *grads):
+    """Gradient for grouped allreduce op.
+
+    Args:
+      op: An operation.
+      grads: `Tensor` gradients with respect to the outputs of the op.
+
+    Returns:
+      The gradients with respect to the inputs of the op.
+    """
+    return _grouped_allreduce(list(grads),
+                              compression=op.get_attr('compression'),
+                              prescale_factor=op.get_attr('prescale_factor'),
+                              postscale_factor=op.get_attr('postscale_factor'))
 
 
 def allgather(tensor, name=None):
@@ -148,6 +202,111 @@ def _allgather_grad(op, grad):
     return splits[rank()]
 
 
+def sparse_allreduce(values, indices, deduplicate=False, name=None):
+    """An op which sums the rows of a sparse tensor, given as the rows `values`
+    and their `indices` along the first dimension, over all the Horovod processes.
+
+    The rows and indices of all processes are gathered in a single operation
+    instead of densifying the tensor. The input values on the different
+    processes must have the same rank and shape, except for the first dimension.
+    The op runs on the CPU.
+
+    Arguments:
+        values: Tensor with the rows of the sparse tensor.
+        indices: Vector with the index of every row of `values`.
+        deduplicate: If True, rows with the same index are summed up into a
+                     single row. Otherwise the rows of all processes are kept.
+
+    Returns:
+      A tuple of the summed rows and their int64 indices. Without
+      deduplication these are the rows and indices of all processes in rank
+      order, otherwise every index occurs once in the order in which it first
+      occurs.
+    """
+    if name is None and not _executing_eagerly():
+        name = 'HorovodSparseAllreduce_%s' % _normalize_name(values.name)
+    indices = tf.cast(indices, tf.int64)
+    return MPI_LIB.horovod_sparse_allreduce(values, indices, name=name,
+                                            deduplicate=deduplicate)
+
+
+def reducescatter(tensor, name=None):
+    """An op which sums the input tensor over all the Horovod processes and
+    scatters the sum along the first dimension.
+
+    The tensor type and shape must be the same on all Horovod processes for a
+    given name. The rows of the sum are split up among the processes in rank
+    order, the first processes getting one more row if the first dimension
+    can't be split up evenly.
+
+    Returns:
+      A tensor of the same type as `tensor` with the rows of the sum that
+      belong to this process.
+    """
+    if name is None and not _executing_eagerly():
+        name = 'HorovodReducescatter_%s' % _normalize_name(tensor.name)
+    return MPI_LIB.horovod_reducescatter(tensor, name=name)
+
+
+@ops.RegisterGradient('HorovodReducescatter')
+def _reducescatter_grad(op, grad):
+    """Gradient for reducescatter op.
+
+    Args:
+      op: An operation.
+      grad: `Tensor` gradient with respect to the output of the op.
+
+    Returns:
+      The gradient with respect to the input of the op.
+    """
+    return allgather(grad)
+
+
+def alltoall(tensor, splits=None, name=None):
+    """An op which sends the rows of the input tensor to all the Horovod
+    processes and concatenates the rows received from them.
+
+    `splits[r]` rows of `tensor` are sent to process `r` in rank order. If
+    `splits` is None, the first dimension must be divisible by the number of
+    processes and the rows are split up evenly. The input tensors on the
+    different processes must have the same rank and shape, except for the
+    first dimension.
+
+    Returns:
+      A tensor of the same type as `tensor` with the rows received from all
+      processes, concatenated on dimension zero in rank order.
+    """
+    if name is None and not _executing_eagerly():
+        name = 'HorovodAlltoall_%s' % _normalize_name(tensor.name)
+    if splits is None:
+        splits = tf.zeros([0], dtype=tf.int32)
+    else:
+        splits = tf.cast(splits, tf.int32)
+    return MPI_LIB.horovod_alltoall(tensor, splits, name=name)
+
+
+@ops.RegisterGradient('HorovodAlltoall')
+def _alltoall_grad(op, grad):
+    """Gradient for alltoall op.
+
+    Args:
+      op: An operation.
+      grad: `Tensor` gradient with respect to the output of the op.
+
+    Returns:
+      The gradient with respect to the inputs of the op.
+    """
+    splits = op.inputs[1]
+    s = size()
+    d0 = tf.shape(op.inputs[0], out_type=tf.int32)[0]
+    splits = tf.cond(tf.equal(tf.size(splits), 0),
+                     lambda: tf.fill([s], d0 // s),
+                     lambda: splits)
+    # Every process sends back the rows it received from every other process.
+    recv_splits = alltoall(splits)
+    return [alltoall(grad, splits=recv_splits), None]
+
+
 def broadcast(tensor, root_rank, name=None):
     """An op which broadcasts the input tensor on root rank to the same input tensor
     on all other Horovod processes.
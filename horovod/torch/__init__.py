@@ -28,12 +28,21 @@ except:
 
 from horovod.torch.compression import Compression
 from horovod.torch.mpi_ops import allreduce, allreduce_async, allreduce_, allreduce_async_
+from horovod.torch.mpi_ops import _allreduce_async
+from horovod.torch.mpi_ops import grouped_allreduce, grouped_allreduce_async
 from horovod.torch.mpi_ops import allgather, allgather_async
 from horovod.torch.mpi_ops import broadcast, broadcast_async, broadcast_, broadcast_async_
-from horovod.torch.mpi_ops import poll, synchronize
+from horovod.torch.mpi_ops import sparse_allreduce, sparse_allreduce_async
+from horovod.torch.mpi_ops import reducescatter, reducescatter_async
+from horovod.torch.mpi_ops import alltoall, alltoall_async
+from horovod.torch.mpi_ops import poll, synchronize, synchronize_all, wait_any
+from horovod.torch.mpi_ops import mark_step
+from horovod.torch.mpi_ops import ReduceScope
 from horovod.torch.mpi_ops import init, shutdown
 from horovod.torch.mpi_ops import size, local_size, rank, local_rank
 from horovod.torch.mpi_ops import mpi_threads_supported
+from horovod.torch.mpi_ops import metrics
+from horovod.torch.mpi_ops import replay
 
 import torch
 import collections
@@ -41,7 +50,7 @@ import collections
 
 class _DistributedOptimizer(torch.optim.Optimizer):
     def __init__(self, params, named_parameters, compression,
-                 backward_passes_per_step=1):
+                 backward_passes_per_step=1, cross_node_period=1):
         super(self.__class__, self).__init__(params)
         self._compression = compression
 
@@ -68,9 +77,24 @@ class _DistributedOptimizer(torch.optim.Optimizer):
             self._parameter_names = {v: 'allreduce.noname.%s' % i
                                      for param_group in self.param_groups
                                      for i, v in enumerate(param_group['params'])}
+        # Gradients of the first parameters, usually of the front layers, are
+        # needed first by the next forward pass, so they get the highest
+        # priority even though backpropagation produces them last.
+        params = [p for param_group in self.param_groups
+                  for p in param_group['params']]
+        self._priorities = {p: len(params) - i for i, p in enumerate(params)}
         self.backward_passes_per_step = backward_passes_per_step
         self._allreduce_delay = {v: self.backward_passes_per_step
                                  for _, v in sorted(named_parameters)}
+        # With a cross-node period, gradients are only averaged within every
+        # node and the parameters are averaged across nodes after every
+        # cross_node_period-th step.
+        if cross_node_period < 1:
+            raise ValueError('cross_node_period must be at least 1.')
+        self._cross_node_period = cross_node_period
+        self._grad_scope = (ReduceScope.local if cross_node_period > 1
+                            else ReduceScope.world)
+        self._steps = 0
         self._handles = {}
         self._grad_accs = []
         self._requires_update = set()
@@ -108,9 +132,20 @@ class _DistributedOptimizer(torch.optim.Optimizer):
         tensor = p.grad
         tensor_compressed, ctx = self._compression.compress(tensor)
 
-        handle = allreduce_async_(tensor_compressed, average=True, name=name)
+        handle = _allreduce_async(tensor_compressed, tensor_compressed, True, name,
+                                  self._compression.core_compression,
+                                  self._priorities.get(p, 0),
+                                  scope=self._grad_scope)
         return handle, ctx
 
+    def _average_across_nodes(self):
+        handles = []
+        for p in self._requires_update:
+            name = 'cross_node.%s' % self._parameter_names.get(p)
+            handles.append(allreduce_async_(p.data, True, name,
+                                            scope=ReduceScope.cross))
+        synchronize_all(handles)
+
     def _make_hook(self, p):
         def hook(*ignore):
             if p in self._handles and self._handles[p][0] is not None:
@@ -140,20 +175,27 @@ class _DistributedOptimizer(torch.optim.Optimizer):
             if handle is None:
                 handle, ctx = self._allreduce_grad_async(p)
                 self._handles[p] = (handle, ctx)
-        for p, (handle, _) in self._handles.items():
-            output = synchronize(handle)
+        params = list(self._handles.keys())
+        outputs = synchronize_all([self._handles[p][0] for p in params])
+        for p, output in zip(params, outputs):
+            _, ctx = self._handles[p]
             self._allreduce_delay[p] = self.backward_passes_per_step
             p.grad.set_(self._compression.decompress(output, ctx))
         self._handles.clear()
 
     def step(self, closure=None):
         self.synchronize()
-        return super(self.__class__, self).step(closure)
+        loss = super(self.__class__, self).step(closure)
+        if self._cross_node_period > 1 and size() > 1:
+            self._steps += 1
+            if self._steps % self._cross_node_period == 0:
+                self._average_across_nodes()
+        return loss
 
 
 def DistributedOptimizer(optimizer, named_parameters=None,
                          compression=Compression.none,
-                         backward_passes_per_step=1):
+                         backward_passes_per_step=1, cross_node_period=1):
     """
     An optimizer that wraps another torch.optim.Optimizer, using an allreduce to
     average gradient values before applying gradients to model weights.
@@ -188,13 +230,20 @@ def DistributedOptimizer(optimizer, named_parameters=None,
                                   allows accumulating gradients over multiple
                                   mini-batches before executing averaging and
                                   applying them.
+        cross_node_period: Number of steps between averages across nodes. With
+                           a period K > 1, gradients are only averaged within
+                           every node, and the parameters are averaged across
+                           nodes after every Kth step, which needs the same
+                           number of processes on every node. Defaults to
+                           averaging gradients across all processes every
+                           step.
     """
     # We dynamically create a new class that inherits from the optimizer that was passed in.
     # The goal is to override the `step()` method with an allreduce implementation.
     cls = type(optimizer.__class__.__name__, (optimizer.__class__,),
                dict(_DistributedOptimizer.__dict__))
     return cls(optimizer.param_groups, named_parameters,
-               compression, backward_passes_per_step)
+               compression, backward_passes_per_step, cross_node_period)
 
 
 def broadcast_parameters(params, root_rank):
@@ -54,6 +54,10 @@ const MPIDataType TorchTensor::dtype() const {
     return common::HOROVOD_FLOAT32;
   case ::torch::kDouble:
     return common::HOROVOD_FLOAT64;
+#if TORCH_VERSION >= 1003000000
+  case ::torch::kBFloat16:
+    return common::HOROVOD_BFLOAT16;
+#endif
   default:
     throw std::logic_error("Invalid tensor type.");
   }
@@ -74,7 +78,11 @@ int64_t TorchTensor::size() const {
 }
 
 TorchOpContext::TorchOpContext(int device, ::torch::Tensor output)
-    : device_(device), output_(output) {}
+    : device_(device), outputs_({output}) {}
+
+TorchOpContext::TorchOpContext(int device,
+                               std::vector<::torch::Tensor> outputs)
+    : device_(device), outputs_(std::move(outputs)) {}
 
 Status
 TorchOpContext::AllocatePersistent(int64_t size,
@@ -86,14 +94,24 @@ TorchOpContext::AllocatePersistent(int64_t size,
 
 Status TorchOpContext::AllocateOutput(TensorShape shape,
                                       std::shared_ptr<Tensor>* tensor) {
+  return AllocateOutput(0, shape, tensor);
+}
+
+Status TorchOpContext::AllocateOutput(int output_index, TensorShape shape,
+                                      std::shared_ptr<Tensor>* tensor) {
+  if (output_index < 0 || output_index >= (int)outputs_.size()) {
+    return Status::PreconditionError("Invalid output index " +
+                                     std::to_string(output_index) + ".");
+  }
   std::vector<int64_t> shape_vector;
   shape_vector.reserve(shape.dims());
   for (int idx = 0; idx < shape.dims(); ++idx) {
     shape_vector.push_back(shape.dim_size(idx));
   }
   with_device device_context(device_);
-  output_.resize_(shape_vector);
-  *tensor = std::make_shared<TorchTensor>(output_);
+  auto& output = outputs_[output_index];
+  output.resize_(shape_vector);
+  *tensor = std::make_shared<TorchTensor>(output);
   return Status::OK();
 }
 
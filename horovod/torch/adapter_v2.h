@@ -52,16 +52,19 @@ protected:
 class TorchOpContext : public OpContext {
 public:
   TorchOpContext(int device, ::torch::Tensor output);
+  TorchOpContext(int device, std::vector<::torch::Tensor> outputs);
   virtual Status
   AllocatePersistent(int64_t size,
                      std::shared_ptr<PersistentBuffer>* tensor) override;
   virtual Status AllocateOutput(TensorShape shape,
                                 std::shared_ptr<Tensor>* tensor) override;
+  virtual Status AllocateOutput(int output_index, TensorShape shape,
+                                std::shared_ptr<Tensor>* tensor) override;
   virtual Framework framework() const override;
 
 private:
   int device_ = CPU_DEVICE_ID;
-  ::torch::Tensor output_;
+  std::vector<::torch::Tensor> outputs_;
 };
 
 void ThrowIfError(Status status);
@@ -19,6 +19,10 @@ import torch
 
 class Compressor(object):
     """Interface for compressing and decompressing a given tensor."""
+
+    """Compression applied by the Horovod core to the data of the tensor."""
+    core_compression = 0
+
     @staticmethod
     def compress(tensor):
         """Compresses a tensor and returns it with the context needed to decompress it."""
@@ -64,6 +68,47 @@ class FP16Compressor(Compressor):
         return tensor_decompressed
 
 
+class FP16FusedCompressor(Compressor):
+    """Compress float32 gradients to 16-bit inside the Horovod fusion buffer.
+
+    Unlike FP16Compressor, the tensors are cast while they are copied into the
+    fusion buffer, so no extra casts are launched by PyTorch. Tensors larger
+    than the fusion buffer, and GPU tensors reduced without NCCL, are reduced
+    without compression.
+    """
+    core_compression = 1
+
+    @staticmethod
+    def compress(tensor):
+        """Returns the tensor unmodified."""
+        return tensor, None
+
+    @staticmethod
+    def decompress(tensor, ctx):
+        """Returns the tensor unmodified."""
+        return tensor
+
+
+class Int8Compressor(FP16FusedCompressor):
+    """Quantize float32 gradients of CPU tensors to 8 bits.
+
+    Every chunk of 512 values is scaled by its largest absolute value and
+    rounded stochastically. The quantization error of every tensor is kept by
+    Horovod and added to the tensor the next time it is reduced.
+    """
+    core_compression = 2
+
+
+class OneBitCompressor(FP16FusedCompressor):
+    """Quantize float32 gradients of CPU tensors to their signs.
+
+    Every chunk of 512 values is sent as its signs and the mean of its absolute
+    values. The quantization error of every tensor is kept by Horovod and added
+    to the tensor the next time it is reduced.
+    """
+    core_compression = 3
+
+
 class Compression(object):
     """Optional gradient compression algorithm used during allreduce."""
 
@@ -72,3 +117,12 @@ class Compression(object):
 
     """Compress all floating point gradients to 16-bit."""
     fp16 = FP16Compressor
+
+    """Compress float32 gradients to 16-bit inside the Horovod fusion buffer."""
+    fp16_fused = FP16FusedCompressor
+
+    """Quantize float32 gradients to 8 bits with error feedback."""
+    int8 = Int8Compressor
+
+    """Quantize float32 gradients to 1 bit with error feedback."""
+    onebit = OneBitCompressor
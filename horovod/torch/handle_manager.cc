@@ -15,40 +15,138 @@
 
 #include "handle_manager.h"
 
+#include <stdexcept>
+#include <string>
+
 namespace horovod {
 namespace torch {
 
+HandleManager::HandleManager() : slots_(new Slot[HANDLE_TABLE_SIZE]) {}
+
+HandleManager::Slot& HandleManager::SlotOf(int handle) {
+  return slots_[(unsigned int)handle % HANDLE_TABLE_SIZE];
+}
+
+HandleManager::Slot& HandleManager::AllocatedSlot(int handle) {
+  auto& slot = SlotOf(handle);
+  if (slot.state.load() == FREE || slot.handle.load() != handle) {
+    throw std::invalid_argument("Handle " + std::to_string(handle) +
+                                " was not created or has been cleared.");
+  }
+  return slot;
+}
+
 int HandleManager::AllocateHandle() {
-  int handle = last_handle_.fetch_add(1) + 1;
-  std::lock_guard<std::mutex> guard(mutex_);
-  results_[handle] = nullptr;
-  return handle;
+  // Handles are numbered consecutively, skipping the ones whose slot is still
+  // taken by an operation that has not been released.
+  for (int i = 0; i < HANDLE_TABLE_SIZE; ++i) {
+    int handle = last_handle_.fetch_add(1) + 1;
+    auto& slot = SlotOf(handle);
+    int expected = FREE;
+    if (slot.state.compare_exchange_strong(expected, PENDING)) {
+      slot.handle.store(handle);
+      return handle;
+    }
+  }
+  throw std::runtime_error("More than " + std::to_string(HANDLE_TABLE_SIZE) +
+                           " Horovod operations are outstanding. Operations "
+                           "have to be synchronized to release their handles.");
 }
 
 void HandleManager::MarkDone(int handle, const Status& status) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  results_[handle] = std::make_shared<Status>(status);
+  auto& slot = SlotOf(handle);
+  slot.status = status;
+  slot.state.store(DONE);
+  // A waiter either sees the new state before it blocks or is counted here,
+  // since both the state and the number of waiters are sequentially
+  // consistent.
+  if (waiters_.load() > 0) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    done_.notify_all();
+  }
 }
 
 bool HandleManager::PollHandle(int handle) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  if (results_.find(handle) == results_.end()) {
-    throw std::invalid_argument("Handle " + std::to_string(handle) +
-                                " was not created or has been cleared.");
+  return AllocatedSlot(handle).state.load() == DONE;
+}
+
+void HandleManager::Wait(const std::function<bool()>& done) {
+  if (done()) {
+    return;
   }
-  return results_[handle] != nullptr;
+  waiters_.fetch_add(1);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, done);
+  }
+  waiters_.fetch_sub(1);
+}
+
+void HandleManager::WaitHandles(const std::vector<int>& handles) {
+  std::vector<Slot*> slots;
+  slots.reserve(handles.size());
+  for (auto handle : handles) {
+    slots.push_back(&AllocatedSlot(handle));
+  }
+  Wait([&slots]() {
+    for (auto slot : slots) {
+      if (slot->state.load() != DONE) {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+int HandleManager::WaitAnyHandle(const std::vector<int>& handles) {
+  if (handles.empty()) {
+    throw std::invalid_argument("Waiting for any of no handles.");
+  }
+  std::vector<Slot*> slots;
+  slots.reserve(handles.size());
+  for (auto handle : handles) {
+    slots.push_back(&AllocatedSlot(handle));
+  }
+  int done_handle = handles[0];
+  Wait([&]() {
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (slots[i]->state.load() == DONE) {
+        done_handle = handles[i];
+        return true;
+      }
+    }
+    return false;
+  });
+  return done_handle;
 }
 
 std::shared_ptr<Status> HandleManager::ReleaseHandle(int handle) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  if (results_.find(handle) == results_.end()) {
-    throw std::invalid_argument("Handle " + std::to_string(handle) +
-        " was not created or has been cleared.");
+  auto& slot = AllocatedSlot(handle);
+  std::shared_ptr<Status> status;
+  if (slot.state.load() == DONE) {
+    status = std::make_shared<Status>(slot.status);
+  }
+  slot.state.store(FREE);
+  return status;
+}
+
+Status HandleManager::ReleaseHandles(const std::vector<int>& handles) {
+  // Every handle is released before an error is returned, so that none of
+  // them is leaked.
+  std::vector<Slot*> slots;
+  slots.reserve(handles.size());
+  for (auto handle : handles) {
+    slots.push_back(&AllocatedSlot(handle));
+  }
+  Status status = Status::OK();
+  for (auto slot : slots) {
+    if (status.ok() && !slot->status.ok()) {
+      status = slot->status;
+    }
+    slot->state.store(FREE);
   }
-  auto status = results_[handle];
-  results_.erase(handle);
   return status;
 }
 
 } // namespace torch
-} // namespace horovod
\ No newline at end of file
+} // namespace horovod
@@ -17,9 +17,11 @@
 #define HOROVOD_TORCH_HANDLE_MANAGER_H
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
-#include <unordered_map>
+#include <vector>
 
 #include "../common/common.h"
 
@@ -28,17 +30,56 @@ namespace torch {
 
 using namespace horovod::common;
 
+// Number of slots of the handle table, which is the number of operations that
+// can be pending or done but not yet released at the same time.
+#define HANDLE_TABLE_SIZE (1 << 16)
+
+// Table of the handles of asynchronous operations. Every handle has a slot
+// whose state is changed with atomics, so marking a handle as done and polling
+// it don't take a lock. Only threads which wait for handles to be done and the
+// operations finishing while they wait synchronize on a condition variable.
 class HandleManager {
 public:
+  HandleManager();
   int AllocateHandle();
   void MarkDone(int handle, const Status& status);
   bool PollHandle(int handle);
+
+  // Blocks until all of the handles are done.
+  void WaitHandles(const std::vector<int>& handles);
+
+  // Blocks until any of the handles is done and returns it.
+  int WaitAnyHandle(const std::vector<int>& handles);
+
   std::shared_ptr<Status> ReleaseHandle(int handle);
 
+  // Releases all of the handles, which must be done, and returns the first
+  // error of their operations.
+  Status ReleaseHandles(const std::vector<int>& handles);
+
 private:
-  std::atomic_int last_handle_;
-  std::unordered_map<int, std::shared_ptr<Status>> results_;
+  enum SlotState { FREE = 0, PENDING = 1, DONE = 2 };
+
+  struct Slot {
+    std::atomic_int state{FREE};
+    std::atomic_int handle{0};
+    // Written before the state becomes DONE and read after it is.
+    Status status;
+  };
+
+  Slot& SlotOf(int handle);
+
+  // Returns the slot of an allocated handle, or throws if the handle was not
+  // created or has been released.
+  Slot& AllocatedSlot(int handle);
+
+  void Wait(const std::function<bool()>& done);
+
+  std::atomic_int last_handle_{0};
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic_int waiters_{0};
   std::mutex mutex_;
+  std::condition_variable done_;
 };
 
 } // namespace torch
@@ -13,18 +13,22 @@
 // limitations under the License.
 // =============================================================================
 
-int horovod_torch_allreduce_async_torch_IntTensor(THIntTensor* tensor,
-                                                  THIntTensor* output,
-                                                  int average, char* name);
-int horovod_torch_allreduce_async_torch_LongTensor(THLongTensor* tensor,
-                                                   THLongTensor* output,
-                                                   int average, char* name);
-int horovod_torch_allreduce_async_torch_FloatTensor(THFloatTensor* tensor,
-                                                    THFloatTensor* output,
-                                                    int average, char* name);
-int horovod_torch_allreduce_async_torch_DoubleTensor(THDoubleTensor* tensor,
-                                                     THDoubleTensor* output,
-                                                     int average, char* name);
+int horovod_torch_allreduce_async_torch_IntTensor(
+    THIntTensor* tensor, THIntTensor* output, int average, char* name,
+    int compression, int priority, int accumulation_steps,
+    int scope, int local_replicas);
+int horovod_torch_allreduce_async_torch_LongTensor(
+    THLongTensor* tensor, THLongTensor* output, int average, char* name,
+    int compression, int priority, int accumulation_steps,
+    int scope, int local_replicas);
+int horovod_torch_allreduce_async_torch_FloatTensor(
+    THFloatTensor* tensor, THFloatTensor* output, int average, char* name,
+    int compression, int priority, int accumulation_steps,
+    int scope, int local_replicas);
+int horovod_torch_allreduce_async_torch_DoubleTensor(
+    THDoubleTensor* tensor, THDoubleTensor* output, int average, char* name,
+    int compression, int priority, int accumulation_steps,
+    int scope, int local_replicas);
 
 int horovod_torch_allgather_async_torch_ByteTensor(THByteTensor* tensor,
                                                    THByteTensor* output,
@@ -72,3 +76,5 @@ int horovod_torch_broadcast_async_torch_DoubleTensor(THDoubleTensor* tensor,
 
 int horovod_torch_poll(int handle);
 void horovod_torch_wait_and_clear(int handle);
+void horovod_torch_wait_all_and_clear(int* handles, int count);
+int horovod_torch_wait_any(int* handles, int count);
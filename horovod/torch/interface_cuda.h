@@ -13,19 +13,22 @@
 // limitations under the License.
 // =============================================================================
 
-int horovod_torch_allreduce_async_torch_cuda_IntTensor(THCudaIntTensor* tensor,
-                                                       THCudaIntTensor* output,
-                                                       int average, char* name);
+int horovod_torch_allreduce_async_torch_cuda_IntTensor(
+    THCudaIntTensor* tensor, THCudaIntTensor* output, int average, char* name,
+    int compression, int priority, int accumulation_steps,
+    int scope, int local_replicas);
 int horovod_torch_allreduce_async_torch_cuda_LongTensor(
-    THCudaLongTensor* tensor, THCudaLongTensor* output, int average,
-    char* name);
-int horovod_torch_allreduce_async_torch_cuda_FloatTensor(THCudaTensor* tensor,
-                                                         THCudaTensor* output,
-                                                         int average,
-                                                         char* name);
+    THCudaLongTensor* tensor, THCudaLongTensor* output, int average, char* name,
+    int compression, int priority, int accumulation_steps,
+    int scope, int local_replicas);
+int horovod_torch_allreduce_async_torch_cuda_FloatTensor(
+    THCudaTensor* tensor, THCudaTensor* output, int average, char* name,
+    int compression, int priority, int accumulation_steps,
+    int scope, int local_replicas);
 int horovod_torch_allreduce_async_torch_cuda_DoubleTensor(
     THCudaDoubleTensor* tensor, THCudaDoubleTensor* output, int average,
-    char* name);
+    char* name, int compression, int priority, int accumulation_steps,
+    int scope, int local_replicas);
 
 int horovod_torch_allgather_async_torch_cuda_ByteTensor(
     THCudaByteTensor* tensor, THCudaByteTensor* output, char* name);
@@ -13,9 +13,7 @@
 // limitations under the License.
 // =============================================================================
 
-#include <chrono>
 #include <memory>
-#include <thread>
 
 #include "../common/operations.h"
 #include "adapter.h"
@@ -39,10 +37,31 @@ std::string GetOpName(const std::string& prefix, char* name, int handle) {
   return prefix + ".noname." + std::to_string(handle);
 }
 
+// Floating point tensors are averaged by Horovod while they are copied out of
+// the fusion buffer, other tensors are divided after the allreduce.
+template <MPIDataType DT> bool ScaleInHorovod(int average) {
+  return average && (DT == HOROVOD_FLOAT16 || DT == HOROVOD_FLOAT32 ||
+                     DT == HOROVOD_FLOAT64);
+}
+
+// Number of ranks an allreduce with the given scope sums up the tensor across.
+int ScopeSize(int scope) {
+  switch (scope) {
+  case LOCAL_SCOPE:
+    return horovod_local_size();
+  case CROSS_SCOPE:
+    return horovod_size() / horovod_local_size();
+  default:
+    return horovod_size();
+  }
+}
+
 } // namespace
 
 template <MPIDataType DT, DeviceType Dev, class T>
-int DoAllreduce(T* tensor, T* output, int average, char* name) {
+int DoAllreduce(T* tensor, T* output, int average, char* name,
+                int compression, int priority, int accumulation_steps,
+                int scope, int local_replicas) {
   ThrowIfError(common::CheckInitialized());
 
   auto handle = handle_manager.AllocateHandle();
@@ -53,15 +72,19 @@ int DoAllreduce(T* tensor, T* output, int average, char* name) {
       std::make_shared<TorchOpContext<DT, Dev, T>>(device, output);
   auto hvd_output = std::make_shared<TorchTensor<DT, Dev, T>>(output);
 
+  auto scale = ScaleInHorovod<DT>(average);
+  auto reduce_size = ScopeSize(scope) * local_replicas;
   auto enqueue_result = EnqueueTensorAllreduce(
       hvd_context, hvd_tensor, hvd_output, ready_event,
       GetOpName("allreduce", name, handle), device,
-      [handle, average, output](const Status& status) {
-        if (average) {
-          TensorUtil::DivideTensorInPlace<DT, Dev, T>(output, horovod_size());
+      [handle, average, scale, output, reduce_size](const Status& status) {
+        if (average && !scale) {
+          TensorUtil::DivideTensorInPlace<DT, Dev, T>(output, reduce_size);
         }
         handle_manager.MarkDone(handle, status);
-      });
+      },
+      (Compression)compression, 1.0, scale ? 1.0 / reduce_size : 1.0,
+      priority, accumulation_steps, (ReduceScope)scope, local_replicas);
   ThrowIfError(enqueue_result);
 
   return handle;
@@ -69,7 +92,10 @@ int DoAllreduce(T* tensor, T* output, int average, char* name) {
 
 #if HAVE_CUDA
 template <MPIDataType DT, class TC, class T>
-int DoAllreduceCudaOnCPU(TC* tensor, TC* output, int average, char* name) {
+int DoAllreduceCudaOnCPU(TC* tensor, TC* output, int average, char* name,
+                         int compression, int priority,
+                         int accumulation_steps, int scope,
+                         int local_replicas) {
   ThrowIfError(common::CheckInitialized());
 
   // Make async copy of input tensor to CPU tensor and record completion event.
@@ -84,17 +110,22 @@ int DoAllreduceCudaOnCPU(TC* tensor, TC* output, int average, char* name) {
       CPU_DEVICE_ID, hvd_cpu_buffer->tensor());
 
   auto handle = handle_manager.AllocateHandle();
+  auto scale = ScaleInHorovod<DT>(average);
+  auto reduce_size = ScopeSize(scope) * local_replicas;
   auto enqueue_result = EnqueueTensorAllreduce(
       hvd_context, hvd_cpu_buffer, hvd_cpu_buffer, ready_event,
       GetOpName("allreduce", name, handle), CPU_DEVICE_ID,
-      [handle, average, hvd_cpu_buffer, output](const Status& status) {
+      [handle, average, scale, hvd_cpu_buffer, output,
+       reduce_size](const Status& status) {
         TensorUtil::CopyCPUToCuda<DT>(hvd_cpu_buffer->tensor(), output);
-        if (average) {
+        if (average && !scale) {
           TensorUtil::DivideTensorInPlace<DT, DeviceType::GPU>(output,
-                                                               horovod_size());
+                                                               reduce_size);
         }
         handle_manager.MarkDone(handle, status);
-      });
+      },
+      (Compression)compression, 1.0, scale ? 1.0 / reduce_size : 1.0,
+      priority, accumulation_steps, (ReduceScope)scope, local_replicas);
   ThrowIfError(enqueue_result);
 
   return handle;
@@ -218,9 +249,12 @@ int DoBroadcastCudaOnCPU(TC* tensor, TC* output, int root_rank, char* name) {
 
 #define ALLREDUCE(torch_Tensor, HorovodType, DeviceType, THTensor)             \
   extern "C" int horovod_torch_allreduce_async_##torch_Tensor(                 \
-      THTensor* tensor, THTensor* output, int average, char* name) {           \
-    return DoAllreduce<HorovodType, DeviceType>(tensor, output, average,       \
-                                                name);                         \
+      THTensor* tensor, THTensor* output, int average, char* name,             \
+      int compression, int priority, int accumulation_steps, int scope,        \
+      int local_replicas) {                                                    \
+    return DoAllreduce<HorovodType, DeviceType>(                               \
+        tensor, output, average, name, compression, priority,                  \
+        accumulation_steps, scope, local_replicas);                            \
   }
 
 ALLREDUCE(torch_IntTensor, MPIDataType::HOROVOD_INT32, DeviceType::CPU,
@@ -245,9 +279,12 @@ ALLREDUCE(torch_cuda_DoubleTensor, MPIDataType::HOROVOD_FLOAT64,
 
 #define ALLREDUCE_CUDA_ON_CPU(torch_Tensor, HorovodType, THCTensor, THTensor)  \
   extern "C" int horovod_torch_allreduce_async_##torch_Tensor(                 \
-      THCTensor* tensor, THCTensor* output, int average, char* name) {         \
+      THCTensor* tensor, THCTensor* output, int average, char* name,           \
+      int compression, int priority, int accumulation_steps, int scope,        \
+      int local_replicas) {                                                    \
     return DoAllreduceCudaOnCPU<HorovodType, THCTensor, THTensor>(             \
-        tensor, output, average, name);                                        \
+        tensor, output, average, name, compression, priority,                  \
+        accumulation_steps, scope, local_replicas);                            \
   }
 
 #if !HOROVOD_GPU_ALLREDUCE && HAVE_CUDA
@@ -391,12 +428,21 @@ extern "C" int horovod_torch_poll(int handle) {
 }
 
 extern "C" void horovod_torch_wait_and_clear(int handle) {
-  while (!handle_manager.PollHandle(handle)) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-  }
+  handle_manager.WaitHandles({handle});
   auto status = handle_manager.ReleaseHandle(handle);
   ThrowIfError(*status);
 }
 
+extern "C" void horovod_torch_wait_all_and_clear(int* handles, int count) {
+  std::vector<int> handle_list(handles, handles + count);
+  handle_manager.WaitHandles(handle_list);
+  ThrowIfError(handle_manager.ReleaseHandles(handle_list));
+}
+
+extern "C" int horovod_torch_wait_any(int* handles, int count) {
+  std::vector<int> handle_list(handles, handles + count);
+  return handle_manager.WaitAnyHandle(handle_list);
+}
+
 } // namespace torch
 } // namespace horovod
\ No newline at end of file
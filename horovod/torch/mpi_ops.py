@@ -46,6 +46,22 @@ local_size = _basics.local_size
 rank = _basics.rank
 local_rank = _basics.local_rank
 mpi_threads_supported = _basics.mpi_threads_supported
+metrics = _basics.metrics
+replay = _basics.replay
+
+
+class ReduceScope(object):
+    """Ranks an allreduce sums up the tensor across."""
+
+    """All processes."""
+    world = 0
+
+    """The processes on the same node."""
+    local = 1
+
+    """The processes with the same local rank on all nodes. Needs the same
+    number of processes on every node."""
+    cross = 2
 
 
 # Schema: handle -> input, output
@@ -56,6 +72,34 @@ _handle_map = {}
 # Only support fp16 allreduce for PyTorch versions using v2 API.
 _fp16_supported = _v2_api
 
+# Number of unnamed operations since the last call to mark_step(), or None if
+# it was never called. Until then, unnamed operations are named after their
+# handle, which is different in every step.
+_step_op_index = None
+
+
+def mark_step():
+    """
+    Marks the beginning of a training step. From then on, operations without a
+    name are named after the order in which they are called within the step,
+    so that the same operation has the same name in every step. This lets the
+    response cache, the autotuner and the timeline recognize them.
+
+    All processes have to call the unnamed operations in the same order, and
+    the unnamed operations of a step have to be synchronized before the next
+    step begins.
+    """
+    global _step_op_index
+    _step_op_index = 0
+
+
+def _encode_name(name):
+    global _step_op_index
+    if name is None and _step_op_index is not None:
+        name = 'step.%d' % _step_op_index
+        _step_op_index += 1
+    return name.encode() if name is not None else _NULL
+
 
 def _check_function(function_factory, tensor):
     function = function_factory(tensor)
@@ -70,20 +114,33 @@ def _allreduce_function_factory(tensor):
     return 'horovod_torch_allreduce_async_' + tensor.type().replace('.', '_')
 
 
-def _allreduce_async(tensor, output, average, name):
+def _allreduce_async(tensor, output, average, name, compression=0, priority=0,
+                     accumulation_steps=1, scope=ReduceScope.world,
+                     local_replicas=1):
     if tensor.dtype == torch.float16 and not _fp16_supported:
         raise NotImplementedError(
             'float16 allreduce is not supported for PyTorch version {} < 1.0.0'
             .format(torch.__version__))
+    if accumulation_steps > 1 and name is None:
+        raise ValueError('Accumulated allreduces must be named, since the '
+                         'steps of a tensor are matched by name.')
+    if local_replicas > 1 and name is None:
+        raise ValueError('Allreduces of local replicas must be named, since '
+                         'the replicas of a tensor are matched by name.')
 
     function = _check_function(_allreduce_function_factory, tensor)
     handle = getattr(mpi_lib, function)(tensor, output, average,
-                                        name.encode() if name is not None else _NULL)
+                                        _encode_name(name),
+                                        compression, priority,
+                                        accumulation_steps, scope,
+                                        local_replicas)
     _handle_map[handle] = (tensor, output)
     return handle
 
 
-def allreduce_async(tensor, average=True, name=None):
+def allreduce_async(tensor, average=True, name=None, priority=0,
+                    accumulation_steps=1, scope=ReduceScope.world,
+                    local_replicas=1):
     """
     A function that performs asynchronous averaging or summation of the input tensor
     over all the Horovod processes. The input tensor is not modified.
@@ -98,27 +155,51 @@ def allreduce_async(tensor, average=True, name=None):
         average: A flag indicating whether to compute average or summation,
                  defaults to average.
         name: A name of the reduction operation.
+        priority: Allreduces with a higher priority are performed first when
+                  several are ready. Must be the same on all processes for a
+                  given name, defaults to 0.
+        accumulation_steps: Number of calls with the same name whose tensors
+                            are summed up locally before their sum is
+                            allreduced into the output of the last call. The
+                            outputs of the other calls are left uninitialized.
+                            Only floating point tensors can be accumulated.
+                            Defaults to 1.
+        scope: A `ReduceScope` limiting the processes the tensor is averaged
+               or summed up across. All processes have to call the allreduce
+               anyway. Defaults to all processes.
+        local_replicas: Number of GPUs of this process which call the
+                        allreduce with the same name. Their tensors are
+                        summed up locally with NCCL and the sum is allreduced
+                        once for the process, so that one process can drive
+                        several GPUs. Must be the same on all processes for a
+                        given name, defaults to 1.
 
     Returns:
         A handle to the allreduce operation that can be used with `poll()` or
         `synchronize()`.
     """
     output = tensor.new(tensor.shape)
-    return _allreduce_async(tensor, output, average, name)
+    return _allreduce_async(tensor, output, average, name, priority=priority,
+                            accumulation_steps=accumulation_steps, scope=scope,
+                            local_replicas=local_replicas)
 
 
 class HorovodAllreduce(torch.autograd.Function):
     """An autograd function that performs allreduce on a tensor."""
 
     @staticmethod
-    def forward(ctx, tensor, average, name):
+    def forward(ctx, tensor, average, name, compression):
         ctx.average = average
-        handle = allreduce_async(tensor, average, name)
+        ctx.compression = compression
+        output = tensor.new(tensor.shape)
+        handle = _allreduce_async(tensor, output, average, name, compression)
         return synchronize(handle)
 
     @staticmethod
     def backward(ctx, grad_output):
-        return allreduce(grad_output, ctx.average), None, None
+        return (HorovodAllreduce.apply(grad_output, ctx.average, None,
+                                       ctx.compression),
+                None, None, None)
 
 
 def allreduce(tensor, average=True, name=None, compression=Compression.none):
@@ -149,11 +230,13 @@ def allreduce(tensor, average=True, name=None, compression=Compression.none):
         processes.
     """
     tensor_compressed, ctx = compression.compress(tensor)
-    summed_tensor_compressed = HorovodAllreduce.apply(tensor_compressed, average, name)
+    summed_tensor_compressed = HorovodAllreduce.apply(tensor_compressed, average, name,
+                                                      compression.core_compression)
     return compression.decompress(summed_tensor_compressed, ctx)
 
 
-def allreduce_async_(tensor, average=True, name=None):
+def allreduce_async_(tensor, average=True, name=None, priority=0,
+                     scope=ReduceScope.world, local_replicas=1):
     """
     A function that performs asynchronous in-place averaging or summation of the input
     tensor over all the Horovod processes.
@@ -168,12 +251,22 @@ def allreduce_async_(tensor, average=True, name=None):
         average: A flag indicating whether to compute average or summation,
                  defaults to average.
         name: A name of the reduction operation.
+        priority: Allreduces with a higher priority are performed first when
+                  several are ready. Must be the same on all processes for a
+                  given name, defaults to 0.
+        scope: A `ReduceScope` limiting the processes the tensor is averaged
+               or summed up across. All processes have to call the allreduce
+               anyway. Defaults to all processes.
+        local_replicas: Number of GPUs of this process which call the
+                        allreduce with the same name, see `allreduce_async()`.
+                        Defaults to 1.
 
     Returns:
         A handle to the allreduce operation that can be used with `poll()` or
         `synchronize()`.
     """
-    return _allreduce_async(tensor, tensor, average, name)
+    return _allreduce_async(tensor, tensor, average, name, priority=priority,
+                            scope=scope, local_replicas=local_replicas)
 
 
 def allreduce_(tensor, average=True, name=None):
@@ -200,6 +293,125 @@ def allreduce_(tensor, average=True, name=None):
     return synchronize(handle)
 
 
+def _grouped_allreduce_function_factory(tensor):
+    return ('horovod_torch_grouped_allreduce_async_' +
+            tensor.type().replace('.', '_'))
+
+
+def _grouped_allreduce_async(tensors, outputs, average, name, compression=0):
+    if not _v2_api:
+        raise NotImplementedError(
+            'grouped allreduce is not supported for PyTorch version {} < 1.0.0'
+            .format(torch.__version__))
+    if not tensors:
+        raise ValueError('Grouped allreduce requires at least one tensor.')
+    for tensor in tensors:
+        if tensor.type() != tensors[0].type():
+            raise ValueError('Tensors of a grouped allreduce are required to '
+                             'have the same type and device.')
+        if not tensor.is_contiguous():
+            raise ValueError('Tensor is required to be contiguous.')
+
+    function = _check_function(_grouped_allreduce_function_factory, tensors[0])
+    handle = getattr(mpi_lib, function)(tensors, outputs, average,
+                                        _encode_name(name),
+                                        compression)
+    _handle_map[handle] = (tuple(tensors), list(outputs))
+    return handle
+
+
+def grouped_allreduce_async(tensors, average=True, name=None):
+    """
+    A function that performs asynchronous averaging or summation of a list of
+    input tensors over all the Horovod processes. The input tensors are not
+    modified.
+
+    The tensors are enqueued in a single call and only fused with each other,
+    which saves the per-tensor overhead of separate allreduces. They must have
+    the same type and device. The number of tensors and their shapes must be
+    the same on all Horovod processes for a given name.
+
+    Arguments:
+        tensors: A list of tensors to average and sum.
+        average: A flag indicating whether to compute average or summation,
+                 defaults to average.
+        name: A name of the grouped reduction operation.
+
+    Returns:
+        A handle to the grouped allreduce operation that can be used with
+        `poll()` or `synchronize()`. `synchronize()` returns a list of the
+        output tensors.
+    """
+    outputs = [tensor.new(tensor.shape) for tensor in tensors]
+    return _grouped_allreduce_async(tensors, outputs, average, name)
+
+
+class HorovodGroupedAllreduce(torch.autograd.Function):
+    """An autograd function that performs allreduce on a group of tensors."""
+
+    @staticmethod
+    def forward(ctx, average, name, compression, *tensors):
+        ctx.average = average
+        ctx.compression = compression
+        outputs = [tensor.new(tensor.shape) for tensor in tensors]
+        handle = _grouped_allreduce_async(list(tensors), outputs, average,
+                                          name, compression)
+        return tuple(synchronize(handle))
+
+    @staticmethod
+    def backward(ctx, *grad_outputs):
+        grads = [grad.contiguous() for grad in grad_outputs]
+        return (None, None, None) + HorovodGroupedAllreduce.apply(
+            ctx.average, None, ctx.compression, *grads)
+
+
+def grouped_allreduce(tensors, average=True, name=None,
+                      compression=Compression.none):
+    """
+    A function that performs averaging or summation of a list of input tensors
+    over all the Horovod processes. The input tensors are not modified.
+
+    The tensors of every type and device are enqueued in a single call and
+    only fused with each other, which saves the per-tensor overhead of
+    separate allreduces. The number of tensors and their shapes must be the
+    same on all Horovod processes for a given name.
+
+    This acts as a thin wrapper around an autograd function.  If your input
+    tensors require gradients, then callings this function will allow
+    gradients to be computed and backpropagated.
+
+    Arguments:
+        tensors: A list of tensors to average and sum.
+        average: A flag indicating whether to compute average or summation,
+                 defaults to average.
+        name: A name of the grouped reduction operation.
+        compression: Compression algorithm used during allreduce to reduce the
+                     amount of data sent during the each parameter update step.
+                     Defaults to not using compression.
+
+    Returns:
+        A list of tensors of the same shapes and types as `tensors`, averaged
+        or summed across all processes.
+    """
+    compressed = [compression.compress(tensor) for tensor in tensors]
+    groups = {}
+    for i, (tensor_compressed, _) in enumerate(compressed):
+        groups.setdefault(tensor_compressed.type(), []).append(i)
+
+    results = [None] * len(tensors)
+    for tensor_type in sorted(groups):
+        indices = groups[tensor_type]
+        group_name = None
+        if name is not None:
+            group_name = '%s.%s' % (name, tensor_type)
+        summed_tensors = HorovodGroupedAllreduce.apply(
+            average, group_name, compression.core_compression,
+            *[compressed[i][0] for i in indices])
+        for i, summed_tensor in zip(indices, summed_tensors):
+            results[i] = compression.decompress(summed_tensor, compressed[i][1])
+    return results
+
+
 def _allgather_function_factory(tensor):
     return 'horovod_torch_allgather_async_' + tensor.type().replace('.', '_')
 
@@ -207,7 +419,7 @@ def _allgather_function_factory(tensor):
 def _allgather_async(tensor, output, name):
     function = _check_function(_allgather_function_factory, tensor)
     handle = getattr(mpi_lib, function)(
-        tensor, output, name.encode() if name is not None else _NULL)
+        tensor, output, _encode_name(name))
     _handle_map[handle] = (tensor, output)
     return handle
 
@@ -287,7 +499,7 @@ def _broadcast_function_factory(tensor):
 def _broadcast_async(tensor, output, root_rank, name):
     function = _check_function(_broadcast_function_factory, tensor)
     handle = getattr(mpi_lib, function)(
-        tensor, output, root_rank, name.encode() if name is not None else _NULL)
+        tensor, output, root_rank, _encode_name(name))
     _handle_map[handle] = (tensor, output)
     return handle
 
@@ -403,6 +615,251 @@ def broadcast_(tensor, root_rank, name=None):
     return synchronize(handle)
 
 
+def _sparse_allreduce_function_factory(tensor):
+    return ('horovod_torch_sparse_allreduce_async_' +
+            tensor.type().replace('.', '_'))
+
+
+def sparse_allreduce_async(values, indices, deduplicate=False, name=None):
+    """
+    A function that asynchronously sums the rows of a sparse tensor, given as the
+    rows `values` and their `indices` along the first dimension, over all the
+    Horovod processes. The input tensors are not modified.
+
+    The rows and indices of all processes are gathered in a single operation
+    instead of densifying the tensor, so the input values on the different
+    processes must have the same rank and shape, except for the first dimension.
+    The operation runs on the CPU, GPU tensors are copied to the CPU first.
+
+    Arguments:
+        values: A tensor with the rows of the sparse tensor.
+        indices: A vector with the index of every row of `values`.
+        deduplicate: If True, rows with the same index are summed up into a
+                     single row. Otherwise the rows of all processes are kept.
+        name: A name of the sparse allreduce operation.
+
+    Returns:
+        A handle to the sparse allreduce operation that can be used with `poll()`
+        or `synchronize()`. `synchronize()` returns a tuple of the summed rows and
+        their indices as CPU tensors.
+    """
+    if not _v2_api:
+        raise NotImplementedError(
+            'sparse allreduce is not supported for PyTorch version {} < 1.0.0'
+            .format(torch.__version__))
+
+    values = values.cpu().contiguous()
+    indices = indices.cpu().long().contiguous()
+    function = _check_function(_sparse_allreduce_function_factory, values)
+    output = values.new()
+    output_indices = indices.new()
+    handle = getattr(mpi_lib, function)(
+        values, indices, output, output_indices,
+        _encode_name(name), deduplicate)
+    _handle_map[handle] = ((values, indices), (output, output_indices))
+    return handle
+
+
+def sparse_allreduce(values, indices, average=True, deduplicate=False,
+                     name=None):
+    """
+    A function that averages or sums the rows of a sparse tensor, given as the
+    rows `values` and their `indices` along the first dimension, over all the
+    Horovod processes. The input tensors are not modified.
+
+    The rows and indices of all processes are gathered in a single operation
+    instead of densifying the tensor, so the input values on the different
+    processes must have the same rank and shape, except for the first dimension.
+
+    Arguments:
+        values: A tensor with the rows of the sparse tensor.
+        indices: A vector with the index of every row of `values`.
+        average: A flag indicating whether to compute average or summation,
+                 defaults to average.
+        deduplicate: If True, rows with the same index are summed up into a
+                     single row. Otherwise the rows of all processes are kept.
+        name: A name of the sparse allreduce operation.
+
+    Returns:
+        A tuple of the averaged or summed rows and their int64 indices, on the
+        device of `values`. Without deduplication these are the rows and indices
+        of all processes in rank order, otherwise every index occurs once in the
+        order in which it first occurs.
+    """
+    handle = sparse_allreduce_async(values, indices, deduplicate, name)
+    output, output_indices = synchronize(handle)
+    if average:
+        output = output / size()
+    return output.to(values.device), output_indices.to(values.device)
+
+
+def _reducescatter_function_factory(tensor):
+    return ('horovod_torch_reducescatter_async_' +
+            tensor.type().replace('.', '_'))
+
+
+def reducescatter_async(tensor, name=None):
+    """
+    A function that asynchronously sums the input tensor over all the Horovod
+    processes and scatters the sum along the first dimension. The input tensor
+    is not modified.
+
+    The tensor type and shape must be the same on all Horovod processes for a
+    given name. The rows of the sum are split up among the processes in rank
+    order, the first processes getting one more row if the first dimension
+    can't be split up evenly.
+
+    Arguments:
+        tensor: A tensor to reduce and scatter.
+        name: A name of the reducescatter operation.
+
+    Returns:
+        A handle to the reducescatter operation that can be used with `poll()`
+        or `synchronize()`.
+    """
+    if not _v2_api:
+        raise NotImplementedError(
+            'reducescatter is not supported for PyTorch version {} < 1.0.0'
+            .format(torch.__version__))
+
+    function = _check_function(_reducescatter_function_factory, tensor)
+    output = tensor.new()
+    handle = getattr(mpi_lib, function)(
+        tensor, output, _encode_name(name))
+    _handle_map[handle] = (tensor, output)
+    return handle
+
+
+class HorovodReducescatter(torch.autograd.Function):
+    """An autograd function that performs reducescatter on a tensor."""
+
+    @staticmethod
+    def forward(ctx, tensor, name):
+        handle = reducescatter_async(tensor, name)
+        return synchronize(handle)
+
+    @staticmethod
+    def backward(ctx, grad_output):
+        return allgather(grad_output), None
+
+
+def reducescatter(tensor, name=None):
+    """
+    A function that sums the input tensor over all the Horovod processes and
+    scatters the sum along the first dimension. The input tensor is not
+    modified.
+
+    The tensor type and shape must be the same on all Horovod processes for a
+    given name. The rows of the sum are split up among the processes in rank
+    order, the first processes getting one more row if the first dimension
+    can't be split up evenly.
+
+    This acts as a thin wrapper around an autograd function.  If your input
+    tensor requires gradients, then callings this function will allow gradients
+    to be computed and backpropagated.
+
+    Arguments:
+        tensor: A tensor to reduce and scatter.
+        name: A name of the reducescatter operation.
+
+    Returns:
+        A tensor of the same type as `tensor` with the rows of the sum that
+        belong to this process.
+    """
+    return HorovodReducescatter.apply(tensor, name)
+
+
+def _alltoall_function_factory(tensor):
+    return 'horovod_torch_alltoall_async_' + tensor.type().replace('.', '_')
+
+
+def alltoall_async(tensor, splits=None, name=None):
+    """
+    A function that asynchronously sends the rows of the input tensor to all
+    the Horovod processes and concatenates the rows received from them. The
+    input tensor is not modified.
+
+    `splits[r]` rows of `tensor` are sent to process `r` in rank order. If
+    `splits` is None, the first dimension must be divisible by the number of
+    processes and the rows are split up evenly. The input tensors on the
+    different processes must have the same rank and shape, except for the
+    first dimension.
+
+    Arguments:
+        tensor: A tensor to distribute.
+        splits: A list or vector with the number of rows sent to every process.
+        name: A name of the alltoall operation.
+
+    Returns:
+        A handle to the alltoall operation that can be used with `poll()` or
+        `synchronize()`.
+    """
+    if not _v2_api:
+        raise NotImplementedError(
+            'alltoall is not supported for PyTorch version {} < 1.0.0'
+            .format(torch.__version__))
+
+    function = _check_function(_alltoall_function_factory, tensor)
+    if splits is None:
+        splits = torch.IntTensor()
+    else:
+        splits = torch.as_tensor(splits).cpu().int().contiguous()
+    output = tensor.new()
+    handle = getattr(mpi_lib, function)(
+        tensor, splits, output, _encode_name(name))
+    _handle_map[handle] = ((tensor, splits), output)
+    return handle
+
+
+class HorovodAlltoall(torch.autograd.Function):
+    """An autograd function that performs alltoall on a tensor."""
+
+    @staticmethod
+    def forward(ctx, tensor, splits, name):
+        if splits is None:
+            splits = torch.IntTensor([tensor.shape[0] // size()] * size())
+        else:
+            splits = torch.as_tensor(splits).cpu().int()
+        ctx.splits = splits
+        handle = alltoall_async(tensor, splits, name)
+        return synchronize(handle)
+
+    @staticmethod
+    def backward(ctx, grad_output):
+        # Every process sends back the rows it received from every other
+        # process.
+        recv_splits = alltoall(ctx.splits)
+        return alltoall(grad_output.contiguous(), recv_splits), None, None
+
+
+def alltoall(tensor, splits=None, name=None):
+    """
+    A function that sends the rows of the input tensor to all the Horovod
+    processes and concatenates the rows received from them. The input tensor
+    is not modified.
+
+    `splits[r]` rows of `tensor` are sent to process `r` in rank order. If
+    `splits` is None, the first dimension must be divisible by the number of
+    processes and the rows are split up evenly. The input tensors on the
+    different processes must have the same rank and shape, except for the
+    first dimension.
+
+    This acts as a thin wrapper around an autograd function.  If your input
+    tensor requires gradients, then callings this function will allow gradients
+    to be computed and backpropagated.
+
+    Arguments:
+        tensor: A tensor to distribute.
+        splits: A list or vector with the number of rows sent to every process.
+        name: A name of the alltoall operation.
+
+    Returns:
+        A tensor of the same type as `tensor` with the rows received from all
+        processes, concatenated on dimension zero in rank order.
+    """
+    return HorovodAlltoall.apply(tensor, splits, name)
+
+
 def poll(handle):
     """
     Polls an allreduce, allgather or broadcast handle to determine whether underlying
@@ -436,3 +893,45 @@ def synchronize(handle):
     mpi_lib.horovod_torch_wait_and_clear(handle)
     _, output = _handle_map.pop(handle)
     return output
+
+
+def _handle_list(handles):
+    if _v2_api:
+        return handles,
+    return mpi_lib._ffi.new('int[]', handles), len(handles)
+
+
+def synchronize_all(handles):
+    """
+    Synchronizes a list of asynchronous operations until all of them are
+    completed, which is cheaper than synchronizing them one by one. Returns the
+    results of the operations.
+
+    Arguments:
+        handles: A list of handles returned by asynchronous operations.
+
+    Returns:
+        A list of the output tensors of the operations, in the order of the
+        handles.
+    """
+    known = [handle for handle in handles if handle in _handle_map]
+    if known:
+        mpi_lib.horovod_torch_wait_all_and_clear(*_handle_list(known))
+    return [_handle_map.pop(handle)[1] if handle in _handle_map else None
+            for handle in handles]
+
+
+def wait_any(handles):
+    """
+    Blocks until any of a list of asynchronous operations is completed. The
+    operation still has to be synchronized to get its result, which then
+    returns without blocking.
+
+    Arguments:
+        handles: A non-empty list of handles returned by asynchronous
+                 operations.
+
+    Returns:
+        A handle of a completed operation.
+    """
+    return mpi_lib.horovod_torch_wait_any(*_handle_list(list(handles)))
@@ -13,9 +13,8 @@
 // limitations under the License.
 // =============================================================================
 
-#include <chrono>
 #include <memory>
-#include <thread>
+#include <mutex>
 #include <torch/extension.h>
 #include <torch/torch.h>
 
@@ -47,10 +46,60 @@ int GetDeviceID(const ::torch::Tensor& tensor) {
   return CPU_DEVICE_ID;
 }
 
+// Counts down the tensors of a grouped operation and marks its handle done,
+// with the first error if there was one, once all tensors are done.
+class GroupCompletion {
+public:
+  GroupCompletion(int handle, int count) : handle_(handle), remaining_(count) {}
+
+  void Done(const Status& status) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (status_.ok() && !status.ok()) {
+        status_ = status;
+      }
+      if (--remaining_ > 0) {
+        return;
+      }
+    }
+    handle_manager.MarkDone(handle_, status_);
+  }
+
+private:
+  int handle_;
+  int remaining_;
+  Status status_;
+  std::mutex mutex_;
+};
+
+// Float16, float32 and float64 tensors are averaged by Horovod while they are
+// copied out of the fusion buffer, other tensors are divided after the
+// allreduce.
+double PostscaleFactor(const ::torch::Tensor& tensor, int average,
+                       int size = horovod_size()) {
+  auto type = tensor.scalar_type();
+  bool scale = type == ::torch::kHalf || type == ::torch::kFloat ||
+               type == ::torch::kDouble;
+  return average && scale ? 1.0 / size : 1.0;
+}
+
+// Number of ranks an allreduce with the given scope sums up the tensor across.
+int ScopeSize(int scope) {
+  switch (scope) {
+  case LOCAL_SCOPE:
+    return horovod_local_size();
+  case CROSS_SCOPE:
+    return horovod_size() / horovod_local_size();
+  default:
+    return horovod_size();
+  }
+}
+
 } // namespace
 
 int DoAllreduce(::torch::Tensor tensor, ::torch::Tensor output, int average,
-                const std::string& name) {
+                const std::string& name, int compression, int priority,
+                int accumulation_steps, int scope, int local_replicas) {
   ThrowIfError(common::CheckInitialized());
 
   auto handle = handle_manager.AllocateHandle();
@@ -60,23 +109,30 @@ int DoAllreduce(::torch::Tensor tensor, ::torch::Tensor output, int average,
   auto hvd_context = std::make_shared<TorchOpContext>(device, output);
   auto hvd_output = std::make_shared<TorchTensor>(output);
 
+  auto reduce_size = ScopeSize(scope) * local_replicas;
+  auto postscale_factor = PostscaleFactor(tensor, average, reduce_size);
   auto enqueue_result = EnqueueTensorAllreduce(
       hvd_context, hvd_tensor, hvd_output, ready_event,
       GetOpName("allreduce", name, handle), device,
-      [handle, average, output](const Status& status) mutable {
+      [handle, average, postscale_factor, output,
+       reduce_size](const Status& status) mutable {
         // Will execute in the `device` context.
-        if (average) {
-          output.div_(horovod_size());
+        if (average && postscale_factor == 1.0) {
+          output.div_(reduce_size);
         }
         handle_manager.MarkDone(handle, status);
-      });
+      },
+      (Compression)compression, 1.0, postscale_factor, priority,
+      accumulation_steps, (ReduceScope)scope, local_replicas);
   ThrowIfError(enqueue_result);
 
   return handle;
 }
 
 int DoAllreduceCudaOnCPU(::torch::Tensor tensor, ::torch::Tensor output, int average,
-                         const std::string& name) {
+                         const std::string& name, int compression,
+                         int priority, int accumulation_steps, int scope,
+                         int local_replicas) {
   ThrowIfError(common::CheckInitialized());
 
   // Make async copy of input tensor to CPU tensor and record completion event.
@@ -90,20 +146,124 @@ int DoAllreduceCudaOnCPU(::torch::Tensor tensor, ::torch::Tensor output, int ave
       std::make_shared<TorchOpContext>(CPU_DEVICE_ID, cpu_buffer);
 
   auto handle = handle_manager.AllocateHandle();
+  auto reduce_size = ScopeSize(scope) * local_replicas;
+  auto postscale_factor = PostscaleFactor(tensor, average, reduce_size);
   auto enqueue_result = EnqueueTensorAllreduce(
       hvd_context, hvd_cpu_buffer, hvd_cpu_buffer, ready_event,
       GetOpName("allreduce", name, handle), CPU_DEVICE_ID,
-      [handle, average, cpu_buffer, output,
-       device](const Status& status) mutable {
+      [handle, average, postscale_factor, cpu_buffer, output, device,
+       reduce_size](const Status& status) mutable {
         // Since the operation was on CPU, need to perform copy with the GPU
         // device guard.
         with_device device_guard(device);
         output.copy_(cpu_buffer);
-        if (average) {
-          output.div_(horovod_size());
+        if (average && postscale_factor == 1.0) {
+          output.div_(reduce_size);
         }
         handle_manager.MarkDone(handle, status);
-      });
+      },
+      (Compression)compression, 1.0, postscale_factor, priority,
+      accumulation_steps, (ReduceScope)scope, local_replicas);
+  ThrowIfError(enqueue_result);
+
+  return handle;
+}
+
+int DoGroupedAllreduce(const std::vector<::torch::Tensor>& tensors,
+                       const std::vector<::torch::Tensor>& outputs,
+                       int average, const std::string& name,
+                       int compression) {
+  ThrowIfError(common::CheckInitialized());
+
+  auto handle = handle_manager.AllocateHandle();
+  auto device = GetDeviceID(tensors[0]);
+  auto ready_event = RecordReadyEvent(device);
+  auto completion = std::make_shared<GroupCompletion>(handle, (int)tensors.size());
+
+  std::vector<std::shared_ptr<OpContext>> hvd_contexts;
+  std::vector<std::shared_ptr<Tensor>> hvd_tensors;
+  std::vector<std::shared_ptr<Tensor>> hvd_outputs;
+  std::vector<std::shared_ptr<ReadyEvent>> ready_events;
+  std::vector<std::string> names;
+  std::vector<StatusCallback> callbacks;
+  auto group_name = GetOpName("grouped_allreduce", name, handle);
+  auto postscale_factor = PostscaleFactor(tensors[0], average);
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    auto output = outputs[i];
+    hvd_contexts.push_back(std::make_shared<TorchOpContext>(device, output));
+    hvd_tensors.push_back(std::make_shared<TorchTensor>(tensors[i]));
+    hvd_outputs.push_back(std::make_shared<TorchTensor>(output));
+    ready_events.push_back(ready_event);
+    names.push_back(group_name + "." + std::to_string(i));
+    callbacks.push_back([completion, average, postscale_factor,
+                         output](const Status& status) mutable {
+      // Will execute in the `device` context.
+      if (average && postscale_factor == 1.0) {
+        output.div_(horovod_size());
+      }
+      completion->Done(status);
+    });
+  }
+
+  auto enqueue_result = EnqueueTensorAllreduces(
+      hvd_contexts, hvd_tensors, hvd_outputs, ready_events, names, device,
+      callbacks, (Compression)compression, 1.0, postscale_factor);
+  ThrowIfError(enqueue_result);
+
+  return handle;
+}
+
+int DoGroupedAllreduceCudaOnCPU(const std::vector<::torch::Tensor>& tensors,
+                                const std::vector<::torch::Tensor>& outputs,
+                                int average, const std::string& name,
+                                int compression) {
+  ThrowIfError(common::CheckInitialized());
+
+  // Make async copies of the input tensors to CPU tensors and record their
+  // completion event.
+  auto device = GetDeviceID(tensors[0]);
+  std::vector<::torch::Tensor> cpu_buffers;
+  for (auto& tensor : tensors) {
+    cpu_buffers.push_back(
+        tensor.to(::torch::Device(::torch::kCPU), /*non_blocking=*/true));
+  }
+  auto ready_event = RecordReadyEvent(device);
+
+  auto handle = handle_manager.AllocateHandle();
+  auto completion = std::make_shared<GroupCompletion>(handle, (int)tensors.size());
+
+  std::vector<std::shared_ptr<OpContext>> hvd_contexts;
+  std::vector<std::shared_ptr<Tensor>> hvd_cpu_buffers;
+  std::vector<std::shared_ptr<ReadyEvent>> ready_events;
+  std::vector<std::string> names;
+  std::vector<StatusCallback> callbacks;
+  auto group_name = GetOpName("grouped_allreduce", name, handle);
+  auto postscale_factor = PostscaleFactor(tensors[0], average);
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    auto cpu_buffer = cpu_buffers[i];
+    auto output = outputs[i];
+    hvd_contexts.push_back(
+        std::make_shared<TorchOpContext>(CPU_DEVICE_ID, cpu_buffer));
+    hvd_cpu_buffers.push_back(std::make_shared<TorchTensor>(cpu_buffer));
+    ready_events.push_back(ready_event);
+    names.push_back(group_name + "." + std::to_string(i));
+    callbacks.push_back([completion, average, postscale_factor, cpu_buffer,
+                         output, device](const Status& status) mutable {
+      // Since the operation was on CPU, need to perform copy with the GPU
+      // device guard.
+      with_device device_guard(device);
+      output.copy_(cpu_buffer);
+      if (average && postscale_factor == 1.0) {
+        output.div_(horovod_size());
+      }
+      completion->Done(status);
+    });
+  }
+
+  auto enqueue_result = EnqueueTensorAllreduces(
+      hvd_contexts, hvd_cpu_buffers, hvd_cpu_buffers, ready_events, names,
+      CPU_DEVICE_ID, callbacks, (Compression)compression, 1.0,
+      postscale_factor);
   ThrowIfError(enqueue_result);
 
   return handle;
@@ -223,16 +383,92 @@ int DoBroadcastCudaOnCPU(::torch::Tensor tensor, ::torch::Tensor output, int roo
   return handle;
 }
 
+int DoSparseAllreduce(::torch::Tensor values, ::torch::Tensor indices,
+                      ::torch::Tensor output, ::torch::Tensor output_indices,
+                      const std::string& name, bool deduplicate) {
+  ThrowIfError(common::CheckInitialized());
+
+  auto device = GetDeviceID(values);
+  auto ready_event = RecordReadyEvent(device);
+  auto hvd_values = std::make_shared<TorchTensor>(values);
+  auto hvd_indices = std::make_shared<TorchTensor>(indices);
+  auto hvd_context = std::make_shared<TorchOpContext>(
+      device, std::vector<::torch::Tensor>{output, output_indices});
+
+  auto handle = handle_manager.AllocateHandle();
+  auto enqueue_result = EnqueueTensorSparseAllreduce(
+      hvd_context, hvd_values, hvd_indices, ready_event,
+      GetOpName("sparse_allreduce", name, handle), device, deduplicate,
+      [handle](const Status& status) {
+        handle_manager.MarkDone(handle, status);
+      });
+  ThrowIfError(enqueue_result);
+
+  return handle;
+}
+
+int DoReducescatter(::torch::Tensor tensor, ::torch::Tensor output,
+                    const std::string& name) {
+  ThrowIfError(common::CheckInitialized());
+
+  auto device = GetDeviceID(tensor);
+  auto ready_event = RecordReadyEvent(device);
+  auto hvd_tensor = std::make_shared<TorchTensor>(tensor);
+  auto hvd_context = std::make_shared<TorchOpContext>(device, output);
+
+  auto handle = handle_manager.AllocateHandle();
+  auto enqueue_result = EnqueueTensorReducescatter(
+      hvd_context, hvd_tensor, ready_event,
+      GetOpName("reducescatter", name, handle), device,
+      [handle](const Status& status) {
+        handle_manager.MarkDone(handle, status);
+      });
+  ThrowIfError(enqueue_result);
+
+  return handle;
+}
+
+int DoAlltoall(::torch::Tensor tensor, ::torch::Tensor splits,
+               ::torch::Tensor output, const std::string& name) {
+  ThrowIfError(common::CheckInitialized());
+
+  auto device = GetDeviceID(tensor);
+  auto ready_event = RecordReadyEvent(device);
+  auto hvd_tensor = std::make_shared<TorchTensor>(tensor);
+  auto hvd_context = std::make_shared<TorchOpContext>(device, output);
+  auto splits_data = (int32_t*)splits.data_ptr();
+  std::vector<int32_t> splits_vector(splits_data,
+                                     splits_data + splits.numel());
+
+  auto handle = handle_manager.AllocateHandle();
+  auto enqueue_result = EnqueueTensorAlltoall(
+      hvd_context, hvd_tensor, std::move(splits_vector), ready_event,
+      GetOpName("alltoall", name, handle), device,
+      [handle](const Status& status) {
+        handle_manager.MarkDone(handle, status);
+      });
+  ThrowIfError(enqueue_result);
+
+  return handle;
+}
+
 int PollHandle(int handle) { return handle_manager.PollHandle(handle) ? 1 : 0; }
 
 void WaitAndClear(int handle) {
-  while (!handle_manager.PollHandle(handle)) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-  }
+  handle_manager.WaitHandles({handle});
   auto status = handle_manager.ReleaseHandle(handle);
   ThrowIfError(*status);
 }
 
+void WaitAllAndClear(const std::vector<int>& handles) {
+  handle_manager.WaitHandles(handles);
+  ThrowIfError(handle_manager.ReleaseHandles(handles));
+}
+
+int WaitAny(const std::vector<int>& handles) {
+  return handle_manager.WaitAnyHandle(handles);
+}
+
 PYBIND11_MODULE(mpi_lib_v2, m) {
   // allreduce
   m.def("horovod_torch_allreduce_async_torch_IntTensor", &DoAllreduce);
@@ -259,6 +495,41 @@ PYBIND11_MODULE(mpi_lib_v2, m) {
         &DoAllreduceCudaOnCPU);
 #endif
 
+  // grouped allreduce
+  m.def("horovod_torch_grouped_allreduce_async_torch_IntTensor",
+        &DoGroupedAllreduce);
+  m.def("horovod_torch_grouped_allreduce_async_torch_LongTensor",
+        &DoGroupedAllreduce);
+  m.def("horovod_torch_grouped_allreduce_async_torch_HalfTensor",
+        &DoGroupedAllreduce);
+  m.def("horovod_torch_grouped_allreduce_async_torch_FloatTensor",
+        &DoGroupedAllreduce);
+  m.def("horovod_torch_grouped_allreduce_async_torch_DoubleTensor",
+        &DoGroupedAllreduce);
+#if HOROVOD_GPU_ALLREDUCE
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_IntTensor",
+        &DoGroupedAllreduce);
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_LongTensor",
+        &DoGroupedAllreduce);
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_HalfTensor",
+        &DoGroupedAllreduce);
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_FloatTensor",
+        &DoGroupedAllreduce);
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_DoubleTensor",
+        &DoGroupedAllreduce);
+#else
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_IntTensor",
+        &DoGroupedAllreduceCudaOnCPU);
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_LongTensor",
+        &DoGroupedAllreduceCudaOnCPU);
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_HalfTensor",
+        &DoGroupedAllreduceCudaOnCPU);
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_FloatTensor",
+        &DoGroupedAllreduceCudaOnCPU);
+  m.def("horovod_torch_grouped_allreduce_async_torch_cuda_DoubleTensor",
+        &DoGroupedAllreduceCudaOnCPU);
+#endif
+
   // allgather
   m.def("horovod_torch_allgather_async_torch_ByteTensor", &DoAllgather);
   m.def("horovod_torch_allgather_async_torch_CharTensor", &DoAllgather);
@@ -333,9 +604,76 @@ PYBIND11_MODULE(mpi_lib_v2, m) {
         &DoBroadcastCudaOnCPU);
 #endif
 
+  // sparse allreduce
+  m.def("horovod_torch_sparse_allreduce_async_torch_ByteTensor",
+        &DoSparseAllreduce);
+  m.def("horovod_torch_sparse_allreduce_async_torch_CharTensor",
+        &DoSparseAllreduce);
+  m.def("horovod_torch_sparse_allreduce_async_torch_ShortTensor",
+        &DoSparseAllreduce);
+  m.def("horovod_torch_sparse_allreduce_async_torch_IntTensor",
+        &DoSparseAllreduce);
+  m.def("horovod_torch_sparse_allreduce_async_torch_LongTensor",
+        &DoSparseAllreduce);
+  m.def("horovod_torch_sparse_allreduce_async_torch_HalfTensor",
+        &DoSparseAllreduce);
+  m.def("horovod_torch_sparse_allreduce_async_torch_FloatTensor",
+        &DoSparseAllreduce);
+  m.def("horovod_torch_sparse_allreduce_async_torch_DoubleTensor",
+        &DoSparseAllreduce);
+
+  // reducescatter
+  m.def("horovod_torch_reducescatter_async_torch_IntTensor",
+        &DoReducescatter);
+  m.def("horovod_torch_reducescatter_async_torch_LongTensor",
+        &DoReducescatter);
+  m.def("horovod_torch_reducescatter_async_torch_HalfTensor",
+        &DoReducescatter);
+  m.def("horovod_torch_reducescatter_async_torch_FloatTensor",
+        &DoReducescatter);
+  m.def("horovod_torch_reducescatter_async_torch_DoubleTensor",
+        &DoReducescatter);
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+  m.def("horovod_torch_reducescatter_async_torch_cuda_IntTensor",
+        &DoReducescatter);
+  m.def("horovod_torch_reducescatter_async_torch_cuda_LongTensor",
+        &DoReducescatter);
+  m.def("horovod_torch_reducescatter_async_torch_cuda_HalfTensor",
+        &DoReducescatter);
+  m.def("horovod_torch_reducescatter_async_torch_cuda_FloatTensor",
+        &DoReducescatter);
+  m.def("horovod_torch_reducescatter_async_torch_cuda_DoubleTensor",
+        &DoReducescatter);
+#endif
+
+  // alltoall
+  m.def("horovod_torch_alltoall_async_torch_ByteTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_CharTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_ShortTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_IntTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_LongTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_HalfTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_FloatTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_DoubleTensor", &DoAlltoall);
+#if HOROVOD_GPU_ALLREDUCE == 'N'
+  m.def("horovod_torch_alltoall_async_torch_cuda_ByteTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_cuda_CharTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_cuda_ShortTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_cuda_IntTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_cuda_LongTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_cuda_HalfTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_cuda_FloatTensor", &DoAlltoall);
+  m.def("horovod_torch_alltoall_async_torch_cuda_DoubleTensor", &DoAlltoall);
+#endif
+
   // basics
   m.def("horovod_torch_poll", &PollHandle);
-  m.def("horovod_torch_wait_and_clear", &WaitAndClear);
+  m.def("horovod_torch_wait_and_clear", &WaitAndClear,
+        py::call_guard<py::gil_scoped_release>());
+  m.def("horovod_torch_wait_all_and_clear", &WaitAllAndClear,
+        py::call_guard<py::gil_scoped_release>());
+  m.def("horovod_torch_wait_any", &WaitAny,
+        py::call_guard<py::gil_scoped_release>());
 }
 
 } // namespace torch
@@ -18,6 +18,7 @@ import os
 from setuptools import setup, Extension, find_packages
 from setuptools.command.build_ext import build_ext
 from distutils.errors import CompileError, DistutilsError, DistutilsPlatformError, LinkError
+from distutils.spawn import find_executable
 from distutils.version import LooseVersion
 import shlex
 import subprocess
@@ -379,6 +380,35 @@ def get_cuda_dirs(build_ext, cpp_flags):
     return cuda_include_dirs, cuda_lib_dirs
 
 
+def get_nvcc_cmd():
+    cuda_home = os.environ.get('HOROVOD_CUDA_HOME')
+    if cuda_home:
+        return os.path.join(cuda_home, 'bin', 'nvcc')
+    return find_executable('nvcc') or '/usr/local/cuda/bin/nvcc'
+
+
+def build_cuda_objects(build_ext, options):
+    """Compiles the CUDA kernels of Horovod with nvcc and returns the object files."""
+    objects = []
+    for source in options['CUDA_SOURCES']:
+        object_file = os.path.join(build_ext.build_temp,
+                                   os.path.splitext(source)[0] + '.o')
+        object_dir = os.path.dirname(object_file)
+        if not os.path.exists(object_dir):
+            os.makedirs(object_dir)
+        try:
+            subprocess.check_call([options['NVCC'], '-c', source, '-o', object_file,
+                                   '-O3', '-std=c++11', '-Xcompiler', '-fPIC'] +
+                                  ['-I%s' % include for include in options['INCLUDES']])
+        except (OSError, subprocess.CalledProcessError):
+            raise DistutilsPlatformError(
+                'Failed to compile %s with nvcc (see error above).\n'
+                'Please make sure that nvcc can be found in HOROVOD_CUDA_HOME/bin, '
+                'in PATH or in /usr/local/cuda/bin.' % source)
+        objects.append(object_file)
+    return objects
+
+
 def get_nccl_vals(build_ext, cuda_include_dirs, cuda_lib_dirs, cpp_flags):
     nccl_include_dirs = []
     nccl_lib_dirs = []
@@ -457,14 +487,14 @@ def get_common_options(build_ext):
                              'values are "", "MPI", "NCCL", "DDL".' % gpu_allreduce)
 
     gpu_allgather = os.environ.get('HOROVOD_GPU_ALLGATHER')
-    if gpu_allgather and gpu_allgather != 'MPI':
+    if gpu_allgather and gpu_allgather != 'MPI' and gpu_allgather != 'NCCL':
         raise DistutilsError('HOROVOD_GPU_ALLGATHER=%s is invalid, supported '
-                             'values are "", "MPI".' % gpu_allgather)
+                             'values are "", "MPI", "NCCL".' % gpu_allgather)
 
     gpu_broadcast = os.environ.get('HOROVOD_GPU_BROADCAST')
-    if gpu_broadcast and gpu_broadcast != 'MPI':
+    if gpu_broadcast and gpu_broadcast != 'MPI' and gpu_broadcast != 'NCCL':
         raise DistutilsError('HOROVOD_GPU_BROADCAST=%s is invalid, supported '
-                             'values are "", "MPI".' % gpu_broadcast)
+                             'values are "", "MPI", "NCCL".' % gpu_broadcast)
 
     if gpu_allreduce or gpu_allgather or gpu_broadcast:
         have_cuda = True
@@ -473,7 +503,8 @@ def get_common_options(build_ext):
         have_cuda = False
         cuda_include_dirs = cuda_lib_dirs = []
 
-    if gpu_allreduce == 'NCCL':
+    if gpu_allreduce == 'NCCL' or gpu_allgather == 'NCCL' or \
+       gpu_broadcast == 'NCCL':
         have_nccl = True
         nccl_include_dirs, nccl_lib_dirs, nccl_libs = get_nccl_vals(
             build_ext, cuda_include_dirs, cuda_lib_dirs, cpp_flags)
@@ -488,7 +519,8 @@ def get_common_options(build_ext):
         have_ddl = False
         ddl_include_dirs = ddl_lib_dirs = []
 
-    if (gpu_allreduce == 'NCCL' and (gpu_allgather == 'MPI' or gpu_broadcast == 'MPI')
+    gpu_ops = [gpu_allreduce, gpu_allgather, gpu_broadcast]
+    if ('NCCL' in gpu_ops and 'MPI' in gpu_ops
             and not os.environ.get('HOROVOD_ALLOW_MIXED_GPU_IMPL')):
         raise DistutilsError('You should not mix NCCL and MPI GPU due to a possible deadlock.\n'
                              'If you\'re sure you want to mix them, set the '
@@ -511,15 +543,27 @@ def get_common_options(build_ext):
                 'third_party/boost/type_traits/include',
                 'third_party/boost/utility/include']
     SOURCES = ['horovod/common/common.cc',
+               'horovod/common/affinity.cc',
                'horovod/common/fusion_buffer_manager.cc',
+               'horovod/common/memcpy_pool.cc',
+               'horovod/common/metrics.cc',
                'horovod/common/mpi_message.cc',
                'horovod/common/half.cc',
                'horovod/common/operations.cc',
                'horovod/common/parameter_manager.cc',
+               'horovod/common/quantization.cc',
+               'horovod/common/replay.cc',
+               'horovod/common/response_cache.cc',
+               'horovod/common/gradient_accumulation.cc',
+               'horovod/common/tensor_partition.cc',
+               'horovod/common/tcp_ring.cc',
+               'horovod/common/tensor_queue.cc',
                'horovod/common/timeline.cc',
                'horovod/common/optim/bayesian_optimization.cc',
                'horovod/common/optim/gaussian_process.cc',
                'horovod/common/logging.cc']
+    CUDA_SOURCES = []
+    NVCC = None
     COMPILE_FLAGS = cpp_flags + shlex.split(mpi_flags)
     LINK_FLAGS = link_flags + shlex.split(mpi_flags)
     LIBRARY_DIRS = []
@@ -528,6 +572,8 @@ def get_common_options(build_ext):
     if have_cuda:
         MACROS += [('HAVE_CUDA', '1')]
         INCLUDES += cuda_include_dirs
+        CUDA_SOURCES += ['horovod/common/cuda_kernels.cu']
+        NVCC = get_nvcc_cmd()
         LIBRARY_DIRS += cuda_lib_dirs
         LIBRARIES += ['cudart']
 
@@ -555,6 +601,8 @@ def get_common_options(build_ext):
     return dict(MACROS=MACROS,
                 INCLUDES=INCLUDES,
                 SOURCES=SOURCES,
+                CUDA_SOURCES=CUDA_SOURCES,
+                NVCC=NVCC,
                 COMPILE_FLAGS=COMPILE_FLAGS,
                 LINK_FLAGS=LINK_FLAGS,
                 LIBRARY_DIRS=LIBRARY_DIRS,
@@ -575,6 +623,7 @@ def build_tf_extension(build_ext, options):
     tensorflow_mpi_lib.extra_link_args = options['LINK_FLAGS'] + tf_link_flags
     tensorflow_mpi_lib.library_dirs = options['LIBRARY_DIRS']
     tensorflow_mpi_lib.libraries = options['LIBRARIES']
+    tensorflow_mpi_lib.extra_objects = build_cuda_objects(build_ext, options)
 
     build_ext.build_extension(tensorflow_mpi_lib)
 
@@ -610,6 +659,7 @@ def build_mx_extension(build_ext, options):
     mxnet_mpi_lib.sources = options['SOURCES'] + \
         ['horovod/mxnet/mpi_ops.cc',
          'horovod/mxnet/ready_event.cc',
+         'horovod/mxnet/staging_pool.cc',
          'horovod/mxnet/tensor_util.cc',
          'horovod/mxnet/cuda_util.cc',
          'horovod/mxnet/adapter.cc']
@@ -618,6 +668,7 @@ def build_mx_extension(build_ext, options):
     mxnet_mpi_lib.extra_link_args = options['LINK_FLAGS'] + mx_link_flags
     mxnet_mpi_lib.library_dirs = options['LIBRARY_DIRS']
     mxnet_mpi_lib.libraries = options['LIBRARIES']
+    mxnet_mpi_lib.extra_objects = build_cuda_objects(build_ext, options)
 
     build_ext.build_extension(mxnet_mpi_lib)
 
@@ -763,6 +814,8 @@ def build_torch_extension(build_ext, options, torch_version):
         # ffi_ext is distutils Extension, not setuptools Extension
         for k, v in ffi_ext.__dict__.items():
             setuptools_ext.__dict__[k] = v
+        if setuptools_ext is torch_mpi_lib_impl and have_cuda:
+            setuptools_ext.extra_objects = build_cuda_objects(build_ext, options)
         build_ext.build_extension(setuptools_ext)
 
 
@@ -810,7 +863,9 @@ def build_torch_extension_v2(build_ext, options, torch_version):
                          extra_compile_args=options['COMPILE_FLAGS'],
                          extra_link_args=options['LINK_FLAGS'],
                          library_dirs=options['LIBRARY_DIRS'],
-                         libraries=options['LIBRARIES'])
+                         libraries=options['LIBRARIES'],
+                         extra_objects=build_cuda_objects(build_ext, options)
+                         if have_cuda else [])
 
     # Patch an existing torch_mpi_lib_v2 extension object.
     for k, v in ext.__dict__.items():
@@ -0,0 +1,579 @@
+// Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Benchmark of the Horovod engine without a framework. Every step enqueues a
+// number of tensors with mock implementations of the interfaces of common.h
+// and waits for all of them to be done. The outputs of the last step are
+// checked against the expected result. The time of the phases of the
+// operations is taken from a binary timeline written on rank 0.
+//
+// See docs/benchmarks.md for how to build and run it.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include "horovod/common/common.h"
+#include "horovod/common/half.h"
+#include "horovod/common/operations.h"
+#include "horovod/common/timeline.h"
+
+using namespace horovod::common;
+
+namespace {
+
+class BenchmarkPersistentBuffer : public PersistentBuffer {
+public:
+  explicit BenchmarkPersistentBuffer(int64_t size) : data_(size) {}
+  const void* AccessData(std::shared_ptr<OpContext> context) const override {
+    return data_.data();
+  }
+
+private:
+  std::vector<uint8_t> data_;
+};
+
+class BenchmarkTensor : public Tensor {
+public:
+  BenchmarkTensor(MPIDataType dtype, TensorShape shape, int element_size)
+      : dtype_(dtype), shape_(shape),
+        data_(shape.num_elements() * element_size) {}
+  const MPIDataType dtype() const override { return dtype_; }
+  const TensorShape shape() const override { return shape_; }
+  const void* data() const override { return data_.data(); }
+  int64_t size() const override { return (int64_t)data_.size(); }
+  void* mutable_data() { return data_.data(); }
+
+private:
+  MPIDataType dtype_;
+  TensorShape shape_;
+  std::vector<uint8_t> data_;
+};
+
+class BenchmarkOpContext : public OpContext {
+public:
+  BenchmarkOpContext(MPIDataType dtype, int element_size)
+      : dtype_(dtype), element_size_(element_size) {}
+  Status
+  AllocatePersistent(int64_t size,
+                     std::shared_ptr<PersistentBuffer>* tensor) override {
+    *tensor = std::make_shared<BenchmarkPersistentBuffer>(size);
+    return Status::OK();
+  }
+  Status AllocateOutput(TensorShape shape,
+                        std::shared_ptr<Tensor>* tensor) override {
+    *tensor = std::make_shared<BenchmarkTensor>(dtype_, shape, element_size_);
+    output_ = *tensor;
+    return Status::OK();
+  }
+  Framework framework() const override { return PYTORCH; }
+
+  // Returns the output allocated last, which is the output of an allgather.
+  std::shared_ptr<Tensor> output() const { return output_; }
+
+private:
+  MPIDataType dtype_;
+  int element_size_;
+  std::shared_ptr<Tensor> output_;
+};
+
+struct Options {
+  std::string op = "allreduce";
+  std::string dtype = "float32";
+  // Sizes of the tensors: "fixed" uses max_bytes, "uniform" and "log-uniform"
+  // draw sizes between min_bytes and max_bytes.
+  std::string distribution = "fixed";
+  int64_t min_bytes = 1024;
+  int64_t max_bytes = 4 * 1024 * 1024;
+  int tensors = 64;
+  int steps = 100;
+  int warmup_steps = 10;
+  // Passed on as HOROVOD_FUSION_THRESHOLD and HOROVOD_CYCLE_TIME if set.
+  std::string fusion_threshold;
+  std::string cycle_time;
+};
+
+void PrintUsage() {
+  std::cerr
+      << "Usage: engine_benchmark [--op=allreduce|allgather|broadcast]\n"
+         "    [--dtype=float16|float32|float64|int32|int64|uint8]\n"
+         "    [--distribution=fixed|uniform|log-uniform]\n"
+         "    [--min-bytes=N] [--max-bytes=N] [--tensors=N] [--steps=N]\n"
+         "    [--warmup-steps=N] [--fusion-threshold=BYTES]\n"
+         "    [--cycle-time=MS]\n";
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      return false;
+    }
+    auto name = arg.substr(2, eq - 2);
+    auto value = arg.substr(eq + 1);
+    if (name == "op") {
+      options.op = value;
+    } else if (name == "dtype") {
+      options.dtype = value;
+    } else if (name == "distribution") {
+      options.distribution = value;
+    } else if (name == "min-bytes") {
+      options.min_bytes = std::strtoll(value.c_str(), nullptr, 10);
+    } else if (name == "max-bytes") {
+      options.max_bytes = std::strtoll(value.c_str(), nullptr, 10);
+    } else if (name == "tensors") {
+      options.tensors = std::atoi(value.c_str());
+    } else if (name == "steps") {
+      options.steps = std::atoi(value.c_str());
+    } else if (name == "warmup-steps") {
+      options.warmup_steps = std::atoi(value.c_str());
+    } else if (name == "fusion-threshold") {
+      options.fusion_threshold = value;
+    } else if (name == "cycle-time") {
+      options.cycle_time = value;
+    } else {
+      return false;
+    }
+  }
+  if (options.op != "allreduce" && options.op != "allgather" &&
+      options.op != "broadcast") {
+    return false;
+  }
+  if (options.distribution != "fixed" && options.distribution != "uniform" &&
+      options.distribution != "log-uniform") {
+    return false;
+  }
+  return options.min_bytes > 0 && options.max_bytes >= options.min_bytes &&
+         options.tensors > 0 && options.steps > 0 && options.warmup_steps >= 0;
+}
+
+bool ParseDataType(const std::string& name, MPIDataType& dtype,
+                   int& element_size) {
+  static const std::map<std::string, std::pair<MPIDataType, int>> dtypes = {
+      {"float16", {HOROVOD_FLOAT16, 2}}, {"float32", {HOROVOD_FLOAT32, 4}},
+      {"float64", {HOROVOD_FLOAT64, 8}}, {"int32", {HOROVOD_INT32, 4}},
+      {"int64", {HOROVOD_INT64, 8}},     {"uint8", {HOROVOD_UINT8, 1}}};
+  auto it = dtypes.find(name);
+  if (it == dtypes.end()) {
+    return false;
+  }
+  dtype = it->second.first;
+  element_size = it->second.second;
+  return true;
+}
+
+// Draws the number of elements of every tensor. The generator is seeded the
+// same way on all ranks, so that all ranks enqueue the same tensors.
+std::vector<int64_t> TensorElements(const Options& options,
+                                    int element_size) {
+  std::mt19937_64 generator(1234);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::vector<int64_t> elements;
+  for (int i = 0; i < options.tensors; ++i) {
+    double bytes = (double)options.max_bytes;
+    if (options.distribution == "uniform") {
+      bytes = options.min_bytes +
+              uniform(generator) * (options.max_bytes - options.min_bytes);
+    } else if (options.distribution == "log-uniform") {
+      bytes = options.min_bytes *
+              std::pow((double)options.max_bytes / options.min_bytes,
+                       uniform(generator));
+    }
+    elements.push_back(std::max((int64_t)(bytes / element_size), (int64_t)1));
+  }
+  return elements;
+}
+
+// Sets all elements of a tensor to value.
+void FillTensor(BenchmarkTensor& tensor, int64_t value) {
+  auto data = tensor.mutable_data();
+  int64_t count = tensor.shape().num_elements();
+  for (int64_t i = 0; i < count; ++i) {
+    switch (tensor.dtype()) {
+    case HOROVOD_FLOAT16: {
+      float f = (float)value;
+      Float2HalfBits(&f, (unsigned short*)data + i);
+      break;
+    }
+    case HOROVOD_FLOAT32:
+      ((float*)data)[i] = (float)value;
+      break;
+    case HOROVOD_FLOAT64:
+      ((double*)data)[i] = (double)value;
+      break;
+    case HOROVOD_INT32:
+      ((int32_t*)data)[i] = (int32_t)value;
+      break;
+    case HOROVOD_INT64:
+      ((int64_t*)data)[i] = value;
+      break;
+    default:
+      ((uint8_t*)data)[i] = (uint8_t)value;
+      break;
+    }
+  }
+}
+
+// Returns whether count elements of a tensor from the given one on are all
+// equal to value, which wraps around for uint8 like the sums of MPI do.
+bool TensorEquals(const Tensor& tensor, int64_t begin, int64_t count,
+                  int64_t value) {
+  auto data = tensor.data();
+  for (int64_t i = begin; i < begin + count; ++i) {
+    bool equal;
+    switch (tensor.dtype()) {
+    case HOROVOD_FLOAT16: {
+      float f;
+      HalfBits2Float((unsigned short*)data + i, &f);
+      equal = f == (float)value;
+      break;
+    }
+    case HOROVOD_FLOAT32:
+      equal = ((const float*)data)[i] == (float)value;
+      break;
+    case HOROVOD_FLOAT64:
+      equal = ((const double*)data)[i] == (double)value;
+      break;
+    case HOROVOD_INT32:
+      equal = ((const int32_t*)data)[i] == (int32_t)value;
+      break;
+    case HOROVOD_INT64:
+      equal = ((const int64_t*)data)[i] == value;
+      break;
+    default:
+      equal = ((const uint8_t*)data)[i] == (uint8_t)value;
+      break;
+    }
+    if (!equal) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Checks the outputs of a step. Every rank contributes rank + 1 to all
+// elements, and rank 0 is the root of broadcasts.
+bool CheckOutputs(const Options& options, int rank, int size,
+                  const std::vector<int64_t>& elements,
+                  const std::vector<std::shared_ptr<Tensor>>& outputs,
+                  const std::vector<std::shared_ptr<BenchmarkOpContext>>&
+                      contexts) {
+  for (size_t i = 0; i < elements.size(); ++i) {
+    bool valid;
+    if (options.op == "allreduce") {
+      valid = TensorEquals(*outputs[i], 0, elements[i],
+                           (int64_t)size * (size + 1) / 2);
+    } else if (options.op == "allgather") {
+      auto output = contexts[i]->output();
+      valid = output != nullptr &&
+              output->shape().num_elements() == elements[i] * size;
+      for (int rc = 0; valid && rc < size; ++rc) {
+        valid = TensorEquals(*output, rc * elements[i], elements[i], rc + 1);
+      }
+    } else {
+      // Frameworks broadcast in place, so the output of the root is unused.
+      valid = rank == 0 || TensorEquals(*outputs[i], 0, elements[i], 1);
+    }
+    if (!valid) {
+      std::cerr << "Rank " << rank << ": wrong result of the " << options.op
+                << " of tensor " << i << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Counts outstanding operations of a step.
+class StepLatch {
+public:
+  void Reset(int count) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    pending_ = count;
+    status_ = Status::OK();
+  }
+  void Done(const Status& status) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!status.ok()) {
+      status_ = status;
+    }
+    if (--pending_ == 0) {
+      cv_.notify_all();
+    }
+  }
+  Status Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return pending_ == 0; });
+    return status_;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int pending_ = 0;
+  Status status_;
+};
+
+Status RunStep(const Options& options, const std::string& prefix,
+               std::vector<std::shared_ptr<Tensor>>& tensors,
+               std::vector<std::shared_ptr<Tensor>>& outputs,
+               std::vector<std::shared_ptr<BenchmarkOpContext>>& contexts,
+               StepLatch& latch) {
+  latch.Reset((int)tensors.size());
+  auto callback = [&latch](const Status& status) { latch.Done(status); };
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    auto name = prefix + std::to_string(i);
+    auto& context = contexts[i];
+    Status status;
+    if (options.op == "allreduce") {
+      status = EnqueueTensorAllreduce(context, tensors[i], outputs[i], nullptr,
+                                      name, CPU_DEVICE_ID, callback);
+    } else if (options.op == "allgather") {
+      status = EnqueueTensorAllgather(context, tensors[i], nullptr, name,
+                                      CPU_DEVICE_ID, callback);
+    } else {
+      status = EnqueueTensorBroadcast(context, tensors[i], outputs[i], 0,
+                                      nullptr, name, CPU_DEVICE_ID, callback);
+    }
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return latch.Wait();
+}
+
+struct PhaseStats {
+  int64_t count = 0;
+  int64_t total_micros = 0;
+};
+
+// Sums up the time of every phase in a binary timeline, leaving out the
+// tensors of the warmup steps. Every tensor of a fused operation has its own
+// activities, which begin and end at slightly different times, so the
+// activities of a phase are merged where they overlap. A phase then counts
+// the wall time during which any tensor was in it, and the number of
+// separate intervals, which is the number of operations for the phases of
+// operations performed one after another by the background thread.
+bool ReadPhases(const std::string& file_name,
+                std::map<std::string, PhaseStats>& phases) {
+  std::ifstream file(file_name, std::ios::in | std::ios::binary);
+  char magic[8];
+  int32_t header[2];
+  if (!file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, "HVDTLBIN", sizeof(magic)) != 0 ||
+      !file.read((char*)header, sizeof(header)) ||
+      header[0] != TIMELINE_BINARY_VERSION ||
+      header[1] != (int32_t)sizeof(TimelineBinaryRecord)) {
+    return false;
+  }
+
+  std::vector<std::string> strings(1);
+  std::map<int32_t, std::vector<std::pair<int32_t, int64_t>>> open_events;
+  std::map<int32_t, std::vector<std::pair<int64_t, int64_t>>> intervals;
+  TimelineBinaryRecord r;
+  while (file.read((char*)&r, sizeof(r))) {
+    if (r.type == 'S') {
+      std::string s(r.args_id, '\0');
+      file.read(&s[0], r.args_id);
+      if ((int32_t)strings.size() <= r.name_id) {
+        strings.resize(r.name_id + 1);
+      }
+      strings[r.name_id] = s;
+      continue;
+    }
+    if (r.type != 'E') {
+      continue;
+    }
+    auto& stack = open_events[r.tensor_id];
+    if (r.phase == 'B') {
+      stack.emplace_back(r.name_id, r.ts_micros);
+    } else if (r.phase == 'E' && !stack.empty()) {
+      auto& tensor_name = strings[r.tensor_id];
+      if (tensor_name.compare(0, 7, "warmup.") != 0) {
+        intervals[stack.back().first].emplace_back(stack.back().second,
+                                                   r.ts_micros);
+      }
+      stack.pop_back();
+    }
+  }
+
+  for (auto& phase : intervals) {
+    auto& spans = phase.second;
+    std::sort(spans.begin(), spans.end());
+    auto& stats = phases[strings[phase.first]];
+    int64_t begin = spans[0].first;
+    int64_t end = spans[0].second;
+    for (size_t i = 1; i <= spans.size(); ++i) {
+      if (i < spans.size() && spans[i].first <= end) {
+        end = std::max(end, spans[i].second);
+        continue;
+      }
+      ++stats.count;
+      stats.total_micros += end - begin;
+      if (i < spans.size()) {
+        begin = spans[i].first;
+        end = spans[i].second;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  MPIDataType dtype;
+  int element_size;
+  if (!ParseOptions(argc, argv, options) ||
+      !ParseDataType(options.dtype, dtype, element_size)) {
+    PrintUsage();
+    return 1;
+  }
+
+  // The timeline is only written by rank 0, which removes it at the end.
+  std::string timeline_file;
+  if (std::getenv(HOROVOD_TIMELINE) == nullptr) {
+    timeline_file = "/tmp/horovod_engine_benchmark." +
+                    std::to_string(getpid()) + ".timeline";
+    setenv(HOROVOD_TIMELINE, timeline_file.c_str(), 1);
+    setenv(HOROVOD_TIMELINE_FORMAT, "binary", 1);
+  }
+  if (!options.fusion_threshold.empty()) {
+    setenv(HOROVOD_FUSION_THRESHOLD, options.fusion_threshold.c_str(), 1);
+  }
+  if (!options.cycle_time.empty()) {
+    setenv(HOROVOD_CYCLE_TIME, options.cycle_time.c_str(), 1);
+  }
+
+  horovod_init(nullptr, 0);
+  int rank = horovod_rank();
+  int size = horovod_size();
+
+  auto elements = TensorElements(options, element_size);
+  std::vector<std::shared_ptr<BenchmarkOpContext>> contexts;
+  std::vector<std::shared_ptr<Tensor>> tensors;
+  std::vector<std::shared_ptr<Tensor>> outputs;
+  int64_t step_bytes = 0;
+  for (auto n : elements) {
+    TensorShape shape;
+    shape.AddDim(n);
+    contexts.push_back(
+        std::make_shared<BenchmarkOpContext>(dtype, element_size));
+    auto tensor = std::make_shared<BenchmarkTensor>(dtype, shape, element_size);
+    FillTensor(*tensor, rank + 1);
+    tensors.push_back(tensor);
+    outputs.push_back(
+        std::make_shared<BenchmarkTensor>(dtype, shape, element_size));
+    // Like in the NCCL tests, the bandwidth of an allgather is computed from
+    // the size of its output.
+    step_bytes += n * element_size * (options.op == "allgather" ? size : 1);
+  }
+
+  StepLatch latch;
+  for (int i = 0; i < options.warmup_steps; ++i) {
+    auto status =
+        RunStep(options, "warmup.", tensors, outputs, contexts, latch);
+    if (!status.ok()) {
+      std::cerr << "Warmup step failed: " << status.reason() << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<double> step_micros;
+  for (int i = 0; i < options.steps; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    auto status =
+        RunStep(options, "tensor.", tensors, outputs, contexts, latch);
+    if (!status.ok()) {
+      std::cerr << "Step failed: " << status.reason() << std::endl;
+      return 1;
+    }
+    step_micros.push_back(
+        std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+
+  bool valid = CheckOutputs(options, rank, size, elements, outputs, contexts);
+
+  // Shutting down writes out the rest of the timeline.
+  horovod_shutdown();
+  if (!valid) {
+    return 1;
+  }
+  if (rank != 0) {
+    return 0;
+  }
+
+  double bus_factor = 1.0;
+  if (options.op == "allreduce") {
+    bus_factor = 2.0 * (size - 1) / size;
+  } else if (options.op == "allgather") {
+    bus_factor = (double)(size - 1) / size;
+  }
+  std::sort(step_micros.begin(), step_micros.end());
+  double mean_micros = 0;
+  for (auto micros : step_micros) {
+    mean_micros += micros / step_micros.size();
+  }
+  double algorithm_bandwidth = step_bytes / mean_micros * 1e6;
+
+  std::printf("%s of %d %s tensors, %lld bytes per step, %d ranks\n",
+              options.op.c_str(), options.tensors, options.dtype.c_str(),
+              (long long)step_bytes, size);
+  std::printf("step time: mean %.1f us, median %.1f us, max %.1f us\n",
+              mean_micros, step_micros[step_micros.size() / 2],
+              step_micros.back());
+  std::printf("algorithm bandwidth: %.3f GB/s, bus bandwidth: %.3f GB/s\n",
+              algorithm_bandwidth / 1e9, algorithm_bandwidth * bus_factor / 1e9);
+
+  auto timeline = std::getenv(HOROVOD_TIMELINE);
+  auto timeline_format = std::getenv(HOROVOD_TIMELINE_FORMAT);
+  std::map<std::string, PhaseStats> phases;
+  if (timeline_format == nullptr || std::string(timeline_format) != "binary") {
+    std::printf("set HOROVOD_TIMELINE_FORMAT=binary for the time of phases\n");
+  } else if (!ReadPhases(timeline, phases)) {
+    std::printf("could not read the timeline %s\n", timeline);
+  } else {
+    std::printf("%-32s %10s %14s %14s\n", "phase", "count", "mean us",
+                "per step us");
+    for (auto& phase : phases) {
+      std::printf("%-32s %10lld %14.1f %14.1f\n", phase.first.c_str(),
+                  (long long)phase.second.count,
+                  (double)phase.second.total_micros / phase.second.count,
+                  (double)phase.second.total_micros / options.steps);
+    }
+  }
+  if (!timeline_file.empty()) {
+    std::remove(timeline_file.c_str());
+  }
+  return 0;
+}
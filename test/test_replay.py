@@ -0,0 +1,73 @@
+# Copyright 2019 Uber Technologies, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import os
+import shutil
+import tempfile
+import torch
+import unittest
+import warnings
+
+import horovod.torch as hvd
+
+from common import env
+
+
+class ReplayTests(unittest.TestCase):
+    """
+    Tests for recording and replaying operations in horovod.torch.
+    """
+
+    def __init__(self, *args, **kwargs):
+        super(ReplayTests, self).__init__(*args, **kwargs)
+        warnings.simplefilter('module')
+
+    def test_enqueue_replay(self):
+        """Test that recorded steps are replayed with the recorded tensors."""
+        dir = tempfile.mkdtemp()
+        try:
+            recording = os.path.join(dir, 'recording')
+            with env(HOROVOD_ENQUEUE_RECORDING=recording):
+                hvd.init()
+
+                for _ in range(3):
+                    hvd.allreduce(torch.ones(17), name='test_replay.0')
+                    hvd.allreduce(torch.ones(4, 5), name='test_replay.1')
+                    hvd.broadcast(torch.ones(3), root_rank=0,
+                                  name='test_replay.2')
+
+            with open(recording + '.' + str(hvd.rank())) as f:
+                assert f.readline().startswith('HVDREPLAY\t1\t%d\t%d' %
+                                               (hvd.rank(), hvd.size()))
+
+            report = os.path.join(dir, 'report.json')
+            steps = hvd.replay(recording, report)
+            assert len(steps) == 3, steps
+            for step in steps:
+                assert step['tensors'] == 3, step
+                assert step['bytes'] == (17 + 20 + 3) * 4, step
+                assert step['errors'] == 0, step
+                assert step['micros'] >= step['communication_micros'], step
+            assert os.path.exists(report)
+        finally:
+            shutil.rmtree(dir)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -28,6 +28,7 @@ from tensorflow.python.framework import ops
 import warnings
 
 import horovod.tensorflow as hvd
+import horovod.tensorflow.mpi_ops as mpi_ops
 
 from common import mpi_env_rank_and_size
 
@@ -104,6 +105,92 @@ class MPITests(tf.test.TestCase):
             self.assertTrue(diff <= threshold,
                             "hvd.allreduce produces incorrect results")
 
+    def test_horovod_grouped_allreduce_cpu(self):
+        """Test on CPU that the grouped allreduce correctly sums a list of
+        tensors of different types and shapes."""
+        hvd.init()
+        size = hvd.size()
+        with tf.device("/cpu:0"):
+            tensors = [tf.ones([17] * dim, dtype=dtype) * (dim + 1)
+                       for dtype in [tf.int32, tf.float32, tf.float64]
+                       for dim in [1, 2, 3]]
+            summed = hvd.grouped_allreduce(tensors, average=False)
+        results = self.evaluate(summed)
+        for tensor, result in zip(tensors, results):
+            self.assertEqual(list(result.shape), tensor.get_shape().as_list())
+            self.assertTrue(np.all(result == (len(result.shape) + 1) * size),
+                            "hvd.grouped_allreduce produces incorrect results")
+
+    def test_horovod_allreduce_cpu_average(self):
+        """Test on CPU that the allreduce correctly averages tensors, which
+        Horovod scales while copying them out of the fusion buffer for floating
+        point types."""
+        hvd.init()
+        size = hvd.size()
+        dtypes = [tf.int32, tf.int64, tf.float16, tf.float32, tf.float64]
+        for dtype in dtypes:
+            with tf.device("/cpu:0"):
+                tensor = tf.ones([17, 17], dtype=dtype) * 4 * size
+                averaged = hvd.allreduce(tensor, average=True)
+            result = self.evaluate(averaged)
+            self.assertTrue(np.all(result == 4 * size),
+                            "hvd.allreduce produces incorrect results")
+
+    def test_horovod_allreduce_cpu_bfloat16(self):
+        """Test on CPU that the allreduce correctly sums and averages bfloat16
+        tensors."""
+        hvd.init()
+        size = hvd.size()
+        with tf.device("/cpu:0"):
+            # Small integers are exact in bfloat16.
+            tensor = tf.cast(tf.reshape(tf.range(17 * 17) % 7, [17, 17]),
+                             tf.bfloat16)
+            summed = hvd.allreduce(tensor, average=False)
+            averaged = hvd.allreduce(tensor * size, average=True)
+        expected = self.evaluate(tf.cast(tensor, tf.float32))
+        summed, averaged = self.evaluate([tf.cast(summed, tf.float32),
+                                          tf.cast(averaged, tf.float32)])
+        self.assertTrue(np.all(summed == expected * size),
+                        "hvd.allreduce produces incorrect results")
+        self.assertTrue(np.all(averaged == expected),
+                        "hvd.allreduce produces incorrect results")
+
+    def test_horovod_allreduce_cpu_prescale_postscale(self):
+        """Test on CPU that the allreduce scales tensors before and after
+        they are summed up."""
+        hvd.init()
+        size = hvd.size()
+        for dtype in [tf.float16, tf.float32, tf.float64]:
+            with tf.device("/cpu:0"):
+                tensor = tf.ones([17, 17], dtype=dtype)
+                scaled = mpi_ops._allreduce(tensor, prescale_factor=4.0,
+                                            postscale_factor=0.5)
+            result = self.evaluate(scaled)
+            self.assertTrue(np.all(result == 2 * size),
+                            "hvd.allreduce produces incorrect results")
+
+    def test_horovod_allreduce_cpu_fp16_fused(self):
+        """Test on CPU that the allreduce with compression in the fusion buffer
+        correctly sums float32 tensors and leaves other types uncompressed."""
+        hvd.init()
+        size = hvd.size()
+        dtypes = [tf.int32, tf.float32, tf.float64]
+        dims = [1, 2, 3]
+        for dtype, dim in itertools.product(dtypes, dims):
+            with tf.device("/cpu:0"):
+                tf.set_random_seed(1234)
+                # Small integers are exact in float16.
+                tensor = tf.cast(tf.random_uniform(
+                    [17] * dim, -100, 100, dtype=tf.int32), dtype)
+                summed = hvd.allreduce(tensor, average=False,
+                                       compression=hvd.Compression.fp16_fused)
+            multiplied = tensor * size
+            max_difference = tf.reduce_max(tf.abs(summed - multiplied))
+
+            diff = self.evaluate(max_difference)
+            self.assertTrue(diff == 0,
+                            "hvd.allreduce produces incorrect results")
+
     def test_horovod_allreduce_cpu_fused(self):
         """Test on CPU that the allreduce correctly sums 1D, 2D, 3D tensors
         with Tensor Fusion."""
@@ -555,6 +642,78 @@ class MPITests(tf.test.TestCase):
                         tf.equal(tf.cast(rank_tensor, tf.int32), value))),
                     "hvd.allgather produces incorrect gathered tensor")
 
+    def test_horovod_sparse_allreduce_cpu(self):
+        """Test that the sparse allreduce gathers the rows and indices of all
+        ranks, and sums up rows with the same index if asked to."""
+        hvd.init()
+        rank = hvd.rank()
+        size = hvd.size()
+
+        with tf.device("/cpu:0"):
+            # Every rank sends a row for index 0 and one for index rank + 1.
+            values = tf.ones([2, 5], dtype=tf.float32) * (rank + 1)
+            indices = tf.constant([0, rank + 1], dtype=tf.int32)
+            gathered, gathered_indices = self.evaluate(
+                hvd.sparse_allreduce(values, indices))
+            summed, summed_indices = self.evaluate(
+                hvd.sparse_allreduce(values, indices, deduplicate=True))
+
+        expected_indices = []
+        for i in range(size):
+            expected_indices += [0, i + 1]
+        self.assertEqual(list(gathered_indices), expected_indices)
+        self.assertEqual(list(gathered.shape), [2 * size, 5])
+        for i in range(size):
+            self.assertTrue(np.all(gathered[2 * i:2 * i + 2] == i + 1),
+                            "hvd.sparse_allreduce produces incorrect rows")
+
+        self.assertEqual(list(summed_indices), list(range(size + 1)))
+        self.assertEqual(list(summed.shape), [size + 1, 5])
+        self.assertTrue(np.all(summed[0] == size * (size + 1) / 2),
+                        "hvd.sparse_allreduce produces incorrect sums")
+        for i in range(size):
+            self.assertTrue(np.all(summed[i + 1] == i + 1),
+                            "hvd.sparse_allreduce produces incorrect sums")
+
+    def test_horovod_reducescatter_cpu(self):
+        """Test that the reducescatter sums the tensor and returns the rows of
+        the sum that belong to this rank."""
+        hvd.init()
+        rank = hvd.rank()
+        size = hvd.size()
+
+        with tf.device("/cpu:0"):
+            # The rows can't be split up evenly, the first rank gets one more.
+            tensor = tf.tile(tf.reshape(tf.range(2 * size + 1, dtype=tf.float32),
+                                        [-1, 1]), [1, 3])
+            reduced = self.evaluate(hvd.reducescatter(tensor))
+
+        rows = 3 if rank == 0 else 2
+        offset = 0 if rank == 0 else 2 * rank + 1
+        self.assertEqual(list(reduced.shape), [rows, 3])
+        for i in range(rows):
+            self.assertTrue(np.all(reduced[i] == (offset + i) * size),
+                            "hvd.reducescatter produces incorrect results")
+
+    def test_horovod_alltoall_cpu(self):
+        """Test that the alltoall sends the rows given by the splits to every
+        rank."""
+        hvd.init()
+        rank = hvd.rank()
+        size = hvd.size()
+
+        with tf.device("/cpu:0"):
+            # Every rank sends i + 1 rows holding its rank to rank i.
+            splits = [i + 1 for i in range(size)]
+            tensor = tf.ones([sum(splits), 4], dtype=tf.int32) * rank
+            received = self.evaluate(hvd.alltoall(tensor, splits=splits))
+
+        self.assertEqual(list(received.shape), [(rank + 1) * size, 4])
+        for i in range(size):
+            rows = received[i * (rank + 1):(i + 1) * (rank + 1)]
+            self.assertTrue(np.all(rows == i),
+                            "hvd.alltoall produces incorrect results")
+
     def test_horovod_allgather_error(self):
         """Test that the allgather returns an error if any dimension besides
         the first is different among the tensors being gathered."""
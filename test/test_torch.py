@@ -31,7 +31,14 @@ import warnings
 
 import horovod.torch as hvd
 
-from common import mpi_env_rank_and_size
+from common import env, mpi_env_rank_and_size
+
+# Importing mpi4py initializes MPI, so that Horovod does not finalize it on
+# hvd.shutdown() and can be restarted with different settings.
+try:
+    from mpi4py import MPI
+except ImportError:
+    MPI = None
 
 _fp16_supported = LooseVersion(torch.__version__) >= LooseVersion('1.0.0')
 
@@ -56,6 +63,13 @@ class TorchTests(unittest.TestCase):
                 result.append(value)
         return result
 
+    def restart_horovod(self, **kwargs):
+        # Settings are read when Horovod starts, so restart it with the given
+        # environment variables set.
+        hvd.shutdown()
+        with env(**kwargs):
+            hvd.init()
+
     def test_horovod_rank(self):
         """Test that the rank returned by hvd.rank() is correct."""
         true_rank, _ = mpi_env_rank_and_size()
@@ -70,6 +84,54 @@ class TorchTests(unittest.TestCase):
         size = hvd.size()
         assert true_size == size
 
+    def test_horovod_metrics(self):
+        """Test that hvd.metrics() counts allreduces and their bytes."""
+        hvd.init()
+        before = hvd.metrics()
+        tensor = torch.FloatTensor(1024).fill_(1)
+        for i in range(3):
+            hvd.allreduce(tensor, name='test_metrics_%d' % i)
+        after = hvd.metrics()
+
+        for key in ['negotiation_micros', 'queue_micros', 'fused_bytes',
+                    'responses_per_cycle', 'ready_event_wait_micros']:
+            assert key in after
+        assert after['queue_micros']['count'] - \
+            before['queue_micros']['count'] >= 3
+        assert after['fused_bytes']['sum'] - \
+            before['fused_bytes']['sum'] == 3 * 1024 * 4
+        mpi = after['backends']['mpi']
+        assert mpi['operations'] - before['backends']['mpi']['operations'] == 3
+        assert mpi['bytes'] - before['backends']['mpi']['bytes'] == 3 * 1024 * 4
+
+    def test_horovod_metrics_stragglers(self):
+        """Test that the coordinator reports the lag of every rank."""
+        hvd.init()
+        tensor = torch.FloatTensor(16).fill_(1)
+        for i in range(3):
+            hvd.allreduce(tensor, name='test_metrics_stragglers_%d' % i)
+        stragglers = hvd.metrics()['stragglers']
+
+        if hvd.rank() == 0:
+            ranks = [lag['rank'] for lag in stragglers['ranks']]
+            assert ranks == list(range(hvd.size())), stragglers
+            for lag in stragglers['ranks']:
+                assert lag['tensor_lag_micros']['p50'] <= \
+                    lag['tensor_lag_micros']['p99']
+        else:
+            assert stragglers['ranks'] == [], stragglers
+
+    def test_horovod_metrics_buffers(self):
+        """Test that fusion buffers are sized for the data fused into them."""
+        hvd.init()
+        tensors = [torch.FloatTensor(1024).fill_(1) for _ in range(4)]
+        hvd.grouped_allreduce(tensors, name='test_metrics_buffers')
+        buffers = hvd.metrics()['buffers']
+        assert buffers['fusion_bytes'] >= 4 * 1024 * 4, buffers
+        assert buffers['fusion_bytes'] < 64 * 1024 * 1024, buffers
+        assert buffers['shared_bytes'] >= 0, buffers
+        assert buffers['budget_bytes'] >= 0, buffers
+
     def test_horovod_allreduce(self):
         """Test that the allreduce correctly sums 1D, 2D, 3D tensors."""
         hvd.init()
@@ -107,6 +169,48 @@ class TorchTests(unittest.TestCase):
 
             assert max_difference <= threshold, 'hvd.allreduce produces incorrect results'
 
+    def test_horovod_allreduce_fp16_fused(self):
+        """Test that the allreduce with compression in the fusion buffer
+        correctly sums float32 tensors and leaves other types uncompressed."""
+        hvd.init()
+        size = hvd.size()
+        dtypes = [torch.IntTensor, torch.FloatTensor, torch.DoubleTensor]
+        if torch.cuda.is_available():
+            dtypes += [torch.cuda.IntTensor, torch.cuda.FloatTensor,
+                       torch.cuda.DoubleTensor]
+        dims = [1, 2, 3]
+        for dtype, dim in itertools.product(dtypes, dims):
+            torch.manual_seed(1234)
+            # Small integers are exact in float16.
+            tensor = torch.FloatTensor(*([17] * dim)).random_(-100, 100)
+            tensor = tensor.type(dtype)
+            summed = hvd.allreduce(tensor, average=False,
+                                   compression=hvd.Compression.fp16_fused)
+            assert summed.type() == tensor.type()
+            multiplied = tensor * size
+            max_difference = summed.data.sub(multiplied).abs().max()
+            assert max_difference == 0, 'hvd.allreduce produces incorrect results'
+
+    def test_horovod_allreduce_int8(self):
+        """Test that the allreduce with 8-bit quantization sums CPU tensors
+        up to the quantization error."""
+        hvd.init()
+        size = hvd.size()
+        dims = [1, 2, 3]
+        for dim in dims:
+            torch.manual_seed(1234)
+            tensor = torch.FloatTensor(*([17] * dim)).random_(-100, 100)
+            summed = hvd.allreduce(tensor, average=False,
+                                   name='allreduce_int8_%d' % dim,
+                                   compression=hvd.Compression.int8)
+            multiplied = tensor * size
+            max_difference = summed.data.sub(multiplied).abs().max()
+
+            # Values are rounded once on every rank and once more after they
+            # are summed up, each time by less than 1/127 of their maximum.
+            threshold = 3 * size * 100 / 127.0
+            assert max_difference <= threshold, 'hvd.allreduce produces incorrect results'
+
     def test_horovod_allreduce_average(self):
         """Test that the allreduce correctly sums 1D, 2D, 3D tensors."""
         hvd.init()
@@ -140,6 +244,33 @@ class TorchTests(unittest.TestCase):
 
             assert max_difference <= threshold, 'hvd.allreduce produces incorrect results'
 
+    def test_horovod_grouped_allreduce(self):
+        """Test that the grouped allreduce correctly sums a list of tensors of
+        different types and shapes."""
+        # Grouped allreduce is only supported with the PyTorch v2 API.
+        if LooseVersion(torch.__version__) < LooseVersion('1.0.0'):
+            return
+
+        hvd.init()
+        size = hvd.size()
+        dtypes = [torch.IntTensor, torch.LongTensor,
+                  torch.FloatTensor, torch.DoubleTensor]
+        if torch.cuda.is_available():
+            dtypes += [torch.cuda.IntTensor, torch.cuda.FloatTensor]
+        tensors = [torch.FloatTensor(*([17] * dim)).fill_(dim).type(dtype)
+                   for dtype in dtypes for dim in [1, 2, 3]]
+        summed = hvd.grouped_allreduce(tensors, average=False)
+        assert len(summed) == len(tensors)
+        for tensor, result in zip(tensors, summed):
+            assert result.type() == tensor.type()
+            assert torch.equal(result, tensor * size), \
+                'hvd.grouped_allreduce produces incorrect results'
+
+        averaged = hvd.synchronize(hvd.grouped_allreduce_async(tensors[:3]))
+        for tensor, result in zip(tensors[:3], averaged):
+            assert torch.equal(result, tensor), \
+                'hvd.grouped_allreduce_async produces incorrect results'
+
     def test_horovod_allreduce_inplace(self):
         """Test that the allreduce correctly sums 1D, 2D, 3D tensors."""
         hvd.init()
@@ -227,6 +358,67 @@ class TorchTests(unittest.TestCase):
 
             assert max_difference <= threshold, 'hvd.allreduce produces incorrect results'
 
+    def test_horovod_allreduce_partitioned(self):
+        """Test that the allreduce of tensors split into parts by
+        HOROVOD_PARTITION_THRESHOLD gives the same sums as without parts."""
+        if MPI is None:
+            self.skipTest('mpi4py is required to restart Horovod')
+        hvd.init()
+        # Parts have at most 1024 bytes. Only the (32, 64) tensors are split
+        # into parts of the same size.
+        shapes = [(3001,), (32, 64), (17, 19, 13)]
+        dtypes = [torch.IntTensor, torch.FloatTensor, torch.DoubleTensor]
+        tensors = []
+        for dtype, shape in itertools.product(dtypes, shapes):
+            torch.manual_seed(1234 + hvd.rank())
+            tensor = torch.FloatTensor(*shape).random_(-100, 100).type(dtype)
+            tensors.append(tensor)
+        expected = [hvd.allreduce(tensor, average=False) for tensor in tensors]
+
+        self.restart_horovod(HOROVOD_PARTITION_THRESHOLD='1024')
+        try:
+            handles = [hvd.allreduce_async(tensor, average=False)
+                       for tensor in tensors]
+            for tensor, handle, summed in zip(tensors, handles, expected):
+                partitioned = hvd.synchronize(handle)
+                assert partitioned.shape == tensor.shape
+                # The values are integers, so the sums are exact.
+                assert torch.equal(partitioned, summed), \
+                    'hvd.allreduce produces incorrect results with partitions'
+        finally:
+            self.restart_horovod()
+
+    def test_horovod_allreduce_tcp_ring(self):
+        """Test that the allreduce over the TCP ring with several connections
+        gives the same sums as over MPI."""
+        if MPI is None:
+            self.skipTest('mpi4py is required to restart Horovod')
+        hvd.init()
+        if hvd.size() == 1:
+            self.skipTest('the TCP ring needs more than one process')
+        # Neither count is divisible by size * 3 connections, and the second
+        # one leaves some connections without elements.
+        counts = [10001, 5]
+        dtypes = [torch.IntTensor, torch.LongTensor,
+                  torch.FloatTensor, torch.DoubleTensor]
+        tensors = []
+        for dtype, count in itertools.product(dtypes, counts):
+            torch.manual_seed(1234 + hvd.rank())
+            tensor = torch.FloatTensor(count).random_(-100, 100).type(dtype)
+            tensors.append(tensor)
+        expected = [hvd.allreduce(tensor, average=False) for tensor in tensors]
+
+        self.restart_horovod(HOROVOD_CPU_OPERATIONS='tcp',
+                             HOROVOD_TCP_RING_CONNECTIONS='3')
+        try:
+            for tensor, summed in zip(tensors, expected):
+                ring_summed = hvd.allreduce(tensor, average=False)
+                # The values are integers, so the sums are exact.
+                assert torch.equal(ring_summed, summed), \
+                    'hvd.allreduce produces incorrect results over TCP'
+        finally:
+            self.restart_horovod()
+
     def test_horovod_allreduce_multi_gpu(self):
         """Test that the allreduce works on multiple GPUs."""
         # Only do this test if there are GPUs available.
@@ -267,6 +459,147 @@ class TorchTests(unittest.TestCase):
 
             assert max_difference <= threshold, 'hvd.allreduce produces incorrect results'
 
+    def test_horovod_allreduce_priority(self):
+        """Test that allreduces with different priorities that are ready at
+        the same time all produce correct results."""
+        hvd.init()
+        size = hvd.size()
+        tests = []
+        for priority in range(-2, 3):
+            torch.manual_seed(1234)
+            tensor = torch.FloatTensor(17, 17).random_(-100, 100)
+            handle = hvd.allreduce_async(tensor, average=False,
+                                         name='priority.%d' % priority,
+                                         priority=priority)
+            tests.append((tensor * size, handle))
+
+        for multiplied, handle in tests:
+            summed = hvd.synchronize(handle)
+            max_difference = summed.sub(multiplied).max()
+            assert max_difference <= 0, 'hvd.allreduce produces incorrect results'
+
+    def test_horovod_allreduce_accumulation(self):
+        """Test that accumulated allreduces sum up the tensors of all steps
+        before they are allreduced."""
+        hvd.init()
+        size = hvd.size()
+        steps = 3
+        for dtype in [torch.FloatTensor, torch.DoubleTensor]:
+            torch.manual_seed(1234)
+            tensors = [dtype(17, 17).random_(-100, 100) for _ in range(steps)]
+            handles = [hvd.allreduce_async(tensor, average=False,
+                                           name='accumulation.%s' % dtype.__name__,
+                                           accumulation_steps=steps)
+                       for tensor in tensors]
+            outputs = hvd.synchronize_all(handles)
+            expected = sum(tensors) * size
+            max_difference = outputs[-1].sub(expected).abs().max()
+            assert max_difference <= 1e-4, 'hvd.allreduce produces incorrect results'
+
+    def test_horovod_allreduce_local_replicas(self):
+        """Test that the replicas of a tensor on several GPUs of a process are
+        summed up locally and their sum is allreduced into all of them."""
+        # Only do this test if every process has two GPUs.
+        if not torch.cuda.is_available():
+            return
+
+        hvd.init()
+        local_rank = hvd.local_rank()
+        size = hvd.size()
+        if torch.cuda.device_count() < 2 * hvd.local_size():
+            return
+
+        torch.manual_seed(1234)
+        tensor = torch.FloatTensor(17, 17).random_(-100, 100)
+        replicas = [tensor.cuda(local_rank * 2 + i) for i in range(2)]
+        try:
+            handles = [hvd.allreduce_async(replica, average=False,
+                                           name='local_replicas',
+                                           local_replicas=2)
+                       for replica in replicas]
+        except RuntimeError as e:
+            # Local replicas need NCCL.
+            assert 'NCCL' in str(e)
+            return
+        for output in hvd.synchronize_all(handles):
+            max_difference = output.cpu().sub(tensor * 2 * size).abs().max()
+            assert max_difference <= 1e-4, 'hvd.allreduce produces incorrect results'
+
+    def test_horovod_allreduce_local_replicas_type_error(self):
+        """Test that the allreduce of local replicas raises an error for types
+        which NCCL can't sum up."""
+        if not torch.cuda.is_available():
+            return
+
+        hvd.init()
+        tensor = torch.cuda.ByteTensor(17, 17)
+        try:
+            hvd.allreduce_async(tensor, name='local_replicas_type_error',
+                                local_replicas=2)
+            assert False, 'hvd.allreduce_async did not throw error'
+        except (torch.FatalError, RuntimeError):
+            pass
+
+    def test_horovod_allreduce_scope(self):
+        """Test that scoped allreduces only sum up the tensors within every
+        node or across nodes."""
+        hvd.init()
+        size = hvd.size()
+        local_size = hvd.local_size()
+        torch.manual_seed(1234)
+        tensor = torch.FloatTensor(17, 17).random_(-100, 100)
+        for scope, scope_size in [(hvd.ReduceScope.local, local_size),
+                                  (hvd.ReduceScope.cross, size // local_size)]:
+            summed = hvd.synchronize(hvd.allreduce_async(
+                tensor, average=False, scope=scope))
+            max_difference = summed.sub(tensor * scope_size).abs().max()
+            assert max_difference <= 1e-4, 'hvd.allreduce produces incorrect results'
+
+            averaged = hvd.synchronize(hvd.allreduce_async(tensor, scope=scope))
+            max_difference = averaged.sub(tensor).abs().max()
+            assert max_difference <= 1e-4, 'hvd.allreduce produces incorrect results'
+
+    def test_horovod_synchronize_all(self):
+        """Test that synchronize_all and wait_any return the results of a
+        list of asynchronous allreduces."""
+        hvd.init()
+        size = hvd.size()
+        tensors = [torch.FloatTensor(17 * (i + 1)).random_(-100, 100)
+                   for i in range(5)]
+        handles = [hvd.allreduce_async(tensor, average=False)
+                   for tensor in tensors]
+
+        done = hvd.wait_any(handles)
+        assert done in handles, 'hvd.wait_any returned an unknown handle'
+        assert hvd.poll(done), 'hvd.wait_any returned a pending handle'
+
+        outputs = hvd.synchronize_all(handles)
+        assert len(outputs) == len(tensors)
+        for tensor, output in zip(tensors, outputs):
+            max_difference = output.sub(tensor * size).max()
+            assert max_difference <= 0, 'hvd.synchronize_all produces incorrect results'
+
+    def test_horovod_mark_step(self):
+        """Test that unnamed operations are named after their order within
+        the step once mark_step() has been called."""
+        hvd.init()
+        size = hvd.size()
+        try:
+            for _ in range(3):
+                hvd.mark_step()
+                tensor = torch.FloatTensor(17).random_(-100, 100)
+                handles = [hvd.allreduce_async(tensor, average=False)
+                           for _ in range(2)]
+
+                # The next unnamed operation is the third one of the step.
+                assert hvd.mpi_ops._encode_name(None) == b'step.2'
+
+                for summed in hvd.synchronize_all(handles):
+                    max_difference = summed.sub(tensor * size).max()
+                    assert max_difference <= 0, 'hvd.allreduce produces incorrect results'
+        finally:
+            hvd.mpi_ops._step_op_index = None
+
     def test_horovod_allreduce_error(self):
         """Test that the allreduce raises an error if different ranks try to
         send tensors of different rank or dimension."""
@@ -325,6 +658,24 @@ class TorchTests(unittest.TestCase):
         except (torch.FatalError, RuntimeError):
             pass
 
+    def test_horovod_allreduce_priority_error(self):
+        """Test that the allreduce raises an error if different ranks use
+        different priorities for a tensor."""
+        hvd.init()
+        rank = hvd.rank()
+        size = hvd.size()
+
+        # This test does not apply if there is only one worker.
+        if size == 1:
+            return
+
+        tensor = torch.FloatTensor(17, 17).random_(-100, 100)
+        try:
+            hvd.synchronize(hvd.allreduce_async(tensor, priority=rank))
+            assert False, 'hvd.allreduce did not throw error'
+        except (torch.FatalError, RuntimeError):
+            pass
+
     def test_horovod_allreduce_cpu_gpu_error(self):
         """Test that the allreduce raises an error if different ranks try to
         perform reduction on CPU and GPU."""
@@ -502,6 +853,128 @@ class TorchTests(unittest.TestCase):
                 assert rank_tensor.data.min() == i
                 assert rank_tensor.data.max() == i
 
+    def test_horovod_allgather_fused_large(self):
+        """Test that large fused allgathers of tensors with different sizes
+        on every rank gather straight into the outputs."""
+        hvd.init()
+        rank = hvd.rank()
+        size = hvd.size()
+
+        # Each rank contributes 4 MB per tensor, so that the fused response
+        # is larger than the default HOROVOD_ALLGATHER_ZERO_COPY_THRESHOLD.
+        rows = [1024 + i for i in range(size)]
+        tensors = [torch.FloatTensor(rows[rank] + j, 1024).fill_(rank * 10 + j)
+                   for j in range(3)]
+        handles = [hvd.allgather_async(t, name='test_allgather_fused_large_%d' % j)
+                   for j, t in enumerate(tensors)]
+        for j, handle in enumerate(handles):
+            gathered = hvd.synchronize(handle)
+            assert list(gathered.shape) == [sum(rows) + size * j, 1024]
+            offset = 0
+            for i in range(size):
+                part = gathered[offset:offset + rows[i] + j]
+                assert part.min() == i * 10 + j and part.max() == i * 10 + j
+                offset += rows[i] + j
+
+    def test_horovod_sparse_allreduce(self):
+        """Test that the sparse allreduce gathers the rows and indices of all
+        ranks, and sums up rows with the same index if asked to."""
+        # Sparse allreduce is only supported with the PyTorch v2 API.
+        if LooseVersion(torch.__version__) < LooseVersion('1.0.0'):
+            return
+
+        hvd.init()
+        rank = hvd.rank()
+        size = hvd.size()
+
+        dtypes = [torch.FloatTensor, torch.DoubleTensor]
+        if torch.cuda.is_available():
+            dtypes += [torch.cuda.FloatTensor]
+        for dtype in dtypes:
+            # Every rank sends a row for index 0 and one for index rank + 1.
+            values = torch.FloatTensor(2, 5).fill_(rank + 1).type(dtype)
+            indices = torch.LongTensor([0, rank + 1])
+
+            gathered, gathered_indices = hvd.sparse_allreduce(
+                values, indices, average=False)
+            expected_indices = []
+            for i in range(size):
+                expected_indices += [0, i + 1]
+            assert gathered_indices.tolist() == expected_indices
+            assert list(gathered.shape) == [2 * size, 5]
+            for i in range(size):
+                assert gathered[2 * i:2 * i + 2].min() == i + 1
+                assert gathered[2 * i:2 * i + 2].max() == i + 1
+
+            summed, summed_indices = hvd.sparse_allreduce(
+                values, indices, average=False, deduplicate=True)
+            assert summed.type() == values.type()
+            assert summed_indices.tolist() == list(range(size + 1))
+            assert list(summed.shape) == [size + 1, 5]
+            assert summed[0].min() == size * (size + 1) / 2
+            assert summed[0].max() == size * (size + 1) / 2
+            for i in range(size):
+                assert summed[i + 1].min() == i + 1
+                assert summed[i + 1].max() == i + 1
+
+    def test_horovod_reducescatter(self):
+        """Test that the reducescatter sums the tensor and returns the rows of
+        the sum that belong to this rank."""
+        # Reducescatter is only supported with the PyTorch v2 API.
+        if LooseVersion(torch.__version__) < LooseVersion('1.0.0'):
+            return
+
+        hvd.init()
+        rank = hvd.rank()
+        size = hvd.size()
+
+        dtypes = [torch.IntTensor, torch.LongTensor,
+                  torch.FloatTensor, torch.DoubleTensor]
+        for dtype in dtypes:
+            # The rows can't be split up evenly, the first rank gets one more.
+            tensor = torch.arange(2 * size + 1).view(-1, 1).type(dtype)
+            tensor = tensor.repeat(1, 3)
+            reduced = hvd.reducescatter(tensor)
+            rows = 3 if rank == 0 else 2
+            offset = 0 if rank == 0 else 2 * rank + 1
+            expected = tensor.narrow(0, offset, rows) * size
+            assert reduced.type() == tensor.type()
+            assert list(reduced.shape) == [rows, 3]
+            assert torch.equal(reduced, expected)
+
+    def test_horovod_alltoall(self):
+        """Test that the alltoall sends the rows given by the splits to every
+        rank."""
+        # Alltoall is only supported with the PyTorch v2 API.
+        if LooseVersion(torch.__version__) < LooseVersion('1.0.0'):
+            return
+
+        hvd.init()
+        rank = hvd.rank()
+        size = hvd.size()
+
+        dtypes = [torch.ByteTensor, torch.IntTensor, torch.LongTensor,
+                  torch.FloatTensor, torch.DoubleTensor]
+        for dtype in dtypes:
+            # Every rank sends i + 1 rows holding its rank to rank i.
+            splits = [i + 1 for i in range(size)]
+            tensor = torch.FloatTensor(sum(splits), 4).fill_(rank).type(dtype)
+            received = hvd.alltoall(tensor, splits)
+            assert received.type() == tensor.type()
+            assert list(received.shape) == [(rank + 1) * size, 4]
+            for i in range(size):
+                rows = received.narrow(0, i * (rank + 1), rank + 1)
+                assert rows.min() == i
+                assert rows.max() == i
+
+            # Without splits, the rows are split up evenly.
+            tensor = torch.FloatTensor(2 * size, 4).fill_(rank).type(dtype)
+            received = hvd.alltoall(tensor)
+            assert list(received.shape) == [2 * size, 4]
+            for i in range(size):
+                assert received.narrow(0, 2 * i, 2).min() == i
+                assert received.narrow(0, 2 * i, 2).max() == i
+
     def test_horovod_allgather_error(self):
         """Test that the allgather returns an error if any dimension besides
         the first is different among the tensors being gathered."""